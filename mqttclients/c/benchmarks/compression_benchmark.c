@@ -0,0 +1,333 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <zdict.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAS_CYCLES 1
+#else
+#define HAS_CYCLES 0
+#endif
+
+#include "geo_json_handler.h"
+#include "logging.h"
+#include "mosquitto.h"
+#include "mqtt_compression.h"
+#include "mqtt_protocol.h"
+#include "mqtt_setup.h"
+#include "position_codec.h"
+#include "position_trajectory.h"
+
+#define DEFAULT_BENCHMARK_MESSAGES 200000
+#define POSITIONS 1024
+#define BATCH_SIZE 16
+#define TRAINING_POSITIONS 4096
+#define DICTIONARY_SIZE 4096
+#define MAX_PAYLOAD_LENGTH 1024
+#define STEP_SECONDS 5.0
+#define BENCHMARK_SEED 1
+#define TRAINING_SEED 2
+
+/*
+ * Measures mqtt_compression on telemetry positions written as GeoJSON Points, and as MultiPoints
+ * of BATCH_SIZE positions like position_batcher writes them, per message:
+ *   payload     bytes of the GeoJSON payload
+ *   compressed  bytes of the zstd frame
+ *   ratio       payload / compressed
+ *   compress    ns and cycles per payload byte in mqtt_compression_compress()
+ *   decompress  ns and cycles per payload byte in mqtt_compression_decompress_message(), as
+ *               on_message calls it, with the content-encoding property lookup
+ * Each payload is compressed without a dictionary and with a dictionary trained by ZDICT (like
+ * tools/dictionary_trainer.c does) on a separate walk of positions, or with the dictionary in
+ * BENCHMARK_DICTIONARY. Cycles are read with rdtsc, so they are only printed on x86, and they count
+ * reference cycles at the nominal frequency. No broker is needed.
+ *
+ * Extra settings:
+ *   BENCHMARK_MESSAGES    number of messages compressed and decompressed per case (default 200000)
+ *   BENCHMARK_LEVEL       the zstd level (default MQTT_COMPRESSION_DEFAULT_LEVEL)
+ *   BENCHMARK_DICTIONARY  a dictionary file to use instead of training one (default unset)
+ */
+
+typedef struct payloads
+{
+  char* data[POSITIONS];
+  int lengths[POSITIONS];
+  size_t total_length;
+} payloads;
+
+static double elapsed_ns(const struct timespec* start, const struct timespec* end)
+{
+  return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+static unsigned long long cycles()
+{
+#if HAS_CYCLES
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+/* A vehicle driving like the telemetry producer's, a position every STEP_SECONDS. */
+static bool walk(geojson_coordinates* positions, int count, uint64_t seed)
+{
+  geojson_coordinates center = { .x = -122.335, .y = 47.608 };
+  trajectory_fleet* vehicle = trajectory_fleet_create(1, trajectory_settings_default(center), seed);
+  if (vehicle == NULL)
+  {
+    return false;
+  }
+  for (int i = 0; i < count; i++)
+  {
+    trajectory_fleet_step(vehicle, STEP_SECONDS);
+    positions[i] = trajectory_fleet_position(vehicle, 0);
+  }
+  trajectory_fleet_destroy(vehicle);
+  return true;
+}
+
+/* Writes each position, or each batch of batch_size positions from it, as a GeoJSON payload. */
+static bool write_payloads(
+    const geojson_coordinates* positions,
+    int count,
+    int batch_size,
+    payloads* output)
+{
+  mosquitto_payload payload = mosquitto_payload_init(MAX_PAYLOAD_LENGTH);
+  geojson_geometry batch = geojson_geometry_init();
+  bool result = true;
+
+  output->total_length = 0;
+  for (int i = 0; i < count && result; i++)
+  {
+    result = geojson_geometry_reset(&batch, GEOJSON_MULTI_POINT, batch_size, 0);
+    for (int j = 0; j < batch_size && result; j++)
+    {
+      geojson_coordinates position = positions[(i + j) % count];
+      result = geojson_geometry_add_position(&batch, position.x, position.y);
+    }
+    result = result
+        && positions_to_mosquitto_payload(POSITION_ENCODING_JSON, &batch, &payload) == 0
+        && (output->data[i] = malloc(payload.payload_length + 1)) != NULL;
+    if (result)
+    {
+      memcpy(output->data[i], payload.payload, payload.payload_length);
+      output->data[i][payload.payload_length] = '\0';
+      output->lengths[i] = (int)payload.payload_length;
+      output->total_length += payload.payload_length;
+    }
+  }
+
+  geojson_geometry_destroy(&batch);
+  mosquitto_payload_destroy(&payload);
+  return result;
+}
+
+static void free_payloads(payloads* payloads)
+{
+  for (int i = 0; i < POSITIONS; i++)
+  {
+    free(payloads->data[i]);
+  }
+}
+
+/* Trains a dictionary on the single positions and the batches of another walk. */
+static mqtt_compression* train(int level)
+{
+  geojson_coordinates* positions = malloc(TRAINING_POSITIONS * sizeof(geojson_coordinates));
+  char* samples = malloc(TRAINING_POSITIONS * MAX_PAYLOAD_LENGTH);
+  size_t* sizes = malloc(TRAINING_POSITIONS * sizeof(size_t));
+  mosquitto_payload payload = mosquitto_payload_init(MAX_PAYLOAD_LENGTH);
+  geojson_geometry batch = geojson_geometry_init();
+  char dictionary[DICTIONARY_SIZE];
+  mqtt_compression* compression = NULL;
+  size_t length = 0;
+  bool result = positions != NULL && samples != NULL && sizes != NULL
+      && walk(positions, TRAINING_POSITIONS, TRAINING_SEED);
+
+  for (int i = 0; i < TRAINING_POSITIONS && result; i++)
+  {
+    /* Every other sample is a batch. */
+    int batch_size = i % 2 == 0 ? 1 : BATCH_SIZE;
+    result = geojson_geometry_reset(&batch, GEOJSON_MULTI_POINT, batch_size, 0);
+    for (int j = 0; j < batch_size && result; j++)
+    {
+      geojson_coordinates position = positions[(i + j) % TRAINING_POSITIONS];
+      result = geojson_geometry_add_position(&batch, position.x, position.y);
+    }
+    result = result
+        && positions_to_mosquitto_payload(POSITION_ENCODING_JSON, &batch, &payload) == 0;
+    if (result)
+    {
+      memcpy(samples + length, payload.payload, payload.payload_length);
+      sizes[i] = payload.payload_length;
+      length += payload.payload_length;
+    }
+  }
+
+  if (result)
+  {
+    length
+        = ZDICT_trainFromBuffer(dictionary, sizeof(dictionary), samples, sizes, TRAINING_POSITIONS);
+    if (ZDICT_isError(length))
+    {
+      LOG_ERROR("Failed to train a dictionary: %s", ZDICT_getErrorName(length));
+    }
+    else
+    {
+      compression = mqtt_compression_create(dictionary, length, level);
+    }
+  }
+
+  geojson_geometry_destroy(&batch);
+  mosquitto_payload_destroy(&payload);
+  free(sizes);
+  free(samples);
+  free(positions);
+  return compression;
+}
+
+static int run(
+    const char* name,
+    const mqtt_compression* compression,
+    const payloads* payloads,
+    int message_count)
+{
+  char* frames[POSITIONS] = { 0 };
+  struct mosquitto_message messages[POSITIONS] = { 0 };
+  struct mosquitto_message output;
+  mosquitto_property* props = NULL;
+  struct timespec start, end;
+  size_t compressed_bytes = 0;
+  int failures = 0;
+
+  mqtt_compression_add_property(&props);
+
+  /* Keep a copy of each frame to decompress, the compressed output is reused. */
+  for (int i = 0; i < POSITIONS; i++)
+  {
+    const void* frame;
+    int frame_length;
+    if (mqtt_compression_compress(
+            compression, payloads->data[i], payloads->lengths[i], &frame, &frame_length)
+            != MOSQ_ERR_SUCCESS
+        || (frames[i] = malloc(frame_length)) == NULL)
+    {
+      failures++;
+      continue;
+    }
+    memcpy(frames[i], frame, frame_length);
+    messages[i].topic = "vehicles/vehicle01/position";
+    messages[i].payload = frames[i];
+    messages[i].payloadlen = frame_length;
+    compressed_bytes += frame_length;
+  }
+
+  size_t payload_bytes = 0;
+  unsigned long long start_cycles = cycles();
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < message_count && failures == 0; i++)
+  {
+    const void* frame;
+    int frame_length;
+    int index = i % POSITIONS;
+    failures += mqtt_compression_compress(
+                    compression,
+                    payloads->data[index],
+                    payloads->lengths[index],
+                    &frame,
+                    &frame_length)
+        != MOSQ_ERR_SUCCESS;
+    payload_bytes += payloads->lengths[index];
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double compress_cycles = (double)(cycles() - start_cycles) / payload_bytes;
+  double compress_ns = elapsed_ns(&start, &end) / payload_bytes;
+
+  start_cycles = cycles();
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < message_count && failures == 0; i++)
+  {
+    int index = i % POSITIONS;
+    failures += mqtt_compression_decompress_message(compression, &messages[index], props, &output)
+            != MOSQ_ERR_SUCCESS
+        || output.payloadlen != payloads->lengths[index];
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double decompress_cycles = (double)(cycles() - start_cycles) / payload_bytes;
+  double decompress_ns = elapsed_ns(&start, &end) / payload_bytes;
+
+  printf(
+      "%-22s %8.1f %10.1f %6.2f %11.2f %10.2f %13.2f %12.2f %9d\n",
+      name,
+      (double)payloads->total_length / POSITIONS,
+      (double)compressed_bytes / POSITIONS,
+      compressed_bytes > 0 ? (double)payloads->total_length / compressed_bytes : 0,
+      compress_ns,
+      HAS_CYCLES ? compress_cycles : 0,
+      decompress_ns,
+      HAS_CYCLES ? decompress_cycles : 0,
+      failures);
+
+  for (int i = 0; i < POSITIONS; i++)
+  {
+    free(frames[i]);
+  }
+  mosquitto_property_free_all(&props);
+  return failures == 0 ? MOSQ_ERR_SUCCESS : MOSQ_ERR_UNKNOWN;
+}
+
+int main(int argc, char* argv[])
+{
+  geojson_coordinates positions[POSITIONS];
+  payloads points = { 0 };
+  payloads batches = { 0 };
+  mqtt_compression* no_dictionary = NULL;
+  mqtt_compression* dictionary = NULL;
+  char* dictionary_file;
+  int message_count;
+  int level;
+  int result = MOSQ_ERR_UNKNOWN;
+
+  if (!set_int_connection_setting(
+          &message_count, "BENCHMARK_MESSAGES", DEFAULT_BENCHMARK_MESSAGES)
+      || message_count <= 0
+      || !set_int_connection_setting(&level, "BENCHMARK_LEVEL", MQTT_COMPRESSION_DEFAULT_LEVEL)
+      || !set_char_connection_setting(&dictionary_file, "BENCHMARK_DICTIONARY", false))
+  {
+    return MOSQ_ERR_INVAL;
+  }
+
+  if (walk(positions, POSITIONS, BENCHMARK_SEED)
+      && write_payloads(positions, POSITIONS, 1, &points)
+      && write_payloads(positions, POSITIONS, BATCH_SIZE, &batches)
+      && (no_dictionary = mqtt_compression_create(NULL, 0, level)) != NULL
+      && (dictionary = dictionary_file != NULL ? mqtt_compression_load(dictionary_file, level)
+                                               : train(level))
+          != NULL)
+  {
+    printf(
+        "level %d, batches of %d positions, %s dictionary%s\n",
+        level,
+        BATCH_SIZE,
+        dictionary_file != NULL ? dictionary_file : "trained",
+        HAS_CYCLES ? "" : ", no cycle counter on this CPU");
+    printf("message                 payload compressed  ratio compress ns/B cycles/B "
+           "decompress ns/B cycles/B  failures\n");
+    result = run("point", no_dictionary, &points, message_count);
+    result |= run("point, dictionary", dictionary, &points, message_count);
+    result |= run("batch", no_dictionary, &batches, message_count);
+    result |= run("batch, dictionary", dictionary, &batches, message_count);
+  }
+
+  mqtt_compression_destroy(no_dictionary);
+  mqtt_compression_destroy(dictionary);
+  free_payloads(&points);
+  free_payloads(&batches);
+  return result;
+}
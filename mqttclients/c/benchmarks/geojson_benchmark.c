@@ -0,0 +1,214 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <json-c/json.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "geo_json_handler.h"
+#include "logging.h"
+#include "mosquitto.h"
+#include "mqtt_setup.h"
+
+#define DEFAULT_BENCHMARK_MESSAGES 1000000
+#define PAYLOADS 1024
+#define MAX_PAYLOAD_LENGTH 64
+#define BATCH_SIZE 64
+
+/*
+ * Compares the cost of parsing the telemetry samples' GeoJSON Point payloads, in ns and heap
+ * allocations per message:
+ *   json-c       the previous implementation: geojson_point_init() and json_tokener_parse() for
+ *                every message
+ *   point        mosquitto_payload_to_geojson_point() with geojson_point_init() for every message
+ *   coordinates  mosquitto_payload_to_geojson_coordinates(), the scalar single pass parser
+ *   batch        geojson_points_decode_batch() on batches of 64 messages, as used by the telemetry
+ *                consumer
+ * Allocations are counted by wrapping malloc, calloc and realloc, which works with glibc. No broker
+ * is needed.
+ *
+ * Extra settings:
+ *   BENCHMARK_MESSAGES  number of messages parsed per mode (default 1000000)
+ */
+
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+
+static unsigned long long allocations = 0;
+
+void* malloc(size_t size)
+{
+  allocations++;
+  return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size)
+{
+  allocations++;
+  return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+  allocations++;
+  return __libc_realloc(ptr, size);
+}
+
+typedef int (*parse_function)(const struct mosquitto_message* message, double* checksum);
+
+static int parse_with_json_c(const struct mosquitto_message* message, double* checksum)
+{
+  geojson_point point = geojson_point_init();
+  json_object* jobj = json_tokener_parse(message->payload);
+  json_object* type = json_object_object_get(jobj, "type");
+  json_object* coordinates = json_object_object_get(jobj, "coordinates");
+  int rc = -1;
+
+  if (type != NULL && coordinates != NULL
+      && strcmp(json_object_get_string(type), "Point") == 0)
+  {
+    strcpy(point.type, "Point");
+    point.coordinates.x = json_object_get_double(json_object_array_get_idx(coordinates, 0));
+    point.coordinates.y = json_object_get_double(json_object_array_get_idx(coordinates, 1));
+    *checksum += point.coordinates.x + point.coordinates.y;
+    rc = 0;
+  }
+
+  json_object_put(jobj);
+  geojson_point_destroy(&point);
+  return rc;
+}
+
+static int parse_point(const struct mosquitto_message* message, double* checksum)
+{
+  geojson_point point = geojson_point_init();
+  int rc = mosquitto_payload_to_geojson_point(message, &point);
+  *checksum += point.coordinates.x + point.coordinates.y;
+  geojson_point_destroy(&point);
+  return rc;
+}
+
+static int parse_coordinates(const struct mosquitto_message* message, double* checksum)
+{
+  geojson_coordinates coordinates;
+  int rc = mosquitto_payload_to_geojson_coordinates(message, &coordinates);
+  *checksum += coordinates.x + coordinates.y;
+  return rc;
+}
+
+static void print_result(
+    const char* name,
+    const struct timespec* start,
+    const struct timespec* end,
+    unsigned long long allocated,
+    int message_count,
+    int failures,
+    double checksum)
+{
+  double elapsed_ns = (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+  printf(
+      "%-12s %10.1f %14.2f %9d %16.6f\n",
+      name,
+      elapsed_ns / message_count,
+      (double)allocated / message_count,
+      failures,
+      checksum);
+}
+
+static void run(
+    const char* name,
+    parse_function parse,
+    const struct mosquitto_message* messages,
+    int message_count)
+{
+  struct timespec start, end;
+  double checksum = 0;
+  int failures = 0;
+
+  unsigned long long allocations_before = allocations;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < message_count; i++)
+  {
+    failures += parse(&messages[i % PAYLOADS], &checksum) != 0;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  print_result(
+      name, &start, &end, allocations - allocations_before, message_count, failures, checksum);
+}
+
+static void run_batch(const struct mosquitto_message* messages, int message_count)
+{
+  const struct mosquitto_message* batch[BATCH_SIZE];
+  geojson_coordinates_batch coordinates = geojson_coordinates_batch_init(BATCH_SIZE);
+  struct timespec start, end;
+  double checksum = 0;
+  int failures = 0;
+
+  unsigned long long allocations_before = allocations;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < message_count; i += BATCH_SIZE)
+  {
+    int count = message_count - i < BATCH_SIZE ? message_count - i : BATCH_SIZE;
+    for (int j = 0; j < count; j++)
+    {
+      batch[j] = &messages[(i + j) % PAYLOADS];
+    }
+    failures += count - geojson_points_decode_batch(batch, count, &coordinates);
+    for (int j = 0; j < count; j++)
+    {
+      checksum += coordinates.x[j] + coordinates.y[j];
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  print_result(
+      "batch", &start, &end, allocations - allocations_before, message_count, failures, checksum);
+
+  geojson_coordinates_batch_destroy(&coordinates);
+}
+
+int main(int argc, char* argv[])
+{
+  struct mosquitto_message messages[PAYLOADS] = { 0 };
+  mosquitto_payload payloads[PAYLOADS];
+  int message_count;
+
+  if (!set_int_connection_setting(
+          &message_count, "BENCHMARK_MESSAGES", DEFAULT_BENCHMARK_MESSAGES)
+      || message_count <= 0)
+  {
+    return MOSQ_ERR_INVAL;
+  }
+
+  /* The same payloads the telemetry producer sends. */
+  srand(1);
+  for (int i = 0; i < PAYLOADS; i++)
+  {
+    geojson_point point = geojson_point_init();
+    strcpy(point.type, "Point");
+    geojson_point_set_coordinates(
+        &point, rand() / (double)RAND_MAX * 360 - 180, rand() / (double)RAND_MAX * 180 - 90);
+    payloads[i] = mosquitto_payload_init(MAX_PAYLOAD_LENGTH);
+    if (geojson_point_to_mosquitto_payload(point, &payloads[i]) != 0)
+    {
+      return MOSQ_ERR_UNKNOWN;
+    }
+    messages[i].payload = payloads[i].payload;
+    messages[i].payloadlen = payloads[i].payload_length;
+    geojson_point_destroy(&point);
+  }
+
+  printf("mode            ns/message  allocs/message  failures         checksum\n");
+  run("json-c", parse_with_json_c, messages, message_count);
+  run("point", parse_point, messages, message_count);
+  run("coordinates", parse_coordinates, messages, message_count);
+  run_batch(messages, message_count);
+
+  for (int i = 0; i < PAYLOADS; i++)
+  {
+    mosquitto_payload_destroy(&payloads[i]);
+  }
+  return MOSQ_ERR_SUCCESS;
+}
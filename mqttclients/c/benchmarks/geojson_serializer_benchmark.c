@@ -0,0 +1,167 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <json-c/json.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "geo_json_handler.h"
+#include "logging.h"
+#include "mosquitto.h"
+#include "mqtt_setup.h"
+
+#define DEFAULT_BENCHMARK_MESSAGES 1000000
+#define POINTS 1024
+#define MAX_PAYLOAD_LENGTH 64
+
+/*
+ * Compares the cost of serialising the telemetry producer's GeoJSON Point payloads, in messages/s
+ * per core (messages divided by the CPU time of the serialising thread) and heap allocations per
+ * message:
+ *   json-c  the previous implementation: a json-c object tree for every message, serialised with
+ *           the "%.6f" double format and copied into the payload
+ *   direct  geojson_point_to_mosquitto_payload(), which writes the payload directly
+ * Every payload of the direct writer is also compared with the json-c one. Allocations are counted
+ * by wrapping malloc, calloc and realloc, which works with glibc. No broker is needed.
+ *
+ * Extra settings:
+ *   BENCHMARK_MESSAGES  number of messages serialised per mode (default 1000000)
+ */
+
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+
+static unsigned long long allocations = 0;
+
+void* malloc(size_t size)
+{
+  allocations++;
+  return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size)
+{
+  allocations++;
+  return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+  allocations++;
+  return __libc_realloc(ptr, size);
+}
+
+typedef int (*serialise_function)(const geojson_point point, mosquitto_payload* payload);
+
+static int serialise_with_json_c(const geojson_point point, mosquitto_payload* payload)
+{
+  const char* text;
+  size_t length;
+  json_object* jobj = json_object_new_object();
+  json_object* coordinates = json_object_new_array();
+  int rc = -1;
+
+  json_c_set_serialization_double_format("%.6f", JSON_C_OPTION_THREAD);
+  json_object_array_add(coordinates, json_object_new_double(point.coordinates.x));
+  json_object_array_add(coordinates, json_object_new_double(point.coordinates.y));
+  json_object_object_add(jobj, "type", json_object_new_string(point.type));
+  json_object_object_add(jobj, "coordinates", coordinates);
+  text = json_object_to_json_string_length(jobj, JSON_C_TO_STRING_PLAIN, &length);
+  if (text != NULL && length < payload->max_payload_length)
+  {
+    strcpy(payload->payload, text);
+    payload->payload_length = length;
+    rc = 0;
+  }
+
+  json_object_put(jobj);
+  return rc;
+}
+
+static double elapsed_ns(const struct timespec* start, const struct timespec* end)
+{
+  return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+static void run(
+    const char* name,
+    serialise_function serialise,
+    const geojson_point* points,
+    mosquitto_payload* payload,
+    int message_count)
+{
+  struct timespec start, end, cpu_start, cpu_end;
+  size_t total_length = 0;
+  int failures = 0;
+
+  unsigned long long allocations_before = allocations;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+  for (int i = 0; i < message_count; i++)
+  {
+    failures += serialise(points[i % POINTS], payload) != 0;
+    total_length += payload->payload_length;
+  }
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  unsigned long long allocated = allocations - allocations_before;
+
+  double cpu_ns = elapsed_ns(&cpu_start, &cpu_end);
+  printf(
+      "%-8s %10.1f %18.0f %14.2f %9d %12.1f\n",
+      name,
+      elapsed_ns(&start, &end) / message_count,
+      message_count / (cpu_ns / 1e9),
+      (double)allocated / message_count,
+      failures,
+      (double)total_length / message_count);
+}
+
+int main(int argc, char* argv[])
+{
+  geojson_point points[POINTS];
+  mosquitto_payload expected = mosquitto_payload_init(MAX_PAYLOAD_LENGTH);
+  mosquitto_payload payload = mosquitto_payload_init(MAX_PAYLOAD_LENGTH);
+  int message_count;
+  int mismatches = 0;
+
+  if (!set_int_connection_setting(
+          &message_count, "BENCHMARK_MESSAGES", DEFAULT_BENCHMARK_MESSAGES)
+      || message_count <= 0)
+  {
+    return MOSQ_ERR_INVAL;
+  }
+
+  /* The same coordinates the telemetry producer sends. */
+  srand(1);
+  for (int i = 0; i < POINTS; i++)
+  {
+    points[i] = geojson_point_init();
+    strcpy(points[i].type, "Point");
+    geojson_point_set_coordinates(
+        &points[i], rand() / (double)RAND_MAX * 360 - 180, rand() / (double)RAND_MAX * 180 - 90);
+
+    if (serialise_with_json_c(points[i], &expected) != 0
+        || geojson_point_to_mosquitto_payload(points[i], &payload) != 0
+        || strcmp(expected.payload, payload.payload) != 0)
+    {
+      mismatches++;
+    }
+  }
+
+  printf("payloads different from json-c: %d of %d\n", mismatches, POINTS);
+  printf("mode     ns/message  messages/s/core  allocs/message  failures  bytes/message\n");
+  run("json-c", serialise_with_json_c, points, &payload, message_count);
+  run("direct", geojson_point_to_mosquitto_payload, points, &payload, message_count);
+
+  for (int i = 0; i < POINTS; i++)
+  {
+    geojson_point_destroy(&points[i]);
+  }
+  mosquitto_payload_destroy(&expected);
+  mosquitto_payload_destroy(&payload);
+  return mismatches == 0 ? MOSQ_ERR_SUCCESS : MOSQ_ERR_UNKNOWN;
+}
@@ -0,0 +1,304 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "logging.h"
+#include "mosquitto.h"
+#include "mqtt_protocol.h"
+#include "mqtt_recorder.h"
+#include "mqtt_setup.h"
+
+#define DEFAULT_BENCHMARK_MESSAGES 2000000
+#define DEFAULT_BENCHMARK_VEHICLES 10000
+#define DEFAULT_BENCHMARK_SEGMENT_MB 64
+#define DEFAULT_BENCHMARK_INGEST_RATE 500000
+#define BENCHMARK_SEEKS 1000
+#define BENCHMARK_SEED 1
+#define TOPIC_SIZE 64
+#define PAYLOAD_SIZE 96
+#define DIRECTORY_SIZE 1024
+#define POLICY_COUNT 3
+#define RECEIVE_INTERVAL_NS 1000
+#define START_NS 1700000000000000000ull
+
+/*
+ * Measures the recorder of the telemetry consumer: appends BENCHMARK_MESSAGES GeoJSON positions
+ * (default 2000000) of BENCHMARK_VEHICLES vehicles (default 10000), each with its own topic and a
+ * content type, to segments of BENCHMARK_SEGMENT_MB (default 64), once for each sync policy:
+ *   none      the kernel writes the pages back when it wants
+ *   interval  the current segment is synced every second
+ *   segment   full segments are synced before being closed
+ * It reports the records/s, MB/s, ns per record, the 99th percentile and max time of an append,
+ * the appends that waited for a segment to be closed and the syncs, then the share of a core the
+ * recorder takes at BENCHMARK_INGEST_RATE messages/s (default 500000), the rate the consumer
+ * receives at. It then reads the recording back and reports the records/s, and the ns to seek to a
+ * random time. No broker is needed.
+ *
+ * Extra settings:
+ *   BENCHMARK_MESSAGES      number of messages (default 2000000)
+ *   BENCHMARK_VEHICLES      number of topics (default 10000)
+ *   BENCHMARK_SEGMENT_MB    size of a segment (default 64)
+ *   BENCHMARK_INGEST_RATE   messages/s the consumer receives (default 500000)
+ *   BENCHMARK_DIRECTORY     where the segments are written, removed after each run (default /tmp)
+ */
+
+typedef struct benchmark_data
+{
+  char (*topics)[TOPIC_SIZE];
+  char (*payloads)[PAYLOAD_SIZE];
+  int* payload_lengths;
+  int vehicles;
+  int messages;
+  mosquitto_property* props;
+  /* The time each append took. */
+  uint64_t* append_ns;
+} benchmark_data;
+
+static uint64_t now_ns()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+static int compare_ns(const void* a, const void* b)
+{
+  uint64_t first = *(const uint64_t*)a;
+  uint64_t second = *(const uint64_t*)b;
+  return first < second ? -1 : first > second;
+}
+
+static void remove_recording(const char* directory)
+{
+  DIR* dir = opendir(directory);
+  struct dirent* entry;
+  char path[2 * DIRECTORY_SIZE];
+  if (dir == NULL)
+  {
+    return;
+  }
+  while ((entry = readdir(dir)) != NULL)
+  {
+    if (entry->d_name[0] != '.')
+    {
+      snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name);
+      unlink(path);
+    }
+  }
+  closedir(dir);
+  rmdir(directory);
+}
+
+/* Appends every message as received RECEIVE_INTERVAL_NS apart, vehicles taking turns. */
+static bool run_append(
+    benchmark_data* data,
+    const char* directory,
+    const mqtt_recorder_options* options,
+    double* total_ns,
+    mqtt_recorder_stats* stats)
+{
+  mqtt_recorder* recorder = mqtt_recorder_create(directory, options);
+  bool success = recorder != NULL;
+  uint64_t start = now_ns();
+
+  for (int i = 0; i < data->messages && success; i++)
+  {
+    int vehicle = i % data->vehicles;
+    struct mosquitto_message message = { .topic = data->topics[vehicle],
+                                         .payload = data->payloads[vehicle],
+                                         .payloadlen = data->payload_lengths[vehicle],
+                                         .qos = 1 };
+    uint64_t append_start = now_ns();
+    success = mqtt_recorder_append(
+                  recorder, &message, data->props, START_NS + (uint64_t)i * RECEIVE_INTERVAL_NS)
+        == MOSQ_ERR_SUCCESS;
+    data->append_ns[i] = now_ns() - append_start;
+  }
+  if (recorder != NULL)
+  {
+    *stats = mqtt_recorder_get_stats(recorder);
+    /* Closing the last segment is part of recording. */
+    mqtt_recorder_destroy(recorder);
+  }
+  *total_ns = (double)(now_ns() - start);
+  return success;
+}
+
+/* Reads every record back, then seeks to random times. */
+static bool run_read(benchmark_data* data, const char* directory)
+{
+  mqtt_recorder_reader* reader = mqtt_recorder_reader_open(directory);
+  mqtt_recorder_record record;
+  uint64_t start;
+  double read_ns;
+  double seek_ns;
+  int count = 0;
+  int rc;
+  bool success = true;
+
+  if (reader == NULL)
+  {
+    return false;
+  }
+  start = now_ns();
+  while ((rc = mqtt_recorder_reader_next(reader, &record)) == 1)
+  {
+    count++;
+  }
+  read_ns = (double)(now_ns() - start);
+
+  srand(BENCHMARK_SEED);
+  start = now_ns();
+  for (int i = 0; i < BENCHMARK_SEEKS && success; i++)
+  {
+    uint64_t index = (uint64_t)(rand() % data->messages);
+    success = mqtt_recorder_reader_seek(reader, START_NS + index * RECEIVE_INTERVAL_NS)
+        && mqtt_recorder_reader_next(reader, &record) == 1
+        && record.received_ns == START_NS + index * RECEIVE_INTERVAL_NS;
+  }
+  seek_ns = (double)(now_ns() - start);
+  mqtt_recorder_reader_close(reader);
+
+  if (rc != 0 || count != data->messages || !success)
+  {
+    printf("Read %d records of %d, seeks %s\n", count, data->messages, success ? "ok" : "failed");
+    return false;
+  }
+  printf(
+      "read %.0f records/s, seek %.0f ns\n", count / read_ns * 1e9, seek_ns / BENCHMARK_SEEKS);
+  return true;
+}
+
+static bool create_data(benchmark_data* data)
+{
+  data->topics = malloc(data->vehicles * sizeof(*data->topics));
+  data->payloads = malloc(data->vehicles * sizeof(*data->payloads));
+  data->payload_lengths = malloc(data->vehicles * sizeof(int));
+  data->append_ns = malloc(data->messages * sizeof(uint64_t));
+  if (data->topics == NULL || data->payloads == NULL || data->payload_lengths == NULL
+      || data->append_ns == NULL
+      || mosquitto_property_add_string(
+             &data->props, MQTT_PROP_CONTENT_TYPE, "application/geo+json")
+          != MOSQ_ERR_SUCCESS)
+  {
+    return false;
+  }
+  srand(BENCHMARK_SEED);
+  for (int i = 0; i < data->vehicles; i++)
+  {
+    snprintf(data->topics[i], TOPIC_SIZE, "vehicles/vehicle-%d/position", i);
+    data->payload_lengths[i] = snprintf(
+        data->payloads[i],
+        PAYLOAD_SIZE,
+        "{\"type\":\"Point\",\"coordinates\":[%.6f,%.6f]}",
+        -122.5 + rand() / (double)RAND_MAX,
+        47.0 + rand() / (double)RAND_MAX);
+  }
+  return true;
+}
+
+static void destroy_data(benchmark_data* data)
+{
+  free(data->topics);
+  free(data->payloads);
+  free(data->payload_lengths);
+  free(data->append_ns);
+  mosquitto_property_free_all(&data->props);
+}
+
+int main(int argc, char* argv[])
+{
+  benchmark_data data = { 0 };
+  mqtt_recorder_sync policies[POLICY_COUNT]
+      = { MQTT_RECORDER_SYNC_NONE, MQTT_RECORDER_SYNC_INTERVAL, MQTT_RECORDER_SYNC_SEGMENT };
+  const char* names[POLICY_COUNT] = { "none", "interval", "segment" };
+  char* base_directory;
+  char directory[DIRECTORY_SIZE];
+  int segment_mb;
+  int ingest_rate;
+  int result = MOSQ_ERR_SUCCESS;
+
+  if (!set_int_connection_setting(&data.messages, "BENCHMARK_MESSAGES", DEFAULT_BENCHMARK_MESSAGES)
+      || data.messages <= 0
+      || !set_int_connection_setting(
+          &data.vehicles, "BENCHMARK_VEHICLES", DEFAULT_BENCHMARK_VEHICLES)
+      || data.vehicles <= 0
+      || !set_int_connection_setting(
+          &segment_mb, "BENCHMARK_SEGMENT_MB", DEFAULT_BENCHMARK_SEGMENT_MB)
+      || segment_mb <= 0 || segment_mb >= 4096
+      || !set_int_connection_setting(
+          &ingest_rate, "BENCHMARK_INGEST_RATE", DEFAULT_BENCHMARK_INGEST_RATE)
+      || ingest_rate <= 0
+      || !set_char_connection_setting(&base_directory, "BENCHMARK_DIRECTORY", false))
+  {
+    return MOSQ_ERR_INVAL;
+  }
+  if (!create_data(&data))
+  {
+    destroy_data(&data);
+    return MOSQ_ERR_NOMEM;
+  }
+
+  printf(
+      "%d messages on %d topics, segments of %d MB, ingest at %d messages/s\n",
+      data.messages,
+      data.vehicles,
+      segment_mb,
+      ingest_rate);
+  printf("sync        records/s    MB/s  ns/record  p99 ns  max us  waits  syncs   core\n");
+  for (int i = 0; i < POLICY_COUNT && result == MOSQ_ERR_SUCCESS; i++)
+  {
+    mqtt_recorder_options options = mqtt_recorder_options_default();
+    mqtt_recorder_stats stats = { 0 };
+    double total_ns;
+
+    options.segment_bytes = (size_t)segment_mb * 1024 * 1024;
+    options.sync = policies[i];
+    snprintf(
+        directory,
+        sizeof(directory),
+        "%s/mqtt_recorder_benchmark_XXXXXX",
+        base_directory != NULL ? base_directory : "/tmp");
+    if (mkdtemp(directory) == NULL)
+    {
+      LOG_ERROR("Failed to create a directory in %s", base_directory);
+      result = MOSQ_ERR_ERRNO;
+      break;
+    }
+    if (!run_append(&data, directory, &options, &total_ns, &stats))
+    {
+      LOG_ERROR("Failed to record the messages to %s", directory);
+      result = MOSQ_ERR_UNKNOWN;
+    }
+    else
+    {
+      qsort(data.append_ns, data.messages, sizeof(uint64_t), compare_ns);
+      printf(
+          "%-10s %10.0f %7.1f %10.1f %7llu %7.0f %6llu %6llu %5.1f%%\n",
+          names[i],
+          data.messages / total_ns * 1e9,
+          stats.bytes / total_ns * 1e9 / (1024 * 1024),
+          total_ns / data.messages,
+          (unsigned long long)data.append_ns[(size_t)(data.messages * 0.99)],
+          data.append_ns[data.messages - 1] / 1e3,
+          (unsigned long long)stats.full_waits,
+          (unsigned long long)stats.syncs,
+          ingest_rate * (total_ns / data.messages) / 1e9 * 100);
+      /* The segments of the last run are read back. */
+      if (i == POLICY_COUNT - 1 && !run_read(&data, directory))
+      {
+        result = MOSQ_ERR_UNKNOWN;
+      }
+    }
+    remove_recording(directory);
+  }
+
+  destroy_data(&data);
+  return result;
+}
@@ -0,0 +1,247 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "logging.h"
+#include "mosquitto.h"
+#include "mqtt_client_pool.h"
+#include "mqtt_setup.h"
+
+#define QOS_LEVEL 1
+#define MQTT_VERSION MQTT_PROTOCOL_V311
+#define PAYLOAD "0123456789abcdef0123456789abcdef"
+
+#define DEFAULT_BENCHMARK_MAX_CONNECTIONS 16
+#define DEFAULT_BENCHMARK_TOPICS 1024
+#define DEFAULT_BENCHMARK_DURATION_SECONDS 5
+#define CONNECT_TIMEOUT_SECONDS 10
+/* Unacknowledged messages allowed per connection before the publishers wait. */
+#define CONNECTION_WINDOW 1000
+
+/*
+ * Measures how QoS 1 publish throughput scales with the number of pooled connections. For each
+ * pool size K (1, 2, 4, ... up to BENCHMARK_MAX_CONNECTIONS) it opens a mqtt_client_pool of K
+ * connections and runs K publisher threads, each publishing round-robin over its own slice of
+ * BENCHMARK_TOPICS topics through mqtt_client_pool_publish(). Throughput is counted from PUBACKs.
+ * Run it against a local broker like reactor_benchmark.
+ *
+ * Extra settings:
+ *   BENCHMARK_MAX_CONNECTIONS   largest pool size (default 16)
+ *   BENCHMARK_TOPICS            number of distinct topics (default 1024)
+ *   BENCHMARK_DURATION_SECONDS  measurement time per pool size (default 5)
+ */
+
+typedef struct publisher
+{
+  mqtt_client_pool* pool;
+  pthread_t thread;
+  int first_topic;
+  int topic_stride;
+} publisher;
+
+static char (*topics)[64];
+static int topic_count;
+static int connected_count = 0;
+static bool publishing = false;
+static unsigned long long published_total = 0;
+static unsigned long long acknowledged_total = 0;
+
+static void on_pool_connect(
+    struct mosquitto* mosq,
+    void* obj,
+    int reason_code,
+    int flags,
+    const mosquitto_property* props)
+{
+  if (reason_code != 0)
+  {
+    LOG_ERROR("Failed to connect: %s", mosquitto_connack_string(reason_code));
+    return;
+  }
+  __atomic_fetch_add(&connected_count, 1, __ATOMIC_RELAXED);
+}
+
+static void on_pool_publish_count(
+    struct mosquitto* mosq,
+    void* obj,
+    int mid,
+    int reason_code,
+    const mosquitto_property* props)
+{
+  __atomic_fetch_add(&acknowledged_total, 1, __ATOMIC_RELAXED);
+}
+
+static void* publish_thread(void* arg)
+{
+  publisher* self = (publisher*)arg;
+  int topic = self->first_topic;
+
+  while (__atomic_load_n(&publishing, __ATOMIC_RELAXED))
+  {
+    /* Stay within a window of unacknowledged messages so the queues don't grow without bound. */
+    if (__atomic_load_n(&published_total, __ATOMIC_RELAXED)
+            - __atomic_load_n(&acknowledged_total, __ATOMIC_RELAXED)
+        > (unsigned long long)CONNECTION_WINDOW * self->topic_stride)
+    {
+      sched_yield();
+      continue;
+    }
+
+    int rc = mqtt_client_pool_publish(
+        self->pool, NULL, topics[topic], (int)strlen(PAYLOAD), PAYLOAD, QOS_LEVEL, false, NULL);
+    if (rc != MOSQ_ERR_SUCCESS)
+    {
+      LOG_ERROR("Failure while publishing: %s", mosquitto_strerror(rc));
+      break;
+    }
+    __atomic_fetch_add(&published_total, 1, __ATOMIC_RELAXED);
+    topic += self->topic_stride;
+    if (topic >= topic_count)
+    {
+      topic = self->first_topic;
+    }
+  }
+  return NULL;
+}
+
+static double timespec_seconds(struct timespec ts) { return ts.tv_sec + ts.tv_nsec / 1e9; }
+
+static int run_pool_size(
+    const mqtt_client_connection_settings* connection_settings,
+    int connections,
+    int duration_seconds,
+    double* messages_per_second)
+{
+  mqtt_client_obj obj = { 0 };
+  mqtt_client_pool pool;
+  publisher* publishers = calloc(connections, sizeof(publisher));
+  int result;
+
+  obj.mqtt_version = MQTT_VERSION;
+  __atomic_store_n(&connected_count, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&published_total, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&acknowledged_total, 0, __ATOMIC_RELAXED);
+
+  if (publishers == NULL
+      || !mqtt_client_pool_init(
+          &pool, connection_settings, connections, true, on_pool_connect, &obj))
+  {
+    free(publishers);
+    return MOSQ_ERR_UNKNOWN;
+  }
+  for (int i = 0; i < pool.size; i++)
+  {
+    /* Replace the logging sample callback, it would dominate the measurement. */
+    mosquitto_publish_v5_callback_set(pool.connections[i].mosq, on_pool_publish_count);
+  }
+
+  if ((result = mqtt_client_pool_connect(&pool)) == MOSQ_ERR_SUCCESS)
+  {
+    time_t deadline = time(NULL) + CONNECT_TIMEOUT_SECONDS;
+    while (__atomic_load_n(&connected_count, __ATOMIC_RELAXED) < connections && keep_running
+           && time(NULL) < deadline)
+    {
+      struct timespec pause = { 0, 10 * 1000 * 1000 };
+      nanosleep(&pause, NULL);
+    }
+    if (__atomic_load_n(&connected_count, __ATOMIC_RELAXED) < connections)
+    {
+      LOG_ERROR("Only %d of %d connections were established.", connected_count, connections);
+      result = MOSQ_ERR_NO_CONN;
+    }
+  }
+
+  if (result == MOSQ_ERR_SUCCESS && keep_running)
+  {
+    struct timespec start, end, pause = { duration_seconds, 0 };
+    __atomic_store_n(&publishing, true, __ATOMIC_RELAXED);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int i = 0; i < connections; i++)
+    {
+      publishers[i].pool = &pool;
+      publishers[i].first_topic = i % topic_count;
+      publishers[i].topic_stride = connections;
+      pthread_create(&publishers[i].thread, NULL, publish_thread, &publishers[i]);
+    }
+
+    nanosleep(&pause, NULL);
+    unsigned long long acknowledged = __atomic_load_n(&acknowledged_total, __ATOMIC_RELAXED);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    __atomic_store_n(&publishing, false, __ATOMIC_RELAXED);
+
+    for (int i = 0; i < connections; i++)
+    {
+      pthread_join(publishers[i].thread, NULL);
+    }
+    *messages_per_second = acknowledged / (timespec_seconds(end) - timespec_seconds(start));
+  }
+
+  mqtt_client_pool_destroy(&pool);
+  free(publishers);
+  return result;
+}
+
+int main(int argc, char* argv[])
+{
+  mqtt_client_connection_settings connection_settings;
+  int max_connections;
+  int duration_seconds;
+  int result = MOSQ_ERR_SUCCESS;
+  double baseline = 0;
+
+  if (!mqtt_client_setup(argv[1], &connection_settings)
+      || !set_int_connection_setting(
+          &max_connections, "BENCHMARK_MAX_CONNECTIONS", DEFAULT_BENCHMARK_MAX_CONNECTIONS)
+      || !set_int_connection_setting(&topic_count, "BENCHMARK_TOPICS", DEFAULT_BENCHMARK_TOPICS)
+      || !set_int_connection_setting(
+          &duration_seconds, "BENCHMARK_DURATION_SECONDS", DEFAULT_BENCHMARK_DURATION_SECONDS))
+  {
+    return MOSQ_ERR_UNKNOWN;
+  }
+  if (connection_settings.client_id == NULL)
+  {
+    connection_settings.client_id = "pool-benchmark";
+  }
+
+  if (topic_count < 1 || (topics = calloc(topic_count, sizeof(*topics))) == NULL)
+  {
+    LOG_ERROR("Failed to initialize the benchmark.");
+    return MOSQ_ERR_UNKNOWN;
+  }
+  for (int i = 0; i < topic_count; i++)
+  {
+    snprintf(topics[i], sizeof(topics[i]), "benchmark/pool/%d", i);
+  }
+
+  printf("connections  messages/s  speedup\n");
+  for (int connections = 1; connections <= max_connections && keep_running; connections *= 2)
+  {
+    double messages_per_second = 0;
+    if ((result = run_pool_size(
+             &connection_settings, connections, duration_seconds, &messages_per_second))
+        != MOSQ_ERR_SUCCESS)
+    {
+      break;
+    }
+    if (baseline == 0)
+    {
+      baseline = messages_per_second;
+    }
+    printf(
+        "%11d  %10.0f  %6.2fx\n",
+        connections,
+        messages_per_second,
+        baseline > 0 ? messages_per_second / baseline : 0);
+  }
+
+  free(topics);
+  mosquitto_lib_cleanup();
+  return result;
+}
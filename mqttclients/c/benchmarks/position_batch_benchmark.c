@@ -0,0 +1,308 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "logging.h"
+#include "mosquitto.h"
+#include "mqtt_client_pool.h"
+#include "mqtt_protocol.h"
+#include "mqtt_setup.h"
+#include "position_batcher.h"
+#include "position_codec.h"
+
+#define QOS_LEVEL 1
+#define MQTT_VERSION MQTT_PROTOCOL_V5
+#define TOPIC "vehicles/benchmark/position"
+#define MAX_STEP_DEGREES 0.0005
+
+#define DEFAULT_BENCHMARK_MAX_BATCH 64
+#define DEFAULT_BENCHMARK_DURATION_SECONDS 5
+#define CONNECT_TIMEOUT_SECONDS 10
+/* Unacknowledged messages allowed before the publisher waits. */
+#define PUBLISH_WINDOW 1000
+
+/*
+ * Measures what batching positions with position_batcher saves against a local broker. For each
+ * batch size (1, 2, 4, ... up to BENCHMARK_MAX_BATCH) it publishes a random walk of positions at
+ * QoS 1 for BENCHMARK_DURATION_SECONDS, like the telemetry producer does with TELEMETRY_BATCH_SIZE,
+ * and reports the acknowledged messages/s and positions/s and the CPU used by the benchmark per
+ * position. When BENCHMARK_BROKER_PID is set to the pid of the broker, it also reports the broker's
+ * CPU, read from /proc, so the broker must run on the same machine.
+ *
+ * Extra settings:
+ *   BENCHMARK_ENCODING          json (default) or binary
+ *   BENCHMARK_MAX_BATCH         largest batch size (default 64)
+ *   BENCHMARK_DURATION_SECONDS  measurement time per batch size (default 5)
+ *   BENCHMARK_BROKER_PID        pid of the local broker (default unset)
+ */
+
+static int connected_count = 0;
+static unsigned long long published_total = 0;
+static unsigned long long acknowledged_total = 0;
+
+typedef struct batch_run
+{
+  mqtt_client_pool* pool;
+  mosquitto_property* props;
+} batch_run;
+
+static void on_benchmark_connect(
+    struct mosquitto* mosq,
+    void* obj,
+    int reason_code,
+    int flags,
+    const mosquitto_property* props)
+{
+  if (reason_code != 0)
+  {
+    LOG_ERROR("Failed to connect: %s", mosquitto_connack_string(reason_code));
+    return;
+  }
+  __atomic_fetch_add(&connected_count, 1, __ATOMIC_RELAXED);
+}
+
+static void on_benchmark_publish(
+    struct mosquitto* mosq,
+    void* obj,
+    int mid,
+    int reason_code,
+    const mosquitto_property* props)
+{
+  __atomic_fetch_add(&acknowledged_total, 1, __ATOMIC_RELAXED);
+}
+
+static int publish_batch(const mosquitto_payload* payload, int count, void* context)
+{
+  batch_run* run = (batch_run*)context;
+
+  /* Stay within a window of unacknowledged messages so the queue doesn't grow without bound. */
+  while (__atomic_load_n(&published_total, __ATOMIC_RELAXED)
+             - __atomic_load_n(&acknowledged_total, __ATOMIC_RELAXED)
+         > PUBLISH_WINDOW)
+  {
+    sched_yield();
+  }
+
+  int rc = mqtt_client_pool_publish(
+      run->pool,
+      NULL,
+      TOPIC,
+      (int)payload->payload_length,
+      payload->payload,
+      QOS_LEVEL,
+      false,
+      run->props);
+  if (rc != MOSQ_ERR_SUCCESS)
+  {
+    LOG_ERROR("Failure while publishing: %s", mosquitto_strerror(rc));
+    return rc;
+  }
+  __atomic_fetch_add(&published_total, 1, __ATOMIC_RELAXED);
+  return MOSQ_ERR_SUCCESS;
+}
+
+static double step_coordinate(double coordinate)
+{
+  double step = (rand() / (double)RAND_MAX * 2 - 1) * MAX_STEP_DEGREES;
+  return coordinate + step > 90 || coordinate + step < -90 ? coordinate - step : coordinate + step;
+}
+
+static double timespec_seconds(struct timespec ts) { return ts.tv_sec + ts.tv_nsec / 1e9; }
+
+static double cpu_seconds()
+{
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec
+      + usage.ru_stime.tv_usec / 1e6;
+}
+
+/* The user and system CPU seconds of another process, from fields 14 and 15 of /proc/<pid>/stat.
+ * Returns -1 when the process can't be read. */
+static double process_cpu_seconds(int pid)
+{
+  char path[64];
+  char stat[1024];
+  unsigned long user_ticks;
+  unsigned long system_ticks;
+  size_t length;
+  FILE* file;
+
+  snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+  if (pid <= 0 || (file = fopen(path, "r")) == NULL)
+  {
+    return -1;
+  }
+  length = fread(stat, 1, sizeof(stat) - 1, file);
+  fclose(file);
+  stat[length] = '\0';
+
+  /* The command name in field 2 may contain spaces, the fields after it start after its ')'. */
+  char* fields = strrchr(stat, ')');
+  if (fields == NULL
+      || sscanf(
+             fields + 1,
+             " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+             &user_ticks,
+             &system_ticks)
+          != 2)
+  {
+    return -1;
+  }
+  return (user_ticks + system_ticks) / (double)sysconf(_SC_CLK_TCK);
+}
+
+static int run_batch_size(
+    mqtt_client_pool* pool,
+    position_encoding encoding,
+    mosquitto_property* props,
+    int batch_size,
+    int duration_seconds,
+    int broker_pid)
+{
+  batch_run run = { .pool = pool, .props = props };
+  position_batch_policy policy = { .max_count = batch_size };
+  geojson_coordinates position = { .x = -122.3, .y = 47.6 };
+  struct timespec start, now;
+  int result = MOSQ_ERR_SUCCESS;
+
+  position_batcher* batcher = position_batcher_create(encoding, policy, NULL, publish_batch, &run);
+  if (batcher == NULL)
+  {
+    return MOSQ_ERR_UNKNOWN;
+  }
+
+  /* Let the previous batch size drain so its acknowledgements aren't counted here. */
+  while (__atomic_load_n(&acknowledged_total, __ATOMIC_RELAXED)
+         < __atomic_load_n(&published_total, __ATOMIC_RELAXED))
+  {
+    sched_yield();
+  }
+  unsigned long long acknowledged_before = __atomic_load_n(&acknowledged_total, __ATOMIC_RELAXED);
+  double cpu_before = cpu_seconds();
+  double broker_cpu_before = process_cpu_seconds(broker_pid);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  do
+  {
+    /* Check the clock once per batch, a position is cheaper than reading it. */
+    for (int i = 0; i < batch_size && result == MOSQ_ERR_SUCCESS; i++)
+    {
+      position.x = step_coordinate(position.x);
+      position.y = step_coordinate(position.y);
+      result = position_batcher_add(batcher, position) == 0 ? MOSQ_ERR_SUCCESS : MOSQ_ERR_UNKNOWN;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+  } while (result == MOSQ_ERR_SUCCESS && keep_running
+           && timespec_seconds(now) - timespec_seconds(start) < duration_seconds);
+
+  unsigned long long acknowledged
+      = __atomic_load_n(&acknowledged_total, __ATOMIC_RELAXED) - acknowledged_before;
+  double elapsed = timespec_seconds(now) - timespec_seconds(start);
+  double cpu = cpu_seconds() - cpu_before;
+  double broker_cpu = process_cpu_seconds(broker_pid);
+  double acknowledged_positions = (double)acknowledged * batch_size;
+
+  if (result == MOSQ_ERR_SUCCESS)
+  {
+    printf(
+        "%5d  %10.0f  %11.0f  %16.2f",
+        batch_size,
+        acknowledged / elapsed,
+        acknowledged_positions / elapsed,
+        acknowledged_positions > 0 ? cpu * 1e6 / acknowledged_positions : 0);
+    if (broker_cpu >= 0 && broker_cpu_before >= 0)
+    {
+      broker_cpu -= broker_cpu_before;
+      printf(
+          "  %10.0f%%  %16.2f",
+          broker_cpu * 100 / elapsed,
+          acknowledged_positions > 0 ? broker_cpu * 1e6 / acknowledged_positions : 0);
+    }
+    printf("\n");
+  }
+
+  position_batcher_destroy(batcher);
+  return result;
+}
+
+int main(int argc, char* argv[])
+{
+  mqtt_client_connection_settings connection_settings;
+  mqtt_client_obj obj = { 0 };
+  mqtt_client_pool pool;
+  mosquitto_property* props = NULL;
+  position_encoding encoding = POSITION_ENCODING_JSON;
+  char* encoding_name;
+  int max_batch;
+  int duration_seconds;
+  int broker_pid;
+  int result;
+
+  if (!mqtt_client_setup(argv[1], &connection_settings)
+      || !set_char_connection_setting(&encoding_name, "BENCHMARK_ENCODING", false)
+      || (encoding_name != NULL && !position_encoding_from_name(encoding_name, &encoding))
+      || !set_int_connection_setting(&max_batch, "BENCHMARK_MAX_BATCH", DEFAULT_BENCHMARK_MAX_BATCH)
+      || !set_int_connection_setting(
+          &duration_seconds, "BENCHMARK_DURATION_SECONDS", DEFAULT_BENCHMARK_DURATION_SECONDS)
+      || !set_int_connection_setting(&broker_pid, "BENCHMARK_BROKER_PID", 0)
+      || mosquitto_property_add_string(
+             &props, MQTT_PROP_CONTENT_TYPE, position_encoding_content_type(encoding))
+          != MOSQ_ERR_SUCCESS)
+  {
+    return MOSQ_ERR_UNKNOWN;
+  }
+  if (connection_settings.client_id == NULL)
+  {
+    connection_settings.client_id = "position-batch-benchmark";
+  }
+
+  obj.mqtt_version = MQTT_VERSION;
+  if (!mqtt_client_pool_init(&pool, &connection_settings, 1, true, on_benchmark_connect, &obj))
+  {
+    mosquitto_property_free_all(&props);
+    return MOSQ_ERR_UNKNOWN;
+  }
+  /* Replace the logging sample callback, it would dominate the measurement. */
+  mosquitto_publish_v5_callback_set(pool.connections[0].mosq, on_benchmark_publish);
+
+  if ((result = mqtt_client_pool_connect(&pool)) == MOSQ_ERR_SUCCESS)
+  {
+    time_t deadline = time(NULL) + CONNECT_TIMEOUT_SECONDS;
+    while (__atomic_load_n(&connected_count, __ATOMIC_RELAXED) < 1 && keep_running
+           && time(NULL) < deadline)
+    {
+      struct timespec pause = { 0, 10 * 1000 * 1000 };
+      nanosleep(&pause, NULL);
+    }
+    if (__atomic_load_n(&connected_count, __ATOMIC_RELAXED) < 1)
+    {
+      LOG_ERROR("Failed to connect within %d seconds.", CONNECT_TIMEOUT_SECONDS);
+      result = MOSQ_ERR_NO_CONN;
+    }
+  }
+
+  if (result == MOSQ_ERR_SUCCESS)
+  {
+    printf("batch  messages/s  positions/s  client us/position");
+    printf(broker_pid > 0 ? "  broker cpu  broker us/position\n" : "\n");
+  }
+  for (int batch_size = 1;
+       result == MOSQ_ERR_SUCCESS && batch_size <= max_batch && keep_running;
+       batch_size *= 2)
+  {
+    result = run_batch_size(&pool, encoding, props, batch_size, duration_seconds, broker_pid);
+  }
+
+  mqtt_client_pool_destroy(&pool);
+  mosquitto_property_free_all(&props);
+  mosquitto_lib_cleanup();
+  return result;
+}
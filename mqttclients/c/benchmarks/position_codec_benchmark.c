@@ -0,0 +1,260 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "geo_json_handler.h"
+#include "logging.h"
+#include "mosquitto.h"
+#include "mqtt_protocol.h"
+#include "mqtt_setup.h"
+#include "position_codec.h"
+#include "position_stream_codec.h"
+#include "position_trajectory.h"
+
+#define DEFAULT_BENCHMARK_MESSAGES 1000000
+#define POSITIONS 1024
+#define MAX_PAYLOAD_LENGTH 64
+#define TOPIC "vehicles/vehicle01/position"
+#define BENCHMARK_SEED 1
+#define STEP_SECONDS 5.0
+
+/*
+ * Compares the telemetry position encodings on the positions of a vehicle driving like the
+ * telemetry producer's (position_trajectory, every 5 seconds), per message:
+ *   payload     bytes of payload
+ *   publish     bytes of the QoS 1 MQTT 5 PUBLISH packet, with the topic of the telemetry producer
+ *               and its content type property
+ *   encode      ns to write the payload with position_to_mosquitto_payload() or
+ *               position_stream_encode()
+ *   decode      ns to read the payload with mosquitto_payload_to_position() or
+ *               position_stream_decode()
+ *   negotiated  ns to find the encoding with position_encoding_from_properties() and decode, as the
+ *               telemetry consumer does, and the heap allocations this makes
+ * Streams have a keyframe every POSITION_STREAM_DEFAULT_KEYFRAME_INTERVAL frames. The size of the
+ * JSON PUBLISH packet of an MQTT 3.1.1 producer, which sends no content type, is printed first.
+ * Allocations are counted by wrapping malloc, calloc and realloc, which works with glibc. No broker
+ * is needed.
+ *
+ * Extra settings:
+ *   BENCHMARK_MESSAGES  number of messages encoded and decoded per encoding (default 1000000)
+ */
+
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+
+static unsigned long long allocations = 0;
+
+void* malloc(size_t size)
+{
+  allocations++;
+  return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size)
+{
+  allocations++;
+  return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+  allocations++;
+  return __libc_realloc(ptr, size);
+}
+
+static size_t varint_length(size_t value)
+{
+  size_t length = 1;
+  for (; value >= 128; value /= 128)
+  {
+    length++;
+  }
+  return length;
+}
+
+/* The size of a QoS 1 PUBLISH packet with a content type property, or none if content_type is
+ * NULL. */
+static size_t publish_packet_length(size_t payload_length, const char* content_type, int version)
+{
+  size_t properties_length = content_type == NULL ? 0 : 1 + 2 + strlen(content_type);
+  size_t remaining_length = 2 + strlen(TOPIC) + 2 + payload_length;
+  if (version == MQTT_PROTOCOL_V5)
+  {
+    remaining_length += varint_length(properties_length) + properties_length;
+  }
+  return 1 + varint_length(remaining_length) + remaining_length;
+}
+
+static double elapsed_ns(const struct timespec* start, const struct timespec* end)
+{
+  return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+/* Streams are encoded from a keyframe at the first position, so the stored frames can be decoded
+ * over and over. */
+static int encode(
+    position_encoding encoding,
+    position_stream_encoder* stream,
+    int index,
+    geojson_coordinates coordinates,
+    mosquitto_payload* payload)
+{
+  if (encoding != POSITION_ENCODING_STREAM)
+  {
+    return position_to_mosquitto_payload(encoding, coordinates, payload);
+  }
+  if (index == 0)
+  {
+    position_stream_encoder_reset(stream);
+  }
+  return position_stream_encode(stream, coordinates, payload);
+}
+
+static int decode(
+    position_encoding encoding,
+    position_stream_decoder* streams,
+    const struct mosquitto_message* message,
+    geojson_coordinates* output)
+{
+  return encoding == POSITION_ENCODING_STREAM
+      ? position_stream_decode(streams, message, output)
+      : mosquitto_payload_to_position(encoding, message, output);
+}
+
+static void run(
+    const char* name,
+    position_encoding encoding,
+    const geojson_coordinates* positions,
+    int message_count)
+{
+  mosquitto_payload payloads[POSITIONS];
+  struct mosquitto_message messages[POSITIONS] = { 0 };
+  position_stream_encoder stream
+      = position_stream_encoder_init(POSITION_STREAM_DEFAULT_KEYFRAME_INTERVAL);
+  position_stream_decoder* streams = position_stream_decoder_create();
+  mosquitto_property* props = NULL;
+  struct timespec start, end;
+  geojson_coordinates coordinates;
+  size_t payload_bytes = 0;
+  double checksum = 0;
+  int failures = 0;
+
+  mosquitto_property_add_string(
+      &props, MQTT_PROP_CONTENT_TYPE, position_encoding_content_type(encoding));
+  for (int i = 0; i < POSITIONS; i++)
+  {
+    payloads[i] = mosquitto_payload_init(MAX_PAYLOAD_LENGTH);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < message_count; i++)
+  {
+    int index = i % POSITIONS;
+    failures += encode(encoding, &stream, index, positions[index], &payloads[index]) != 0;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double encode_ns = elapsed_ns(&start, &end) / message_count;
+
+  for (int i = 0; i < POSITIONS; i++)
+  {
+    messages[i].topic = TOPIC;
+    messages[i].payload = payloads[i].payload;
+    messages[i].payloadlen = payloads[i].payload_length;
+    payload_bytes += payloads[i].payload_length;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < message_count; i++)
+  {
+    failures += decode(encoding, streams, &messages[i % POSITIONS], &coordinates) != 0;
+    checksum += coordinates.x + coordinates.y;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double decode_ns = elapsed_ns(&start, &end) / message_count;
+
+  unsigned long long allocations_before = allocations;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < message_count; i++)
+  {
+    position_encoding received;
+    failures += !position_encoding_from_properties(props, &received)
+        || decode(received, streams, &messages[i % POSITIONS], &coordinates) != 0;
+    checksum += coordinates.x + coordinates.y;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double negotiated_ns = elapsed_ns(&start, &end) / message_count;
+
+  double average_payload = (double)payload_bytes / POSITIONS;
+  printf(
+      "%-8s %8.1f %8.1f %8.1f %8.1f %11.1f %14.2f %9d %16.6f\n",
+      name,
+      average_payload,
+      (double)publish_packet_length(
+          (size_t)(average_payload + 0.5),
+          position_encoding_content_type(encoding),
+          MQTT_PROTOCOL_V5),
+      encode_ns,
+      decode_ns,
+      negotiated_ns,
+      (double)(allocations - allocations_before) / message_count,
+      failures,
+      checksum);
+
+  for (int i = 0; i < POSITIONS; i++)
+  {
+    mosquitto_payload_destroy(&payloads[i]);
+  }
+  position_stream_decoder_destroy(streams);
+  mosquitto_property_free_all(&props);
+}
+
+int main(int argc, char* argv[])
+{
+  geojson_coordinates positions[POSITIONS];
+  mosquitto_payload payload = mosquitto_payload_init(MAX_PAYLOAD_LENGTH);
+  size_t json_bytes = 0;
+  int message_count;
+
+  if (!set_int_connection_setting(
+          &message_count, "BENCHMARK_MESSAGES", DEFAULT_BENCHMARK_MESSAGES)
+      || message_count <= 0)
+  {
+    return MOSQ_ERR_INVAL;
+  }
+
+  geojson_coordinates center = { .x = -122.335, .y = 47.608 };
+  trajectory_fleet* vehicle
+      = trajectory_fleet_create(1, trajectory_settings_default(center), BENCHMARK_SEED);
+  if (vehicle == NULL)
+  {
+    return MOSQ_ERR_NOMEM;
+  }
+  for (int i = 0; i < POSITIONS; i++)
+  {
+    trajectory_fleet_step(vehicle, STEP_SECONDS);
+    positions[i] = trajectory_fleet_position(vehicle, 0);
+    if (position_to_mosquitto_payload(POSITION_ENCODING_JSON, positions[i], &payload) != 0)
+    {
+      return MOSQ_ERR_UNKNOWN;
+    }
+    json_bytes += payload.payload_length;
+  }
+  trajectory_fleet_destroy(vehicle);
+  mosquitto_payload_destroy(&payload);
+
+  printf(
+      "MQTT 3.1.1 JSON publish without a content type: %.1f bytes/message\n",
+      (double)publish_packet_length(
+          (size_t)((double)json_bytes / POSITIONS + 0.5), NULL, MQTT_PROTOCOL_V311));
+  printf("encoding  payload  publish   encode   decode  negotiated  allocs/message  failures "
+         "        checksum\n");
+  run("json", POSITION_ENCODING_JSON, positions, message_count);
+  run("binary", POSITION_ENCODING_BINARY, positions, message_count);
+  run("stream", POSITION_ENCODING_STREAM, positions, message_count);
+  return MOSQ_ERR_SUCCESS;
+}
@@ -0,0 +1,380 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "geo_json_handler.h"
+#include "logging.h"
+#include "mosquitto.h"
+#include "mqtt_setup.h"
+#include "position_geofences.h"
+#include "position_grid.h"
+#include "position_store.h"
+#include "position_trajectory.h"
+
+#define DEFAULT_BENCHMARK_VEHICLES 100000
+#define DEFAULT_BENCHMARK_FENCES 5000
+#define DEFAULT_BENCHMARK_FENCE_VERTICES 32
+#define DEFAULT_BENCHMARK_FENCE_METERS 2000.0
+#define DEFAULT_BENCHMARK_AREA_DEGREES 1.0
+#define DEFAULT_BENCHMARK_ROUNDS 10
+#define BENCHMARK_SEED 1
+#define STEP_SECONDS 5.0
+#define METERS_PER_DEGREE 111320.0
+#define ID_SIZE 32
+/* The linear scans are this many times fewer than the updates of a round. */
+#define SCAN_DIVISOR 100
+
+/*
+ * Measures the geofences of the telemetry consumer with BENCHMARK_FENCES fences (default 5000) of
+ * BENCHMARK_FENCE_VERTICES vertices (default 32) and BENCHMARK_VEHICLES vehicles (default 100000)
+ * driving with position_trajectory around the streets of an area of BENCHMARK_AREA_DEGREES degrees
+ * of latitude around its center (default 1, about 110 km). The fences are star shaped polygons
+ * whose vertices are at most BENCHMARK_FENCE_METERS (default 2000) from their center, one out of
+ * four with a hole:
+ *   create     the packing of the fences into the tree
+ *   geofences  BENCHMARK_ROUNDS positions of every vehicle 5 seconds apart, moving the vehicles
+ *              through the fences
+ *   scan       the same as finding the fences of a position by testing the box of every fence,
+ *              then the polygons that hold it, 100 times fewer
+ *   consumer   BENCHMARK_ROUNDS more positions of every vehicle through what the telemetry consumer
+ *              does with each decoded position: the position store, the grid and the geofences
+ * It reports the operations per second and ns per operation, the fences each position is inside on
+ * average and the entries and exits. No broker is needed.
+ *
+ * Extra settings:
+ *   BENCHMARK_VEHICLES        number of vehicles (default 100000)
+ *   BENCHMARK_FENCES          number of fences (default 5000)
+ *   BENCHMARK_FENCE_VERTICES  vertices per ring of the fences (default 32)
+ *   BENCHMARK_FENCE_METERS    largest distance of a vertex to its center (default 2000)
+ *   BENCHMARK_AREA_DEGREES    half the height of the area in degrees (default 1)
+ *   BENCHMARK_ROUNDS          number of positions per vehicle (default 10)
+ */
+
+typedef struct benchmark_data
+{
+  trajectory_fleet* fleet;
+  geojson_geometry* polygons;
+  const char** ids;
+  char* id_text;
+  int fence_count;
+  position_geofences* fences;
+  position_store* store;
+  position_grid* grid;
+  int rounds;
+} benchmark_data;
+
+typedef struct benchmark_result
+{
+  double ns;
+  size_t operations;
+  size_t inside;
+  size_t events;
+} benchmark_result;
+
+static double elapsed_ns(const struct timespec* start, const struct timespec* end)
+{
+  return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+static void report(const char* name, const benchmark_result* result)
+{
+  printf(
+      "%-10s %12.0f %10.1f",
+      name,
+      result->operations / result->ns * 1e9,
+      result->ns / result->operations);
+  if (result->inside > 0 || result->events > 0)
+  {
+    printf(" %7.3f %10zu", (double)result->inside / result->operations, result->events);
+  }
+  printf("\n");
+}
+
+static void count_event(int vehicle, int fence, bool entered, void* context)
+{
+  (*(size_t*)context)++;
+}
+
+static bool add_ring(
+    geojson_geometry* polygon,
+    trajectory_rng* rng,
+    geojson_coordinates center,
+    double radius_degrees,
+    double x_scale,
+    int vertices)
+{
+  int first = polygon->count;
+  bool success = true;
+  for (int i = 0; i < vertices && success; i++)
+  {
+    double angle = 2 * M_PI * i / vertices;
+    double distance = trajectory_rng_between(rng, radius_degrees / 2, radius_degrees);
+    success = geojson_geometry_add_position(
+        polygon, center.x + distance * x_scale * cos(angle), center.y + distance * sin(angle));
+  }
+  return success && geojson_geometry_add_position(polygon, polygon->x[first], polygon->y[first])
+      && geojson_geometry_end_ring(polygon);
+}
+
+/* A star shaped fence around a random point of the area, with a hole one time out of four. */
+static bool make_fence(
+    geojson_geometry* polygon,
+    trajectory_rng* rng,
+    const trajectory_fleet* fleet,
+    int vertices,
+    double meters)
+{
+  geojson_coordinates center = { .x = trajectory_rng_between(rng, fleet->min_x, fleet->max_x),
+                                 .y = trajectory_rng_between(rng, fleet->min_y, fleet->max_y) };
+  double radius_degrees = trajectory_rng_between(rng, meters / 4, meters) / METERS_PER_DEGREE;
+  double x_scale = 1 / cos(center.y * M_PI / 180);
+  bool hole = trajectory_rng_uniform(rng) < 0.25;
+
+  return geojson_geometry_reset(polygon, GEOJSON_POLYGON, 2 * vertices + 2, 2)
+      && add_ring(polygon, rng, center, radius_degrees, x_scale, vertices)
+      && (!hole || add_ring(polygon, rng, center, radius_degrees / 5, x_scale, vertices));
+}
+
+/* Finds the fences of a position the simple way: the box of every fence, then the polygon. */
+static int scan_fences(const benchmark_data* data, const double* boxes, geojson_coordinates point)
+{
+  int found = 0;
+  for (int f = 0; f < data->fence_count; f++)
+  {
+    const double* box = boxes + 4 * f;
+    if (point.x < box[0] || point.x > box[2] || point.y < box[1] || point.y > box[3])
+    {
+      continue;
+    }
+    const geojson_geometry* polygon = &data->polygons[f];
+    bool inside = false;
+    for (int r = 0, start = 0; r < polygon->ring_count; start = polygon->ring_ends[r++])
+    {
+      for (int i = start; i < polygon->ring_ends[r] - 1; i++)
+      {
+        double x0 = polygon->x[i], y0 = polygon->y[i];
+        double x1 = polygon->x[i + 1], y1 = polygon->y[i + 1];
+        if ((y0 > point.y) != (y1 > point.y)
+            && point.x < x0 + (point.y - y0) * (x1 - x0) / (y1 - y0))
+        {
+          inside = !inside;
+        }
+      }
+    }
+    found += inside;
+  }
+  return found;
+}
+
+static bool run_scan(const benchmark_data* data, benchmark_result* result)
+{
+  size_t count = data->fleet->count / SCAN_DIVISOR > 0 ? data->fleet->count / SCAN_DIVISOR : 1;
+  double* boxes = malloc(4 * data->fence_count * sizeof(double));
+  struct timespec start, end;
+
+  if (boxes == NULL)
+  {
+    return false;
+  }
+  for (int f = 0; f < data->fence_count; f++)
+  {
+    const geojson_geometry* polygon = &data->polygons[f];
+    double* box = boxes + 4 * f;
+    box[0] = box[1] = INFINITY;
+    box[2] = box[3] = -INFINITY;
+    for (int i = 0; i < polygon->count; i++)
+    {
+      box[0] = fmin(box[0], polygon->x[i]);
+      box[1] = fmin(box[1], polygon->y[i]);
+      box[2] = fmax(box[2], polygon->x[i]);
+      box[3] = fmax(box[3], polygon->y[i]);
+    }
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (size_t i = 0; i < count; i++)
+  {
+    result->inside += scan_fences(data, boxes, trajectory_fleet_position(data->fleet, i));
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  result->ns = elapsed_ns(&start, &end);
+  result->operations = count;
+  free(boxes);
+  return true;
+}
+
+/* Moves every vehicle through the fences once per round, or through the store, the grid and the
+ * fences like the telemetry consumer. */
+static bool run_updates(const benchmark_data* data, bool consumer, benchmark_result* result)
+{
+  const trajectory_fleet* fleet = data->fleet;
+  char(*ids)[ID_SIZE] = NULL;
+  size_t* lengths = NULL;
+  int inside[1];
+  struct timespec start, end;
+  bool success = true;
+
+  if (consumer
+      && ((ids = malloc(fleet->count * ID_SIZE)) == NULL
+          || (lengths = malloc(fleet->count * sizeof(size_t))) == NULL))
+  {
+    free(ids);
+    return false;
+  }
+  for (size_t i = 0; consumer && i < fleet->count; i++)
+  {
+    lengths[i] = snprintf(ids[i], ID_SIZE, "vehicle-%zu", i);
+  }
+
+  for (int round = 0; round < data->rounds && success; round++)
+  {
+    trajectory_fleet_step(data->fleet, STEP_SECONDS);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < fleet->count && success; i++)
+    {
+      geojson_coordinates position = { .x = fleet->x[i], .y = fleet->y[i] };
+      int vehicle = (int)i;
+      if (consumer)
+      {
+        success = (vehicle = position_store_update(data->store, ids[i], lengths[i], position)) >= 0
+            && position_grid_update(data->grid, vehicle);
+      }
+      success = success
+          && position_geofences_update(
+                 data->fences, vehicle, position, count_event, &result->events)
+              >= 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    result->ns += elapsed_ns(&start, &end);
+  }
+  result->operations = fleet->count * data->rounds;
+  /* The fences of the last positions, outside of the timings. */
+  for (size_t i = 0; i < fleet->count; i++)
+  {
+    result->inside += position_geofences_find(
+        data->fences, trajectory_fleet_position(fleet, i), inside, 0);
+  }
+  result->inside *= data->rounds;
+  free(ids);
+  free(lengths);
+  return success;
+}
+
+static bool create_data(
+    benchmark_data* data,
+    int vehicles,
+    double area_degrees,
+    int vertices,
+    double meters)
+{
+  geojson_coordinates center = { .x = -100.0, .y = 40.0 };
+  trajectory_settings settings = trajectory_settings_default(center);
+  trajectory_rng rng;
+
+  settings.radius_degrees = area_degrees;
+  data->fleet = trajectory_fleet_create(vehicles, settings, BENCHMARK_SEED);
+  data->polygons = calloc(data->fence_count, sizeof(geojson_geometry));
+  data->ids = malloc(data->fence_count * sizeof(char*));
+  data->id_text = malloc((size_t)data->fence_count * ID_SIZE);
+  data->store = position_store_create(vehicles);
+  data->grid = position_grid_create(data->store, vehicles, POSITION_GRID_DEFAULT_CELL_DEGREES);
+  if (data->fleet == NULL || data->polygons == NULL || data->ids == NULL || data->id_text == NULL
+      || data->store == NULL || data->grid == NULL)
+  {
+    return false;
+  }
+
+  trajectory_rng_seed(&rng, BENCHMARK_SEED);
+  for (int i = 0; i < data->fence_count; i++)
+  {
+    data->ids[i] = data->id_text + (size_t)i * ID_SIZE;
+    snprintf(data->id_text + (size_t)i * ID_SIZE, ID_SIZE, "fence-%d", i);
+    data->polygons[i] = geojson_geometry_init();
+    if (!make_fence(&data->polygons[i], &rng, data->fleet, vertices, meters))
+    {
+      LOG_ERROR("Failure making fence %d", i);
+      return false;
+    }
+  }
+  return true;
+}
+
+static void destroy_data(benchmark_data* data)
+{
+  for (int i = 0; data->polygons != NULL && i < data->fence_count; i++)
+  {
+    geojson_geometry_destroy(&data->polygons[i]);
+  }
+  free(data->polygons);
+  free(data->ids);
+  free(data->id_text);
+  position_geofences_destroy(data->fences);
+  position_grid_destroy(data->grid);
+  position_store_destroy(data->store);
+  trajectory_fleet_destroy(data->fleet);
+}
+
+int main(int argc, char* argv[])
+{
+  benchmark_data data = { 0 };
+  double area_degrees;
+  double meters;
+  int vehicles;
+  int vertices;
+  int result = MOSQ_ERR_UNKNOWN;
+
+  if (!set_int_connection_setting(&vehicles, "BENCHMARK_VEHICLES", DEFAULT_BENCHMARK_VEHICLES)
+      || vehicles <= 0
+      || !set_int_connection_setting(
+          &data.fence_count, "BENCHMARK_FENCES", DEFAULT_BENCHMARK_FENCES)
+      || data.fence_count <= 0
+      || !set_int_connection_setting(
+          &vertices, "BENCHMARK_FENCE_VERTICES", DEFAULT_BENCHMARK_FENCE_VERTICES)
+      || vertices < 3
+      || !set_double_connection_setting(
+          &meters, "BENCHMARK_FENCE_METERS", DEFAULT_BENCHMARK_FENCE_METERS)
+      || !(meters > 0)
+      || !set_double_connection_setting(
+          &area_degrees, "BENCHMARK_AREA_DEGREES", DEFAULT_BENCHMARK_AREA_DEGREES)
+      || !(area_degrees > 0)
+      || !set_int_connection_setting(&data.rounds, "BENCHMARK_ROUNDS", DEFAULT_BENCHMARK_ROUNDS)
+      || data.rounds <= 0)
+  {
+    return MOSQ_ERR_INVAL;
+  }
+
+  if (create_data(&data, vehicles, area_degrees, vertices, meters))
+  {
+    benchmark_result create = { .operations = data.fence_count };
+    benchmark_result geofences = { 0 };
+    benchmark_result scan = { 0 };
+    benchmark_result consumer = { 0 };
+    struct timespec start, end;
+
+    printf("%d vehicles, %d fences of %d vertices\n", vehicles, data.fence_count, vertices);
+    printf("operation         ops/s      ns/op  inside     events\n");
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    data.fences = position_geofences_create(data.ids, data.polygons, data.fence_count, vehicles);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    create.ns = elapsed_ns(&start, &end);
+
+    if (data.fences != NULL && run_updates(&data, false, &geofences) && run_scan(&data, &scan)
+        && run_updates(&data, true, &consumer))
+    {
+      report("create", &create);
+      report("geofences", &geofences);
+      report("scan", &scan);
+      report("consumer", &consumer);
+      result = MOSQ_ERR_SUCCESS;
+    }
+  }
+
+  destroy_data(&data);
+  return result;
+}
@@ -0,0 +1,281 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "geo_json_handler.h"
+#include "logging.h"
+#include "mosquitto.h"
+#include "mqtt_setup.h"
+#include "position_geohash.h"
+#include "position_trajectory.h"
+
+#define DEFAULT_BENCHMARK_POSITIONS 1000000
+#define DEFAULT_BENCHMARK_PRECISION 6
+#define DEFAULT_BENCHMARK_BOXES 10000
+#define DEFAULT_BENCHMARK_BOX_DEGREES 1.0
+#define DEFAULT_BENCHMARK_MAX_FILTERS 16
+#define BENCHMARK_SEED 1
+#define BENCHMARK_ID "fleet-12345"
+#define TOPIC_SIZE 128
+
+/*
+ * Measures the geohash topics of the telemetry producer and consumer with BENCHMARK_POSITIONS
+ * random positions (default 1000000):
+ *   encode  the geohash of every position of BENCHMARK_PRECISION characters (default 6), with
+ *           position_geohash_encode()
+ *   bisect  the same geohashes, halving the range of one axis per bit as usual
+ *   topic   the geohash topic of every position, with position_geohash_topic()
+ *   cover   the geohashes of at most BENCHMARK_MAX_FILTERS cells (default 16) covering
+ *           BENCHMARK_BOXES random boxes (default 10000) of BENCHMARK_BOX_DEGREES degrees of
+ *           longitude by half of it of latitude (default 1), with position_geohash_cover()
+ * It reports the operations per second, ns per operation, and a checksum of the geohashes, the same
+ * for encode and bisect. For cover, it reports the cells per box and the area of the cells over
+ * the area of the boxes, the extra positions a consumer of a region receives. No broker is needed.
+ *
+ * Extra settings:
+ *   BENCHMARK_POSITIONS    number of positions (default 1000000)
+ *   BENCHMARK_PRECISION    characters of a geohash (default 6)
+ *   BENCHMARK_BOXES        number of boxes (default 10000)
+ *   BENCHMARK_BOX_DEGREES  width of a box in degrees (default 1)
+ *   BENCHMARK_MAX_FILTERS  most cells covering a box (default 16)
+ */
+
+typedef struct benchmark_result
+{
+  double ns;
+  size_t operations;
+  uint64_t checksum;
+} benchmark_result;
+
+static const char base32[] = "0123456789bcdefghjkmnpqrstuvwxyz";
+
+static double elapsed_ns(const struct timespec* start, const struct timespec* end)
+{
+  return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+static void report(const char* name, const benchmark_result* result)
+{
+  printf(
+      "%-7s %12.0f %10.1f %20llu\n",
+      name,
+      result->operations / result->ns * 1e9,
+      result->ns / result->operations,
+      (unsigned long long)result->checksum);
+}
+
+/* FNV-1a over the characters of a geohash, added up so the order doesn't matter. */
+static uint64_t hash(const char* geohash)
+{
+  uint64_t value = 14695981039346656037ull;
+  for (const char* c = geohash; *c != '\0'; c++)
+  {
+    value = (value ^ (unsigned char)*c) * 1099511628211ull;
+  }
+  return value;
+}
+
+/* The usual encoder, halving the range of one axis per bit. */
+static void bisect_geohash(geojson_coordinates position, int precision, char* geohash)
+{
+  double min_x = -180, max_x = 180, min_y = -90, max_y = 90;
+  bool longitude = true;
+  for (int i = 0; i < precision; i++)
+  {
+    int character = 0;
+    for (int bit = 0; bit < 5; bit++)
+    {
+      double* min = longitude ? &min_x : &min_y;
+      double* max = longitude ? &max_x : &max_y;
+      double middle = (*min + *max) / 2;
+      character <<= 1;
+      if ((longitude ? position.x : position.y) >= middle)
+      {
+        character |= 1;
+        *min = middle;
+      }
+      else
+      {
+        *max = middle;
+      }
+      longitude = !longitude;
+    }
+    geohash[i] = base32[character];
+  }
+  geohash[precision] = '\0';
+}
+
+static void run_encode(
+    const geojson_coordinates* positions,
+    int count,
+    int precision,
+    benchmark_result* encode,
+    benchmark_result* bisect,
+    benchmark_result* topic)
+{
+  char geohash[POSITION_GEOHASH_SIZE];
+  char name[TOPIC_SIZE];
+  struct timespec start, end;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < count; i++)
+  {
+    position_geohash_encode(positions[i], precision, geohash);
+    encode->checksum += hash(geohash);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  encode->ns = elapsed_ns(&start, &end);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < count; i++)
+  {
+    bisect_geohash(positions[i], precision, geohash);
+    bisect->checksum += hash(geohash);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  bisect->ns = elapsed_ns(&start, &end);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < count; i++)
+  {
+    topic->checksum
+        += position_geohash_topic(positions[i], precision, BENCHMARK_ID, name, sizeof(name));
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  topic->ns = elapsed_ns(&start, &end);
+  encode->operations = bisect->operations = topic->operations = count;
+}
+
+/* The area in square degrees of the cell of a geohash. */
+static double cell_area(const char* geohash)
+{
+  int bits = 5 * (int)strlen(geohash);
+  return 360.0 / (1ull << ((bits + 1) / 2)) * 180.0 / (1ull << (bits / 2));
+}
+
+static bool run_cover(
+    int boxes,
+    double box_degrees,
+    int precision,
+    int max_filters,
+    benchmark_result* result,
+    double* cells_per_box,
+    double* area_ratio)
+{
+  char(*cells)[POSITION_GEOHASH_SIZE] = malloc(max_filters * sizeof(*cells));
+  geojson_coordinates* corners = malloc(boxes * sizeof(geojson_coordinates));
+  struct timespec start, end;
+  trajectory_rng rng;
+  double cells_area = 0;
+  size_t total_cells = 0;
+
+  if (cells == NULL || corners == NULL)
+  {
+    free(cells);
+    free(corners);
+    return false;
+  }
+  trajectory_rng_seed(&rng, BENCHMARK_SEED);
+  for (int i = 0; i < boxes; i++)
+  {
+    corners[i] = (geojson_coordinates){ .x = trajectory_rng_between(&rng, -180, 180 - box_degrees),
+                                        .y = trajectory_rng_between(&rng, -80, 80) };
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < boxes; i++)
+  {
+    geojson_coordinates max = { .x = corners[i].x + box_degrees,
+                                .y = corners[i].y + box_degrees / 2 };
+    int count = position_geohash_cover(corners[i], max, precision, max_filters, cells);
+    for (int c = 0; c < count; c++)
+    {
+      result->checksum += hash(cells[c]);
+      cells_area += cell_area(cells[c]);
+    }
+    total_cells += count;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  result->ns = elapsed_ns(&start, &end);
+  result->operations = boxes;
+  *cells_per_box = (double)total_cells / boxes;
+  *area_ratio = cells_area / (boxes * box_degrees * box_degrees / 2);
+
+  free(cells);
+  free(corners);
+  return true;
+}
+
+int main(int argc, char* argv[])
+{
+  int count;
+  int precision;
+  int boxes;
+  double box_degrees;
+  int max_filters;
+  trajectory_rng rng;
+
+  if (!set_int_connection_setting(&count, "BENCHMARK_POSITIONS", DEFAULT_BENCHMARK_POSITIONS)
+      || count <= 0
+      || !set_int_connection_setting(
+          &precision, "BENCHMARK_PRECISION", DEFAULT_BENCHMARK_PRECISION)
+      || precision < 1 || precision > POSITION_GEOHASH_MAX_PRECISION
+      || !set_int_connection_setting(&boxes, "BENCHMARK_BOXES", DEFAULT_BENCHMARK_BOXES)
+      || boxes <= 0
+      || !set_double_connection_setting(
+          &box_degrees, "BENCHMARK_BOX_DEGREES", DEFAULT_BENCHMARK_BOX_DEGREES)
+      || box_degrees <= 0 || box_degrees > 20
+      || !set_int_connection_setting(
+          &max_filters, "BENCHMARK_MAX_FILTERS", DEFAULT_BENCHMARK_MAX_FILTERS)
+      || max_filters <= 0)
+  {
+    return MOSQ_ERR_INVAL;
+  }
+
+  geojson_coordinates* positions = malloc(count * sizeof(geojson_coordinates));
+  if (positions == NULL)
+  {
+    return MOSQ_ERR_NOMEM;
+  }
+  trajectory_rng_seed(&rng, BENCHMARK_SEED);
+  for (int i = 0; i < count; i++)
+  {
+    positions[i] = (geojson_coordinates){ .x = trajectory_rng_between(&rng, -180, 180),
+                                          .y = trajectory_rng_between(&rng, -90, 90) };
+  }
+
+  benchmark_result encode = { 0 };
+  benchmark_result bisect = { 0 };
+  benchmark_result topic = { 0 };
+  benchmark_result cover = { 0 };
+  double cells_per_box;
+  double area_ratio;
+  int result = MOSQ_ERR_NOMEM;
+
+  printf("%d positions, precision %d\n", count, precision);
+  printf("operation      ops/s      ns/op             checksum\n");
+  run_encode(positions, count, precision, &encode, &bisect, &topic);
+  report("encode", &encode);
+  report("bisect", &bisect);
+  report("topic", &topic);
+  if (run_cover(
+          boxes, box_degrees, precision, max_filters, &cover, &cells_per_box, &area_ratio))
+  {
+    report("cover", &cover);
+    printf(
+        "%d boxes of %g by %g degrees: %.1f cells per box, cells %.2f times the box area\n",
+        boxes,
+        box_degrees,
+        box_degrees / 2,
+        cells_per_box,
+        area_ratio);
+    result = MOSQ_ERR_SUCCESS;
+  }
+
+  free(positions);
+  return result;
+}
@@ -0,0 +1,447 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "geo_json_handler.h"
+#include "logging.h"
+#include "mosquitto.h"
+#include "mqtt_setup.h"
+#include "position_grid.h"
+#include "position_store.h"
+#include "position_trajectory.h"
+
+#define DEFAULT_BENCHMARK_VEHICLES 1000000
+#define DEFAULT_BENCHMARK_AREA_DEGREES 2.0
+#define DEFAULT_BENCHMARK_RADIUS_M 2000.0
+#define DEFAULT_BENCHMARK_ROUNDS 5
+#define DEFAULT_BENCHMARK_QUERIES 100000
+#define DEFAULT_BENCHMARK_READERS 3
+#define BENCHMARK_SEED 1
+#define STEP_SECONDS 5.0
+#define ID_SIZE 32
+#define ID_DIGITS 7
+/* The linear scans are this many times fewer than the grid queries. */
+#define SCAN_DIVISOR 1000
+/* Every SAMPLE_INTERVAL-th query is timed on its own for the latency percentiles. */
+#define SAMPLE_INTERVAL 8
+#define EARTH_RADIUS_METERS 6371008.8
+
+/*
+ * Measures the spatial index of the telemetry consumer with BENCHMARK_VEHICLES vehicles (default
+ * 1000000) driving with position_trajectory around the streets of an area of
+ * BENCHMARK_AREA_DEGREES degrees of latitude around its center (default 2, about 220 km):
+ *   insert         the first position of every vehicle, into the position store and the grid
+ *   update         BENCHMARK_ROUNDS positions of every vehicle 5 seconds apart, in a shuffled
+ *                  order, into the store and the grid
+ *   radius         BENCHMARK_QUERIES queries for the vehicles within BENCHMARK_RADIUS_M meters
+ *                  (default 2000) of random points of the area
+ *   scan           the same queries going through all the vehicles of the store, 1000 times fewer
+ *   box            BENCHMARK_QUERIES queries for the vehicles in the box around the circles
+ *   update+radius  the updates on one thread while BENCHMARK_READERS threads each do
+ *                  BENCHMARK_QUERIES radius queries
+ * It reports the operations per second and ns per operation of every thread, the vehicles found
+ * per query, and the median, 99th percentile and max latency of one query out of SAMPLE_INTERVAL.
+ * No broker is needed.
+ *
+ * Extra settings:
+ *   BENCHMARK_VEHICLES      number of vehicles, below 10000000 (default 1000000)
+ *   BENCHMARK_AREA_DEGREES  half the height of the area in degrees (default 2)
+ *   BENCHMARK_RADIUS_M      radius of the queries in meters (default 2000)
+ *   BENCHMARK_ROUNDS        number of updates per vehicle (default 5)
+ *   BENCHMARK_QUERIES       number of queries per thread (default 100000)
+ *   BENCHMARK_READERS       number of threads querying during the updates (default 3)
+ */
+
+typedef enum query_kind
+{
+  QUERY_RADIUS,
+  QUERY_SCAN,
+  QUERY_BOX
+} query_kind;
+
+typedef struct benchmark_data
+{
+  position_store* store;
+  position_grid* grid;
+  trajectory_fleet* fleet;
+  /* The order vehicles are updated in, and their positions in that order for the current round. */
+  int* order;
+  geojson_coordinates* positions;
+  int rounds;
+  int queries;
+  double radius_meters;
+} benchmark_data;
+
+typedef struct benchmark_thread
+{
+  pthread_t thread;
+  benchmark_data* data;
+  query_kind kind;
+  int queries;
+  uint64_t seed;
+  double ns;
+  size_t operations;
+  size_t found;
+  /* The timed queries, or NULL for the updating thread. */
+  double* samples;
+  size_t sample_count;
+  int* vehicles;
+} benchmark_thread;
+
+static double elapsed_ns(const struct timespec* start, const struct timespec* end)
+{
+  return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+/* Writes "vehicle-<n>" with n on ID_DIGITS digits, without the cost of snprintf(). */
+static size_t make_id(char* id, int vehicle)
+{
+  memcpy(id, "vehicle-", 8);
+  for (int i = ID_DIGITS - 1; i >= 0; i--)
+  {
+    id[8 + i] = (char)('0' + vehicle % 10);
+    vehicle /= 10;
+  }
+  id[8 + ID_DIGITS] = '\0';
+  return 8 + ID_DIGITS;
+}
+
+static int compare_doubles(const void* a, const void* b)
+{
+  double difference = *(const double*)a - *(const double*)b;
+  return (difference > 0) - (difference < 0);
+}
+
+static void report(const char* name, const benchmark_thread* thread)
+{
+  printf(
+      "%-14s %12.0f %10.1f",
+      name,
+      thread->operations / thread->ns * 1e9,
+      thread->ns / thread->operations);
+  if (thread->samples != NULL && thread->sample_count > 0)
+  {
+    qsort(thread->samples, thread->sample_count, sizeof(double), compare_doubles);
+    printf(
+        " %7.1f %8.0f %8.0f %8.0f",
+        (double)thread->found / thread->operations,
+        thread->samples[thread->sample_count / 2],
+        thread->samples[thread->sample_count * 99 / 100],
+        thread->samples[thread->sample_count - 1]);
+  }
+  printf("\n");
+}
+
+static bool update_position(benchmark_data* data, int vehicle, geojson_coordinates coordinates)
+{
+  char id[ID_SIZE];
+  size_t length = make_id(id, vehicle);
+  int number = position_store_update(data->store, id, length, coordinates);
+  return number >= 0 && position_grid_update(data->grid, number);
+}
+
+/* Sets the position of every vehicle once per round. */
+static void* update_positions(void* context)
+{
+  benchmark_thread* thread = (benchmark_thread*)context;
+  benchmark_data* data = thread->data;
+  struct timespec start, end;
+  double ns = 0;
+
+  for (int round = 0; round < data->rounds; round++)
+  {
+    trajectory_fleet_step(data->fleet, STEP_SECONDS);
+    for (size_t i = 0; i < data->fleet->count; i++)
+    {
+      data->positions[i] = trajectory_fleet_position(data->fleet, data->order[i]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < data->fleet->count; i++)
+    {
+      if (!update_position(data, data->order[i], data->positions[i]))
+      {
+        LOG_ERROR("Failure updating the position of vehicle %d", data->order[i]);
+      }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ns += elapsed_ns(&start, &end);
+  }
+  thread->ns = ns;
+  thread->operations = data->fleet->count * data->rounds;
+  return NULL;
+}
+
+/* What a dispatch service without an index would do: check the distance of every vehicle. */
+static int scan_radius(const benchmark_data* data, geojson_coordinates center, int* vehicles)
+{
+  const double radians = M_PI / 180;
+  size_t count = position_store_count(data->store);
+  int found = 0;
+  for (size_t i = 0; i < count; i++)
+  {
+    geojson_coordinates position = position_store_get(data->store, i);
+    double sin_y = sin((position.y - center.y) * radians / 2);
+    double sin_x = sin((position.x - center.x) * radians / 2);
+    double h = sin_y * sin_y + cos(center.y * radians) * cos(position.y * radians) * sin_x * sin_x;
+    if (2 * EARTH_RADIUS_METERS * asin(sqrt(h)) <= data->radius_meters)
+    {
+      vehicles[found++] = (int)i;
+    }
+  }
+  return found;
+}
+
+static int run_query(benchmark_thread* thread, geojson_coordinates center)
+{
+  benchmark_data* data = thread->data;
+  const double radians = M_PI / 180;
+  double y_degrees = data->radius_meters / EARTH_RADIUS_METERS / radians;
+  double x_degrees = y_degrees / cos(center.y * radians);
+  int max_count = (int)data->fleet->count;
+
+  switch (thread->kind)
+  {
+    case QUERY_RADIUS:
+      return position_grid_query_radius(
+          data->grid, center, data->radius_meters, thread->vehicles, max_count);
+    case QUERY_SCAN:
+      return scan_radius(data, center, thread->vehicles);
+    default:
+      return position_grid_query_box(
+          data->grid,
+          (geojson_coordinates){ .x = center.x - x_degrees, .y = center.y - y_degrees },
+          (geojson_coordinates){ .x = center.x + x_degrees, .y = center.y + y_degrees },
+          thread->vehicles,
+          max_count);
+  }
+}
+
+/* Queries around random points of the area, timing one query out of SAMPLE_INTERVAL on its own. */
+static void* query_positions(void* context)
+{
+  benchmark_thread* thread = (benchmark_thread*)context;
+  const trajectory_fleet* fleet = thread->data->fleet;
+  trajectory_rng rng;
+  struct timespec start, end, sample_start, sample_end;
+
+  trajectory_rng_seed(&rng, thread->seed);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < thread->queries; i++)
+  {
+    geojson_coordinates center = { .x = trajectory_rng_between(&rng, fleet->min_x, fleet->max_x),
+                                   .y = trajectory_rng_between(&rng, fleet->min_y, fleet->max_y) };
+    if (i % SAMPLE_INTERVAL == 0)
+    {
+      clock_gettime(CLOCK_MONOTONIC, &sample_start);
+      thread->found += run_query(thread, center);
+      clock_gettime(CLOCK_MONOTONIC, &sample_end);
+      thread->samples[thread->sample_count++] = elapsed_ns(&sample_start, &sample_end);
+    }
+    else
+    {
+      thread->found += run_query(thread, center);
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  thread->ns = elapsed_ns(&start, &end);
+  thread->operations = thread->queries;
+  return NULL;
+}
+
+static void destroy_threads(benchmark_thread* threads, int count)
+{
+  for (int i = 0; threads != NULL && i < count; i++)
+  {
+    free(threads[i].samples);
+    free(threads[i].vehicles);
+  }
+  free(threads);
+}
+
+static benchmark_thread* create_threads(
+    benchmark_data* data,
+    int count,
+    query_kind kind,
+    int queries)
+{
+  benchmark_thread* threads = calloc(count, sizeof(benchmark_thread));
+  for (int i = 0; threads != NULL && i < count; i++)
+  {
+    threads[i].data = data;
+    threads[i].kind = kind;
+    threads[i].queries = queries;
+    threads[i].seed = BENCHMARK_SEED + i;
+    if ((threads[i].samples = malloc((queries / SAMPLE_INTERVAL + 1) * sizeof(double))) == NULL
+        || (threads[i].vehicles = malloc(data->fleet->count * sizeof(int))) == NULL)
+    {
+      LOG_ERROR("Failure allocating the query buffers");
+      destroy_threads(threads, i + 1);
+      threads = NULL;
+    }
+  }
+  return threads;
+}
+
+static bool run_queries(benchmark_data* data, const char* name, query_kind kind, int queries)
+{
+  benchmark_thread* thread = create_threads(data, 1, kind, queries);
+  if (thread == NULL)
+  {
+    return false;
+  }
+  query_positions(thread);
+  report(name, thread);
+  destroy_threads(thread, 1);
+  return true;
+}
+
+static bool run_concurrently(benchmark_data* data, int reader_count)
+{
+  benchmark_thread writer = { .data = data };
+  benchmark_thread* readers = create_threads(data, reader_count, QUERY_RADIUS, data->queries);
+  int started = 0;
+  bool writer_started;
+
+  if (readers == NULL)
+  {
+    return false;
+  }
+  writer_started = pthread_create(&writer.thread, NULL, update_positions, &writer) == 0;
+  for (; writer_started && started < reader_count; started++)
+  {
+    if (pthread_create(&readers[started].thread, NULL, query_positions, &readers[started]) != 0)
+    {
+      break;
+    }
+  }
+  if (writer_started)
+  {
+    pthread_join(writer.thread, NULL);
+  }
+  for (int i = 0; i < started; i++)
+  {
+    pthread_join(readers[i].thread, NULL);
+  }
+
+  bool success = writer_started && started == reader_count;
+  if (success)
+  {
+    report("update+radius", &writer);
+    for (int i = 0; i < reader_count; i++)
+    {
+      report("", &readers[i]);
+    }
+  }
+  else
+  {
+    LOG_ERROR("Failure starting a benchmark thread");
+  }
+  destroy_threads(readers, reader_count);
+  return success;
+}
+
+static bool create_data(benchmark_data* data, int vehicles, double area_degrees)
+{
+  geojson_coordinates center = { .x = -100.0, .y = 40.0 };
+  trajectory_settings settings = trajectory_settings_default(center);
+  trajectory_rng rng;
+
+  settings.radius_degrees = area_degrees;
+  data->store = position_store_create(vehicles);
+  data->grid = position_grid_create(data->store, vehicles, POSITION_GRID_DEFAULT_CELL_DEGREES);
+  data->fleet = trajectory_fleet_create(vehicles, settings, BENCHMARK_SEED);
+  data->order = malloc(vehicles * sizeof(int));
+  data->positions = malloc(vehicles * sizeof(geojson_coordinates));
+  if (data->store == NULL || data->grid == NULL || data->fleet == NULL || data->order == NULL
+      || data->positions == NULL)
+  {
+    return false;
+  }
+
+  /* A shuffled order, so consecutive updates land far apart in the store and the grid. */
+  trajectory_rng_seed(&rng, BENCHMARK_SEED);
+  for (int i = 0; i < vehicles; i++)
+  {
+    int j = (int)((trajectory_rng_next(&rng) >> 32) % (i + 1));
+    data->order[i] = data->order[j];
+    data->order[j] = i;
+  }
+  return true;
+}
+
+static void destroy_data(benchmark_data* data)
+{
+  position_grid_destroy(data->grid);
+  position_store_destroy(data->store);
+  trajectory_fleet_destroy(data->fleet);
+  free(data->order);
+  free(data->positions);
+}
+
+int main(int argc, char* argv[])
+{
+  benchmark_data data = { 0 };
+  double area_degrees;
+  int vehicles;
+  int readers;
+  int result = MOSQ_ERR_UNKNOWN;
+
+  if (!set_int_connection_setting(&vehicles, "BENCHMARK_VEHICLES", DEFAULT_BENCHMARK_VEHICLES)
+      || vehicles <= 0
+      || vehicles >= 10000000
+      || !set_double_connection_setting(
+          &area_degrees, "BENCHMARK_AREA_DEGREES", DEFAULT_BENCHMARK_AREA_DEGREES)
+      || !(area_degrees > 0)
+      || !set_double_connection_setting(
+          &data.radius_meters, "BENCHMARK_RADIUS_M", DEFAULT_BENCHMARK_RADIUS_M)
+      || !(data.radius_meters >= 0)
+      || !set_int_connection_setting(&data.rounds, "BENCHMARK_ROUNDS", DEFAULT_BENCHMARK_ROUNDS)
+      || data.rounds <= 0
+      || !set_int_connection_setting(&data.queries, "BENCHMARK_QUERIES", DEFAULT_BENCHMARK_QUERIES)
+      || data.queries <= 0
+      || !set_int_connection_setting(&readers, "BENCHMARK_READERS", DEFAULT_BENCHMARK_READERS)
+      || readers < 0)
+  {
+    return MOSQ_ERR_INVAL;
+  }
+
+  if (create_data(&data, vehicles, area_degrees))
+  {
+    benchmark_thread insert = { .data = &data, .operations = vehicles };
+    benchmark_thread update = { .data = &data };
+    struct timespec start, end;
+    int scans = data.queries / SCAN_DIVISOR > 0 ? data.queries / SCAN_DIVISOR : 1;
+
+    printf("%d vehicles, queries within %.0f m\n", vehicles, data.radius_meters);
+    printf("operation             ops/s      ns/op   found   p50 ns   p99 ns   max ns\n");
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < vehicles; i++)
+    {
+      update_position(&data, i, trajectory_fleet_position(data.fleet, i));
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    insert.ns = elapsed_ns(&start, &end);
+    report("insert", &insert);
+    update_positions(&update);
+    report("update", &update);
+
+    if (position_store_count(data.store) == (size_t)vehicles
+        && run_queries(&data, "radius", QUERY_RADIUS, data.queries)
+        && run_queries(&data, "scan", QUERY_SCAN, scans)
+        && run_queries(&data, "box", QUERY_BOX, data.queries)
+        && (readers == 0 || run_concurrently(&data, readers)))
+    {
+      result = MOSQ_ERR_SUCCESS;
+    }
+  }
+
+  destroy_data(&data);
+  return result;
+}
@@ -0,0 +1,320 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "geo_json_handler.h"
+#include "logging.h"
+#include "mosquitto.h"
+#include "mqtt_setup.h"
+#include "position_kinematics.h"
+#include "position_trajectory.h"
+
+#define DEFAULT_BENCHMARK_VEHICLES 100000
+#define DEFAULT_BENCHMARK_ROUNDS 10
+#define DEFAULT_BENCHMARK_BATCH_SIZE 256
+#define DEFAULT_BENCHMARK_WINDOW_SECONDS 60
+#define DEFAULT_BENCHMARK_PANES 6
+#define BENCHMARK_SEED 1
+#define STEP_SECONDS 5
+#define NANOSECONDS_PER_SECOND 1000000000ull
+
+/*
+ * Measures the kinematics of the telemetry consumer with BENCHMARK_VEHICLES vehicles (default
+ * 100000) driving with position_trajectory, each sending a position every 5 seconds:
+ *   segments    the length and heading of the segments between the last two positions of every
+ *               vehicle, with position_kinematics_segments()
+ *   libm        the same segments, one at a time with the sin, cos and atan2 of libm
+ *   kinematics  BENCHMARK_ROUNDS positions of every vehicle added in batches of
+ *               BENCHMARK_BATCH_SIZE positions (default 256), in a random order of the vehicles
+ *               like messages from many producers, with windows of BENCHMARK_WINDOW_SECONDS
+ *               (default 60) sliding by 1/BENCHMARK_PANES of their length (default 6)
+ * It reports the operations per second, ns per operation, the meters driven and the window
+ * summaries. No broker is needed.
+ *
+ * Extra settings:
+ *   BENCHMARK_VEHICLES        number of vehicles (default 100000)
+ *   BENCHMARK_ROUNDS          number of positions per vehicle (default 10)
+ *   BENCHMARK_BATCH_SIZE      positions per batch (default 256)
+ *   BENCHMARK_WINDOW_SECONDS  length of a window (default 60)
+ *   BENCHMARK_PANES           number of steps a window slides by (default 6)
+ */
+
+typedef struct benchmark_data
+{
+  trajectory_fleet* fleet;
+  /* The positions of the previous round, the segments of the last one and the order of the
+   * vehicles in the batches. */
+  double* from_x;
+  double* from_y;
+  double* meters;
+  double* headings;
+  int* order;
+  double* batch_x;
+  double* batch_y;
+  int batch_size;
+  int rounds;
+} benchmark_data;
+
+typedef struct benchmark_result
+{
+  double ns;
+  size_t operations;
+  double meters;
+  size_t summaries;
+} benchmark_result;
+
+static double elapsed_ns(const struct timespec* start, const struct timespec* end)
+{
+  return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+static void report(const char* name, const benchmark_result* result)
+{
+  printf(
+      "%-10s %12.0f %10.1f %14.0f",
+      name,
+      result->operations / result->ns * 1e9,
+      result->ns / result->operations,
+      result->meters);
+  if (result->summaries > 0)
+  {
+    printf(" %10zu", result->summaries);
+  }
+  printf("\n");
+}
+
+static void count_summary(int vehicle, const position_kinematics_summary* summary, void* context)
+{
+  (*(size_t*)context)++;
+}
+
+/* The usual haversine formula and initial bearing. */
+static void libm_segments(benchmark_data* data)
+{
+  const trajectory_fleet* fleet = data->fleet;
+  const double radians = M_PI / 180;
+  for (size_t i = 0; i < fleet->count; i++)
+  {
+    double latitude_1 = data->from_y[i] * radians;
+    double latitude_2 = fleet->y[i] * radians;
+    double longitudes = (fleet->x[i] - data->from_x[i]) * radians;
+    double sin_latitudes = sin((latitude_2 - latitude_1) / 2);
+    double sin_longitudes = sin(longitudes / 2);
+    double a = sin_latitudes * sin_latitudes
+        + cos(latitude_1) * cos(latitude_2) * sin_longitudes * sin_longitudes;
+    data->meters[i]
+        = 2 * POSITION_KINEMATICS_EARTH_RADIUS_METERS * atan2(sqrt(a), sqrt(fmax(0, 1 - a)));
+    data->headings[i] = atan2(
+                            sin(longitudes) * cos(latitude_2),
+                            cos(latitude_1) * sin(latitude_2)
+                                - sin(latitude_1) * cos(latitude_2) * cos(longitudes))
+        / radians;
+  }
+}
+
+static double sum(const double* values, size_t count)
+{
+  double total = 0;
+  for (size_t i = 0; i < count; i++)
+  {
+    total += values[i];
+  }
+  return total;
+}
+
+/* Steps the fleet once per round and computes the segments from the previous positions, with
+ * position_kinematics_segments() then with libm. */
+static void run_segments(benchmark_data* data, benchmark_result* segments, benchmark_result* libm)
+{
+  trajectory_fleet* fleet = data->fleet;
+  struct timespec start, end;
+
+  for (int round = 0; round < data->rounds; round++)
+  {
+    memcpy(data->from_x, fleet->x, fleet->count * sizeof(double));
+    memcpy(data->from_y, fleet->y, fleet->count * sizeof(double));
+    trajectory_fleet_step(fleet, STEP_SECONDS);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    position_kinematics_segments(
+        data->from_x,
+        data->from_y,
+        fleet->x,
+        fleet->y,
+        (int)fleet->count,
+        data->meters,
+        data->headings);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    segments->ns += elapsed_ns(&start, &end);
+    segments->meters += sum(data->meters, fleet->count);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    libm_segments(data);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    libm->ns += elapsed_ns(&start, &end);
+    libm->meters += sum(data->meters, fleet->count);
+  }
+  segments->operations = libm->operations = fleet->count * data->rounds;
+}
+
+/* Adds every vehicle's position once per round, in batches in the random order of the vehicles, as
+ * if the batches were received 5 seconds apart. */
+static bool run_kinematics(
+    benchmark_data* data,
+    position_kinematics* kinematics,
+    benchmark_result* result)
+{
+  trajectory_fleet* fleet = data->fleet;
+  struct timespec start, end;
+  bool success = true;
+
+  for (int round = 0; round < data->rounds && success; round++)
+  {
+    uint64_t now_ns = (uint64_t)(round + 1) * STEP_SECONDS * NANOSECONDS_PER_SECOND;
+    trajectory_fleet_step(fleet, STEP_SECONDS);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t first = 0; first < fleet->count && success; first += data->batch_size)
+    {
+      int count = fleet->count - first < (size_t)data->batch_size ? (int)(fleet->count - first)
+                                                                  : data->batch_size;
+      const int* vehicles = data->order + first;
+      /* The positions of a batch are gathered from the decoded messages, as in the consumer. */
+      for (int i = 0; i < count; i++)
+      {
+        data->batch_x[i] = fleet->x[vehicles[i]];
+        data->batch_y[i] = fleet->y[vehicles[i]];
+      }
+      success = position_kinematics_update(
+                    kinematics,
+                    vehicles,
+                    data->batch_x,
+                    data->batch_y,
+                    count,
+                    now_ns,
+                    count_summary,
+                    &result->summaries)
+          == count;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    result->ns += elapsed_ns(&start, &end);
+  }
+  result->operations = fleet->count * data->rounds;
+  for (size_t i = 0; i < fleet->count; i++)
+  {
+    position_kinematics_state state;
+    if (position_kinematics_get(kinematics, (int)i, &state))
+    {
+      result->meters += state.total_meters;
+    }
+  }
+  return success;
+}
+
+static bool create_data(benchmark_data* data, int vehicles)
+{
+  geojson_coordinates center = { .x = -100.0, .y = 40.0 };
+  trajectory_rng rng;
+
+  data->fleet
+      = trajectory_fleet_create(vehicles, trajectory_settings_default(center), BENCHMARK_SEED);
+  data->from_x = malloc(vehicles * sizeof(double));
+  data->from_y = malloc(vehicles * sizeof(double));
+  data->meters = malloc(vehicles * sizeof(double));
+  data->headings = malloc(vehicles * sizeof(double));
+  data->order = malloc(vehicles * sizeof(int));
+  data->batch_x = malloc(data->batch_size * sizeof(double));
+  data->batch_y = malloc(data->batch_size * sizeof(double));
+  if (data->fleet == NULL || data->from_x == NULL || data->from_y == NULL || data->meters == NULL
+      || data->headings == NULL || data->order == NULL || data->batch_x == NULL
+      || data->batch_y == NULL)
+  {
+    return false;
+  }
+
+  /* A Fisher-Yates shuffle of the vehicles. */
+  trajectory_rng_seed(&rng, BENCHMARK_SEED);
+  for (int i = 0; i < vehicles; i++)
+  {
+    data->order[i] = i;
+  }
+  for (int i = vehicles - 1; i > 0; i--)
+  {
+    int j = (int)(trajectory_rng_uniform(&rng) * (i + 1));
+    int vehicle = data->order[i];
+    data->order[i] = data->order[j];
+    data->order[j] = vehicle;
+  }
+  return true;
+}
+
+static void destroy_data(benchmark_data* data)
+{
+  free(data->from_x);
+  free(data->from_y);
+  free(data->meters);
+  free(data->headings);
+  free(data->order);
+  free(data->batch_x);
+  free(data->batch_y);
+  trajectory_fleet_destroy(data->fleet);
+}
+
+int main(int argc, char* argv[])
+{
+  benchmark_data data = { 0 };
+  position_kinematics* kinematics = NULL;
+  int vehicles;
+  int window_seconds;
+  int panes;
+  int result = MOSQ_ERR_UNKNOWN;
+
+  if (!set_int_connection_setting(&vehicles, "BENCHMARK_VEHICLES", DEFAULT_BENCHMARK_VEHICLES)
+      || vehicles <= 0
+      || !set_int_connection_setting(&data.rounds, "BENCHMARK_ROUNDS", DEFAULT_BENCHMARK_ROUNDS)
+      || data.rounds <= 0
+      || !set_int_connection_setting(
+          &data.batch_size, "BENCHMARK_BATCH_SIZE", DEFAULT_BENCHMARK_BATCH_SIZE)
+      || data.batch_size <= 0
+      || !set_int_connection_setting(
+          &window_seconds, "BENCHMARK_WINDOW_SECONDS", DEFAULT_BENCHMARK_WINDOW_SECONDS)
+      || window_seconds <= 0
+      || !set_int_connection_setting(&panes, "BENCHMARK_PANES", DEFAULT_BENCHMARK_PANES)
+      || panes <= 0)
+  {
+    return MOSQ_ERR_INVAL;
+  }
+
+  if (create_data(&data, vehicles)
+      && (kinematics = position_kinematics_create(
+              vehicles, (uint64_t)window_seconds * NANOSECONDS_PER_SECOND, panes))
+          != NULL)
+  {
+    benchmark_result segments = { 0 };
+    benchmark_result libm = { 0 };
+    benchmark_result updates = { 0 };
+
+    printf(
+        "%d vehicles, batches of %d, windows of %d s sliding by %d s\n",
+        vehicles,
+        data.batch_size,
+        window_seconds,
+        window_seconds / panes);
+    printf("operation         ops/s      ns/op         meters  summaries\n");
+    run_segments(&data, &segments, &libm);
+    if (run_kinematics(&data, kinematics, &updates))
+    {
+      report("segments", &segments);
+      report("libm", &libm);
+      report("kinematics", &updates);
+      result = MOSQ_ERR_SUCCESS;
+    }
+  }
+
+  position_kinematics_destroy(kinematics);
+  destroy_data(&data);
+  return result;
+}
@@ -0,0 +1,365 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "geo_json_handler.h"
+#include "logging.h"
+#include "mosquitto.h"
+#include "mqtt_setup.h"
+#include "position_store.h"
+#include "position_trajectory.h"
+
+#define DEFAULT_BENCHMARK_VEHICLES 1000000
+#define DEFAULT_BENCHMARK_ROUNDS 5
+#define DEFAULT_BENCHMARK_LOOKUPS 10000000
+#define DEFAULT_BENCHMARK_READERS 3
+#define BENCHMARK_SEED 1
+#define STEP_SECONDS 5.0
+#define TOPIC_SIZE 48
+#define ID_DIGITS 7
+/* Every SAMPLE_INTERVAL-th lookup is timed on its own for the latency percentiles. */
+#define SAMPLE_INTERVAL 32
+
+/*
+ * Measures the last known position store of the telemetry consumer with BENCHMARK_VEHICLES
+ * vehicles (default 1000000) driving with position_trajectory:
+ *   insert         the first position of every vehicle, from its topic
+ *                  ("vehicles/vehicle-<n>/position")
+ *   update         BENCHMARK_ROUNDS positions of every vehicle, in a shuffled order like messages
+ *                  from many producers, with the vehicle id found in the topic
+ *   lookup         BENCHMARK_LOOKUPS lookups of random vehicle ids ("vehicle-<n>") on one thread
+ *   update+lookup  the updates on one thread while BENCHMARK_READERS threads each do
+ *                  BENCHMARK_LOOKUPS lookups
+ * It reports the operations per second and ns per operation of every thread, and the median, 99th
+ * percentile and max latency of one lookup out of SAMPLE_INTERVAL, which include reading the
+ * clock. Topics and ids are written as they are needed, and the positions of a round are copied in
+ * update order beforehand, so the store's cache misses are the only ones measured. No broker is
+ * needed.
+ *
+ * Extra settings:
+ *   BENCHMARK_VEHICLES  number of vehicles, below 10000000 (default 1000000)
+ *   BENCHMARK_ROUNDS    number of updates per vehicle (default 5)
+ *   BENCHMARK_LOOKUPS   number of lookups per thread (default 10000000)
+ *   BENCHMARK_READERS   number of threads looking up during the updates (default 3)
+ */
+
+typedef struct benchmark_data
+{
+  position_store* store;
+  trajectory_fleet* fleet;
+  /* The order vehicles are updated in, and their positions in that order for the current round. */
+  int* order;
+  geojson_coordinates* positions;
+  int rounds;
+  int lookups;
+} benchmark_data;
+
+typedef struct benchmark_thread
+{
+  pthread_t thread;
+  benchmark_data* data;
+  uint64_t seed;
+  double ns;
+  size_t operations;
+  /* The timed lookups, or NULL for the updating thread. */
+  double* samples;
+  size_t sample_count;
+  size_t found;
+} benchmark_thread;
+
+static double elapsed_ns(const struct timespec* start, const struct timespec* end)
+{
+  return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+/* Writes "vehicle-<n>" with n on ID_DIGITS digits, without the cost of snprintf(). */
+static size_t make_id(char* id, int vehicle)
+{
+  memcpy(id, "vehicle-", 8);
+  for (int i = ID_DIGITS - 1; i >= 0; i--)
+  {
+    id[8 + i] = (char)('0' + vehicle % 10);
+    vehicle /= 10;
+  }
+  id[8 + ID_DIGITS] = '\0';
+  return 8 + ID_DIGITS;
+}
+
+static void make_topic(char* topic, int vehicle)
+{
+  size_t prefix_length = strlen(POSITION_STORE_TOPIC_PREFIX);
+  memcpy(topic, POSITION_STORE_TOPIC_PREFIX, prefix_length);
+  size_t length = make_id(topic + prefix_length, vehicle);
+  strcpy(topic + prefix_length + length, POSITION_STORE_TOPIC_SUFFIX);
+}
+
+static int compare_doubles(const void* a, const void* b)
+{
+  double difference = *(const double*)a - *(const double*)b;
+  return (difference > 0) - (difference < 0);
+}
+
+static void report(const char* name, const benchmark_thread* thread)
+{
+  printf(
+      "%-14s %13.0f %8.1f",
+      name,
+      thread->operations / thread->ns * 1e9,
+      thread->ns / thread->operations);
+  if (thread->samples != NULL && thread->sample_count > 0)
+  {
+    qsort(thread->samples, thread->sample_count, sizeof(double), compare_doubles);
+    printf(
+        " %8.0f %8.0f %8.0f",
+        thread->samples[thread->sample_count / 2],
+        thread->samples[thread->sample_count * 99 / 100],
+        thread->samples[thread->sample_count - 1]);
+  }
+  printf("\n");
+}
+
+/* Sets the position of every vehicle once per round, from its message topic. */
+static void* update_positions(void* context)
+{
+  benchmark_thread* thread = (benchmark_thread*)context;
+  benchmark_data* data = thread->data;
+  struct timespec start, end;
+  char topic[TOPIC_SIZE];
+  double ns = 0;
+
+  for (int round = 0; round < data->rounds; round++)
+  {
+    trajectory_fleet_step(data->fleet, STEP_SECONDS);
+    for (size_t i = 0; i < data->fleet->count; i++)
+    {
+      data->positions[i] = trajectory_fleet_position(data->fleet, data->order[i]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < data->fleet->count; i++)
+    {
+      size_t length;
+      make_topic(topic, data->order[i]);
+      const char* id = position_store_topic_vehicle_id(topic, &length);
+      if (position_store_update(data->store, id, length, data->positions[i]) < 0)
+      {
+        LOG_ERROR("Failure updating the position of %s", topic);
+      }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ns += elapsed_ns(&start, &end);
+  }
+  thread->ns = ns;
+  thread->operations = data->fleet->count * data->rounds;
+  return NULL;
+}
+
+/* Looks up random vehicles, timing one lookup out of SAMPLE_INTERVAL on its own. */
+static void* look_up_positions(void* context)
+{
+  benchmark_thread* thread = (benchmark_thread*)context;
+  benchmark_data* data = thread->data;
+  trajectory_rng rng;
+  struct timespec start, end, sample_start, sample_end;
+  geojson_coordinates coordinates;
+  char id[TOPIC_SIZE];
+
+  trajectory_rng_seed(&rng, thread->seed);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < data->lookups; i++)
+  {
+    size_t length = make_id(id, (int)((trajectory_rng_next(&rng) >> 32) % data->fleet->count));
+    if (i % SAMPLE_INTERVAL == 0)
+    {
+      clock_gettime(CLOCK_MONOTONIC, &sample_start);
+      thread->found += position_store_lookup(data->store, id, length, &coordinates);
+      clock_gettime(CLOCK_MONOTONIC, &sample_end);
+      thread->samples[thread->sample_count++] = elapsed_ns(&sample_start, &sample_end);
+    }
+    else
+    {
+      thread->found += position_store_lookup(data->store, id, length, &coordinates);
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  thread->ns = elapsed_ns(&start, &end);
+  thread->operations = data->lookups;
+  return NULL;
+}
+
+static benchmark_thread* create_threads(benchmark_data* data, int count)
+{
+  benchmark_thread* threads = calloc(count, sizeof(benchmark_thread));
+  for (int i = 0; threads != NULL && i < count; i++)
+  {
+    threads[i].data = data;
+    threads[i].seed = BENCHMARK_SEED + i;
+    if ((threads[i].samples = malloc((data->lookups / SAMPLE_INTERVAL + 1) * sizeof(double)))
+        == NULL)
+    {
+      LOG_ERROR("Failure allocating the lookup samples");
+      for (int j = 0; j <= i; j++)
+      {
+        free(threads[j].samples);
+      }
+      free(threads);
+      threads = NULL;
+    }
+  }
+  return threads;
+}
+
+static void destroy_threads(benchmark_thread* threads, int count)
+{
+  for (int i = 0; threads != NULL && i < count; i++)
+  {
+    free(threads[i].samples);
+  }
+  free(threads);
+}
+
+static bool run_concurrently(benchmark_data* data, int reader_count)
+{
+  benchmark_thread writer = { .data = data };
+  benchmark_thread* readers = create_threads(data, reader_count);
+  int started = 0;
+  bool writer_started;
+
+  if (readers == NULL)
+  {
+    return false;
+  }
+  writer_started = pthread_create(&writer.thread, NULL, update_positions, &writer) == 0;
+  for (; writer_started && started < reader_count; started++)
+  {
+    if (pthread_create(&readers[started].thread, NULL, look_up_positions, &readers[started]) != 0)
+    {
+      break;
+    }
+  }
+  if (writer_started)
+  {
+    pthread_join(writer.thread, NULL);
+  }
+  for (int i = 0; i < started; i++)
+  {
+    pthread_join(readers[i].thread, NULL);
+  }
+
+  bool success = writer_started && started == reader_count;
+  if (success)
+  {
+    report("update+lookup", &writer);
+    for (int i = 0; i < reader_count; i++)
+    {
+      report("", &readers[i]);
+    }
+  }
+  else
+  {
+    LOG_ERROR("Failure starting a benchmark thread");
+  }
+  destroy_threads(readers, reader_count);
+  return success;
+}
+
+static bool create_data(benchmark_data* data, int vehicles)
+{
+  geojson_coordinates center = { .x = -122.335, .y = 47.608 };
+  trajectory_rng rng;
+
+  data->store = position_store_create(vehicles);
+  data->fleet
+      = trajectory_fleet_create(vehicles, trajectory_settings_default(center), BENCHMARK_SEED);
+  data->order = malloc(vehicles * sizeof(int));
+  data->positions = malloc(vehicles * sizeof(geojson_coordinates));
+  if (data->store == NULL || data->fleet == NULL || data->order == NULL || data->positions == NULL)
+  {
+    return false;
+  }
+
+  /* A shuffled order, so consecutive updates land far apart in the store. */
+  trajectory_rng_seed(&rng, BENCHMARK_SEED);
+  for (int i = 0; i < vehicles; i++)
+  {
+    int j = (int)((trajectory_rng_next(&rng) >> 32) % (i + 1));
+    data->order[i] = data->order[j];
+    data->order[j] = i;
+  }
+  return true;
+}
+
+static void destroy_data(benchmark_data* data)
+{
+  position_store_destroy(data->store);
+  trajectory_fleet_destroy(data->fleet);
+  free(data->order);
+  free(data->positions);
+}
+
+int main(int argc, char* argv[])
+{
+  benchmark_data data = { 0 };
+  benchmark_thread* lookup = NULL;
+  char topic[TOPIC_SIZE];
+  int vehicles;
+  int readers;
+  int result = MOSQ_ERR_UNKNOWN;
+
+  if (!set_int_connection_setting(&vehicles, "BENCHMARK_VEHICLES", DEFAULT_BENCHMARK_VEHICLES)
+      || vehicles <= 0
+      || vehicles >= 10000000
+      || !set_int_connection_setting(&data.rounds, "BENCHMARK_ROUNDS", DEFAULT_BENCHMARK_ROUNDS)
+      || data.rounds <= 0
+      || !set_int_connection_setting(&data.lookups, "BENCHMARK_LOOKUPS", DEFAULT_BENCHMARK_LOOKUPS)
+      || data.lookups <= 0
+      || !set_int_connection_setting(&readers, "BENCHMARK_READERS", DEFAULT_BENCHMARK_READERS)
+      || readers < 0)
+  {
+    return MOSQ_ERR_INVAL;
+  }
+
+  if (create_data(&data, vehicles) && (lookup = create_threads(&data, 1)) != NULL)
+  {
+    benchmark_thread insert = { .data = &data, .operations = vehicles };
+    benchmark_thread update = { .data = &data };
+    struct timespec start, end;
+
+    printf("%d vehicles\n", vehicles);
+    printf("operation              ops/s  ns/op  p50 ns  p99 ns  max ns\n");
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < vehicles; i++)
+    {
+      size_t length;
+      make_topic(topic, i);
+      const char* id = position_store_topic_vehicle_id(topic, &length);
+      position_store_update(data.store, id, length, trajectory_fleet_position(data.fleet, i));
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    insert.ns = elapsed_ns(&start, &end);
+    report("insert", &insert);
+
+    update_positions(&update);
+    report("update", &update);
+    look_up_positions(lookup);
+    report("lookup", lookup);
+
+    if (position_store_count(data.store) != (size_t)vehicles || lookup->found != lookup->operations)
+    {
+      LOG_ERROR("Failure finding the vehicles");
+    }
+    else if (readers == 0 || run_concurrently(&data, readers))
+    {
+      result = MOSQ_ERR_SUCCESS;
+    }
+  }
+
+  destroy_threads(lookup, 1);
+  destroy_data(&data);
+  return result;
+}
@@ -0,0 +1,284 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#include "logging.h"
+#include "mosquitto.h"
+#include "mqtt_event_loop.h"
+#include "mqtt_reactor.h"
+#include "mqtt_setup.h"
+
+#define QOS_LEVEL 0
+#define MQTT_VERSION MQTT_PROTOCOL_V311
+#define PAYLOAD "0123456789abcdef0123456789abcdef"
+
+#define DEFAULT_BENCHMARK_CLIENTS 100
+#define DEFAULT_BENCHMARK_DURATION_SECONDS 10
+
+/*
+ * Compares driving N connections from one thread with mqtt_reactor against the thread-per-client
+ * model used by the samples (mosquitto_loop_start). Every client subscribes to its own topic and
+ * keeps exactly one message in flight: each time it receives its message back from the broker it
+ * publishes the next one. Run it against a local broker, ex. `mosquitto -p 1883`, with an env file
+ * containing MQTT_HOST_NAME=localhost, MQTT_TCP_PORT=1883 and MQTT_USE_TLS=false.
+ *
+ * Extra settings:
+ *   BENCHMARK_MODE              reactor (default) or threads
+ *   BENCHMARK_CLIENTS           number of connections (default 100)
+ *   BENCHMARK_DURATION_SECONDS  measurement time (default 10)
+ */
+
+typedef struct benchmark_client
+{
+  mqtt_client_obj obj; /* must be first, mosquitto callbacks receive a pointer to it */
+  struct mosquitto* mosq;
+  mqtt_reactor_client* reactor_client;
+  char client_id[64];
+  char topic[96];
+} benchmark_client;
+
+static unsigned long long messages_received = 0;
+static bool measuring = false;
+
+static void publish_next(benchmark_client* client)
+{
+  int rc;
+  if (client->reactor_client != NULL)
+  {
+    rc = mqtt_reactor_publish(
+        client->reactor_client,
+        NULL,
+        client->topic,
+        (int)strlen(PAYLOAD),
+        PAYLOAD,
+        QOS_LEVEL,
+        false,
+        NULL);
+  }
+  else
+  {
+    rc = mosquitto_publish_v5(
+        client->mosq, NULL, client->topic, (int)strlen(PAYLOAD), PAYLOAD, QOS_LEVEL, false, NULL);
+  }
+
+  if (rc != MOSQ_ERR_SUCCESS)
+  {
+    LOG_ERROR("Failure while publishing: %s", mosquitto_strerror(rc));
+  }
+}
+
+static void on_benchmark_connect(
+    struct mosquitto* mosq,
+    void* obj,
+    int reason_code,
+    int flags,
+    const mosquitto_property* props)
+{
+  benchmark_client* client = (benchmark_client*)obj;
+  int rc;
+
+  if (reason_code != 0)
+  {
+    LOG_ERROR("%s failed to connect: %s", client->client_id, mosquitto_connack_string(reason_code));
+    mqtt_client_stop();
+  }
+  else if ((rc = mosquitto_subscribe_v5(mosq, NULL, client->topic, QOS_LEVEL, 0, NULL))
+           != MOSQ_ERR_SUCCESS)
+  {
+    LOG_ERROR("%s failed to subscribe: %s", client->client_id, mosquitto_strerror(rc));
+    mqtt_client_stop();
+  }
+}
+
+static void on_benchmark_subscribe(
+    struct mosquitto* mosq,
+    void* obj,
+    int mid,
+    int qos_count,
+    const int* granted_qos,
+    const mosquitto_property* props)
+{
+  publish_next((benchmark_client*)obj);
+}
+
+static void on_benchmark_message(
+    struct mosquitto* mosq,
+    void* obj,
+    const struct mosquitto_message* msg,
+    const mosquitto_property* props)
+{
+  if (__atomic_load_n(&measuring, __ATOMIC_RELAXED))
+  {
+    __atomic_fetch_add(&messages_received, 1, __ATOMIC_RELAXED);
+  }
+  publish_next((benchmark_client*)obj);
+}
+
+static void stop_benchmark(void* context) { mqtt_client_stop(); }
+
+static double timespec_seconds(struct timespec ts) { return ts.tv_sec + ts.tv_nsec / 1e9; }
+
+static double cpu_seconds()
+{
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec
+      + usage.ru_stime.tv_usec / 1e6;
+}
+
+static long thread_count()
+{
+  long threads = 0;
+  char line[256];
+  FILE* status = fopen("/proc/self/status", "r");
+  if (status != NULL)
+  {
+    while (fgets(line, sizeof(line), status) != NULL)
+    {
+      if (sscanf(line, "Threads: %ld", &threads) == 1)
+      {
+        break;
+      }
+    }
+    fclose(status);
+  }
+  return threads;
+}
+
+int main(int argc, char* argv[])
+{
+  mqtt_client_connection_settings connection_settings;
+  char* mode;
+  int client_count;
+  int duration_seconds;
+
+  if (!mqtt_client_setup(argv[1], &connection_settings)
+      || !set_char_connection_setting(&mode, "BENCHMARK_MODE", false)
+      || !set_int_connection_setting(&client_count, "BENCHMARK_CLIENTS", DEFAULT_BENCHMARK_CLIENTS)
+      || !set_int_connection_setting(
+          &duration_seconds, "BENCHMARK_DURATION_SECONDS", DEFAULT_BENCHMARK_DURATION_SECONDS))
+  {
+    return MOSQ_ERR_UNKNOWN;
+  }
+
+  bool use_reactor = mode == NULL || strcmp(mode, "reactor") == 0;
+  const char* client_id_prefix
+      = connection_settings.client_id != NULL ? connection_settings.client_id : "benchmark";
+  mqtt_event_loop* loop = mqtt_client_event_loop();
+  mqtt_reactor reactor;
+  benchmark_client* clients = calloc(client_count, sizeof(benchmark_client));
+  int result = MOSQ_ERR_SUCCESS;
+  int connected = 0;
+
+  if (loop == NULL || clients == NULL || (use_reactor && !mqtt_reactor_init(&reactor, loop)))
+  {
+    LOG_ERROR("Failed to initialize the benchmark.");
+    return MOSQ_ERR_UNKNOWN;
+  }
+
+  for (int i = 0; i < client_count && keep_running; i++)
+  {
+    benchmark_client* client = &clients[i];
+    snprintf(client->client_id, sizeof(client->client_id), "%s-%d", client_id_prefix, i);
+    snprintf(client->topic, sizeof(client->topic), "benchmark/%s", client->client_id);
+    client->obj.mqtt_version = MQTT_VERSION;
+    connection_settings.client_id = client->client_id;
+
+    if ((client->mosq
+         = mqtt_client_create(&connection_settings, false, on_benchmark_connect, &client->obj))
+        == NULL)
+    {
+      result = MOSQ_ERR_UNKNOWN;
+      break;
+    }
+    /* Replace the logging sample callbacks, they would dominate the measurement. */
+    mosquitto_subscribe_v5_callback_set(client->mosq, on_benchmark_subscribe);
+    mosquitto_message_v5_callback_set(client->mosq, on_benchmark_message);
+
+    if ((result = mosquitto_connect_bind_v5(
+             client->mosq,
+             client->obj.hostname,
+             client->obj.tcp_port,
+             client->obj.keep_alive_in_seconds,
+             NULL,
+             NULL))
+        != MOSQ_ERR_SUCCESS)
+    {
+      LOG_ERROR("Failed to connect %s: %s", client->client_id, mosquitto_strerror(result));
+      break;
+    }
+    connected++;
+
+    if (use_reactor)
+    {
+      if ((client->reactor_client = mqtt_reactor_add_client(&reactor, client->mosq)) == NULL)
+      {
+        result = MOSQ_ERR_UNKNOWN;
+        break;
+      }
+    }
+    else if ((result = mosquitto_loop_start(client->mosq)) != MOSQ_ERR_SUCCESS)
+    {
+      LOG_ERROR("Failure starting mosquitto loop: %s", mosquitto_strerror(result));
+      break;
+    }
+  }
+
+  if (result == MOSQ_ERR_SUCCESS && keep_running)
+  {
+    struct timespec start, end;
+    LOG_INFO(APP_LOG_TAG, "%d clients connected, measuring for %d s", connected, duration_seconds);
+
+    mqtt_event_loop_add_timer(loop, duration_seconds * 1000, 0, stop_benchmark, NULL);
+    double cpu_start = cpu_seconds();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    __atomic_store_n(&measuring, true, __ATOMIC_RELAXED);
+
+    result = mqtt_client_run();
+
+    __atomic_store_n(&measuring, false, __ATOMIC_RELAXED);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double cpu_used = cpu_seconds() - cpu_start;
+    double elapsed = timespec_seconds(end) - timespec_seconds(start);
+    double messages = (double)__atomic_load_n(&messages_received, __ATOMIC_RELAXED);
+    double cores_used = cpu_used / elapsed;
+
+    printf("mode                 %s\n", use_reactor ? "reactor" : "threads");
+    printf("connections          %d\n", connected);
+    printf("threads              %ld\n", thread_count());
+    printf("messages             %.0f\n", messages);
+    printf("messages/s           %.0f\n", messages / elapsed);
+    printf("cpu cores used       %.2f\n", cores_used);
+    printf("messages/cpu-second  %.0f\n", cpu_used > 0 ? messages / cpu_used : 0);
+    printf("connections/core     %.0f\n", cores_used > 0 ? connected / cores_used : 0);
+  }
+
+  for (int i = 0; i < client_count; i++)
+  {
+    if (clients[i].mosq != NULL)
+    {
+      if (clients[i].reactor_client != NULL)
+      {
+        mqtt_reactor_remove_client(&reactor, clients[i].reactor_client);
+      }
+      mosquitto_disconnect_v5(clients[i].mosq, MOSQ_ERR_SUCCESS, NULL);
+      if (!use_reactor)
+      {
+        mosquitto_loop_stop(clients[i].mosq, false);
+      }
+      mosquitto_destroy(clients[i].mosq);
+    }
+  }
+  if (use_reactor)
+  {
+    mqtt_reactor_destroy(&reactor);
+  }
+  free(clients);
+  mosquitto_lib_cleanup();
+  return result;
+}
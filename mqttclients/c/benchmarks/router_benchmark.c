@@ -0,0 +1,182 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "logging.h"
+#include "mosquitto.h"
+#include "mqtt_protocol.h"
+#include "mqtt_setup.h"
+#include "mqtt_topic_router.h"
+
+#define DEFAULT_BENCHMARK_FILTERS 10000
+#define DEFAULT_BENCHMARK_MESSAGES 1000000
+#define REGIONS 16
+#define TOPIC_SIZE 64
+
+/*
+ * Measures the cost of finding the handlers for a received message with BENCHMARK_FILTERS topic
+ * filters registered. Half of the filters are exact ("fleet/<region>/vehicle-<n>/position"), a
+ * quarter use + ("fleet/<region>/+/alarm-<n>") and a quarter use #
+ * ("fleet/<region>/vehicle-<n>/#").
+ * Every message matches at least one filter. The benchmark compares:
+ *   linear          mosquitto_topic_matches_sub() against every filter, what a single
+ *                   handle_message callback comparing topics ends up doing
+ *   trie            mqtt_topic_router_dispatch() matching the topic
+ *   subscription id mqtt_topic_router_dispatch() with the MQTT 5 subscription identifier
+ * No broker is needed.
+ *
+ * Extra settings:
+ *   BENCHMARK_FILTERS   number of registered filters (default 10000)
+ *   BENCHMARK_MESSAGES  number of messages dispatched by the router (default 1000000), the
+ *                       linear scan dispatches 1% of them
+ */
+
+typedef struct route
+{
+  char filter[TOPIC_SIZE];
+  char topic[TOPIC_SIZE];
+  int id;
+} route;
+
+static unsigned long long handled = 0;
+
+static void count_message(
+    struct mosquitto* mosq,
+    const struct mosquitto_message* message,
+    const mosquitto_property* props,
+    void* context)
+{
+  handled++;
+}
+
+/* Visits the filters in a scattered order so the same trie path isn't always in the cache. */
+static route* route_for_message(route* routes, int filter_count, int i)
+{
+  return &routes[((size_t)i * 7919) % filter_count];
+}
+
+static double elapsed_ns(struct timespec start, struct timespec end)
+{
+  return (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+}
+
+static void make_route(route* route, int n)
+{
+  int region = n % REGIONS;
+  switch (n % 4)
+  {
+    case 0:
+      snprintf(route->filter, TOPIC_SIZE, "fleet/region-%d/+/alarm-%d", region, n);
+      snprintf(route->topic, TOPIC_SIZE, "fleet/region-%d/vehicle-%d/alarm-%d", region, n, n);
+      break;
+    case 1:
+      snprintf(route->filter, TOPIC_SIZE, "fleet/region-%d/vehicle-%d/#", region, n);
+      snprintf(route->topic, TOPIC_SIZE, "fleet/region-%d/vehicle-%d/status", region, n);
+      break;
+    default:
+      snprintf(route->filter, TOPIC_SIZE, "fleet/region-%d/vehicle-%d/position", region, n);
+      snprintf(route->topic, TOPIC_SIZE, "fleet/region-%d/vehicle-%d/position", region, n);
+      break;
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  int filter_count;
+  int message_count;
+  int linear_count;
+  route* routes;
+  mqtt_topic_router* router;
+  struct mosquitto_message message = { 0 };
+  struct timespec start, end;
+  double linear_ns, trie_ns, id_ns;
+
+  if (!set_int_connection_setting(&filter_count, "BENCHMARK_FILTERS", DEFAULT_BENCHMARK_FILTERS)
+      || !set_int_connection_setting(
+          &message_count, "BENCHMARK_MESSAGES", DEFAULT_BENCHMARK_MESSAGES))
+  {
+    return MOSQ_ERR_UNKNOWN;
+  }
+  if (filter_count <= 0 || message_count <= 0)
+  {
+    LOG_ERROR("BENCHMARK_FILTERS and BENCHMARK_MESSAGES must be positive.");
+    return MOSQ_ERR_INVAL;
+  }
+  linear_count = message_count >= 100 ? message_count / 100 : 1;
+
+  routes = calloc(filter_count, sizeof(route));
+  router = mqtt_topic_router_create();
+  if (routes == NULL || router == NULL)
+  {
+    LOG_ERROR("Out of memory.");
+    free(routes);
+    mqtt_topic_router_destroy(router);
+    return MOSQ_ERR_NOMEM;
+  }
+  for (int i = 0; i < filter_count; i++)
+  {
+    make_route(&routes[i], i);
+    if ((routes[i].id = mqtt_topic_router_add(router, routes[i].filter, count_message, NULL)) < 0)
+    {
+      mqtt_topic_router_destroy(router);
+      free(routes);
+      return MOSQ_ERR_NOMEM;
+    }
+  }
+
+  /* A linear scan over every filter is slow, so it only dispatches 1% of the messages. */
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < linear_count; i++)
+  {
+    bool matches;
+    message.topic = route_for_message(routes, filter_count, i)->topic;
+    for (int j = 0; j < filter_count; j++)
+    {
+      if (mosquitto_topic_matches_sub(routes[j].filter, message.topic, &matches)
+              == MOSQ_ERR_SUCCESS
+          && matches)
+      {
+        count_message(NULL, &message, NULL, NULL);
+      }
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  linear_ns = elapsed_ns(start, end) / linear_count;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < message_count; i++)
+  {
+    message.topic = route_for_message(routes, filter_count, i)->topic;
+    mqtt_topic_router_dispatch(router, NULL, &message, NULL);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  trie_ns = elapsed_ns(start, end) / message_count;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < message_count; i++)
+  {
+    mosquitto_property* props = NULL;
+    route* route = route_for_message(routes, filter_count, i);
+    message.topic = route->topic;
+    mosquitto_property_add_varint(&props, MQTT_PROP_SUBSCRIPTION_IDENTIFIER, route->id);
+    mqtt_topic_router_dispatch(router, NULL, &message, props);
+    mosquitto_property_free_all(&props);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  id_ns = elapsed_ns(start, end) / message_count;
+
+  printf("filters  mode             ns/message\n");
+  printf("%7d  linear           %10.1f\n", filter_count, linear_ns);
+  printf("%7d  trie             %10.1f\n", filter_count, trie_ns);
+  printf("%7d  subscription id  %10.1f\n", filter_count, id_ns);
+  printf("(subscription id includes building and freeing the property list)\n");
+  printf("%llu handlers called\n", handled);
+
+  mqtt_topic_router_destroy(router);
+  free(routes);
+  return MOSQ_ERR_SUCCESS;
+}
@@ -0,0 +1,155 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "logging.h"
+#include "mosquitto.h"
+#include "mqtt_setup.h"
+#include "mqtt_tls_context.h"
+
+#define MQTT_VERSION MQTT_PROTOCOL_V311
+#define DEFAULT_BENCHMARK_CONNECTIONS 50
+#define CONNACK_TIMEOUT_MS 5000
+
+/*
+ * Compares full and resumed TLS handshakes through the shared TLS context. The benchmark connects
+ * and disconnects BENCHMARK_CONNECTIONS times, clearing the cached sessions before every other
+ * connection, and reports the time from mosquitto_connect to CONNACK for both kinds of handshake.
+ * Run it against the local TLS listener of _mosquitto/tls.conf (see the README for creating
+ * self-signed certificates), with an env file setting MQTT_HOST_NAME=localhost, MQTT_TCP_PORT=8883,
+ * MQTT_CA_FILE, MQTT_CERT_FILE and MQTT_KEY_FILE.
+ *
+ * Extra settings:
+ *   BENCHMARK_CONNECTIONS  number of connections (default 50)
+ */
+
+static bool connected = false;
+
+static void on_benchmark_connect(
+    struct mosquitto* mosq,
+    void* obj,
+    int reason_code,
+    int flags,
+    const mosquitto_property* props)
+{
+  if (reason_code != 0)
+  {
+    LOG_ERROR("Failed to connect: %s", mosquitto_connack_string(reason_code));
+  }
+  connected = reason_code == 0;
+}
+
+static double elapsed_ms(struct timespec start, struct timespec end)
+{
+  return (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+}
+
+static int connect_once(
+    const mqtt_client_connection_settings* connection_settings,
+    mqtt_client_obj* obj,
+    double* connect_ms)
+{
+  struct timespec start, end;
+  struct mosquitto* mosq
+      = mqtt_client_create(connection_settings, false, on_benchmark_connect, obj);
+  int rc;
+
+  if (mosq == NULL)
+  {
+    return MOSQ_ERR_UNKNOWN;
+  }
+
+  connected = false;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  rc = mosquitto_connect_bind_v5(
+      mosq, obj->hostname, obj->tcp_port, obj->keep_alive_in_seconds, NULL, NULL);
+  for (int waited_ms = 0; rc == MOSQ_ERR_SUCCESS && !connected && waited_ms < CONNACK_TIMEOUT_MS;
+       waited_ms += 10)
+  {
+    rc = mosquitto_loop(mosq, 10, 1);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  if (rc == MOSQ_ERR_SUCCESS && !connected)
+  {
+    rc = MOSQ_ERR_NO_CONN;
+  }
+  if (rc != MOSQ_ERR_SUCCESS)
+  {
+    LOG_ERROR("Failed to connect: %s", mosquitto_strerror(rc));
+  }
+
+  *connect_ms = elapsed_ms(start, end);
+  /* Closes the TLS session cleanly so it stays resumable. */
+  mosquitto_disconnect_v5(mosq, MOSQ_ERR_SUCCESS, NULL);
+  mosquitto_destroy(mosq);
+  return rc;
+}
+
+int main(int argc, char* argv[])
+{
+  mqtt_client_connection_settings connection_settings;
+  mqtt_client_obj obj = { 0 };
+  int connections;
+  int result = MOSQ_ERR_SUCCESS;
+  double full_ms = 0;
+  double resumed_ms = 0;
+  int full_count = 0;
+  int resumed_count = 0;
+
+  if (!mqtt_client_setup(argv[1], &connection_settings)
+      || !set_int_connection_setting(
+          &connections, "BENCHMARK_CONNECTIONS", DEFAULT_BENCHMARK_CONNECTIONS))
+  {
+    return MOSQ_ERR_UNKNOWN;
+  }
+  if (!connection_settings.use_TLS)
+  {
+    LOG_ERROR("Set MQTT_USE_TLS=true to measure TLS handshakes.");
+    return MOSQ_ERR_INVAL;
+  }
+  obj.mqtt_version = MQTT_VERSION;
+
+  for (int i = 0; i < connections && keep_running; i++)
+  {
+    double connect_ms;
+    bool resume = i % 2 == 1;
+    if (!resume)
+    {
+      mqtt_tls_context_clear_sessions();
+    }
+
+    mqtt_tls_context_stats before = mqtt_tls_context_get_stats();
+    if ((result = connect_once(&connection_settings, &obj, &connect_ms)) != MOSQ_ERR_SUCCESS)
+    {
+      break;
+    }
+    mqtt_tls_context_stats after = mqtt_tls_context_get_stats();
+
+    if (after.resumed_handshakes > before.resumed_handshakes)
+    {
+      resumed_ms += connect_ms;
+      resumed_count++;
+    }
+    else
+    {
+      full_ms += connect_ms;
+      full_count++;
+    }
+  }
+
+  printf("handshake  connections  avg connect ms\n");
+  printf("full       %11d  %14.3f\n", full_count, full_count > 0 ? full_ms / full_count : 0);
+  printf(
+      "resumed    %11d  %14.3f\n",
+      resumed_count,
+      resumed_count > 0 ? resumed_ms / resumed_count : 0);
+
+  mqtt_tls_context_cleanup();
+  mosquitto_lib_cleanup();
+  return result;
+}
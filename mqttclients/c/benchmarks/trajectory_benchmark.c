@@ -0,0 +1,188 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "geo_json_handler.h"
+#include "logging.h"
+#include "mosquitto.h"
+#include "mqtt_setup.h"
+#include "position_trajectory.h"
+
+#define DEFAULT_BENCHMARK_VEHICLES 100000
+#define DEFAULT_BENCHMARK_STEPS 100
+#define DEFAULT_BENCHMARK_THREADS 4
+#define BENCHMARK_SEED 1
+#define STEP_SECONDS 5.0
+#define MAX_STEP_DEGREES 0.0005
+
+/*
+ * Measures how fast positions are generated for a fleet of BENCHMARK_VEHICLES vehicles moved
+ * BENCHMARK_STEPS times, STEP_SECONDS apart:
+ *   rand() walk  the random walk the telemetry producer took with rand() before, on one thread
+ *                since rand() shares its state
+ *   trajectory   trajectory_fleet_step() on one thread, then trajectory_fleet_step_range() with
+ *                the vehicles split between BENCHMARK_THREADS threads
+ * It reports the positions per second and ns per position, and a checksum of the last positions:
+ * the trajectory runs print the same checksum whatever the number of threads. No broker is
+ * needed.
+ *
+ * Extra settings:
+ *   BENCHMARK_VEHICLES  number of vehicles (default 100000)
+ *   BENCHMARK_STEPS     number of positions per vehicle (default 100)
+ *   BENCHMARK_THREADS   number of threads of the second trajectory run (default 4)
+ */
+
+typedef struct step_thread
+{
+  pthread_t thread;
+  trajectory_fleet* fleet;
+  size_t first;
+  size_t count;
+  int steps;
+} step_thread;
+
+static double elapsed_ns(const struct timespec* start, const struct timespec* end)
+{
+  return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+static double checksum(const double* x, const double* y, size_t count)
+{
+  double sum = 0;
+  for (size_t i = 0; i < count; i++)
+  {
+    sum += x[i] + y[i];
+  }
+  return sum;
+}
+
+static void report(const char* name, int threads, double ns, size_t positions, double sum)
+{
+  printf(
+      "%-12s %7d %13.0f %11.2f %17.6f\n", name, threads, positions / ns * 1e9, ns / positions, sum);
+}
+
+static double step_coordinate(double coordinate)
+{
+  double step = (rand() / (double)RAND_MAX * 2 - 1) * MAX_STEP_DEGREES;
+  return coordinate + step > 90 || coordinate + step < -90 ? coordinate - step : coordinate + step;
+}
+
+static void* step_vehicles(void* context)
+{
+  step_thread* thread = (step_thread*)context;
+  for (int step = 0; step < thread->steps; step++)
+  {
+    trajectory_fleet_step_range(thread->fleet, thread->first, thread->count, STEP_SECONDS);
+  }
+  return NULL;
+}
+
+static bool run_trajectory(trajectory_fleet* fleet, int steps, int thread_count)
+{
+  step_thread* threads = calloc(thread_count, sizeof(step_thread));
+  struct timespec start, end;
+  int started = 0;
+
+  if (threads == NULL)
+  {
+    return false;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (; started < thread_count; started++)
+  {
+    step_thread* thread = &threads[started];
+    thread->fleet = fleet;
+    thread->first = fleet->count * started / thread_count;
+    thread->count = fleet->count * (started + 1) / thread_count - thread->first;
+    thread->steps = steps;
+    if (pthread_create(&thread->thread, NULL, step_vehicles, thread) != 0)
+    {
+      LOG_ERROR("Failure starting a benchmark thread");
+      break;
+    }
+  }
+  for (int i = 0; i < started; i++)
+  {
+    pthread_join(threads[i].thread, NULL);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  if (started == thread_count)
+  {
+    report(
+        "trajectory",
+        thread_count,
+        elapsed_ns(&start, &end),
+        fleet->count * steps,
+        checksum(fleet->x, fleet->y, fleet->count));
+  }
+  free(threads);
+  return started == thread_count;
+}
+
+int main(int argc, char* argv[])
+{
+  geojson_coordinates center = { .x = -122.335, .y = 47.608 };
+  trajectory_settings settings = trajectory_settings_default(center);
+  trajectory_fleet* fleet = NULL;
+  struct timespec start, end;
+  int vehicles;
+  int steps;
+  int threads;
+  int result = MOSQ_ERR_UNKNOWN;
+
+  if (!set_int_connection_setting(&vehicles, "BENCHMARK_VEHICLES", DEFAULT_BENCHMARK_VEHICLES)
+      || vehicles <= 0
+      || !set_int_connection_setting(&steps, "BENCHMARK_STEPS", DEFAULT_BENCHMARK_STEPS)
+      || steps <= 0
+      || !set_int_connection_setting(&threads, "BENCHMARK_THREADS", DEFAULT_BENCHMARK_THREADS)
+      || threads <= 0)
+  {
+    return MOSQ_ERR_INVAL;
+  }
+
+  printf("%d vehicles, %d positions each\n", vehicles, steps);
+  printf("generator    threads   positions/s  ns/position          checksum\n");
+
+  /* The rand() walk reuses the arrays of a fleet for its positions. */
+  if ((fleet = trajectory_fleet_create(vehicles, settings, BENCHMARK_SEED)) != NULL)
+  {
+    srand(BENCHMARK_SEED);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int step = 0; step < steps; step++)
+    {
+      for (int i = 0; i < vehicles; i++)
+      {
+        fleet->x[i] = step_coordinate(fleet->x[i]);
+        fleet->y[i] = step_coordinate(fleet->y[i]);
+      }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    report(
+        "rand() walk",
+        1,
+        elapsed_ns(&start, &end),
+        (size_t)vehicles * steps,
+        checksum(fleet->x, fleet->y, vehicles));
+    trajectory_fleet_destroy(fleet);
+  }
+
+  if ((fleet = trajectory_fleet_create(vehicles, settings, BENCHMARK_SEED)) != NULL
+      && run_trajectory(fleet, steps, 1))
+  {
+    trajectory_fleet_destroy(fleet);
+    if ((fleet = trajectory_fleet_create(vehicles, settings, BENCHMARK_SEED)) != NULL
+        && run_trajectory(fleet, steps, threads))
+    {
+      result = MOSQ_ERR_SUCCESS;
+    }
+  }
+
+  trajectory_fleet_destroy(fleet);
+  return result;
+}
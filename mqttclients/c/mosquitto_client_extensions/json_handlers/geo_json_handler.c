@@ -4,10 +4,17 @@
 #include "logging.h"
 #include <errno.h>
 #include <json-c/json.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(__x86_64__)
+#include <emmintrin.h>
+#endif
+
 #include "geo_json_handler.h"
 
 #define RETURN_IF_NULL(x, jobj_to_free)                  \
@@ -24,17 +31,6 @@
     }                                                    \
   } while (0)
 
-#define RETURN_IF_NON_ZERO(x)                    \
-  do                                             \
-  {                                              \
-    if ((x) != 0)                                \
-    {                                            \
-      LOG_ERROR("Failure parsing JSON: %s", #x); \
-      json_object_put(jobj);                     \
-      return -1;                                 \
-    }                                            \
-  } while (0)
-
 #define RETURN_IF_NAN(x)                                         \
   do                                                             \
   {                                                              \
@@ -89,13 +85,227 @@ void geojson_point_set_coordinates(geojson_point* pt, double x, double y)
   pt->coordinates.y = y;
 }
 
-int mosquitto_payload_to_geojson_point(
-    const struct mosquitto_message* message,
-    geojson_point* output)
+static const double exact_powers_of_10[] = { 1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+                                             1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+                                             1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+static void _skip_whitespace(const char** cursor, const char* end)
 {
-  RETURN_IF_NULL(message, NULL);
-  RETURN_IF_NULL(output, NULL);
+  while (*cursor < end
+         && (**cursor == ' ' || **cursor == '\t' || **cursor == '\n' || **cursor == '\r'))
+  {
+    (*cursor)++;
+  }
+}
+
+static bool _consume(const char** cursor, const char* end, char expected)
+{
+  _skip_whitespace(cursor, end);
+  if (*cursor < end && **cursor == expected)
+  {
+    (*cursor)++;
+    return true;
+  }
+  return false;
+}
 
+/* Reads a string without escapes, returning its start and length. */
+static bool _parse_plain_string(
+    const char** cursor,
+    const char* end,
+    const char** string,
+    size_t* length)
+{
+  if (!_consume(cursor, end, '"'))
+  {
+    return false;
+  }
+  *string = *cursor;
+  while (*cursor < end && **cursor != '"')
+  {
+    if (**cursor == '\\' || **cursor == '\0')
+    {
+      return false;
+    }
+    (*cursor)++;
+  }
+  if (*cursor == end)
+  {
+    return false;
+  }
+  *length = *cursor - *string;
+  (*cursor)++;
+  return true;
+}
+
+static bool _is_digit(const char* cursor, const char* end)
+{
+  return cursor < end && *cursor >= '0' && *cursor <= '9';
+}
+
+/* Parses a JSON number. Numbers with up to 15 significant digits and a small exponent are exact in
+ * a double, so they are converted with a single correctly rounded multiplication or division.
+ * Anything else goes through strtod on a stack copy, so the result always matches strtod. */
+static bool _parse_number(const char** cursor, const char* end, double* value)
+{
+  _skip_whitespace(cursor, end);
+  const char* start = *cursor;
+  const char* p = start;
+  bool negative = false;
+  uint64_t mantissa = 0;
+  int digits = 0;
+  int exponent = 0;
+
+  if (p < end && *p == '-')
+  {
+    negative = true;
+    p++;
+  }
+  if (!_is_digit(p, end))
+  {
+    return false;
+  }
+  if (*p == '0')
+  {
+    /* JSON doesn't allow leading zeros. */
+    p++;
+  }
+  else
+  {
+    for (; _is_digit(p, end); p++, digits += mantissa != 0)
+    {
+      mantissa = mantissa * 10 + (*p - '0');
+    }
+  }
+  if (p < end && *p == '.')
+  {
+    p++;
+    if (!_is_digit(p, end))
+    {
+      return false;
+    }
+    for (; _is_digit(p, end); p++, digits += mantissa != 0, exponent--)
+    {
+      mantissa = mantissa * 10 + (*p - '0');
+    }
+  }
+  if (p < end && (*p == 'e' || *p == 'E'))
+  {
+    int exponent_sign = 1;
+    int exponent_value = 0;
+    p++;
+    if (p < end && (*p == '+' || *p == '-'))
+    {
+      exponent_sign = *p == '-' ? -1 : 1;
+      p++;
+    }
+    if (!_is_digit(p, end))
+    {
+      return false;
+    }
+    for (; _is_digit(p, end); p++)
+    {
+      exponent_value = exponent_value < 10000 ? exponent_value * 10 + (*p - '0') : exponent_value;
+    }
+    exponent += exponent_sign * exponent_value;
+  }
+  *cursor = p;
+
+  /* 15 digits can't overflow the mantissa above 2^53. */
+  if (digits <= 15 && exponent >= -22 && exponent <= 22)
+  {
+    double result = exponent < 0 ? (double)mantissa / exact_powers_of_10[-exponent]
+                                 : (double)mantissa * exact_powers_of_10[exponent];
+    *value = negative ? -result : result;
+    return true;
+  }
+
+  char number[64];
+  if ((size_t)(p - start) >= sizeof(number))
+  {
+    return false;
+  }
+  memcpy(number, start, p - start);
+  number[p - start] = '\0';
+  *value = strtod(number, NULL);
+  return true;
+}
+
+/* Parses {"type":"Point","coordinates":[x,y]} with the members in either order and any
+ * whitespace, without allocating. Returns false for anything else, which the caller hands to
+ * json-c. The payload ends at length or at a NUL byte, whichever comes first. */
+static bool _parse_geojson_point(const char* payload, size_t length, geojson_coordinates* output)
+{
+  const char* cursor = payload;
+  const char* end = payload + length;
+  bool has_type = false;
+  bool has_coordinates = false;
+  geojson_coordinates coordinates;
+
+  if (payload == NULL || !_consume(&cursor, end, '{'))
+  {
+    return false;
+  }
+
+  do
+  {
+    const char* key;
+    size_t key_length;
+    if (!_parse_plain_string(&cursor, end, &key, &key_length) || !_consume(&cursor, end, ':'))
+    {
+      return false;
+    }
+
+    if (key_length == strlen("type") && memcmp(key, "type", key_length) == 0 && !has_type)
+    {
+      const char* type;
+      size_t type_length;
+      if (!_parse_plain_string(&cursor, end, &type, &type_length)
+          || type_length != strlen("Point") || memcmp(type, "Point", type_length) != 0)
+      {
+        return false;
+      }
+      has_type = true;
+    }
+    else if (
+        key_length == strlen("coordinates") && memcmp(key, "coordinates", key_length) == 0
+        && !has_coordinates)
+    {
+      if (!_consume(&cursor, end, '[') || !_parse_number(&cursor, end, &coordinates.x)
+          || !_consume(&cursor, end, ',') || !_parse_number(&cursor, end, &coordinates.y)
+          || !_consume(&cursor, end, ']'))
+      {
+        return false;
+      }
+      has_coordinates = true;
+    }
+    else
+    {
+      return false;
+    }
+  } while (_consume(&cursor, end, ','));
+
+  if (!_consume(&cursor, end, '}') || !has_type || !has_coordinates)
+  {
+    return false;
+  }
+  _skip_whitespace(&cursor, end);
+  if (cursor != end && *cursor != '\0')
+  {
+    return false;
+  }
+
+  *output = coordinates;
+  return true;
+}
+
+/* The original json-c parser, used for layouts the single pass parser doesn't handle. type_output
+ * may be NULL. */
+static int _json_c_payload_to_geojson_point(
+    const struct mosquitto_message* message,
+    char* type_output,
+    geojson_coordinates* output)
+{
   json_object* type;
   json_object* coordinates;
   json_object* jobj = json_tokener_parse(message->payload);
@@ -116,9 +326,12 @@ int mosquitto_payload_to_geojson_point(
   RETURN_IF_NAN(x = json_object_get_double(json_object_array_get_idx(coordinates, 0)));
   RETURN_IF_NAN(y = json_object_get_double(json_object_array_get_idx(coordinates, 1)));
 
-  strcpy(output->type, type_string);
-  output->coordinates.x = x;
-  output->coordinates.y = y;
+  if (type_output != NULL)
+  {
+    strcpy(type_output, type_string);
+  }
+  output->x = x;
+  output->y = y;
 
   // decrements the reference count of the object and frees it if it reaches zero.
   json_object_put(jobj);
@@ -126,6 +339,314 @@ int mosquitto_payload_to_geojson_point(
   return 0;
 }
 
+int mosquitto_payload_to_geojson_point(
+    const struct mosquitto_message* message,
+    geojson_point* output)
+{
+  RETURN_IF_NULL(message, NULL);
+  RETURN_IF_NULL(output, NULL);
+
+  if (_parse_geojson_point(message->payload, message->payloadlen, &output->coordinates))
+  {
+    strcpy(output->type, "Point");
+    return 0;
+  }
+  return _json_c_payload_to_geojson_point(message, output->type, &output->coordinates);
+}
+
+int mosquitto_payload_to_geojson_coordinates(
+    const struct mosquitto_message* message,
+    geojson_coordinates* output)
+{
+  RETURN_IF_NULL(message, NULL);
+  RETURN_IF_NULL(output, NULL);
+
+  if (_parse_geojson_point(message->payload, message->payloadlen, output))
+  {
+    return 0;
+  }
+  return _json_c_payload_to_geojson_point(message, NULL, output);
+}
+
+/* What json-c and geojson_point_to_mosquitto_payload() write before the coordinates. */
+static const char compact_point_prefix[32] = "{\"type\":\"Point\",\"coordinates\":[";
+#define COMPACT_POINT_PREFIX_LENGTH (sizeof(compact_point_prefix) - 1)
+
+/* Compares all the structural characters before the coordinates at once, 16 bytes at a time with
+ * SSE2. The payload must have at least 32 bytes. */
+static bool _has_compact_point_prefix(const char* payload)
+{
+#if defined(__x86_64__)
+  __m128i low = _mm_cmpeq_epi8(
+      _mm_loadu_si128((const __m128i*)payload),
+      _mm_loadu_si128((const __m128i*)compact_point_prefix));
+  __m128i high = _mm_cmpeq_epi8(
+      _mm_loadu_si128((const __m128i*)(payload + 16)),
+      _mm_loadu_si128((const __m128i*)(compact_point_prefix + 16)));
+  uint32_t equal = (uint32_t)_mm_movemask_epi8(low) | (uint32_t)_mm_movemask_epi8(high) << 16;
+  return (equal | UINT32_C(0x80000000)) == UINT32_C(0xFFFFFFFF);
+#else
+  return memcmp(payload, compact_point_prefix, COMPACT_POINT_PREFIX_LENGTH) == 0;
+#endif
+}
+
+/* Parses payloads in the exact layout the telemetry producer sends,
+ * {"type":"Point","coordinates":[x,y]}, returning false for anything else. */
+static bool _parse_compact_geojson_point(
+    const char* payload,
+    size_t length,
+    geojson_coordinates* output)
+{
+  geojson_coordinates coordinates;
+
+  if (payload == NULL || length < sizeof(compact_point_prefix))
+  {
+    return false;
+  }
+  const char* cursor = payload + COMPACT_POINT_PREFIX_LENGTH;
+  const char* end = payload + length;
+  if (!_has_compact_point_prefix(payload) || !_parse_number(&cursor, end, &coordinates.x)
+      || cursor == end || *cursor++ != ',' || !_parse_number(&cursor, end, &coordinates.y)
+      || end - cursor < 2 || cursor[0] != ']' || cursor[1] != '}')
+  {
+    return false;
+  }
+  cursor += 2;
+  _skip_whitespace(&cursor, end);
+  if (cursor != end && *cursor != '\0')
+  {
+    return false;
+  }
+
+  *output = coordinates;
+  return true;
+}
+
+/* Allocates doubles on a cache line boundary, or returns NULL on failure. */
+static double* _alloc_aligned_doubles(size_t count)
+{
+  void* memory;
+  return posix_memalign(&memory, 64, count * sizeof(double)) == 0 ? memory : NULL;
+}
+
+geojson_coordinates_batch geojson_coordinates_batch_init(int capacity)
+{
+  geojson_coordinates_batch batch = { .x = _alloc_aligned_doubles(capacity),
+                                      .y = _alloc_aligned_doubles(capacity),
+                                      .decoded = calloc(capacity, sizeof(bool)),
+                                      .capacity = capacity };
+  if (batch.x == NULL || batch.y == NULL || batch.decoded == NULL)
+  {
+    geojson_coordinates_batch_destroy(&batch);
+  }
+  return batch;
+}
+
+void geojson_coordinates_batch_destroy(geojson_coordinates_batch* batch)
+{
+  free(batch->x);
+  free(batch->y);
+  free(batch->decoded);
+  batch->x = NULL;
+  batch->y = NULL;
+  batch->decoded = NULL;
+  batch->capacity = 0;
+}
+
+int geojson_points_decode_batch(
+    const struct mosquitto_message* const messages[],
+    int count,
+    geojson_coordinates_batch* output)
+{
+  RETURN_IF_NULL(messages, NULL);
+  RETURN_IF_NULL(output, NULL);
+  RETURN_IF_NULL(output->x, NULL);
+  if (count > output->capacity)
+  {
+    LOG_ERROR(
+        "Failure parsing JSON: %d messages don't fit in a batch of %d", count, output->capacity);
+    return -1;
+  }
+
+  int decoded = 0;
+  for (int i = 0; i < count; i++)
+  {
+    geojson_coordinates coordinates;
+    if (i + 1 < count)
+    {
+      __builtin_prefetch(messages[i + 1]->payload);
+    }
+
+    output->decoded[i] = _parse_compact_geojson_point(
+                             messages[i]->payload, messages[i]->payloadlen, &coordinates)
+        || mosquitto_payload_to_geojson_coordinates(messages[i], &coordinates) == 0;
+    output->x[i] = output->decoded[i] ? coordinates.x : NAN;
+    output->y[i] = output->decoded[i] ? coordinates.y : NAN;
+    decoded += output->decoded[i];
+  }
+  return decoded;
+}
+
+/* Large enough for any %.6f json-c writes, which formats doubles into a buffer of this size. */
+#define COORDINATE_BUFFER_SIZE 128
+
+/* Coordinates below this are scaled to an integer number of millionths without overflowing. */
+#define FIXED_POINT_LIMIT 1e12
+
+/*
+ * Formats a coordinate exactly like json-c does with the "%.6f" double format: printf's digits
+ * with a '.' whatever the locale, and NaN, Infinity or -Infinity for non-finite values. The value
+ * is multiplied by 10^6 with integer arithmetic and rounded half to even on the exact binary
+ * value, as glibc does, so no float formatting is needed. Returns the length of the text, which
+ * is written at *start within buffer, or -1 if it doesn't fit.
+ */
+static int _format_coordinate(double value, char buffer[COORDINATE_BUFFER_SIZE], char** start)
+{
+  *start = buffer;
+  if (isnan(value))
+  {
+    memcpy(buffer, "NaN", 3);
+    return 3;
+  }
+  if (isinf(value))
+  {
+    return sprintf(buffer, value > 0 ? "Infinity" : "-Infinity");
+  }
+
+#if defined(__SIZEOF_INT128__)
+  if (value < FIXED_POINT_LIMIT && value > -FIXED_POINT_LIMIT)
+  {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint64_t mantissa = bits & ((UINT64_C(1) << 52) - 1);
+    int exponent = (int)((bits >> 52) & 0x7ff);
+
+    /* value is mantissa * 2^-shift, and shift > 0 as value < 2^52. */
+    int shift = 1075 - (exponent == 0 ? 1 : exponent);
+    mantissa |= exponent == 0 ? 0 : UINT64_C(1) << 52;
+
+    uint64_t scaled = 0;
+    if (shift < 128)
+    {
+      unsigned __int128 product = (unsigned __int128)mantissa * 1000000;
+      unsigned __int128 half = (unsigned __int128)1 << (shift - 1);
+      scaled = (uint64_t)(product >> shift);
+      unsigned __int128 remainder = product - ((unsigned __int128)scaled << shift);
+      if (remainder > half || (remainder == half && (scaled & 1)))
+      {
+        scaled++;
+      }
+    }
+
+    char* cursor = buffer + COORDINATE_BUFFER_SIZE;
+    for (int i = 0; i < 6; i++)
+    {
+      *--cursor = (char)('0' + scaled % 10);
+      scaled /= 10;
+    }
+    *--cursor = '.';
+    do
+    {
+      *--cursor = (char)('0' + scaled % 10);
+      scaled /= 10;
+    } while (scaled > 0);
+    /* printf keeps the sign of -0.0 and of negative values that round to 0. */
+    if (signbit(value))
+    {
+      *--cursor = '-';
+    }
+    *start = cursor;
+    return (int)(buffer + COORDINATE_BUFFER_SIZE - cursor);
+  }
+#endif
+
+  int length = snprintf(buffer, COORDINATE_BUFFER_SIZE, "%.6f", value);
+  if (length < 0 || length >= COORDINATE_BUFFER_SIZE)
+  {
+    return -1;
+  }
+  char* comma = strchr(buffer, ',');
+  if (comma != NULL)
+  {
+    *comma = '.';
+  }
+  return length;
+}
+
+/* Returns the escape json-c writes for a character of a string, or NULL if it's written as is. */
+static const char* _json_escape(unsigned char c, char unicode_escape[7])
+{
+  static const char hex[] = "0123456789abcdef";
+  switch (c)
+  {
+    case '\b':
+      return "\\b";
+    case '\n':
+      return "\\n";
+    case '\r':
+      return "\\r";
+    case '\t':
+      return "\\t";
+    case '\f':
+      return "\\f";
+    case '"':
+      return "\\\"";
+    case '\\':
+      return "\\\\";
+    case '/':
+      return "\\/";
+  }
+  if (c < ' ')
+  {
+    memcpy(unicode_escape, "\\u00", 4);
+    unicode_escape[4] = hex[c >> 4];
+    unicode_escape[5] = hex[c & 0xf];
+    unicode_escape[6] = '\0';
+    return unicode_escape;
+  }
+  return NULL;
+}
+
+static size_t _json_string_length(const char* string)
+{
+  char unicode_escape[7];
+  size_t length = 2;
+  for (const char* c = string; *c != '\0'; c++)
+  {
+    const char* escape = _json_escape((unsigned char)*c, unicode_escape);
+    length += escape == NULL ? 1 : strlen(escape);
+  }
+  return length;
+}
+
+static char* _write_json_string(char* cursor, const char* string)
+{
+  char unicode_escape[7];
+  *cursor++ = '"';
+  for (const char* c = string; *c != '\0'; c++)
+  {
+    const char* escape = _json_escape((unsigned char)*c, unicode_escape);
+    if (escape == NULL)
+    {
+      *cursor++ = *c;
+    }
+    else
+    {
+      size_t length = strlen(escape);
+      memcpy(cursor, escape, length);
+      cursor += length;
+    }
+  }
+  *cursor++ = '"';
+  return cursor;
+}
+
+static char* _write(char* cursor, const char* text, size_t length)
+{
+  memcpy(cursor, text, length);
+  return cursor + length;
+}
+
 int geojson_point_to_mosquitto_payload(
     const geojson_point geojson_point,
     mosquitto_payload* message)
@@ -133,33 +654,547 @@ int geojson_point_to_mosquitto_payload(
   RETURN_IF_NULL(geojson_point.type, NULL);
   RETURN_IF_NULL(message->payload, NULL);
 
-  const char* payload;
-  size_t payload_length;
-  json_object* jobj = json_object_new_object();
-  json_object* type = json_object_new_string(geojson_point.type);
-  json_object* coordinates = json_object_new_array();
-
-  RETURN_IF_NON_ZERO(json_c_set_serialization_double_format("%.6f", JSON_C_OPTION_THREAD));
-  RETURN_IF_NON_ZERO(
-      json_object_array_add(coordinates, json_object_new_double(geojson_point.coordinates.x)));
-  RETURN_IF_NON_ZERO(
-      json_object_array_add(coordinates, json_object_new_double(geojson_point.coordinates.y)));
-  RETURN_IF_NON_ZERO(json_object_object_add(jobj, "type", type));
-  RETURN_IF_NON_ZERO(json_object_object_add(jobj, "coordinates", coordinates));
-  RETURN_IF_NULL(
-      payload = json_object_to_json_string_length(jobj, JSON_C_TO_STRING_PLAIN, &payload_length),
-      jobj);
-  if (payload_length > message->max_payload_length)
+  static const char type_member[] = "{\"type\":";
+  static const char coordinates_member[] = ",\"coordinates\":[";
+  char x_buffer[COORDINATE_BUFFER_SIZE];
+  char y_buffer[COORDINATE_BUFFER_SIZE];
+  char* x;
+  char* y;
+  int x_length = _format_coordinate(geojson_point.coordinates.x, x_buffer, &x);
+  int y_length = _format_coordinate(geojson_point.coordinates.y, y_buffer, &y);
+  if (x_length < 0 || y_length < 0)
+  {
+    LOG_ERROR("Failure writing JSON: coordinates are too large");
+    return -1;
+  }
+
+  /* The same text json-c writes for the object with JSON_C_TO_STRING_PLAIN. */
+  size_t payload_length = sizeof(type_member) - 1 + _json_string_length(geojson_point.type)
+      + sizeof(coordinates_member) - 1 + x_length + 1 + y_length + 2;
+  if (payload_length >= message->max_payload_length)
   {
     LOG_ERROR("Failure parsing JSON: mosquitto payload buffer is too small");
-    json_object_put(jobj);
     return -1;
   }
 
-  strcpy(message->payload, payload);
+  char* cursor = _write(message->payload, type_member, sizeof(type_member) - 1);
+  cursor = _write_json_string(cursor, geojson_point.type);
+  cursor = _write(cursor, coordinates_member, sizeof(coordinates_member) - 1);
+  cursor = _write(cursor, x, x_length);
+  *cursor++ = ',';
+  cursor = _write(cursor, y, y_length);
+  cursor = _write(cursor, "]}", 3);
   message->payload_length = payload_length;
+  return 0;
+}
+
+static const char* const geometry_type_names[] = { "Point", "MultiPoint", "LineString", "Polygon" };
+
+/* How deeply each geometry type's coordinates are nested: a position, an array of positions or an
+ * array of rings of positions. */
+static const int geometry_type_depths[] = { 1, 2, 2, 3 };
+
+#define GEOMETRY_TYPE_COUNT (int)(sizeof(geometry_type_names) / sizeof(geometry_type_names[0]))
+
+/* Rounds an array length up so the array after it in the same allocation stays aligned. */
+#define ALIGNED_DOUBLES(count) ((((size_t)(count) + 7) / 8) * 8)
+
+const char* geojson_geometry_type_name(geojson_geometry_type type)
+{
+  return (int)type >= 0 && (int)type < GEOMETRY_TYPE_COUNT ? geometry_type_names[type] : NULL;
+}
+
+static bool _geometry_type_from_name(const char* name, size_t length, geojson_geometry_type* type)
+{
+  for (int i = 0; i < GEOMETRY_TYPE_COUNT; i++)
+  {
+    if (strlen(geometry_type_names[i]) == length
+        && memcmp(geometry_type_names[i], name, length) == 0)
+    {
+      *type = (geojson_geometry_type)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+geojson_geometry geojson_geometry_init()
+{
+  return (geojson_geometry){ .type = GEOJSON_POINT };
+}
+
+void geojson_geometry_destroy(geojson_geometry* geometry)
+{
+  /* y is part of the allocation of x. */
+  free(geometry->x);
+  free(geometry->ring_ends);
+  *geometry = geojson_geometry_init();
+}
+
+bool geojson_geometry_reset(
+    geojson_geometry* geometry,
+    geojson_geometry_type type,
+    int positions,
+    int rings)
+{
+  if (positions > geometry->capacity)
+  {
+    size_t capacity = ALIGNED_DOUBLES(positions);
+    double* x = _alloc_aligned_doubles(2 * capacity);
+    if (x == NULL)
+    {
+      LOG_ERROR("Failure allocating %d GeoJSON positions", positions);
+      return false;
+    }
+    free(geometry->x);
+    geometry->x = x;
+    geometry->y = x + capacity;
+    geometry->capacity = (int)capacity;
+  }
+  if (rings > geometry->ring_capacity)
+  {
+    int* ring_ends = malloc(rings * sizeof(int));
+    if (ring_ends == NULL)
+    {
+      LOG_ERROR("Failure allocating %d GeoJSON rings", rings);
+      return false;
+    }
+    free(geometry->ring_ends);
+    geometry->ring_ends = ring_ends;
+    geometry->ring_capacity = rings;
+  }
+  geometry->type = type;
+  geometry->count = 0;
+  geometry->ring_count = 0;
+  return true;
+}
+
+bool geojson_geometry_add_position(geojson_geometry* geometry, double x, double y)
+{
+  if (geometry->count >= geometry->capacity)
+  {
+    return false;
+  }
+  geometry->x[geometry->count] = x;
+  geometry->y[geometry->count] = y;
+  geometry->count++;
+  return true;
+}
+
+bool geojson_geometry_end_ring(geojson_geometry* geometry)
+{
+  if (geometry->ring_count >= geometry->ring_capacity)
+  {
+    return false;
+  }
+  geometry->ring_ends[geometry->ring_count++] = geometry->count;
+  return true;
+}
+
+/* Checks the number of positions each type needs: exactly one for a Point, none or at least two
+ * for a LineString, and at least four for each closed ring of a Polygon. */
+static bool _geometry_is_valid(const geojson_geometry* geometry)
+{
+  switch (geometry->type)
+  {
+    case GEOJSON_POINT:
+      return geometry->count == 1;
+    case GEOJSON_MULTI_POINT:
+      return true;
+    case GEOJSON_LINE_STRING:
+      return geometry->count != 1;
+    case GEOJSON_POLYGON:
+      if (geometry->ring_count == 0)
+      {
+        return geometry->count == 0;
+      }
+      for (int r = 0, start = 0; r < geometry->ring_count; start = geometry->ring_ends[r++])
+      {
+        int last = geometry->ring_ends[r] - 1;
+        if (last - start < 3 || geometry->x[start] != geometry->x[last]
+            || geometry->y[start] != geometry->y[last])
+        {
+          return false;
+        }
+      }
+      return geometry->ring_ends[geometry->ring_count - 1] == geometry->count;
+  }
+  return false;
+}
+
+/* Skips the coordinates member's value, counting its arrays, which is at least the number of
+ * positions plus the number of rings. The numbers are checked by _parse_positions(). */
+static bool _skip_coordinates(const char** cursor, const char* end, int* arrays)
+{
+  int depth = 0;
+  *arrays = 0;
+  _skip_whitespace(cursor, end);
+  if (*cursor == end || **cursor != '[')
+  {
+    return false;
+  }
+  do
+  {
+    switch (*(*cursor)++)
+    {
+      case '[':
+        depth++;
+        (*arrays)++;
+        break;
+      case ']':
+        depth--;
+        break;
+      case '"':
+      case '{':
+      case '\0':
+        return false;
+    }
+  } while (depth > 0 && *cursor < end);
+  return depth == 0;
+}
+
+/* Parses a position, keeping its first two numbers. */
+static bool _parse_position(const char** cursor, const char* end, geojson_geometry* output)
+{
+  double x;
+  double y;
+  double ignored;
+  if (!_consume(cursor, end, '[') || !_parse_number(cursor, end, &x)
+      || !_consume(cursor, end, ',') || !_parse_number(cursor, end, &y))
+  {
+    return false;
+  }
+  while (_consume(cursor, end, ','))
+  {
+    if (!_parse_number(cursor, end, &ignored))
+    {
+      return false;
+    }
+  }
+  return _consume(cursor, end, ']') && geojson_geometry_add_position(output, x, y);
+}
+
+/* Parses a position (depth 1), an array of positions (depth 2) or an array of rings (depth 3). */
+static bool _parse_positions(
+    const char** cursor,
+    const char* end,
+    int depth,
+    geojson_geometry* output)
+{
+  if (depth == 1)
+  {
+    return _parse_position(cursor, end, output);
+  }
+  if (!_consume(cursor, end, '['))
+  {
+    return false;
+  }
+  if (_consume(cursor, end, ']'))
+  {
+    return true;
+  }
+  do
+  {
+    if (!_parse_positions(cursor, end, depth - 1, output)
+        || (depth == 3 && !geojson_geometry_end_ring(output)))
+    {
+      return false;
+    }
+  } while (_consume(cursor, end, ','));
+  return _consume(cursor, end, ']');
+}
+
+/* Parses {"type":...,"coordinates":...} with the members in either order and any whitespace. The
+ * first pass finds the type and counts the arrays of the coordinates, so the geometry can be sized
+ * before the second pass parses them. Returns false for anything else, which the caller hands to
+ * json-c. */
+static bool _parse_geojson_geometry(const char* payload, size_t length, geojson_geometry* output)
+{
+  const char* cursor = payload;
+  const char* end = payload + length;
+  const char* coordinates = NULL;
+  bool has_type = false;
+  geojson_geometry_type type = GEOJSON_POINT;
+  int arrays = 0;
+
+  if (payload == NULL || !_consume(&cursor, end, '{'))
+  {
+    return false;
+  }
+
+  do
+  {
+    const char* key;
+    size_t key_length;
+    if (!_parse_plain_string(&cursor, end, &key, &key_length) || !_consume(&cursor, end, ':'))
+    {
+      return false;
+    }
+
+    if (key_length == strlen("type") && memcmp(key, "type", key_length) == 0 && !has_type)
+    {
+      const char* name;
+      size_t name_length;
+      if (!_parse_plain_string(&cursor, end, &name, &name_length)
+          || !_geometry_type_from_name(name, name_length, &type))
+      {
+        return false;
+      }
+      has_type = true;
+    }
+    else if (
+        key_length == strlen("coordinates") && memcmp(key, "coordinates", key_length) == 0
+        && coordinates == NULL)
+    {
+      _skip_whitespace(&cursor, end);
+      coordinates = cursor;
+      if (!_skip_coordinates(&cursor, end, &arrays))
+      {
+        return false;
+      }
+    }
+    else
+    {
+      return false;
+    }
+  } while (_consume(&cursor, end, ','));
+
+  if (!_consume(&cursor, end, '}') || !has_type || coordinates == NULL)
+  {
+    return false;
+  }
+  _skip_whitespace(&cursor, end);
+  if (cursor != end && *cursor != '\0')
+  {
+    return false;
+  }
+
+  return geojson_geometry_reset(output, type, arrays, type == GEOJSON_POLYGON ? arrays : 0)
+      && _parse_positions(&coordinates, end, geometry_type_depths[type], output);
+}
+
+/* Counts the arrays of a json-c coordinates value, like _skip_coordinates(). */
+static int _json_c_count_arrays(json_object* value)
+{
+  int arrays = 0;
+  if (json_object_is_type(value, json_type_array))
+  {
+    arrays++;
+    for (size_t i = 0; i < json_object_array_length(value); i++)
+    {
+      arrays += _json_c_count_arrays(json_object_array_get_idx(value, i));
+    }
+  }
+  return arrays;
+}
+
+static bool _json_c_is_number(json_object* value)
+{
+  return json_object_is_type(value, json_type_double)
+      || json_object_is_type(value, json_type_int);
+}
+
+/* Reads json-c coordinates nested depth levels deep, like _parse_positions(). */
+static bool _json_c_read_positions(json_object* value, int depth, geojson_geometry* output)
+{
+  if (!json_object_is_type(value, json_type_array))
+  {
+    return false;
+  }
+  size_t length = json_object_array_length(value);
+  if (depth == 1)
+  {
+    for (size_t i = 0; i < length; i++)
+    {
+      if (!_json_c_is_number(json_object_array_get_idx(value, i)))
+      {
+        return false;
+      }
+    }
+    return length >= 2
+        && geojson_geometry_add_position(
+               output,
+               json_object_get_double(json_object_array_get_idx(value, 0)),
+               json_object_get_double(json_object_array_get_idx(value, 1)));
+  }
+  for (size_t i = 0; i < length; i++)
+  {
+    if (!_json_c_read_positions(json_object_array_get_idx(value, i), depth - 1, output)
+        || (depth == 3 && !geojson_geometry_end_ring(output)))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+static int _json_c_payload_to_geojson_geometry(
+    const struct mosquitto_message* message,
+    geojson_geometry* output)
+{
+  json_object* type;
+  json_object* coordinates;
+  json_object* jobj = json_tokener_parse(message->payload);
+  const char* type_string;
+  geojson_geometry_type geometry_type;
+
+  RETURN_IF_NULL(type = json_object_object_get(jobj, "type"), jobj);
+  RETURN_IF_NULL(type_string = json_object_get_string(type), jobj);
+  RETURN_IF_NULL(coordinates = json_object_object_get(jobj, "coordinates"), jobj);
+  if (!_geometry_type_from_name(type_string, strlen(type_string), &geometry_type))
+  {
+    LOG_ERROR("Failure parsing JSON: %s is not a supported geometry type", type_string);
+    json_object_put(jobj);
+    return -1;
+  }
+
+  int arrays = _json_c_count_arrays(coordinates);
+  if (!geojson_geometry_reset(
+          output, geometry_type, arrays, geometry_type == GEOJSON_POLYGON ? arrays : 0)
+      || !_json_c_read_positions(coordinates, geometry_type_depths[geometry_type], output)
+      || !_geometry_is_valid(output))
+  {
+    LOG_ERROR("Failure parsing JSON: coordinates are not a valid %s", type_string);
+    json_object_put(jobj);
+    return -1;
+  }
 
-  // decrements the reference count of the object and frees it if it reaches zero.
   json_object_put(jobj);
   return 0;
 }
+
+int mosquitto_payload_to_geojson_geometry(
+    const struct mosquitto_message* message,
+    geojson_geometry* output)
+{
+  RETURN_IF_NULL(message, NULL);
+  RETURN_IF_NULL(output, NULL);
+
+  if (_parse_geojson_geometry(message->payload, message->payloadlen, output))
+  {
+    if (_geometry_is_valid(output))
+    {
+      return 0;
+    }
+    LOG_ERROR(
+        "Failure parsing JSON: coordinates are not a valid %s",
+        geojson_geometry_type_name(output->type));
+    return -1;
+  }
+  return _json_c_payload_to_geojson_geometry(message, output);
+}
+
+/* Appends text to a payload, returning false if it doesn't fit. */
+static bool _append(char** cursor, const char* end, const char* text, size_t length)
+{
+  if ((size_t)(end - *cursor) < length)
+  {
+    return false;
+  }
+  *cursor = _write(*cursor, text, length);
+  return true;
+}
+
+static bool _append_position(char** cursor, const char* end, double x, double y)
+{
+  char x_buffer[COORDINATE_BUFFER_SIZE];
+  char y_buffer[COORDINATE_BUFFER_SIZE];
+  char* x_text;
+  char* y_text;
+  int x_length = _format_coordinate(x, x_buffer, &x_text);
+  int y_length = _format_coordinate(y, y_buffer, &y_text);
+  return x_length >= 0 && y_length >= 0 && _append(cursor, end, "[", 1)
+      && _append(cursor, end, x_text, x_length) && _append(cursor, end, ",", 1)
+      && _append(cursor, end, y_text, y_length) && _append(cursor, end, "]", 1);
+}
+
+int geojson_position_length(double x, double y)
+{
+  char x_buffer[COORDINATE_BUFFER_SIZE];
+  char y_buffer[COORDINATE_BUFFER_SIZE];
+  char* text;
+  int x_length = _format_coordinate(x, x_buffer, &text);
+  int y_length = _format_coordinate(y, y_buffer, &text);
+  return x_length < 0 || y_length < 0 ? -1 : x_length + y_length + 3;
+}
+
+/* Appends positions first to last - 1 as an array. */
+static bool _append_positions(
+    char** cursor,
+    const char* end,
+    const geojson_geometry* geometry,
+    int first,
+    int last)
+{
+  if (!_append(cursor, end, "[", 1))
+  {
+    return false;
+  }
+  for (int i = first; i < last; i++)
+  {
+    if ((i > first && !_append(cursor, end, ",", 1))
+        || !_append_position(cursor, end, geometry->x[i], geometry->y[i]))
+    {
+      return false;
+    }
+  }
+  return _append(cursor, end, "]", 1);
+}
+
+static bool _append_coordinates(char** cursor, const char* end, const geojson_geometry* geometry)
+{
+  switch (geometry->type)
+  {
+    case GEOJSON_POINT:
+      return _append_position(cursor, end, geometry->x[0], geometry->y[0]);
+    case GEOJSON_MULTI_POINT:
+    case GEOJSON_LINE_STRING:
+      return _append_positions(cursor, end, geometry, 0, geometry->count);
+    case GEOJSON_POLYGON:
+      if (!_append(cursor, end, "[", 1))
+      {
+        return false;
+      }
+      for (int r = 0, start = 0; r < geometry->ring_count; start = geometry->ring_ends[r++])
+      {
+        if ((r > 0 && !_append(cursor, end, ",", 1))
+            || !_append_positions(cursor, end, geometry, start, geometry->ring_ends[r]))
+        {
+          return false;
+        }
+      }
+      return _append(cursor, end, "]", 1);
+  }
+  return false;
+}
+
+int geojson_geometry_to_mosquitto_payload(
+    const geojson_geometry* geometry,
+    mosquitto_payload* message)
+{
+  RETURN_IF_NULL(geometry, NULL);
+  RETURN_IF_NULL(message->payload, NULL);
+
+  const char* type_name = geojson_geometry_type_name(geometry->type);
+  if (type_name == NULL || !_geometry_is_valid(geometry))
+  {
+    LOG_ERROR("Failure writing JSON: geometry is not a valid GeoJSON geometry");
+    return -1;
+  }
+
+  /* Leaves room for the terminator. */
+  char* cursor = message->payload;
+  const char* end = message->payload
+      + (message->max_payload_length > 0 ? message->max_payload_length - 1 : 0);
+  if (!_append(&cursor, end, "{\"type\":\"", 9)
+      || !_append(&cursor, end, type_name, strlen(type_name))
+      || !_append(&cursor, end, "\",\"coordinates\":", 16)
+      || !_append_coordinates(&cursor, end, geometry) || !_append(&cursor, end, "}", 1))
+  {
+    LOG_ERROR("Failure writing JSON: mosquitto payload buffer is too small");
+    return -1;
+  }
+  *cursor = '\0';
+  message->payload_length = cursor - message->payload;
+  return 0;
+}
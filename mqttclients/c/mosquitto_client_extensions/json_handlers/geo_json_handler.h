@@ -6,6 +6,7 @@
 
 #include "mosquitto.h"
 #include <json-c/json.h>
+#include <stdbool.h>
 
 typedef struct mosquitto_payload
 {
@@ -25,8 +26,45 @@ typedef struct geojson_point
   geojson_coordinates coordinates;
 } geojson_point;
 
+/* The coordinates of a batch of messages, stored as one array per axis. */
+typedef struct geojson_coordinates_batch
+{
+  /* The coordinates of message i, or NaN if it couldn't be decoded. Aligned to 64 bytes. */
+  double* x;
+  double* y;
+  bool* decoded;
+  int capacity;
+} geojson_coordinates_batch;
+
+typedef enum geojson_geometry_type
+{
+  GEOJSON_POINT,
+  GEOJSON_MULTI_POINT,
+  GEOJSON_LINE_STRING,
+  GEOJSON_POLYGON
+} geojson_geometry_type;
+
+/* A Point, MultiPoint, LineString or Polygon with its positions stored as one array per axis. */
+typedef struct geojson_geometry
+{
+  geojson_geometry_type type;
+  /* Position i is (x[i], y[i]), any altitude is dropped. Both arrays are aligned to 64 bytes and
+   * share one allocation. */
+  double* x;
+  double* y;
+  int count;
+  int capacity;
+  /* The rings of a Polygon: ring r is positions ring_ends[r - 1] (0 for the first ring) to
+   * ring_ends[r] - 1. Unused by the other types. */
+  int* ring_ends;
+  int ring_count;
+  int ring_capacity;
+} geojson_geometry;
+
 /**
- * @brief Converts a mosquitto_message to a geojson_point
+ * @brief Converts a mosquitto_message to a geojson_point. Payloads of the usual
+ * {"type":"Point","coordinates":[x,y]} shape are parsed in a single pass without allocating;
+ * other layouts (extra members, escaped strings, 3D positions) are parsed with json-c.
  *
  * @param message The mosquitto_message to convert
  * @param output The geojson_point to output to. The type field must already be allocated. The
@@ -38,12 +76,85 @@ int mosquitto_payload_to_geojson_point(
     geojson_point* output);
 
 /**
- * @brief Converts a geojson_point to a mosquitto_payload
+ * @brief Reads the coordinates of a GeoJSON Point payload like
+ * mosquitto_payload_to_geojson_point(), without needing an allocated geojson_point. Nothing is
+ * allocated unless the payload has to be parsed with json-c.
+ *
+ * @param message The mosquitto_message to read, the first payloadlen bytes of the payload are used
+ * @param output The coordinates to output to
+ * @return int 0 on success, -1 on failure
+ */
+int mosquitto_payload_to_geojson_coordinates(
+    const struct mosquitto_message* message,
+    geojson_coordinates* output);
+
+/**
+ * @brief Reads the coordinates of a batch of GeoJSON Point payloads into arrays of x and y.
+ * Payloads in the compact {"type":"Point","coordinates":[x,y]} layout that json-c and
+ * geojson_point_to_mosquitto_payload() write have all their structural characters up to the
+ * coordinates checked with two SSE2 comparisons (memcmp on other CPUs), so only the numbers are
+ * parsed. Other payloads are decoded with mosquitto_payload_to_geojson_coordinates(), so the
+ * results are the same as decoding the messages one at a time.
+ *
+ * @param messages The messages to read, the first payloadlen bytes of each payload are used
+ * @param count The number of messages, at most the capacity of output
+ * @param output The batch to output to, from geojson_coordinates_batch_init()
+ * @return int The number of messages decoded, or -1 on failure
+ */
+int geojson_points_decode_batch(
+    const struct mosquitto_message* const messages[],
+    int count,
+    geojson_coordinates_batch* output);
+
+/**
+ * @brief Converts a mosquitto_message to a geojson_geometry. Payloads with only the type and
+ * coordinates members and no escaped strings are parsed in two passes over the payload without
+ * json-c; the first pass bounds the number of positions and rings, so the geometry grows with at
+ * most one allocation for its coordinates and one for its rings however many positions there are,
+ * and none when it is already large enough. Other layouts are parsed with json-c. Positions must
+ * have at least two numbers; Polygon rings must have at least four positions and be closed.
+ *
+ * @param message The mosquitto_message to convert
+ * @param output The geojson_geometry to output to, from geojson_geometry_init(). Its arrays are
+ * reused, and its contents are undefined on failure.
+ * @return int 0 on success, -1 on failure
+ */
+int mosquitto_payload_to_geojson_geometry(
+    const struct mosquitto_message* message,
+    geojson_geometry* output);
+
+/**
+ * @brief Converts a geojson_geometry to a mosquitto_payload, formatting the coordinates like
+ * geojson_point_to_mosquitto_payload() does, without allocating.
+ *
+ * @param geometry The geojson_geometry to convert
+ * @param message The mosquitto_payload to output to. Payload must already be allocated to a size of
+ * max_payload_length, with room for the text and its terminator.
+ * @return int 0 on success, -1 on failure
+ */
+int geojson_geometry_to_mosquitto_payload(
+    const geojson_geometry* geometry,
+    mosquitto_payload* message);
+
+/**
+ * @brief Returns the length of a position as geojson_geometry_to_mosquitto_payload() writes it,
+ * ex. 23 for [-83.551071,-36.169784], so writers can bound the size of a payload before writing it.
+ *
+ * @param x The x coordinate of the position
+ * @param y The y coordinate of the position
+ * @return int The length, or -1 if a coordinate is too large to write
+ */
+int geojson_position_length(double x, double y);
+
+/**
+ * @brief Converts a geojson_point to a mosquitto_payload. Writes
+ * {"type":"Point","coordinates":[x,y]} with the coordinates formatted like "%.6f", the same text
+ * json-c produces, directly into the payload without allocating.
  *
  * @param geojson_point The geojson_point to convert
  * @param message The mosquitto_payload to output to. Payload must already be allocated to a size of
- * max_payload_length (which must be set and will not be modified in this function).
- * mosquitto_payload_init() will do this for you.
+ * max_payload_length (which must be set and will not be modified in this function), with room for
+ * the text and its terminator. mosquitto_payload_init() will do this for you.
  * @return int 0 on success, -1 on failure
  */
 int geojson_point_to_mosquitto_payload(
@@ -74,6 +185,79 @@ geojson_point geojson_point_init();
  */
 void geojson_point_destroy(geojson_point* pt);
 
+/**
+ * @brief Allocates the arrays of a geojson_coordinates_batch for capacity messages. On failure the
+ * arrays are NULL. The batch must be freed with geojson_coordinates_batch_destroy().
+ *
+ * @param capacity The largest number of messages decoded at once
+ * @return geojson_coordinates_batch The initialized batch
+ */
+geojson_coordinates_batch geojson_coordinates_batch_init(int capacity);
+
+/**
+ * @brief Frees the arrays of a geojson_coordinates_batch and sets its capacity to 0.
+ *
+ * @param batch The batch to free
+ */
+void geojson_coordinates_batch_destroy(geojson_coordinates_batch* batch);
+
+/**
+ * @brief Initializes an empty GeoJSON Point geometry without allocating. The geojson_geometry must
+ * be freed with geojson_geometry_destroy().
+ *
+ * @return geojson_geometry The initialized geojson_geometry
+ */
+geojson_geometry geojson_geometry_init();
+
+/**
+ * @brief Frees the arrays of a geojson_geometry and empties it.
+ *
+ * @param geometry The geojson_geometry to free
+ */
+void geojson_geometry_destroy(geojson_geometry* geometry);
+
+/**
+ * @brief Empties a geojson_geometry and sets its type, growing its arrays so that positions
+ * positions and rings rings can be added without allocating.
+ *
+ * @param geometry The geojson_geometry to reset
+ * @param type The new type of the geometry
+ * @param positions The number of positions that will be added
+ * @param rings The number of rings that will be ended, for a Polygon
+ * @return true on success, false if the arrays couldn't be allocated
+ */
+bool geojson_geometry_reset(
+    geojson_geometry* geometry,
+    geojson_geometry_type type,
+    int positions,
+    int rings);
+
+/**
+ * @brief Appends a position to a geojson_geometry.
+ *
+ * @param geometry The geojson_geometry to append to
+ * @param x The x coordinate
+ * @param y The y coordinate
+ * @return true on success, false if the geometry is full
+ */
+bool geojson_geometry_add_position(geojson_geometry* geometry, double x, double y);
+
+/**
+ * @brief Ends the current ring of a Polygon geojson_geometry at the last position added.
+ *
+ * @param geometry The geojson_geometry to end the ring of
+ * @return true on success, false if the geometry is full
+ */
+bool geojson_geometry_end_ring(geojson_geometry* geometry);
+
+/**
+ * @brief Returns the GeoJSON name of a geometry type, like "LineString".
+ *
+ * @param type The geometry type
+ * @return const char* The name, or NULL for an unknown type
+ */
+const char* geojson_geometry_type_name(geojson_geometry_type type);
+
 /**
  * @brief Initializes a mosquitto_payload with payload_length set to 0 and payload allocated to
  * max_payload_length. The mosquitto_payload must be freed with mosquitto_payload_destroy().
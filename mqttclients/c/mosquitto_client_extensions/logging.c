@@ -0,0 +1,363 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "logging.h"
+
+#define RING_MASK (MQTT_LOG_RING_SIZE - 1)
+#define FLUSH_INTERVAL_MS 10
+#define TRUNCATED_MARKER "..."
+
+typedef struct log_record
+{
+  uint64_t timestamp_ns;
+  const char* tag;
+  const char* file;
+  const char* function;
+  uint32_t line;
+  uint16_t message_length;
+  uint8_t level;
+  char message[MQTT_LOG_MESSAGE_SIZE];
+} log_record;
+
+/* Single producer (the owning thread), single consumer (whoever holds flush_mutex). */
+typedef struct log_ring
+{
+  struct log_ring* next;
+  uint32_t id;
+  int closed;
+  uint64_t dropped_reported;
+  __attribute__((aligned(64))) uint64_t head;
+  uint64_t dropped;
+  __attribute__((aligned(64))) uint64_t tail;
+  log_record records[MQTT_LOG_RING_SIZE];
+} log_ring;
+
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+static pthread_key_t ring_key;
+static __thread log_ring* thread_ring = NULL;
+
+static pthread_mutex_t rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+static log_ring* rings = NULL;
+static uint32_t next_ring_id = 0;
+
+static pthread_mutex_t flush_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t flusher_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t flusher;
+static bool flusher_started = false;
+static bool stopping = false;
+
+static FILE* output = NULL;
+#ifdef MQTT_LOG_BINARY
+static bool binary_output = true;
+#else
+static bool binary_output = false;
+#endif
+
+static uint64_t _now_ns()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+static uint8_t _short_length(const char* text)
+{
+  size_t length = text != NULL ? strlen(text) : 0;
+  return length > UINT8_MAX ? UINT8_MAX : (uint8_t)length;
+}
+
+static void _write_record(const log_record* record, uint32_t thread_id)
+{
+  FILE* out = output != NULL ? output : stdout;
+
+  if (binary_output)
+  {
+    mqtt_log_binary_record header = { .timestamp_ns = record->timestamp_ns,
+                                      .thread_id = thread_id,
+                                      .line = record->line,
+                                      .message_length = record->message_length,
+                                      .level = record->level,
+                                      .tag_length = _short_length(record->tag),
+                                      .file_length = _short_length(record->file),
+                                      .function_length = _short_length(record->function) };
+    fwrite(&header, sizeof(header), 1, out);
+    fwrite(record->tag != NULL ? record->tag : "", 1, header.tag_length, out);
+    fwrite(record->file != NULL ? record->file : "", 1, header.file_length, out);
+    fwrite(record->function != NULL ? record->function : "", 1, header.function_length, out);
+    fwrite(record->message, 1, record->message_length, out);
+    return;
+  }
+
+  switch (record->level)
+  {
+    case MQTT_LOG_LEVEL_ERROR:
+      fprintf(
+          out,
+          "\x1B[31m[ERROR]\x1B[0m %.*s \x1b[2m[%s:%s:%u]\x1B[0m\n",
+          (int)record->message_length,
+          record->message,
+          record->file,
+          record->function,
+          record->line);
+      break;
+    case MQTT_LOG_LEVEL_WARNING:
+      fprintf(
+          out,
+          "\x1B[33m[WARNING]\x1B[0m %.*s\n",
+          (int)record->message_length,
+          record->message);
+      break;
+    default:
+      if (record->tag != NULL)
+      {
+        fprintf(
+            out,
+            "\x1B[34m[%s]\x1B[0m %.*s\n",
+            record->tag,
+            (int)record->message_length,
+            record->message);
+      }
+      else
+      {
+        fprintf(out, "\t%.*s\n", (int)record->message_length, record->message);
+      }
+      break;
+  }
+}
+
+static void _format_record(
+    log_record* record,
+    int level,
+    const char* tag,
+    const char* file,
+    const char* function,
+    int line,
+    const char* format,
+    va_list args)
+{
+  record->timestamp_ns = _now_ns();
+  record->level = (uint8_t)level;
+  record->tag = tag;
+  record->file = file;
+  record->function = function;
+  record->line = (uint32_t)line;
+
+  int length = vsnprintf(record->message, sizeof(record->message), format, args);
+  if (length < 0)
+  {
+    length = 0;
+  }
+  else if (length >= (int)sizeof(record->message))
+  {
+    length = sizeof(record->message) - 1;
+    memcpy(
+        record->message + length - strlen(TRUNCATED_MARKER),
+        TRUNCATED_MARKER,
+        strlen(TRUNCATED_MARKER));
+  }
+  record->message_length = (uint16_t)length;
+}
+
+/* Writes every queued record in timestamp order. Must be called with flush_mutex held. */
+static void _drain()
+{
+  pthread_mutex_lock(&rings_mutex);
+
+  while (true)
+  {
+    log_ring* oldest = NULL;
+    uint64_t oldest_timestamp = UINT64_MAX;
+
+    for (log_ring* ring = rings; ring != NULL; ring = ring->next)
+    {
+      uint64_t tail = ring->tail;
+      if (tail != __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)
+          && ring->records[tail & RING_MASK].timestamp_ns < oldest_timestamp)
+      {
+        oldest = ring;
+        oldest_timestamp = ring->records[tail & RING_MASK].timestamp_ns;
+      }
+    }
+    if (oldest == NULL)
+    {
+      break;
+    }
+
+    _write_record(&oldest->records[oldest->tail & RING_MASK], oldest->id);
+    __atomic_store_n(&oldest->tail, oldest->tail + 1, __ATOMIC_RELEASE);
+  }
+
+  for (log_ring** link = &rings; *link != NULL;)
+  {
+    log_ring* ring = *link;
+    uint64_t dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+
+    if (dropped != ring->dropped_reported)
+    {
+      log_record record = { .timestamp_ns = _now_ns(), .level = MQTT_LOG_LEVEL_WARNING };
+      record.message_length = (uint16_t)snprintf(
+          record.message,
+          sizeof(record.message),
+          "%llu log messages dropped",
+          (unsigned long long)(dropped - ring->dropped_reported));
+      _write_record(&record, ring->id);
+      ring->dropped_reported = dropped;
+    }
+
+    /* The thread exited and everything it logged has been written. */
+    if (__atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE)
+        && ring->tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE))
+    {
+      *link = ring->next;
+      free(ring);
+    }
+    else
+    {
+      link = &ring->next;
+    }
+  }
+
+  pthread_mutex_unlock(&rings_mutex);
+  fflush(output != NULL ? output : stdout);
+}
+
+static void* _flusher_thread(void* arg)
+{
+  pthread_mutex_lock(&flush_mutex);
+  while (!stopping)
+  {
+    _drain();
+
+    struct timespec wake_at;
+    clock_gettime(CLOCK_REALTIME, &wake_at);
+    wake_at.tv_nsec += FLUSH_INTERVAL_MS * 1000000L;
+    if (wake_at.tv_nsec >= 1000000000L)
+    {
+      wake_at.tv_sec++;
+      wake_at.tv_nsec -= 1000000000L;
+    }
+    pthread_cond_timedwait(&flusher_cond, &flush_mutex, &wake_at);
+  }
+  pthread_mutex_unlock(&flush_mutex);
+  return NULL;
+}
+
+static void _close_ring(void* ring)
+{
+  __atomic_store_n(&((log_ring*)ring)->closed, 1, __ATOMIC_RELEASE);
+}
+
+static void _shutdown()
+{
+  pthread_mutex_lock(&flush_mutex);
+  stopping = true;
+  pthread_cond_signal(&flusher_cond);
+  pthread_mutex_unlock(&flush_mutex);
+
+  if (__atomic_exchange_n(&flusher_started, false, __ATOMIC_ACQ_REL))
+  {
+    pthread_join(flusher, NULL);
+  }
+  mqtt_log_flush();
+}
+
+static void _init()
+{
+  pthread_key_create(&ring_key, _close_ring);
+  __atomic_store_n(
+      &flusher_started,
+      pthread_create(&flusher, NULL, _flusher_thread, NULL) == 0,
+      __ATOMIC_RELEASE);
+  atexit(_shutdown);
+}
+
+static log_ring* _get_thread_ring()
+{
+  if (thread_ring == NULL)
+  {
+    pthread_once(&init_once, _init);
+
+    void* memory;
+    if (posix_memalign(&memory, 64, sizeof(log_ring)) != 0)
+    {
+      return NULL;
+    }
+    log_ring* ring = memory;
+    memset(ring, 0, sizeof(log_ring));
+
+    pthread_mutex_lock(&rings_mutex);
+    ring->id = next_ring_id++;
+    ring->next = rings;
+    rings = ring;
+    pthread_mutex_unlock(&rings_mutex);
+
+    pthread_setspecific(ring_key, ring);
+    thread_ring = ring;
+  }
+  return thread_ring;
+}
+
+void mqtt_log_write(
+    int level,
+    const char* tag,
+    const char* file,
+    const char* function,
+    int line,
+    const char* format,
+    ...)
+{
+  log_ring* ring = _get_thread_ring();
+  va_list args;
+  va_start(args, format);
+
+  if (ring == NULL || !__atomic_load_n(&flusher_started, __ATOMIC_ACQUIRE))
+  {
+    /* No buffer to queue in, write the message directly. */
+    log_record record;
+    _format_record(&record, level, tag, file, function, line, format, args);
+    pthread_mutex_lock(&flush_mutex);
+    _write_record(&record, ring != NULL ? ring->id : UINT32_MAX);
+    fflush(output != NULL ? output : stdout);
+    pthread_mutex_unlock(&flush_mutex);
+  }
+  else
+  {
+    uint64_t head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == MQTT_LOG_RING_SIZE)
+    {
+      __atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+    }
+    else
+    {
+      _format_record(
+          &ring->records[head & RING_MASK], level, tag, file, function, line, format, args);
+      __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    }
+  }
+
+  va_end(args);
+}
+
+void mqtt_log_flush()
+{
+  pthread_mutex_lock(&flush_mutex);
+  _drain();
+  pthread_mutex_unlock(&flush_mutex);
+}
+
+void mqtt_log_set_output(FILE* new_output, bool binary)
+{
+  pthread_mutex_lock(&flush_mutex);
+  _drain();
+  output = new_output;
+  binary_output = binary;
+  pthread_mutex_unlock(&flush_mutex);
+}
@@ -4,6 +4,10 @@
 #ifndef LOGGING_H
 #define LOGGING_H
 
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
 /*
 Black:   \x1B[30m
 Red:     \x1B[31m
@@ -23,7 +27,95 @@ Reset:   \x1B[0m
 #define CLIENT_LOG_TAG "Client"
 #define SERVER_LOG_TAG "Server"
 
-#define LOG_INFO(log_tag, ...)                     \
+#define MQTT_LOG_LEVEL_NONE 0
+#define MQTT_LOG_LEVEL_ERROR 1
+#define MQTT_LOG_LEVEL_WARNING 2
+#define MQTT_LOG_LEVEL_INFO 3
+
+/* Log messages above this level are compiled out. Set with the LOG_LEVEL cmake option. */
+#ifndef MQTT_LOG_LEVEL
+#define MQTT_LOG_LEVEL MQTT_LOG_LEVEL_INFO
+#endif
+
+/* Records per thread buffered by the async backend, must be a power of 2. */
+#define MQTT_LOG_RING_SIZE 512
+/* Longer messages are truncated by the async backend. */
+#define MQTT_LOG_MESSAGE_SIZE 240
+
+/* Header of a binary log record, followed by the tag, file, function and message (not NUL
+ * terminated). All fields are in host byte order. */
+typedef struct __attribute__((packed)) mqtt_log_binary_record
+{
+  uint64_t timestamp_ns; /* CLOCK_REALTIME */
+  uint32_t thread_id; /* index of the thread that logged the message */
+  uint32_t line;
+  uint16_t message_length;
+  uint8_t level;
+  uint8_t tag_length;
+  uint8_t file_length;
+  uint8_t function_length;
+} mqtt_log_binary_record;
+
+/**
+ * @brief Queues a log message for the background flusher thread. The message is formatted into the
+ * calling thread's ring buffer without taking any lock; the flusher adds the colours, tags and
+ * source location and writes the records in timestamp order. If a thread logs faster than the
+ * flusher can write, its messages are dropped and the number dropped is reported.
+ * Used by the LOG_ macros when built with ASYNC_LOGGING.
+ *
+ * @param level One of MQTT_LOG_LEVEL_ERROR, MQTT_LOG_LEVEL_WARNING or MQTT_LOG_LEVEL_INFO.
+ * @param tag String literal tag for info messages, NULL for errors, warnings and detail lines.
+ * @param file String literal source file for errors, or NULL.
+ * @param function String literal function name for errors, or NULL.
+ * @param line Source line for errors, or 0.
+ */
+void mqtt_log_write(
+    int level,
+    const char* tag,
+    const char* file,
+    const char* function,
+    int line,
+    const char* format,
+    ...) __attribute__((format(printf, 6, 7)));
+
+/**
+ * @brief Writes every queued log message before returning. Runs automatically at exit.
+ */
+void mqtt_log_flush();
+
+/**
+ * @brief Changes where the flusher writes and whether it writes text or binary records (see
+ * mqtt_log_binary_record and tools/log_decoder.c). The default is text on stdout, or binary when
+ * built with LOG_BINARY.
+ */
+void mqtt_log_set_output(FILE* output, bool binary);
+
+#define LOG_DISABLED(...)        \
+  do                             \
+  {                              \
+    if (0)                       \
+    {                            \
+      (void)printf(__VA_ARGS__); \
+    }                            \
+  } while (0)
+
+#ifdef ASYNC_LOGGING
+
+#define LOG_INFO_ENABLED(log_tag, ...) \
+  mqtt_log_write(MQTT_LOG_LEVEL_INFO, log_tag, NULL, NULL, 0, __VA_ARGS__)
+
+#define LOG_DETAIL_ENABLED(...) \
+  mqtt_log_write(MQTT_LOG_LEVEL_INFO, NULL, NULL, NULL, 0, "" __VA_ARGS__)
+
+#define LOG_ERROR_ENABLED(...) \
+  mqtt_log_write(MQTT_LOG_LEVEL_ERROR, NULL, __FILE__, __func__, __LINE__, "" __VA_ARGS__)
+
+#define LOG_WARNING_ENABLED(...) \
+  mqtt_log_write(MQTT_LOG_LEVEL_WARNING, NULL, NULL, NULL, 0, "" __VA_ARGS__)
+
+#else
+
+#define LOG_INFO_ENABLED(log_tag, ...)             \
   do                                               \
   {                                                \
     (void)printf("\x1B[34m[%s]\x1B[0m ", log_tag); \
@@ -31,7 +123,14 @@ Reset:   \x1B[0m
     (void)printf("\n");                            \
   } while (0)
 
-#define LOG_ERROR(...)                                                       \
+#define LOG_DETAIL_ENABLED(...)     \
+  do                                \
+  {                                 \
+    (void)printf("\t" __VA_ARGS__); \
+    (void)printf("\n");             \
+  } while (0)
+
+#define LOG_ERROR_ENABLED(...)                                               \
   do                                                                         \
   {                                                                          \
     (void)printf("\x1B[31m[ERROR]\x1B[0m " __VA_ARGS__);                     \
@@ -39,11 +138,34 @@ Reset:   \x1B[0m
     (void)printf("\n");                                                      \
   } while (0)
 
-#define LOG_WARNING(...)                                   \
+#define LOG_WARNING_ENABLED(...)                           \
   do                                                       \
   {                                                        \
     (void)printf("\x1B[33m[WARNING]\x1B[0m " __VA_ARGS__); \
     (void)printf("\n");                                    \
   } while (0)
 
+#endif /* ASYNC_LOGGING */
+
+#if MQTT_LOG_LEVEL >= MQTT_LOG_LEVEL_INFO
+#define LOG_INFO(log_tag, ...) LOG_INFO_ENABLED(log_tag, __VA_ARGS__)
+/* An indented line that belongs to the previous LOG_INFO message. */
+#define LOG_DETAIL(...) LOG_DETAIL_ENABLED(__VA_ARGS__)
+#else
+#define LOG_INFO(log_tag, ...) LOG_DISABLED(__VA_ARGS__)
+#define LOG_DETAIL(...) LOG_DISABLED(__VA_ARGS__)
+#endif
+
+#if MQTT_LOG_LEVEL >= MQTT_LOG_LEVEL_WARNING
+#define LOG_WARNING(...) LOG_WARNING_ENABLED(__VA_ARGS__)
+#else
+#define LOG_WARNING(...) LOG_DISABLED(__VA_ARGS__)
+#endif
+
+#if MQTT_LOG_LEVEL >= MQTT_LOG_LEVEL_ERROR
+#define LOG_ERROR(...) LOG_ERROR_ENABLED(__VA_ARGS__)
+#else
+#define LOG_ERROR(...) LOG_DISABLED(__VA_ARGS__)
+#endif
+
 #endif /* LOGGING_H */
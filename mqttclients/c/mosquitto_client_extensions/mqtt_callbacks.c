@@ -7,6 +7,7 @@
 #include "logging.h"
 #include "mosquitto.h"
 #include "mqtt_callbacks.h"
+#include "mqtt_event_loop.h"
 #include "mqtt_setup.h"
 
 /* Callback called when the client receives a CONNACK message from the broker. */
@@ -34,7 +35,7 @@ void on_connect(
 
   if (reason_code != 0)
   {
-    keep_running = 0;
+    mqtt_client_stop();
     /* If the connection fails for any reason, we don't want to keep on
      * retrying in this example, so disconnect. Without this, the client
      * will attempt to reconnect. */
@@ -69,7 +70,34 @@ void on_subscribe(
    * them all. */
   for (int i = 0; i < qos_count; i++)
   {
-    printf("\tQoS %d\n", granted_qos[i]);
+    LOG_DETAIL("QoS %d", granted_qos[i]);
+  }
+}
+
+/* Passes a message to the router or the handle_message of the client, on the network thread or
+ * on an executor worker. */
+static void _handle_message(
+    struct mosquitto* mosq,
+    const struct mosquitto_message* msg,
+    const mosquitto_property* props,
+    void* context)
+{
+  mqtt_client_obj* client_obj = (mqtt_client_obj*)context;
+
+  if (client_obj != NULL && client_obj->router != NULL
+      && mqtt_topic_router_dispatch(client_obj->router, mosq, msg, props) > 0)
+  {
+    return;
+  }
+
+  if (client_obj != NULL && client_obj->handle_message != NULL)
+  {
+    client_obj->handle_message(mosq, msg, props);
+  }
+  else
+  {
+    /* This blindly prints the payload, but the payload can be anything so take care. */
+    LOG_DETAIL("Payload: %s", (char*)msg->payload);
   }
 }
 
@@ -83,16 +111,58 @@ void on_message(
   LOG_INFO(MQTT_LOG_TAG, "on_message: Topic: %s; QOS: %d; mid: %d", msg->topic, msg->qos, msg->mid);
 
   mqtt_client_obj* client_obj = (mqtt_client_obj*)obj;
+  struct mosquitto_message decompressed;
 
-  if (client_obj != NULL && client_obj->handle_message != NULL)
+  /* Recorded still compressed, a record is the message as it was received. */
+  if (client_obj != NULL && client_obj->recorder != NULL)
   {
-    client_obj->handle_message(mosq, msg, props);
+    int rc = mqtt_recorder_append(client_obj->recorder, msg, props, 0);
+    if (rc != MOSQ_ERR_SUCCESS)
+    {
+      LOG_WARNING("Message on %s not recorded: %s", msg->topic, mosquitto_strerror(rc));
+    }
   }
-  else
+
+  /* The decompressed payload lives in a buffer of this thread, the ring and the executor copy it
+   * like any other payload. */
+  if (client_obj != NULL && client_obj->compression != NULL)
   {
-    /* This blindly prints the payload, but the payload can be anything so take care. */
-    printf("\tPayload: %s\n", (char*)msg->payload);
+    int rc
+        = mqtt_compression_decompress_message(client_obj->compression, msg, props, &decompressed);
+    if (rc != MOSQ_ERR_SUCCESS)
+    {
+      LOG_ERROR(
+          "Dropped message on %s, it could not be decompressed: %s",
+          msg->topic,
+          mosquitto_strerror(rc));
+      return;
+    }
+    msg = &decompressed;
+  }
+
+  if (client_obj != NULL && client_obj->message_ring != NULL)
+  {
+    if (!mqtt_message_ring_push(client_obj->message_ring, msg, props))
+    {
+      LOG_WARNING("Dropped message on %s, the message ring is full.", msg->topic);
+    }
+    return;
   }
+
+  if (client_obj != NULL && client_obj->executor != NULL)
+  {
+    /* Handling the message here instead would let it overtake the messages of its topic that are
+     * still queued, so it's dropped and counted in the executor's metrics. */
+    int rc = mqtt_executor_submit(client_obj->executor, mosq, msg, props, _handle_message, obj);
+    if (rc != MOSQ_ERR_SUCCESS)
+    {
+      LOG_ERROR(
+          "Dropped message on %s, it could not be queued: %s", msg->topic, mosquitto_strerror(rc));
+    }
+    return;
+  }
+
+  _handle_message(mosq, msg, props, obj);
 }
 
 /* Callback called when the client knows to the best of its abilities that a
@@ -0,0 +1,194 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+/* For CPU_SET() and pthread_setaffinity_np(). */
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "logging.h"
+#include "mosquitto.h"
+#include "mqtt_client_pool.h"
+#include "mqtt_hash.h"
+#include "mqtt_setup.h"
+
+static void* _connection_thread(void* arg)
+{
+  mqtt_client_pool_connection* connection = (mqtt_client_pool_connection*)arg;
+
+  /* Reconnects automatically until mosquitto_disconnect() is called. */
+  int rc = mosquitto_loop_forever(connection->mosq, -1, 1);
+  if (rc != MOSQ_ERR_SUCCESS)
+  {
+    LOG_ERROR("Pool connection %s stopped: %s", connection->client_id, mosquitto_strerror(rc));
+  }
+  return NULL;
+}
+
+static void _stop_connection(mqtt_client_pool_connection* connection)
+{
+  mosquitto_disconnect_v5(connection->mosq, MOSQ_ERR_SUCCESS, NULL);
+  if (connection->thread_started)
+  {
+    pthread_join(connection->thread, NULL);
+    connection->thread_started = false;
+  }
+}
+
+/* Stops the connections that were started before connection failed_index failed to connect, along
+ * with that connection itself in case it connected but its thread couldn't be started. */
+static int _stop_connections_after_failure(mqtt_client_pool* pool, int failed_index, int rc)
+{
+  for (int i = 0; i <= failed_index; i++)
+  {
+    _stop_connection(&pool->connections[i]);
+  }
+  return rc;
+}
+
+bool mqtt_client_pool_init(
+    mqtt_client_pool* pool,
+    const mqtt_client_connection_settings* connection_settings,
+    int size,
+    bool publish,
+    void (*on_connect_with_subscribe)(
+        struct mosquitto*,
+        void*,
+        int,
+        int,
+        const mosquitto_property* props),
+    const mqtt_client_obj* obj)
+{
+  mqtt_client_connection_settings settings = *connection_settings;
+
+  pool->size = 0;
+  pool->connections = NULL;
+  /* Every connection has its own network thread, but a message ring or a recorder takes a single
+   * producer. */
+  if (obj->message_ring != NULL || obj->recorder != NULL)
+  {
+    LOG_ERROR("The connections of a pool can't share a message ring or a recorder.");
+    return false;
+  }
+  if (size < 1 || (pool->connections = calloc(size, sizeof(mqtt_client_pool_connection))) == NULL)
+  {
+    LOG_ERROR("Failed to allocate a pool of %d connections.", size);
+    return false;
+  }
+
+  for (int i = 0; i < size; i++)
+  {
+    mqtt_client_pool_connection* connection = &pool->connections[i];
+    connection->obj = *obj;
+
+    if (connection_settings->client_id != NULL)
+    {
+      snprintf(
+          connection->client_id,
+          sizeof(connection->client_id),
+          "%s-%d",
+          connection_settings->client_id,
+          i);
+      settings.client_id = connection->client_id;
+    }
+
+    if ((connection->mosq
+         = mqtt_client_create(&settings, publish, on_connect_with_subscribe, &connection->obj))
+        == NULL)
+    {
+      mqtt_client_pool_destroy(pool);
+      return false;
+    }
+    pool->size++;
+  }
+
+  return true;
+}
+
+int mqtt_client_pool_connect(mqtt_client_pool* pool)
+{
+  long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+  int rc;
+
+  for (int i = 0; i < pool->size; i++)
+  {
+    mqtt_client_pool_connection* connection = &pool->connections[i];
+
+    if ((rc = mosquitto_connect_bind_v5(
+             connection->mosq,
+             connection->obj.hostname,
+             connection->obj.tcp_port,
+             connection->obj.keep_alive_in_seconds,
+             NULL,
+             NULL))
+        != MOSQ_ERR_SUCCESS)
+    {
+      LOG_ERROR("Failed to connect %s: %s", connection->client_id, mosquitto_strerror(rc));
+      return _stop_connections_after_failure(pool, i, rc);
+    }
+
+    /* Our own thread runs mosquitto_loop_forever, so tell mosquitto to use its locks. */
+    mosquitto_threaded_set(connection->mosq, true);
+    if (pthread_create(&connection->thread, NULL, _connection_thread, connection) != 0)
+    {
+      LOG_ERROR("Failed to start the network thread for %s", connection->client_id);
+      return _stop_connections_after_failure(pool, i, MOSQ_ERR_ERRNO);
+    }
+    connection->thread_started = true;
+
+    connection->cpu = cpu_count > 0 ? (int)(i % cpu_count) : 0;
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(connection->cpu, &cpus);
+    if (pthread_setaffinity_np(connection->thread, sizeof(cpus), &cpus) != 0)
+    {
+      LOG_WARNING("Failed to pin %s to CPU %d", connection->client_id, connection->cpu);
+    }
+  }
+
+  return MOSQ_ERR_SUCCESS;
+}
+
+void mqtt_client_pool_destroy(mqtt_client_pool* pool)
+{
+  for (int i = 0; i < pool->size; i++)
+  {
+    mqtt_client_pool_connection* connection = &pool->connections[i];
+
+    _stop_connection(connection);
+    mosquitto_destroy(connection->mosq);
+    connection->mosq = NULL;
+  }
+
+  free(pool->connections);
+  pool->connections = NULL;
+  pool->size = 0;
+}
+
+mqtt_client_pool_connection* mqtt_client_pool_connection_for_topic(
+    const mqtt_client_pool* pool,
+    const char* topic)
+{
+  return &pool->connections[mqtt_hash_string(topic) % (uint32_t)pool->size];
+}
+
+int mqtt_client_pool_publish(
+    const mqtt_client_pool* pool,
+    int* mid,
+    const char* topic,
+    int payloadlen,
+    const void* payload,
+    int qos,
+    bool retain,
+    const mosquitto_property* properties)
+{
+  mqtt_client_pool_connection* connection = mqtt_client_pool_connection_for_topic(pool, topic);
+  return mosquitto_publish_v5(
+      connection->mosq, mid, topic, payloadlen, payload, qos, retain, properties);
+}
@@ -0,0 +1,98 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef MQTT_CLIENT_POOL_H
+#define MQTT_CLIENT_POOL_H
+
+#include "mosquitto.h"
+#include "mqtt_setup.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define MQTT_CLIENT_POOL_MAX_CLIENT_ID_LENGTH 128
+
+typedef struct mqtt_client_pool_connection
+{
+  mqtt_client_obj obj;
+  struct mosquitto* mosq;
+  pthread_t thread;
+  bool thread_started;
+  int cpu;
+  char client_id[MQTT_CLIENT_POOL_MAX_CLIENT_ID_LENGTH];
+} mqtt_client_pool_connection;
+
+typedef struct mqtt_client_pool
+{
+  mqtt_client_pool_connection* connections;
+  int size;
+} mqtt_client_pool;
+
+/**
+ * @brief Creates a pool of connections that share the same connection settings. Each connection
+ * gets the client id "<client_id>-<index>" (or a broker assigned id if client_id isn't set) and its
+ * own copy of obj, so handle_message and mqtt_version apply to every connection. The copies share
+ * the router, executor and compression context, which can be used from any thread. A message ring
+ * or a recorder only accepts messages from one thread, so obj must not have either. The pool must
+ * be freed with mqtt_client_pool_destroy().
+ *
+ * @param pool The pool to initialize.
+ * @param connection_settings Settings read with mqtt_client_setup().
+ * @param size The number of connections to open.
+ * @param publish Whether to set the publish callbacks on every connection.
+ * @param on_connect_with_subscribe Connect callback, or NULL to use on_connect.
+ * @param obj Template copied into every connection's mqtt_client_obj.
+ * @return true on success, false on failure or if obj has a message ring or a recorder.
+ */
+bool mqtt_client_pool_init(
+    mqtt_client_pool* pool,
+    const mqtt_client_connection_settings* connection_settings,
+    int size,
+    bool publish,
+    void (*on_connect_with_subscribe)(
+        struct mosquitto*,
+        void*,
+        int,
+        int,
+        const mosquitto_property* props),
+    const mqtt_client_obj* obj);
+
+/**
+ * @brief Connects every connection in the pool and starts one network thread per connection. The
+ * threads are pinned round-robin to the online CPUs so the pool's work is spread across cores. If
+ * a connection fails, the connections started before it are disconnected and their threads joined,
+ * so the pool can be connected again or destroyed.
+ *
+ * @return MOSQ_ERR_SUCCESS on success, other enum mosq_err_t on failure.
+ */
+int mqtt_client_pool_connect(mqtt_client_pool* pool);
+
+/**
+ * @brief Disconnects every connection, waits for the network threads and frees the pool.
+ */
+void mqtt_client_pool_destroy(mqtt_client_pool* pool);
+
+/**
+ * @brief Returns the connection responsible for a topic. A topic always maps to the same
+ * connection, so messages published on one topic through the pool keep their order.
+ */
+mqtt_client_pool_connection* mqtt_client_pool_connection_for_topic(
+    const mqtt_client_pool* pool,
+    const char* topic);
+
+/**
+ * @brief Publishes a message on the connection responsible for the topic.
+ *
+ * @return enum mosq_err_t from mosquitto_publish_v5().
+ */
+int mqtt_client_pool_publish(
+    const mqtt_client_pool* pool,
+    int* mid,
+    const char* topic,
+    int payloadlen,
+    const void* payload,
+    int qos,
+    bool retain,
+    const mosquitto_property* properties);
+
+#endif /* MQTT_CLIENT_POOL_H */
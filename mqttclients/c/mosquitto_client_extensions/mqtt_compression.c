@@ -0,0 +1,325 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logging.h"
+#include "mqtt_compression.h"
+#include "mqtt_protocol.h"
+
+#ifdef MQTT_PAYLOAD_COMPRESSION
+#include <zstd.h>
+#endif
+
+int mqtt_compression_add_property(mosquitto_property** props)
+{
+  return mosquitto_property_add_string_pair(
+      props, MQTT_PROP_USER_PROPERTY, MQTT_CONTENT_ENCODING_PROPERTY, MQTT_CONTENT_ENCODING_ZSTD);
+}
+
+mqtt_compression* mqtt_compression_load(const char* dictionary_file, int level)
+{
+  FILE* file = fopen(dictionary_file, "rb");
+  mqtt_compression* compression = NULL;
+  char* dictionary = NULL;
+  long length = -1;
+
+  if (file != NULL && fseek(file, 0, SEEK_END) == 0 && (length = ftell(file)) > 0
+      && fseek(file, 0, SEEK_SET) == 0 && (dictionary = malloc(length)) != NULL
+      && fread(dictionary, 1, length, file) == (size_t)length)
+  {
+    compression = mqtt_compression_create(dictionary, length, level);
+  }
+  else
+  {
+    LOG_ERROR("Failed to read the compression dictionary %s", dictionary_file);
+  }
+
+  if (file != NULL)
+  {
+    fclose(file);
+  }
+  free(dictionary);
+  return compression;
+}
+
+#ifdef MQTT_PAYLOAD_COMPRESSION
+
+struct mqtt_compression
+{
+  ZSTD_CDict* compression_dictionary;
+  ZSTD_DDict* decompression_dictionary;
+};
+
+/* Finds the content-encoding user property. mosquitto only reads properties into copies, so this
+ * allocates, but only for messages that have user properties. */
+static int _read_content_encoding(const mosquitto_property* props, bool* compressed)
+{
+  char* name = NULL;
+  char* value = NULL;
+  int rc = MOSQ_ERR_SUCCESS;
+
+  *compressed = false;
+  for (const mosquitto_property* property = mosquitto_property_read_string_pair(
+           props, MQTT_PROP_USER_PROPERTY, &name, &value, false);
+       property != NULL;
+       property = mosquitto_property_read_string_pair(
+           property, MQTT_PROP_USER_PROPERTY, &name, &value, true))
+  {
+    if (strcmp(name, MQTT_CONTENT_ENCODING_PROPERTY) == 0)
+    {
+      *compressed = strcmp(value, MQTT_CONTENT_ENCODING_ZSTD) == 0;
+      if (!*compressed)
+      {
+        LOG_ERROR("Unsupported content-encoding: %s", value);
+        rc = MOSQ_ERR_NOT_SUPPORTED;
+      }
+    }
+    free(name);
+    free(value);
+    if (*compressed || rc != MOSQ_ERR_SUCCESS)
+    {
+      break;
+    }
+  }
+  return rc;
+}
+
+typedef struct compression_buffer
+{
+  char* data;
+  size_t capacity;
+} compression_buffer;
+
+/* zstd contexts can't be shared between threads, so each thread that compresses or decompresses
+ * keeps its own, with the buffers its payloads are written to. */
+typedef struct compression_thread_state
+{
+  ZSTD_CCtx* compression_context;
+  ZSTD_DCtx* decompression_context;
+  compression_buffer compressed;
+  compression_buffer decompressed;
+} compression_thread_state;
+
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+static pthread_key_t state_key;
+static __thread compression_thread_state* thread_state = NULL;
+
+static void _free_thread_state(void* context)
+{
+  compression_thread_state* state = (compression_thread_state*)context;
+  ZSTD_freeCCtx(state->compression_context);
+  ZSTD_freeDCtx(state->decompression_context);
+  free(state->compressed.data);
+  free(state->decompressed.data);
+  free(state);
+}
+
+static void _init() { pthread_key_create(&state_key, _free_thread_state); }
+
+static compression_thread_state* _get_thread_state()
+{
+  if (thread_state == NULL)
+  {
+    pthread_once(&init_once, _init);
+
+    compression_thread_state* state = calloc(1, sizeof(compression_thread_state));
+    if (state == NULL || (state->compression_context = ZSTD_createCCtx()) == NULL
+        || (state->decompression_context = ZSTD_createDCtx()) == NULL)
+    {
+      LOG_ERROR("Failure allocating the compression state of a thread");
+      if (state != NULL)
+      {
+        _free_thread_state(state);
+      }
+      return NULL;
+    }
+    pthread_setspecific(state_key, state);
+    thread_state = state;
+  }
+  return thread_state;
+}
+
+static bool _reserve(compression_buffer* buffer, size_t length)
+{
+  if (length <= buffer->capacity)
+  {
+    return true;
+  }
+  size_t capacity = buffer->capacity * 2 > length ? buffer->capacity * 2 : length;
+  char* data = realloc(buffer->data, capacity);
+  if (data == NULL)
+  {
+    LOG_ERROR("Failure allocating a compression buffer of %zu bytes", capacity);
+    return false;
+  }
+  buffer->data = data;
+  buffer->capacity = capacity;
+  return true;
+}
+
+mqtt_compression* mqtt_compression_create(
+    const void* dictionary,
+    size_t dictionary_length,
+    int level)
+{
+  mqtt_compression* compression = calloc(1, sizeof(mqtt_compression));
+  if (dictionary == NULL)
+  {
+    dictionary_length = 0;
+  }
+
+  if (compression == NULL
+      || (compression->compression_dictionary
+          = ZSTD_createCDict(dictionary, dictionary_length, level))
+          == NULL
+      || (compression->decompression_dictionary
+          = ZSTD_createDDict(dictionary, dictionary_length))
+          == NULL)
+  {
+    LOG_ERROR("Failure creating the compression dictionaries");
+    mqtt_compression_destroy(compression);
+    return NULL;
+  }
+  return compression;
+}
+
+void mqtt_compression_destroy(mqtt_compression* compression)
+{
+  if (compression == NULL)
+  {
+    return;
+  }
+  ZSTD_freeCDict(compression->compression_dictionary);
+  ZSTD_freeDDict(compression->decompression_dictionary);
+  free(compression);
+}
+
+int mqtt_compression_compress(
+    const mqtt_compression* compression,
+    const void* payload,
+    int payloadlen,
+    const void** output,
+    int* output_length)
+{
+  compression_thread_state* state = _get_thread_state();
+  if (compression == NULL || payloadlen < 0 || (payload == NULL && payloadlen > 0))
+  {
+    return MOSQ_ERR_INVAL;
+  }
+  if (state == NULL || !_reserve(&state->compressed, ZSTD_compressBound(payloadlen)))
+  {
+    return MOSQ_ERR_NOMEM;
+  }
+
+  size_t length = ZSTD_compress_usingCDict(
+      state->compression_context,
+      state->compressed.data,
+      state->compressed.capacity,
+      payload,
+      payloadlen,
+      compression->compression_dictionary);
+  if (ZSTD_isError(length))
+  {
+    LOG_ERROR("Failure compressing payload: %s", ZSTD_getErrorName(length));
+    return MOSQ_ERR_UNKNOWN;
+  }
+  *output = state->compressed.data;
+  *output_length = (int)length;
+  return MOSQ_ERR_SUCCESS;
+}
+
+int mqtt_compression_decompress_message(
+    const mqtt_compression* compression,
+    const struct mosquitto_message* message,
+    const mosquitto_property* props,
+    struct mosquitto_message* output)
+{
+  bool compressed;
+  int rc;
+
+  if (compression == NULL || message == NULL || output == NULL)
+  {
+    return MOSQ_ERR_INVAL;
+  }
+  *output = *message;
+  if ((rc = _read_content_encoding(props, &compressed)) != MOSQ_ERR_SUCCESS || !compressed)
+  {
+    return rc;
+  }
+
+  /* The frames of mqtt_compression_compress() always hold their decompressed size. */
+  unsigned long long length = ZSTD_getFrameContentSize(message->payload, message->payloadlen);
+  if (length == ZSTD_CONTENTSIZE_ERROR || length == ZSTD_CONTENTSIZE_UNKNOWN)
+  {
+    LOG_ERROR("Failure decompressing payload: not a zstd frame with its size");
+    return MOSQ_ERR_MALFORMED_PACKET;
+  }
+  if (length > MQTT_COMPRESSION_MAX_PAYLOAD_LENGTH)
+  {
+    LOG_ERROR("Failure decompressing payload: %llu bytes is too large", length);
+    return MOSQ_ERR_PAYLOAD_SIZE;
+  }
+
+  compression_thread_state* state = _get_thread_state();
+  if (state == NULL || !_reserve(&state->decompressed, length + 1))
+  {
+    return MOSQ_ERR_NOMEM;
+  }
+  size_t result = ZSTD_decompress_usingDDict(
+      state->decompression_context,
+      state->decompressed.data,
+      length,
+      message->payload,
+      message->payloadlen,
+      compression->decompression_dictionary);
+  if (ZSTD_isError(result) || result != length)
+  {
+    LOG_ERROR(
+        "Failure decompressing payload: %s",
+        ZSTD_isError(result) ? ZSTD_getErrorName(result) : "size mismatch");
+    return MOSQ_ERR_MALFORMED_PACKET;
+  }
+
+  state->decompressed.data[length] = '\0';
+  output->payload = state->decompressed.data;
+  output->payloadlen = (int)length;
+  return MOSQ_ERR_SUCCESS;
+}
+
+#else
+
+mqtt_compression* mqtt_compression_create(
+    const void* dictionary,
+    size_t dictionary_length,
+    int level)
+{
+  LOG_ERROR("Payload compression needs the PAYLOAD_COMPRESSION cmake option");
+  return NULL;
+}
+
+void mqtt_compression_destroy(mqtt_compression* compression) {}
+
+int mqtt_compression_compress(
+    const mqtt_compression* compression,
+    const void* payload,
+    int payloadlen,
+    const void** output,
+    int* output_length)
+{
+  return MOSQ_ERR_NOT_SUPPORTED;
+}
+
+int mqtt_compression_decompress_message(
+    const mqtt_compression* compression,
+    const struct mosquitto_message* message,
+    const mosquitto_property* props,
+    struct mosquitto_message* output)
+{
+  return MOSQ_ERR_NOT_SUPPORTED;
+}
+
+#endif /* MQTT_PAYLOAD_COMPRESSION */
@@ -0,0 +1,111 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef MQTT_COMPRESSION_H
+#define MQTT_COMPRESSION_H
+
+#include "mosquitto.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Compresses payloads with zstd and a dictionary shared by producers and consumers. Small messages
+ * like telemetry positions barely compress on their own, but a dictionary trained on recorded
+ * payloads (see tools/dictionary_trainer.c) already holds their common text, like the GeoJSON
+ * member names, so each frame only encodes what differs.
+ *
+ * Compressed payloads are tagged with the MQTT 5 user property content-encoding=zstd. When
+ * mqtt_client_obj.compression is set, on_message decompresses tagged messages before the router,
+ * the executor, the message ring or handle_message see them. Untagged messages pass unchanged.
+ *
+ * Needs the PAYLOAD_COMPRESSION cmake option (and libzstd). Without it mqtt_compression_create()
+ * fails and the other functions return MOSQ_ERR_NOT_SUPPORTED.
+ */
+
+#define MQTT_CONTENT_ENCODING_PROPERTY "content-encoding"
+#define MQTT_CONTENT_ENCODING_ZSTD "zstd"
+#define MQTT_COMPRESSION_DEFAULT_LEVEL 3
+/* Frames that decompress to more than this are rejected, so a small message can't make a receiver
+ * allocate without bound. */
+#define MQTT_COMPRESSION_MAX_PAYLOAD_LENGTH (1024 * 1024)
+
+typedef struct mqtt_compression mqtt_compression;
+
+/**
+ * @brief Creates a compression context from a dictionary. It can be shared by any number of
+ * threads and connections, each thread keeps its own zstd contexts and buffers.
+ *
+ * @param dictionary A dictionary from tools/dictionary_trainer.c, or any sample content. NULL
+ * compresses without a dictionary.
+ * @param dictionary_length The length of the dictionary in bytes
+ * @param level The zstd compression level, ex. MQTT_COMPRESSION_DEFAULT_LEVEL
+ * @return mqtt_compression* The context, or NULL on failure. It must be freed with
+ * mqtt_compression_destroy().
+ */
+mqtt_compression* mqtt_compression_create(
+    const void* dictionary,
+    size_t dictionary_length,
+    int level);
+
+/**
+ * @brief Creates a compression context from a dictionary file.
+ *
+ * @param dictionary_file The path of the dictionary
+ * @param level The zstd compression level, ex. MQTT_COMPRESSION_DEFAULT_LEVEL
+ * @return mqtt_compression* The context, or NULL on failure
+ */
+mqtt_compression* mqtt_compression_load(const char* dictionary_file, int level);
+
+/**
+ * @brief Frees a compression context. The buffers of each thread are freed when the thread exits.
+ *
+ * @param compression The context to free, can be NULL
+ */
+void mqtt_compression_destroy(mqtt_compression* compression);
+
+/**
+ * @brief Adds the content-encoding user property that tags compressed payloads to a property list.
+ *
+ * @param props The property list to add to
+ * @return int MOSQ_ERR_SUCCESS, or the error of mosquitto_property_add_string_pair()
+ */
+int mqtt_compression_add_property(mosquitto_property** props);
+
+/**
+ * @brief Compresses a payload into a buffer owned by the calling thread. Publish it with the
+ * property of mqtt_compression_add_property().
+ *
+ * @param compression The compression context
+ * @param payload The payload to compress
+ * @param payloadlen The length of the payload
+ * @param output Set to the compressed payload, valid until the next call on this thread
+ * @param output_length Set to the length of the compressed payload
+ * @return int MOSQ_ERR_SUCCESS on success
+ */
+int mqtt_compression_compress(
+    const mqtt_compression* compression,
+    const void* payload,
+    int payloadlen,
+    const void** output,
+    int* output_length);
+
+/**
+ * @brief Decompresses a message tagged with content-encoding=zstd into a buffer owned by the calling
+ * thread. The decompressed payload is followed by a terminating zero like mosquitto's payloads.
+ *
+ * @param compression The compression context, with the dictionary the message was compressed with
+ * @param message The received message
+ * @param props The properties of the message
+ * @param output Set to a copy of the message. Its payload points to the decompressed payload, valid
+ * until the next call on this thread, or to the original payload when the message isn't tagged.
+ * @return int MOSQ_ERR_SUCCESS on success, MOSQ_ERR_NOT_SUPPORTED for another content-encoding,
+ * MOSQ_ERR_PAYLOAD_SIZE when the payload is larger than MQTT_COMPRESSION_MAX_PAYLOAD_LENGTH and
+ * MOSQ_ERR_MALFORMED_PACKET when it can't be decompressed, ex. with another dictionary.
+ */
+int mqtt_compression_decompress_message(
+    const mqtt_compression* compression,
+    const struct mosquitto_message* message,
+    const mosquitto_property* props,
+    struct mosquitto_message* output);
+
+#endif /* MQTT_COMPRESSION_H */
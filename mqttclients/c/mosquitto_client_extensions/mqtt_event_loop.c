@@ -0,0 +1,381 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "logging.h"
+#include "mosquitto.h"
+#include "mqtt_event_loop.h"
+#include "mqtt_setup.h"
+
+#define MAX_EVENTS_PER_WAIT 64
+
+struct mqtt_event_work
+{
+  mqtt_event_callback callback;
+  void* context;
+  mqtt_event_work* next;
+};
+
+static mqtt_event_loop default_loop;
+static bool default_loop_initialized = false;
+static pthread_once_t default_loop_once = PTHREAD_ONCE_INIT;
+
+/* Written once the default loop exists so that mqtt_client_stop() can wake it from a signal
+ * handler without touching anything that isn't async-signal-safe. */
+static volatile sig_atomic_t default_wakeup_fd = -1;
+
+static void _drain_fd(int fd)
+{
+  uint64_t value;
+  while (read(fd, &value, sizeof(value)) > 0)
+  {
+  }
+}
+
+static void _run_posted_work(mqtt_event_loop* loop)
+{
+  pthread_mutex_lock(&loop->work_mutex);
+  mqtt_event_work* work = loop->work_head;
+  loop->work_head = NULL;
+  loop->work_tail = NULL;
+  pthread_mutex_unlock(&loop->work_mutex);
+
+  while (work != NULL)
+  {
+    mqtt_event_work* next = work->next;
+    work->callback(work->context);
+    free(work);
+    work = next;
+  }
+}
+
+static void _free_deferred(mqtt_event_loop* loop)
+{
+  for (size_t i = 0; i < loop->deferred_count; i++)
+  {
+    free(loop->deferred_frees[i]);
+  }
+  loop->deferred_count = 0;
+}
+
+static void _on_wakeup(mqtt_event_loop* loop, mqtt_event_source* source, uint32_t events)
+{
+  _drain_fd(source->fd);
+  _run_posted_work(loop);
+}
+
+static void _on_timer(mqtt_event_loop* loop, mqtt_event_source* source, uint32_t events)
+{
+  mqtt_event_timer* timer = (mqtt_event_timer*)source;
+
+  /* The timer may have been removed earlier in this batch of events. */
+  if (source->fd < 0)
+  {
+    return;
+  }
+
+  _drain_fd(source->fd);
+  timer->callback(timer->context);
+}
+
+static void _set_timespec_ms(struct timespec* ts, uint32_t ms)
+{
+  ts->tv_sec = ms / 1000;
+  ts->tv_nsec = (long)(ms % 1000) * 1000000;
+}
+
+bool mqtt_event_loop_init(mqtt_event_loop* loop)
+{
+  memset(loop, 0, sizeof(*loop));
+  loop->wakeup.fd = -1;
+
+  if ((loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+  {
+    LOG_ERROR("Failed to create epoll instance: %s", strerror(errno));
+    return false;
+  }
+
+  if ((loop->wakeup.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+  {
+    LOG_ERROR("Failed to create eventfd: %s", strerror(errno));
+    close(loop->epoll_fd);
+    return false;
+  }
+  loop->wakeup.on_event = _on_wakeup;
+
+  pthread_mutex_init(&loop->work_mutex, NULL);
+
+  if (!mqtt_event_loop_add_source(loop, &loop->wakeup, EPOLLIN))
+  {
+    mqtt_event_loop_destroy(loop);
+    return false;
+  }
+
+  return true;
+}
+
+void mqtt_event_loop_destroy(mqtt_event_loop* loop)
+{
+  mqtt_event_work* work = loop->work_head;
+  while (work != NULL)
+  {
+    mqtt_event_work* next = work->next;
+    free(work);
+    work = next;
+  }
+  loop->work_head = NULL;
+  loop->work_tail = NULL;
+
+  _free_deferred(loop);
+  free(loop->deferred_frees);
+  loop->deferred_frees = NULL;
+  loop->deferred_capacity = 0;
+
+  if (loop->wakeup.fd >= 0)
+  {
+    close(loop->wakeup.fd);
+    loop->wakeup.fd = -1;
+  }
+  if (loop->epoll_fd >= 0)
+  {
+    close(loop->epoll_fd);
+    loop->epoll_fd = -1;
+  }
+  pthread_mutex_destroy(&loop->work_mutex);
+}
+
+bool mqtt_event_loop_add_source(mqtt_event_loop* loop, mqtt_event_source* source, uint32_t events)
+{
+  struct epoll_event event = { .events = events, .data.ptr = source };
+  if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, source->fd, &event) != 0)
+  {
+    LOG_ERROR("Failed to add fd %d to the event loop: %s", source->fd, strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+bool mqtt_event_loop_modify_source(
+    mqtt_event_loop* loop,
+    mqtt_event_source* source,
+    uint32_t events)
+{
+  struct epoll_event event = { .events = events, .data.ptr = source };
+  if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, source->fd, &event) != 0)
+  {
+    LOG_ERROR("Failed to modify fd %d in the event loop: %s", source->fd, strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+void mqtt_event_loop_remove_source(mqtt_event_loop* loop, mqtt_event_source* source)
+{
+  if (source->fd >= 0)
+  {
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, source->fd, NULL);
+  }
+}
+
+void mqtt_event_loop_free_source(mqtt_event_loop* loop, void* memory)
+{
+  if (!loop->dispatching)
+  {
+    free(memory);
+    return;
+  }
+
+  if (loop->deferred_count == loop->deferred_capacity)
+  {
+    size_t capacity = loop->deferred_capacity > 0 ? loop->deferred_capacity * 2 : 16;
+    void** deferred_frees = realloc(loop->deferred_frees, capacity * sizeof(void*));
+    if (deferred_frees == NULL)
+    {
+      /* Freeing now could let a pending event use the memory, so it is leaked instead. */
+      LOG_ERROR("Out of memory.");
+      return;
+    }
+    loop->deferred_frees = deferred_frees;
+    loop->deferred_capacity = capacity;
+  }
+  loop->deferred_frees[loop->deferred_count++] = memory;
+}
+
+mqtt_event_timer* mqtt_event_loop_add_timer(
+    mqtt_event_loop* loop,
+    uint32_t initial_delay_ms,
+    uint32_t interval_ms,
+    mqtt_event_callback callback,
+    void* context)
+{
+  if (loop == NULL)
+  {
+    return NULL;
+  }
+
+  mqtt_event_timer* timer = calloc(1, sizeof(mqtt_event_timer));
+  if (timer == NULL)
+  {
+    LOG_ERROR("Out of memory.");
+    return NULL;
+  }
+
+  if ((timer->source.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0)
+  {
+    LOG_ERROR("Failed to create timerfd: %s", strerror(errno));
+    free(timer);
+    return NULL;
+  }
+  timer->source.on_event = _on_timer;
+  timer->callback = callback;
+  timer->context = context;
+
+  struct itimerspec spec = { 0 };
+  _set_timespec_ms(&spec.it_value, initial_delay_ms);
+  _set_timespec_ms(&spec.it_interval, interval_ms);
+  if (initial_delay_ms == 0)
+  {
+    /* A zero it_value disarms the timer, so use the smallest possible delay instead. */
+    spec.it_value.tv_nsec = 1;
+  }
+
+  if (timerfd_settime(timer->source.fd, 0, &spec, NULL) != 0
+      || !mqtt_event_loop_add_source(loop, &timer->source, EPOLLIN))
+  {
+    LOG_ERROR("Failed to arm timer: %s", strerror(errno));
+    close(timer->source.fd);
+    free(timer);
+    return NULL;
+  }
+
+  return timer;
+}
+
+void mqtt_event_loop_remove_timer(mqtt_event_loop* loop, mqtt_event_timer* timer)
+{
+  if (timer == NULL)
+  {
+    return;
+  }
+
+  mqtt_event_loop_remove_source(loop, &timer->source);
+  close(timer->source.fd);
+  timer->source.fd = -1;
+  mqtt_event_loop_free_source(loop, timer);
+}
+
+bool mqtt_event_loop_post(mqtt_event_loop* loop, mqtt_event_callback callback, void* context)
+{
+  mqtt_event_work* work = malloc(sizeof(mqtt_event_work));
+  if (work == NULL)
+  {
+    LOG_ERROR("Out of memory.");
+    return false;
+  }
+  work->callback = callback;
+  work->context = context;
+  work->next = NULL;
+
+  pthread_mutex_lock(&loop->work_mutex);
+  if (loop->work_tail != NULL)
+  {
+    loop->work_tail->next = work;
+  }
+  else
+  {
+    loop->work_head = work;
+  }
+  loop->work_tail = work;
+  pthread_mutex_unlock(&loop->work_mutex);
+
+  mqtt_event_loop_wakeup(loop);
+  return true;
+}
+
+void mqtt_event_loop_wakeup(mqtt_event_loop* loop)
+{
+  uint64_t one = 1;
+  (void)!write(loop->wakeup.fd, &one, sizeof(one));
+}
+
+int mqtt_event_loop_run(mqtt_event_loop* loop)
+{
+  struct epoll_event events[MAX_EVENTS_PER_WAIT];
+
+  while (keep_running)
+  {
+    int count = epoll_wait(loop->epoll_fd, events, MAX_EVENTS_PER_WAIT, -1);
+    if (count < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      LOG_ERROR("Failure waiting for events: %s", strerror(errno));
+      return MOSQ_ERR_ERRNO;
+    }
+
+    loop->dispatching = true;
+    for (int i = 0; i < count; i++)
+    {
+      mqtt_event_source* source = (mqtt_event_source*)events[i].data.ptr;
+      source->on_event(loop, source, events[i].events);
+    }
+    loop->dispatching = false;
+    _free_deferred(loop);
+  }
+
+  /* Run anything that was posted before the stop so callers don't leak queued work. */
+  _run_posted_work(loop);
+
+  return MOSQ_ERR_SUCCESS;
+}
+
+static void _init_default_loop()
+{
+  if (mqtt_event_loop_init(&default_loop))
+  {
+    default_loop_initialized = true;
+    default_wakeup_fd = default_loop.wakeup.fd;
+  }
+}
+
+mqtt_event_loop* mqtt_client_event_loop()
+{
+  pthread_once(&default_loop_once, _init_default_loop);
+  return default_loop_initialized ? &default_loop : NULL;
+}
+
+int mqtt_client_run()
+{
+  mqtt_event_loop* loop = mqtt_client_event_loop();
+  if (loop == NULL)
+  {
+    return MOSQ_ERR_UNKNOWN;
+  }
+
+  return mqtt_event_loop_run(loop);
+}
+
+void mqtt_client_stop()
+{
+  keep_running = 0;
+
+  int fd = default_wakeup_fd;
+  if (fd >= 0)
+  {
+    uint64_t one = 1;
+    (void)!write(fd, &one, sizeof(one));
+  }
+}
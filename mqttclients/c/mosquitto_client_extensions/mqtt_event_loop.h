@@ -0,0 +1,167 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef MQTT_EVENT_LOOP_H
+#define MQTT_EVENT_LOOP_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct mqtt_event_loop mqtt_event_loop;
+
+typedef void (*mqtt_event_callback)(void* context);
+
+/* A file descriptor watched by the event loop. The loop keeps a pointer to the source, so it must
+ * stay valid until it has been removed from the loop. */
+typedef struct mqtt_event_source
+{
+  int fd;
+  void (*on_event)(mqtt_event_loop* loop, struct mqtt_event_source* source, uint32_t events);
+} mqtt_event_source;
+
+typedef struct mqtt_event_timer
+{
+  mqtt_event_source source;
+  mqtt_event_callback callback;
+  void* context;
+} mqtt_event_timer;
+
+typedef struct mqtt_event_work mqtt_event_work;
+
+struct mqtt_event_loop
+{
+  int epoll_fd;
+  mqtt_event_source wakeup;
+  pthread_mutex_t work_mutex;
+  mqtt_event_work* work_head;
+  mqtt_event_work* work_tail;
+  /* Memory of sources removed while a batch of events is being dispatched. It is freed once the
+   * batch is done, since events for those sources may still be pending in it. */
+  void** deferred_frees;
+  size_t deferred_count;
+  size_t deferred_capacity;
+  bool dispatching;
+};
+
+/**
+ * @brief Initializes an event loop backed by epoll, with an eventfd used for wakeups and posted
+ * work. The event loop must be freed with mqtt_event_loop_destroy().
+ *
+ * @param loop The event loop to initialize.
+ * @return true on success, false if any of the file descriptors could not be created.
+ */
+bool mqtt_event_loop_init(mqtt_event_loop* loop);
+
+/**
+ * @brief Closes the event loop file descriptors and frees any work that was posted but not run,
+ * along with the memory of removed sources. Sources and timers still registered with the loop are
+ * not freed.
+ *
+ * @param loop The event loop to destroy.
+ */
+void mqtt_event_loop_destroy(mqtt_event_loop* loop);
+
+/**
+ * @brief Registers a file descriptor with the event loop. source->on_event is called on the loop
+ * thread whenever any of the requested events are ready.
+ *
+ * @param loop The event loop.
+ * @param source The source to watch. source->fd and source->on_event must be set.
+ * @param events The epoll events to wait for (ex. EPOLLIN).
+ * @return true on success, false on failure.
+ */
+bool mqtt_event_loop_add_source(mqtt_event_loop* loop, mqtt_event_source* source, uint32_t events);
+
+/**
+ * @brief Changes the events a registered source is waiting for.
+ *
+ * @return true on success, false on failure.
+ */
+bool mqtt_event_loop_modify_source(
+    mqtt_event_loop* loop,
+    mqtt_event_source* source,
+    uint32_t events);
+
+/**
+ * @brief Stops watching a source. The source's file descriptor is not closed.
+ */
+void mqtt_event_loop_remove_source(mqtt_event_loop* loop, mqtt_event_source* source);
+
+/**
+ * @brief Frees the memory holding a removed source. While a batch of events is being dispatched,
+ * events for the source may still be pending in it, so the memory is only freed once the batch is
+ * done. Outside of a batch it is freed right away. Must be called on the loop thread, or while the
+ * loop is not running.
+ *
+ * @param loop The event loop the source was removed from.
+ * @param memory The memory to free, as returned by malloc().
+ */
+void mqtt_event_loop_free_source(mqtt_event_loop* loop, void* memory);
+
+/**
+ * @brief Adds a timer backed by a timerfd. The callback runs on the loop thread.
+ *
+ * @param loop The event loop.
+ * @param initial_delay_ms Delay before the first expiration. 0 fires on the next loop iteration.
+ * @param interval_ms Interval between subsequent expirations. 0 makes this a one-shot timer.
+ * @param callback The function to call when the timer expires.
+ * @param context Passed to the callback.
+ * @return The timer, which must be removed with mqtt_event_loop_remove_timer(), or NULL on failure.
+ */
+mqtt_event_timer* mqtt_event_loop_add_timer(
+    mqtt_event_loop* loop,
+    uint32_t initial_delay_ms,
+    uint32_t interval_ms,
+    mqtt_event_callback callback,
+    void* context);
+
+/**
+ * @brief Stops and frees a timer. It is safe to call this from the timer's own callback.
+ */
+void mqtt_event_loop_remove_timer(mqtt_event_loop* loop, mqtt_event_timer* timer);
+
+/**
+ * @brief Queues a function to be run on the loop thread and wakes the loop. This may be called
+ * from any thread, including the mosquitto network thread.
+ *
+ * @return true on success, false if the work item could not be allocated.
+ */
+bool mqtt_event_loop_post(mqtt_event_loop* loop, mqtt_event_callback callback, void* context);
+
+/**
+ * @brief Wakes the loop so that it re-checks keep_running. Async-signal-safe.
+ */
+void mqtt_event_loop_wakeup(mqtt_event_loop* loop);
+
+/**
+ * @brief Blocks the calling thread and dispatches events until keep_running is cleared.
+ *
+ * @return MOSQ_ERR_SUCCESS when stopped by keep_running, MOSQ_ERR_ERRNO if waiting failed.
+ */
+int mqtt_event_loop_run(mqtt_event_loop* loop);
+
+/**
+ * @brief Returns the process wide event loop used by mqtt_client_run(), initializing it on first
+ * use.
+ *
+ * @return The event loop, or NULL if it could not be initialized.
+ */
+mqtt_event_loop* mqtt_client_event_loop();
+
+/**
+ * @brief Runs the process wide event loop on the calling thread until mqtt_client_stop() is called
+ * or SIGINT is received. The thread sleeps in epoll_wait while there is nothing to do.
+ *
+ * @return MOSQ_ERR_SUCCESS on a clean stop, other enum mosq_err_t on failure.
+ */
+int mqtt_client_run();
+
+/**
+ * @brief Clears keep_running and wakes the process wide event loop. Async-signal-safe, so it can
+ * be called from signal handlers as well as mosquitto callbacks.
+ */
+void mqtt_client_stop();
+
+#endif /* MQTT_EVENT_LOOP_H */
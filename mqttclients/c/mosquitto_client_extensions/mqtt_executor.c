@@ -0,0 +1,250 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "logging.h"
+#include "mosquitto.h"
+#include "mqtt_executor.h"
+#include "mqtt_hash.h"
+
+typedef struct executor_item
+{
+  struct mosquitto* mosq;
+  struct mosquitto_message message;
+  mosquitto_property* props;
+  mqtt_message_handler handler;
+  void* context;
+  uint64_t submitted_ns;
+} executor_item;
+
+typedef struct executor_shard
+{
+  pthread_mutex_t mutex;
+  pthread_cond_t not_empty;
+  pthread_cond_t not_full;
+  pthread_t thread;
+  bool thread_started;
+  bool stopping;
+  /* Circular queue of capacity items starting at head. */
+  executor_item* items;
+  int capacity;
+  int head;
+  int count;
+  mqtt_executor_shard_metrics metrics;
+} executor_shard;
+
+struct mqtt_executor
+{
+  executor_shard* shards;
+  int shard_count;
+};
+
+static uint64_t _now_ns()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+static void* _worker_thread(void* arg)
+{
+  executor_shard* shard = (executor_shard*)arg;
+
+  pthread_mutex_lock(&shard->mutex);
+  while (true)
+  {
+    while (shard->count == 0 && !shard->stopping)
+    {
+      pthread_cond_wait(&shard->not_empty, &shard->mutex);
+    }
+    /* Stopping only once the queue is drained. */
+    if (shard->count == 0)
+    {
+      break;
+    }
+
+    executor_item item = shard->items[shard->head];
+    shard->head = (shard->head + 1) % shard->capacity;
+    shard->count--;
+    pthread_cond_signal(&shard->not_full);
+    pthread_mutex_unlock(&shard->mutex);
+
+    uint64_t started_ns = _now_ns();
+    item.handler(item.mosq, &item.message, item.props, item.context);
+    uint64_t finished_ns = _now_ns();
+
+    mosquitto_message_free_contents(&item.message);
+    mosquitto_property_free_all(&item.props);
+
+    pthread_mutex_lock(&shard->mutex);
+    mqtt_executor_shard_metrics* metrics = &shard->metrics;
+    uint64_t wait_ns = started_ns - item.submitted_ns;
+    uint64_t handler_ns = finished_ns - started_ns;
+    metrics->processed++;
+    metrics->total_wait_ns += wait_ns;
+    metrics->total_handler_ns += handler_ns;
+    if (wait_ns > metrics->max_wait_ns)
+    {
+      metrics->max_wait_ns = wait_ns;
+    }
+    if (handler_ns > metrics->max_handler_ns)
+    {
+      metrics->max_handler_ns = handler_ns;
+    }
+  }
+  pthread_mutex_unlock(&shard->mutex);
+  return NULL;
+}
+
+mqtt_executor* mqtt_executor_create(int shard_count, int queue_capacity)
+{
+  mqtt_executor* executor;
+
+  if (shard_count < 1 || queue_capacity < 1)
+  {
+    LOG_ERROR("Invalid executor size: %d shards of %d messages.", shard_count, queue_capacity);
+    return NULL;
+  }
+  if ((executor = calloc(1, sizeof(mqtt_executor))) == NULL
+      || (executor->shards = calloc(shard_count, sizeof(executor_shard))) == NULL)
+  {
+    LOG_ERROR("Out of memory.");
+    free(executor);
+    return NULL;
+  }
+
+  for (int i = 0; i < shard_count; i++)
+  {
+    executor_shard* shard = &executor->shards[i];
+    pthread_mutex_init(&shard->mutex, NULL);
+    pthread_cond_init(&shard->not_empty, NULL);
+    pthread_cond_init(&shard->not_full, NULL);
+    shard->capacity = queue_capacity;
+    executor->shard_count++;
+
+    if ((shard->items = calloc(queue_capacity, sizeof(executor_item))) == NULL
+        || !(shard->thread_started
+             = pthread_create(&shard->thread, NULL, _worker_thread, shard) == 0))
+    {
+      LOG_ERROR("Failed to start executor shard %d.", i);
+      mqtt_executor_destroy(executor);
+      return NULL;
+    }
+  }
+
+  return executor;
+}
+
+void mqtt_executor_destroy(mqtt_executor* executor)
+{
+  if (executor == NULL)
+  {
+    return;
+  }
+
+  for (int i = 0; i < executor->shard_count; i++)
+  {
+    executor_shard* shard = &executor->shards[i];
+    pthread_mutex_lock(&shard->mutex);
+    shard->stopping = true;
+    pthread_cond_signal(&shard->not_empty);
+    pthread_mutex_unlock(&shard->mutex);
+  }
+
+  for (int i = 0; i < executor->shard_count; i++)
+  {
+    executor_shard* shard = &executor->shards[i];
+    if (shard->thread_started)
+    {
+      pthread_join(shard->thread, NULL);
+    }
+    pthread_mutex_destroy(&shard->mutex);
+    pthread_cond_destroy(&shard->not_empty);
+    pthread_cond_destroy(&shard->not_full);
+    free(shard->items);
+  }
+
+  free(executor->shards);
+  free(executor);
+}
+
+int mqtt_executor_submit(
+    mqtt_executor* executor,
+    struct mosquitto* mosq,
+    const struct mosquitto_message* message,
+    const mosquitto_property* props,
+    mqtt_message_handler handler,
+    void* context)
+{
+  executor_shard* shard
+      = &executor->shards[mqtt_executor_shard_for_topic(executor, message->topic)];
+  executor_item item = { .mosq = mosq, .handler = handler, .context = context };
+
+  /* mosquitto frees the message and properties once on_message returns. */
+  bool copied = mosquitto_message_copy(&item.message, message) == MOSQ_ERR_SUCCESS;
+  if (copied && mosquitto_property_copy_all(&item.props, props) != MOSQ_ERR_SUCCESS)
+  {
+    mosquitto_message_free_contents(&item.message);
+    copied = false;
+  }
+  if (!copied)
+  {
+    pthread_mutex_lock(&shard->mutex);
+    shard->metrics.dropped++;
+    pthread_mutex_unlock(&shard->mutex);
+    return MOSQ_ERR_NOMEM;
+  }
+
+  pthread_mutex_lock(&shard->mutex);
+  if (shard->count == shard->capacity)
+  {
+    shard->metrics.full_waits++;
+    while (shard->count == shard->capacity)
+    {
+      pthread_cond_wait(&shard->not_full, &shard->mutex);
+    }
+  }
+
+  item.submitted_ns = _now_ns();
+  shard->items[(shard->head + shard->count) % shard->capacity] = item;
+  shard->count++;
+  shard->metrics.submitted++;
+  if ((size_t)shard->count > shard->metrics.max_queue_depth)
+  {
+    shard->metrics.max_queue_depth = shard->count;
+  }
+  pthread_cond_signal(&shard->not_empty);
+  pthread_mutex_unlock(&shard->mutex);
+
+  return MOSQ_ERR_SUCCESS;
+}
+
+int mqtt_executor_shard_count(const mqtt_executor* executor) { return executor->shard_count; }
+
+int mqtt_executor_shard_for_topic(const mqtt_executor* executor, const char* topic)
+{
+  return mqtt_hash_string(topic) % executor->shard_count;
+}
+
+bool mqtt_executor_get_metrics(
+    mqtt_executor* executor,
+    int shard_index,
+    mqtt_executor_shard_metrics* metrics)
+{
+  if (shard_index < 0 || shard_index >= executor->shard_count)
+  {
+    return false;
+  }
+
+  executor_shard* shard = &executor->shards[shard_index];
+  pthread_mutex_lock(&shard->mutex);
+  *metrics = shard->metrics;
+  metrics->queue_depth = shard->count;
+  pthread_mutex_unlock(&shard->mutex);
+  return true;
+}
@@ -0,0 +1,90 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef MQTT_EXECUTOR_H
+#define MQTT_EXECUTOR_H
+
+#include "mosquitto.h"
+#include "mqtt_topic_router.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct mqtt_executor mqtt_executor;
+
+typedef struct mqtt_executor_shard_metrics
+{
+  /* Messages waiting for the worker right now, and the most there have been. */
+  size_t queue_depth;
+  size_t max_queue_depth;
+  uint64_t submitted;
+  uint64_t processed;
+  /* Submits that had to wait because the queue was full. */
+  uint64_t full_waits;
+  /* Messages that couldn't be copied and were dropped instead of queued. */
+  uint64_t dropped;
+  /* Time between submitting a message and its handler starting. */
+  uint64_t total_wait_ns;
+  uint64_t max_wait_ns;
+  /* Time spent in the handler. */
+  uint64_t total_handler_ns;
+  uint64_t max_handler_ns;
+} mqtt_executor_shard_metrics;
+
+/**
+ * @brief Creates an executor that runs message handlers on a pool of worker threads instead of the
+ * mosquitto network thread, so a slow handler doesn't hold up reads, keepalives and PUBACKs. Each
+ * worker owns one shard, and a topic always maps to the same shard, so messages on one topic are
+ * handled in the order they were received. Set it as the executor of a mqtt_client_obj to have
+ * on_message hand messages to it.
+ *
+ * Handlers run concurrently with the network thread, so a handler that publishes needs a client
+ * running in threaded mode (mosquitto_loop_start(), mosquitto_loop_forever() or
+ * mosquitto_threaded_set()).
+ *
+ * @param shard_count The number of worker threads.
+ * @param queue_capacity Messages each shard can queue before mqtt_executor_submit() waits.
+ * @return The executor, or NULL on failure. Free it with mqtt_executor_destroy().
+ */
+mqtt_executor* mqtt_executor_create(int shard_count, int queue_capacity);
+
+/**
+ * @brief Handles every message already submitted, stops the workers and frees the executor. Call
+ * it before destroying the clients that submit to it.
+ */
+void mqtt_executor_destroy(mqtt_executor* executor);
+
+/**
+ * @brief Copies a message and its properties and queues them for the worker of the topic's shard,
+ * which calls handler with them and frees the copies. If the shard's queue is full, waits until
+ * the worker makes room.
+ *
+ * @return MOSQ_ERR_SUCCESS on success, MOSQ_ERR_NOMEM if the message couldn't be copied. The
+ * message is then dropped and counted in the dropped metric of its shard, the handler isn't called.
+ */
+int mqtt_executor_submit(
+    mqtt_executor* executor,
+    struct mosquitto* mosq,
+    const struct mosquitto_message* message,
+    const mosquitto_property* props,
+    mqtt_message_handler handler,
+    void* context);
+
+int mqtt_executor_shard_count(const mqtt_executor* executor);
+
+/**
+ * @brief Returns the shard that handles messages on a topic.
+ */
+int mqtt_executor_shard_for_topic(const mqtt_executor* executor, const char* topic);
+
+/**
+ * @brief Reads a snapshot of a shard's queue and handler metrics.
+ *
+ * @return true on success, false if the shard doesn't exist.
+ */
+bool mqtt_executor_get_metrics(
+    mqtt_executor* executor,
+    int shard_index,
+    mqtt_executor_shard_metrics* metrics);
+
+#endif /* MQTT_EXECUTOR_H */
@@ -0,0 +1,28 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include "mqtt_hash.h"
+
+#define FNV_OFFSET_BASIS 2166136261u
+#define FNV_PRIME 16777619u
+
+uint32_t mqtt_hash_bytes(const void* data, size_t length)
+{
+  const unsigned char* bytes = (const unsigned char*)data;
+  uint32_t hash = FNV_OFFSET_BASIS;
+  for (size_t i = 0; i < length; i++)
+  {
+    hash = (hash ^ bytes[i]) * FNV_PRIME;
+  }
+  return hash;
+}
+
+uint32_t mqtt_hash_string(const char* string)
+{
+  uint32_t hash = FNV_OFFSET_BASIS;
+  for (const unsigned char* c = (const unsigned char*)string; *c != '\0'; c++)
+  {
+    hash = (hash ^ *c) * FNV_PRIME;
+  }
+  return hash;
+}
@@ -0,0 +1,26 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef MQTT_HASH_H
+#define MQTT_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * 32-bit FNV-1a, used to spread short keys such as topics, topic levels and vehicle ids over hash
+ * tables, shards and pool connections. A key always hashes to the same value, in every process.
+ */
+
+/**
+ * @brief Hashes length bytes of data.
+ */
+uint32_t mqtt_hash_bytes(const void* data, size_t length);
+
+/**
+ * @brief Hashes a null terminated string, without its terminator. Same as mqtt_hash_bytes() over
+ * strlen(string) bytes.
+ */
+uint32_t mqtt_hash_string(const char* string);
+
+#endif /* MQTT_HASH_H */
@@ -0,0 +1,269 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "logging.h"
+#include "mosquitto.h"
+#include "mqtt_message_ring.h"
+#include "mqtt_setup.h"
+
+/*
+ * The producer (network thread) owns head and the consumer (application) owns tail. Both sides
+ * publish their index with a sequentially consistent store and then read the other side's, so at
+ * least one of them always sees the other's progress:
+ * - The producer signals data_fd when its push finds the ring empty. The consumer re-reads head
+ *   after moving tail, so a message pushed while it was popping is either seen or signalled.
+ * - The producer sets producer_waiting before it checks for room; the consumer signals space_fd
+ *   after moving tail if the flag is set.
+ */
+struct mqtt_message_ring
+{
+  mqtt_client_message* slots;
+  uint64_t mask;
+  int data_fd;
+  int space_fd;
+  __attribute__((aligned(64))) uint64_t head;
+  int producer_waiting;
+  uint64_t full_waits;
+  uint64_t dropped;
+  __attribute__((aligned(64))) uint64_t tail;
+};
+
+static void _signal(int fd)
+{
+  uint64_t one = 1;
+  (void)!write(fd, &one, sizeof(one));
+}
+
+static void _reset(int fd)
+{
+  uint64_t count;
+  (void)!read(fd, &count, sizeof(count));
+}
+
+static int64_t _now_ms()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/* Waits for the fd to become readable. Returns 1 if it did, 0 on timeout and -1 on failure. */
+static int _wait(int fd, int timeout_ms)
+{
+  struct pollfd pfd = { .fd = fd, .events = POLLIN };
+  int rc = poll(&pfd, 1, timeout_ms);
+  if (rc < 0 && errno == EINTR)
+  {
+    return 0;
+  }
+  return rc < 0 ? -1 : rc > 0;
+}
+
+mqtt_message_ring* mqtt_message_ring_create(int capacity)
+{
+  mqtt_message_ring* ring;
+  void* memory;
+  uint64_t size = 1;
+
+  if (capacity < 1)
+  {
+    LOG_ERROR("Invalid message ring capacity %d.", capacity);
+    return NULL;
+  }
+  while (size < (uint64_t)capacity)
+  {
+    size <<= 1;
+  }
+
+  if (posix_memalign(&memory, 64, sizeof(mqtt_message_ring)) != 0)
+  {
+    LOG_ERROR("Out of memory.");
+    return NULL;
+  }
+  ring = memory;
+  memset(ring, 0, sizeof(mqtt_message_ring));
+  ring->mask = size - 1;
+  ring->slots = calloc(size, sizeof(mqtt_client_message));
+  ring->data_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  ring->space_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+  if (ring->slots == NULL || ring->data_fd < 0 || ring->space_fd < 0)
+  {
+    LOG_ERROR("Failed to create a message ring of %d messages.", capacity);
+    mqtt_message_ring_destroy(ring);
+    return NULL;
+  }
+  return ring;
+}
+
+void mqtt_message_ring_destroy(mqtt_message_ring* ring)
+{
+  if (ring == NULL)
+  {
+    return;
+  }
+
+  if (ring->slots != NULL)
+  {
+    for (uint64_t i = ring->tail; i != ring->head; i++)
+    {
+      mqtt_client_message_free(&ring->slots[i & ring->mask], 1);
+    }
+  }
+  if (ring->data_fd >= 0)
+  {
+    close(ring->data_fd);
+  }
+  if (ring->space_fd >= 0)
+  {
+    close(ring->space_fd);
+  }
+  free(ring->slots);
+  free(ring);
+}
+
+bool mqtt_message_ring_push(
+    mqtt_message_ring* ring,
+    const struct mosquitto_message* message,
+    const mosquitto_property* props)
+{
+  uint64_t head = ring->head;
+
+  if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) > ring->mask)
+  {
+    __atomic_store_n(&ring->full_waits, ring->full_waits + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&ring->producer_waiting, 1, __ATOMIC_SEQ_CST);
+    while (head - __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) > ring->mask)
+    {
+      if (!keep_running)
+      {
+        __atomic_store_n(&ring->producer_waiting, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+        return false;
+      }
+      _wait(ring->space_fd, MQTT_MESSAGE_RING_FULL_WAIT_MS);
+      _reset(ring->space_fd);
+    }
+    __atomic_store_n(&ring->producer_waiting, 0, __ATOMIC_RELAXED);
+  }
+
+  /* mosquitto frees the message and properties once on_message returns. */
+  mqtt_client_message* slot = &ring->slots[head & ring->mask];
+  if (mosquitto_message_copy(&slot->message, message) != MOSQ_ERR_SUCCESS)
+  {
+    __atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+    return false;
+  }
+  if (mosquitto_property_copy_all(&slot->props, props) != MOSQ_ERR_SUCCESS)
+  {
+    mosquitto_message_free_contents(&slot->message);
+    __atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+    return false;
+  }
+
+  __atomic_store_n(&ring->head, head + 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) == head)
+  {
+    _signal(ring->data_fd);
+  }
+  return true;
+}
+
+int mqtt_message_ring_pop(
+    mqtt_message_ring* ring,
+    mqtt_client_message messages[],
+    int max,
+    int timeout_ms)
+{
+  int64_t deadline_ms = timeout_ms > 0 ? _now_ms() + timeout_ms : 0;
+  int count = 0;
+
+  while (true)
+  {
+    /* Clear the signal before looking, a push after this point signals again. */
+    _reset(ring->data_fd);
+
+    uint64_t tail = ring->tail;
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    while (count < max && tail != head)
+    {
+      messages[count++] = ring->slots[tail & ring->mask];
+      tail++;
+      if (tail == head)
+      {
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_SEQ_CST);
+        head = __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST);
+      }
+    }
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&ring->producer_waiting, __ATOMIC_SEQ_CST))
+    {
+      _signal(ring->space_fd);
+    }
+    if (count > 0)
+    {
+      /* Keep the fd readable for the messages that didn't fit. */
+      if (__atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) != tail)
+      {
+        _signal(ring->data_fd);
+      }
+      return count;
+    }
+
+    int wait_ms = timeout_ms > 0 ? (int)(deadline_ms - _now_ms()) : timeout_ms;
+    if (timeout_ms == 0 || (timeout_ms > 0 && wait_ms <= 0))
+    {
+      return 0;
+    }
+    if (_wait(ring->data_fd, wait_ms) < 0)
+    {
+      LOG_ERROR("Failed to wait for messages: %s", strerror(errno));
+      return -1;
+    }
+  }
+}
+
+int mqtt_message_ring_fd(const mqtt_message_ring* ring) { return ring->data_fd; }
+
+mqtt_message_ring_stats mqtt_message_ring_get_stats(const mqtt_message_ring* ring)
+{
+  mqtt_message_ring_stats stats;
+  stats.pushed = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+  stats.popped = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+  stats.full_waits = __atomic_load_n(&ring->full_waits, __ATOMIC_RELAXED);
+  stats.dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+  return stats;
+}
+
+int mqtt_client_poll(
+    struct mqtt_client_obj* client,
+    mqtt_client_message messages[],
+    int max,
+    int timeout_ms)
+{
+  if (client == NULL || client->message_ring == NULL)
+  {
+    LOG_ERROR("The client has no message ring to poll.");
+    return -1;
+  }
+  return mqtt_message_ring_pop(client->message_ring, messages, max, timeout_ms);
+}
+
+void mqtt_client_message_free(mqtt_client_message messages[], int count)
+{
+  for (int i = 0; i < count; i++)
+  {
+    mosquitto_message_free_contents(&messages[i].message);
+    mosquitto_property_free_all(&messages[i].props);
+  }
+}
@@ -0,0 +1,106 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef MQTT_MESSAGE_RING_H
+#define MQTT_MESSAGE_RING_H
+
+#include "mosquitto.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/* How long a full ring makes the network thread wait before it re-checks keep_running. */
+#define MQTT_MESSAGE_RING_FULL_WAIT_MS 100
+
+struct mqtt_client_obj;
+
+/* A received message and its properties, owned by the application once polled. */
+typedef struct mqtt_client_message
+{
+  struct mosquitto_message message;
+  mosquitto_property* props;
+} mqtt_client_message;
+
+typedef struct mqtt_message_ring mqtt_message_ring;
+
+typedef struct mqtt_message_ring_stats
+{
+  uint64_t pushed;
+  uint64_t popped;
+  /* Pushes that found the ring full and had to wait for the application. */
+  uint64_t full_waits;
+  /* Messages discarded because the ring was full when keep_running was cleared. */
+  uint64_t dropped;
+} mqtt_message_ring_stats;
+
+/**
+ * @brief Creates a bounded single-producer/single-consumer ring of received messages. Set it as
+ * the message_ring of a mqtt_client_obj and on_message pushes every message into it instead of
+ * calling the handlers; the application then takes them out in batches with mqtt_client_poll().
+ * Neither side takes a lock. When the ring is full, on_message waits for the application to make
+ * room, which stops the client reading from the socket and so slows down the broker.
+ *
+ * @param capacity The number of messages the ring can hold, rounded up to a power of 2.
+ * @return The ring, or NULL on failure. Free it with mqtt_message_ring_destroy().
+ */
+mqtt_message_ring* mqtt_message_ring_create(int capacity);
+
+/**
+ * @brief Frees the ring and any messages still in it. The client pushing into it must be stopped
+ * first.
+ */
+void mqtt_message_ring_destroy(mqtt_message_ring* ring);
+
+/**
+ * @brief Copies a message and its properties into the ring. Must only be called from one thread at
+ * a time, normally the mosquitto network thread through on_message.
+ *
+ * @return true if the message was queued, false if it was dropped.
+ */
+bool mqtt_message_ring_push(
+    mqtt_message_ring* ring,
+    const struct mosquitto_message* message,
+    const mosquitto_property* props);
+
+/**
+ * @brief Moves up to max messages out of the ring, waiting up to timeout_ms for the first one.
+ * Must only be called from one thread at a time.
+ *
+ * @param ring The ring.
+ * @param messages Receives the messages, which must be freed with mqtt_client_message_free().
+ * @param max The size of messages.
+ * @param timeout_ms How long to wait if the ring is empty: 0 returns immediately, -1 waits forever.
+ * @return The number of messages taken, or -1 if waiting failed.
+ */
+int mqtt_message_ring_pop(
+    mqtt_message_ring* ring,
+    mqtt_client_message messages[],
+    int max,
+    int timeout_ms);
+
+/**
+ * @brief Returns a file descriptor that becomes readable when messages are pushed into an empty
+ * ring, so the consumer can be driven by an event loop (ex. with mqtt_event_loop_add_source()). It
+ * stays readable while messages are left after a pop.
+ */
+int mqtt_message_ring_fd(const mqtt_message_ring* ring);
+
+mqtt_message_ring_stats mqtt_message_ring_get_stats(const mqtt_message_ring* ring);
+
+/**
+ * @brief Takes up to max received messages from the client's message_ring, waiting up to
+ * timeout_ms for the first one. See mqtt_message_ring_pop().
+ *
+ * @return The number of messages taken, or -1 if the client has no message_ring or waiting failed.
+ */
+int mqtt_client_poll(
+    struct mqtt_client_obj* client,
+    mqtt_client_message messages[],
+    int max,
+    int timeout_ms);
+
+/**
+ * @brief Frees the messages returned by mqtt_client_poll() or mqtt_message_ring_pop().
+ */
+void mqtt_client_message_free(mqtt_client_message messages[], int count);
+
+#endif /* MQTT_MESSAGE_RING_H */
@@ -0,0 +1,248 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <openssl/ssl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <time.h>
+
+#include "logging.h"
+#include "mosquitto.h"
+#include "mqtt_event_loop.h"
+#include "mqtt_reactor.h"
+
+#define INITIAL_CLIENT_CAPACITY 16
+
+static void _client_register(mqtt_reactor_client* client)
+{
+  client->source.fd = mosquitto_socket(client->mosq);
+  if (client->source.fd < 0)
+  {
+    return;
+  }
+
+  client->events = EPOLLIN | (mosquitto_want_write(client->mosq) ? EPOLLOUT : 0);
+  if (!mqtt_event_loop_add_source(client->reactor->loop, &client->source, client->events))
+  {
+    client->source.fd = -1;
+  }
+}
+
+static void _client_connection_lost(mqtt_reactor_client* client, int rc)
+{
+  LOG_WARNING("Reactor client lost its connection: %s", mosquitto_strerror(rc));
+
+  /* mosquitto closes the socket when the connection is lost, which also removes it from the epoll
+   * set. If it is still open, remove it ourselves. */
+  if (mosquitto_socket(client->mosq) >= 0)
+  {
+    mqtt_event_loop_remove_source(client->reactor->loop, &client->source);
+  }
+  client->source.fd = -1;
+  client->reconnect_at = time(NULL) + MQTT_REACTOR_RECONNECT_DELAY_SECONDS;
+}
+
+static void _on_client_event(mqtt_event_loop* loop, mqtt_event_source* source, uint32_t events)
+{
+  mqtt_reactor_client* client = (mqtt_reactor_client*)source;
+  int rc = MOSQ_ERR_SUCCESS;
+
+  if (source->fd < 0)
+  {
+    return;
+  }
+
+  if (events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+  {
+    /* Records OpenSSL has already read from the socket don't make it readable again, so keep
+     * reading while it holds any, as mosquitto_loop() does. */
+    SSL* ssl;
+    do
+    {
+      rc = mosquitto_loop_read(client->mosq, 1);
+    } while (rc == MOSQ_ERR_SUCCESS && (ssl = mosquitto_ssl_get(client->mosq)) != NULL
+             && SSL_pending(ssl) > 0);
+  }
+  if (rc == MOSQ_ERR_SUCCESS && (events & EPOLLOUT))
+  {
+    rc = mosquitto_loop_write(client->mosq, 1);
+  }
+
+  if (rc != MOSQ_ERR_SUCCESS)
+  {
+    _client_connection_lost(client, rc);
+  }
+  else
+  {
+    mqtt_reactor_client_update(client);
+  }
+}
+
+static void _on_misc_timer(void* context)
+{
+  mqtt_reactor* reactor = (mqtt_reactor*)context;
+  time_t now = time(NULL);
+
+  size_t i = 0;
+  while (i < reactor->client_count)
+  {
+    mqtt_reactor_client* client = reactor->clients[i];
+
+    if (client->source.fd >= 0)
+    {
+      /* Sends PINGREQs when the keepalive is due and checks for PINGRESP timeouts. */
+      int rc = mosquitto_loop_misc(client->mosq);
+      if (rc != MOSQ_ERR_SUCCESS || mosquitto_socket(client->mosq) < 0)
+      {
+        _client_connection_lost(client, rc);
+      }
+      else
+      {
+        mqtt_reactor_client_update(client);
+      }
+    }
+    else if (now >= client->reconnect_at)
+    {
+      /* The connect completes in the background and the CONNECT packet is sent once the socket
+       * becomes writable, so a broker that is slow to answer doesn't stall the other clients. */
+      int rc = mosquitto_reconnect_async(client->mosq);
+      if (rc == MOSQ_ERR_SUCCESS)
+      {
+        _client_register(client);
+      }
+      else
+      {
+        LOG_WARNING("Reactor client failed to reconnect: %s", mosquitto_strerror(rc));
+        client->reconnect_at = now + MQTT_REACTOR_RECONNECT_DELAY_SECONDS;
+      }
+    }
+
+    /* A mosquitto callback may have removed the client, which swaps the last client into this
+     * slot. That client still needs this tick. */
+    if (reactor->clients[i] == client)
+    {
+      i++;
+    }
+  }
+}
+
+bool mqtt_reactor_init(mqtt_reactor* reactor, mqtt_event_loop* loop)
+{
+  reactor->loop = loop;
+  reactor->client_count = 0;
+  reactor->client_capacity = INITIAL_CLIENT_CAPACITY;
+  reactor->clients = malloc(reactor->client_capacity * sizeof(mqtt_reactor_client*));
+  if (reactor->clients == NULL)
+  {
+    LOG_ERROR("Out of memory.");
+    return false;
+  }
+
+  reactor->misc_timer = mqtt_event_loop_add_timer(
+      loop, MQTT_REACTOR_MISC_INTERVAL_MS, MQTT_REACTOR_MISC_INTERVAL_MS, _on_misc_timer, reactor);
+  if (reactor->misc_timer == NULL)
+  {
+    free(reactor->clients);
+    reactor->clients = NULL;
+    return false;
+  }
+
+  return true;
+}
+
+void mqtt_reactor_destroy(mqtt_reactor* reactor)
+{
+  while (reactor->client_count > 0)
+  {
+    mqtt_reactor_remove_client(reactor, reactor->clients[reactor->client_count - 1]);
+  }
+  mqtt_event_loop_remove_timer(reactor->loop, reactor->misc_timer);
+  reactor->misc_timer = NULL;
+  free(reactor->clients);
+  reactor->clients = NULL;
+  reactor->client_capacity = 0;
+}
+
+mqtt_reactor_client* mqtt_reactor_add_client(mqtt_reactor* reactor, struct mosquitto* mosq)
+{
+  if (reactor->client_count == reactor->client_capacity)
+  {
+    size_t capacity = reactor->client_capacity * 2;
+    mqtt_reactor_client** clients
+        = realloc(reactor->clients, capacity * sizeof(mqtt_reactor_client*));
+    if (clients == NULL)
+    {
+      LOG_ERROR("Out of memory.");
+      return NULL;
+    }
+    reactor->clients = clients;
+    reactor->client_capacity = capacity;
+  }
+
+  mqtt_reactor_client* client = calloc(1, sizeof(mqtt_reactor_client));
+  if (client == NULL)
+  {
+    LOG_ERROR("Out of memory.");
+    return NULL;
+  }
+  client->source.on_event = _on_client_event;
+  client->mosq = mosq;
+  client->reactor = reactor;
+
+  _client_register(client);
+  if (client->source.fd < 0)
+  {
+    LOG_ERROR("Reactor clients must be connected before they are added.");
+    free(client);
+    return NULL;
+  }
+
+  client->index = reactor->client_count;
+  reactor->clients[reactor->client_count++] = client;
+  return client;
+}
+
+void mqtt_reactor_remove_client(mqtt_reactor* reactor, mqtt_reactor_client* client)
+{
+  mqtt_event_loop_remove_source(reactor->loop, &client->source);
+  client->source.fd = -1;
+
+  /* Swap the last client into this slot so removal stays O(1). */
+  mqtt_reactor_client* last = reactor->clients[--reactor->client_count];
+  reactor->clients[client->index] = last;
+  last->index = client->index;
+
+  mqtt_event_loop_free_source(reactor->loop, client);
+}
+
+void mqtt_reactor_client_update(mqtt_reactor_client* client)
+{
+  if (client->source.fd < 0)
+  {
+    return;
+  }
+
+  uint32_t events = EPOLLIN | (mosquitto_want_write(client->mosq) ? EPOLLOUT : 0);
+  if (events != client->events
+      && mqtt_event_loop_modify_source(client->reactor->loop, &client->source, events))
+  {
+    client->events = events;
+  }
+}
+
+int mqtt_reactor_publish(
+    mqtt_reactor_client* client,
+    int* mid,
+    const char* topic,
+    int payloadlen,
+    const void* payload,
+    int qos,
+    bool retain,
+    const mosquitto_property* properties)
+{
+  int rc = mosquitto_publish_v5(
+      client->mosq, mid, topic, payloadlen, payload, qos, retain, properties);
+  mqtt_reactor_client_update(client);
+  return rc;
+}
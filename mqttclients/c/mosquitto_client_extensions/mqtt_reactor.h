@@ -0,0 +1,96 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef MQTT_REACTOR_H
+#define MQTT_REACTOR_H
+
+#include "mosquitto.h"
+#include "mqtt_event_loop.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+/* How often keepalives are checked and dropped connections are retried. */
+#define MQTT_REACTOR_MISC_INTERVAL_MS 1000
+#define MQTT_REACTOR_RECONNECT_DELAY_SECONDS 5
+
+typedef struct mqtt_reactor mqtt_reactor;
+
+typedef struct mqtt_reactor_client
+{
+  mqtt_event_source source;
+  struct mosquitto* mosq;
+  mqtt_reactor* reactor;
+  uint32_t events;
+  time_t reconnect_at;
+  size_t index;
+} mqtt_reactor_client;
+
+struct mqtt_reactor
+{
+  mqtt_event_loop* loop;
+  mqtt_event_timer* misc_timer;
+  mqtt_reactor_client** clients;
+  size_t client_count;
+  size_t client_capacity;
+};
+
+/**
+ * @brief Initializes a reactor that drives mosquitto clients from an event loop instead of
+ * giving each client its own network thread with mosquitto_loop_start(). All clients added to the
+ * reactor are read, written and kept alive on the thread running the event loop, so their
+ * callbacks also run on that thread.
+ *
+ * @param reactor The reactor to initialize.
+ * @param loop The event loop to register client sockets with, ex. mqtt_client_event_loop().
+ * @return true on success, false on failure.
+ */
+bool mqtt_reactor_init(mqtt_reactor* reactor, mqtt_event_loop* loop);
+
+/**
+ * @brief Removes all clients from the reactor and frees its memory. The mosquitto clients
+ * themselves are not disconnected or destroyed.
+ */
+void mqtt_reactor_destroy(mqtt_reactor* reactor);
+
+/**
+ * @brief Adds a connected client to the reactor. The client must have been connected with one of
+ * the mosquitto_connect functions and must not be running mosquitto_loop_start().
+ *
+ * @param reactor The reactor.
+ * @param mosq The connected mosquitto client.
+ * @return The reactor's handle for the client, or NULL on failure.
+ */
+mqtt_reactor_client* mqtt_reactor_add_client(mqtt_reactor* reactor, struct mosquitto* mosq);
+
+/**
+ * @brief Stops driving a client and frees the handle. Call this before disconnecting the client
+ * when it should not be reconnected. From an event callback the handle is freed once the batch
+ * being dispatched is done; once the loop has stopped it is freed right away.
+ */
+void mqtt_reactor_remove_client(mqtt_reactor* reactor, mqtt_reactor_client* client);
+
+/**
+ * @brief Makes sure the reactor waits for the client's socket to become writable if mosquitto has
+ * queued outgoing packets. Call this after using the mosquitto client directly (ex. subscribing)
+ * from the loop thread. Callbacks run by the reactor don't need to call it.
+ */
+void mqtt_reactor_client_update(mqtt_reactor_client* client);
+
+/**
+ * @brief Publishes a message on a reactor client. Must be called on the loop thread; other
+ * threads should use mqtt_event_loop_post() to get there.
+ *
+ * @return enum mosq_err_t from mosquitto_publish_v5().
+ */
+int mqtt_reactor_publish(
+    mqtt_reactor_client* client,
+    int* mid,
+    const char* topic,
+    int payloadlen,
+    const void* payload,
+    int qos,
+    bool retain,
+    const mosquitto_property* properties);
+
+#endif /* MQTT_REACTOR_H */
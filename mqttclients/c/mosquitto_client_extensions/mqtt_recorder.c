@@ -0,0 +1,1452 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "logging.h"
+#include "mosquitto.h"
+#include "mqtt_protocol.h"
+#include "mqtt_recorder.h"
+
+#define SEGMENT_MAGIC "MQTTREC1"
+#define INDEX_MAGIC "MQTTIDX1"
+#define FORMAT_VERSION 1
+#define SEGMENT_SUFFIX ".rec"
+#define INDEX_SUFFIX ".idx"
+#define RECORD_ALIGNMENT 8
+#define RECORD_MESSAGE 1
+#define RECORD_TOPIC 2
+#define MIN_SEGMENT_BYTES 4096
+#define MAX_SEGMENT_BYTES 0xffffffffull
+#define MIN_INDEX_INTERVAL_BYTES 64
+#define MAX_STRING_LENGTH 0xffff
+#define HASH_MULTIPLIER 0x9e3779b97f4a7c15ull
+#define NANOSECONDS_PER_SECOND 1000000000ull
+#define NANOSECONDS_PER_MILLISECOND 1000000ull
+
+/* The files are written in the byte order of the host, little endian on x86 and ARM. */
+
+/* The start of a segment file. */
+typedef struct segment_header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t header_size;
+  uint64_t sequence;
+  /* The receive time of the first record. */
+  uint64_t first_ns;
+  /* The topic ids of the segment are below it. */
+  uint32_t max_topics;
+  uint32_t reserved[7];
+} segment_header;
+
+/* The start of a record, followed by the properties and the payload of a message, or by the null
+ * terminated name of a topic, then padded to RECORD_ALIGNMENT. */
+typedef struct record_header
+{
+  /* The bytes of the record without its padding, 0 after the last record of a segment. */
+  uint32_t size;
+  uint16_t type;
+  uint8_t qos;
+  uint8_t retain;
+  uint64_t received_ns;
+  uint32_t topic_id;
+  uint32_t properties_length;
+  uint32_t payload_length;
+  /* A hash of the rest of the record, to find records torn by a crash. */
+  uint32_t check;
+} record_header;
+
+/* The start of an index file, followed by its entries then the offsets of the topic records of its
+ * segment. */
+typedef struct index_header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t entry_count;
+  uint32_t topic_count;
+  uint32_t reserved;
+} index_header;
+
+typedef struct index_entry
+{
+  /* The latest receive time of the records up to this one, so entries are in order even when the
+   * clock steps back. */
+  uint64_t received_ns;
+  uint64_t offset;
+} index_entry;
+
+/* A segment being written, then closed by the background thread. */
+typedef struct recorder_segment
+{
+  uint32_t sequence;
+  int fd;
+  uint8_t* data;
+  /* The bytes of records written, read by the background thread to sync them. */
+  size_t used;
+  size_t synced;
+  uint64_t max_ns;
+  index_entry* index;
+  uint32_t index_count;
+  size_t next_index_offset;
+  /* The offsets of the topic records. */
+  uint32_t* topics;
+  uint32_t topic_count;
+  uint32_t topic_capacity;
+} recorder_segment;
+
+typedef struct recorder_topic
+{
+  char* name;
+  uint32_t hash;
+  uint32_t id;
+  /* The last segment the topic was written to, 0 for none. */
+  uint32_t sequence;
+} recorder_topic;
+
+struct mqtt_recorder
+{
+  char* directory;
+  mqtt_recorder_options options;
+  /* Only used by the appending thread. */
+  recorder_topic* topics;
+  uint32_t slot_mask;
+  uint32_t topic_count;
+  uint8_t* properties;
+  size_t properties_capacity;
+  /* current and everything below is shared with the background thread, under mutex. The
+   * appending thread writes to current without it. */
+  pthread_mutex_t mutex;
+  pthread_cond_t work;
+  pthread_cond_t room;
+  pthread_t thread;
+  bool thread_started;
+  bool stopping;
+  recorder_segment* current;
+  /* The next segment, created ahead by the background thread. */
+  recorder_segment* spare;
+  bool spare_creating;
+  bool spare_failed;
+  /* The full segments waiting to be closed, a circular queue of max_pending_segments. */
+  recorder_segment** closing;
+  int closing_head;
+  int closing_count;
+  uint32_t next_sequence;
+  uint64_t synced_ns;
+  /* Each counter has a single writer and is read with atomics. */
+  mqtt_recorder_stats stats;
+};
+
+typedef struct reader_segment
+{
+  uint32_t sequence;
+  uint64_t first_ns;
+} reader_segment;
+
+struct mqtt_recorder_reader
+{
+  char* directory;
+  reader_segment* segments;
+  int segment_count;
+  /* The open segment, segment_count after the last one. */
+  int segment;
+  int fd;
+  uint8_t* data;
+  size_t size;
+  size_t offset;
+  /* The offset of the record last returned. */
+  size_t record_offset;
+  size_t header_size;
+  uint32_t max_topics;
+  index_entry* index;
+  uint32_t index_count;
+  /* The topic of each id of the open segment, pointing into it. */
+  const char** topics;
+};
+
+static uint64_t _now_ns()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  return (uint64_t)now.tv_sec * NANOSECONDS_PER_SECOND + (uint64_t)now.tv_nsec;
+}
+
+static void _count(uint64_t* counter, uint64_t value)
+{
+  __atomic_store_n(counter, *counter + value, __ATOMIC_RELAXED);
+}
+
+static size_t _align(size_t size)
+{
+  return (size + RECORD_ALIGNMENT - 1) & ~(size_t)(RECORD_ALIGNMENT - 1);
+}
+
+static uint64_t _mix(uint64_t hash, uint64_t word)
+{
+  hash = (hash ^ word) * HASH_MULTIPLIER;
+  return hash ^ (hash >> 29);
+}
+
+/* Hashes bytes 8 at a time, in two independent lanes so the multiplications overlap. */
+static uint32_t _hash_bytes(uint64_t seed, const void* data, size_t length)
+{
+  const uint8_t* bytes = (const uint8_t*)data;
+  uint64_t hash = seed;
+  uint64_t other = ~seed;
+  uint64_t words[2];
+  size_t i = 0;
+
+  for (; i + sizeof(words) <= length; i += sizeof(words))
+  {
+    memcpy(words, bytes + i, sizeof(words));
+    hash = _mix(hash, words[0]);
+    other = _mix(other, words[1]);
+  }
+  memset(words, 0, sizeof(words));
+  memcpy(words, bytes + i, length - i);
+  hash = _mix(_mix(hash, words[0]), words[1]);
+  hash = _mix(hash, other);
+  return (uint32_t)(hash ^ (hash >> 32));
+}
+
+/* Hashes the header of a record but its check, then its body. */
+static uint32_t _check(const record_header* header, const uint8_t* body, size_t length)
+{
+  uint64_t seed = _mix(
+      header->size | (uint64_t)header->type << 32 | (uint64_t)header->qos << 48
+          | (uint64_t)header->retain << 56,
+      header->received_ns);
+  seed = _mix(seed, header->topic_id | (uint64_t)header->properties_length << 32);
+  seed = _mix(seed, header->payload_length);
+  return _hash_bytes(seed, body, length);
+}
+
+static void _file_path(
+    const char* directory,
+    uint32_t sequence,
+    const char* suffix,
+    char* path,
+    size_t size)
+{
+  snprintf(path, size, "%s/%010u%s", directory, sequence, suffix);
+}
+
+/* Lists the sequences of the segment files of a directory, in increasing order. */
+static int _list_segments(const char* directory, uint32_t** sequences)
+{
+  DIR* dir = opendir(directory);
+  struct dirent* entry;
+  int count = 0;
+  int capacity = 0;
+
+  *sequences = NULL;
+  if (dir == NULL)
+  {
+    LOG_ERROR("Failed to open %s: %s", directory, strerror(errno));
+    return -1;
+  }
+  while ((entry = readdir(dir)) != NULL)
+  {
+    char* end;
+    unsigned long sequence = strtoul(entry->d_name, &end, 10);
+    if (end == entry->d_name || strcmp(end, SEGMENT_SUFFIX) != 0 || sequence == 0
+        || sequence > UINT32_MAX)
+    {
+      continue;
+    }
+    if (count == capacity)
+    {
+      uint32_t* grown = realloc(*sequences, (capacity = capacity * 2 + 16) * sizeof(uint32_t));
+      if (grown == NULL)
+      {
+        LOG_ERROR("Out of memory.");
+        free(*sequences);
+        closedir(dir);
+        return -1;
+      }
+      *sequences = grown;
+    }
+    /* Insertion sort, directories hold few segments. */
+    int i = count++;
+    for (; i > 0 && (*sequences)[i - 1] > sequence; i--)
+    {
+      (*sequences)[i] = (*sequences)[i - 1];
+    }
+    (*sequences)[i] = (uint32_t)sequence;
+  }
+  closedir(dir);
+  return count;
+}
+
+/* The type of the value of a property, from the MQTT 5 specification. */
+static int _property_type(int identifier)
+{
+  switch (identifier)
+  {
+    case MQTT_PROP_PAYLOAD_FORMAT_INDICATOR:
+    case MQTT_PROP_REQUEST_PROBLEM_INFORMATION:
+    case MQTT_PROP_REQUEST_RESPONSE_INFORMATION:
+    case MQTT_PROP_MAXIMUM_QOS:
+    case MQTT_PROP_RETAIN_AVAILABLE:
+    case MQTT_PROP_WILDCARD_SUB_AVAILABLE:
+    case MQTT_PROP_SUBSCRIPTION_ID_AVAILABLE:
+    case MQTT_PROP_SHARED_SUB_AVAILABLE:
+      return MQTT_PROP_TYPE_BYTE;
+    case MQTT_PROP_SERVER_KEEP_ALIVE:
+    case MQTT_PROP_RECEIVE_MAXIMUM:
+    case MQTT_PROP_TOPIC_ALIAS_MAXIMUM:
+    case MQTT_PROP_TOPIC_ALIAS:
+      return MQTT_PROP_TYPE_INT16;
+    case MQTT_PROP_MESSAGE_EXPIRY_INTERVAL:
+    case MQTT_PROP_SESSION_EXPIRY_INTERVAL:
+    case MQTT_PROP_WILL_DELAY_INTERVAL:
+    case MQTT_PROP_MAXIMUM_PACKET_SIZE:
+      return MQTT_PROP_TYPE_INT32;
+    case MQTT_PROP_SUBSCRIPTION_IDENTIFIER:
+      return MQTT_PROP_TYPE_VARINT;
+    case MQTT_PROP_CORRELATION_DATA:
+    case MQTT_PROP_AUTHENTICATION_DATA:
+      return MQTT_PROP_TYPE_BINARY;
+    case MQTT_PROP_CONTENT_TYPE:
+    case MQTT_PROP_RESPONSE_TOPIC:
+    case MQTT_PROP_ASSIGNED_CLIENT_IDENTIFIER:
+    case MQTT_PROP_AUTHENTICATION_METHOD:
+    case MQTT_PROP_RESPONSE_INFORMATION:
+    case MQTT_PROP_SERVER_REFERENCE:
+    case MQTT_PROP_REASON_STRING:
+      return MQTT_PROP_TYPE_STRING;
+    case MQTT_PROP_USER_PROPERTY:
+      return MQTT_PROP_TYPE_STRING_PAIR;
+    default:
+      return -1;
+  }
+}
+
+/* Appends bytes to the properties buffer of the recorder. */
+static bool _put(mqtt_recorder* recorder, size_t* length, const void* data, size_t size)
+{
+  if (*length + size > recorder->properties_capacity)
+  {
+    size_t capacity = (*length + size) * 2;
+    uint8_t* grown = realloc(recorder->properties, capacity);
+    if (grown == NULL)
+    {
+      return false;
+    }
+    recorder->properties = grown;
+    recorder->properties_capacity = capacity;
+  }
+  memcpy(recorder->properties + *length, data, size);
+  *length += size;
+  return true;
+}
+
+static bool _put_string(mqtt_recorder* recorder, size_t* length, const void* value, size_t size)
+{
+  uint16_t size_16 = (uint16_t)(size > MAX_STRING_LENGTH ? MAX_STRING_LENGTH : size);
+  return _put(recorder, length, &size_16, sizeof(size_16))
+      && _put(recorder, length, value, size_16);
+}
+
+/* Writes each property as its identifier, then its value: 1, 2 or 4 bytes for numbers, and a
+ * 2 byte length then the bytes for binary data and strings. Returns the length, or -1. */
+static int _serialize_properties(mqtt_recorder* recorder, const mosquitto_property* props)
+{
+  size_t length = 0;
+  bool success = true;
+
+  for (const mosquitto_property* property = props; property != NULL && success;
+       property = mosquitto_property_next(property))
+  {
+    int identifier = mosquitto_property_identifier(property);
+    uint8_t identifier_8 = (uint8_t)identifier;
+    uint8_t byte;
+    uint16_t int16;
+    uint32_t int32;
+    void* binary = NULL;
+    char* name = NULL;
+    char* value = NULL;
+
+    switch (_property_type(identifier))
+    {
+      case MQTT_PROP_TYPE_BYTE:
+        success = mosquitto_property_read_byte(property, identifier, &byte, false) != NULL
+            && _put(recorder, &length, &identifier_8, 1) && _put(recorder, &length, &byte, 1);
+        break;
+      case MQTT_PROP_TYPE_INT16:
+        success = mosquitto_property_read_int16(property, identifier, &int16, false) != NULL
+            && _put(recorder, &length, &identifier_8, 1)
+            && _put(recorder, &length, &int16, sizeof(int16));
+        break;
+      case MQTT_PROP_TYPE_INT32:
+        success = mosquitto_property_read_int32(property, identifier, &int32, false) != NULL
+            && _put(recorder, &length, &identifier_8, 1)
+            && _put(recorder, &length, &int32, sizeof(int32));
+        break;
+      case MQTT_PROP_TYPE_VARINT:
+        success = mosquitto_property_read_varint(property, identifier, &int32, false) != NULL
+            && _put(recorder, &length, &identifier_8, 1)
+            && _put(recorder, &length, &int32, sizeof(int32));
+        break;
+      case MQTT_PROP_TYPE_BINARY:
+        success
+            = mosquitto_property_read_binary(property, identifier, &binary, &int16, false) != NULL
+            && _put(recorder, &length, &identifier_8, 1)
+            && _put_string(recorder, &length, binary, int16);
+        break;
+      case MQTT_PROP_TYPE_STRING:
+        success = mosquitto_property_read_string(property, identifier, &value, false) != NULL
+            && _put(recorder, &length, &identifier_8, 1)
+            && _put_string(recorder, &length, value, strlen(value));
+        break;
+      case MQTT_PROP_TYPE_STRING_PAIR:
+        success
+            = mosquitto_property_read_string_pair(property, identifier, &name, &value, false)
+                != NULL
+            && _put(recorder, &length, &identifier_8, 1)
+            && _put_string(recorder, &length, name, strlen(name))
+            && _put_string(recorder, &length, value, strlen(value));
+        break;
+      default:
+        /* Not a property of the specification, it can't be read. */
+        break;
+    }
+    free(binary);
+    free(name);
+    free(value);
+  }
+  return success && length <= INT32_MAX ? (int)length : -1;
+}
+
+static void _segment_free(recorder_segment* segment)
+{
+  free(segment->index);
+  free(segment->topics);
+  free(segment);
+}
+
+/* Creates a segment file of segment_bytes, allocated on disk so writing to its mapping can't fail
+ * for lack of space, and maps it. */
+static recorder_segment* _segment_create(mqtt_recorder* recorder, uint32_t sequence)
+{
+  size_t size = recorder->options.segment_bytes;
+  char path[strlen(recorder->directory) + 32];
+  recorder_segment* segment = calloc(1, sizeof(recorder_segment));
+  int rc;
+
+  _file_path(recorder->directory, sequence, SEGMENT_SUFFIX, path, sizeof(path));
+  if (segment == NULL
+      || (segment->index
+          = calloc(size / recorder->options.index_interval_bytes + 2, sizeof(index_entry)))
+          == NULL)
+  {
+    LOG_ERROR("Out of memory.");
+    free(segment != NULL ? segment->index : NULL);
+    free(segment);
+    return NULL;
+  }
+  segment->sequence = sequence;
+  if ((segment->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0)
+  {
+    LOG_ERROR("Failed to create %s: %s", path, strerror(errno));
+    _segment_free(segment);
+    return NULL;
+  }
+  if ((rc = posix_fallocate(segment->fd, 0, (off_t)size)) != 0
+      || (segment->data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, segment->fd, 0))
+          == MAP_FAILED)
+  {
+    LOG_ERROR("Failed to map %s: %s", path, strerror(rc != 0 ? rc : errno));
+    close(segment->fd);
+    unlink(path);
+    _segment_free(segment);
+    return NULL;
+  }
+  madvise(segment->data, size, MADV_SEQUENTIAL);
+  return segment;
+}
+
+/* Syncs the records written to a segment since its last sync. */
+static void _segment_sync(mqtt_recorder* recorder, recorder_segment* segment)
+{
+  size_t used = __atomic_load_n(&segment->used, __ATOMIC_ACQUIRE);
+  if (used > segment->synced)
+  {
+    size_t start = segment->synced & ~((size_t)sysconf(_SC_PAGESIZE) - 1);
+    if (msync(segment->data + start, used - start, MS_SYNC) != 0)
+    {
+      LOG_ERROR("Failed to sync segment %u: %s", segment->sequence, strerror(errno));
+    }
+    segment->synced = used;
+    _count(&recorder->stats.syncs, 1);
+  }
+}
+
+static void _write_index(mqtt_recorder* recorder, const recorder_segment* segment)
+{
+  char path[strlen(recorder->directory) + 32];
+  index_header header = { .magic = INDEX_MAGIC,
+                          .version = FORMAT_VERSION,
+                          .entry_count = segment->index_count,
+                          .topic_count = segment->topic_count };
+  FILE* file;
+
+  _file_path(recorder->directory, segment->sequence, INDEX_SUFFIX, path, sizeof(path));
+  if ((file = fopen(path, "wb")) == NULL)
+  {
+    LOG_ERROR("Failed to create %s: %s", path, strerror(errno));
+    return;
+  }
+  if (fwrite(&header, sizeof(header), 1, file) != 1
+      || fwrite(segment->index, sizeof(index_entry), segment->index_count, file)
+          != segment->index_count
+      || fwrite(segment->topics, sizeof(uint32_t), segment->topic_count, file)
+          != segment->topic_count
+      || fflush(file) != 0
+      || (recorder->options.sync != MQTT_RECORDER_SYNC_NONE && fsync(fileno(file)) != 0))
+  {
+    LOG_ERROR("Failed to write %s: %s", path, strerror(errno));
+    fclose(file);
+    unlink(path);
+    return;
+  }
+  fclose(file);
+}
+
+/* Syncs a full segment, writes its index, and trims its file to its records. Empty segments are
+ * removed. */
+static void _segment_close(mqtt_recorder* recorder, recorder_segment* segment)
+{
+  char path[strlen(recorder->directory) + 32];
+
+  if (segment->used > 0)
+  {
+    if (recorder->options.sync != MQTT_RECORDER_SYNC_NONE)
+    {
+      _segment_sync(recorder, segment);
+    }
+    _write_index(recorder, segment);
+  }
+  munmap(segment->data, recorder->options.segment_bytes);
+  if (segment->used == 0)
+  {
+    _file_path(recorder->directory, segment->sequence, SEGMENT_SUFFIX, path, sizeof(path));
+    unlink(path);
+  }
+  else if (
+      ftruncate(segment->fd, (off_t)segment->used) != 0
+      || (recorder->options.sync != MQTT_RECORDER_SYNC_NONE && fsync(segment->fd) != 0))
+  {
+    LOG_ERROR("Failed to close segment %u: %s", segment->sequence, strerror(errno));
+  }
+  close(segment->fd);
+  _segment_free(segment);
+}
+
+/* Creates the spare segment, closes full segments and syncs the current one every
+ * sync_interval_ms. */
+static void* _background_thread(void* arg)
+{
+  mqtt_recorder* recorder = (mqtt_recorder*)arg;
+  uint64_t interval_ns = (uint64_t)recorder->options.sync_interval_ms * NANOSECONDS_PER_MILLISECOND;
+  bool interval = recorder->options.sync == MQTT_RECORDER_SYNC_INTERVAL;
+
+  pthread_mutex_lock(&recorder->mutex);
+  while (true)
+  {
+    uint64_t now_ns = _now_ns();
+    if (!recorder->stopping && recorder->spare == NULL && !recorder->spare_failed)
+    {
+      uint32_t sequence = recorder->next_sequence++;
+      recorder->spare_creating = true;
+      pthread_mutex_unlock(&recorder->mutex);
+      recorder_segment* spare = _segment_create(recorder, sequence);
+      pthread_mutex_lock(&recorder->mutex);
+      recorder->spare = spare;
+      recorder->spare_creating = false;
+      recorder->spare_failed = spare == NULL;
+      pthread_cond_signal(&recorder->room);
+    }
+    else if (recorder->closing_count > 0)
+    {
+      recorder_segment* segment = recorder->closing[recorder->closing_head];
+      pthread_mutex_unlock(&recorder->mutex);
+      _segment_close(recorder, segment);
+      pthread_mutex_lock(&recorder->mutex);
+      recorder->closing_head
+          = (recorder->closing_head + 1) % recorder->options.max_pending_segments;
+      recorder->closing_count--;
+      pthread_cond_signal(&recorder->room);
+    }
+    else if (recorder->stopping)
+    {
+      break;
+    }
+    else if (interval && now_ns >= recorder->synced_ns + interval_ns)
+    {
+      /* Only this thread unmaps segments, so current stays mapped even if it fills up meanwhile. */
+      recorder_segment* segment = recorder->current;
+      recorder->synced_ns = now_ns;
+      pthread_mutex_unlock(&recorder->mutex);
+      if (segment != NULL)
+      {
+        _segment_sync(recorder, segment);
+      }
+      pthread_mutex_lock(&recorder->mutex);
+    }
+    else if (interval)
+    {
+      uint64_t wake_ns = recorder->synced_ns + interval_ns;
+      struct timespec wake_at = { .tv_sec = (time_t)(wake_ns / NANOSECONDS_PER_SECOND),
+                                  .tv_nsec = (long)(wake_ns % NANOSECONDS_PER_SECOND) };
+      pthread_cond_timedwait(&recorder->work, &recorder->mutex, &wake_at);
+    }
+    else
+    {
+      pthread_cond_wait(&recorder->work, &recorder->mutex);
+    }
+  }
+  pthread_mutex_unlock(&recorder->mutex);
+  return NULL;
+}
+
+/* Queues the current segment to be closed and takes the spare one. Waits when
+ * max_pending_segments are already waiting to be closed, or for the spare being created. */
+static bool _rotate(mqtt_recorder* recorder)
+{
+  recorder_segment* next;
+  uint32_t sequence = 0;
+  bool waited = false;
+
+  pthread_mutex_lock(&recorder->mutex);
+  if (recorder->current != NULL)
+  {
+    while (recorder->closing_count == recorder->options.max_pending_segments)
+    {
+      waited = true;
+      pthread_cond_wait(&recorder->room, &recorder->mutex);
+    }
+    recorder->closing
+        [(recorder->closing_head + recorder->closing_count++)
+         % recorder->options.max_pending_segments]
+        = recorder->current;
+    recorder->current = NULL;
+  }
+  while (recorder->spare_creating)
+  {
+    waited = true;
+    pthread_cond_wait(&recorder->room, &recorder->mutex);
+  }
+  next = recorder->spare;
+  recorder->spare = NULL;
+  recorder->spare_failed = false;
+  if (next == NULL)
+  {
+    sequence = recorder->next_sequence++;
+  }
+  pthread_cond_signal(&recorder->work);
+  pthread_mutex_unlock(&recorder->mutex);
+
+  if (waited)
+  {
+    _count(&recorder->stats.full_waits, 1);
+  }
+  if (next == NULL)
+  {
+    next = _segment_create(recorder, sequence);
+  }
+  pthread_mutex_lock(&recorder->mutex);
+  recorder->current = next;
+  pthread_mutex_unlock(&recorder->mutex);
+  return next != NULL;
+}
+
+/* Finds the topic, or gives it the next id. When all max_topics ids are taken, they start again
+ * from 0 in a new segment, so each segment has one topic per id. */
+static recorder_topic* _find_topic(
+    mqtt_recorder* recorder,
+    const char* name,
+    size_t length,
+    bool* reset)
+{
+  uint32_t hash = _hash_bytes(length, name, length);
+  uint32_t slot = hash & recorder->slot_mask;
+
+  *reset = false;
+  for (; recorder->topics[slot].name != NULL; slot = (slot + 1) & recorder->slot_mask)
+  {
+    recorder_topic* topic = &recorder->topics[slot];
+    if (topic->hash == hash && strcmp(topic->name, name) == 0)
+    {
+      return topic;
+    }
+  }
+  if (recorder->topic_count == (uint32_t)recorder->options.max_topics)
+  {
+    for (uint32_t i = 0; i <= recorder->slot_mask; i++)
+    {
+      free(recorder->topics[i].name);
+    }
+    memset(recorder->topics, 0, (recorder->slot_mask + 1) * sizeof(recorder_topic));
+    recorder->topic_count = 0;
+    *reset = true;
+    for (slot = hash & recorder->slot_mask; recorder->topics[slot].name != NULL;
+         slot = (slot + 1) & recorder->slot_mask)
+    {
+    }
+  }
+  recorder_topic* topic = &recorder->topics[slot];
+  if ((topic->name = strdup(name)) == NULL)
+  {
+    return NULL;
+  }
+  topic->hash = hash;
+  topic->id = recorder->topic_count++;
+  topic->sequence = 0;
+  return topic;
+}
+
+/* Writes a record at the end of the segment: its body, its header, then its size last so a reader
+ * mapping the segment never sees half a record. */
+static void _write_record(
+    mqtt_recorder* recorder,
+    recorder_segment* segment,
+    record_header header,
+    const void* first,
+    size_t first_length,
+    const void* second,
+    size_t second_length)
+{
+  uint8_t* record = segment->data + segment->used;
+  uint8_t* body = record + sizeof(record_header);
+  uint32_t size = header.size;
+
+  if (first_length > 0)
+  {
+    memcpy(body, first, first_length);
+  }
+  if (second_length > 0)
+  {
+    memcpy(body + first_length, second, second_length);
+  }
+  header.check = _check(&header, body, first_length + second_length);
+  header.size = 0;
+  memcpy(record, &header, sizeof(header));
+  __atomic_store_n((uint32_t*)record, size, __ATOMIC_RELEASE);
+  __atomic_store_n(&segment->used, segment->used + _align(size), __ATOMIC_RELEASE);
+  _count(&recorder->stats.bytes, _align(size));
+}
+
+mqtt_recorder_options mqtt_recorder_options_default()
+{
+  return (mqtt_recorder_options){
+    .segment_bytes = MQTT_RECORDER_DEFAULT_SEGMENT_BYTES,
+    .index_interval_bytes = MQTT_RECORDER_DEFAULT_INDEX_INTERVAL_BYTES,
+    .sync = MQTT_RECORDER_SYNC_INTERVAL,
+    .sync_interval_ms = MQTT_RECORDER_DEFAULT_SYNC_INTERVAL_MS,
+    .max_pending_segments = MQTT_RECORDER_DEFAULT_MAX_PENDING_SEGMENTS,
+    .max_topics = MQTT_RECORDER_DEFAULT_MAX_TOPICS,
+  };
+}
+
+bool mqtt_recorder_sync_from_name(const char* name, mqtt_recorder_sync* sync)
+{
+  if (strcmp(name, "none") == 0)
+  {
+    *sync = MQTT_RECORDER_SYNC_NONE;
+  }
+  else if (strcmp(name, "interval") == 0)
+  {
+    *sync = MQTT_RECORDER_SYNC_INTERVAL;
+  }
+  else if (strcmp(name, "segment") == 0)
+  {
+    *sync = MQTT_RECORDER_SYNC_SEGMENT;
+  }
+  else
+  {
+    return false;
+  }
+  return true;
+}
+
+mqtt_recorder* mqtt_recorder_create(const char* directory, const mqtt_recorder_options* options)
+{
+  mqtt_recorder_options settings = options != NULL ? *options : mqtt_recorder_options_default();
+  mqtt_recorder* recorder;
+  uint32_t* sequences;
+  int count;
+  uint32_t slots = 1;
+
+  if (directory == NULL || settings.segment_bytes < MIN_SEGMENT_BYTES
+      || settings.segment_bytes > MAX_SEGMENT_BYTES
+      || settings.index_interval_bytes < MIN_INDEX_INTERVAL_BYTES
+      || settings.sync < MQTT_RECORDER_SYNC_NONE || settings.sync > MQTT_RECORDER_SYNC_SEGMENT
+      || settings.sync_interval_ms < 1 || settings.max_pending_segments < 1
+      || settings.max_topics < 1 || settings.max_topics > INT32_MAX / 4)
+  {
+    LOG_ERROR("Invalid recorder options.");
+    return NULL;
+  }
+  if (mkdir(directory, 0755) != 0 && errno != EEXIST)
+  {
+    LOG_ERROR("Failed to create %s: %s", directory, strerror(errno));
+    return NULL;
+  }
+  if ((count = _list_segments(directory, &sequences)) < 0)
+  {
+    return NULL;
+  }
+  /* At most half the slots of the topic table are used. */
+  while (slots < 2 * (uint32_t)settings.max_topics)
+  {
+    slots *= 2;
+  }
+
+  if ((recorder = calloc(1, sizeof(mqtt_recorder))) == NULL
+      || (recorder->directory = strdup(directory)) == NULL
+      || (recorder->topics = calloc(slots, sizeof(recorder_topic))) == NULL
+      || (recorder->closing = calloc(settings.max_pending_segments, sizeof(recorder_segment*)))
+          == NULL)
+  {
+    LOG_ERROR("Out of memory.");
+    free(sequences);
+    if (recorder != NULL)
+    {
+      free(recorder->directory);
+      free(recorder->topics);
+      free(recorder);
+    }
+    return NULL;
+  }
+  recorder->options = settings;
+  recorder->slot_mask = slots - 1;
+  recorder->next_sequence = count > 0 ? sequences[count - 1] + 1 : 1;
+  recorder->synced_ns = _now_ns();
+  free(sequences);
+  pthread_mutex_init(&recorder->mutex, NULL);
+  pthread_cond_init(&recorder->work, NULL);
+  pthread_cond_init(&recorder->room, NULL);
+
+  if ((recorder->current = _segment_create(recorder, recorder->next_sequence++)) == NULL
+      || !(recorder->thread_started
+           = pthread_create(&recorder->thread, NULL, _background_thread, recorder) == 0))
+  {
+    LOG_ERROR("Failed to start the recorder in %s.", directory);
+    mqtt_recorder_destroy(recorder);
+    return NULL;
+  }
+  return recorder;
+}
+
+void mqtt_recorder_destroy(mqtt_recorder* recorder)
+{
+  if (recorder == NULL)
+  {
+    return;
+  }
+  pthread_mutex_lock(&recorder->mutex);
+  if (recorder->thread_started && recorder->current != NULL)
+  {
+    while (recorder->closing_count == recorder->options.max_pending_segments)
+    {
+      pthread_cond_wait(&recorder->room, &recorder->mutex);
+    }
+    recorder->closing
+        [(recorder->closing_head + recorder->closing_count++)
+         % recorder->options.max_pending_segments]
+        = recorder->current;
+    recorder->current = NULL;
+  }
+  recorder->stopping = true;
+  pthread_cond_signal(&recorder->work);
+  pthread_mutex_unlock(&recorder->mutex);
+
+  /* The background thread closes every segment queued before it stops. */
+  if (recorder->thread_started)
+  {
+    pthread_join(recorder->thread, NULL);
+  }
+  if (recorder->current != NULL)
+  {
+    _segment_close(recorder, recorder->current);
+  }
+  if (recorder->spare != NULL)
+  {
+    _segment_close(recorder, recorder->spare);
+  }
+  pthread_mutex_destroy(&recorder->mutex);
+  pthread_cond_destroy(&recorder->work);
+  pthread_cond_destroy(&recorder->room);
+  for (uint32_t i = 0; i <= recorder->slot_mask; i++)
+  {
+    free(recorder->topics[i].name);
+  }
+  free(recorder->topics);
+  free(recorder->closing);
+  free(recorder->properties);
+  free(recorder->directory);
+  free(recorder);
+}
+
+int mqtt_recorder_append(
+    mqtt_recorder* recorder,
+    const struct mosquitto_message* message,
+    const mosquitto_property* props,
+    uint64_t received_ns)
+{
+  size_t topic_length = strlen(message->topic);
+  size_t payload_length = message->payloadlen > 0 ? (size_t)message->payloadlen : 0;
+  int properties_length = _serialize_properties(recorder, props);
+  /* Topics are written with their null terminator, for readers to use them in place. */
+  size_t topic_bytes = _align(sizeof(record_header) + topic_length + 1);
+  size_t message_bytes;
+  recorder_topic* topic;
+  bool reset;
+
+  received_ns = received_ns != 0 ? received_ns : _now_ns();
+  if (properties_length < 0)
+  {
+    _count(&recorder->stats.dropped, 1);
+    return MOSQ_ERR_NOMEM;
+  }
+  message_bytes = _align(sizeof(record_header) + properties_length + payload_length);
+  if (sizeof(segment_header) + topic_bytes + message_bytes > recorder->options.segment_bytes)
+  {
+    _count(&recorder->stats.dropped, 1);
+    return MOSQ_ERR_PAYLOAD_SIZE;
+  }
+  if ((topic = _find_topic(recorder, message->topic, topic_length, &reset)) == NULL)
+  {
+    _count(&recorder->stats.dropped, 1);
+    return MOSQ_ERR_NOMEM;
+  }
+
+  recorder_segment* segment = recorder->current;
+  if (segment == NULL || (reset && segment->used > 0)
+      || segment->used + (topic->sequence == segment->sequence ? 0 : topic_bytes) + message_bytes
+          > recorder->options.segment_bytes)
+  {
+    if (!_rotate(recorder))
+    {
+      _count(&recorder->stats.dropped, 1);
+      return MOSQ_ERR_ERRNO;
+    }
+    segment = recorder->current;
+  }
+
+  if (segment->used == 0)
+  {
+    segment_header header = { .magic = SEGMENT_MAGIC,
+                              .version = FORMAT_VERSION,
+                              .header_size = sizeof(segment_header),
+                              .sequence = segment->sequence,
+                              .first_ns = received_ns,
+                              .max_topics = (uint32_t)recorder->options.max_topics };
+    memcpy(segment->data, &header, sizeof(header));
+    __atomic_store_n(&segment->used, sizeof(header), __ATOMIC_RELEASE);
+    _count(&recorder->stats.segments, 1);
+  }
+  if (topic->sequence != segment->sequence)
+  {
+    if (segment->topic_count == segment->topic_capacity)
+    {
+      uint32_t capacity = segment->topic_capacity * 2 + 64;
+      uint32_t* grown = realloc(segment->topics, capacity * sizeof(uint32_t));
+      if (grown == NULL)
+      {
+        _count(&recorder->stats.dropped, 1);
+        return MOSQ_ERR_NOMEM;
+      }
+      segment->topics = grown;
+      segment->topic_capacity = capacity;
+    }
+    segment->topics[segment->topic_count++] = (uint32_t)segment->used;
+    record_header header = { .size = (uint32_t)(sizeof(record_header) + topic_length + 1),
+                             .type = RECORD_TOPIC,
+                             .received_ns = received_ns,
+                             .topic_id = topic->id,
+                             .payload_length = (uint32_t)topic_length + 1 };
+    _write_record(recorder, segment, header, message->topic, topic_length + 1, NULL, 0);
+    topic->sequence = segment->sequence;
+  }
+
+  segment->max_ns = received_ns > segment->max_ns ? received_ns : segment->max_ns;
+  if (segment->used >= segment->next_index_offset)
+  {
+    segment->index[segment->index_count++]
+        = (index_entry){ .received_ns = segment->max_ns, .offset = segment->used };
+    segment->next_index_offset = (segment->used / recorder->options.index_interval_bytes + 1)
+        * recorder->options.index_interval_bytes;
+  }
+  record_header header = { .size = (uint32_t)(sizeof(record_header) + properties_length
+                                              + payload_length),
+                           .type = RECORD_MESSAGE,
+                           .qos = (uint8_t)message->qos,
+                           .retain = message->retain,
+                           .received_ns = received_ns,
+                           .topic_id = topic->id,
+                           .properties_length = (uint32_t)properties_length,
+                           .payload_length = (uint32_t)payload_length };
+  _write_record(
+      recorder,
+      segment,
+      header,
+      recorder->properties,
+      (size_t)properties_length,
+      message->payload,
+      payload_length);
+  _count(&recorder->stats.records, 1);
+  return MOSQ_ERR_SUCCESS;
+}
+
+mqtt_recorder_stats mqtt_recorder_get_stats(const mqtt_recorder* recorder)
+{
+  const mqtt_recorder_stats* stats = &recorder->stats;
+  return (mqtt_recorder_stats){
+    .records = __atomic_load_n(&stats->records, __ATOMIC_RELAXED),
+    .bytes = __atomic_load_n(&stats->bytes, __ATOMIC_RELAXED),
+    .segments = __atomic_load_n(&stats->segments, __ATOMIC_RELAXED),
+    .dropped = __atomic_load_n(&stats->dropped, __ATOMIC_RELAXED),
+    .full_waits = __atomic_load_n(&stats->full_waits, __ATOMIC_RELAXED),
+    .syncs = __atomic_load_n(&stats->syncs, __ATOMIC_RELAXED),
+  };
+}
+
+static void _reader_close_segment(mqtt_recorder_reader* reader)
+{
+  if (reader->data != NULL)
+  {
+    munmap(reader->data, reader->size);
+    reader->data = NULL;
+  }
+  if (reader->fd >= 0)
+  {
+    close(reader->fd);
+    reader->fd = -1;
+  }
+  free(reader->topics);
+  reader->topics = NULL;
+  free(reader->index);
+  reader->index = NULL;
+  reader->index_count = 0;
+}
+
+/* Reads the record at offset, returns its size with padding, or 0 if there is no whole record. */
+static size_t _reader_record(
+    const mqtt_recorder_reader* reader,
+    size_t offset,
+    record_header* header)
+{
+  if (offset + sizeof(record_header) > reader->size)
+  {
+    return 0;
+  }
+  /* The size is written last, and read first. */
+  uint32_t size = __atomic_load_n((const uint32_t*)(reader->data + offset), __ATOMIC_ACQUIRE);
+  if (size < sizeof(record_header) || offset + size > reader->size)
+  {
+    return 0;
+  }
+  memcpy(header, reader->data + offset, sizeof(record_header));
+  header->size = size;
+  if ((uint64_t)header->properties_length + header->payload_length + sizeof(record_header) != size
+      || header->topic_id >= reader->max_topics
+      || _check(header, reader->data + offset + sizeof(record_header), size - sizeof(record_header))
+          != header->check)
+  {
+    return 0;
+  }
+  return _align(size);
+}
+
+static bool _reader_set_topic(mqtt_recorder_reader* reader, size_t offset)
+{
+  record_header header;
+  const char* topic = (const char*)reader->data + offset + sizeof(record_header);
+  if (_reader_record(reader, offset, &header) == 0 || header.type != RECORD_TOPIC
+      || header.payload_length == 0 || topic[header.payload_length - 1] != '\0')
+  {
+    return false;
+  }
+  reader->topics[header.topic_id] = topic;
+  return true;
+}
+
+/* Loads the index of the open segment and its topics, if it has a valid one. */
+static void _reader_load_index(mqtt_recorder_reader* reader, uint32_t sequence)
+{
+  char path[strlen(reader->directory) + 32];
+  index_header header;
+  struct stat status;
+  FILE* file;
+
+  _file_path(reader->directory, sequence, INDEX_SUFFIX, path, sizeof(path));
+  if ((file = fopen(path, "rb")) == NULL)
+  {
+    return;
+  }
+  uint32_t* topics = NULL;
+  bool valid = fstat(fileno(file), &status) == 0 && fread(&header, sizeof(header), 1, file) == 1
+      && memcmp(header.magic, INDEX_MAGIC, sizeof(header.magic)) == 0
+      && header.version == FORMAT_VERSION
+      && (uint64_t)status.st_size
+          == sizeof(header) + (uint64_t)header.entry_count * sizeof(index_entry)
+              + (uint64_t)header.topic_count * sizeof(uint32_t)
+      && (reader->index = malloc(header.entry_count * sizeof(index_entry) + 1)) != NULL
+      && (topics = malloc(header.topic_count * sizeof(uint32_t) + 1)) != NULL
+      && fread(reader->index, sizeof(index_entry), header.entry_count, file) == header.entry_count
+      && fread(topics, sizeof(uint32_t), header.topic_count, file) == header.topic_count;
+  fclose(file);
+
+  for (uint32_t i = 0; valid && i < header.entry_count; i++)
+  {
+    valid = reader->index[i].offset < reader->size;
+  }
+  for (uint32_t i = 0; valid && i < header.topic_count; i++)
+  {
+    valid = _reader_set_topic(reader, topics[i]);
+  }
+  free(topics);
+  if (valid)
+  {
+    reader->index_count = header.entry_count;
+  }
+  else
+  {
+    LOG_WARNING("Ignoring the invalid index %s", path);
+    free(reader->index);
+    reader->index = NULL;
+  }
+}
+
+static bool _reader_open_segment(mqtt_recorder_reader* reader)
+{
+  uint32_t sequence = reader->segments[reader->segment].sequence;
+  char path[strlen(reader->directory) + 32];
+  segment_header header;
+  struct stat status;
+
+  _file_path(reader->directory, sequence, SEGMENT_SUFFIX, path, sizeof(path));
+  if ((reader->fd = open(path, O_RDONLY)) < 0 || fstat(reader->fd, &status) != 0
+      || (size_t)status.st_size < sizeof(segment_header)
+      || (reader->data = mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, reader->fd, 0))
+          == MAP_FAILED)
+  {
+    LOG_ERROR("Failed to map %s: %s", path, strerror(errno));
+    reader->data = NULL;
+    _reader_close_segment(reader);
+    return false;
+  }
+  reader->size = status.st_size;
+  memcpy(&header, reader->data, sizeof(header));
+  reader->max_topics = header.max_topics;
+  reader->header_size = header.header_size;
+  reader->offset = header.header_size;
+  if ((reader->topics = calloc(reader->max_topics, sizeof(const char*))) == NULL)
+  {
+    LOG_ERROR("Out of memory.");
+    _reader_close_segment(reader);
+    return false;
+  }
+  _reader_load_index(reader, sequence);
+  return true;
+}
+
+/* Reads the next message of the open segment, defining the topics on the way. Returns 1, or 0 at
+ * the end of the segment. */
+static int _reader_next_message(mqtt_recorder_reader* reader, mqtt_recorder_record* record)
+{
+  record_header header;
+  size_t size;
+
+  while ((size = _reader_record(reader, reader->offset, &header)) > 0)
+  {
+    size_t offset = reader->offset;
+    const uint8_t* body = reader->data + offset + sizeof(record_header);
+    reader->offset += size;
+    if (header.type == RECORD_TOPIC)
+    {
+      _reader_set_topic(reader, offset);
+    }
+    else if (header.type == RECORD_MESSAGE && reader->topics[header.topic_id] != NULL)
+    {
+      *record = (mqtt_recorder_record){ .received_ns = header.received_ns,
+                                        .topic = reader->topics[header.topic_id],
+                                        .payload = body + header.properties_length,
+                                        .payload_length = (int)header.payload_length,
+                                        .qos = header.qos,
+                                        .retain = header.retain != 0,
+                                        .properties = body,
+                                        .properties_length = header.properties_length };
+      reader->record_offset = offset;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+mqtt_recorder_reader* mqtt_recorder_reader_open(const char* directory)
+{
+  mqtt_recorder_reader* reader;
+  uint32_t* sequences;
+  int count;
+
+  if ((count = _list_segments(directory, &sequences)) < 0)
+  {
+    return NULL;
+  }
+  if ((reader = calloc(1, sizeof(mqtt_recorder_reader))) == NULL
+      || (reader->directory = strdup(directory)) == NULL
+      || (reader->segments = calloc(count + 1, sizeof(reader_segment))) == NULL)
+  {
+    LOG_ERROR("Out of memory.");
+    free(sequences);
+    mqtt_recorder_reader_close(reader);
+    return NULL;
+  }
+  reader->fd = -1;
+
+  /* Segments without a header are spares that were never written to. */
+  for (int i = 0; i < count; i++)
+  {
+    char path[strlen(directory) + 32];
+    segment_header header;
+    int fd;
+    _file_path(directory, sequences[i], SEGMENT_SUFFIX, path, sizeof(path));
+    if ((fd = open(path, O_RDONLY)) >= 0)
+    {
+      if (pread(fd, &header, sizeof(header), 0) == sizeof(header)
+          && memcmp(header.magic, SEGMENT_MAGIC, sizeof(header.magic)) == 0
+          && header.version == FORMAT_VERSION && header.header_size >= sizeof(header))
+      {
+        reader->segments[reader->segment_count++]
+            = (reader_segment){ .sequence = sequences[i], .first_ns = header.first_ns };
+      }
+      close(fd);
+    }
+  }
+  free(sequences);
+  return reader;
+}
+
+void mqtt_recorder_reader_close(mqtt_recorder_reader* reader)
+{
+  if (reader == NULL)
+  {
+    return;
+  }
+  _reader_close_segment(reader);
+  free(reader->segments);
+  free(reader->directory);
+  free(reader);
+}
+
+bool mqtt_recorder_reader_seek(mqtt_recorder_reader* reader, uint64_t received_ns)
+{
+  mqtt_recorder_record record;
+  int first = 0;
+  int last = reader->segment_count - 1;
+
+  /* The last segment starting before the time, the time may be in it. */
+  while (first < last)
+  {
+    int middle = first + (last - first + 1) / 2;
+    if (reader->segments[middle].first_ns < received_ns)
+    {
+      first = middle;
+    }
+    else
+    {
+      last = middle - 1;
+    }
+  }
+  if (reader->segment_count == 0)
+  {
+    return true;
+  }
+  /* The open segment keeps the topics it already read. */
+  if (reader->segment != first || reader->data == NULL)
+  {
+    _reader_close_segment(reader);
+    reader->segment = first;
+    if (!_reader_open_segment(reader))
+    {
+      reader->segment = reader->segment_count;
+      return false;
+    }
+  }
+  reader->offset = reader->header_size;
+
+  /* Every record before the last index entry received before the time was received before it. */
+  uint32_t low = 0;
+  uint32_t high = reader->index_count;
+  while (low < high)
+  {
+    uint32_t middle = low + (high - low) / 2;
+    if (reader->index[middle].received_ns < received_ns)
+    {
+      low = middle + 1;
+    }
+    else
+    {
+      high = middle;
+    }
+  }
+  if (low > 0)
+  {
+    reader->offset = reader->index[low - 1].offset;
+  }
+
+  int rc;
+  while ((rc = mqtt_recorder_reader_next(reader, &record)) == 1)
+  {
+    if (record.received_ns >= received_ns)
+    {
+      reader->offset = reader->record_offset;
+      break;
+    }
+  }
+  return rc >= 0;
+}
+
+int mqtt_recorder_reader_next(mqtt_recorder_reader* reader, mqtt_recorder_record* record)
+{
+  while (reader->segment < reader->segment_count)
+  {
+    if (reader->data == NULL && !_reader_open_segment(reader))
+    {
+      return -1;
+    }
+    if (_reader_next_message(reader, record) == 1)
+    {
+      return 1;
+    }
+    _reader_close_segment(reader);
+    reader->segment++;
+  }
+  return 0;
+}
+
+/* Reads a 2 byte length then that many bytes. */
+static const uint8_t* _read_string(const uint8_t** data, const uint8_t* end, uint16_t* length)
+{
+  if (end - *data < (ptrdiff_t)sizeof(uint16_t))
+  {
+    return NULL;
+  }
+  memcpy(length, *data, sizeof(uint16_t));
+  *data += sizeof(uint16_t);
+  if (end - *data < *length)
+  {
+    return NULL;
+  }
+  const uint8_t* value = *data;
+  *data += *length;
+  return value;
+}
+
+int mqtt_recorder_record_properties(const mqtt_recorder_record* record, mosquitto_property** props)
+{
+  const uint8_t* data = record->properties;
+  const uint8_t* end = data + record->properties_length;
+  int rc = MOSQ_ERR_SUCCESS;
+
+  *props = NULL;
+  while (data < end && rc == MOSQ_ERR_SUCCESS)
+  {
+    int identifier = *data++;
+    uint16_t int16;
+    uint32_t int32;
+    uint16_t name_length;
+    uint16_t value_length;
+    const uint8_t* name;
+    const uint8_t* value;
+    char* name_string;
+    char* value_string;
+
+    switch (_property_type(identifier))
+    {
+      case MQTT_PROP_TYPE_BYTE:
+        rc = data < end ? mosquitto_property_add_byte(props, identifier, *data++)
+                        : MOSQ_ERR_MALFORMED_PACKET;
+        break;
+      case MQTT_PROP_TYPE_INT16:
+        if (end - data < (ptrdiff_t)sizeof(int16))
+        {
+          rc = MOSQ_ERR_MALFORMED_PACKET;
+          break;
+        }
+        memcpy(&int16, data, sizeof(int16));
+        data += sizeof(int16);
+        rc = mosquitto_property_add_int16(props, identifier, int16);
+        break;
+      case MQTT_PROP_TYPE_INT32:
+      case MQTT_PROP_TYPE_VARINT:
+        if (end - data < (ptrdiff_t)sizeof(int32))
+        {
+          rc = MOSQ_ERR_MALFORMED_PACKET;
+          break;
+        }
+        memcpy(&int32, data, sizeof(int32));
+        data += sizeof(int32);
+        rc = _property_type(identifier) == MQTT_PROP_TYPE_INT32
+            ? mosquitto_property_add_int32(props, identifier, int32)
+            : mosquitto_property_add_varint(props, identifier, int32);
+        break;
+      case MQTT_PROP_TYPE_BINARY:
+        rc = (value = _read_string(&data, end, &value_length)) == NULL
+            ? MOSQ_ERR_MALFORMED_PACKET
+            : mosquitto_property_add_binary(props, identifier, value, value_length);
+        break;
+      case MQTT_PROP_TYPE_STRING:
+        if ((value = _read_string(&data, end, &value_length)) == NULL)
+        {
+          rc = MOSQ_ERR_MALFORMED_PACKET;
+        }
+        else if ((value_string = strndup((const char*)value, value_length)) == NULL)
+        {
+          rc = MOSQ_ERR_NOMEM;
+        }
+        else
+        {
+          rc = mosquitto_property_add_string(props, identifier, value_string);
+          free(value_string);
+        }
+        break;
+      case MQTT_PROP_TYPE_STRING_PAIR:
+        if ((name = _read_string(&data, end, &name_length)) == NULL
+            || (value = _read_string(&data, end, &value_length)) == NULL)
+        {
+          rc = MOSQ_ERR_MALFORMED_PACKET;
+          break;
+        }
+        name_string = strndup((const char*)name, name_length);
+        value_string = strndup((const char*)value, value_length);
+        rc = name_string == NULL || value_string == NULL
+            ? MOSQ_ERR_NOMEM
+            : mosquitto_property_add_string_pair(props, identifier, name_string, value_string);
+        free(name_string);
+        free(value_string);
+        break;
+      default:
+        rc = MOSQ_ERR_MALFORMED_PACKET;
+        break;
+    }
+  }
+  if (rc != MOSQ_ERR_SUCCESS)
+  {
+    mosquitto_property_free_all(props);
+  }
+  return rc;
+}
@@ -0,0 +1,185 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef MQTT_RECORDER_H
+#define MQTT_RECORDER_H
+
+#include "mosquitto.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Records received messages for forensics and replay: the time each message was received, its
+ * topic, QoS, retain flag, MQTT 5 properties and payload, as they arrived (before decompression).
+ *
+ * Records are appended to segment files of a directory, 0000000001.rec, 0000000002.rec, ... Each
+ * segment is preallocated and mapped, so appending a record is copying it into memory; a background
+ * thread maps the next segment ahead of time and closes the full ones: it syncs them, writes their
+ * index, trims them to their records and unmaps them. The appending thread only waits when more
+ * than max_pending_segments full segments are still being closed, so the memory mapped is bounded
+ * by (max_pending_segments + 2) * segment_bytes.
+ *
+ * Topics are written once per segment and records refer to them by id. The index of a segment,
+ * 0000000001.idx, holds the receive time of a record every index_interval_bytes and the topics of
+ * the segment, so a reader seeks to a time without going through the segment. A segment without
+ * an index, the last one after a crash, is read from its start instead, up to its last whole
+ * record.
+ *
+ * When mqtt_client_obj.recorder is set, on_message records every message before doing anything
+ * else with it.
+ */
+
+#define MQTT_RECORDER_DEFAULT_SEGMENT_BYTES (64 * 1024 * 1024)
+#define MQTT_RECORDER_DEFAULT_INDEX_INTERVAL_BYTES (64 * 1024)
+#define MQTT_RECORDER_DEFAULT_SYNC_INTERVAL_MS 1000
+#define MQTT_RECORDER_DEFAULT_MAX_PENDING_SEGMENTS 2
+#define MQTT_RECORDER_DEFAULT_MAX_TOPICS 65536
+
+typedef enum mqtt_recorder_sync
+{
+  /* Never syncs, the kernel writes the pages back when it wants. */
+  MQTT_RECORDER_SYNC_NONE,
+  /* Syncs the records of the current segment every sync_interval_ms, and full segments. */
+  MQTT_RECORDER_SYNC_INTERVAL,
+  /* Only syncs full segments, before closing them. */
+  MQTT_RECORDER_SYNC_SEGMENT
+} mqtt_recorder_sync;
+
+typedef struct mqtt_recorder_options
+{
+  /* The size of a segment file, from 4096 bytes to 4 GB. */
+  size_t segment_bytes;
+  /* The bytes of records between two index entries, at least 64. */
+  size_t index_interval_bytes;
+  mqtt_recorder_sync sync;
+  int sync_interval_ms;
+  /* Full segments the background thread may be closing before mqtt_recorder_append() waits. */
+  int max_pending_segments;
+  /* The most topics with an id. When there are more, the ids start again in a new segment. */
+  int max_topics;
+} mqtt_recorder_options;
+
+typedef struct mqtt_recorder mqtt_recorder;
+
+typedef struct mqtt_recorder_stats
+{
+  uint64_t records;
+  /* The bytes appended to the segments, topics and alignment included. */
+  uint64_t bytes;
+  uint64_t segments;
+  /* Messages that were not recorded, too large for a segment or because a segment couldn't be
+   * created. */
+  uint64_t dropped;
+  /* Appends that waited for the background thread to close a segment. */
+  uint64_t full_waits;
+  uint64_t syncs;
+} mqtt_recorder_stats;
+
+/* A recorded message, pointing into the segment the reader maps, valid until the next call. */
+typedef struct mqtt_recorder_record
+{
+  /* CLOCK_REALTIME nanoseconds. */
+  uint64_t received_ns;
+  const char* topic;
+  const void* payload;
+  int payload_length;
+  int qos;
+  bool retain;
+  /* The serialized properties, read with mqtt_recorder_record_properties(). */
+  const void* properties;
+  size_t properties_length;
+} mqtt_recorder_record;
+
+typedef struct mqtt_recorder_reader mqtt_recorder_reader;
+
+/**
+ * @brief The default options: segments of 64 MB indexed every 64 KB, synced every second, 2
+ * segments pending and 65536 topics.
+ */
+mqtt_recorder_options mqtt_recorder_options_default();
+
+/**
+ * @brief Reads the name of a sync policy, "none", "interval" or "segment".
+ *
+ * @return true on success, false if the name is unknown.
+ */
+bool mqtt_recorder_sync_from_name(const char* name, mqtt_recorder_sync* sync);
+
+/**
+ * @brief Creates a recorder appending to the segments of a directory, created if needed. Segments
+ * already in it are kept, and new ones are numbered after them.
+ *
+ * @param directory The directory of the segments.
+ * @param options The options, NULL for mqtt_recorder_options_default().
+ * @return The recorder, or NULL on failure. Free it with mqtt_recorder_destroy().
+ */
+mqtt_recorder* mqtt_recorder_create(const char* directory, const mqtt_recorder_options* options);
+
+/**
+ * @brief Closes the current segment, waits for the background thread to close every segment and
+ * frees the recorder. The client appending to it must be stopped first.
+ */
+void mqtt_recorder_destroy(mqtt_recorder* recorder);
+
+/**
+ * @brief Appends a message and its properties. Must only be called from one thread at a time,
+ * normally the mosquitto network thread through on_message.
+ *
+ * @param recorder The recorder.
+ * @param message The message.
+ * @param props The properties of the message, or NULL.
+ * @param received_ns When the message was received, in CLOCK_REALTIME nanoseconds, or 0 for now.
+ * @return MOSQ_ERR_SUCCESS on success, MOSQ_ERR_PAYLOAD_SIZE if the record is larger than a
+ * segment, MOSQ_ERR_NOMEM or MOSQ_ERR_ERRNO if a segment or a topic couldn't be created.
+ */
+int mqtt_recorder_append(
+    mqtt_recorder* recorder,
+    const struct mosquitto_message* message,
+    const mosquitto_property* props,
+    uint64_t received_ns);
+
+/**
+ * @brief Reads the counters of a recorder. Can be called from any thread.
+ */
+mqtt_recorder_stats mqtt_recorder_get_stats(const mqtt_recorder* recorder);
+
+/**
+ * @brief Opens the segments of a directory for reading, at the first record.
+ *
+ * @return The reader, or NULL on failure. Free it with mqtt_recorder_reader_close().
+ */
+mqtt_recorder_reader* mqtt_recorder_reader_open(const char* directory);
+
+void mqtt_recorder_reader_close(mqtt_recorder_reader* reader);
+
+/**
+ * @brief Moves the reader to the first record received at or after a time, found with the index
+ * of its segment. Receive times are expected to increase, a clock stepping back makes it stop at
+ * the first record after the step that is late enough.
+ *
+ * @return true on success, false if a segment couldn't be read.
+ */
+bool mqtt_recorder_reader_seek(mqtt_recorder_reader* reader, uint64_t received_ns);
+
+/**
+ * @brief Reads the next record.
+ *
+ * @param reader The reader.
+ * @param record Set to the record, which points into the reader until the next call.
+ * @return 1 if a record was read, 0 at the end of the recording, -1 if a segment couldn't be read.
+ */
+int mqtt_recorder_reader_next(mqtt_recorder_reader* reader, mqtt_recorder_record* record);
+
+/**
+ * @brief Rebuilds the properties of a record, ex. to publish it again.
+ *
+ * @param record The record.
+ * @param props Set to the properties, NULL if it has none. Free them with
+ * mosquitto_property_free_all().
+ * @return MOSQ_ERR_SUCCESS on success, MOSQ_ERR_MALFORMED_PACKET if they are invalid,
+ * MOSQ_ERR_NOMEM.
+ */
+int mqtt_recorder_record_properties(const mqtt_recorder_record* record, mosquitto_property** props);
+
+#endif /* MQTT_RECORDER_H */
@@ -9,18 +9,16 @@
 #include "logging.h"
 #include "mosquitto.h"
 #include "mqtt_callbacks.h"
+#include "mqtt_event_loop.h"
 #include "mqtt_setup.h"
-
-// A certificate path (any string) is required when configuring mosquitto to use OS certificates
-// when use_TLS is true and you're not using a ca file.
-#define REQUIRED_TLS_SET_CERT_PATH "L"
+#include "mqtt_tls_context.h"
 
 volatile sig_atomic_t keep_running = 1;
 
 static void sig_handler(int _)
 {
   (void)_;
-  keep_running = 0;
+  mqtt_client_stop();
 }
 
 #define MQTT_RETURN_IF_FAILED(rc)                                        \
@@ -100,7 +98,7 @@ bool set_char_connection_setting(
     return false;
   }
   *connection_setting = env_value;
-  printf("\t%s = %s\n", env_name, *connection_setting);
+  LOG_DETAIL("%s = %s", env_name, *connection_setting);
 
   return true;
 }
@@ -119,7 +117,7 @@ bool set_int_connection_setting(int* connection_setting, char* env_name, int def
   if (env_value == NULL)
   {
     *connection_setting = default_value;
-    printf("\t%s = %d (Default value)\n", env_name, *connection_setting);
+    LOG_DETAIL("%s = %d (Default value)", env_name, *connection_setting);
   }
   else
   {
@@ -132,7 +130,42 @@ bool set_int_connection_setting(int* connection_setting, char* env_name, int def
     else
     {
       *connection_setting = env_int_value;
-      printf("\t%s = %d\n", env_name, *connection_setting);
+      LOG_DETAIL("%s = %d", env_name, *connection_setting);
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Sets a double connection setting from environment variables.
+ * @param connection_setting The connection setting to set.
+ * @param env_name The name of the environment variable to read.
+ * @param default_value The default value to use if the environment variable isn't set.
+ *
+ * @return true if connection setting successfully set, false if environment variable isn't a
+ * number.
+ */
+bool set_double_connection_setting(double* connection_setting, char* env_name, double default_value)
+{
+  char* env_value = getenv(env_name);
+  if (env_value == NULL)
+  {
+    *connection_setting = default_value;
+    LOG_DETAIL("%s = %g (Default value)", env_name, *connection_setting);
+  }
+  else
+  {
+    char* end;
+    double env_double_value = strtod(env_value, &end);
+    if (end == env_value || *end != '\0')
+    {
+      LOG_ERROR("Environment variable %s (value: %s) is not a valid number.", env_name, env_value);
+      return false;
+    }
+    else
+    {
+      *connection_setting = env_double_value;
+      LOG_DETAIL("%s = %g", env_name, *connection_setting);
     }
   }
   return true;
@@ -152,7 +185,7 @@ bool set_bool_connection_setting(bool* connection_setting, char* env_name, bool
   if (env_value == NULL)
   {
     *connection_setting = default_value;
-    printf("\t%s = %s (Default value)\n", env_name, *connection_setting ? "true" : "false");
+    LOG_DETAIL("%s = %s (Default value)", env_name, *connection_setting ? "true" : "false");
     return true;
   }
   else
@@ -170,7 +203,7 @@ bool set_bool_connection_setting(bool* connection_setting, char* env_name, bool
       LOG_ERROR("Environment variable %s (value: %s) is not a valid boolean.", env_name, env_value);
       return false;
     }
-    printf("\t%s = %s\n", env_name, *connection_setting ? "true" : "false");
+    LOG_DETAIL("%s = %s", env_name, *connection_setting ? "true" : "false");
     return true;
   }
 }
@@ -260,9 +293,41 @@ void on_mosquitto_log(struct mosquitto* mosq, void* obj, int level, const char*
 #endif
 }
 
-struct mosquitto* mqtt_client_init(
+/**
+ * @brief Reads the connection settings from the env file and environment variables, installs the
+ * SIGINT handler and initializes the mosquitto library.
+ * @param env_file The env file to read, or NULL to use .env in the current directory.
+ * @param connection_settings The connection settings struct to write to.
+ *
+ * @return true if successful, or false if the settings are invalid or mosquitto failed to
+ * initialize.
+ */
+bool mqtt_client_setup(char* env_file, mqtt_client_connection_settings* connection_settings)
+{
+  signal(SIGINT, sig_handler);
+
+  /* Get environment variables for connection settings */
+  mqtt_client_read_env_file(env_file);
+  if (!mqtt_client_set_connection_settings(connection_settings))
+  {
+    LOG_ERROR("Failed to set connection settings.");
+    return false;
+  }
+
+  /* Required before calling other mosquitto functions */
+  int result = mosquitto_lib_init();
+  if (result != MOSQ_ERR_SUCCESS)
+  {
+    LOG_ERROR("Mosquitto Error: %s", mosquitto_strerror(result));
+    return false;
+  }
+
+  return true;
+}
+
+struct mosquitto* mqtt_client_create(
+    const mqtt_client_connection_settings* connection_settings,
     bool publish,
-    char* env_file,
     void (*on_connect_with_subscribe)(
         struct mosquitto*,
         void*,
@@ -271,34 +336,20 @@ struct mosquitto* mqtt_client_init(
         const mosquitto_property* props),
     mqtt_client_obj* obj)
 {
-  signal(SIGINT, sig_handler);
-
   struct mosquitto* mosq = NULL;
-  mqtt_client_connection_settings connection_settings;
   bool subscribe = on_connect_with_subscribe != NULL;
 
-  /* Get environment variables for connection settings */
-  mqtt_client_read_env_file(env_file);
-  if (!mqtt_client_set_connection_settings(&connection_settings))
-  {
-    LOG_ERROR("Failed to set connection settings.");
-    return NULL;
-  }
-
-  obj->hostname = connection_settings.hostname;
-  obj->keep_alive_in_seconds = connection_settings.keep_alive_in_seconds;
-  obj->tcp_port = connection_settings.tcp_port;
-  obj->client_id = connection_settings.client_id;
-
-  /* Required before calling other mosquitto functions */
-  MQTT_RETURN_IF_FAILED(mosquitto_lib_init());
+  obj->hostname = connection_settings->hostname;
+  obj->keep_alive_in_seconds = connection_settings->keep_alive_in_seconds;
+  obj->tcp_port = connection_settings->tcp_port;
+  obj->client_id = connection_settings->client_id;
 
   /* Create a new client instance.
    * id = NULL -> ask the broker to generate a client id for us
    * clean session = true -> the broker should remove old sessions when we connect
    * obj = NULL -> we aren't passing any of our private data for callbacks
    */
-  mosq = mosquitto_new(connection_settings.client_id, connection_settings.clean_session, obj);
+  mosq = mosquitto_new(connection_settings->client_id, connection_settings->clean_session, obj);
 
   if (mosq == NULL)
   {
@@ -308,11 +359,6 @@ struct mosquitto* mqtt_client_init(
 
   mosquitto_log_callback_set(mosq, on_mosquitto_log);
 
-  printf(
-      "\tMQTT_VERSION = %s\n",
-      obj->mqtt_version == MQTT_PROTOCOL_V5
-          ? "MQTT_PROTOCOL_V5"
-          : obj->mqtt_version == MQTT_PROTOCOL_V311 ? "MQTT_PROTOCOL_V311" : "UNKNOWN");
   MQTT_RETURN_IF_FAILED(mosquitto_int_option(mosq, MOSQ_OPT_PROTOCOL_VERSION, obj->mqtt_version));
 
   /*callbacks */
@@ -329,29 +375,48 @@ struct mosquitto* mqtt_client_init(
     _set_publish_callbacks(mosq);
   }
 
-  int result;
-
-  if (connection_settings.username)
+  if (connection_settings->username)
   {
     MQTT_RETURN_IF_FAILED(mosquitto_username_pw_set(
-        mosq, connection_settings.username, connection_settings.password));
+        mosq, connection_settings->username, connection_settings->password));
   }
 
-  if (connection_settings.use_TLS)
+  if (connection_settings->use_TLS)
   {
-    bool use_OS_certs = connection_settings.ca_file == NULL;
-    if (use_OS_certs)
-    {
-      MQTT_RETURN_IF_FAILED(mosquitto_int_option(mosq, MOSQ_OPT_TLS_USE_OS_CERTS, true));
-    }
-    MQTT_RETURN_IF_FAILED(mosquitto_tls_set(
-        mosq,
-        connection_settings.ca_file,
-        use_OS_certs ? REQUIRED_TLS_SET_CERT_PATH : NULL,
-        connection_settings.cert_file,
-        connection_settings.key_file,
-        NULL));
+    /* All clients share one SSL_CTX, so certificates are loaded once and reconnects resume the
+     * TLS session. mosquitto must use the context as is instead of applying its defaults. */
+    SSL_CTX* ssl_ctx = mqtt_tls_context_get(connection_settings);
+    MQTT_RETURN_IF_FAILED(ssl_ctx != NULL ? MOSQ_ERR_SUCCESS : MOSQ_ERR_TLS);
+    MQTT_RETURN_IF_FAILED(mosquitto_void_option(mosq, MOSQ_OPT_SSL_CTX, ssl_ctx));
+    MQTT_RETURN_IF_FAILED(mosquitto_int_option(mosq, MOSQ_OPT_SSL_CTX_WITH_DEFAULTS, false));
   }
 
   return mosq;
 }
+
+struct mosquitto* mqtt_client_init(
+    bool publish,
+    char* env_file,
+    void (*on_connect_with_subscribe)(
+        struct mosquitto*,
+        void*,
+        int,
+        int,
+        const mosquitto_property* props),
+    mqtt_client_obj* obj)
+{
+  mqtt_client_connection_settings connection_settings;
+
+  if (!mqtt_client_setup(env_file, &connection_settings))
+  {
+    return NULL;
+  }
+
+  LOG_DETAIL(
+      "MQTT_VERSION = %s",
+      obj->mqtt_version == MQTT_PROTOCOL_V5
+          ? "MQTT_PROTOCOL_V5"
+          : obj->mqtt_version == MQTT_PROTOCOL_V311 ? "MQTT_PROTOCOL_V311" : "UNKNOWN");
+
+  return mqtt_client_create(&connection_settings, publish, on_connect_with_subscribe, obj);
+}
@@ -5,6 +5,11 @@
 #define MQTT_SETUP_H
 
 #include "mosquitto.h"
+#include "mqtt_compression.h"
+#include "mqtt_executor.h"
+#include "mqtt_message_ring.h"
+#include "mqtt_recorder.h"
+#include "mqtt_topic_router.h"
 #include <signal.h>
 #include <stdbool.h>
 
@@ -37,6 +42,21 @@ typedef struct mqtt_client_obj
       struct mosquitto*,
       const struct mosquitto_message*,
       const mosquitto_property*);
+  /* When set, on_message dispatches through the router and only calls handle_message for messages
+   * no route matched. */
+  mqtt_topic_router* router;
+  /* When set, on_message copies messages to the executor and the router or handle_message run on
+   * its worker threads. */
+  mqtt_executor* executor;
+  /* When set, on_message pushes messages into the ring for mqtt_client_poll() instead of handling
+   * them. */
+  mqtt_message_ring* message_ring;
+  /* When set, on_message decompresses messages tagged with content-encoding=zstd before handling
+   * them. */
+  mqtt_compression* compression;
+  /* When set, on_message appends every message to the recorder as it was received, before
+   * handling it. */
+  mqtt_recorder* recorder;
   char* client_id;
   char* hostname;
   int keep_alive_in_seconds;
@@ -44,6 +64,26 @@ typedef struct mqtt_client_obj
   int tcp_port;
 } mqtt_client_obj;
 
+bool mqtt_client_setup(char* env_file, mqtt_client_connection_settings* connection_settings);
+
+/**
+ * @brief Creates a mosquitto client from connection settings that were already read with
+ * mqtt_client_setup(). Call this once per connection when several clients share the same settings
+ * (give each a distinct client_id). Fills in the connection fields of obj.
+ *
+ * @return The new client, or NULL on failure.
+ */
+struct mosquitto* mqtt_client_create(
+    const mqtt_client_connection_settings* connection_settings,
+    bool publish,
+    void (*on_connect_with_subscribe)(
+        struct mosquitto*,
+        void*,
+        int,
+        int,
+        const mosquitto_property* props),
+    mqtt_client_obj* mqtt_client_obj);
+
 struct mosquitto* mqtt_client_init(
     bool publish,
     char* env_file,
@@ -62,6 +102,11 @@ bool set_char_connection_setting(
 
 bool set_int_connection_setting(int* connection_setting, char* env_name, int default_value);
 
+bool set_double_connection_setting(
+    double* connection_setting,
+    char* env_name,
+    double default_value);
+
 bool set_bool_connection_setting(bool* connection_setting, char* env_name, bool default_value);
 
 bool mqtt_client_set_connection_settings(mqtt_client_connection_settings* connection_settings);
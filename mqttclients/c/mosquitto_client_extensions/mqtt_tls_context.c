@@ -0,0 +1,302 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logging.h"
+#include "mqtt_setup.h"
+#include "mqtt_tls_context.h"
+
+typedef struct tls_session_entry
+{
+  char* host;
+  SSL_SESSION* session;
+} tls_session_entry;
+
+typedef struct tls_context
+{
+  struct tls_context* next;
+  SSL_CTX* ssl_ctx;
+  char* ca_file;
+  char* cert_file;
+  char* key_file;
+  pthread_mutex_t sessions_mutex;
+  tls_session_entry sessions[MQTT_TLS_SESSION_CACHE_SIZE];
+  size_t next_eviction;
+} tls_context;
+
+static pthread_mutex_t contexts_mutex = PTHREAD_MUTEX_INITIALIZER;
+static tls_context* contexts = NULL;
+static int context_ex_index = -1;
+static unsigned long full_handshakes = 0;
+static unsigned long resumed_handshakes = 0;
+
+static void _log_openssl_error(const char* action, const char* path)
+{
+  char error[256];
+  ERR_error_string_n(ERR_get_error(), error, sizeof(error));
+  LOG_ERROR("Failed to %s %s: %s", action, path != NULL ? path : "", error);
+}
+
+static bool _paths_equal(const char* a, const char* b)
+{
+  return a == b || (a != NULL && b != NULL && strcmp(a, b) == 0);
+}
+
+static char* _copy_path(const char* path) { return path != NULL ? strdup(path) : NULL; }
+
+/* Must be called with sessions_mutex held. */
+static tls_session_entry* _find_session(tls_context* context, const char* host)
+{
+  for (size_t i = 0; i < MQTT_TLS_SESSION_CACHE_SIZE; i++)
+  {
+    if (context->sessions[i].host != NULL && strcmp(context->sessions[i].host, host) == 0)
+    {
+      return &context->sessions[i];
+    }
+  }
+  return NULL;
+}
+
+static void _free_session(tls_session_entry* entry)
+{
+  free(entry->host);
+  entry->host = NULL;
+  if (entry->session != NULL)
+  {
+    SSL_SESSION_free(entry->session);
+    entry->session = NULL;
+  }
+}
+
+static int _on_new_session(SSL* ssl, SSL_SESSION* session)
+{
+  tls_context* context = SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), context_ex_index);
+  const char* host = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+  int kept = 0;
+
+  if (context == NULL || host == NULL)
+  {
+    return 0;
+  }
+
+  pthread_mutex_lock(&context->sessions_mutex);
+  tls_session_entry* entry = _find_session(context, host);
+  if (entry == NULL)
+  {
+    entry = &context->sessions[context->next_eviction++ % MQTT_TLS_SESSION_CACHE_SIZE];
+    _free_session(entry);
+    entry->host = strdup(host);
+  }
+  if (entry->host != NULL)
+  {
+    if (entry->session != NULL)
+    {
+      SSL_SESSION_free(entry->session);
+    }
+    /* Returning 1 keeps the reference OpenSSL handed us. */
+    entry->session = session;
+    kept = 1;
+  }
+  pthread_mutex_unlock(&context->sessions_mutex);
+
+  return kept;
+}
+
+static void _on_info(const SSL* ssl, int where, int ret)
+{
+  /* mosquitto creates the SSL object and sets SNI right before starting the handshake, so this is
+   * the first place we get to see the connection. Renegotiations already have a session. */
+  if ((where & SSL_CB_HANDSHAKE_START) && SSL_get_session(ssl) == NULL)
+  {
+    SSL* connection = (SSL*)ssl;
+    tls_context* context = SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), context_ex_index);
+    const char* host = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+
+    if (context == NULL || host == NULL)
+    {
+      return;
+    }
+
+    /* mosquitto only checks the broker's hostname on contexts it configured itself. */
+    if (SSL_set1_host(connection, host) != 1)
+    {
+      LOG_ERROR("Failed to set the expected TLS hostname %s", host);
+    }
+
+    pthread_mutex_lock(&context->sessions_mutex);
+    tls_session_entry* entry = _find_session(context, host);
+    if (entry != NULL && entry->session != NULL)
+    {
+      SSL_set_session(connection, entry->session);
+    }
+    pthread_mutex_unlock(&context->sessions_mutex);
+  }
+  else if (where & SSL_CB_HANDSHAKE_DONE)
+  {
+    __atomic_fetch_add(
+        SSL_session_reused((SSL*)ssl) ? &resumed_handshakes : &full_handshakes,
+        1,
+        __ATOMIC_RELAXED);
+  }
+}
+
+static SSL_CTX* _create_ssl_ctx(const mqtt_client_connection_settings* connection_settings)
+{
+  SSL_CTX* ssl_ctx = SSL_CTX_new(TLS_client_method());
+  if (ssl_ctx == NULL)
+  {
+    _log_openssl_error("create", "the TLS context");
+    return NULL;
+  }
+
+  SSL_CTX_set_min_proto_version(ssl_ctx, TLS1_2_VERSION);
+  SSL_CTX_set_verify(ssl_ctx, SSL_VERIFY_PEER, NULL);
+
+  if (connection_settings->ca_file != NULL)
+  {
+    if (SSL_CTX_load_verify_locations(ssl_ctx, connection_settings->ca_file, NULL) != 1)
+    {
+      _log_openssl_error("load the CA file", connection_settings->ca_file);
+      SSL_CTX_free(ssl_ctx);
+      return NULL;
+    }
+  }
+  else if (SSL_CTX_set_default_verify_paths(ssl_ctx) != 1)
+  {
+    _log_openssl_error("load", "the OS certificates");
+    SSL_CTX_free(ssl_ctx);
+    return NULL;
+  }
+
+  if (connection_settings->cert_file != NULL
+      && SSL_CTX_use_certificate_chain_file(ssl_ctx, connection_settings->cert_file) != 1)
+  {
+    _log_openssl_error("load the certificate file", connection_settings->cert_file);
+    SSL_CTX_free(ssl_ctx);
+    return NULL;
+  }
+
+  if (connection_settings->key_file != NULL)
+  {
+    SSL_CTX_set_default_passwd_cb_userdata(ssl_ctx, connection_settings->key_file_password);
+    if (SSL_CTX_use_PrivateKey_file(ssl_ctx, connection_settings->key_file, SSL_FILETYPE_PEM) != 1
+        || SSL_CTX_check_private_key(ssl_ctx) != 1)
+    {
+      _log_openssl_error("load the key file", connection_settings->key_file);
+      SSL_CTX_free(ssl_ctx);
+      return NULL;
+    }
+  }
+
+  /* OpenSSL's internal cache is keyed by session id, which clients don't know before connecting.
+   * Sessions are cached by host in _on_new_session instead. */
+  SSL_CTX_set_session_cache_mode(ssl_ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+  SSL_CTX_sess_set_new_cb(ssl_ctx, _on_new_session);
+  SSL_CTX_set_info_callback(ssl_ctx, _on_info);
+
+  return ssl_ctx;
+}
+
+SSL_CTX* mqtt_tls_context_get(const mqtt_client_connection_settings* connection_settings)
+{
+  SSL_CTX* ssl_ctx = NULL;
+  tls_context* context;
+
+  pthread_mutex_lock(&contexts_mutex);
+
+  for (context = contexts; context != NULL; context = context->next)
+  {
+    if (_paths_equal(context->ca_file, connection_settings->ca_file)
+        && _paths_equal(context->cert_file, connection_settings->cert_file)
+        && _paths_equal(context->key_file, connection_settings->key_file))
+    {
+      ssl_ctx = context->ssl_ctx;
+      break;
+    }
+  }
+
+  if (ssl_ctx == NULL)
+  {
+    if (context_ex_index < 0)
+    {
+      context_ex_index = SSL_CTX_get_ex_new_index(0, NULL, NULL, NULL, NULL);
+    }
+
+    if ((context = calloc(1, sizeof(tls_context))) == NULL)
+    {
+      LOG_ERROR("Out of memory.");
+    }
+    else if ((context->ssl_ctx = _create_ssl_ctx(connection_settings)) == NULL)
+    {
+      free(context);
+    }
+    else
+    {
+      context->ca_file = _copy_path(connection_settings->ca_file);
+      context->cert_file = _copy_path(connection_settings->cert_file);
+      context->key_file = _copy_path(connection_settings->key_file);
+      pthread_mutex_init(&context->sessions_mutex, NULL);
+      SSL_CTX_set_ex_data(context->ssl_ctx, context_ex_index, context);
+
+      context->next = contexts;
+      contexts = context;
+      ssl_ctx = context->ssl_ctx;
+    }
+  }
+
+  pthread_mutex_unlock(&contexts_mutex);
+  return ssl_ctx;
+}
+
+void mqtt_tls_context_clear_sessions()
+{
+  pthread_mutex_lock(&contexts_mutex);
+  for (tls_context* context = contexts; context != NULL; context = context->next)
+  {
+    pthread_mutex_lock(&context->sessions_mutex);
+    for (size_t i = 0; i < MQTT_TLS_SESSION_CACHE_SIZE; i++)
+    {
+      _free_session(&context->sessions[i]);
+    }
+    pthread_mutex_unlock(&context->sessions_mutex);
+  }
+  pthread_mutex_unlock(&contexts_mutex);
+}
+
+mqtt_tls_context_stats mqtt_tls_context_get_stats()
+{
+  mqtt_tls_context_stats stats;
+  stats.full_handshakes = __atomic_load_n(&full_handshakes, __ATOMIC_RELAXED);
+  stats.resumed_handshakes = __atomic_load_n(&resumed_handshakes, __ATOMIC_RELAXED);
+  return stats;
+}
+
+void mqtt_tls_context_cleanup()
+{
+  pthread_mutex_lock(&contexts_mutex);
+  while (contexts != NULL)
+  {
+    tls_context* context = contexts;
+    contexts = context->next;
+
+    /* Clients still holding the SSL_CTX must not reach the freed cache from the callbacks. */
+    SSL_CTX_set_ex_data(context->ssl_ctx, context_ex_index, NULL);
+    SSL_CTX_free(context->ssl_ctx);
+    for (size_t i = 0; i < MQTT_TLS_SESSION_CACHE_SIZE; i++)
+    {
+      _free_session(&context->sessions[i]);
+    }
+    pthread_mutex_destroy(&context->sessions_mutex);
+    free(context->ca_file);
+    free(context->cert_file);
+    free(context->key_file);
+    free(context);
+  }
+  pthread_mutex_unlock(&contexts_mutex);
+}
@@ -0,0 +1,53 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef MQTT_TLS_CONTEXT_H
+#define MQTT_TLS_CONTEXT_H
+
+#include "mqtt_setup.h"
+#include <openssl/ssl.h>
+#include <stdbool.h>
+
+/* Number of hosts whose TLS sessions are remembered per context. */
+#define MQTT_TLS_SESSION_CACHE_SIZE 16
+
+typedef struct mqtt_tls_context_stats
+{
+  unsigned long full_handshakes;
+  unsigned long resumed_handshakes;
+} mqtt_tls_context_stats;
+
+/**
+ * @brief Returns the process-wide SSL_CTX for the TLS settings (ca_file, cert_file, key_file),
+ * creating it on first use. The CA bundle (or the OS certificate store when ca_file isn't set) and
+ * the client certificate are loaded once, no matter how many clients use the context. Sessions are
+ * cached per host, so reconnects and new connections to the same broker resume the TLS session
+ * instead of doing a full handshake.
+ *
+ * mqtt_client_create() hands the context to mosquitto with MOSQ_OPT_SSL_CTX. mosquitto takes its
+ * own reference, so the context outlives mqtt_tls_context_cleanup() as long as a client uses it.
+ * Must be called after mosquitto_lib_init().
+ *
+ * @param connection_settings The TLS settings.
+ * @return The shared context, or NULL on failure.
+ */
+SSL_CTX* mqtt_tls_context_get(const mqtt_client_connection_settings* connection_settings);
+
+/**
+ * @brief Forgets the cached sessions of every context, so the next connection to each host does a
+ * full handshake.
+ */
+void mqtt_tls_context_clear_sessions();
+
+/**
+ * @brief Returns the number of full and resumed handshakes done with the shared contexts.
+ */
+mqtt_tls_context_stats mqtt_tls_context_get_stats();
+
+/**
+ * @brief Releases the shared contexts and their cached sessions. Clients that still use a context
+ * keep it alive until they are destroyed, but must not be connecting while this runs.
+ */
+void mqtt_tls_context_cleanup();
+
+#endif /* MQTT_TLS_CONTEXT_H */
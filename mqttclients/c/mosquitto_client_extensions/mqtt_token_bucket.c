@@ -0,0 +1,35 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <time.h>
+
+#include "mqtt_token_bucket.h"
+
+mqtt_token_bucket mqtt_token_bucket_init(double rate_per_second, double burst, uint64_t now_ns)
+{
+  burst = burst < 1 ? 1 : burst;
+  return (mqtt_token_bucket){
+    .rate_per_second = rate_per_second, .burst = burst, .tokens = 1, .last_ns = now_ns
+  };
+}
+
+int mqtt_token_bucket_take(mqtt_token_bucket* bucket, uint64_t now_ns, int max)
+{
+  if (now_ns > bucket->last_ns)
+  {
+    bucket->tokens += (now_ns - bucket->last_ns) * bucket->rate_per_second / 1e9;
+    bucket->tokens = bucket->tokens > bucket->burst ? bucket->burst : bucket->tokens;
+    bucket->last_ns = now_ns;
+  }
+
+  int taken = bucket->tokens < max ? (int)bucket->tokens : max;
+  bucket->tokens -= taken;
+  return taken < 0 ? 0 : taken;
+}
+
+uint64_t mqtt_token_bucket_now_ns()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
@@ -0,0 +1,53 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef MQTT_TOKEN_BUCKET_H
+#define MQTT_TOKEN_BUCKET_H
+
+#include <stdint.h>
+
+/*
+ * Paces work to an average rate. Tokens accrue continuously at rate_per_second, up to burst, and
+ * each unit of work takes one. Checking the bucket from a periodic timer (ex. a 1 ms
+ * mqtt_event_loop timer) and doing as much work as it allows keeps the average rate exact whatever
+ * the timer period, from one message every few seconds to hundreds of thousands per second, while
+ * burst bounds how much is caught up after the timer ran late.
+ *
+ * A bucket is a plain value and is not thread safe.
+ */
+
+typedef struct mqtt_token_bucket
+{
+  double rate_per_second;
+  double burst;
+  double tokens;
+  uint64_t last_ns;
+} mqtt_token_bucket;
+
+/**
+ * @brief Initializes a bucket holding one token, so the first unit of work can start right away.
+ *
+ * @param rate_per_second The average rate, greater than 0
+ * @param burst The most tokens the bucket holds, at least 1
+ * @param now_ns The current time, from mqtt_token_bucket_now_ns()
+ * @return mqtt_token_bucket The bucket
+ */
+mqtt_token_bucket mqtt_token_bucket_init(double rate_per_second, double burst, uint64_t now_ns);
+
+/**
+ * @brief Adds the tokens accrued since the last call and takes as many whole tokens as are there,
+ * at most max.
+ *
+ * @param bucket The bucket
+ * @param now_ns The current time, from mqtt_token_bucket_now_ns()
+ * @param max The most tokens to take
+ * @return int The number of tokens taken, the units of work to do now
+ */
+int mqtt_token_bucket_take(mqtt_token_bucket* bucket, uint64_t now_ns, int max);
+
+/**
+ * @brief Returns the current CLOCK_MONOTONIC time in nanoseconds.
+ */
+uint64_t mqtt_token_bucket_now_ns();
+
+#endif /* MQTT_TOKEN_BUCKET_H */
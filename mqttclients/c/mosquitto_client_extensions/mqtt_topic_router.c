@@ -0,0 +1,391 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logging.h"
+#include "mosquitto.h"
+#include "mqtt_hash.h"
+#include "mqtt_protocol.h"
+#include "mqtt_topic_router.h"
+
+#define INITIAL_CHILD_CAPACITY 4
+#define INITIAL_ROUTE_CAPACITY 16
+
+/* One topic level of the registered filters. Children are kept in an open addressing hash table
+ * keyed by level, the + and # wildcards get their own slots. */
+typedef struct router_node
+{
+  char* level;
+  size_t level_length;
+  uint32_t hash;
+  struct router_node** children;
+  size_t child_count;
+  size_t child_capacity;
+  struct router_node* plus_child;
+  struct router_node* hash_child;
+  mqtt_message_handler handler;
+  void* context;
+  int id;
+} router_node;
+
+struct mqtt_topic_router
+{
+  router_node root;
+  /* Nodes by subscription identifier, index 0 is unused. */
+  router_node** routes;
+  int route_count;
+  int route_capacity;
+};
+
+typedef struct dispatch_args
+{
+  struct mosquitto* mosq;
+  const struct mosquitto_message* message;
+  const mosquitto_property* props;
+} dispatch_args;
+
+/* Returns the '/' that ends the level, or the end of the string for the last level. */
+static const char* _level_end(const char* level)
+{
+  const char* end = strchr(level, '/');
+  return end != NULL ? end : level + strlen(level);
+}
+
+static router_node* _find_child(const router_node* node, const char* level, size_t length)
+{
+  if (node->child_capacity == 0)
+  {
+    return NULL;
+  }
+
+  uint32_t hash = mqtt_hash_bytes(level, length);
+  size_t mask = node->child_capacity - 1;
+  for (size_t i = hash & mask; node->children[i] != NULL; i = (i + 1) & mask)
+  {
+    router_node* child = node->children[i];
+    if (child->hash == hash && child->level_length == length
+        && memcmp(child->level, level, length) == 0)
+    {
+      return child;
+    }
+  }
+  return NULL;
+}
+
+static bool _insert_child(router_node* node, router_node* child)
+{
+  /* Keep the table at most 3/4 full so probes stay short. */
+  if ((node->child_count + 1) * 4 > node->child_capacity * 3)
+  {
+    size_t capacity = node->child_capacity == 0 ? INITIAL_CHILD_CAPACITY : node->child_capacity * 2;
+    router_node** children = calloc(capacity, sizeof(router_node*));
+    if (children == NULL)
+    {
+      return false;
+    }
+    for (size_t i = 0; i < node->child_capacity; i++)
+    {
+      if (node->children[i] != NULL)
+      {
+        size_t j = node->children[i]->hash & (capacity - 1);
+        while (children[j] != NULL)
+        {
+          j = (j + 1) & (capacity - 1);
+        }
+        children[j] = node->children[i];
+      }
+    }
+    free(node->children);
+    node->children = children;
+    node->child_capacity = capacity;
+  }
+
+  size_t mask = node->child_capacity - 1;
+  size_t i = child->hash & mask;
+  while (node->children[i] != NULL)
+  {
+    i = (i + 1) & mask;
+  }
+  node->children[i] = child;
+  node->child_count++;
+  return true;
+}
+
+static router_node* _new_node(const char* level, size_t length)
+{
+  router_node* node = calloc(1, sizeof(router_node));
+  if (node == NULL || (node->level = malloc(length + 1)) == NULL)
+  {
+    free(node);
+    return NULL;
+  }
+  memcpy(node->level, level, length);
+  node->level[length] = '\0';
+  node->level_length = length;
+  node->hash = mqtt_hash_bytes(level, length);
+  return node;
+}
+
+static void _free_children(router_node* node)
+{
+  for (size_t i = 0; i < node->child_capacity; i++)
+  {
+    if (node->children[i] != NULL)
+    {
+      _free_children(node->children[i]);
+      free(node->children[i]);
+    }
+  }
+  free(node->children);
+
+  router_node* wildcards[] = { node->plus_child, node->hash_child };
+  for (size_t i = 0; i < sizeof(wildcards) / sizeof(wildcards[0]); i++)
+  {
+    if (wildcards[i] != NULL)
+    {
+      _free_children(wildcards[i]);
+      free(wildcards[i]);
+    }
+  }
+  free(node->level);
+}
+
+/* Returns the node for the filter, creating the missing levels if create is set. */
+static router_node* _find_filter(mqtt_topic_router* router, const char* filter, bool create)
+{
+  router_node* node = &router->root;
+  const char* level = filter;
+
+  while (true)
+  {
+    const char* end = _level_end(level);
+    size_t length = end - level;
+    bool plus = length == 1 && level[0] == '+';
+    bool hash = length == 1 && level[0] == '#';
+
+    /* Wildcards must fill a whole level, and # must be the last level. */
+    if ((!plus && !hash && (memchr(level, '+', length) || memchr(level, '#', length)))
+        || (hash && *end != '\0'))
+    {
+      return NULL;
+    }
+
+    router_node** wildcard = plus ? &node->plus_child : hash ? &node->hash_child : NULL;
+    router_node* child = wildcard != NULL ? *wildcard : _find_child(node, level, length);
+    if (child == NULL && create)
+    {
+      if ((child = _new_node(level, length)) == NULL)
+      {
+        return NULL;
+      }
+      if (wildcard != NULL)
+      {
+        *wildcard = child;
+      }
+      else if (!_insert_child(node, child))
+      {
+        free(child->level);
+        free(child);
+        return NULL;
+      }
+    }
+    if (child == NULL || *end == '\0')
+    {
+      return child;
+    }
+
+    node = child;
+    level = end + 1;
+  }
+}
+
+static int _call(const router_node* node, const dispatch_args* args)
+{
+  if (node == NULL || node->handler == NULL)
+  {
+    return 0;
+  }
+  node->handler(args->mosq, args->message, args->props, node->context);
+  return 1;
+}
+
+static int _dispatch_node(
+    const router_node* node,
+    const char* level,
+    bool first_level,
+    const dispatch_args* args)
+{
+  /* Wildcards at the first level don't match topics starting with $, ex. $SYS. */
+  bool wildcards = !(first_level && level[0] == '$');
+  const char* end = _level_end(level);
+  const char* next = *end == '/' ? end + 1 : NULL;
+  int called = 0;
+
+  if (wildcards)
+  {
+    called += _call(node->hash_child, args);
+  }
+
+  const router_node* children[]
+      = { _find_child(node, level, end - level), wildcards ? node->plus_child : NULL };
+  for (size_t i = 0; i < sizeof(children) / sizeof(children[0]); i++)
+  {
+    if (children[i] == NULL)
+    {
+      continue;
+    }
+    if (next != NULL)
+    {
+      called += _dispatch_node(children[i], next, false, args);
+    }
+    else
+    {
+      /* "a/#" also matches "a". */
+      called += _call(children[i], args) + _call(children[i]->hash_child, args);
+    }
+  }
+
+  return called;
+}
+
+mqtt_topic_router* mqtt_topic_router_create()
+{
+  mqtt_topic_router* router = calloc(1, sizeof(mqtt_topic_router));
+  if (router == NULL)
+  {
+    LOG_ERROR("Out of memory.");
+    return NULL;
+  }
+  router->route_count = 1;
+  return router;
+}
+
+void mqtt_topic_router_destroy(mqtt_topic_router* router)
+{
+  if (router != NULL)
+  {
+    _free_children(&router->root);
+    free(router->routes);
+    free(router);
+  }
+}
+
+int mqtt_topic_router_add(
+    mqtt_topic_router* router,
+    const char* filter,
+    mqtt_message_handler handler,
+    void* context)
+{
+  router_node* node;
+
+  if (filter == NULL || filter[0] == '\0' || (node = _find_filter(router, filter, true)) == NULL)
+  {
+    LOG_ERROR("Failed to add a route for topic filter %s", filter != NULL ? filter : "(null)");
+    return -1;
+  }
+
+  if (node->id == 0)
+  {
+    if (router->route_count > MQTT_TOPIC_ROUTER_MAX_SUBSCRIPTION_ID)
+    {
+      LOG_ERROR("Out of subscription identifiers for topic filter %s", filter);
+      return -1;
+    }
+    if (router->route_count >= router->route_capacity)
+    {
+      int capacity
+          = router->route_capacity == 0 ? INITIAL_ROUTE_CAPACITY : router->route_capacity * 2;
+      router_node** routes = realloc(router->routes, capacity * sizeof(router_node*));
+      if (routes == NULL)
+      {
+        LOG_ERROR("Out of memory.");
+        return -1;
+      }
+      router->routes = routes;
+      router->route_capacity = capacity;
+    }
+    node->id = router->route_count++;
+    router->routes[node->id] = node;
+  }
+
+  node->handler = handler;
+  node->context = context;
+  return node->id;
+}
+
+bool mqtt_topic_router_remove(mqtt_topic_router* router, const char* filter)
+{
+  /* The node is kept, so registering the filter again reuses its subscription identifier. */
+  router_node* node = _find_filter(router, filter, false);
+  if (node == NULL || node->handler == NULL)
+  {
+    return false;
+  }
+  node->handler = NULL;
+  node->context = NULL;
+  return true;
+}
+
+int mqtt_topic_router_subscribe(
+    mqtt_topic_router* router,
+    struct mosquitto* mosq,
+    int mqtt_version,
+    int* mid,
+    const char* filter,
+    int qos,
+    mqtt_message_handler handler,
+    void* context)
+{
+  mosquitto_property* props = NULL;
+  int id = mqtt_topic_router_add(router, filter, handler, context);
+  int rc;
+
+  if (id < 0)
+  {
+    return MOSQ_ERR_INVAL;
+  }
+  if (mqtt_version == MQTT_PROTOCOL_V5
+      && (rc = mosquitto_property_add_varint(&props, MQTT_PROP_SUBSCRIPTION_IDENTIFIER, id))
+          != MOSQ_ERR_SUCCESS)
+  {
+    return rc;
+  }
+
+  rc = mosquitto_subscribe_v5(mosq, mid, filter, qos, 0, props);
+  mosquitto_property_free_all(&props);
+  return rc;
+}
+
+int mqtt_topic_router_dispatch(
+    const mqtt_topic_router* router,
+    struct mosquitto* mosq,
+    const struct mosquitto_message* message,
+    const mosquitto_property* props)
+{
+  dispatch_args args = { mosq, message, props };
+  bool identified = false;
+  int called = 0;
+  uint32_t id;
+
+  /* The broker tags messages with the identifiers of every subscription they matched. */
+  for (const mosquitto_property* prop
+       = mosquitto_property_read_varint(props, MQTT_PROP_SUBSCRIPTION_IDENTIFIER, &id, false);
+       prop != NULL;
+       prop = mosquitto_property_read_varint(prop, MQTT_PROP_SUBSCRIPTION_IDENTIFIER, &id, true))
+  {
+    if (id > 0 && id < (uint32_t)router->route_count)
+    {
+      identified = true;
+      called += _call(router->routes[id], &args);
+    }
+  }
+
+  if (!identified && message->topic != NULL)
+  {
+    called = _dispatch_node(&router->root, message->topic, true, &args);
+  }
+  return called;
+}
@@ -0,0 +1,88 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef MQTT_TOPIC_ROUTER_H
+#define MQTT_TOPIC_ROUTER_H
+
+#include "mosquitto.h"
+#include <stdbool.h>
+
+/* Largest subscription identifier allowed by MQTT 5. */
+#define MQTT_TOPIC_ROUTER_MAX_SUBSCRIPTION_ID 268435455
+
+typedef void (*mqtt_message_handler)(
+    struct mosquitto* mosq,
+    const struct mosquitto_message* message,
+    const mosquitto_property* props,
+    void* context);
+
+typedef struct mqtt_topic_router mqtt_topic_router;
+
+/**
+ * @brief Creates a router that sends each received message to the handlers registered for the
+ * topic filters it matches. Filters are stored in a trie with one level per topic level, so
+ * dispatching costs O(topic levels) no matter how many filters are registered. Set it as the
+ * router of a mqtt_client_obj to have on_message dispatch through it.
+ *
+ * @return The router, or NULL if out of memory. Free it with mqtt_topic_router_destroy().
+ */
+mqtt_topic_router* mqtt_topic_router_create();
+
+void mqtt_topic_router_destroy(mqtt_topic_router* router);
+
+/**
+ * @brief Registers a handler for a topic filter, which may contain the MQTT + and # wildcards.
+ * Registering a filter again replaces its handler and keeps its subscription identifier.
+ *
+ * @param router The router.
+ * @param filter The topic filter, ex. "vehicles/+/position".
+ * @param handler Called with the message and context for every message matching the filter.
+ * @param context Passed to the handler.
+ * @return The subscription identifier of the filter (1 or more), or -1 if the filter is invalid or
+ * out of memory.
+ */
+int mqtt_topic_router_add(
+    mqtt_topic_router* router,
+    const char* filter,
+    mqtt_message_handler handler,
+    void* context);
+
+/**
+ * @brief Removes the handler of a topic filter.
+ *
+ * @return true if the filter was registered, false otherwise.
+ */
+bool mqtt_topic_router_remove(mqtt_topic_router* router, const char* filter);
+
+/**
+ * @brief Registers a handler for a topic filter and subscribes to it. MQTT 5 clients send the
+ * filter's subscription identifier with the SUBSCRIBE, so the broker tags matching messages with it
+ * and dispatching them doesn't need to match the topic at all.
+ *
+ * @param mqtt_version The protocol version of the client, MQTT_PROTOCOL_V5 enables identifiers.
+ * @return enum mosq_err_t from mosquitto_subscribe_v5(), MOSQ_ERR_INVAL for invalid filters.
+ */
+int mqtt_topic_router_subscribe(
+    mqtt_topic_router* router,
+    struct mosquitto* mosq,
+    int mqtt_version,
+    int* mid,
+    const char* filter,
+    int qos,
+    mqtt_message_handler handler,
+    void* context);
+
+/**
+ * @brief Calls the handlers for a message. When the message carries subscription identifiers
+ * assigned by this router, only those handlers are called; otherwise every filter matching the
+ * topic is. Topics starting with $ don't match filters starting with a wildcard.
+ *
+ * @return The number of handlers called.
+ */
+int mqtt_topic_router_dispatch(
+    const mqtt_topic_router* router,
+    struct mosquitto* mosq,
+    const struct mosquitto_message* message,
+    const mosquitto_property* props);
+
+#endif /* MQTT_TOPIC_ROUTER_H */
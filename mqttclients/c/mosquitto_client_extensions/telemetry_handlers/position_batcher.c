@@ -0,0 +1,180 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <stdlib.h>
+
+#include "logging.h"
+#include "position_batcher.h"
+
+/* The text around the positions of a JSON batch. Each position adds its own length and a comma,
+ * which the first one doesn't need. */
+#define JSON_BATCH_EMPTY_LENGTH (sizeof("{\"type\":\"MultiPoint\",\"coordinates\":[]}") - 1 - 1)
+
+struct position_batcher
+{
+  position_encoding encoding;
+  position_batch_policy policy;
+  mqtt_event_loop* loop;
+  /* Armed by the first position of a batch when the policy has a max_latency_ms. */
+  mqtt_event_timer* timer;
+  position_batch_publish publish;
+  void* context;
+  geojson_geometry positions;
+  /* The payload length of the batch if it was written now. It assumes a MultiPoint, so it is a few
+   * bytes too large for a JSON batch of one position, which is written as a Point. */
+  size_t length;
+  size_t empty_length;
+  mosquitto_payload payload;
+};
+
+position_batcher* position_batcher_create(
+    position_encoding encoding,
+    position_batch_policy policy,
+    mqtt_event_loop* loop,
+    position_batch_publish publish,
+    void* context)
+{
+  if ((encoding != POSITION_ENCODING_JSON && encoding != POSITION_ENCODING_BINARY)
+      || policy.max_count < 1 || publish == NULL || (policy.max_latency_ms > 0 && loop == NULL))
+  {
+    LOG_ERROR("Failure creating position batcher: invalid encoding, policy or callback");
+    return NULL;
+  }
+
+  position_batcher* batcher = calloc(1, sizeof(position_batcher));
+  if (batcher == NULL)
+  {
+    LOG_ERROR("Failure allocating position batcher");
+    return NULL;
+  }
+  batcher->encoding = encoding;
+  batcher->policy = policy;
+  batcher->loop = loop;
+  batcher->publish = publish;
+  batcher->context = context;
+  batcher->empty_length = encoding == POSITION_ENCODING_JSON ? JSON_BATCH_EMPTY_LENGTH : 0;
+  batcher->length = batcher->empty_length;
+  batcher->positions = geojson_geometry_init();
+
+  /* A batch never holds more than max_count positions, so adding them doesn't allocate. */
+  if (!geojson_geometry_reset(&batcher->positions, GEOJSON_MULTI_POINT, policy.max_count, 0))
+  {
+    position_batcher_destroy(batcher);
+    return NULL;
+  }
+  return batcher;
+}
+
+void position_batcher_destroy(position_batcher* batcher)
+{
+  if (batcher == NULL)
+  {
+    return;
+  }
+  if (batcher->timer != NULL)
+  {
+    mqtt_event_loop_remove_timer(batcher->loop, batcher->timer);
+  }
+  geojson_geometry_destroy(&batcher->positions);
+  mosquitto_payload_destroy(&batcher->payload);
+  free(batcher);
+}
+
+static void _on_max_latency(void* context) { position_batcher_flush((position_batcher*)context); }
+
+/* Grows the payload to hold the current batch and its terminator. It doubles so that JSON batches,
+ * whose length varies a little with the coordinates, stop allocating after the first few. */
+static bool _reserve_payload(position_batcher* batcher)
+{
+  if (batcher->payload.max_payload_length > batcher->length)
+  {
+    return true;
+  }
+
+  size_t length = batcher->payload.max_payload_length * 2;
+  if (length < batcher->length + 1)
+  {
+    length = batcher->length + 1;
+  }
+  mosquitto_payload payload = mosquitto_payload_init((int)length);
+  if (payload.payload == NULL)
+  {
+    LOG_ERROR("Failure allocating a payload of %zu bytes for a batch", length);
+    return false;
+  }
+  mosquitto_payload_destroy(&batcher->payload);
+  batcher->payload = payload;
+  return true;
+}
+
+int position_batcher_flush(position_batcher* batcher)
+{
+  int result = 0;
+
+  if (batcher->timer != NULL)
+  {
+    mqtt_event_loop_remove_timer(batcher->loop, batcher->timer);
+    batcher->timer = NULL;
+  }
+  if (batcher->positions.count == 0)
+  {
+    return 0;
+  }
+
+  if (!_reserve_payload(batcher)
+      || positions_to_mosquitto_payload(
+             batcher->encoding, &batcher->positions, &batcher->payload)
+          != 0
+      || batcher->publish(&batcher->payload, batcher->positions.count, batcher->context) != 0)
+  {
+    result = -1;
+  }
+
+  batcher->positions.count = 0;
+  batcher->length = batcher->empty_length;
+  return result;
+}
+
+int position_batcher_add(position_batcher* batcher, geojson_coordinates coordinates)
+{
+  int result = 0;
+  int length = batcher->encoding == POSITION_ENCODING_JSON
+      ? geojson_position_length(coordinates.x, coordinates.y) + 1
+      : POSITION_BINARY_PAYLOAD_LENGTH;
+
+  if (length <= 0)
+  {
+    LOG_ERROR("Failure batching position: coordinates are too large");
+    return -1;
+  }
+
+  /* A position larger than max_bytes on its own is still published, alone. */
+  if (batcher->positions.count > 0 && batcher->policy.max_bytes > 0
+      && batcher->length + length > batcher->policy.max_bytes)
+  {
+    result = position_batcher_flush(batcher);
+  }
+
+  geojson_geometry_add_position(&batcher->positions, coordinates.x, coordinates.y);
+  batcher->length += length;
+
+  if (batcher->positions.count >= batcher->policy.max_count)
+  {
+    if (position_batcher_flush(batcher) != 0)
+    {
+      result = -1;
+    }
+  }
+  else if (
+      batcher->positions.count == 1 && batcher->policy.max_latency_ms > 0
+      && (batcher->timer = mqtt_event_loop_add_timer(
+              batcher->loop, batcher->policy.max_latency_ms, 0, _on_max_latency, batcher))
+          == NULL)
+  {
+    LOG_ERROR("Failure creating the batch latency timer");
+    result = -1;
+  }
+  return result;
+}
+
+int position_batcher_count(const position_batcher* batcher) { return batcher->positions.count; }
@@ -0,0 +1,102 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef POSITION_BATCHER_H
+#define POSITION_BATCHER_H
+
+#include "geo_json_handler.h"
+#include "mosquitto.h"
+#include "mqtt_event_loop.h"
+#include "position_codec.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Accumulates positions and publishes them as one message, written with
+ * positions_to_mosquitto_payload(), so the PUBLISH header, the PUBACK and the send syscall are
+ * shared by the whole batch. A batch is flushed when it holds max_count positions, when the next
+ * position would make its payload larger than max_bytes, or max_latency_ms after its first
+ * position was added. A batch of one position is written exactly like an unbatched position.
+ *
+ * A batcher is not thread safe: add and flush on the event loop thread it was created with.
+ */
+
+typedef struct position_batch_policy
+{
+  /* The most positions in a message, 1 publishes every position on its own. */
+  int max_count;
+  /* The largest payload of a batch in bytes, 0 for no limit. */
+  size_t max_bytes;
+  /* How long the first position of a batch may wait, 0 to only flush on count and size. */
+  uint32_t max_latency_ms;
+} position_batch_policy;
+
+/**
+ * @brief Called with the payload of each batch to publish it.
+ *
+ * @param payload The written batch, valid until the callback returns
+ * @param count The number of positions in the batch
+ * @param context The context given to position_batcher_create()
+ * @return int 0 (MOSQ_ERR_SUCCESS) on success
+ */
+typedef int (*position_batch_publish)(const mosquitto_payload* payload, int count, void* context);
+
+typedef struct position_batcher position_batcher;
+
+/**
+ * @brief Creates a batcher.
+ *
+ * @param encoding The encoding of the batches, JSON or binary. Stream frames depend on the frame
+ * before them and are not batched.
+ * @param policy When to flush
+ * @param loop The event loop that runs the max_latency_ms timers, can be NULL without a
+ * max_latency_ms
+ * @param publish Called with each batch
+ * @param context Passed to publish
+ * @return position_batcher* The batcher, or NULL on failure. It must be freed with
+ * position_batcher_destroy().
+ */
+position_batcher* position_batcher_create(
+    position_encoding encoding,
+    position_batch_policy policy,
+    mqtt_event_loop* loop,
+    position_batch_publish publish,
+    void* context);
+
+/**
+ * @brief Frees a batcher. Positions that were not flushed yet are dropped, call
+ * position_batcher_flush() first to publish them.
+ *
+ * @param batcher The batcher to free, can be NULL
+ */
+void position_batcher_destroy(position_batcher* batcher);
+
+/**
+ * @brief Adds a position to the current batch, flushing before it when it doesn't fit in max_bytes
+ * and after it when the batch holds max_count positions.
+ *
+ * @param batcher The batcher
+ * @param coordinates The position to add
+ * @return int 0 on success, -1 if the position could not be added or a flush failed
+ */
+int position_batcher_add(position_batcher* batcher, geojson_coordinates coordinates);
+
+/**
+ * @brief Publishes the current batch now. The positions of a batch that fails to publish are
+ * dropped, so a broker that stays unreachable doesn't make the batch grow without bound.
+ *
+ * @param batcher The batcher
+ * @return int 0 on success or when the batch is empty, -1 on failure
+ */
+int position_batcher_flush(position_batcher* batcher);
+
+/**
+ * @brief Returns the number of positions waiting in the current batch.
+ *
+ * @param batcher The batcher
+ * @return int The number of positions
+ */
+int position_batcher_count(const position_batcher* batcher);
+
+#endif /* POSITION_BATCHER_H */
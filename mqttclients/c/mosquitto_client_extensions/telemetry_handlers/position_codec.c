@@ -0,0 +1,274 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logging.h"
+#include "mqtt_protocol.h"
+#include "position_codec.h"
+
+static const char* const encoding_names[] = { "json", "binary", "stream" };
+static const char* const encoding_content_types[]
+    = { POSITION_JSON_CONTENT_TYPE, POSITION_BINARY_CONTENT_TYPE, POSITION_STREAM_CONTENT_TYPE };
+
+#define ENCODING_COUNT (int)(sizeof(encoding_names) / sizeof(encoding_names[0]))
+
+/* What geojson_geometry_to_mosquitto_payload() writes before the positions of a JSON batch. */
+#define JSON_BATCH_PREFIX "{\"type\":\"MultiPoint\","
+
+bool position_encoding_from_name(const char* name, position_encoding* encoding)
+{
+  for (int i = 0; name != NULL && i < ENCODING_COUNT; i++)
+  {
+    if (strcmp(name, encoding_names[i]) == 0)
+    {
+      *encoding = (position_encoding)i;
+      return true;
+    }
+  }
+  LOG_ERROR("Unknown position encoding: %s", name == NULL ? "(null)" : name);
+  return false;
+}
+
+const char* position_encoding_content_type(position_encoding encoding)
+{
+  return (int)encoding >= 0 && (int)encoding < ENCODING_COUNT ? encoding_content_types[encoding]
+                                                              : NULL;
+}
+
+bool position_encoding_from_properties(const mosquitto_property* props, position_encoding* encoding)
+{
+  char* content_type = NULL;
+  bool found = false;
+
+  if (mosquitto_property_read_string(props, MQTT_PROP_CONTENT_TYPE, &content_type, false) == NULL)
+  {
+    *encoding = POSITION_ENCODING_JSON;
+    return true;
+  }
+  for (int i = 0; i < ENCODING_COUNT && !found; i++)
+  {
+    if (content_type != NULL && strcmp(content_type, encoding_content_types[i]) == 0)
+    {
+      *encoding = (position_encoding)i;
+      found = true;
+    }
+  }
+  if (!found)
+  {
+    LOG_ERROR("Unsupported position content type: %s", content_type);
+  }
+  free(content_type);
+  return found;
+}
+
+static void _write_double(unsigned char* buffer, double value)
+{
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  for (int i = 0; i < 8; i++)
+  {
+    buffer[i] = (unsigned char)(bits >> (8 * i));
+  }
+}
+
+static double _read_double(const unsigned char* buffer)
+{
+  uint64_t bits = 0;
+  double value;
+  for (int i = 0; i < 8; i++)
+  {
+    bits |= (uint64_t)buffer[i] << (8 * i);
+  }
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+int position_to_mosquitto_payload(
+    position_encoding encoding,
+    geojson_coordinates coordinates,
+    mosquitto_payload* payload)
+{
+  if (payload == NULL || payload->payload == NULL)
+  {
+    LOG_ERROR("Failure writing position: payload is NULL");
+    return -1;
+  }
+
+  switch (encoding)
+  {
+    case POSITION_ENCODING_JSON:
+    {
+      geojson_point point = { .type = "Point", .coordinates = coordinates };
+      return geojson_point_to_mosquitto_payload(point, payload);
+    }
+    case POSITION_ENCODING_BINARY:
+      if (payload->max_payload_length < POSITION_BINARY_PAYLOAD_LENGTH)
+      {
+        LOG_ERROR("Failure writing position: mosquitto payload buffer is too small");
+        return -1;
+      }
+      _write_double((unsigned char*)payload->payload, coordinates.x);
+      _write_double((unsigned char*)payload->payload + 8, coordinates.y);
+      payload->payload_length = POSITION_BINARY_PAYLOAD_LENGTH;
+      return 0;
+    case POSITION_ENCODING_STREAM:
+      LOG_ERROR("Failure writing position: streams are written with position_stream_encode()");
+      return -1;
+  }
+  LOG_ERROR("Failure writing position: unknown encoding %d", encoding);
+  return -1;
+}
+
+int mosquitto_payload_to_position(
+    position_encoding encoding,
+    const struct mosquitto_message* message,
+    geojson_coordinates* output)
+{
+  if (message == NULL || output == NULL)
+  {
+    LOG_ERROR("Failure reading position: message or output is NULL");
+    return -1;
+  }
+
+  switch (encoding)
+  {
+    case POSITION_ENCODING_JSON:
+      return mosquitto_payload_to_geojson_coordinates(message, output);
+    case POSITION_ENCODING_BINARY:
+      if (message->payload == NULL || message->payloadlen != POSITION_BINARY_PAYLOAD_LENGTH)
+      {
+        LOG_ERROR(
+            "Failure reading position: binary payload is %d bytes, not %d",
+            message->payloadlen,
+            POSITION_BINARY_PAYLOAD_LENGTH);
+        return -1;
+      }
+      output->x = _read_double((const unsigned char*)message->payload);
+      output->y = _read_double((const unsigned char*)message->payload + 8);
+      return 0;
+    case POSITION_ENCODING_STREAM:
+      LOG_ERROR("Failure reading position: streams are read with position_stream_decode()");
+      return -1;
+  }
+  LOG_ERROR("Failure reading position: unknown encoding %d", encoding);
+  return -1;
+}
+
+int positions_to_mosquitto_payload(
+    position_encoding encoding,
+    const geojson_geometry* positions,
+    mosquitto_payload* payload)
+{
+  if (positions == NULL || positions->count < 1 || payload == NULL || payload->payload == NULL)
+  {
+    LOG_ERROR("Failure writing positions: no positions or payload is NULL");
+    return -1;
+  }
+
+  switch (encoding)
+  {
+    case POSITION_ENCODING_JSON:
+    {
+      geojson_geometry batch = *positions;
+      batch.type = positions->count == 1 ? GEOJSON_POINT : GEOJSON_MULTI_POINT;
+      return geojson_geometry_to_mosquitto_payload(&batch, payload);
+    }
+    case POSITION_ENCODING_BINARY:
+      if (payload->max_payload_length < (size_t)positions->count * POSITION_BINARY_PAYLOAD_LENGTH)
+      {
+        LOG_ERROR("Failure writing positions: mosquitto payload buffer is too small");
+        return -1;
+      }
+      for (int i = 0; i < positions->count; i++)
+      {
+        unsigned char* position
+            = (unsigned char*)payload->payload + i * POSITION_BINARY_PAYLOAD_LENGTH;
+        _write_double(position, positions->x[i]);
+        _write_double(position + 8, positions->y[i]);
+      }
+      payload->payload_length = positions->count * POSITION_BINARY_PAYLOAD_LENGTH;
+      return 0;
+    case POSITION_ENCODING_STREAM:
+      LOG_ERROR("Failure writing positions: streams are written with position_stream_encode()");
+      return -1;
+  }
+  LOG_ERROR("Failure writing positions: unknown encoding %d", encoding);
+  return -1;
+}
+
+int mosquitto_payload_to_positions(
+    position_encoding encoding,
+    const struct mosquitto_message* message,
+    geojson_geometry* output)
+{
+  if (message == NULL || output == NULL)
+  {
+    LOG_ERROR("Failure reading positions: message or output is NULL");
+    return -1;
+  }
+
+  switch (encoding)
+  {
+    case POSITION_ENCODING_JSON:
+      if (mosquitto_payload_to_geojson_geometry(message, output) != 0)
+      {
+        return -1;
+      }
+      if (output->type != GEOJSON_POINT && output->type != GEOJSON_MULTI_POINT)
+      {
+        LOG_ERROR(
+            "Failure reading positions: %s is not a Point or MultiPoint",
+            geojson_geometry_type_name(output->type));
+        return -1;
+      }
+      return output->count;
+    case POSITION_ENCODING_BINARY:
+    {
+      int count = message->payloadlen / POSITION_BINARY_PAYLOAD_LENGTH;
+      if (message->payload == NULL || count < 1
+          || message->payloadlen != count * POSITION_BINARY_PAYLOAD_LENGTH)
+      {
+        LOG_ERROR(
+            "Failure reading positions: binary payload is %d bytes, not a multiple of %d",
+            message->payloadlen,
+            POSITION_BINARY_PAYLOAD_LENGTH);
+        return -1;
+      }
+      if (!geojson_geometry_reset(
+              output, count == 1 ? GEOJSON_POINT : GEOJSON_MULTI_POINT, count, 0))
+      {
+        return -1;
+      }
+      for (int i = 0; i < count; i++)
+      {
+        const unsigned char* position
+            = (const unsigned char*)message->payload + i * POSITION_BINARY_PAYLOAD_LENGTH;
+        geojson_geometry_add_position(output, _read_double(position), _read_double(position + 8));
+      }
+      return count;
+    }
+    case POSITION_ENCODING_STREAM:
+      LOG_ERROR("Failure reading positions: streams are read with position_stream_decode()");
+      return -1;
+  }
+  LOG_ERROR("Failure reading positions: unknown encoding %d", encoding);
+  return -1;
+}
+
+bool position_payload_is_batch(position_encoding encoding, const struct mosquitto_message* message)
+{
+  switch (encoding)
+  {
+    case POSITION_ENCODING_JSON:
+      return message->payloadlen >= (int)sizeof(JSON_BATCH_PREFIX) - 1
+          && memcmp(message->payload, JSON_BATCH_PREFIX, sizeof(JSON_BATCH_PREFIX) - 1) == 0;
+    case POSITION_ENCODING_BINARY:
+      return message->payloadlen > POSITION_BINARY_PAYLOAD_LENGTH;
+    case POSITION_ENCODING_STREAM:
+      return false;
+  }
+  return false;
+}
@@ -0,0 +1,129 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef POSITION_CODEC_H
+#define POSITION_CODEC_H
+
+#include "geo_json_handler.h"
+#include "mosquitto.h"
+#include <stdbool.h>
+
+/* The MQTT 5 content types of the telemetry position encodings. */
+#define POSITION_JSON_CONTENT_TYPE "application/geo+json"
+#define POSITION_BINARY_CONTENT_TYPE "application/vnd.position.v1"
+#define POSITION_STREAM_CONTENT_TYPE "application/vnd.position.delta.v1"
+
+/* A binary position is x then y as little-endian IEEE 754 doubles. A batch of positions is several
+ * of them one after the other. */
+#define POSITION_BINARY_PAYLOAD_LENGTH 16
+
+typedef enum position_encoding
+{
+  /* A GeoJSON Point, the default when a message has no content type. */
+  POSITION_ENCODING_JSON,
+  POSITION_ENCODING_BINARY,
+  /* Delta frames of a stream, written and read with position_stream_codec.h. */
+  POSITION_ENCODING_STREAM
+} position_encoding;
+
+/**
+ * @brief Reads a position encoding from its name, "json", "binary" or "stream", as set in the
+ * environment.
+ *
+ * @param name The name of the encoding
+ * @param encoding The encoding to output to
+ * @return true on success, false if the name is unknown
+ */
+bool position_encoding_from_name(const char* name, position_encoding* encoding);
+
+/**
+ * @brief Returns the MQTT 5 content type a position encoding is published with.
+ *
+ * @param encoding The position encoding
+ * @return const char* The content type, or NULL for an unknown encoding
+ */
+const char* position_encoding_content_type(position_encoding encoding);
+
+/**
+ * @brief Finds the encoding of a received position from the MQTT_PROP_CONTENT_TYPE property.
+ * Messages without a content type, like those of MQTT 3.1.1 producers, are JSON.
+ *
+ * @param props The properties of the message
+ * @param encoding The encoding to output to
+ * @return true on success, false if the content type isn't a position encoding
+ */
+bool position_encoding_from_properties(
+    const mosquitto_property* props,
+    position_encoding* encoding);
+
+/**
+ * @brief Writes a position to a mosquitto_payload. JSON is written with
+ * geojson_point_to_mosquitto_payload(); binary positions are POSITION_BINARY_PAYLOAD_LENGTH bytes.
+ * Nothing is allocated. Streams need the state of position_stream_encode() and fail here.
+ *
+ * @param encoding The encoding to write
+ * @param coordinates The position to write
+ * @param payload The mosquitto_payload to output to, from mosquitto_payload_init()
+ * @return int 0 on success, -1 on failure
+ */
+int position_to_mosquitto_payload(
+    position_encoding encoding,
+    geojson_coordinates coordinates,
+    mosquitto_payload* payload);
+
+/**
+ * @brief Reads a position from a mosquitto_message. JSON is read with
+ * mosquitto_payload_to_geojson_coordinates(). Streams need the state of position_stream_decode()
+ * and fail here.
+ *
+ * @param encoding The encoding of the message, ex. from position_encoding_from_properties()
+ * @param message The mosquitto_message to read
+ * @param output The position to output to
+ * @return int 0 on success, -1 on failure
+ */
+int mosquitto_payload_to_position(
+    position_encoding encoding,
+    const struct mosquitto_message* message,
+    geojson_coordinates* output);
+
+/**
+ * @brief Writes a batch of positions to a mosquitto_payload. JSON batches are a GeoJSON MultiPoint,
+ * or a Point for a single position so they stay readable by consumers that only know Points.
+ * Binary batches are POSITION_BINARY_PAYLOAD_LENGTH bytes per position. Nothing is allocated.
+ *
+ * @param encoding The encoding to write, JSON or binary
+ * @param positions The positions to write, the geometry type is ignored
+ * @param payload The mosquitto_payload to output to, from mosquitto_payload_init()
+ * @return int 0 on success, -1 on failure
+ */
+int positions_to_mosquitto_payload(
+    position_encoding encoding,
+    const geojson_geometry* positions,
+    mosquitto_payload* payload);
+
+/**
+ * @brief Reads every position of a message, a single position or a batch written by
+ * positions_to_mosquitto_payload(). JSON messages may be a GeoJSON Point or MultiPoint.
+ *
+ * @param encoding The encoding of the message, JSON or binary
+ * @param message The mosquitto_message to read
+ * @param output The geojson_geometry to output to, from geojson_geometry_init(). It is reused
+ * between calls and only grows when a message has more positions than before.
+ * @return int The number of positions read, or -1 on failure
+ */
+int mosquitto_payload_to_positions(
+    position_encoding encoding,
+    const struct mosquitto_message* message,
+    geojson_geometry* output);
+
+/**
+ * @brief Tells whether a message holds a batch of positions as positions_to_mosquitto_payload()
+ * writes them, so consumers can keep single positions on the faster single position decoders.
+ *
+ * @param encoding The encoding of the message
+ * @param message The mosquitto_message to check
+ * @return true for a binary payload of several positions or a JSON MultiPoint, false otherwise
+ */
+bool position_payload_is_batch(position_encoding encoding, const struct mosquitto_message* message);
+
+#endif /* POSITION_CODEC_H */
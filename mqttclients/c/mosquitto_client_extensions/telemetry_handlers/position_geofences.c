@@ -0,0 +1,694 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <emmintrin.h>
+#endif
+
+#include "logging.h"
+#include "position_geofences.h"
+
+#define NODE_SIZE 16
+/* Enough levels for INT32_MAX fences. */
+#define MAX_LEVELS 8
+#define INITIAL_MEMBERSHIP_CAPACITY 4
+/* Lists of fences up to this long are sorted by insertion. */
+#define INSERTION_SORT_MAX 16
+
+/* The fences a vehicle is inside, by index in tree order, in increasing order. */
+typedef struct fence_membership
+{
+  int count;
+  int capacity;
+  int* fences;
+} fence_membership;
+
+/* The center of the box of a fence, to sort fences into tiles. */
+typedef struct fence_center
+{
+  double x, y;
+  int fence;
+} fence_center;
+
+struct position_geofences
+{
+  int count;
+  /* The boxes of the fences in tree order, then of the nodes of each level up to the top one. Level
+   * l is boxes level_starts[l] to level_starts[l + 1] - 1: level 0 holds the fences, and node j of
+   * level l + 1 is the box around boxes 16 j to 16 j + 15 of level l. Every level is padded to a
+   * multiple of 16 boxes with empty boxes, min = +inf and max = -inf, and the top level has 16. */
+  double* min_x;
+  double* min_y;
+  double* max_x;
+  double* max_y;
+  int level_starts[MAX_LEVELS + 1];
+  int level_count;
+  /* Fence k in tree order has rings fence_rings[k] to fence_rings[k + 1] - 1, and ring r has
+   * positions ring_starts[r] to ring_starts[r + 1] - 1, closed: its last position is its first. */
+  double* x;
+  double* y;
+  int* fence_rings;
+  int* ring_starts;
+  /* The number fence k in tree order was given when the set was created, and the ids by number. */
+  int* numbers;
+  char** ids;
+  char* id_block;
+  size_t max_vehicles;
+  fence_membership* vehicles;
+  /* The fences of the vehicle being updated. Only used by the updating thread. */
+  int* inside;
+};
+
+static bool _id_is_valid(const char* id)
+{
+  size_t length = id == NULL ? 0 : strlen(id);
+  return length > 0 && length <= POSITION_GEOFENCES_MAX_ID_LENGTH
+      && strpbrk(id, "/+# \t\r\n\v\f") == NULL;
+}
+
+static bool _polygon_is_valid(const geojson_geometry* polygon)
+{
+  if (polygon->type != GEOJSON_POLYGON || polygon->ring_count == 0)
+  {
+    return false;
+  }
+  for (int i = 0; i < polygon->count; i++)
+  {
+    if (!isfinite(polygon->x[i]) || !isfinite(polygon->y[i]))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+static int _compare_x(const void* a, const void* b)
+{
+  double difference = ((const fence_center*)a)->x - ((const fence_center*)b)->x;
+  return (difference > 0) - (difference < 0);
+}
+
+static int _compare_y(const void* a, const void* b)
+{
+  double difference = ((const fence_center*)a)->y - ((const fence_center*)b)->y;
+  return (difference > 0) - (difference < 0);
+}
+
+static int _compare_ints(const void* a, const void* b)
+{
+  int first = *(const int*)a;
+  int second = *(const int*)b;
+  return (first > second) - (first < second);
+}
+
+static void _sort_ints(int* values, int count)
+{
+  if (count > INSERTION_SORT_MAX)
+  {
+    qsort(values, count, sizeof(int), _compare_ints);
+    return;
+  }
+  for (int i = 1; i < count; i++)
+  {
+    int value = values[i];
+    int j = i;
+    for (; j > 0 && values[j - 1] > value; j--)
+    {
+      values[j] = values[j - 1];
+    }
+    values[j] = value;
+  }
+}
+
+static void _set_empty_box(position_geofences* fences, int box)
+{
+  fences->min_x[box] = fences->min_y[box] = INFINITY;
+  fences->max_x[box] = fences->max_y[box] = -INFINITY;
+}
+
+static void _add_to_box(
+    position_geofences* fences,
+    int box,
+    double min_x,
+    double min_y,
+    double max_x,
+    double max_y)
+{
+  fences->min_x[box] = fmin(fences->min_x[box], min_x);
+  fences->min_y[box] = fmin(fences->min_y[box], min_y);
+  fences->max_x[box] = fmax(fences->max_x[box], max_x);
+  fences->max_y[box] = fmax(fences->max_y[box], max_y);
+}
+
+/* Sizes the levels of the tree for count fences, and returns the number of boxes. */
+static int _size_levels(position_geofences* fences, int count)
+{
+  int size = (count + NODE_SIZE - 1) / NODE_SIZE * NODE_SIZE;
+  int start = 0;
+
+  fences->level_count = 0;
+  if (size == 0)
+  {
+    fences->level_starts[0] = 0;
+    return 0;
+  }
+  for (;;)
+  {
+    fences->level_starts[fences->level_count++] = start;
+    start += size;
+    if (size == NODE_SIZE)
+    {
+      break;
+    }
+    size = (size / NODE_SIZE + NODE_SIZE - 1) / NODE_SIZE * NODE_SIZE;
+  }
+  fences->level_starts[fences->level_count] = start;
+  return start;
+}
+
+/* Orders the fences by Sort Tile Recursive: into vertical slices of whole leaf nodes by the x of
+ * their center, then each slice by the y. */
+static void _sort_tiles(fence_center* centers, int count)
+{
+  int leaves = (count + NODE_SIZE - 1) / NODE_SIZE;
+  int slices = (int)ceil(sqrt(leaves));
+  int slice_size = (leaves + slices - 1) / slices * NODE_SIZE;
+
+  qsort(centers, count, sizeof(fence_center), _compare_x);
+  for (int start = 0; start < count; start += slice_size)
+  {
+    int size = count - start < slice_size ? count - start : slice_size;
+    qsort(centers + start, size, sizeof(fence_center), _compare_y);
+  }
+}
+
+/* Copies the fences in tree order and sets their boxes, then the boxes of the nodes. */
+static void _build(
+    position_geofences* fences,
+    const geojson_geometry polygons[],
+    const fence_center* centers)
+{
+  int ring = 0;
+  int position = 0;
+
+  for (int k = 0; k < fences->count; k++)
+  {
+    const geojson_geometry* polygon = &polygons[centers[k].fence];
+    fences->numbers[k] = centers[k].fence;
+    fences->fence_rings[k] = ring;
+    for (int r = 0; r < polygon->ring_count; r++)
+    {
+      fences->ring_starts[ring++] = position + (r == 0 ? 0 : polygon->ring_ends[r - 1]);
+    }
+    memcpy(fences->x + position, polygon->x, polygon->count * sizeof(double));
+    memcpy(fences->y + position, polygon->y, polygon->count * sizeof(double));
+    position += polygon->count;
+    _set_empty_box(fences, k);
+    for (int i = 0; i < polygon->count; i++)
+    {
+      _add_to_box(fences, k, polygon->x[i], polygon->y[i], polygon->x[i], polygon->y[i]);
+    }
+  }
+  fences->fence_rings[fences->count] = ring;
+  fences->ring_starts[ring] = position;
+
+  for (int box = fences->count; box < fences->level_starts[1]; box++)
+  {
+    _set_empty_box(fences, box);
+  }
+  for (int level = 1; level < fences->level_count; level++)
+  {
+    int children = fences->level_starts[level - 1];
+    for (int box = fences->level_starts[level]; box < fences->level_starts[level + 1]; box++)
+    {
+      _set_empty_box(fences, box);
+      for (int i = 0; i < NODE_SIZE && children < fences->level_starts[level]; i++, children++)
+      {
+        _add_to_box(
+            fences,
+            box,
+            fences->min_x[children],
+            fences->min_y[children],
+            fences->max_x[children],
+            fences->max_y[children]);
+      }
+    }
+  }
+}
+
+/* Allocates memory on a cache line boundary, or returns NULL on failure. */
+static void* _alloc_aligned(size_t size)
+{
+  void* memory;
+  return posix_memalign(&memory, 64, size) == 0 ? memory : NULL;
+}
+
+static bool _allocate(
+    position_geofences* fences,
+    const char* const ids[],
+    const geojson_geometry polygons[],
+    int count,
+    size_t max_vehicles)
+{
+  size_t positions = 0;
+  size_t rings = 0;
+  size_t id_bytes = 0;
+  size_t boxes = _size_levels(fences, count);
+  /* The columns share one allocation, so each is rounded up to keep the next one aligned. */
+  size_t box_bytes = (boxes * sizeof(double) + 63) / 64 * 64;
+  size_t position_bytes;
+
+  for (int i = 0; i < count; i++)
+  {
+    positions += polygons[i].count;
+    rings += polygons[i].ring_count;
+    id_bytes += strlen(ids[i]) + 1;
+  }
+  if (positions > INT32_MAX || rings >= INT32_MAX)
+  {
+    return false;
+  }
+  position_bytes = (positions * sizeof(double) + 63) / 64 * 64;
+  if ((fences->min_x = _alloc_aligned(4 * box_bytes + 64)) == NULL
+      || (fences->x = _alloc_aligned(2 * position_bytes + 64)) == NULL
+      || (fences->fence_rings = malloc((count + 1) * sizeof(int))) == NULL
+      || (fences->ring_starts = malloc((rings + 1) * sizeof(int))) == NULL
+      || (fences->numbers = malloc((count + 1) * sizeof(int))) == NULL
+      || (fences->ids = malloc((count + 1) * sizeof(char*))) == NULL
+      || (fences->id_block = malloc(id_bytes + 1)) == NULL
+      || (fences->vehicles = calloc(max_vehicles, sizeof(fence_membership))) == NULL
+      || (fences->inside = malloc((count + 1) * sizeof(int))) == NULL)
+  {
+    return false;
+  }
+  fences->min_y = fences->min_x + box_bytes / sizeof(double);
+  fences->max_x = fences->min_y + box_bytes / sizeof(double);
+  fences->max_y = fences->max_x + box_bytes / sizeof(double);
+  fences->y = fences->x + position_bytes / sizeof(double);
+
+  char* id = fences->id_block;
+  for (int i = 0; i < count; i++)
+  {
+    size_t length = strlen(ids[i]) + 1;
+    memcpy(id, ids[i], length);
+    fences->ids[i] = id;
+    id += length;
+  }
+  return true;
+}
+
+position_geofences* position_geofences_create(
+    const char* const ids[],
+    const geojson_geometry polygons[],
+    int count,
+    size_t max_vehicles)
+{
+  position_geofences* fences = calloc(1, sizeof(position_geofences));
+  fence_center* centers = NULL;
+  bool valid = count >= 0 && max_vehicles > 0 && max_vehicles <= INT32_MAX
+      && (count == 0 || (ids != NULL && polygons != NULL));
+
+  for (int i = 0; valid && i < count; i++)
+  {
+    if (!_id_is_valid(ids[i]) || !_polygon_is_valid(&polygons[i]))
+    {
+      LOG_ERROR("Invalid geofence %d: %s", i, ids[i] == NULL ? "(no id)" : ids[i]);
+      valid = false;
+    }
+  }
+  if (fences == NULL || !valid || (centers = malloc((count + 1) * sizeof(fence_center))) == NULL
+      || !_allocate(fences, ids, polygons, count, max_vehicles))
+  {
+    LOG_ERROR("Failure creating a set of %d geofences for %zu vehicles", count, max_vehicles);
+    free(centers);
+    position_geofences_destroy(fences);
+    return NULL;
+  }
+
+  for (int i = 0; i < count; i++)
+  {
+    const geojson_geometry* polygon = &polygons[i];
+    double min_x = INFINITY, min_y = INFINITY, max_x = -INFINITY, max_y = -INFINITY;
+    for (int j = 0; j < polygon->count; j++)
+    {
+      min_x = fmin(min_x, polygon->x[j]);
+      min_y = fmin(min_y, polygon->y[j]);
+      max_x = fmax(max_x, polygon->x[j]);
+      max_y = fmax(max_y, polygon->y[j]);
+    }
+    centers[i] = (fence_center){ .x = (min_x + max_x) / 2, .y = (min_y + max_y) / 2, .fence = i };
+  }
+  fences->count = count;
+  fences->max_vehicles = max_vehicles;
+  /* Without fences the tree has no levels, which _find() checks. */
+  if (count > 0)
+  {
+    _sort_tiles(centers, count);
+    _build(fences, polygons, centers);
+  }
+  free(centers);
+  return fences;
+}
+
+position_geofences* position_geofences_load(const char* path, size_t max_vehicles)
+{
+  FILE* file = fopen(path, "rb");
+  position_geofences* fences = NULL;
+  char* text = NULL;
+  const char** ids = NULL;
+  geojson_geometry* polygons = NULL;
+  int lines = 1;
+  int count = 0;
+  long length = -1;
+  bool success = file != NULL && fseek(file, 0, SEEK_END) == 0 && (length = ftell(file)) >= 0
+      && length < INT32_MAX && fseek(file, 0, SEEK_SET) == 0
+      && (text = malloc(length + 1)) != NULL && fread(text, 1, length, file) == (size_t)length;
+
+  if (file != NULL)
+  {
+    fclose(file);
+  }
+  if (!success)
+  {
+    LOG_ERROR("Failed to read the geofences %s", path);
+    free(text);
+    return NULL;
+  }
+  text[length] = '\0';
+  for (long i = 0; i < length; i++)
+  {
+    lines += text[i] == '\n';
+  }
+
+  success = (ids = malloc(lines * sizeof(char*))) != NULL
+      && (polygons = malloc(lines * sizeof(geojson_geometry))) != NULL;
+  char* line = text;
+  for (int number = 1; success && line != NULL; number++)
+  {
+    char* end = strchr(line, '\n');
+    char* next = end == NULL ? NULL : end + 1;
+    end = end == NULL ? text + length : end;
+    *end = '\0';
+    if (end > line && end[-1] == '\r')
+    {
+      *--end = '\0';
+    }
+    line += strspn(line, " \t");
+    if (*line != '\0' && *line != '#')
+    {
+      char* polygon = line + strcspn(line, " \t");
+      struct mosquitto_message message = { 0 };
+      if (*polygon != '\0')
+      {
+        *polygon++ = '\0';
+      }
+      message.payload = polygon;
+      message.payloadlen = (int)(end - polygon);
+      ids[count] = line;
+      polygons[count] = geojson_geometry_init();
+      if (mosquitto_payload_to_geojson_geometry(&message, &polygons[count++]) != 0)
+      {
+        LOG_ERROR("Failure parsing the geofence on line %d of %s", number, path);
+        success = false;
+      }
+    }
+    line = next;
+  }
+
+  if (success)
+  {
+    fences = position_geofences_create(ids, polygons, count, max_vehicles);
+  }
+  for (int i = 0; i < count; i++)
+  {
+    geojson_geometry_destroy(&polygons[i]);
+  }
+  free(polygons);
+  free(ids);
+  free(text);
+  return fences;
+}
+
+void position_geofences_destroy(position_geofences* fences)
+{
+  if (fences == NULL)
+  {
+    return;
+  }
+  for (size_t i = 0; fences->vehicles != NULL && i < fences->max_vehicles; i++)
+  {
+    free(fences->vehicles[i].fences);
+  }
+  free(fences->min_x);
+  free(fences->x);
+  free(fences->fence_rings);
+  free(fences->ring_starts);
+  free(fences->numbers);
+  free(fences->ids);
+  free(fences->id_block);
+  free(fences->vehicles);
+  free(fences->inside);
+  free(fences);
+}
+
+int position_geofences_count(const position_geofences* fences)
+{
+  return fences->count;
+}
+
+const char* position_geofences_id(const position_geofences* fences, int fence)
+{
+  return fences->ids[fence];
+}
+
+/* Returns a bit per box of the node starting at box first, set when the box holds the point. The
+ * boxes are tested two at a time with SSE2, nodes are aligned to 64 bytes. */
+static uint32_t _node_hits(const position_geofences* fences, int first, double x, double y)
+{
+  const double* min_x = fences->min_x + first;
+  const double* min_y = fences->min_y + first;
+  const double* max_x = fences->max_x + first;
+  const double* max_y = fences->max_y + first;
+  uint32_t hits = 0;
+
+#if defined(__x86_64__)
+  __m128d point_x = _mm_set1_pd(x);
+  __m128d point_y = _mm_set1_pd(y);
+  for (int i = 0; i < NODE_SIZE; i += 2)
+  {
+    __m128d inside_x = _mm_and_pd(
+        _mm_cmple_pd(_mm_load_pd(min_x + i), point_x),
+        _mm_cmple_pd(point_x, _mm_load_pd(max_x + i)));
+    __m128d inside_y = _mm_and_pd(
+        _mm_cmple_pd(_mm_load_pd(min_y + i), point_y),
+        _mm_cmple_pd(point_y, _mm_load_pd(max_y + i)));
+    hits |= (uint32_t)_mm_movemask_pd(_mm_and_pd(inside_x, inside_y)) << i;
+  }
+#else
+  for (int i = 0; i < NODE_SIZE; i++)
+  {
+    hits |= (uint32_t)((min_x[i] <= x) & (x <= max_x[i]) & (min_y[i] <= y) & (y <= max_y[i])) << i;
+  }
+#endif
+  return hits;
+}
+
+/* Counts the edges of a ring crossed by a ray going east from the point. An edge is crossed when
+ * its ends are on both sides of the ray, and the point is west of it: the cross product of the edge
+ * and the point is positive when the edge goes north, negative when it goes south. Edges are tested
+ * two at a time with SSE2, without branches. */
+static int _ring_crossings(
+    const double* x,
+    const double* y,
+    int start,
+    int last,
+    double px,
+    double py)
+{
+  int crossings = 0;
+  int i = start;
+
+#if defined(__x86_64__)
+  __m128d point_x = _mm_set1_pd(px);
+  __m128d point_y = _mm_set1_pd(py);
+  __m128i counts = _mm_setzero_si128();
+  for (; i + 1 < last; i += 2)
+  {
+    __m128d x0 = _mm_loadu_pd(x + i);
+    __m128d y0 = _mm_loadu_pd(y + i);
+    __m128d x1 = _mm_loadu_pd(x + i + 1);
+    __m128d y1 = _mm_loadu_pd(y + i + 1);
+    __m128d north = _mm_cmpgt_pd(y1, point_y);
+    __m128d straddles = _mm_xor_pd(_mm_cmpgt_pd(y0, point_y), north);
+    __m128d cross = _mm_sub_pd(
+        _mm_mul_pd(_mm_sub_pd(x1, x0), _mm_sub_pd(point_y, y0)),
+        _mm_mul_pd(_mm_sub_pd(point_x, x0), _mm_sub_pd(y1, y0)));
+    __m128d west = _mm_xor_pd(_mm_cmpgt_pd(cross, _mm_setzero_pd()), north);
+    /* Each crossed edge is a lane of all ones, -1. */
+    counts = _mm_sub_epi64(counts, _mm_castpd_si128(_mm_andnot_pd(west, straddles)));
+  }
+  crossings = _mm_cvtsi128_si32(counts) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(counts, counts));
+#endif
+  for (; i < last; i++)
+  {
+    bool north = y[i + 1] > py;
+    double cross = (x[i + 1] - x[i]) * (py - y[i]) - (px - x[i]) * (y[i + 1] - y[i]);
+    crossings += ((y[i] > py) != north) & ((cross > 0) == north);
+  }
+  return crossings;
+}
+
+/* The point is inside a fence when a ray from it crosses the edges of its rings an odd number of
+ * times, so holes need no special case. */
+static bool _fence_contains(const position_geofences* fences, int fence, double px, double py)
+{
+  int crossings = 0;
+  for (int r = fences->fence_rings[fence]; r < fences->fence_rings[fence + 1]; r++)
+  {
+    crossings += _ring_crossings(
+        fences->x, fences->y, fences->ring_starts[r], fences->ring_starts[r + 1] - 1, px, py);
+  }
+  return (crossings & 1) != 0;
+}
+
+/* Finds the fences that hold the point below the node starting at box first of a level, and
+ * outputs their index in tree order. */
+static int _search(
+    const position_geofences* fences,
+    int level,
+    int first,
+    double x,
+    double y,
+    int* output,
+    int max_count,
+    int found)
+{
+  uint32_t hits = _node_hits(fences, first, x, y);
+  while (hits != 0)
+  {
+    int box = first + __builtin_ctz(hits);
+    hits &= hits - 1;
+    if (level > 0)
+    {
+      int child = fences->level_starts[level - 1]
+          + (box - fences->level_starts[level]) * NODE_SIZE;
+      found = _search(fences, level - 1, child, x, y, output, max_count, found);
+    }
+    else if (_fence_contains(fences, box, x, y))
+    {
+      if (found < max_count)
+      {
+        output[found] = box;
+      }
+      found++;
+    }
+  }
+  return found;
+}
+
+static int _find(const position_geofences* fences, double x, double y, int* output, int max_count)
+{
+  int top = fences->level_count - 1;
+  return fences->level_count == 0
+      ? 0
+      : _search(fences, top, fences->level_starts[top], x, y, output, max_count, 0);
+}
+
+int position_geofences_find(
+    const position_geofences* fences,
+    geojson_coordinates point,
+    int* output,
+    int max_count)
+{
+  if (fences == NULL || isnan(point.x) || isnan(point.y) || max_count < 0
+      || (output == NULL && max_count > 0))
+  {
+    return -1;
+  }
+  int found = _find(fences, point.x, point.y, output, max_count);
+  int written = found < max_count ? found : max_count;
+  for (int i = 0; i < written; i++)
+  {
+    output[i] = fences->numbers[output[i]];
+  }
+  _sort_ints(output, written);
+  return found;
+}
+
+int position_geofences_update(
+    position_geofences* fences,
+    int vehicle,
+    geojson_coordinates position,
+    position_geofence_handler handler,
+    void* context)
+{
+  if (fences == NULL || vehicle < 0 || (size_t)vehicle >= fences->max_vehicles
+      || isnan(position.x) || isnan(position.y))
+  {
+    return -1;
+  }
+
+  fence_membership* membership = &fences->vehicles[vehicle];
+  int* inside = fences->inside;
+  int count = _find(fences, position.x, position.y, inside, fences->count);
+  int events = 0;
+
+  if (count == 0 && membership->count == 0)
+  {
+    return 0;
+  }
+  _sort_ints(inside, count);
+  if (count > membership->capacity)
+  {
+    int capacity = count > INITIAL_MEMBERSHIP_CAPACITY ? count : INITIAL_MEMBERSHIP_CAPACITY;
+    int* grown = realloc(membership->fences, capacity * sizeof(int));
+    if (grown == NULL)
+    {
+      LOG_ERROR("Failure growing the geofences of vehicle %d", vehicle);
+      return -1;
+    }
+    membership->fences = grown;
+    membership->capacity = capacity;
+  }
+
+  /* Both lists are sorted, so each is merged against the other once. */
+  for (int i = 0, j = 0; i < membership->count; i++)
+  {
+    while (j < count && inside[j] < membership->fences[i])
+    {
+      j++;
+    }
+    if (j == count || inside[j] != membership->fences[i])
+    {
+      events++;
+      if (handler != NULL)
+      {
+        handler(vehicle, fences->numbers[membership->fences[i]], false, context);
+      }
+    }
+  }
+  for (int i = 0, j = 0; i < count; i++)
+  {
+    while (j < membership->count && membership->fences[j] < inside[i])
+    {
+      j++;
+    }
+    if (j == membership->count || membership->fences[j] != inside[i])
+    {
+      events++;
+      if (handler != NULL)
+      {
+        handler(vehicle, fences->numbers[inside[i]], true, context);
+      }
+    }
+  }
+  memcpy(membership->fences, inside, count * sizeof(int));
+  membership->count = count;
+  return events;
+}
@@ -0,0 +1,134 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef POSITION_GEOFENCES_H
+#define POSITION_GEOFENCES_H
+
+#include "geo_json_handler.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * A fixed set of geofences, GeoJSON Polygons with an id, that tracks which fences each vehicle is
+ * inside and reports when it enters or exits one.
+ *
+ * The bounding boxes of the fences are packed into a static R-tree when the set is created: the
+ * fences are sorted into vertical slices by the x of their center, and each slice by the y (Sort
+ * Tile Recursive), then grouped 16 by 16 into nodes, and the nodes 16 by 16 up to the root. The
+ * boxes of each level are stored as one array per edge with every node padded to 16 children, so
+ * a point is tested against the 16 children of a node in one loop that compilers vectorize. The
+ * fences whose box holds the point are then tested with a crossing number test that goes through
+ * the edges of each ring without branching, over the positions of all the fences stored as one
+ * array per axis in tree order.
+ *
+ * Positions are compared as planar x, y degrees: fences across the antimeridian aren't supported.
+ * A point on an edge may be inside or outside.
+ *
+ * One thread updates the vehicles, ex. the event loop thread handling the messages. The fences
+ * never change, so any number of threads can test points with position_geofences_find() at the
+ * same time.
+ */
+
+/* The longest fence id, ids must also be usable as a topic level. */
+#define POSITION_GEOFENCES_MAX_ID_LENGTH 255
+
+typedef struct position_geofences position_geofences;
+
+/**
+ * @brief Called for each fence a vehicle enters or exits.
+ *
+ * @param vehicle The number of the vehicle
+ * @param fence The number of the fence, its index when the set was created
+ * @param entered true if the vehicle entered the fence, false if it exited it
+ * @param context The context passed to position_geofences_update()
+ */
+typedef void (*position_geofence_handler)(int vehicle, int fence, bool entered, void* context);
+
+/**
+ * @brief Creates a set of geofences, with every vehicle outside all of them.
+ *
+ * @param ids The ids of the fences, copied. Each must be non-empty, at most
+ * POSITION_GEOFENCES_MAX_ID_LENGTH long, without whitespace or the / + # characters.
+ * @param polygons The fences, GeoJSON Polygons with at least one ring, copied. The first ring is
+ * the outside of the fence and the other rings are its holes.
+ * @param count The number of fences
+ * @param max_vehicles The number of vehicles, numbered from 0, whose fences are tracked
+ * @return position_geofences* The set, or NULL if a fence is invalid or memory ran out. It must be
+ * freed with position_geofences_destroy().
+ */
+position_geofences* position_geofences_create(
+    const char* const ids[],
+    const geojson_geometry polygons[],
+    int count,
+    size_t max_vehicles);
+
+/**
+ * @brief Creates a set of geofences from a file with one fence per line: its id, then whitespace,
+ * then its GeoJSON Polygon. Empty lines and lines starting with # are skipped.
+ *
+ * @param path The path of the file
+ * @param max_vehicles The number of vehicles, numbered from 0, whose fences are tracked
+ * @return position_geofences* The set, or NULL if the file can't be read or a fence is invalid. It
+ * must be freed with position_geofences_destroy().
+ */
+position_geofences* position_geofences_load(const char* path, size_t max_vehicles);
+
+/**
+ * @brief Frees a set of geofences. No thread may still be using it.
+ *
+ * @param fences The set to free, can be NULL
+ */
+void position_geofences_destroy(position_geofences* fences);
+
+/**
+ * @brief Returns the number of fences of a set.
+ */
+int position_geofences_count(const position_geofences* fences);
+
+/**
+ * @brief Returns the id of a fence.
+ *
+ * @param fences The set
+ * @param fence A number below position_geofences_count()
+ * @return const char* The null terminated id, kept until the set is destroyed
+ */
+const char* position_geofences_id(const position_geofences* fences, int fence);
+
+/**
+ * @brief Finds the fences a point is inside. Can be called from any thread, while vehicles are
+ * updated.
+ *
+ * @param fences The set
+ * @param point The point
+ * @param output The array to output the fence numbers to, in increasing order
+ * @param max_count The size of output
+ * @return int The number of fences the point is inside, of which at most max_count were written,
+ * or -1 if a coordinate isn't a number
+ */
+int position_geofences_find(
+    const position_geofences* fences,
+    geojson_coordinates point,
+    int* output,
+    int max_count);
+
+/**
+ * @brief Moves a vehicle, calling handler for each fence it exits, then for each fence it enters.
+ * Must only be called from one thread at a time.
+ *
+ * @param fences The set
+ * @param vehicle The number of the vehicle, below the max_vehicles of the set, ex. the number
+ * returned by position_store_update()
+ * @param position The new position of the vehicle
+ * @param handler Called for each fence entered or exited
+ * @param context Passed to handler
+ * @return int The number of fences entered or exited, or -1 if the vehicle number is out of range,
+ * a coordinate isn't a number or memory ran out
+ */
+int position_geofences_update(
+    position_geofences* fences,
+    int vehicle,
+    geojson_coordinates position,
+    position_geofence_handler handler,
+    void* context);
+
+#endif /* POSITION_GEOFENCES_H */
@@ -0,0 +1,256 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "position_geohash.h"
+
+/* The longitude and latitude are quantized to 30 bits each, enough for the 60 bits of a geohash of
+ * precision 12. */
+#define AXIS_BITS 30
+#define AXIS_CELLS (1u << AXIS_BITS)
+#define BITS_PER_CHARACTER 5
+
+static const char BASE32[] = "0123456789bcdefghjkmnpqrstuvwxyz";
+
+/* The cells of the cover, at the precision picked, and where the geohashes are written. */
+typedef struct cover_state
+{
+  int precision;
+  uint32_t min_x, min_y, max_x, max_y;
+  char (*cells)[POSITION_GEOHASH_SIZE];
+  int count;
+} cover_state;
+
+/* The longitude bits of a geohash of a precision, the latitude ones are the rest of its bits. */
+static int _x_bits(int precision)
+{
+  return (BITS_PER_CHARACTER * precision + 1) / 2;
+}
+
+static int _y_bits(int precision)
+{
+  return BITS_PER_CHARACTER * precision / 2;
+}
+
+static bool _position_is_valid(geojson_coordinates position)
+{
+  return position.x >= -180 && position.x <= 180 && position.y >= -90 && position.y <= 90;
+}
+
+static uint32_t _quantize(double value, double min, double range)
+{
+  uint32_t cell = (uint32_t)((value - min) / range * AXIS_CELLS);
+  return cell < AXIS_CELLS ? cell : AXIS_CELLS - 1;
+}
+
+/* Spreads the 30 bits of value to the even bits of the result. */
+static uint64_t _spread(uint32_t value)
+{
+  uint64_t bits = value;
+  bits = (bits | bits << 16) & 0x0000ffff0000ffffull;
+  bits = (bits | bits << 8) & 0x00ff00ff00ff00ffull;
+  bits = (bits | bits << 4) & 0x0f0f0f0f0f0f0f0full;
+  bits = (bits | bits << 2) & 0x3333333333333333ull;
+  bits = (bits | bits << 1) & 0x5555555555555555ull;
+  return bits;
+}
+
+/* Writes the first precision characters of the geohash of the 30 bit cells x and y. */
+static void _write_geohash(uint32_t x, uint32_t y, int precision, char* geohash)
+{
+  uint64_t bits = _spread(x) << 1 | _spread(y);
+  for (int i = 0; i < precision; i++)
+  {
+    geohash[i] = BASE32[(bits >> (2 * AXIS_BITS - BITS_PER_CHARACTER * (i + 1))) & 31];
+  }
+  geohash[precision] = '\0';
+}
+
+static bool _is_base32(char character)
+{
+  return character != '\0' && strchr(BASE32, character) != NULL;
+}
+
+bool position_geohash_encode(geojson_coordinates position, int precision, char* geohash)
+{
+  if (!_position_is_valid(position) || precision < 1 || precision > POSITION_GEOHASH_MAX_PRECISION)
+  {
+    return false;
+  }
+  _write_geohash(
+      _quantize(position.x, -180, 360), _quantize(position.y, -90, 180), precision, geohash);
+  return true;
+}
+
+int position_geohash_topic(
+    geojson_coordinates position,
+    int precision,
+    const char* id,
+    char* topic,
+    size_t size)
+{
+  const size_t prefix_length = sizeof(POSITION_GEOHASH_TOPIC_PREFIX) - 1;
+  const size_t suffix_length = sizeof(POSITION_GEOHASH_TOPIC_SUFFIX) - 1;
+  char geohash[POSITION_GEOHASH_SIZE];
+  size_t id_length = id == NULL ? 0 : strlen(id);
+  size_t length = prefix_length + 2 * (size_t)precision + id_length + suffix_length;
+
+  if (id_length == 0 || strpbrk(id, "/+#") != NULL || length >= size
+      || !position_geohash_encode(position, precision, geohash))
+  {
+    return -1;
+  }
+  char* end = topic + prefix_length;
+  memcpy(topic, POSITION_GEOHASH_TOPIC_PREFIX, prefix_length);
+  for (int i = 0; i < precision; i++)
+  {
+    *end++ = geohash[i];
+    *end++ = '/';
+  }
+  memcpy(end, id, id_length);
+  memcpy(end + id_length, POSITION_GEOHASH_TOPIC_SUFFIX, suffix_length + 1);
+  return (int)length;
+}
+
+const char* position_geohash_topic_vehicle_id(const char* topic, size_t* length)
+{
+  const size_t prefix_length = sizeof(POSITION_GEOHASH_TOPIC_PREFIX) - 1;
+  const size_t suffix_length = sizeof(POSITION_GEOHASH_TOPIC_SUFFIX) - 1;
+  size_t topic_length = topic == NULL ? 0 : strlen(topic);
+  if (topic_length < prefix_length + suffix_length
+      || strncmp(topic, POSITION_GEOHASH_TOPIC_PREFIX, prefix_length) != 0
+      || strcmp(topic + topic_length - suffix_length, POSITION_GEOHASH_TOPIC_SUFFIX) != 0)
+  {
+    return NULL;
+  }
+  /* The id is the last level before the suffix, ids can be a geohash character too. */
+  const char* levels = topic + prefix_length;
+  const char* end = topic + topic_length - suffix_length;
+  const char* id = end;
+  while (id > levels && id[-1] != '/')
+  {
+    id--;
+  }
+  size_t precision = (size_t)(id - levels) / 2;
+  if (id == end || precision == 0 || precision > POSITION_GEOHASH_MAX_PRECISION
+      || (size_t)(id - levels) != 2 * precision)
+  {
+    return NULL;
+  }
+  for (size_t i = 0; i < precision; i++)
+  {
+    if (!_is_base32(levels[2 * i]) || levels[2 * i + 1] != '/')
+    {
+      return NULL;
+    }
+  }
+  *length = end - id;
+  return id;
+}
+
+/* Covers the part of the box inside the cell of a geohash of a precision, given by its longitude
+ * and latitude bits: writes the geohash if the box holds its whole cell, else goes through its 32
+ * cells in the order of their characters. Cells of the precision of the cover that the box touches
+ * are written whole. */
+static void _cover_cell(cover_state* state, int precision, uint32_t x, uint32_t y)
+{
+  int x_shift = AXIS_BITS - _x_bits(precision);
+  int y_shift = AXIS_BITS - _y_bits(precision);
+  uint64_t min_x = (uint64_t)x << x_shift, max_x = ((uint64_t)(x + 1) << x_shift) - 1;
+  uint64_t min_y = (uint64_t)y << y_shift, max_y = ((uint64_t)(y + 1) << y_shift) - 1;
+
+  if (max_x < state->min_x || min_x > state->max_x || max_y < state->min_y || min_y > state->max_y)
+  {
+    return;
+  }
+  if (precision == state->precision
+      || (min_x >= state->min_x && max_x <= state->max_x && min_y >= state->min_y
+          && max_y <= state->max_y))
+  {
+    _write_geohash((uint32_t)min_x, (uint32_t)min_y, precision, state->cells[state->count++]);
+    return;
+  }
+  for (uint32_t character = 0; character < 32; character++)
+  {
+    uint32_t child_x = x, child_y = y;
+    /* Bit k of a geohash is a longitude bit when k is even. */
+    for (int bit = 0; bit < BITS_PER_CHARACTER; bit++)
+    {
+      uint32_t value = (character >> (BITS_PER_CHARACTER - 1 - bit)) & 1;
+      if ((BITS_PER_CHARACTER * precision + bit) % 2 == 0)
+      {
+        child_x = child_x << 1 | value;
+      }
+      else
+      {
+        child_y = child_y << 1 | value;
+      }
+    }
+    _cover_cell(state, precision + 1, child_x, child_y);
+  }
+}
+
+int position_geohash_cover(
+    geojson_coordinates min,
+    geojson_coordinates max,
+    int max_precision,
+    int max_cells,
+    char (*cells)[POSITION_GEOHASH_SIZE])
+{
+  if (!_position_is_valid(min) || !_position_is_valid(max) || min.x > max.x || min.y > max.y
+      || max_precision < 0 || max_precision > POSITION_GEOHASH_MAX_PRECISION || max_cells < 1
+      || cells == NULL)
+  {
+    return -1;
+  }
+  cover_state state = { .min_x = _quantize(min.x, -180, 360),
+                        .min_y = _quantize(min.y, -90, 180),
+                        .max_x = _quantize(max.x, -180, 360),
+                        .max_y = _quantize(max.y, -90, 180),
+                        .cells = cells,
+                        .count = 0 };
+
+  /* The finest precision whose cells touching the box are at most max_cells, counted from the range
+   * of cells on each axis. */
+  state.precision = 0;
+  for (int precision = 1; precision <= max_precision; precision++)
+  {
+    int x_shift = AXIS_BITS - _x_bits(precision);
+    int y_shift = AXIS_BITS - _y_bits(precision);
+    uint64_t columns = (state.max_x >> x_shift) - (state.min_x >> x_shift) + 1;
+    uint64_t rows = (state.max_y >> y_shift) - (state.min_y >> y_shift) + 1;
+    if (columns * rows > (uint64_t)max_cells)
+    {
+      break;
+    }
+    state.precision = precision;
+  }
+  _cover_cell(&state, 0, 0, 0);
+  return state.count;
+}
+
+int position_geohash_filter(const char* geohash, char* filter)
+{
+  const size_t prefix_length = sizeof(POSITION_GEOHASH_TOPIC_PREFIX) - 1;
+  size_t precision = geohash == NULL ? 0 : strlen(geohash);
+  if (geohash == NULL || precision > POSITION_GEOHASH_MAX_PRECISION)
+  {
+    return -1;
+  }
+  char* end = filter + prefix_length;
+  memcpy(filter, POSITION_GEOHASH_TOPIC_PREFIX, prefix_length);
+  for (size_t i = 0; i < precision; i++)
+  {
+    if (!_is_base32(geohash[i]))
+    {
+      return -1;
+    }
+    *end++ = geohash[i];
+    *end++ = '/';
+  }
+  *end++ = '#';
+  *end = '\0';
+  return (int)(end - filter);
+}
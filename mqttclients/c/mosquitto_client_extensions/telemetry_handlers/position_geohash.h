@@ -0,0 +1,105 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef POSITION_GEOHASH_H
+#define POSITION_GEOHASH_H
+
+#include "geo_json_handler.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Geohashes of positions, and the topics that partition positions by them, so the broker does the
+ * spatial filtering for consumers that only need a region.
+ *
+ * A geohash of precision p is the first 5 p bits of the longitude and latitude interleaved, the
+ * longitude first, written 5 bits per character in the geohash base 32. Each character cuts a cell
+ * into 32, and a geohash is a prefix of the geohashes of the positions inside its cell. Precision 5
+ * cells are about 4.9 km by 4.9 km at the equator, precision 6 about 1.2 km by 0.6 km.
+ *
+ * A position is published on vehicles/geo/<c1>/<c2>/.../<cp>/<vehicle id>/position, one topic level
+ * per character, so vehicles/geo/<c1>/.../<ck>/# receives the positions inside a cell of any
+ * precision k up to p.
+ */
+
+#define POSITION_GEOHASH_MAX_PRECISION 12
+/* The size of a geohash of any precision, with its null terminator. */
+#define POSITION_GEOHASH_SIZE (POSITION_GEOHASH_MAX_PRECISION + 1)
+#define POSITION_GEOHASH_TOPIC_PREFIX "vehicles/geo/"
+#define POSITION_GEOHASH_TOPIC_SUFFIX "/position"
+/* The size of the topic filter of a geohash of any precision, with its null terminator. */
+#define POSITION_GEOHASH_FILTER_SIZE \
+  (sizeof(POSITION_GEOHASH_TOPIC_PREFIX) + 2 * POSITION_GEOHASH_MAX_PRECISION + 1)
+
+/**
+ * @brief Writes the geohash of a position, interleaving the bits of its quantized longitude and
+ * latitude with shifts and masks rather than bisecting one bit at a time.
+ *
+ * @param position The position, a longitude from -180 to 180 and a latitude from -90 to 90
+ * @param precision The number of characters, from 1 to POSITION_GEOHASH_MAX_PRECISION
+ * @param geohash The array to write the null terminated geohash to, of at least precision + 1
+ * @return true on success, false if the position or the precision is out of range
+ */
+bool position_geohash_encode(geojson_coordinates position, int precision, char* geohash);
+
+/**
+ * @brief Writes the topic a vehicle publishes a position on,
+ * vehicles/geo/<c1>/.../<cp>/<id>/position.
+ *
+ * @param position The position
+ * @param precision The number of characters of its geohash, from 1 to
+ * POSITION_GEOHASH_MAX_PRECISION
+ * @param id The id of the vehicle, non-empty, without the / + # characters
+ * @param topic The array to write the null terminated topic to
+ * @param size The size of topic
+ * @return int The length of the topic, or -1 if an argument is invalid or the topic doesn't fit
+ */
+int position_geohash_topic(
+    geojson_coordinates position,
+    int precision,
+    const char* id,
+    char* topic,
+    size_t size);
+
+/**
+ * @brief Finds the vehicle id of a topic written by position_geohash_topic().
+ *
+ * @param topic The topic
+ * @param length Set to the length of the id
+ * @return const char* The start of the id in topic, not null terminated, or NULL if topic isn't a
+ * geohash position topic
+ */
+const char* position_geohash_topic_vehicle_id(const char* topic, size_t* length);
+
+/**
+ * @brief Finds the fewest geohashes whose cells cover a box, no finer than max_precision and no
+ * more than max_cells. The box is covered with the cells of the finest precision that takes at most
+ * max_cells of them, then every 32 cells filling a larger cell are replaced by it, so the cover is
+ * as tight as max_cells allows.
+ *
+ * @param min The south west corner of the box
+ * @param max The north east corner of the box, boxes across the antimeridian aren't supported
+ * @param max_precision The finest precision, the precision the producers publish with
+ * @param max_cells The size of cells, at least 1
+ * @param cells The array to write the geohashes to, in increasing order, an empty geohash when the
+ * cover is the whole world
+ * @return int The number of geohashes, or -1 if the box is invalid
+ */
+int position_geohash_cover(
+    geojson_coordinates min,
+    geojson_coordinates max,
+    int max_precision,
+    int max_cells,
+    char (*cells)[POSITION_GEOHASH_SIZE]);
+
+/**
+ * @brief Writes the topic filter of the positions inside the cell of a geohash,
+ * vehicles/geo/<c1>/.../<ck>/#.
+ *
+ * @param geohash The geohash, can be empty for the whole world
+ * @param filter The array to write the null terminated filter to, of POSITION_GEOHASH_FILTER_SIZE
+ * @return int The length of the filter, or -1 if the geohash is invalid
+ */
+int position_geohash_filter(const char* geohash, char* filter);
+
+#endif /* POSITION_GEOHASH_H */
@@ -0,0 +1,432 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logging.h"
+#include "position_grid.h"
+
+#define EARTH_RADIUS_METERS 6371008.8
+#define INITIAL_BUCKET_CAPACITY 4
+#define CELL_HASH_X 0x9e3779b97f4a7c15ull
+#define CELL_HASH_Y 0xc2b2ae3d27d4eb4full
+#define NO_BUCKET UINT32_MAX
+
+/* The vehicles of the cells hashed to a bucket. sequence is odd while the bucket is changed. */
+typedef struct grid_bucket
+{
+  uint32_t sequence;
+  uint32_t count;
+  uint32_t capacity;
+  uint32_t* vehicles;
+} grid_bucket;
+
+/* A bucket array replaced by a larger one, which queries may still be reading. */
+typedef struct retired_array
+{
+  struct retired_array* next;
+  uint32_t* vehicles;
+} retired_array;
+
+struct position_grid
+{
+  const position_store* store;
+  size_t max_vehicles;
+  double cell_degrees;
+  grid_bucket* buckets;
+  size_t bucket_count;
+  int shift;
+  /* Per vehicle, its bucket or NO_BUCKET, and its index in the bucket. Only used by the updating
+   * thread. */
+  uint32_t* bucket_of;
+  uint32_t* index_of;
+  retired_array* retired;
+};
+
+/* What a vehicle must match to be found by a query. */
+typedef struct grid_query
+{
+  geojson_coordinates min;
+  geojson_coordinates max;
+  /* When going through the buckets of cells, the vehicle must be in the cell being visited, so a
+   * vehicle in a bucket shared by several visited cells is only found once. */
+  bool by_cell;
+  int64_t cell_x;
+  int64_t cell_y;
+  /* For radius queries, the haversine of the radius, and the center and the cosine of its
+   * latitude. */
+  bool by_distance;
+  geojson_coordinates center;
+  double center_cos;
+  double max_haversine;
+} grid_query;
+
+static int64_t _cell(const position_grid* grid, double degrees)
+{
+  return isfinite(degrees) ? (int64_t)floor(degrees / grid->cell_degrees) : 0;
+}
+
+static size_t _bucket(const position_grid* grid, int64_t cell_x, int64_t cell_y)
+{
+  return (size_t)(((((uint64_t)cell_x * CELL_HASH_X) ^ (uint64_t)cell_y) * CELL_HASH_Y)
+                  >> grid->shift);
+}
+
+position_grid* position_grid_create(
+    const position_store* store,
+    size_t max_vehicles,
+    double cell_degrees)
+{
+  position_grid* grid = calloc(1, sizeof(position_grid));
+  size_t bucket_count = 16;
+  int bits = 4;
+
+  while (bucket_count < max_vehicles && max_vehicles <= INT32_MAX)
+  {
+    bucket_count *= 2;
+    bits++;
+  }
+  if (grid == NULL || store == NULL || max_vehicles == 0 || max_vehicles > INT32_MAX
+      || !(cell_degrees > 0 && cell_degrees <= 180)
+      || (grid->buckets = calloc(bucket_count, sizeof(grid_bucket))) == NULL
+      || (grid->bucket_of = malloc(max_vehicles * sizeof(uint32_t))) == NULL
+      || (grid->index_of = malloc(max_vehicles * sizeof(uint32_t))) == NULL)
+  {
+    LOG_ERROR("Failure creating a position grid for %zu vehicles", max_vehicles);
+    position_grid_destroy(grid);
+    return NULL;
+  }
+  memset(grid->bucket_of, 0xff, max_vehicles * sizeof(uint32_t));
+  grid->store = store;
+  grid->max_vehicles = max_vehicles;
+  grid->cell_degrees = cell_degrees;
+  grid->bucket_count = bucket_count;
+  grid->shift = 64 - bits;
+  return grid;
+}
+
+void position_grid_destroy(position_grid* grid)
+{
+  if (grid == NULL)
+  {
+    return;
+  }
+  while (grid->retired != NULL)
+  {
+    retired_array* next = grid->retired->next;
+    free(grid->retired->vehicles);
+    free(grid->retired);
+    grid->retired = next;
+  }
+  for (size_t i = 0; grid->buckets != NULL && i < grid->bucket_count; i++)
+  {
+    free(grid->buckets[i].vehicles);
+  }
+  free(grid->buckets);
+  free(grid->bucket_of);
+  free(grid->index_of);
+  free(grid);
+}
+
+static void _begin_change(grid_bucket* bucket)
+{
+  __atomic_store_n(&bucket->sequence, bucket->sequence + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void _end_change(grid_bucket* bucket)
+{
+  __atomic_store_n(&bucket->sequence, bucket->sequence + 1, __ATOMIC_RELEASE);
+}
+
+/* Replaces a full bucket array by one twice as large. The old array is retired rather than freed,
+ * as queries may still be reading it. */
+static bool _grow(position_grid* grid, grid_bucket* bucket)
+{
+  uint32_t capacity = bucket->capacity == 0 ? INITIAL_BUCKET_CAPACITY : bucket->capacity * 2;
+  uint32_t* vehicles = malloc(capacity * sizeof(uint32_t));
+  retired_array* retired = bucket->vehicles == NULL ? NULL : malloc(sizeof(retired_array));
+
+  if (vehicles == NULL || (bucket->vehicles != NULL && retired == NULL))
+  {
+    free(vehicles);
+    free(retired);
+    return false;
+  }
+  if (retired != NULL)
+  {
+    memcpy(vehicles, bucket->vehicles, bucket->count * sizeof(uint32_t));
+    retired->vehicles = bucket->vehicles;
+    retired->next = grid->retired;
+    grid->retired = retired;
+  }
+  /* Queries load the count before the array, so whatever count they see fits the array. */
+  __atomic_store_n(&bucket->vehicles, vehicles, __ATOMIC_RELEASE);
+  bucket->capacity = capacity;
+  return true;
+}
+
+/* Appends a vehicle to a bucket and outputs its index there. */
+static bool _add(position_grid* grid, size_t index, int vehicle, uint32_t* position)
+{
+  grid_bucket* bucket = &grid->buckets[index];
+  if (bucket->count == bucket->capacity && !_grow(grid, bucket))
+  {
+    return false;
+  }
+  *position = bucket->count;
+  _begin_change(bucket);
+  __atomic_store_n(&bucket->vehicles[*position], (uint32_t)vehicle, __ATOMIC_RELAXED);
+  __atomic_store_n(&bucket->count, bucket->count + 1, __ATOMIC_RELEASE);
+  _end_change(bucket);
+  return true;
+}
+
+/* Removes the vehicle at an index of a bucket by moving the last vehicle of the bucket there. */
+static void _remove(position_grid* grid, size_t index, uint32_t position)
+{
+  grid_bucket* bucket = &grid->buckets[index];
+  uint32_t last = bucket->vehicles[bucket->count - 1];
+
+  _begin_change(bucket);
+  __atomic_store_n(&bucket->vehicles[position], last, __ATOMIC_RELAXED);
+  __atomic_store_n(&bucket->count, bucket->count - 1, __ATOMIC_RELEASE);
+  _end_change(bucket);
+  grid->index_of[last] = position;
+}
+
+bool position_grid_update(position_grid* grid, int vehicle)
+{
+  if (vehicle < 0 || (size_t)vehicle >= grid->max_vehicles
+      || (size_t)vehicle >= position_store_count(grid->store))
+  {
+    LOG_ERROR("Failure updating the position grid: vehicle %d is out of range", vehicle);
+    return false;
+  }
+  geojson_coordinates coordinates = position_store_get(grid->store, vehicle);
+  size_t index = _bucket(grid, _cell(grid, coordinates.x), _cell(grid, coordinates.y));
+  uint32_t previous = grid->bucket_of[vehicle];
+  uint32_t position;
+
+  if (previous == index)
+  {
+    return true;
+  }
+  if (!_add(grid, index, vehicle, &position))
+  {
+    LOG_ERROR("Failure updating the position grid: out of memory");
+    return false;
+  }
+  if (previous != NO_BUCKET)
+  {
+    _remove(grid, previous, grid->index_of[vehicle]);
+  }
+  grid->bucket_of[vehicle] = (uint32_t)index;
+  grid->index_of[vehicle] = position;
+  return true;
+}
+
+/* Compares the haversine of the angle between the center and a position with the one of the
+ * radius, rather than the distances, to save the square root and arcsine of every vehicle. */
+static bool _matches(const position_grid* grid, const grid_query* query, uint32_t vehicle)
+{
+  const double radians = M_PI / 180;
+  geojson_coordinates position = position_store_get(grid->store, vehicle);
+
+  if (position.x < query->min.x || position.x > query->max.x || position.y < query->min.y
+      || position.y > query->max.y)
+  {
+    return false;
+  }
+  if (query->by_cell
+      && (_cell(grid, position.x) != query->cell_x || _cell(grid, position.y) != query->cell_y))
+  {
+    return false;
+  }
+  if (query->by_distance)
+  {
+    double sin_y = sin((position.y - query->center.y) * radians / 2);
+    double sin_x = sin((position.x - query->center.x) * radians / 2);
+    double haversine
+        = sin_y * sin_y + query->center_cos * cos(position.y * radians) * sin_x * sin_x;
+    return haversine <= query->max_haversine;
+  }
+  return true;
+}
+
+static int _output(int* vehicles, int max_count, int found, uint32_t vehicle)
+{
+  if (found < max_count)
+  {
+    vehicles[found] = (int)vehicle;
+  }
+  return found + 1;
+}
+
+/* Goes through the vehicles of a bucket, again from the start when the bucket changed meanwhile. */
+static int _query_bucket(
+    const position_grid* grid,
+    const grid_query* query,
+    const grid_bucket* bucket,
+    int* vehicles,
+    int max_count,
+    int found)
+{
+  int start = found;
+  uint32_t sequence;
+  do
+  {
+    found = start;
+    while (((sequence = __atomic_load_n(&bucket->sequence, __ATOMIC_ACQUIRE)) & 1) != 0)
+    {
+    }
+    uint32_t count = __atomic_load_n(&bucket->count, __ATOMIC_ACQUIRE);
+    const uint32_t* bucket_vehicles = __atomic_load_n(&bucket->vehicles, __ATOMIC_ACQUIRE);
+    for (uint32_t i = 0; i < count; i++)
+    {
+      uint32_t vehicle = __atomic_load_n(&bucket_vehicles[i], __ATOMIC_RELAXED);
+      if (vehicle < grid->max_vehicles && _matches(grid, query, vehicle))
+      {
+        found = _output(vehicles, max_count, found, vehicle);
+      }
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while (sequence != __atomic_load_n(&bucket->sequence, __ATOMIC_RELAXED));
+  return found;
+}
+
+static int _compare_vehicles(const void* a, const void* b)
+{
+  return *(const int*)a - *(const int*)b;
+}
+
+/* A vehicle moving to another cell while a query runs can be found in both its old and its new
+ * bucket. Sorting and removing duplicates is cheap for the vehicles within a few kilometers. */
+static int _unique(int* vehicles, int max_count, int found)
+{
+  if (found > max_count || found < 2)
+  {
+    return found;
+  }
+  qsort(vehicles, found, sizeof(int), _compare_vehicles);
+  int unique = 1;
+  for (int i = 1; i < found; i++)
+  {
+    if (vehicles[i] != vehicles[unique - 1])
+    {
+      vehicles[unique++] = vehicles[i];
+    }
+  }
+  return unique;
+}
+
+/* Visits the buckets of the cells of the query box, or the whole store when there are more cells
+ * than buckets. */
+static int _query(
+    const position_grid* grid,
+    grid_query* query,
+    int* vehicles,
+    int max_count,
+    int found)
+{
+  int64_t min_x = _cell(grid, query->min.x), max_x = _cell(grid, query->max.x);
+  int64_t min_y = _cell(grid, query->min.y), max_y = _cell(grid, query->max.y);
+
+  if ((double)(max_x - min_x + 1) * (double)(max_y - min_y + 1) > (double)grid->bucket_count)
+  {
+    size_t count = position_store_count(grid->store);
+    query->by_cell = false;
+    for (size_t vehicle = 0; vehicle < count; vehicle++)
+    {
+      if (_matches(grid, query, (uint32_t)vehicle))
+      {
+        found = _output(vehicles, max_count, found, (uint32_t)vehicle);
+      }
+    }
+    return found;
+  }
+
+  query->by_cell = true;
+  for (query->cell_y = min_y; query->cell_y <= max_y; query->cell_y++)
+  {
+    for (query->cell_x = min_x; query->cell_x <= max_x; query->cell_x++)
+    {
+      const grid_bucket* bucket = &grid->buckets[_bucket(grid, query->cell_x, query->cell_y)];
+      found = _query_bucket(grid, query, bucket, vehicles, max_count, found);
+    }
+  }
+  return found;
+}
+
+int position_grid_query_box(
+    const position_grid* grid,
+    geojson_coordinates min,
+    geojson_coordinates max,
+    int* vehicles,
+    int max_count)
+{
+  if (!isfinite(min.x) || !isfinite(min.y) || !isfinite(max.x) || !isfinite(max.y)
+      || min.x > max.x || min.y > max.y)
+  {
+    LOG_ERROR("Failure querying the position grid: invalid box");
+    return -1;
+  }
+  grid_query query = { .min = min, .max = max };
+  return _unique(vehicles, max_count, _query(grid, &query, vehicles, max_count, 0));
+}
+
+int position_grid_query_radius(
+    const position_grid* grid,
+    geojson_coordinates center,
+    double radius_meters,
+    int* vehicles,
+    int max_count)
+{
+  const double radians = M_PI / 180;
+  if (!isfinite(center.x) || !isfinite(center.y) || fabs(center.y) > 90
+      || !(radius_meters >= 0))
+  {
+    LOG_ERROR("Failure querying the position grid: invalid center or radius");
+    return -1;
+  }
+
+  /* The box around the circle. Its longitude range widens with the latitude, to all longitudes
+   * when the circle reaches a pole. */
+  double angle = fmin(radius_meters / EARTH_RADIUS_METERS, M_PI);
+  double y_degrees = angle / radians;
+  double x_degrees = fabs(center.y) + y_degrees >= 90
+      ? 180
+      : asin(fmin(sin(angle) / cos(center.y * radians), 1)) / radians;
+  double sin_half = sin(angle / 2);
+  grid_query query = { .min = { .x = fmax(center.x - x_degrees, -180), .y = center.y - y_degrees },
+                       .max = { .x = fmin(center.x + x_degrees, 180), .y = center.y + y_degrees },
+                       .by_distance = true,
+                       .center = center,
+                       .center_cos = cos(center.y * radians),
+                       .max_haversine = sin_half * sin_half };
+  if (x_degrees >= 180)
+  {
+    query.min.x = -180;
+    query.max.x = 180;
+  }
+  int found = _query(grid, &query, vehicles, max_count, 0);
+
+  /* The part of the box across the antimeridian, which can't overlap the rest of the box as it is
+   * less than 360 degrees wide. */
+  if (x_degrees < 180 && center.x - x_degrees < -180)
+  {
+    query.min.x = center.x - x_degrees + 360;
+    query.max.x = 180;
+    found = _query(grid, &query, vehicles, max_count, found);
+  }
+  else if (x_degrees < 180 && center.x + x_degrees > 180)
+  {
+    query.min.x = -180;
+    query.max.x = center.x + x_degrees - 360;
+    found = _query(grid, &query, vehicles, max_count, found);
+  }
+  return _unique(vehicles, max_count, found);
+}
@@ -0,0 +1,107 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef POSITION_GRID_H
+#define POSITION_GRID_H
+
+#include "geo_json_handler.h"
+#include "position_store.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * A spatial index over the vehicles of a position_store, to find the vehicles in a box or within a
+ * distance of a point without going through all of them.
+ *
+ * The world is cut into square cells of cell_degrees of longitude and latitude. Cells are hashed
+ * into a fixed number of buckets, each holding the numbers of the vehicles in its cells, so only
+ * the cells that hold vehicles use memory. A vehicle is moved from one bucket to another when an
+ * update takes it into a cell of another bucket; most updates stay in the same cell and only read
+ * the grid. A query goes through the buckets of the cells it covers and checks the last position
+ * of their vehicles in the store, or goes through the whole store when it covers more cells than
+ * there are buckets.
+ *
+ * Like the store, the grid is updated by one thread while any number of threads query it. Each
+ * bucket is changed under a sequence number that queries check, and read again when it changed.
+ * Bucket arrays that grow are kept until the grid is destroyed, so a query never reads freed
+ * memory. A vehicle that changes cells while a query runs may be missed by that query, and is
+ * found once otherwise.
+ */
+
+/* About 1.1 km of latitude. */
+#define POSITION_GRID_DEFAULT_CELL_DEGREES 0.01
+
+typedef struct position_grid position_grid;
+
+/**
+ * @brief Creates an empty grid over a store.
+ *
+ * @param store The store holding the positions of the vehicles, it must outlive the grid
+ * @param max_vehicles The most vehicles of the store, the grid has as many buckets rounded up to a
+ * power of 2
+ * @param cell_degrees The width and height of a cell, ex. POSITION_GRID_DEFAULT_CELL_DEGREES
+ * @return position_grid* The grid, or NULL on failure. It must be freed with
+ * position_grid_destroy().
+ */
+position_grid* position_grid_create(
+    const position_store* store,
+    size_t max_vehicles,
+    double cell_degrees);
+
+/**
+ * @brief Frees a grid. No thread may still be querying it.
+ *
+ * @param grid The grid to free, can be NULL
+ */
+void position_grid_destroy(position_grid* grid);
+
+/**
+ * @brief Adds a vehicle to the grid, or moves it to the bucket of its new position. Call it after
+ * every position_store_update() of the vehicle, from the same thread.
+ *
+ * @param grid The grid
+ * @param vehicle The number returned by position_store_update()
+ * @return true on success, false if the vehicle number is out of range or memory ran out
+ */
+bool position_grid_update(position_grid* grid, int vehicle);
+
+/**
+ * @brief Finds the vehicles in a box. Can be called from any thread, while the grid is updated.
+ *
+ * @param grid The grid
+ * @param min The west and south edges of the box
+ * @param max The east and north edges of the box, boxes across the antimeridian aren't supported
+ * @param vehicles The array to output the vehicle numbers to, in increasing order
+ * @param max_count The size of vehicles
+ * @return int The number of vehicles in the box, or -1 if the box is invalid. When it is more than
+ * max_count, only max_count vehicles were written, in no particular order, and vehicles that moved
+ * during the query may be counted twice.
+ */
+int position_grid_query_box(
+    const position_grid* grid,
+    geojson_coordinates min,
+    geojson_coordinates max,
+    int* vehicles,
+    int max_count);
+
+/**
+ * @brief Finds the vehicles within a distance of a point, measured along the surface of the Earth.
+ * Can be called from any thread, while the grid is updated.
+ *
+ * @param grid The grid
+ * @param center The point
+ * @param radius_meters The distance
+ * @param vehicles The array to output the vehicle numbers to, in increasing order
+ * @param max_count The size of vehicles
+ * @return int The number of vehicles within the distance, or -1 if the center or radius is
+ * invalid. When it is more than max_count, only max_count vehicles were written, in no particular
+ * order, and vehicles that moved during the query may be counted twice.
+ */
+int position_grid_query_radius(
+    const position_grid* grid,
+    geojson_coordinates center,
+    double radius_meters,
+    int* vehicles,
+    int max_count);
+
+#endif /* POSITION_GRID_H */
@@ -0,0 +1,483 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <emmintrin.h>
+#endif
+
+#include "logging.h"
+#include "position_kinematics.h"
+
+/* The positions of a batch are added this many at a time. */
+#define CHUNK_SIZE 64
+#define MAX_PANES 3600
+#define NANOSECONDS_PER_SECOND 1e9
+
+#if defined(__x86_64__)
+/* The Taylor series of the sine up to x^19, from the x^19 term down, accurate to 3e-16 for
+ * |x| <= pi / 2. */
+static const double SIN_COEFFICIENTS[] = {
+  -1.0 / 121645100408832000.0,
+  1.0 / 355687428096000.0,
+  -1.0 / 1307674368000.0,
+  1.0 / 6227020800.0,
+  -1.0 / 39916800.0,
+  1.0 / 362880.0,
+  -1.0 / 5040.0,
+  1.0 / 120.0,
+  -1.0 / 6.0,
+  1.0,
+};
+
+/* The rational approximation of the arctangent of Cephes, for |x| <= 0.66. */
+static const double ATAN_P[] = {
+  -8.750608600031904122785E-1, -1.615753718733365076637E1, -7.500855792314704667340E1,
+  -1.228866684490136173410E2,  -6.485021904942025371773E1,
+};
+static const double ATAN_Q[] = {
+  2.485846490142306297962E1, 1.650270098316988542046E2, 4.328810604912902668951E2,
+  4.853903996359136964868E2, 1.945506571482613964425E2,
+};
+/* pi / 2 - the double closest to it. */
+#define ATAN_MORE_BITS 6.123233995736765886130E-17
+#endif
+
+/* What a vehicle did during one pane. */
+typedef struct kinematics_pane
+{
+  double meters;
+  double seconds;
+  double max_speed_mps;
+  uint32_t fixes;
+} kinematics_pane;
+
+struct position_kinematics
+{
+  size_t max_vehicles;
+  uint64_t pane_ns;
+  int panes;
+  uint64_t last_ns;
+  /* Per vehicle, by number. times holds the time of the last position, 0 before the first one, and
+   * current_panes the number of the pane it was in, counted from time 0. */
+  double* x;
+  double* y;
+  uint64_t* times;
+  uint64_t* current_panes;
+  uint64_t* fixes;
+  double* total_meters;
+  double* speeds;
+  double* headings;
+  /* The panes of vehicle v are window[v * panes] to window[v * panes + panes - 1], pane p of the
+   * clock in window[v * panes + p % panes]. */
+  kinematics_pane* window;
+  /* The chunk of the batch being added: its segments and the time each one starts at. */
+  int chunk_vehicles[CHUNK_SIZE];
+  uint64_t chunk_times[CHUNK_SIZE];
+  double from_x[CHUNK_SIZE];
+  double from_y[CHUNK_SIZE];
+  double to_x[CHUNK_SIZE];
+  double to_y[CHUNK_SIZE];
+  double meters[CHUNK_SIZE];
+  double headings_out[CHUNK_SIZE];
+};
+
+/* Computes one segment with the functions of libm, for the segments that don't fill a pair. */
+static void _segment(
+    double from_x,
+    double from_y,
+    double to_x,
+    double to_y,
+    double* meters,
+    double* heading)
+{
+  const double radians = M_PI / 180;
+  double longitudes = to_x - from_x;
+  longitudes += (longitudes < -180) * 360.0 - (longitudes > 180) * 360.0;
+  double latitude_1 = from_y * radians;
+  double latitude_2 = to_y * radians;
+  double sin_latitudes = sin((to_y - from_y) * radians / 2);
+  double cos_latitudes = cos((to_y - from_y) * radians / 2);
+  double sin_longitudes = sin(longitudes * radians / 2);
+  double cos_longitudes = cos(longitudes * radians / 2);
+  double cos_2 = cos(latitude_2);
+  double squared = sin_longitudes * sin_longitudes;
+  double a = sin_latitudes * sin_latitudes + cos(latitude_1) * cos_2 * squared;
+
+  a = fmin(fmax(a, 0), 1);
+  *meters = 2 * POSITION_KINEMATICS_EARTH_RADIUS_METERS * atan2(sqrt(a), sqrt(1 - a));
+  /* The bearing, as in position_kinematics_segments(). */
+  double degrees = atan2(
+                       2 * sin_longitudes * cos_longitudes * cos_2,
+                       2 * (sin_latitudes * cos_latitudes + sin(latitude_1) * cos_2 * squared))
+      / radians;
+  degrees += (degrees < 0) * 360.0;
+  /* + 0 turns -0 into 0. */
+  *heading = degrees >= 360 || *meters == 0 ? 0 : degrees + 0.0;
+}
+
+#if defined(__x86_64__)
+static inline __m128d _select_pd(__m128d mask, __m128d if_set, __m128d if_clear)
+{
+  return _mm_or_pd(_mm_and_pd(mask, if_set), _mm_andnot_pd(mask, if_clear));
+}
+
+/* The sine of x, for |x| <= pi / 2. */
+static inline __m128d _sin_pd(__m128d x)
+{
+  __m128d square = _mm_mul_pd(x, x);
+  __m128d sum = _mm_set1_pd(SIN_COEFFICIENTS[0]);
+  for (size_t i = 1; i < sizeof(SIN_COEFFICIENTS) / sizeof(double); i++)
+  {
+    sum = _mm_add_pd(_mm_mul_pd(sum, square), _mm_set1_pd(SIN_COEFFICIENTS[i]));
+  }
+  return _mm_mul_pd(sum, x);
+}
+
+/* The cosine of x, for |x| <= pi / 2, as the sine of pi / 2 - |x|. */
+static inline __m128d _cos_pd(__m128d x)
+{
+  return _sin_pd(_mm_sub_pd(_mm_set1_pd(M_PI / 2), _mm_andnot_pd(_mm_set1_pd(-0.0), x)));
+}
+
+/* The arctangent of y / x in the quadrant of the point, from the arctangent of the smaller of |x|
+ * and |y| over the larger one. Arctangents of more than 0.66 are reduced to pi / 4 plus the
+ * arctangent of (t - 1) / (t + 1). */
+static inline __m128d _atan2_pd(__m128d y, __m128d x)
+{
+  __m128d sign = _mm_set1_pd(-0.0);
+  __m128d one = _mm_set1_pd(1.0);
+  __m128d abs_x = _mm_andnot_pd(sign, x);
+  __m128d abs_y = _mm_andnot_pd(sign, y);
+  __m128d steep = _mm_cmpgt_pd(abs_y, abs_x);
+  __m128d t = _mm_div_pd(
+      _mm_min_pd(abs_x, abs_y), _mm_max_pd(_mm_max_pd(abs_x, abs_y), _mm_set1_pd(DBL_MIN)));
+  __m128d reduce = _mm_cmpgt_pd(t, _mm_set1_pd(0.66));
+  __m128d z = _select_pd(reduce, _mm_div_pd(_mm_sub_pd(t, one), _mm_add_pd(t, one)), t);
+  __m128d square = _mm_mul_pd(z, z);
+  __m128d p = _mm_set1_pd(ATAN_P[0]);
+  __m128d q = _mm_add_pd(square, _mm_set1_pd(ATAN_Q[0]));
+  for (size_t i = 1; i < sizeof(ATAN_P) / sizeof(double); i++)
+  {
+    p = _mm_add_pd(_mm_mul_pd(p, square), _mm_set1_pd(ATAN_P[i]));
+    q = _mm_add_pd(_mm_mul_pd(q, square), _mm_set1_pd(ATAN_Q[i]));
+  }
+  __m128d r = _mm_add_pd(z, _mm_mul_pd(z, _mm_div_pd(_mm_mul_pd(square, p), q)));
+  r = _mm_add_pd(r, _mm_and_pd(reduce, _mm_set1_pd(0.5 * ATAN_MORE_BITS)));
+  r = _mm_add_pd(r, _mm_and_pd(reduce, _mm_set1_pd(M_PI / 4)));
+  r = _select_pd(
+      steep, _mm_add_pd(_mm_sub_pd(_mm_set1_pd(M_PI / 2), r), _mm_set1_pd(ATAN_MORE_BITS)), r);
+  r = _select_pd(_mm_cmplt_pd(x, _mm_setzero_pd()), _mm_sub_pd(_mm_set1_pd(M_PI), r), r);
+  return _mm_or_pd(r, _mm_and_pd(sign, y));
+}
+#endif
+
+void position_kinematics_segments(
+    const double* from_x,
+    const double* from_y,
+    const double* to_x,
+    const double* to_y,
+    int count,
+    double* meters,
+    double* headings)
+{
+  int i = 0;
+
+#if defined(__x86_64__)
+  const __m128d radians = _mm_set1_pd(M_PI / 180);
+  const __m128d half_circle = _mm_set1_pd(180.0);
+  const __m128d circle = _mm_set1_pd(360.0);
+  const __m128d zero = _mm_setzero_pd();
+  const __m128d one = _mm_set1_pd(1.0);
+  for (; i + 1 < count; i += 2)
+  {
+    __m128d longitudes = _mm_sub_pd(_mm_loadu_pd(to_x + i), _mm_loadu_pd(from_x + i));
+    longitudes = _mm_add_pd(
+        longitudes,
+        _mm_sub_pd(
+            _mm_and_pd(_mm_cmplt_pd(longitudes, _mm_sub_pd(zero, half_circle)), circle),
+            _mm_and_pd(_mm_cmpgt_pd(longitudes, half_circle), circle)));
+    __m128d from_latitudes = _mm_loadu_pd(from_y + i);
+    __m128d to_latitudes = _mm_loadu_pd(to_y + i);
+    __m128d latitude_1 = _mm_mul_pd(from_latitudes, radians);
+    __m128d latitude_2 = _mm_mul_pd(to_latitudes, radians);
+    /* The differences are taken in degrees, where they are exact for close positions. */
+    __m128d half_longitudes = _mm_mul_pd(longitudes, _mm_set1_pd(M_PI / 360));
+    __m128d half_latitudes
+        = _mm_mul_pd(_mm_sub_pd(to_latitudes, from_latitudes), _mm_set1_pd(M_PI / 360));
+    __m128d sin_latitudes = _sin_pd(half_latitudes);
+    __m128d cos_latitudes = _cos_pd(half_latitudes);
+    __m128d sin_longitudes = _sin_pd(half_longitudes);
+    __m128d cos_longitudes = _cos_pd(half_longitudes);
+    __m128d cos_1 = _cos_pd(latitude_1);
+    __m128d cos_2 = _cos_pd(latitude_2);
+    __m128d sin_longitudes_squared = _mm_mul_pd(sin_longitudes, sin_longitudes);
+    __m128d a = _mm_add_pd(
+        _mm_mul_pd(sin_latitudes, sin_latitudes),
+        _mm_mul_pd(_mm_mul_pd(cos_1, cos_2), sin_longitudes_squared));
+    a = _mm_min_pd(_mm_max_pd(a, zero), one);
+    __m128d length = _mm_mul_pd(
+        _mm_set1_pd(2 * POSITION_KINEMATICS_EARTH_RADIUS_METERS),
+        _atan2_pd(_mm_sqrt_pd(a), _mm_sqrt_pd(_mm_sub_pd(one, a))));
+
+    /* The bearing is the arctangent of sin(dlon) cos(lat2) over cos(lat1) sin(lat2) - sin(lat1)
+     * cos(lat2) cos(dlon), computed as sin(dlat) + 2 sin(lat1) cos(lat2) sin(dlon / 2)^2, without
+     * the cancellation of the first form along short segments. east and north are halved. */
+    __m128d east = _mm_mul_pd(_mm_mul_pd(sin_longitudes, cos_longitudes), cos_2);
+    __m128d north = _mm_add_pd(
+        _mm_mul_pd(sin_latitudes, cos_latitudes),
+        _mm_mul_pd(_mm_mul_pd(_sin_pd(latitude_1), cos_2), sin_longitudes_squared));
+    __m128d degrees = _mm_div_pd(_atan2_pd(east, north), radians);
+    degrees = _mm_add_pd(degrees, _mm_and_pd(_mm_cmplt_pd(degrees, zero), circle));
+    degrees = _mm_andnot_pd(
+        _mm_or_pd(_mm_cmpge_pd(degrees, circle), _mm_cmpeq_pd(length, zero)), degrees);
+    _mm_storeu_pd(meters + i, length);
+    _mm_storeu_pd(headings + i, _mm_add_pd(degrees, zero));
+  }
+#endif
+  for (; i < count; i++)
+  {
+    _segment(from_x[i], from_y[i], to_x[i], to_y[i], &meters[i], &headings[i]);
+  }
+}
+
+position_kinematics* position_kinematics_create(
+    size_t max_vehicles,
+    uint64_t window_ns,
+    int panes)
+{
+  position_kinematics* kinematics = calloc(1, sizeof(position_kinematics));
+
+  if (kinematics == NULL || max_vehicles == 0 || max_vehicles > INT32_MAX || panes < 1
+      || panes > MAX_PANES || window_ns == 0 || window_ns % panes != 0
+      || (kinematics->x = calloc(max_vehicles, sizeof(double))) == NULL
+      || (kinematics->y = calloc(max_vehicles, sizeof(double))) == NULL
+      || (kinematics->times = calloc(max_vehicles, sizeof(uint64_t))) == NULL
+      || (kinematics->current_panes = calloc(max_vehicles, sizeof(uint64_t))) == NULL
+      || (kinematics->fixes = calloc(max_vehicles, sizeof(uint64_t))) == NULL
+      || (kinematics->total_meters = calloc(max_vehicles, sizeof(double))) == NULL
+      || (kinematics->speeds = calloc(max_vehicles, sizeof(double))) == NULL
+      || (kinematics->headings = calloc(max_vehicles, sizeof(double))) == NULL
+      || (kinematics->window = calloc(max_vehicles * panes, sizeof(kinematics_pane))) == NULL)
+  {
+    LOG_ERROR(
+        "Failure creating the kinematics of %zu vehicles over %d panes of %llu ns",
+        max_vehicles,
+        panes,
+        (unsigned long long)window_ns);
+    position_kinematics_destroy(kinematics);
+    return NULL;
+  }
+  kinematics->max_vehicles = max_vehicles;
+  kinematics->pane_ns = window_ns / panes;
+  kinematics->panes = panes;
+  return kinematics;
+}
+
+void position_kinematics_destroy(position_kinematics* kinematics)
+{
+  if (kinematics != NULL)
+  {
+    free(kinematics->x);
+    free(kinematics->y);
+    free(kinematics->times);
+    free(kinematics->current_panes);
+    free(kinematics->fixes);
+    free(kinematics->total_meters);
+    free(kinematics->speeds);
+    free(kinematics->headings);
+    free(kinematics->window);
+    free(kinematics);
+  }
+}
+
+/* Summarizes the window ending with the current pane of a vehicle, then moves the vehicle to a
+ * later pane, clearing the panes in between. */
+static void _end_window(
+    position_kinematics* kinematics,
+    int vehicle,
+    uint64_t pane,
+    position_kinematics_handler handler,
+    void* context)
+{
+  kinematics_pane* window = kinematics->window + (size_t)vehicle * kinematics->panes;
+  uint64_t current = kinematics->current_panes[vehicle];
+  uint64_t panes = kinematics->panes;
+  double seconds = 0;
+  position_kinematics_summary summary = { 0 };
+
+  for (int i = 0; i < kinematics->panes; i++)
+  {
+    summary.fixes += window[i].fixes;
+    summary.meters += window[i].meters;
+    summary.max_speed_mps = fmax(summary.max_speed_mps, window[i].max_speed_mps);
+    seconds += window[i].seconds;
+  }
+  summary.start_ns = (current + 1 > panes ? current + 1 - panes : 0) * kinematics->pane_ns;
+  summary.end_ns = (current + 1) * kinematics->pane_ns;
+  summary.mean_speed_mps = seconds > 0 ? summary.meters / seconds : 0;
+  summary.heading_degrees = kinematics->headings[vehicle];
+  if (handler != NULL)
+  {
+    handler(vehicle, &summary, context);
+  }
+
+  uint64_t cleared = pane - current < panes ? pane - current : panes;
+  for (uint64_t i = 1; i <= cleared; i++)
+  {
+    memset(&window[(current + i) % panes], 0, sizeof(kinematics_pane));
+  }
+  kinematics->current_panes[vehicle] = pane;
+}
+
+/* Adds segment i of the chunk to its vehicle, and to the pane of now_ns. */
+static void _add_segment(
+    position_kinematics* kinematics,
+    int i,
+    uint64_t now_ns,
+    position_kinematics_handler handler,
+    void* context)
+{
+  int vehicle = kinematics->chunk_vehicles[i];
+  uint64_t previous_ns = kinematics->chunk_times[i];
+  uint64_t pane = now_ns / kinematics->pane_ns;
+
+  if (previous_ns == 0)
+  {
+    kinematics->current_panes[vehicle] = pane;
+  }
+  else if (pane > kinematics->current_panes[vehicle])
+  {
+    _end_window(kinematics, vehicle, pane, handler, context);
+  }
+
+  kinematics_pane* slot
+      = &kinematics->window[(size_t)vehicle * kinematics->panes + pane % kinematics->panes];
+  if (previous_ns != 0)
+  {
+    double meters = kinematics->meters[i];
+    double seconds = (now_ns - previous_ns) / NANOSECONDS_PER_SECOND;
+    slot->meters += meters;
+    kinematics->total_meters[vehicle] += meters;
+    /* A vehicle repeated in a batch has segments taking no time, their length is added to the
+     * speed of the segment that took the time since the previous batch. */
+    if (seconds > 0)
+    {
+      double speed = meters / seconds;
+      kinematics->speeds[vehicle] = speed;
+      slot->seconds += seconds;
+      slot->max_speed_mps = fmax(slot->max_speed_mps, speed);
+    }
+    if (meters > 0)
+    {
+      kinematics->headings[vehicle] = kinematics->headings_out[i];
+    }
+  }
+  slot->fixes++;
+  kinematics->fixes[vehicle]++;
+}
+
+static bool _position_is_valid(
+    const position_kinematics* kinematics,
+    int vehicle,
+    double x,
+    double y)
+{
+  return vehicle >= 0 && (size_t)vehicle < kinematics->max_vehicles && x >= -180 && x <= 180
+      && y >= -90 && y <= 90;
+}
+
+int position_kinematics_update(
+    position_kinematics* kinematics,
+    const int* vehicles,
+    const double* x,
+    const double* y,
+    int count,
+    uint64_t now_ns,
+    position_kinematics_handler handler,
+    void* context)
+{
+  int added = 0;
+
+  if (kinematics == NULL || count < 0 || now_ns == 0
+      || (count > 0 && (vehicles == NULL || x == NULL || y == NULL)))
+  {
+    return -1;
+  }
+  if (now_ns < kinematics->last_ns)
+  {
+    now_ns = kinematics->last_ns;
+  }
+  kinematics->last_ns = now_ns;
+
+  while (added < count)
+  {
+    int chunk = 0;
+    bool valid = true;
+
+    /* The new position is stored right away, so a vehicle repeated in the chunk starts its next
+     * segment from it. */
+    for (; chunk < CHUNK_SIZE && added + chunk < count; chunk++)
+    {
+      int i = added + chunk;
+      int vehicle = vehicles[i];
+      if (!_position_is_valid(kinematics, vehicle, x[i], y[i]))
+      {
+        valid = false;
+        break;
+      }
+      kinematics->chunk_vehicles[chunk] = vehicle;
+      kinematics->chunk_times[chunk] = kinematics->times[vehicle];
+      kinematics->from_x[chunk] = kinematics->x[vehicle];
+      kinematics->from_y[chunk] = kinematics->y[vehicle];
+      kinematics->to_x[chunk] = kinematics->x[vehicle] = x[i];
+      kinematics->to_y[chunk] = kinematics->y[vehicle] = y[i];
+      kinematics->times[vehicle] = now_ns;
+    }
+
+    /* The first position of a vehicle has no segment, it is computed from whatever was stored and
+     * ignored. */
+    position_kinematics_segments(
+        kinematics->from_x,
+        kinematics->from_y,
+        kinematics->to_x,
+        kinematics->to_y,
+        chunk,
+        kinematics->meters,
+        kinematics->headings_out);
+    for (int i = 0; i < chunk; i++)
+    {
+      _add_segment(kinematics, i, now_ns, handler, context);
+    }
+    added += chunk;
+
+    if (!valid)
+    {
+      LOG_ERROR("Invalid position %d of vehicle %d", added, vehicles[added]);
+      return -1;
+    }
+  }
+  return added;
+}
+
+bool position_kinematics_get(
+    const position_kinematics* kinematics,
+    int vehicle,
+    position_kinematics_state* output)
+{
+  if (vehicle < 0 || (size_t)vehicle >= kinematics->max_vehicles
+      || kinematics->times[vehicle] == 0)
+  {
+    return false;
+  }
+  output->fixes = kinematics->fixes[vehicle];
+  output->total_meters = kinematics->total_meters[vehicle];
+  output->speed_mps = kinematics->speeds[vehicle];
+  output->heading_degrees = kinematics->headings[vehicle];
+  return true;
+}
@@ -0,0 +1,159 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef POSITION_KINEMATICS_H
+#define POSITION_KINEMATICS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * The distance, speed and heading of every vehicle, computed from its consecutive positions as
+ * they are received, with summaries over tumbling or sliding windows.
+ *
+ * Positions are handled in batches, ex. the messages of one poll of the message ring: the previous
+ * position of each vehicle is gathered, then the distance and heading of every segment of the
+ * batch are computed at once with position_kinematics_segments(), then added to the vehicles.
+ * Positions carry no time, so all the positions of a batch are given the time it was received at:
+ * a vehicle's speed is the length of its last segment over the time since its previous batch.
+ *
+ * A window is made of panes of window_ns / panes nanoseconds, aligned to multiples of their length.
+ * With one pane the windows are tumbling; with more, a window slides by one pane at a time. When
+ * the first position of a vehicle in a new pane arrives, the window ending with the vehicle's
+ * previous pane is summarized and passed to the handler. A vehicle that stops sending has no
+ * summary until it sends again.
+ *
+ * All the functions must be called from one thread, ex. the event loop thread handling the
+ * messages.
+ */
+
+/* The radius of the Earth used by the haversine formula, in meters. */
+#define POSITION_KINEMATICS_EARTH_RADIUS_METERS 6371008.8
+
+typedef struct position_kinematics position_kinematics;
+
+/* What a vehicle did during a window. */
+typedef struct position_kinematics_summary
+{
+  /* The window, from start_ns included to end_ns excluded, in the time of the batches. */
+  uint64_t start_ns;
+  uint64_t end_ns;
+  /* The positions received during the window. */
+  uint32_t fixes;
+  /* The length of the segments ending during the window. */
+  double meters;
+  /* meters over the time those segments took, 0 if they took none. */
+  double mean_speed_mps;
+  double max_speed_mps;
+  /* The heading of the last segment that moved, in degrees clockwise from north. */
+  double heading_degrees;
+} position_kinematics_summary;
+
+/* The last known kinematics of a vehicle. */
+typedef struct position_kinematics_state
+{
+  uint64_t fixes;
+  double total_meters;
+  double speed_mps;
+  double heading_degrees;
+} position_kinematics_state;
+
+/**
+ * @brief Called for each window summary of a vehicle.
+ *
+ * @param vehicle The number of the vehicle
+ * @param summary The summary of its last window
+ * @param context The context passed to position_kinematics_update()
+ */
+typedef void (*position_kinematics_handler)(
+    int vehicle,
+    const position_kinematics_summary* summary,
+    void* context);
+
+/**
+ * @brief Computes the length and heading of segments along the surface of the Earth, with the
+ * haversine formula for the length and the initial bearing for the heading. The segments are
+ * computed two at a time with SSE2, with polynomial sines and arctangents accurate to about 1e-15.
+ *
+ * @param from_x The longitudes of the starts of the segments, in degrees from -180 to 180
+ * @param from_y The latitudes of the starts of the segments, in degrees from -90 to 90
+ * @param to_x The longitudes of the ends of the segments, in degrees from -180 to 180
+ * @param to_y The latitudes of the ends of the segments, in degrees from -90 to 90
+ * @param count The number of segments
+ * @param meters The array to output the lengths to, in meters
+ * @param headings The array to output the headings to, in degrees clockwise from north in [0, 360),
+ * 0 for a segment of length 0
+ */
+void position_kinematics_segments(
+    const double* from_x,
+    const double* from_y,
+    const double* to_x,
+    const double* to_y,
+    int count,
+    double* meters,
+    double* headings);
+
+/**
+ * @brief Creates the kinematics of max_vehicles vehicles, without any position yet.
+ *
+ * @param max_vehicles The number of vehicles, numbered from 0, ex. by a position_store
+ * @param window_ns The length of a window, a multiple of panes
+ * @param panes The number of panes a window slides by, 1 for tumbling windows
+ * @return position_kinematics* The kinematics, or NULL on failure. It must be freed with
+ * position_kinematics_destroy().
+ */
+position_kinematics* position_kinematics_create(
+    size_t max_vehicles,
+    uint64_t window_ns,
+    int panes);
+
+/**
+ * @brief Frees the kinematics of the vehicles.
+ *
+ * @param kinematics The kinematics to free, can be NULL
+ */
+void position_kinematics_destroy(position_kinematics* kinematics);
+
+/**
+ * @brief Adds a batch of positions, in the order they were received, calling handler for each
+ * window that ends.
+ *
+ * @param kinematics The kinematics
+ * @param vehicles The number of the vehicle of each position, a vehicle can be repeated
+ * @param x The longitudes of the positions, in degrees
+ * @param y The latitudes of the positions, in degrees
+ * @param count The number of positions
+ * @param now_ns The time the batch was received, greater than 0, ex. the CLOCK_REALTIME in
+ * nanoseconds so windows are aligned to the clock. A time before the time of the previous batch is
+ * taken as that time.
+ * @param handler Called for each window summary, can be NULL
+ * @param context Passed to handler
+ * @return int The number of positions added, or -1 if now_ns is 0, a vehicle number is out of range
+ * or a position isn't a longitude and latitude in degrees. Positions before the invalid one are
+ * added.
+ */
+int position_kinematics_update(
+    position_kinematics* kinematics,
+    const int* vehicles,
+    const double* x,
+    const double* y,
+    int count,
+    uint64_t now_ns,
+    position_kinematics_handler handler,
+    void* context);
+
+/**
+ * @brief Reads the last known kinematics of a vehicle.
+ *
+ * @param kinematics The kinematics
+ * @param vehicle The number of the vehicle
+ * @param output The state to output to
+ * @return true if the vehicle has a position, false otherwise
+ */
+bool position_kinematics_get(
+    const position_kinematics* kinematics,
+    int vehicle,
+    position_kinematics_state* output);
+
+#endif /* POSITION_KINEMATICS_H */
@@ -0,0 +1,261 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "logging.h"
+#include "mqtt_hash.h"
+#include "position_store.h"
+
+#define FIBONACCI_MULTIPLIER 0x9e3779b97f4a7c15ull
+#define ID_BLOCK_SIZE 65536
+
+/* A block of interned ids, each null terminated. Blocks are only freed with the store. */
+typedef struct id_block
+{
+  struct id_block* next;
+  size_t used;
+  char ids[ID_BLOCK_SIZE];
+} id_block;
+
+/* An entry of the index. key holds the hash of the id in its high 32 bits and the vehicle number
+ * + 1 in its low 32 bits, 0 when the entry is empty. The id is in the entry, rather than only in
+ * the vehicle arrays, so comparing it doesn't wait for one more cache miss. */
+typedef struct index_entry
+{
+  uint64_t key;
+  const char* id;
+} index_entry;
+
+struct position_store
+{
+  /* The index, kept at most 3/4 full. */
+  index_entry* entries;
+  size_t mask;
+  int shift;
+  size_t max_vehicles;
+  /* Written by the updating thread, published with release stores. */
+  size_t count;
+  /* Per vehicle, by number. sequence is odd while the vehicle's position is being written. */
+  const char** ids;
+  double* x;
+  double* y;
+  uint32_t* sequence;
+  id_block* blocks;
+};
+
+/* Spreads the hash over the whole table with a multiply, so ids differing in their last characters
+ * don't land in neighbouring entries. */
+static size_t _home(const position_store* store, uint32_t hash)
+{
+  return (size_t)((hash * FIBONACCI_MULTIPLIER) >> store->shift);
+}
+
+static bool _same_id(const char* interned, const char* id, size_t length)
+{
+  return memcmp(interned, id, length) == 0 && interned[length] == '\0';
+}
+
+/* Returns the number of the vehicle with this id, or -1 with the empty entry where it would go. */
+static int _probe(
+    const position_store* store,
+    uint32_t hash,
+    const char* id,
+    size_t length,
+    size_t* empty)
+{
+  for (size_t i = _home(store, hash);; i = (i + 1) & store->mask)
+  {
+    uint64_t key = __atomic_load_n(&store->entries[i].key, __ATOMIC_ACQUIRE);
+    if (key == 0)
+    {
+      *empty = i;
+      return -1;
+    }
+    if ((uint32_t)(key >> 32) == hash && _same_id(store->entries[i].id, id, length))
+    {
+      return (int)(uint32_t)key - 1;
+    }
+  }
+}
+
+/* Copies an id into the current block, starting a new one when it is full. */
+static const char* _intern(position_store* store, const char* id, size_t length)
+{
+  id_block* block = store->blocks;
+  if (block == NULL || block->used + length + 1 > ID_BLOCK_SIZE)
+  {
+    if ((block = malloc(sizeof(id_block))) == NULL)
+    {
+      return NULL;
+    }
+    block->next = store->blocks;
+    block->used = 0;
+    store->blocks = block;
+  }
+  char* interned = block->ids + block->used;
+  memcpy(interned, id, length);
+  interned[length] = '\0';
+  block->used += length + 1;
+  return interned;
+}
+
+position_store* position_store_create(size_t max_vehicles)
+{
+  position_store* store = calloc(1, sizeof(position_store));
+  size_t capacity = 16;
+  int bits = 4;
+
+  while (capacity / 4 * 3 < max_vehicles && max_vehicles <= INT32_MAX)
+  {
+    capacity *= 2;
+    bits++;
+  }
+  if (store == NULL || max_vehicles == 0 || max_vehicles > INT32_MAX
+      || (store->entries = calloc(capacity, sizeof(index_entry))) == NULL
+      || (store->ids = malloc(max_vehicles * sizeof(const char*))) == NULL
+      || (store->x = malloc(max_vehicles * sizeof(double))) == NULL
+      || (store->y = malloc(max_vehicles * sizeof(double))) == NULL
+      || (store->sequence = malloc(max_vehicles * sizeof(uint32_t))) == NULL)
+  {
+    LOG_ERROR("Failure creating a position store for %zu vehicles", max_vehicles);
+    position_store_destroy(store);
+    return NULL;
+  }
+  store->mask = capacity - 1;
+  store->shift = 64 - bits;
+  store->max_vehicles = max_vehicles;
+  return store;
+}
+
+void position_store_destroy(position_store* store)
+{
+  if (store == NULL)
+  {
+    return;
+  }
+  while (store->blocks != NULL)
+  {
+    id_block* next = store->blocks->next;
+    free(store->blocks);
+    store->blocks = next;
+  }
+  free(store->entries);
+  free(store->ids);
+  free(store->x);
+  free(store->y);
+  free(store->sequence);
+  free(store);
+}
+
+const char* position_store_topic_vehicle_id(const char* topic, size_t* length)
+{
+  const size_t prefix_length = sizeof(POSITION_STORE_TOPIC_PREFIX) - 1;
+  if (topic == NULL || strncmp(topic, POSITION_STORE_TOPIC_PREFIX, prefix_length) != 0)
+  {
+    return NULL;
+  }
+  const char* id = topic + prefix_length;
+  const char* end = strchr(id, '/');
+  if (end == NULL || end == id || strcmp(end, POSITION_STORE_TOPIC_SUFFIX) != 0)
+  {
+    return NULL;
+  }
+  *length = end - id;
+  return id;
+}
+
+int position_store_update(
+    position_store* store,
+    const char* id,
+    size_t length,
+    geojson_coordinates coordinates)
+{
+  size_t empty = 0;
+  if (length > POSITION_STORE_MAX_ID_LENGTH)
+  {
+    return -1;
+  }
+  uint32_t hash = mqtt_hash_bytes(id, length);
+  int vehicle = _probe(store, hash, id, length, &empty);
+
+  if (vehicle >= 0)
+  {
+    /* Readers that start while the sequence is odd, or see it change, read again. */
+    uint32_t sequence = store->sequence[vehicle];
+    __atomic_store_n(&store->sequence[vehicle], sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store(&store->x[vehicle], &coordinates.x, __ATOMIC_RELAXED);
+    __atomic_store(&store->y[vehicle], &coordinates.y, __ATOMIC_RELAXED);
+    __atomic_store_n(&store->sequence[vehicle], sequence + 2, __ATOMIC_RELEASE);
+    return vehicle;
+  }
+
+  const char* interned;
+  if (store->count == store->max_vehicles || (interned = _intern(store, id, length)) == NULL)
+  {
+    return -1;
+  }
+  /* Nothing reads a new vehicle before the release stores below publish it. */
+  vehicle = (int)store->count;
+  store->ids[vehicle] = interned;
+  store->x[vehicle] = coordinates.x;
+  store->y[vehicle] = coordinates.y;
+  store->sequence[vehicle] = 0;
+  store->entries[empty].id = interned;
+  __atomic_store_n(
+      &store->entries[empty].key, (uint64_t)hash << 32 | (uint32_t)(vehicle + 1), __ATOMIC_RELEASE);
+  __atomic_store_n(&store->count, store->count + 1, __ATOMIC_RELEASE);
+  return vehicle;
+}
+
+int position_store_find(const position_store* store, const char* id, size_t length)
+{
+  size_t empty = 0;
+  if (length > POSITION_STORE_MAX_ID_LENGTH)
+  {
+    return -1;
+  }
+  return _probe(store, mqtt_hash_bytes(id, length), id, length, &empty);
+}
+
+bool position_store_lookup(
+    const position_store* store,
+    const char* id,
+    size_t length,
+    geojson_coordinates* output)
+{
+  int vehicle = position_store_find(store, id, length);
+  if (vehicle < 0)
+  {
+    return false;
+  }
+  *output = position_store_get(store, vehicle);
+  return true;
+}
+
+size_t position_store_count(const position_store* store)
+{
+  return __atomic_load_n(&store->count, __ATOMIC_ACQUIRE);
+}
+
+geojson_coordinates position_store_get(const position_store* store, size_t vehicle)
+{
+  geojson_coordinates coordinates;
+  uint32_t sequence;
+  do
+  {
+    sequence = __atomic_load_n(&store->sequence[vehicle], __ATOMIC_ACQUIRE);
+    __atomic_load(&store->x[vehicle], &coordinates.x, __ATOMIC_RELAXED);
+    __atomic_load(&store->y[vehicle], &coordinates.y, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while ((sequence & 1) != 0
+           || sequence != __atomic_load_n(&store->sequence[vehicle], __ATOMIC_RELAXED));
+  return coordinates;
+}
+
+const char* position_store_id(const position_store* store, size_t vehicle)
+{
+  return store->ids[vehicle];
+}
@@ -0,0 +1,131 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef POSITION_STORE_H
+#define POSITION_STORE_H
+
+#include "geo_json_handler.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * The last known position of every vehicle, keyed by the vehicle id of its telemetry topic
+ * (vehicles/<id>/position).
+ *
+ * Vehicles are numbered in the order they are first seen. Their ids are interned, copied once into
+ * shared blocks, and their coordinates are kept in one array per field indexed by that number. An
+ * open addressing index of 16 byte entries, each the hash of an id, its vehicle number and its
+ * interned id, maps ids to numbers: a lookup reads a few neighbouring entries, then the id and the
+ * coordinates, which don't depend on each other. The capacity is fixed when the store is created:
+ * nothing ever moves, so no lock is needed.
+ *
+ * One thread updates the store, ex. the event loop thread handling the messages, while any number
+ * of threads look positions up. A new vehicle is published once its id and first position are
+ * written, and each position is written under a sequence number that readers check, and retry on
+ * when the writer was halfway through, so a reader never sees the x of one update with the y of
+ * another.
+ */
+
+#define POSITION_STORE_TOPIC_PREFIX "vehicles/"
+#define POSITION_STORE_TOPIC_SUFFIX "/position"
+/* The longest vehicle id, longer ones are not stored. */
+#define POSITION_STORE_MAX_ID_LENGTH 255
+
+typedef struct position_store position_store;
+
+/**
+ * @brief Creates an empty store.
+ *
+ * @param max_vehicles The most vehicles the store holds, at most INT32_MAX. The index is sized for
+ * this many vehicles up front.
+ * @return position_store* The store, or NULL on failure. It must be freed with
+ * position_store_destroy().
+ */
+position_store* position_store_create(size_t max_vehicles);
+
+/**
+ * @brief Frees a store. No thread may still be reading it.
+ *
+ * @param store The store to free, can be NULL
+ */
+void position_store_destroy(position_store* store);
+
+/**
+ * @brief Finds the vehicle id of a telemetry topic, without copying it.
+ *
+ * @param topic A topic like vehicles/<id>/position
+ * @param length Outputs the length of the id
+ * @return const char* The start of the id in topic, or NULL if topic isn't a position topic
+ */
+const char* position_store_topic_vehicle_id(const char* topic, size_t* length);
+
+/**
+ * @brief Sets the last position of a vehicle, adding the vehicle the first time its id is seen.
+ * Must only be called from one thread at a time.
+ *
+ * @param store The store
+ * @param id The vehicle id, doesn't need to be null terminated
+ * @param length The length of id
+ * @param coordinates The position of the vehicle
+ * @return int The number of the vehicle, or -1 if the id is too long or the store is full
+ */
+int position_store_update(
+    position_store* store,
+    const char* id,
+    size_t length,
+    geojson_coordinates coordinates);
+
+/**
+ * @brief Finds the number of a vehicle. Can be called from any thread, while the store is updated.
+ *
+ * @param store The store
+ * @param id The vehicle id, doesn't need to be null terminated
+ * @param length The length of id
+ * @return int The number of the vehicle, or -1 if it has no position yet
+ */
+int position_store_find(const position_store* store, const char* id, size_t length);
+
+/**
+ * @brief Reads the last position of a vehicle. Can be called from any thread, while the store is
+ * updated.
+ *
+ * @param store The store
+ * @param id The vehicle id, doesn't need to be null terminated
+ * @param length The length of id
+ * @param output The position to output to
+ * @return true if the vehicle has a position, false otherwise
+ */
+bool position_store_lookup(
+    const position_store* store,
+    const char* id,
+    size_t length,
+    geojson_coordinates* output);
+
+/**
+ * @brief Returns the number of vehicles with a position, which are numbered from 0 to the count -
+ * 1. Can be called from any thread.
+ */
+size_t position_store_count(const position_store* store);
+
+/**
+ * @brief Reads the last position of a vehicle by number, ex. when going through all of them. Can
+ * be called from any thread, while the store is updated.
+ *
+ * @param store The store
+ * @param vehicle A number below position_store_count()
+ * @return geojson_coordinates The position of the vehicle
+ */
+geojson_coordinates position_store_get(const position_store* store, size_t vehicle);
+
+/**
+ * @brief Returns the id of a vehicle by number. Ids never change or move, so the string can be kept
+ * until the store is destroyed.
+ *
+ * @param store The store
+ * @param vehicle A number below position_store_count()
+ * @return const char* The null terminated id
+ */
+const char* position_store_id(const position_store* store, size_t vehicle);
+
+#endif /* POSITION_STORE_H */
@@ -0,0 +1,307 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logging.h"
+#include "mqtt_hash.h"
+#include "position_stream_codec.h"
+
+#define INITIAL_STREAM_CAPACITY 16
+
+#define MICRODEGREES_PER_DEGREE 1e6
+/* Coordinates whose micro-degrees fit in an int64_t. */
+#define MAX_COORDINATE 9e12
+#define KEYFRAME_FLAG 0x01
+#define SEQUENCE_MASK 0x7f
+#define MAX_VARINT_LENGTH 10
+
+/* The state of one topic's stream. */
+typedef struct stream_state
+{
+  char* topic;
+  uint32_t hash;
+  int64_t x;
+  int64_t y;
+  uint8_t sequence;
+  bool has_reference;
+} stream_state;
+
+/* Streams are kept in an open addressing hash table keyed by topic. */
+struct position_stream_decoder
+{
+  stream_state* streams;
+  size_t stream_count;
+  size_t stream_capacity;
+};
+
+static bool _quantize(double degrees, int64_t* microdegrees)
+{
+  if (!isfinite(degrees) || fabs(degrees) > MAX_COORDINATE)
+  {
+    return false;
+  }
+  *microdegrees = llround(degrees * MICRODEGREES_PER_DEGREE);
+  return true;
+}
+
+/* Maps small negative and positive differences to small unsigned values: 0, -1, 1, -2, 2... The
+ * arithmetic is unsigned so differences of distant coordinates wrap instead of overflowing, and
+ * wrap back when decoded. */
+static uint64_t _zigzag(uint64_t value)
+{
+  return (value << 1) ^ (UINT64_C(0) - (value >> 63));
+}
+
+static uint64_t _unzigzag(uint64_t value)
+{
+  return (value >> 1) ^ (UINT64_C(0) - (value & 1));
+}
+
+static unsigned char* _write_varint(unsigned char* cursor, uint64_t value)
+{
+  while (value >= 0x80)
+  {
+    *cursor++ = (unsigned char)(value | 0x80);
+    value >>= 7;
+  }
+  *cursor++ = (unsigned char)value;
+  return cursor;
+}
+
+static bool _read_varint(const unsigned char** cursor, const unsigned char* end, uint64_t* value)
+{
+  *value = 0;
+  for (int i = 0; i < MAX_VARINT_LENGTH && *cursor < end; i++)
+  {
+    unsigned char byte = *(*cursor)++;
+    *value |= (uint64_t)(byte & 0x7f) << (7 * i);
+    if ((byte & 0x80) == 0)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+position_stream_encoder position_stream_encoder_init(int keyframe_interval)
+{
+  return (position_stream_encoder){ .keyframe_interval
+                                    = keyframe_interval < 1 ? 1 : keyframe_interval };
+}
+
+void position_stream_encoder_reset(position_stream_encoder* encoder)
+{
+  encoder->has_reference = false;
+}
+
+int position_stream_encode(
+    position_stream_encoder* encoder,
+    geojson_coordinates coordinates,
+    mosquitto_payload* payload)
+{
+  int64_t x;
+  int64_t y;
+
+  if (encoder == NULL || payload == NULL || payload->payload == NULL
+      || payload->max_payload_length < POSITION_STREAM_MAX_FRAME_LENGTH)
+  {
+    LOG_ERROR("Failure writing position stream: no encoder or payload buffer is too small");
+    return -1;
+  }
+  if (!_quantize(coordinates.x, &x) || !_quantize(coordinates.y, &y))
+  {
+    LOG_ERROR("Failure writing position stream: coordinates are out of range");
+    return -1;
+  }
+
+  bool keyframe = !encoder->has_reference
+      || encoder->frames_since_keyframe + 1 >= encoder->keyframe_interval;
+  uint64_t x_value = keyframe ? (uint64_t)x : (uint64_t)x - (uint64_t)encoder->x;
+  uint64_t y_value = keyframe ? (uint64_t)y : (uint64_t)y - (uint64_t)encoder->y;
+
+  unsigned char* cursor = (unsigned char*)payload->payload;
+  *cursor++ = (unsigned char)(encoder->sequence << 1 | (keyframe ? KEYFRAME_FLAG : 0));
+  cursor = _write_varint(cursor, _zigzag(x_value));
+  cursor = _write_varint(cursor, _zigzag(y_value));
+  payload->payload_length = cursor - (unsigned char*)payload->payload;
+
+  encoder->x = x;
+  encoder->y = y;
+  encoder->has_reference = true;
+  encoder->sequence = (encoder->sequence + 1) & SEQUENCE_MASK;
+  encoder->frames_since_keyframe = keyframe ? 0 : encoder->frames_since_keyframe + 1;
+  return 0;
+}
+
+position_stream_decoder* position_stream_decoder_create()
+{
+  position_stream_decoder* decoder = calloc(1, sizeof(position_stream_decoder));
+  if (decoder == NULL
+      || (decoder->streams = calloc(INITIAL_STREAM_CAPACITY, sizeof(stream_state))) == NULL)
+  {
+    LOG_ERROR("Failure allocating position stream decoder");
+    free(decoder);
+    return NULL;
+  }
+  decoder->stream_capacity = INITIAL_STREAM_CAPACITY;
+  return decoder;
+}
+
+void position_stream_decoder_destroy(position_stream_decoder* decoder)
+{
+  if (decoder == NULL)
+  {
+    return;
+  }
+  for (size_t i = 0; i < decoder->stream_capacity; i++)
+  {
+    free(decoder->streams[i].topic);
+  }
+  free(decoder->streams);
+  free(decoder);
+}
+
+/* Returns the slot of topic's stream, or the empty slot where it would go. */
+static size_t _probe(const stream_state* streams, size_t capacity, uint32_t hash, const char* topic)
+{
+  size_t mask = capacity - 1;
+  size_t i = hash & mask;
+  while (streams[i].topic != NULL
+         && (topic == NULL || streams[i].hash != hash || strcmp(streams[i].topic, topic) != 0))
+  {
+    i = (i + 1) & mask;
+  }
+  return i;
+}
+
+static bool _grow_streams(position_stream_decoder* decoder)
+{
+  size_t capacity = decoder->stream_capacity * 2;
+  stream_state* streams = calloc(capacity, sizeof(stream_state));
+  if (streams == NULL)
+  {
+    return false;
+  }
+  for (size_t i = 0; i < decoder->stream_capacity; i++)
+  {
+    if (decoder->streams[i].topic != NULL)
+    {
+      streams[_probe(streams, capacity, decoder->streams[i].hash, NULL)] = decoder->streams[i];
+    }
+  }
+  free(decoder->streams);
+  decoder->streams = streams;
+  decoder->stream_capacity = capacity;
+  return true;
+}
+
+/* Finds the stream of a topic, adding it the first time the topic is seen. */
+static stream_state* _find_stream(position_stream_decoder* decoder, const char* topic)
+{
+  uint32_t hash = mqtt_hash_string(topic);
+  size_t i = _probe(decoder->streams, decoder->stream_capacity, hash, topic);
+  if (decoder->streams[i].topic != NULL)
+  {
+    return &decoder->streams[i];
+  }
+
+  /* Keep the table at most 3/4 full so probes stay short. */
+  if ((decoder->stream_count + 1) * 4 > decoder->stream_capacity * 3)
+  {
+    if (!_grow_streams(decoder))
+    {
+      return NULL;
+    }
+    i = _probe(decoder->streams, decoder->stream_capacity, hash, NULL);
+  }
+  if ((decoder->streams[i].topic = strdup(topic)) == NULL)
+  {
+    return NULL;
+  }
+  decoder->streams[i].hash = hash;
+  decoder->streams[i].has_reference = false;
+  decoder->stream_count++;
+  return &decoder->streams[i];
+}
+
+/* Reads the header byte and the two varints of a frame. */
+static bool _parse_frame(
+    const struct mosquitto_message* message,
+    uint8_t* header,
+    uint64_t* x,
+    uint64_t* y)
+{
+  if (message->payload == NULL || message->payloadlen < 1)
+  {
+    return false;
+  }
+  const unsigned char* cursor = message->payload;
+  const unsigned char* end = cursor + message->payloadlen;
+  *header = *cursor++;
+  return _read_varint(&cursor, end, x) && _read_varint(&cursor, end, y) && cursor == end;
+}
+
+int position_stream_decode(
+    position_stream_decoder* decoder,
+    const struct mosquitto_message* message,
+    geojson_coordinates* output)
+{
+  uint8_t header;
+  uint64_t x;
+  uint64_t y;
+
+  if (decoder == NULL || message == NULL || message->topic == NULL || output == NULL)
+  {
+    LOG_ERROR("Failure reading position stream: decoder, message, topic or output is NULL");
+    return -1;
+  }
+  if (!_parse_frame(message, &header, &x, &y))
+  {
+    LOG_ERROR("Failure reading position stream: malformed frame on %s", message->topic);
+    return -1;
+  }
+
+  stream_state* stream = _find_stream(decoder, message->topic);
+  if (stream == NULL)
+  {
+    LOG_ERROR("Failure reading position stream: can't track %s", message->topic);
+    return -1;
+  }
+
+  uint8_t sequence = header >> 1;
+  if ((header & KEYFRAME_FLAG) == 0)
+  {
+    if (stream->has_reference && sequence == stream->sequence)
+    {
+      LOG_ERROR("Failure reading position stream: repeated frame on %s", message->topic);
+      return -1;
+    }
+    if (!stream->has_reference || sequence != ((stream->sequence + 1) & SEQUENCE_MASK))
+    {
+      LOG_ERROR(
+          "Failure reading position stream: lost a frame on %s, waiting for a keyframe",
+          message->topic);
+      stream->has_reference = false;
+      return -1;
+    }
+    x = (uint64_t)stream->x + _unzigzag(x);
+    y = (uint64_t)stream->y + _unzigzag(y);
+  }
+  else
+  {
+    x = _unzigzag(x);
+    y = _unzigzag(y);
+  }
+
+  stream->x = (int64_t)x;
+  stream->y = (int64_t)y;
+  stream->sequence = sequence;
+  stream->has_reference = true;
+  output->x = stream->x / MICRODEGREES_PER_DEGREE;
+  output->y = stream->y / MICRODEGREES_PER_DEGREE;
+  return 0;
+}
@@ -0,0 +1,98 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef POSITION_STREAM_CODEC_H
+#define POSITION_STREAM_CODEC_H
+
+#include "geo_json_handler.h"
+#include "mosquitto.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * A stateful codec for the stream of positions one producer publishes on one topic. Coordinates are
+ * quantized to integer micro-degrees (the precision of the JSON payloads), and each frame holds
+ * either the position itself (a keyframe) or its difference from the previous frame, written as
+ * zigzag varints. A frame starts with a header byte: bit 0 is set for keyframes and bits 1-7 hold a
+ * sequence number, so a decoder notices a lost frame and waits for the next keyframe instead of
+ * applying a difference to the wrong position.
+ */
+
+/* A header byte and two varints of up to 10 bytes. */
+#define POSITION_STREAM_MAX_FRAME_LENGTH 21
+#define POSITION_STREAM_DEFAULT_KEYFRAME_INTERVAL 30
+
+typedef struct position_stream_encoder
+{
+  /* The last position written, in micro-degrees. */
+  int64_t x;
+  int64_t y;
+  uint8_t sequence;
+  bool has_reference;
+  int keyframe_interval;
+  int frames_since_keyframe;
+} position_stream_encoder;
+
+typedef struct position_stream_decoder position_stream_decoder;
+
+/**
+ * @brief Initializes an encoder whose first frame is a keyframe.
+ *
+ * @param keyframe_interval Every keyframe_interval-th frame is a keyframe, so a consumer that lost
+ * a frame or subscribed late resynchronizes within that many frames. Must be at least 1.
+ * @return position_stream_encoder The initialized encoder
+ */
+position_stream_encoder position_stream_encoder_init(int keyframe_interval);
+
+/**
+ * @brief Makes the next frame a keyframe, ex. after reconnecting.
+ *
+ * @param encoder The encoder
+ */
+void position_stream_encoder_reset(position_stream_encoder* encoder);
+
+/**
+ * @brief Writes the next frame of a position stream without allocating.
+ *
+ * @param encoder The encoder of the stream
+ * @param coordinates The position to write, within +/-9e12 degrees
+ * @param payload The mosquitto_payload to output to, with a max_payload_length of at least
+ * POSITION_STREAM_MAX_FRAME_LENGTH
+ * @return int 0 on success, -1 on failure
+ */
+int position_stream_encode(
+    position_stream_encoder* encoder,
+    geojson_coordinates coordinates,
+    mosquitto_payload* payload);
+
+/**
+ * @brief Creates a decoder, which follows the streams of any number of topics.
+ *
+ * @return position_stream_decoder* The decoder, or NULL on failure. It must be freed with
+ * position_stream_decoder_destroy().
+ */
+position_stream_decoder* position_stream_decoder_create();
+
+/**
+ * @brief Frees a decoder and the state of all its topics.
+ *
+ * @param decoder The decoder to free, can be NULL
+ */
+void position_stream_decoder_destroy(position_stream_decoder* decoder);
+
+/**
+ * @brief Reads the next frame of the stream of the message's topic. Differences that can't be
+ * applied, because the previous frame of the topic was lost or never received, fail until the next
+ * keyframe. A repeated frame fails without losing the stream.
+ *
+ * @param decoder The decoder
+ * @param message The mosquitto_message to read
+ * @param output The position to output to
+ * @return int 0 on success, -1 on failure
+ */
+int position_stream_decode(
+    position_stream_decoder* decoder,
+    const struct mosquitto_message* message,
+    geojson_coordinates* output);
+
+#endif /* POSITION_STREAM_CODEC_H */
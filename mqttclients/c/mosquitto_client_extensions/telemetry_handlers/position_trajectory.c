@@ -0,0 +1,258 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logging.h"
+#include "position_trajectory.h"
+
+#define METERS_PER_DEGREE 111320.0
+#define DEFAULT_RADIUS_DEGREES 0.1
+#define MAX_LATITUDE 85.0
+
+static uint64_t _splitmix64(uint64_t* x)
+{
+  uint64_t z = (*x += 0x9e3779b97f4a7c15ull);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+  return z ^ (z >> 31);
+}
+
+static inline uint64_t _rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+
+/* One xoshiro256+ step on words kept in locals, so the fleet loop can keep them in registers. */
+static inline uint64_t _xoshiro256p(uint64_t* s0, uint64_t* s1, uint64_t* s2, uint64_t* s3)
+{
+  uint64_t result = *s0 + *s3;
+  uint64_t t = *s1 << 17;
+  *s2 ^= *s0;
+  *s3 ^= *s1;
+  *s1 ^= *s2;
+  *s0 ^= *s3;
+  *s2 ^= t;
+  *s3 = _rotl(*s3, 45);
+  return result;
+}
+
+/* The 52 high bits as the mantissa of a double in [1, 2), minus 1. Unlike an integer to double
+ * conversion of 64 bits, this vectorizes without AVX-512. */
+static inline double _to_uniform(uint64_t bits)
+{
+  uint64_t mantissa = (bits >> 12) | 0x3ff0000000000000ull;
+  double value;
+  memcpy(&value, &mantissa, sizeof(value));
+  return value - 1.0;
+}
+
+void trajectory_rng_seed(trajectory_rng* rng, uint64_t seed)
+{
+  for (int i = 0; i < 4; i++)
+  {
+    rng->state[i] = _splitmix64(&seed);
+  }
+}
+
+uint64_t trajectory_rng_next(trajectory_rng* rng)
+{
+  return _xoshiro256p(&rng->state[0], &rng->state[1], &rng->state[2], &rng->state[3]);
+}
+
+double trajectory_rng_uniform(trajectory_rng* rng)
+{
+  return _to_uniform(trajectory_rng_next(rng));
+}
+
+double trajectory_rng_between(trajectory_rng* rng, double min, double max)
+{
+  return min + trajectory_rng_uniform(rng) * (max - min);
+}
+
+trajectory_settings trajectory_settings_default(geojson_coordinates center)
+{
+  return (trajectory_settings){ .center = center,
+                                .radius_degrees = DEFAULT_RADIUS_DEGREES,
+                                .min_speed_mps = TRAJECTORY_DEFAULT_MIN_SPEED_MPS,
+                                .max_speed_mps = TRAJECTORY_DEFAULT_MAX_SPEED_MPS,
+                                .acceleration = TRAJECTORY_DEFAULT_ACCELERATION,
+                                .turn_rate = TRAJECTORY_DEFAULT_TURN_RATE };
+}
+
+trajectory_fleet* trajectory_fleet_create(
+    size_t count,
+    trajectory_settings settings,
+    uint64_t seed)
+{
+  trajectory_fleet* fleet = calloc(1, sizeof(trajectory_fleet));
+  bool allocated = fleet != NULL && count > 0 && settings.radius_degrees > 0
+      && settings.min_speed_mps <= settings.max_speed_mps;
+
+  if (allocated)
+  {
+    double** fields[] = { &fleet->x, &fleet->y, &fleet->east, &fleet->north, &fleet->speed_mps };
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]) && allocated; i++)
+    {
+      allocated = (*fields[i] = malloc(count * sizeof(double))) != NULL;
+    }
+    for (int i = 0; i < 4 && allocated; i++)
+    {
+      allocated = (fleet->state[i] = malloc(count * sizeof(uint64_t))) != NULL;
+    }
+  }
+  if (!allocated)
+  {
+    LOG_ERROR("Failure creating a trajectory fleet of %zu vehicles", count);
+    trajectory_fleet_destroy(fleet);
+    return NULL;
+  }
+
+  const double radians = M_PI / 180;
+  double radius = settings.radius_degrees;
+  double center_y = fmin(fmax(settings.center.y, -MAX_LATITUDE + radius), MAX_LATITUDE - radius);
+  double x_radius = radius / cos(center_y * radians);
+
+  fleet->count = count;
+  fleet->settings = settings;
+  fleet->min_x = settings.center.x - x_radius;
+  fleet->max_x = settings.center.x + x_radius;
+  fleet->min_y = center_y - radius;
+  fleet->max_y = center_y + radius;
+  fleet->y_degrees_per_meter = 1 / METERS_PER_DEGREE;
+  fleet->x_degrees_per_meter = 1 / (METERS_PER_DEGREE * cos(center_y * radians));
+
+  for (size_t i = 0; i < count; i++)
+  {
+    /* Each vehicle has its own stream, mixed from the seed and its index. */
+    trajectory_rng rng;
+    uint64_t index = i;
+    trajectory_rng_seed(&rng, seed ^ _splitmix64(&index));
+
+    /* A street towards one of the four directions. */
+    int direction = (int)(trajectory_rng_next(&rng) >> 62);
+    fleet->east[i] = direction == 0 ? 1 : direction == 1 ? -1 : 0;
+    fleet->north[i] = direction == 2 ? 1 : direction == 3 ? -1 : 0;
+    fleet->x[i] = trajectory_rng_between(&rng, fleet->min_x, fleet->max_x);
+    fleet->y[i] = trajectory_rng_between(&rng, fleet->min_y, fleet->max_y);
+    fleet->speed_mps[i]
+        = trajectory_rng_between(&rng, settings.min_speed_mps, settings.max_speed_mps);
+    for (int w = 0; w < 4; w++)
+    {
+      fleet->state[w][i] = rng.state[w];
+    }
+  }
+  return fleet;
+}
+
+void trajectory_fleet_destroy(trajectory_fleet* fleet)
+{
+  if (fleet == NULL)
+  {
+    return;
+  }
+  free(fleet->x);
+  free(fleet->y);
+  free(fleet->east);
+  free(fleet->north);
+  free(fleet->speed_mps);
+  for (int i = 0; i < 4; i++)
+  {
+    free(fleet->state[i]);
+  }
+  free(fleet);
+}
+
+/* The arrays are restrict parameters of a function that isn't inlined: GCC ignores restrict on
+ * local pointers, and without it the loop needs more alias checks than it will version for. */
+static __attribute__((noinline)) void _step_vehicles(
+    const trajectory_fleet* fleet,
+    size_t count,
+    double seconds,
+    double* restrict x,
+    double* restrict y,
+    double* restrict east,
+    double* restrict north,
+    double* restrict speed_mps,
+    uint64_t* restrict state0,
+    uint64_t* restrict state1,
+    uint64_t* restrict state2,
+    uint64_t* restrict state3)
+{
+  const double turn = fmin(fleet->settings.turn_rate * seconds, 1);
+  const double max_change = fleet->settings.acceleration * seconds;
+  const double min_speed = fleet->settings.min_speed_mps;
+  const double max_speed = fleet->settings.max_speed_mps;
+  const double x_scale = fleet->x_degrees_per_meter * seconds;
+  const double y_scale = fleet->y_degrees_per_meter * seconds;
+  const double min_x = fleet->min_x, max_x = fleet->max_x;
+  const double min_y = fleet->min_y, max_y = fleet->max_y;
+
+  /* No branches and no calls, every vehicle does the same work, so this loop vectorizes at -O3
+   * (the Release builds). Conditions combine with & and | rather than && and ||, and values are
+   * selected or clamped before each unconditional store. */
+  for (size_t i = 0; i < count; i++)
+  {
+    uint64_t s0 = state0[i], s1 = state1[i], s2 = state2[i], s3 = state3[i];
+    double turn_draw = _to_uniform(_xoshiro256p(&s0, &s1, &s2, &s3));
+    double speed_draw = _to_uniform(_xoshiro256p(&s0, &s1, &s2, &s3));
+    state0[i] = s0;
+    state1[i] = s1;
+    state2[i] = s2;
+    state3[i] = s3;
+
+    /* Turn left with a probability of turn / 2, and right with the same, onto the crossing
+     * street: (east, north) becomes (-north, east) or (north, -east). */
+    double left = turn_draw < turn / 2 ? 1.0 : 0.0;
+    double right = (turn_draw >= turn / 2) & (turn_draw < turn) ? 1.0 : 0.0;
+    double straight = 1.0 - left - right;
+    double e = east[i], n = north[i];
+    double new_east = straight * e - left * n + right * n;
+    double new_north = straight * n + left * e - right * e;
+
+    double speed = speed_mps[i] + (speed_draw * 2 - 1) * max_change;
+    speed = speed < min_speed ? min_speed : speed;
+    speed = speed > max_speed ? max_speed : speed;
+    speed_mps[i] = speed;
+
+    /* Stop at the edges of the area and turn back instead of leaving it. */
+    double new_x = x[i] + new_east * speed * x_scale;
+    double new_y = y[i] + new_north * speed * y_scale;
+    east[i] = (new_x < min_x) | (new_x > max_x) ? -new_east : new_east;
+    north[i] = (new_y < min_y) | (new_y > max_y) ? -new_north : new_north;
+    new_x = new_x < min_x ? min_x : new_x;
+    new_y = new_y < min_y ? min_y : new_y;
+    x[i] = new_x > max_x ? max_x : new_x;
+    y[i] = new_y > max_y ? max_y : new_y;
+  }
+}
+
+void trajectory_fleet_step_range(
+    trajectory_fleet* fleet,
+    size_t first,
+    size_t count,
+    double seconds)
+{
+  _step_vehicles(
+      fleet,
+      count,
+      seconds,
+      fleet->x + first,
+      fleet->y + first,
+      fleet->east + first,
+      fleet->north + first,
+      fleet->speed_mps + first,
+      fleet->state[0] + first,
+      fleet->state[1] + first,
+      fleet->state[2] + first,
+      fleet->state[3] + first);
+}
+
+void trajectory_fleet_step(trajectory_fleet* fleet, double seconds)
+{
+  trajectory_fleet_step_range(fleet, 0, fleet->count, seconds);
+}
+
+geojson_coordinates trajectory_fleet_position(const trajectory_fleet* fleet, size_t vehicle)
+{
+  return (geojson_coordinates){ .x = fleet->x[vehicle], .y = fleet->y[vehicle] };
+}
@@ -0,0 +1,152 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef POSITION_TRAJECTORY_H
+#define POSITION_TRAJECTORY_H
+
+#include "geo_json_handler.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Generates plausible, reproducible vehicle positions for samples, tests and benchmarks, instead
+ * of rand() coordinates that jump across the map.
+ *
+ * Random numbers come from xoshiro256+, seeded with splitmix64. A generator is a plain value
+ * owned by its caller, so there is no global state to share between threads.
+ *
+ * A trajectory_fleet drives vehicles on a street grid around a center: each vehicle goes straight
+ * along a street (north, south, east or west), turns left or right now and then, speeds up and
+ * slows down within a speed range, and turns back at the edges of the area. Its state is stored
+ * as arrays per field and stepped by a branch-free loop that compilers vectorize. Each vehicle
+ * has its own generator seeded from the fleet seed and its index, so a run is the same for the
+ * same seed whatever the number of threads stepping the vehicles. Positions are identical between
+ * runs of a build; builds for CPUs with FMA (ex. -march=native) round some steps differently.
+ */
+
+#define TRAJECTORY_DEFAULT_MIN_SPEED_MPS 3.0
+#define TRAJECTORY_DEFAULT_MAX_SPEED_MPS 30.0
+/* How fast the speed changes, at most, in m/s per second. */
+#define TRAJECTORY_DEFAULT_ACCELERATION 2.0
+/* How often a vehicle turns at a crossing, on average, in turns per second. */
+#define TRAJECTORY_DEFAULT_TURN_RATE (1.0 / 60)
+/* The memory of each vehicle of a fleet: its position, direction and speed, and its generator. */
+#define TRAJECTORY_BYTES_PER_VEHICLE (5 * sizeof(double) + 4 * sizeof(uint64_t))
+
+typedef struct trajectory_rng
+{
+  uint64_t state[4];
+} trajectory_rng;
+
+/**
+ * @brief Seeds a generator. The same seed always gives the same numbers.
+ *
+ * @param rng The generator
+ * @param seed Any value, including 0
+ */
+void trajectory_rng_seed(trajectory_rng* rng, uint64_t seed);
+
+/**
+ * @brief Returns the next 64 random bits. The lowest bits are weaker, use the high ones.
+ */
+uint64_t trajectory_rng_next(trajectory_rng* rng);
+
+/**
+ * @brief Returns a uniform double in [0, 1).
+ */
+double trajectory_rng_uniform(trajectory_rng* rng);
+
+/**
+ * @brief Returns a uniform double in [min, max).
+ */
+double trajectory_rng_between(trajectory_rng* rng, double min, double max);
+
+typedef struct trajectory_settings
+{
+  /* The middle of the area the vehicles drive in. */
+  geojson_coordinates center;
+  /* Half the width and height of the area, in degrees of latitude. */
+  double radius_degrees;
+  double min_speed_mps;
+  double max_speed_mps;
+  double acceleration;
+  double turn_rate;
+} trajectory_settings;
+
+typedef struct trajectory_fleet
+{
+  size_t count;
+  /* The position of vehicle i is (x[i], y[i]) in degrees. */
+  double* x;
+  double* y;
+  /* The street direction of each vehicle, a unit vector towards east and north. */
+  double* east;
+  double* north;
+  double* speed_mps;
+  /* The xoshiro256+ state of each vehicle, word w of vehicle i is state[w][i]. */
+  uint64_t* state[4];
+  trajectory_settings settings;
+  double min_x, max_x, min_y, max_y;
+  /* Degrees per meter. Longitude degrees are scaled for the latitude of the center, the area is
+   * small enough for the scale to barely change across it. */
+  double x_degrees_per_meter;
+  double y_degrees_per_meter;
+} trajectory_fleet;
+
+/**
+ * @brief Returns the default settings: a city sized area (radius_degrees 0.1, about 11 km) around
+ * center.
+ */
+trajectory_settings trajectory_settings_default(geojson_coordinates center);
+
+/**
+ * @brief Creates a fleet with its vehicles spread over the area, each heading along a street at a
+ * random speed.
+ *
+ * @param count The number of vehicles
+ * @param settings The area and the motion of the vehicles
+ * @param seed The seed of the whole run
+ * @return trajectory_fleet* The fleet, or NULL on failure. It must be freed with
+ * trajectory_fleet_destroy().
+ */
+trajectory_fleet* trajectory_fleet_create(
+    size_t count,
+    trajectory_settings settings,
+    uint64_t seed);
+
+/**
+ * @brief Frees a fleet.
+ *
+ * @param fleet The fleet to free, can be NULL
+ */
+void trajectory_fleet_destroy(trajectory_fleet* fleet);
+
+/**
+ * @brief Moves every vehicle for a time.
+ *
+ * @param fleet The fleet
+ * @param seconds How long the vehicles drive, ex. the interval between two positions
+ */
+void trajectory_fleet_step(trajectory_fleet* fleet, double seconds);
+
+/**
+ * @brief Moves the vehicles first to first + count - 1, ex. the share of one thread. Threads
+ * may step separate ranges of the same fleet at the same time.
+ *
+ * @param fleet The fleet
+ * @param first The first vehicle to move
+ * @param count The number of vehicles to move
+ * @param seconds How long the vehicles drive
+ */
+void trajectory_fleet_step_range(
+    trajectory_fleet* fleet,
+    size_t first,
+    size_t count,
+    double seconds);
+
+/**
+ * @brief Returns the position of a vehicle.
+ */
+geojson_coordinates trajectory_fleet_position(const trajectory_fleet* fleet, size_t vehicle);
+
+#endif /* POSITION_TRAJECTORY_H */
@@ -2,6 +2,7 @@
 // SPDX-License-Identifier: MIT
 
 #include <setjmp.h>
+#include <math.h>
 #include <stdarg.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -135,6 +136,70 @@ static void test_geojson_point_to_mosquitto_payload_output_buffer_too_small_fail
   geojson_point_destroy(&json_point);
 }
 
+// Coordinates are written with the same digits as printf's %.6f, including halfway cases
+static void test_geojson_point_to_mosquitto_payload_rounding_success(void** state)
+{
+  const double values[] = { 0.0078125,   0.0234375, -0.0078125, 1e-7,          -1e-7,
+                            0.0000005,   -0.0,      179.999999, -89.9999995,   123456.7890125,
+                            999999999.9, 5e-324,    1e11 + 0.5, 12345678901.5, 1e15 };
+  mosquitto_payload mosq_payload = mosquitto_payload_init(128);
+  geojson_point json_point = geojson_point_init();
+  strcpy(json_point.type, "Point");
+
+  for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++)
+  {
+    char expected[128];
+    geojson_point_set_coordinates(&json_point, values[i], -values[i]);
+    snprintf(
+        expected,
+        sizeof(expected),
+        "{\"type\":\"Point\",\"coordinates\":[%.6f,%.6f]}",
+        values[i],
+        -values[i]);
+
+    assert_int_equal(0, geojson_point_to_mosquitto_payload(json_point, &mosq_payload));
+    assert_string_equal(mosq_payload.payload, expected);
+    assert_int_equal(mosq_payload.payload_length, strlen(expected));
+  }
+
+  mosquitto_payload_destroy(&mosq_payload);
+  geojson_point_destroy(&json_point);
+}
+
+// The type is escaped and non-finite coordinates are written the way json-c writes them
+static void test_geojson_point_to_mosquitto_payload_escaped_type_success(void** state)
+{
+  mosquitto_payload mosq_payload = mosquitto_payload_init(MAX_PAYLOAD_LENGTH);
+  geojson_point json_point = { .type = "a/\"b\"\n\x01", .coordinates = { 1.0 / 0.0, 0.0 / 0.0 } };
+
+  assert_int_equal(0, geojson_point_to_mosquitto_payload(json_point, &mosq_payload));
+  assert_string_equal(
+      mosq_payload.payload,
+      "{\"type\":\"a\\/\\\"b\\\"\\n\\u0001\",\"coordinates\":[Infinity,NaN]}");
+
+  mosquitto_payload_destroy(&mosq_payload);
+}
+
+// The payload and its terminator have to fit in the buffer
+static void test_geojson_point_to_mosquitto_payload_no_room_for_terminator_fail(void** state)
+{
+  const char* expected = "{\"type\":\"Point\",\"coordinates\":[0.000000,0.000000]}";
+  mosquitto_payload mosq_payload = mosquitto_payload_init(strlen(expected));
+  geojson_point json_point = geojson_point_init();
+  strcpy(json_point.type, "Point");
+
+  assert_int_equal(-1, geojson_point_to_mosquitto_payload(json_point, &mosq_payload));
+  assert_int_equal(mosq_payload.payload_length, 0);
+  mosquitto_payload_destroy(&mosq_payload);
+
+  mosq_payload = mosquitto_payload_init(strlen(expected) + 1);
+  assert_int_equal(0, geojson_point_to_mosquitto_payload(json_point, &mosq_payload));
+  assert_string_equal(mosq_payload.payload, expected);
+
+  mosquitto_payload_destroy(&mosq_payload);
+  geojson_point_destroy(&json_point);
+}
+
 static void test_geojson_point_set_coordinates_sucess(void** state)
 {
   geojson_point json_point = geojson_point_init();
@@ -152,8 +217,9 @@ static void test_geojson_point_set_coordinates_sucess(void** state)
 
 static void test_mosquitto_payload_to_geojson_point_min_payload_success(void** state)
 {
-  struct mosquitto_message message;
+  struct mosquitto_message message = { 0 };
   message.payload = "{\"type\":\"Point\",\"coordinates\":[0.000000,0.000000]}";
+  message.payloadlen = strlen(message.payload);
   geojson_point json_point = geojson_point_init();
 
   assert_int_equal(mosquitto_payload_to_geojson_point(&message, &json_point), 0);
@@ -166,8 +232,9 @@ static void test_mosquitto_payload_to_geojson_point_min_payload_success(void** s
 
 static void test_mosquitto_payload_to_geojson_point_max_payload_success(void** state)
 {
-  struct mosquitto_message message;
+  struct mosquitto_message message = { 0 };
   message.payload = "{\"type\":\"Point\",\"coordinates\":[-83.551071,-36.169784]}";
+  message.payloadlen = strlen(message.payload);
   geojson_point json_point = geojson_point_init();
 
   assert_int_equal(mosquitto_payload_to_geojson_point(&message, &json_point), 0);
@@ -196,7 +263,7 @@ static void test_mosquitto_payload_to_geojson_point_null_message_fail(void** sta
 // null json point
 static void test_mosquitto_payload_to_geojson_point_null_json_point_fail(void** state)
 {
-  struct mosquitto_message message;
+  struct mosquitto_message message = { 0 };
   assert_int_equal(mosquitto_payload_to_geojson_point(&message, NULL), -1);
 }
 
@@ -204,8 +271,9 @@ static void test_mosquitto_payload_to_geojson_point_null_json_point_fail(void**
 static void test_mosquitto_payload_to_geojson_point_empty_json_fail(void** state)
 {
   geojson_point json_point = geojson_point_init();
-  struct mosquitto_message message;
+  struct mosquitto_message message = { 0 };
   message.payload = "";
+  message.payloadlen = strlen(message.payload);
   assert_int_equal(mosquitto_payload_to_geojson_point(&message, &json_point), -1);
 
   geojson_point_destroy(&json_point);
@@ -215,8 +283,9 @@ static void test_mosquitto_payload_to_geojson_point_empty_json_fail(void** state
 static void test_mosquitto_payload_to_geojson_point_not_geojson_fail(void** state)
 {
   geojson_point json_point = geojson_point_init();
-  struct mosquitto_message message;
+  struct mosquitto_message message = { 0 };
   message.payload = "{\"name\":\"Valerie\",\"shirtColor\":\"blue\"}";
+  message.payloadlen = strlen(message.payload);
   assert_int_equal(mosquitto_payload_to_geojson_point(&message, &json_point), -1);
 
   geojson_point_destroy(&json_point);
@@ -226,8 +295,9 @@ static void test_mosquitto_payload_to_geojson_point_not_geojson_fail(void** stat
 static void test_mosquitto_payload_to_geojson_point_not_point_fail(void** state)
 {
   geojson_point json_point = geojson_point_init();
-  struct mosquitto_message message;
+  struct mosquitto_message message = { 0 };
   message.payload = "{\"type\":\"LineString\",\"coordinates\":[[100.0, 0.0],[101.0, 1.0]]}";
+  message.payloadlen = strlen(message.payload);
   assert_int_equal(mosquitto_payload_to_geojson_point(&message, &json_point), -1);
 
   geojson_point_destroy(&json_point);
@@ -237,13 +307,280 @@ static void test_mosquitto_payload_to_geojson_point_not_point_fail(void** state)
 static void test_mosquitto_payload_to_geojson_point_missing_coordinates_fail(void** state)
 {
   geojson_point json_point = geojson_point_init();
-  struct mosquitto_message message;
+  struct mosquitto_message message = { 0 };
   message.payload = "{\"type\":\"Point\"}";
+  message.payloadlen = strlen(message.payload);
   assert_int_equal(mosquitto_payload_to_geojson_point(&message, &json_point), -1);
 
   geojson_point_destroy(&json_point);
 }
 
+// members in any order with whitespace are parsed without json-c
+static void test_mosquitto_payload_to_geojson_point_reordered_payload_success(void** state)
+{
+  struct mosquitto_message message = { 0 };
+  message.payload = " { \"coordinates\" : [ 12.5e-1 , -0.25 ] ,\n \"type\" : \"Point\" } ";
+  message.payloadlen = strlen(message.payload);
+  geojson_point json_point = geojson_point_init();
+
+  assert_int_equal(mosquitto_payload_to_geojson_point(&message, &json_point), 0);
+  assert_string_equal(json_point.type, "Point");
+  assert_float_equal(json_point.coordinates.x, 1.25, 0.000001);
+  assert_float_equal(json_point.coordinates.y, -0.25, 0.000001);
+
+  geojson_point_destroy(&json_point);
+}
+
+// layouts the single pass parser doesn't handle still parse through json-c
+static void test_mosquitto_payload_to_geojson_point_fallback_success(void** state)
+{
+  struct mosquitto_message message = { 0 };
+  message.payload = "{\"type\":\"Po\\u0069nt\",\"coordinates\":[-83.551071,-36.169784,12.0],"
+                    "\"properties\":{\"name\":\"car-1\"}}";
+  message.payloadlen = strlen(message.payload);
+  geojson_point json_point = geojson_point_init();
+
+  assert_int_equal(mosquitto_payload_to_geojson_point(&message, &json_point), 0);
+  assert_string_equal(json_point.type, "Point");
+  assert_float_equal(json_point.coordinates.x, -83.551071, 0.000001);
+  assert_float_equal(json_point.coordinates.y, -36.169784, 0.000001);
+
+  geojson_point_destroy(&json_point);
+}
+
+// only payloadlen bytes of the payload are read
+static void test_mosquitto_payload_to_geojson_coordinates_payloadlen_success(void** state)
+{
+  struct mosquitto_message message = { 0 };
+  geojson_coordinates coordinates;
+  char* point = "{\"type\":\"Point\",\"coordinates\":[-83.551071,-36.169784]}";
+  message.payload = "{\"type\":\"Point\",\"coordinates\":[-83.551071,-36.169784]}{\"type\"";
+  message.payloadlen = strlen(point);
+
+  assert_int_equal(mosquitto_payload_to_geojson_coordinates(&message, &coordinates), 0);
+  assert_float_equal(coordinates.x, -83.551071, 0.000001);
+  assert_float_equal(coordinates.y, -36.169784, 0.000001);
+}
+
+// not a Point
+static void test_mosquitto_payload_to_geojson_coordinates_not_point_fail(void** state)
+{
+  struct mosquitto_message message = { 0 };
+  geojson_coordinates coordinates;
+  message.payload = "{\"type\":\"LineString\",\"coordinates\":[[100.0, 0.0],[101.0, 1.0]]}";
+  message.payloadlen = strlen(message.payload);
+
+  assert_int_equal(mosquitto_payload_to_geojson_coordinates(&message, &coordinates), -1);
+  assert_int_equal(mosquitto_payload_to_geojson_coordinates(NULL, &coordinates), -1);
+}
+
+// A batch decodes each message like mosquitto_payload_to_geojson_coordinates()
+static void test_geojson_points_decode_batch_success(void** state)
+{
+  const char* payloads[6] = {
+    "{\"type\":\"Point\",\"coordinates\":[-83.551071,-36.169784]}",
+    " { \"coordinates\" : [ 1.5 , -2.25 ] ,\n \"type\" : \"Point\" } ",
+    // 3D positions are decoded by json-c
+    "{\"type\":\"Point\",\"coordinates\":[3,4,5]}",
+    // Escapes are decoded by json-c
+    "{\"type\":\"Po\\u0069nt\",\"coordinates\":[5.0,6.0]}",
+    "{\"type\":\"LineString\",\"coordinates\":[[100.0, 0.0],[101.0, 1.0]]}",
+    "{\"type\":\"Point\"}",
+  };
+  const int count = 6;
+  struct mosquitto_message messages[6];
+  const struct mosquitto_message* message_pointers[6];
+  geojson_coordinates_batch batch = geojson_coordinates_batch_init(8);
+  assert_non_null(batch.x);
+  assert_true((uintptr_t)batch.x % 64 == 0);
+
+  for (int i = 0; i < count; i++)
+  {
+    memset(&messages[i], 0, sizeof(messages[i]));
+    messages[i].payload = (void*)payloads[i];
+    messages[i].payloadlen = strlen(payloads[i]);
+    message_pointers[i] = &messages[i];
+  }
+
+  assert_int_equal(geojson_points_decode_batch(message_pointers, count, &batch), 4);
+  assert_true(batch.decoded[0]);
+  assert_float_equal(batch.x[0], -83.551071, 0.000001);
+  assert_float_equal(batch.y[0], -36.169784, 0.000001);
+  assert_true(batch.decoded[1]);
+  assert_float_equal(batch.x[1], 1.5, 0);
+  assert_float_equal(batch.y[1], -2.25, 0);
+  assert_true(batch.decoded[2]);
+  assert_float_equal(batch.x[2], 3, 0);
+  assert_float_equal(batch.y[2], 4, 0);
+  assert_true(batch.decoded[3]);
+  assert_float_equal(batch.x[3], 5, 0);
+  assert_float_equal(batch.y[3], 6, 0);
+  assert_false(batch.decoded[4]);
+  assert_true(isnan(batch.x[4]));
+  assert_false(batch.decoded[5]);
+  assert_true(isnan(batch.y[5]));
+
+  geojson_coordinates_batch_destroy(&batch);
+  assert_null(batch.x);
+  assert_int_equal(batch.capacity, 0);
+}
+
+// More messages than the batch holds
+static void test_geojson_points_decode_batch_too_many_messages_fail(void** state)
+{
+  struct mosquitto_message message = { 0 };
+  const struct mosquitto_message* messages[] = { &message, &message };
+  geojson_coordinates_batch batch = geojson_coordinates_batch_init(1);
+
+  assert_int_equal(geojson_points_decode_batch(messages, 2, &batch), -1);
+  assert_int_equal(geojson_points_decode_batch(messages, 2, NULL), -1);
+
+  geojson_coordinates_batch_destroy(&batch);
+}
+
+static void test_geojson_geometry_line_string_round_trip_success(void** state)
+{
+  const int count = 1000;
+  geojson_geometry track = geojson_geometry_init();
+  geojson_geometry decoded = geojson_geometry_init();
+  mosquitto_payload payload = mosquitto_payload_init(64 * 1024);
+  struct mosquitto_message message = { 0 };
+
+  assert_true(geojson_geometry_reset(&track, GEOJSON_LINE_STRING, count, 0));
+  for (int i = 0; i < count; i++)
+  {
+    assert_true(geojson_geometry_add_position(&track, i * 0.001 - 122.5, 47.25 - i * 0.0005));
+  }
+  assert_int_equal(track.capacity, count);
+  assert_false(geojson_geometry_add_position(&track, 0, 0));
+
+  assert_int_equal(geojson_geometry_to_mosquitto_payload(&track, &payload), 0);
+  assert_int_equal(strlen(payload.payload), payload.payload_length);
+  assert_memory_equal(
+      payload.payload, "{\"type\":\"LineString\",\"coordinates\":[[-122.500000,", 49);
+
+  message.payload = payload.payload;
+  message.payloadlen = payload.payload_length;
+  assert_int_equal(mosquitto_payload_to_geojson_geometry(&message, &decoded), 0);
+  assert_int_equal(decoded.type, GEOJSON_LINE_STRING);
+  assert_int_equal(decoded.count, track.count);
+  assert_true((uintptr_t)decoded.x % 64 == 0);
+  assert_true((uintptr_t)decoded.y % 64 == 0);
+  for (int i = 0; i < decoded.count; i++)
+  {
+    assert_float_equal(decoded.x[i], track.x[i], 0.000001);
+    assert_float_equal(decoded.y[i], track.y[i], 0.000001);
+  }
+
+  // decoding again reuses the arrays
+  double* x = decoded.x;
+  assert_int_equal(mosquitto_payload_to_geojson_geometry(&message, &decoded), 0);
+  assert_ptr_equal(decoded.x, x);
+
+  geojson_geometry_destroy(&track);
+  geojson_geometry_destroy(&decoded);
+  assert_null(decoded.x);
+  assert_int_equal(decoded.capacity, 0);
+  mosquitto_payload_destroy(&payload);
+}
+
+static void test_mosquitto_payload_to_geojson_geometry_polygon_success(void** state)
+{
+  struct mosquitto_message message = { 0 };
+  message.payload = " { \"coordinates\" : [ [ [0,0], [4,0], [4,4], [0,4], [0,0] ],\n"
+                    " [[1,1],[1,2],[2,2],[1,1]] ], \"type\" : \"Polygon\" } ";
+  message.payloadlen = strlen(message.payload);
+  geojson_geometry polygon = geojson_geometry_init();
+  mosquitto_payload payload = mosquitto_payload_init(256);
+
+  assert_int_equal(mosquitto_payload_to_geojson_geometry(&message, &polygon), 0);
+  assert_int_equal(polygon.type, GEOJSON_POLYGON);
+  assert_int_equal(polygon.count, 9);
+  assert_int_equal(polygon.ring_count, 2);
+  assert_int_equal(polygon.ring_ends[0], 5);
+  assert_int_equal(polygon.ring_ends[1], 9);
+  assert_float_equal(polygon.x[6], 1, 0);
+  assert_float_equal(polygon.y[6], 2, 0);
+
+  assert_int_equal(geojson_geometry_to_mosquitto_payload(&polygon, &payload), 0);
+  assert_string_equal(
+      payload.payload,
+      "{\"type\":\"Polygon\",\"coordinates\":[[[0.000000,0.000000],[4.000000,0.000000],"
+      "[4.000000,4.000000],[0.000000,4.000000],[0.000000,0.000000]],[[1.000000,1.000000],"
+      "[1.000000,2.000000],[2.000000,2.000000],[1.000000,1.000000]]]}");
+
+  geojson_geometry_destroy(&polygon);
+  mosquitto_payload_destroy(&payload);
+}
+
+// layouts the two pass parser doesn't handle still parse through json-c
+static void test_mosquitto_payload_to_geojson_geometry_fallback_success(void** state)
+{
+  struct mosquitto_message message = { 0 };
+  message.payload = "{\"type\":\"Multi\\u0050oint\",\"coordinates\":[[1.5,2.5,100],[3,4]],"
+                    "\"bbox\":[1.5,2.5,3,4]}";
+  message.payloadlen = strlen(message.payload);
+  geojson_geometry points = geojson_geometry_init();
+
+  assert_int_equal(mosquitto_payload_to_geojson_geometry(&message, &points), 0);
+  assert_int_equal(points.type, GEOJSON_MULTI_POINT);
+  assert_int_equal(points.count, 2);
+  assert_float_equal(points.x[0], 1.5, 0);
+  assert_float_equal(points.y[0], 2.5, 0);
+  assert_float_equal(points.x[1], 3, 0);
+  assert_float_equal(points.y[1], 4, 0);
+
+  geojson_geometry_destroy(&points);
+}
+
+static void test_mosquitto_payload_to_geojson_geometry_invalid_fail(void** state)
+{
+  const char* payloads[] = {
+    // rings must be closed
+    "{\"type\":\"Polygon\",\"coordinates\":[[[0,0],[4,0],[4,4],[0,4]]]}",
+    "{\"type\":\"LineString\",\"coordinates\":[[1,2]]}",
+    "{\"type\":\"Point\",\"coordinates\":[[1,2]]}",
+    "{\"type\":\"MultiPoint\",\"coordinates\":[[1,\"2\"]]}",
+    "{\"type\":\"MultiPolygon\",\"coordinates\":[]}",
+    "{\"type\":\"LineString\"}",
+  };
+  struct mosquitto_message message = { 0 };
+  geojson_geometry geometry = geojson_geometry_init();
+
+  for (size_t i = 0; i < sizeof(payloads) / sizeof(payloads[0]); i++)
+  {
+    message.payload = (void*)payloads[i];
+    message.payloadlen = strlen(payloads[i]);
+    assert_int_equal(mosquitto_payload_to_geojson_geometry(&message, &geometry), -1);
+  }
+  assert_int_equal(mosquitto_payload_to_geojson_geometry(NULL, &geometry), -1);
+
+  geojson_geometry_destroy(&geometry);
+}
+
+static void test_geojson_geometry_to_mosquitto_payload_buffer_too_small_fail(void** state)
+{
+  geojson_geometry point = geojson_geometry_init();
+  mosquitto_payload payload = mosquitto_payload_init(54);
+
+  // a Point needs exactly one position
+  assert_int_equal(geojson_geometry_to_mosquitto_payload(&point, &payload), -1);
+
+  assert_true(geojson_geometry_reset(&point, GEOJSON_POINT, 1, 0));
+  assert_true(geojson_geometry_add_position(&point, -83.551071, -36.169784));
+  // 54 bytes of text leave no room for the terminator
+  assert_int_equal(geojson_geometry_to_mosquitto_payload(&point, &payload), -1);
+
+  mosquitto_payload_destroy(&payload);
+  payload = mosquitto_payload_init(55);
+  assert_int_equal(geojson_geometry_to_mosquitto_payload(&point, &payload), 0);
+  assert_string_equal(
+      payload.payload, "{\"type\":\"Point\",\"coordinates\":[-83.551071,-36.169784]}");
+
+  geojson_geometry_destroy(&point);
+  mosquitto_payload_destroy(&payload);
+}
+
 int test_json_handler()
 {
   const struct CMUnitTest tests[]
@@ -255,6 +592,9 @@ int test_json_handler()
           cmocka_unit_test(test_geojson_point_to_mosquitto_payload_null_type_fail),
           cmocka_unit_test(test_geojson_point_to_mosquitto_payload_output_null_fail),
           cmocka_unit_test(test_geojson_point_to_mosquitto_payload_output_buffer_too_small_fail),
+          cmocka_unit_test(test_geojson_point_to_mosquitto_payload_rounding_success),
+          cmocka_unit_test(test_geojson_point_to_mosquitto_payload_escaped_type_success),
+          cmocka_unit_test(test_geojson_point_to_mosquitto_payload_no_room_for_terminator_fail),
           cmocka_unit_test(test_geojson_point_set_coordinates_sucess),
           cmocka_unit_test(test_mosquitto_payload_to_geojson_point_min_payload_success),
           cmocka_unit_test(test_mosquitto_payload_to_geojson_point_max_payload_success),
@@ -264,6 +604,17 @@ int test_json_handler()
           cmocka_unit_test(test_mosquitto_payload_to_geojson_point_empty_json_fail),
           cmocka_unit_test(test_mosquitto_payload_to_geojson_point_not_geojson_fail),
           cmocka_unit_test(test_mosquitto_payload_to_geojson_point_not_point_fail),
-          cmocka_unit_test(test_mosquitto_payload_to_geojson_point_missing_coordinates_fail) };
+          cmocka_unit_test(test_mosquitto_payload_to_geojson_point_missing_coordinates_fail),
+          cmocka_unit_test(test_mosquitto_payload_to_geojson_point_reordered_payload_success),
+          cmocka_unit_test(test_mosquitto_payload_to_geojson_point_fallback_success),
+          cmocka_unit_test(test_mosquitto_payload_to_geojson_coordinates_payloadlen_success),
+          cmocka_unit_test(test_mosquitto_payload_to_geojson_coordinates_not_point_fail),
+          cmocka_unit_test(test_geojson_points_decode_batch_success),
+          cmocka_unit_test(test_geojson_points_decode_batch_too_many_messages_fail),
+          cmocka_unit_test(test_geojson_geometry_line_string_round_trip_success),
+          cmocka_unit_test(test_mosquitto_payload_to_geojson_geometry_polygon_success),
+          cmocka_unit_test(test_mosquitto_payload_to_geojson_geometry_fallback_success),
+          cmocka_unit_test(test_mosquitto_payload_to_geojson_geometry_invalid_fail),
+          cmocka_unit_test(test_geojson_geometry_to_mosquitto_payload_buffer_too_small_fail) };
   return cmocka_run_group_tests_name("json_handler", tests, NULL, NULL);
 }
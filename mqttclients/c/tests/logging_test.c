@@ -0,0 +1,142 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+// clang-format off
+// cmocka has to come after stddef.h
+#include <cmocka.h>
+// clang-format on
+
+#include "logging_test.h"
+
+#define TEST_OUTPUT_SIZE 1024
+
+static int setup(void** state)
+{
+  FILE* output = tmpfile();
+  if (output == NULL)
+  {
+    return -1;
+  }
+  *state = output;
+  return 0;
+}
+
+static int teardown(void** state)
+{
+  mqtt_log_set_output(NULL, false);
+  fclose((FILE*)*state);
+  return 0;
+}
+
+// Flushes the queued messages and returns everything written to the test output.
+static size_t read_output(FILE* output, char* buffer)
+{
+  mqtt_log_flush();
+  rewind(output);
+  size_t length = fread(buffer, 1, TEST_OUTPUT_SIZE - 1, output);
+  buffer[length] = '\0';
+  return length;
+}
+
+static void* log_from_thread(void* arg)
+{
+  mqtt_log_write(MQTT_LOG_LEVEL_INFO, APP_LOG_TAG, NULL, NULL, 0, "first");
+  return NULL;
+}
+
+// Text records look like the synchronous LOG_ macros
+static void test_mqtt_log_write_text_success(void** state)
+{
+  FILE* output = (FILE*)*state;
+  char buffer[TEST_OUTPUT_SIZE];
+  mqtt_log_set_output(output, false);
+
+  mqtt_log_write(MQTT_LOG_LEVEL_INFO, APP_LOG_TAG, NULL, NULL, 0, "value %d", 42);
+  mqtt_log_write(MQTT_LOG_LEVEL_INFO, NULL, NULL, NULL, 0, "detail");
+  mqtt_log_write(MQTT_LOG_LEVEL_WARNING, NULL, NULL, NULL, 0, "careful");
+  mqtt_log_write(MQTT_LOG_LEVEL_ERROR, NULL, "file.c", "function", 7, "failed: %s", "why");
+
+  read_output(output, buffer);
+  assert_string_equal(
+      buffer,
+      "\x1B[34m[App]\x1B[0m value 42\n"
+      "\tdetail\n"
+      "\x1B[33m[WARNING]\x1B[0m careful\n"
+      "\x1B[31m[ERROR]\x1B[0m failed: why \x1b[2m[file.c:function:7]\x1B[0m\n");
+}
+
+// Binary records carry the header, the strings and the message
+static void test_mqtt_log_write_binary_success(void** state)
+{
+  FILE* output = (FILE*)*state;
+  char buffer[TEST_OUTPUT_SIZE];
+  mqtt_log_binary_record header;
+  mqtt_log_set_output(output, true);
+
+  mqtt_log_write(MQTT_LOG_LEVEL_ERROR, NULL, "file.c", "function", 7, "failed");
+
+  size_t length = read_output(output, buffer);
+  assert_int_equal(length, sizeof(header) + strlen("file.c") + strlen("function") + strlen("failed"));
+  memcpy(&header, buffer, sizeof(header));
+  assert_int_equal(header.level, MQTT_LOG_LEVEL_ERROR);
+  assert_int_equal(header.line, 7);
+  assert_int_equal(header.tag_length, 0);
+  assert_int_equal(header.file_length, strlen("file.c"));
+  assert_int_equal(header.function_length, strlen("function"));
+  assert_int_equal(header.message_length, strlen("failed"));
+  assert_true(header.timestamp_ns > 0);
+  assert_memory_equal(buffer + sizeof(header), "file.cfunctionfailed", 20);
+}
+
+// Messages longer than the record are truncated and marked
+static void test_mqtt_log_write_truncated_success(void** state)
+{
+  FILE* output = (FILE*)*state;
+  char buffer[TEST_OUTPUT_SIZE];
+  char message[MQTT_LOG_MESSAGE_SIZE * 2];
+  mqtt_log_set_output(output, false);
+
+  memset(message, 'x', sizeof(message) - 1);
+  message[sizeof(message) - 1] = '\0';
+  mqtt_log_write(MQTT_LOG_LEVEL_INFO, NULL, NULL, NULL, 0, "%s", message);
+
+  size_t length = read_output(output, buffer);
+  // Tab, message and newline
+  assert_int_equal(length, MQTT_LOG_MESSAGE_SIZE + 1);
+  assert_memory_equal(buffer + length - 4, "...\n", 4);
+}
+
+// Messages from different threads are written in the order they were logged
+static void test_mqtt_log_write_threads_ordered_success(void** state)
+{
+  FILE* output = (FILE*)*state;
+  char buffer[TEST_OUTPUT_SIZE];
+  pthread_t thread;
+  mqtt_log_set_output(output, false);
+
+  assert_int_equal(pthread_create(&thread, NULL, log_from_thread, NULL), 0);
+  pthread_join(thread, NULL);
+  mqtt_log_write(MQTT_LOG_LEVEL_INFO, APP_LOG_TAG, NULL, NULL, 0, "second");
+
+  read_output(output, buffer);
+  assert_string_equal(buffer, "\x1B[34m[App]\x1B[0m first\n\x1B[34m[App]\x1B[0m second\n");
+}
+
+int test_logging()
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test_setup_teardown(test_mqtt_log_write_text_success, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_mqtt_log_write_binary_success, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_mqtt_log_write_truncated_success, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_mqtt_log_write_threads_ordered_success, setup, teardown)
+  };
+  return cmocka_run_group_tests_name("logging", tests, NULL, NULL);
+}
@@ -2,7 +2,27 @@
 // SPDX-License-Identifier: MIT
 
 #include "json_handler_test.h"
+#include "logging_test.h"
+#include "mqtt_client_pool_test.h"
 #include "mqtt_client_test.h"
+#include "mqtt_compression_test.h"
+#include "mqtt_event_loop_test.h"
+#include "mqtt_executor_test.h"
+#include "mqtt_hash_test.h"
+#include "mqtt_message_ring_test.h"
+#include "mqtt_recorder_test.h"
+#include "mqtt_token_bucket_test.h"
+#include "mqtt_tls_context_test.h"
+#include "mqtt_topic_router_test.h"
+#include "position_batcher_test.h"
+#include "position_codec_test.h"
+#include "position_geofences_test.h"
+#include "position_geohash_test.h"
+#include "position_grid_test.h"
+#include "position_kinematics_test.h"
+#include "position_store_test.h"
+#include "position_stream_codec_test.h"
+#include "position_trajectory_test.h"
 
 int main()
 {
@@ -10,6 +30,26 @@ int main()
 
   result += test_mqtt_client();
   result += test_json_handler();
+  result += test_mqtt_event_loop();
+  result += test_mqtt_client_pool();
+  result += test_mqtt_tls_context();
+  result += test_logging();
+  result += test_mqtt_topic_router();
+  result += test_mqtt_executor();
+  result += test_mqtt_hash();
+  result += test_mqtt_message_ring();
+  result += test_position_codec();
+  result += test_position_stream_codec();
+  result += test_position_batcher();
+  result += test_mqtt_compression();
+  result += test_mqtt_token_bucket();
+  result += test_position_trajectory();
+  result += test_position_store();
+  result += test_position_grid();
+  result += test_position_geofences();
+  result += test_position_kinematics();
+  result += test_position_geohash();
+  result += test_mqtt_recorder();
 
   return result;
 }
@@ -0,0 +1,184 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+// clang-format off
+// cmocka has to come after stddef.h
+#include <cmocka.h>
+// clang-format on
+
+#include "mosquitto.h"
+#include "mqtt_client_pool_test.h"
+#include "mqtt_message_ring.h"
+#include "mqtt_protocol.h"
+
+#define TEST_POOL_SIZE 8
+#define TEST_TOPIC_COUNT 1000
+
+static mqtt_client_pool_connection test_connections[TEST_POOL_SIZE];
+static mqtt_client_pool test_pool = { test_connections, TEST_POOL_SIZE };
+
+// A topic always maps to the same connection
+static void test_mqtt_client_pool_connection_for_topic_stable_success(void** state)
+{
+  mqtt_client_pool_connection* connection
+      = mqtt_client_pool_connection_for_topic(&test_pool, "vehicles/car-1/position");
+
+  assert_ptr_equal(
+      mqtt_client_pool_connection_for_topic(&test_pool, "vehicles/car-1/position"), connection);
+  assert_true(connection >= test_connections && connection < test_connections + TEST_POOL_SIZE);
+}
+
+// Topics are spread over every connection in the pool
+static void test_mqtt_client_pool_connection_for_topic_spread_success(void** state)
+{
+  int counts[TEST_POOL_SIZE] = { 0 };
+  char topic[64];
+
+  for (int i = 0; i < TEST_TOPIC_COUNT; i++)
+  {
+    snprintf(topic, sizeof(topic), "vehicles/car-%d/position", i);
+    counts[mqtt_client_pool_connection_for_topic(&test_pool, topic) - test_connections]++;
+  }
+
+  for (int i = 0; i < TEST_POOL_SIZE; i++)
+  {
+    // Within 50% of an even share
+    assert_in_range(
+        counts[i],
+        TEST_TOPIC_COUNT / TEST_POOL_SIZE / 2,
+        TEST_TOPIC_COUNT / TEST_POOL_SIZE * 3 / 2);
+  }
+}
+
+// A pool of one connection sends everything over it
+static void test_mqtt_client_pool_connection_for_topic_single_success(void** state)
+{
+  mqtt_client_pool single_pool = { test_connections, 1 };
+
+  assert_ptr_equal(mqtt_client_pool_connection_for_topic(&single_pool, "a"), test_connections);
+  assert_ptr_equal(mqtt_client_pool_connection_for_topic(&single_pool, "b/c"), test_connections);
+}
+
+// Binds a socket to a free port on the loopback interface. A listening socket accepts TCP
+// connections without a broker behind it, so mosquitto's connect succeeds; a socket that doesn't
+// listen refuses them.
+static int open_local_socket(bool listening, int* port)
+{
+  struct sockaddr_in address = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+  socklen_t length = sizeof(address);
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+  assert_true(
+      fd >= 0 && bind(fd, (struct sockaddr*)&address, sizeof(address)) == 0
+      && (!listening || listen(fd, TEST_POOL_SIZE) == 0)
+      && getsockname(fd, (struct sockaddr*)&address, &length) == 0);
+  *port = ntohs(address.sin_port);
+  return fd;
+}
+
+static bool init_local_pool(mqtt_client_pool* pool, int size, int port)
+{
+  mqtt_client_connection_settings settings = { .client_id = "pool-test",
+                                               .hostname = "127.0.0.1",
+                                               .keep_alive_in_seconds = 30,
+                                               .tcp_port = port,
+                                               .clean_session = true };
+  mqtt_client_obj obj = { .mqtt_version = MQTT_PROTOCOL_V5 };
+
+  return mqtt_client_pool_init(pool, &settings, size, true, NULL, &obj);
+}
+
+// Every connection is connected with its own network thread, and publishing goes through the
+// connection responsible for the topic
+static void test_mqtt_client_pool_connect_publish_success(void** state)
+{
+  mqtt_client_pool pool;
+  int port;
+  int listener = open_local_socket(true, &port);
+
+  assert_true(init_local_pool(&pool, 2, port));
+  assert_int_equal(mqtt_client_pool_connect(&pool), MOSQ_ERR_SUCCESS);
+  assert_true(pool.connections[0].thread_started);
+  assert_true(pool.connections[1].thread_started);
+
+  assert_int_equal(
+      mqtt_client_pool_publish(&pool, NULL, "vehicles/car-1/position", 2, "{}", 0, false, NULL),
+      MOSQ_ERR_SUCCESS);
+
+  mqtt_client_pool_destroy(&pool);
+  assert_null(pool.connections);
+  close(listener);
+}
+
+// When a connection fails, the connections started before it are stopped and their threads joined
+static void test_mqtt_client_pool_connect_partial_fail(void** state)
+{
+  mqtt_client_pool pool;
+  int port;
+  int closed_port;
+  int listener = open_local_socket(true, &port);
+  int closed = open_local_socket(false, &closed_port);
+
+  assert_true(init_local_pool(&pool, 3, port));
+  pool.connections[1].obj.tcp_port = closed_port;
+
+  assert_int_not_equal(mqtt_client_pool_connect(&pool), MOSQ_ERR_SUCCESS);
+  for (int i = 0; i < pool.size; i++)
+  {
+    assert_false(pool.connections[i].thread_started);
+  }
+
+  mqtt_client_pool_destroy(&pool);
+  close(closed);
+  close(listener);
+}
+
+// A message ring takes one producer, so a pool whose connections would all push into it is
+// rejected
+static void test_mqtt_client_pool_init_shared_message_ring_fail(void** state)
+{
+  mqtt_client_pool pool;
+  mqtt_client_connection_settings settings = { .hostname = "127.0.0.1", .tcp_port = 1883 };
+  mqtt_client_obj obj = { .mqtt_version = MQTT_PROTOCOL_V5,
+                          .message_ring = mqtt_message_ring_create(4) };
+  assert_non_null(obj.message_ring);
+
+  assert_false(mqtt_client_pool_init(&pool, &settings, 2, false, NULL, &obj));
+  assert_null(pool.connections);
+  assert_int_equal(pool.size, 0);
+
+  mqtt_message_ring_destroy(obj.message_ring);
+}
+
+static int group_setup(void** state)
+{
+  return mosquitto_lib_init();
+}
+
+static int group_teardown(void** state)
+{
+  return mosquitto_lib_cleanup();
+}
+
+int test_mqtt_client_pool()
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_mqtt_client_pool_connection_for_topic_stable_success),
+    cmocka_unit_test(test_mqtt_client_pool_connection_for_topic_spread_success),
+    cmocka_unit_test(test_mqtt_client_pool_connection_for_topic_single_success),
+    cmocka_unit_test(test_mqtt_client_pool_connect_publish_success),
+    cmocka_unit_test(test_mqtt_client_pool_connect_partial_fail),
+    cmocka_unit_test(test_mqtt_client_pool_init_shared_message_ring_fail)
+  };
+  return cmocka_run_group_tests_name("mqtt_client_pool", tests, group_setup, group_teardown);
+}
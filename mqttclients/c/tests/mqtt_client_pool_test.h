@@ -0,0 +1,11 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef MQTT_CLIENT_POOL_TEST_H
+#define MQTT_CLIENT_POOL_TEST_H
+
+#include "mqtt_client_pool.h"
+
+int test_mqtt_client_pool();
+
+#endif // MQTT_CLIENT_POOL_TEST_H
@@ -110,6 +110,39 @@ static void test_set_int_connection_setting_invalid_int_failure(void** state)
   assert_null(connection_settings->tcp_port);
 }
 
+// Test successful setting of a double environment variable's default value
+static void test_set_double_connection_setting_default_value_sucess(void** state)
+{
+  double rate;
+
+  assert_true(set_double_connection_setting(&rate, "TELEMETRY_RATE", 0.5));
+  assert_float_equal(rate, 0.5, 0);
+}
+
+// Test successful setting of a double environment variable
+static void test_set_double_connection_setting_sucess(void** state)
+{
+  double rate;
+
+  setenv("TELEMETRY_RATE", "0.25", 1);
+  assert_true(set_double_connection_setting(&rate, "TELEMETRY_RATE", 0));
+  assert_float_equal(rate, 0.25, 0);
+  setenv("TELEMETRY_RATE", "2e5", 1);
+  assert_true(set_double_connection_setting(&rate, "TELEMETRY_RATE", 0));
+  assert_float_equal(rate, 200000, 0);
+}
+
+// Test failure if invalid double environment variable is defined
+static void test_set_double_connection_setting_invalid_double_failure(void** state)
+{
+  double rate;
+
+  setenv("TELEMETRY_RATE", invalid_env_var, 1);
+  assert_false(set_double_connection_setting(&rate, "TELEMETRY_RATE", 0));
+  setenv("TELEMETRY_RATE", "10/s", 1);
+  assert_false(set_double_connection_setting(&rate, "TELEMETRY_RATE", 0));
+}
+
 // Test successful setting of an bool environment variable's default value
 static void test_set_bool_connection_setting_default_value_sucess(void** state)
 {
@@ -226,6 +259,13 @@ int test_mqtt_client()
           cmocka_unit_test_setup_teardown(test_set_int_connection_setting_sucess, setup, teardown),
           cmocka_unit_test_setup_teardown(
               test_set_int_connection_setting_invalid_int_failure, setup, teardown),
+          // double connection settings tests
+          cmocka_unit_test_setup_teardown(
+              test_set_double_connection_setting_default_value_sucess, setup, teardown),
+          cmocka_unit_test_setup_teardown(
+              test_set_double_connection_setting_sucess, setup, teardown),
+          cmocka_unit_test_setup_teardown(
+              test_set_double_connection_setting_invalid_double_failure, setup, teardown),
           // bool connection settings tests
           cmocka_unit_test_setup_teardown(
               test_set_bool_connection_setting_default_value_sucess, setup, teardown),
@@ -0,0 +1,254 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+// clang-format off
+// cmocka has to come after stddef.h
+#include <cmocka.h>
+// clang-format on
+
+#include "mqtt_compression_test.h"
+#include "mqtt_protocol.h"
+
+#define POINT_PAYLOAD "{\"type\":\"Point\",\"coordinates\":[-83.551071,-36.169784]}"
+
+#ifdef MQTT_PAYLOAD_COMPRESSION
+
+// Any content can be used as a dictionary, a trained one is only smaller for the same gain
+static const char dictionary[]
+    = "{\"type\":\"Point\",\"coordinates\":[-83.550000,-36.160000]}"
+      "{\"type\":\"MultiPoint\",\"coordinates\":[[-83.550000,-36.160000]]}";
+
+// Compresses a payload and wraps a copy of it in a message tagged like a producer would
+static struct mosquitto_message compressed_message(
+    const mqtt_compression* compression,
+    const char* payload,
+    char* buffer,
+    size_t buffer_length,
+    mosquitto_property** props)
+{
+  const void* compressed;
+  int compressed_length;
+  assert_int_equal(
+      mqtt_compression_compress(
+          compression, payload, (int)strlen(payload), &compressed, &compressed_length),
+      MOSQ_ERR_SUCCESS);
+  assert_true((size_t)compressed_length <= buffer_length);
+  memcpy(buffer, compressed, compressed_length);
+  assert_int_equal(mqtt_compression_add_property(props), MOSQ_ERR_SUCCESS);
+  return (struct mosquitto_message){
+    .topic = "vehicles/1/position", .payload = buffer, .payloadlen = compressed_length, .qos = 1
+  };
+}
+
+static void test_mqtt_compression_round_trip_success(void** state)
+{
+  char buffer[256];
+  mosquitto_property* props = NULL;
+  struct mosquitto_message output;
+  mqtt_compression* compression = mqtt_compression_create(
+      dictionary, sizeof(dictionary) - 1, MQTT_COMPRESSION_DEFAULT_LEVEL);
+  assert_non_null(compression);
+
+  struct mosquitto_message message
+      = compressed_message(compression, POINT_PAYLOAD, buffer, sizeof(buffer), &props);
+  // without the dictionary the frame would be larger than the point itself
+  const void* plain;
+  int plain_length;
+  mqtt_compression* no_dictionary
+      = mqtt_compression_create(NULL, 0, MQTT_COMPRESSION_DEFAULT_LEVEL);
+  assert_int_equal(
+      mqtt_compression_compress(
+          no_dictionary, POINT_PAYLOAD, (int)strlen(POINT_PAYLOAD), &plain, &plain_length),
+      MOSQ_ERR_SUCCESS);
+  assert_true(message.payloadlen < (int)strlen(POINT_PAYLOAD));
+  assert_true(message.payloadlen < plain_length);
+  mqtt_compression_destroy(no_dictionary);
+
+  assert_int_equal(
+      mqtt_compression_decompress_message(compression, &message, props, &output),
+      MOSQ_ERR_SUCCESS);
+  assert_int_equal(output.payloadlen, strlen(POINT_PAYLOAD));
+  assert_string_equal((char*)output.payload, POINT_PAYLOAD);
+  assert_string_equal(output.topic, message.topic);
+  assert_int_equal(output.qos, message.qos);
+
+  // the buffer of the thread is reused and grows for larger payloads
+  char large[4096];
+  for (size_t i = 0; i < sizeof(large) - 1; i++)
+  {
+    large[i] = POINT_PAYLOAD[i % strlen(POINT_PAYLOAD)];
+  }
+  large[sizeof(large) - 1] = '\0';
+  mosquitto_property_free_all(&props);
+  message = compressed_message(compression, large, buffer, sizeof(buffer), &props);
+  assert_int_equal(
+      mqtt_compression_decompress_message(compression, &message, props, &output),
+      MOSQ_ERR_SUCCESS);
+  assert_int_equal(output.payloadlen, sizeof(large) - 1);
+  assert_string_equal((char*)output.payload, large);
+
+  mosquitto_property_free_all(&props);
+  mqtt_compression_destroy(compression);
+}
+
+static void test_mqtt_compression_untagged_success(void** state)
+{
+  mosquitto_property* props = NULL;
+  struct mosquitto_message output;
+  struct mosquitto_message message
+      = { .topic = "vehicles/1/position", .payload = POINT_PAYLOAD, .payloadlen = 4 };
+  mqtt_compression* compression = mqtt_compression_create(NULL, 0, MQTT_COMPRESSION_DEFAULT_LEVEL);
+  assert_non_null(compression);
+
+  // without properties, or with other user properties, the payload is left as it is
+  assert_int_equal(
+      mqtt_compression_decompress_message(compression, &message, NULL, &output), MOSQ_ERR_SUCCESS);
+  assert_ptr_equal(output.payload, message.payload);
+  assert_int_equal(output.payloadlen, 4);
+
+  mosquitto_property_add_string_pair(&props, MQTT_PROP_USER_PROPERTY, "source", "gps");
+  mosquitto_property_add_string(&props, MQTT_PROP_CONTENT_TYPE, "application/json");
+  assert_int_equal(
+      mqtt_compression_decompress_message(compression, &message, props, &output), MOSQ_ERR_SUCCESS);
+  assert_ptr_equal(output.payload, message.payload);
+
+  mosquitto_property_free_all(&props);
+  mqtt_compression_destroy(compression);
+}
+
+static void test_mqtt_compression_other_dictionary_fail(void** state)
+{
+  char buffer[256];
+  mosquitto_property* props = NULL;
+  struct mosquitto_message output;
+  mqtt_compression* producer = mqtt_compression_create(
+      dictionary, sizeof(dictionary) - 1, MQTT_COMPRESSION_DEFAULT_LEVEL);
+  mqtt_compression* consumer = mqtt_compression_create(NULL, 0, MQTT_COMPRESSION_DEFAULT_LEVEL);
+  assert_non_null(producer);
+  assert_non_null(consumer);
+
+  struct mosquitto_message message
+      = compressed_message(producer, POINT_PAYLOAD, buffer, sizeof(buffer), &props);
+  assert_int_equal(
+      mqtt_compression_decompress_message(consumer, &message, props, &output),
+      MOSQ_ERR_MALFORMED_PACKET);
+
+  // a tagged payload that isn't a zstd frame
+  message.payload = POINT_PAYLOAD;
+  message.payloadlen = (int)strlen(POINT_PAYLOAD);
+  assert_int_equal(
+      mqtt_compression_decompress_message(producer, &message, props, &output),
+      MOSQ_ERR_MALFORMED_PACKET);
+
+  mosquitto_property_free_all(&props);
+  mqtt_compression_destroy(producer);
+  mqtt_compression_destroy(consumer);
+}
+
+static void test_mqtt_compression_unsupported_encoding_fail(void** state)
+{
+  mosquitto_property* props = NULL;
+  struct mosquitto_message output;
+  struct mosquitto_message message
+      = { .topic = "vehicles/1/position", .payload = POINT_PAYLOAD, .payloadlen = 4 };
+  mqtt_compression* compression = mqtt_compression_create(NULL, 0, MQTT_COMPRESSION_DEFAULT_LEVEL);
+  assert_non_null(compression);
+
+  mosquitto_property_add_string_pair(
+      &props, MQTT_PROP_USER_PROPERTY, MQTT_CONTENT_ENCODING_PROPERTY, "lz4");
+  assert_int_equal(
+      mqtt_compression_decompress_message(compression, &message, props, &output),
+      MOSQ_ERR_NOT_SUPPORTED);
+
+  mosquitto_property_free_all(&props);
+  mqtt_compression_destroy(compression);
+}
+
+static void test_mqtt_compression_payload_too_large_fail(void** state)
+{
+  // zeros compress to a few bytes, but a receiver must not allocate for all of them
+  size_t length = MQTT_COMPRESSION_MAX_PAYLOAD_LENGTH + 1;
+  char* zeros = calloc(1, length + 1);
+  char* buffer = malloc(length);
+  mosquitto_property* props = NULL;
+  struct mosquitto_message output;
+  mqtt_compression* compression = mqtt_compression_create(NULL, 0, MQTT_COMPRESSION_DEFAULT_LEVEL);
+  assert_non_null(zeros);
+  assert_non_null(buffer);
+  assert_non_null(compression);
+
+  memset(zeros, '0', length);
+  struct mosquitto_message message = compressed_message(compression, zeros, buffer, length, &props);
+  assert_true(message.payloadlen < 1024);
+  assert_int_equal(
+      mqtt_compression_decompress_message(compression, &message, props, &output),
+      MOSQ_ERR_PAYLOAD_SIZE);
+
+  mosquitto_property_free_all(&props);
+  mqtt_compression_destroy(compression);
+  free(buffer);
+  free(zeros);
+}
+
+static void test_mqtt_compression_invalid_fail(void** state)
+{
+  const void* output;
+  int output_length;
+  struct mosquitto_message message = { 0 };
+  struct mosquitto_message decompressed;
+
+  assert_int_equal(
+      mqtt_compression_compress(NULL, POINT_PAYLOAD, 4, &output, &output_length), MOSQ_ERR_INVAL);
+  assert_int_equal(
+      mqtt_compression_decompress_message(NULL, &message, NULL, &decompressed), MOSQ_ERR_INVAL);
+  assert_null(mqtt_compression_load("does/not/exist.dict", MQTT_COMPRESSION_DEFAULT_LEVEL));
+  mqtt_compression_destroy(NULL);
+}
+
+int test_mqtt_compression()
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_mqtt_compression_round_trip_success),
+    cmocka_unit_test(test_mqtt_compression_untagged_success),
+    cmocka_unit_test(test_mqtt_compression_other_dictionary_fail),
+    cmocka_unit_test(test_mqtt_compression_unsupported_encoding_fail),
+    cmocka_unit_test(test_mqtt_compression_payload_too_large_fail),
+    cmocka_unit_test(test_mqtt_compression_invalid_fail)
+  };
+  return cmocka_run_group_tests_name("mqtt_compression", tests, NULL, NULL);
+}
+
+#else
+
+// Without the PAYLOAD_COMPRESSION option contexts can't be created, the samples check for NULL
+static void test_mqtt_compression_not_built_fail(void** state)
+{
+  const void* output;
+  int output_length;
+  struct mosquitto_message message = { .payload = POINT_PAYLOAD, .payloadlen = 4 };
+  struct mosquitto_message decompressed;
+
+  assert_null(mqtt_compression_create(NULL, 0, MQTT_COMPRESSION_DEFAULT_LEVEL));
+  assert_int_equal(
+      mqtt_compression_compress(NULL, POINT_PAYLOAD, 4, &output, &output_length),
+      MOSQ_ERR_NOT_SUPPORTED);
+  assert_int_equal(
+      mqtt_compression_decompress_message(NULL, &message, NULL, &decompressed),
+      MOSQ_ERR_NOT_SUPPORTED);
+  mqtt_compression_destroy(NULL);
+}
+
+int test_mqtt_compression()
+{
+  const struct CMUnitTest tests[] = { cmocka_unit_test(test_mqtt_compression_not_built_fail) };
+  return cmocka_run_group_tests_name("mqtt_compression", tests, NULL, NULL);
+}
+
+#endif // MQTT_PAYLOAD_COMPRESSION
@@ -0,0 +1,11 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef MQTT_COMPRESSION_TEST_H
+#define MQTT_COMPRESSION_TEST_H
+
+#include "mqtt_compression.h"
+
+int test_mqtt_compression();
+
+#endif // MQTT_COMPRESSION_TEST_H
@@ -0,0 +1,160 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+// clang-format off
+// cmocka has to come after stddef.h
+#include <cmocka.h>
+// clang-format on
+
+#include "mqtt_event_loop_test.h"
+#include "mqtt_setup.h"
+
+typedef struct event_loop_test_counter
+{
+  mqtt_event_loop* loop;
+  mqtt_event_timer* timer;
+  int count;
+  int stop_after;
+} event_loop_test_counter;
+
+static void count_and_stop(void* context)
+{
+  event_loop_test_counter* counter = (event_loop_test_counter*)context;
+  counter->count++;
+  if (counter->count >= counter->stop_after)
+  {
+    if (counter->timer != NULL)
+    {
+      mqtt_event_loop_remove_timer(counter->loop, counter->timer);
+      counter->timer = NULL;
+    }
+    keep_running = 0;
+    mqtt_event_loop_wakeup(counter->loop);
+  }
+}
+
+static void remove_both_and_stop(void* context)
+{
+  event_loop_test_counter* counters = (event_loop_test_counter*)context;
+  counters[0].count++;
+  for (int i = 0; i < 2; i++)
+  {
+    mqtt_event_loop_remove_timer(counters[i].loop, counters[i].timer);
+    counters[i].timer = NULL;
+  }
+  keep_running = 0;
+}
+
+static int setup(void** state)
+{
+  mqtt_event_loop* loop = malloc(sizeof(mqtt_event_loop));
+  if (loop == NULL || !mqtt_event_loop_init(loop))
+  {
+    free(loop);
+    return -1;
+  }
+  keep_running = 1;
+  *state = loop;
+
+  return 0;
+}
+
+static int teardown(void** state)
+{
+  mqtt_event_loop_destroy((mqtt_event_loop*)*state);
+  free(*state);
+  keep_running = 1;
+
+  return 0;
+}
+
+// Posted work runs on the loop thread in the order it was posted
+static void test_mqtt_event_loop_post_success(void** state)
+{
+  mqtt_event_loop* loop = (mqtt_event_loop*)*state;
+  event_loop_test_counter counter = { .loop = loop, .stop_after = 3 };
+
+  assert_true(mqtt_event_loop_post(loop, count_and_stop, &counter));
+  assert_true(mqtt_event_loop_post(loop, count_and_stop, &counter));
+  assert_true(mqtt_event_loop_post(loop, count_and_stop, &counter));
+
+  assert_int_equal(mqtt_event_loop_run(loop), 0);
+  assert_int_equal(counter.count, 3);
+}
+
+// A repeating timer keeps firing until it is removed from its own callback
+static void test_mqtt_event_loop_repeating_timer_success(void** state)
+{
+  mqtt_event_loop* loop = (mqtt_event_loop*)*state;
+  event_loop_test_counter counter = { .loop = loop, .stop_after = 3 };
+
+  counter.timer = mqtt_event_loop_add_timer(loop, 0, 1, count_and_stop, &counter);
+  assert_non_null(counter.timer);
+
+  assert_int_equal(mqtt_event_loop_run(loop), 0);
+  assert_int_equal(counter.count, 3);
+  assert_null(counter.timer);
+}
+
+// A timer removed while its own event is pending in the same batch doesn't fire, and isn't freed
+// by posted work that runs earlier in that batch
+static void test_mqtt_event_loop_remove_pending_timer_success(void** state)
+{
+  mqtt_event_loop* loop = (mqtt_event_loop*)*state;
+  event_loop_test_counter counters[2] = { { .loop = loop }, { .loop = loop } };
+  event_loop_test_counter posted = { .loop = loop, .stop_after = 2 };
+
+  // The batch holds the first timer, the wakeup and then the second timer, in the order they
+  // became ready
+  counters[0].timer = mqtt_event_loop_add_timer(loop, 0, 0, remove_both_and_stop, counters);
+  assert_non_null(counters[0].timer);
+  usleep(2000);
+  assert_true(mqtt_event_loop_post(loop, count_and_stop, &posted));
+  counters[1].timer = mqtt_event_loop_add_timer(loop, 0, 0, remove_both_and_stop, counters);
+  assert_non_null(counters[1].timer);
+  usleep(2000);
+
+  assert_int_equal(mqtt_event_loop_run(loop), 0);
+  assert_int_equal(counters[0].count, 1);
+  assert_int_equal(posted.count, 1);
+}
+
+// The loop doesn't wait at all once keep_running has been cleared
+static void test_mqtt_event_loop_run_stopped_success(void** state)
+{
+  mqtt_event_loop* loop = (mqtt_event_loop*)*state;
+  event_loop_test_counter counter = { .loop = loop, .stop_after = 1 };
+
+  keep_running = 0;
+  assert_true(mqtt_event_loop_post(loop, count_and_stop, &counter));
+
+  // Work posted before the stop still runs
+  assert_int_equal(mqtt_event_loop_run(loop), 0);
+  assert_int_equal(counter.count, 1);
+}
+
+// Adding a timer to a loop that failed to initialize fails
+static void test_mqtt_event_loop_add_timer_null_loop_fail(void** state)
+{
+  assert_null(mqtt_event_loop_add_timer(NULL, 0, 0, count_and_stop, NULL));
+}
+
+int test_mqtt_event_loop()
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test_setup_teardown(test_mqtt_event_loop_post_success, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_mqtt_event_loop_repeating_timer_success, setup, teardown),
+    cmocka_unit_test_setup_teardown(
+        test_mqtt_event_loop_remove_pending_timer_success, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_mqtt_event_loop_run_stopped_success, setup, teardown),
+    cmocka_unit_test(test_mqtt_event_loop_add_timer_null_loop_fail)
+  };
+  return cmocka_run_group_tests_name("mqtt_event_loop", tests, NULL, NULL);
+}
@@ -0,0 +1,231 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+// clang-format off
+// cmocka has to come after stddef.h
+#include <cmocka.h>
+// clang-format on
+
+#include "mqtt_callbacks.h"
+#include "mqtt_executor_test.h"
+#include "mqtt_protocol.h"
+#include "mqtt_setup.h"
+
+#define TOPICS 8
+#define MESSAGES_PER_TOPIC 500
+
+typedef struct received_messages
+{
+  pthread_mutex_t mutex;
+  int count[TOPICS];
+  bool in_order;
+  bool on_network_thread;
+  pthread_t network_thread;
+  uint32_t expiry_interval;
+} received_messages;
+
+static void record_message(
+    struct mosquitto* mosq,
+    const struct mosquitto_message* message,
+    const mosquitto_property* props,
+    void* context)
+{
+  received_messages* received = (received_messages*)context;
+  int topic;
+  int sequence;
+  uint32_t value = 0;
+
+  sscanf(message->topic, "vehicles/%d", &topic);
+  sscanf((const char*)message->payload, "%d", &sequence);
+  mosquitto_property_read_int32(props, MQTT_PROP_MESSAGE_EXPIRY_INTERVAL, &value, false);
+
+  pthread_mutex_lock(&received->mutex);
+  received->in_order &= sequence == received->count[topic];
+  received->count[topic]++;
+  received->on_network_thread |= pthread_equal(pthread_self(), received->network_thread);
+  received->expiry_interval = value;
+  pthread_mutex_unlock(&received->mutex);
+}
+
+static void slow_message(
+    struct mosquitto* mosq,
+    const struct mosquitto_message* message,
+    const mosquitto_property* props,
+    void* context)
+{
+  usleep(1000);
+  record_message(mosq, message, props, context);
+}
+
+static void init_received(received_messages* received)
+{
+  memset(received, 0, sizeof(*received));
+  pthread_mutex_init(&received->mutex, NULL);
+  received->in_order = true;
+  received->network_thread = pthread_self();
+}
+
+static int received_count(received_messages* received, int topic)
+{
+  pthread_mutex_lock(&received->mutex);
+  int count = received->count[topic];
+  pthread_mutex_unlock(&received->mutex);
+  return count;
+}
+
+static void submit(
+    mqtt_executor* executor,
+    mqtt_message_handler handler,
+    received_messages* received,
+    int topic,
+    int sequence)
+{
+  struct mosquitto_message message = { 0 };
+  char topic_name[32];
+  char payload[16];
+
+  snprintf(topic_name, sizeof(topic_name), "vehicles/%d", topic);
+  message.topic = topic_name;
+  message.payloadlen = snprintf(payload, sizeof(payload), "%d", sequence);
+  message.payload = payload;
+  assert_int_equal(
+      mqtt_executor_submit(executor, NULL, &message, NULL, handler, received), MOSQ_ERR_SUCCESS);
+
+  // The executor has its own copy, so the buffers can be reused right away.
+  memset(topic_name, 'x', sizeof(topic_name) - 1);
+  memset(payload, 'x', sizeof(payload) - 1);
+}
+
+// Messages on one topic are handled in order and off the submitting thread
+static void test_mqtt_executor_per_topic_order_success(void** state)
+{
+  received_messages received;
+  init_received(&received);
+  mqtt_executor* executor = mqtt_executor_create(4, 16);
+  assert_non_null(executor);
+
+  for (int sequence = 0; sequence < MESSAGES_PER_TOPIC; sequence++)
+  {
+    for (int topic = 0; topic < TOPICS; topic++)
+    {
+      submit(executor, record_message, &received, topic, sequence);
+    }
+  }
+  // Destroying handles every submitted message first
+  mqtt_executor_destroy(executor);
+
+  for (int topic = 0; topic < TOPICS; topic++)
+  {
+    assert_int_equal(received.count[topic], MESSAGES_PER_TOPIC);
+  }
+  assert_true(received.in_order);
+  assert_false(received.on_network_thread);
+}
+
+// Metrics count the messages of each shard and the time spent in the handler
+static void test_mqtt_executor_metrics_success(void** state)
+{
+  received_messages received;
+  mqtt_executor_shard_metrics metrics;
+  uint64_t processed = 0;
+  uint64_t full_waits = 0;
+  size_t max_queue_depth = 0;
+  init_received(&received);
+  mqtt_executor* executor = mqtt_executor_create(2, 4);
+  assert_non_null(executor);
+  assert_int_equal(mqtt_executor_shard_count(executor), 2);
+
+  int shard = mqtt_executor_shard_for_topic(executor, "vehicles/0");
+  for (int sequence = 0; sequence < 20; sequence++)
+  {
+    submit(executor, slow_message, &received, 0, sequence);
+  }
+
+  assert_true(mqtt_executor_get_metrics(executor, shard, &metrics));
+  assert_int_equal(metrics.submitted, 20);
+  assert_true(metrics.queue_depth <= 4);
+  assert_false(mqtt_executor_get_metrics(executor, 2, &metrics));
+
+  while (received_count(&received, 0) < 20)
+  {
+    usleep(1000);
+  }
+  for (int i = 0; i < mqtt_executor_shard_count(executor); i++)
+  {
+    assert_true(mqtt_executor_get_metrics(executor, i, &metrics));
+    processed += metrics.processed;
+    full_waits += metrics.full_waits;
+    if (metrics.max_queue_depth > max_queue_depth)
+    {
+      max_queue_depth = metrics.max_queue_depth;
+    }
+    if (i == shard)
+    {
+      assert_true(metrics.total_handler_ns >= metrics.max_handler_ns);
+      assert_true(metrics.max_handler_ns >= 1000000);
+      assert_true(metrics.max_wait_ns > 0);
+    }
+  }
+  mqtt_executor_destroy(executor);
+
+  // processed is counted after the handler returns, so it may lag count by a message
+  assert_true(processed >= 19);
+  // The handler is much slower than submitting, so the 4 message queue filled up
+  assert_int_equal(max_queue_depth, 4);
+  assert_true(full_waits > 0);
+}
+
+static void test_mqtt_executor_create_fail(void** state)
+{
+  assert_null(mqtt_executor_create(0, 16));
+  assert_null(mqtt_executor_create(4, 0));
+}
+
+// on_message hands messages and their properties to the executor when one is set
+static void test_on_message_executor_success(void** state)
+{
+  received_messages received;
+  mqtt_client_obj obj = { 0 };
+  struct mosquitto_message message = { 0 };
+  mosquitto_property* props = NULL;
+  mqtt_topic_router* router = mqtt_topic_router_create();
+  init_received(&received);
+
+  obj.router = router;
+  obj.executor = mqtt_executor_create(2, 16);
+  assert_non_null(obj.executor);
+  assert_true(mqtt_topic_router_add(router, "vehicles/+", record_message, &received) > 0);
+
+  message.topic = "vehicles/3";
+  message.payload = "0";
+  message.payloadlen = 1;
+  mosquitto_property_add_int32(&props, MQTT_PROP_MESSAGE_EXPIRY_INTERVAL, 60);
+  on_message(NULL, &obj, &message, props);
+  mosquitto_property_free_all(&props);
+  mqtt_executor_destroy(obj.executor);
+  mqtt_topic_router_destroy(router);
+
+  assert_int_equal(received.count[3], 1);
+  assert_int_equal(received.expiry_interval, 60);
+  assert_false(received.on_network_thread);
+}
+
+int test_mqtt_executor()
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_mqtt_executor_per_topic_order_success),
+    cmocka_unit_test(test_mqtt_executor_metrics_success),
+    cmocka_unit_test(test_mqtt_executor_create_fail),
+    cmocka_unit_test(test_on_message_executor_success)
+  };
+  return cmocka_run_group_tests_name("mqtt_executor", tests, NULL, NULL);
+}
@@ -0,0 +1,11 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef MQTT_EXECUTOR_TEST_H
+#define MQTT_EXECUTOR_TEST_H
+
+#include "mqtt_executor.h"
+
+int test_mqtt_executor();
+
+#endif // MQTT_EXECUTOR_TEST_H
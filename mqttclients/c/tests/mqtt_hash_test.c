@@ -0,0 +1,39 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+// clang-format off
+// cmocka has to come after stddef.h
+#include <cmocka.h>
+// clang-format on
+
+#include "mqtt_hash_test.h"
+
+// The published FNV-1a test vectors, topics and vehicle ids hash the same in every process
+static void test_mqtt_hash_vectors_success(void** state)
+{
+  assert_int_equal(mqtt_hash_string(""), 0x811c9dc5u);
+  assert_int_equal(mqtt_hash_string("a"), 0xe40c292cu);
+  assert_int_equal(mqtt_hash_string("foobar"), 0xbf9cf968u);
+}
+
+static void test_mqtt_hash_bytes_matches_string_success(void** state)
+{
+  const char* topic = "vehicles/vehicle42/position";
+  assert_int_equal(mqtt_hash_bytes(topic, 0), mqtt_hash_string(""));
+  assert_int_equal(mqtt_hash_bytes(topic, 8), mqtt_hash_string("vehicles"));
+  assert_int_equal(mqtt_hash_bytes(topic, 27), mqtt_hash_string(topic));
+}
+
+int test_mqtt_hash()
+{
+  const struct CMUnitTest tests[]
+      = { cmocka_unit_test(test_mqtt_hash_vectors_success),
+          cmocka_unit_test(test_mqtt_hash_bytes_matches_string_success) };
+  return cmocka_run_group_tests_name("mqtt_hash", tests, NULL, NULL);
+}
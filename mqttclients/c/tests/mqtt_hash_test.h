@@ -0,0 +1,11 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef MQTT_HASH_TEST_H
+#define MQTT_HASH_TEST_H
+
+#include "mqtt_hash.h"
+
+int test_mqtt_hash();
+
+#endif // MQTT_HASH_TEST_H
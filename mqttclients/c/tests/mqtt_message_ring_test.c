@@ -0,0 +1,208 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <poll.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+// clang-format off
+// cmocka has to come after stddef.h
+#include <cmocka.h>
+// clang-format on
+
+#include "mqtt_callbacks.h"
+#include "mqtt_message_ring_test.h"
+#include "mqtt_protocol.h"
+#include "mqtt_setup.h"
+
+#define PRODUCER_MESSAGES 10000
+
+static void push(mqtt_message_ring* ring, int sequence, bool expected)
+{
+  struct mosquitto_message message = { 0 };
+  char payload[16];
+
+  message.topic = "vehicles/car-1/position";
+  message.payloadlen = snprintf(payload, sizeof(payload), "%d", sequence);
+  message.payload = payload;
+  assert_int_equal(mqtt_message_ring_push(ring, &message, NULL), expected);
+}
+
+static int sequence_of(const mqtt_client_message* message)
+{
+  return atoi((const char*)message->message.payload);
+}
+
+static bool fd_readable(int fd)
+{
+  struct pollfd pfd = { .fd = fd, .events = POLLIN };
+  return poll(&pfd, 1, 0) == 1;
+}
+
+static void* producer_thread(void* arg)
+{
+  for (int i = 0; i < PRODUCER_MESSAGES; i++)
+  {
+    push((mqtt_message_ring*)arg, i, true);
+  }
+  return NULL;
+}
+
+// Messages come out in order, at most max at a time, and the fd stays readable for the rest
+static void test_mqtt_message_ring_batch_success(void** state)
+{
+  mqtt_client_message messages[4];
+  // Rounded up to 8
+  mqtt_message_ring* ring = mqtt_message_ring_create(5);
+  assert_non_null(ring);
+  assert_false(fd_readable(mqtt_message_ring_fd(ring)));
+
+  for (int i = 0; i < 6; i++)
+  {
+    push(ring, i, true);
+  }
+  assert_true(fd_readable(mqtt_message_ring_fd(ring)));
+
+  assert_int_equal(mqtt_message_ring_pop(ring, messages, 4, 0), 4);
+  for (int i = 0; i < 4; i++)
+  {
+    assert_int_equal(sequence_of(&messages[i]), i);
+  }
+  mqtt_client_message_free(messages, 4);
+  assert_true(fd_readable(mqtt_message_ring_fd(ring)));
+
+  assert_int_equal(mqtt_message_ring_pop(ring, messages, 4, 0), 2);
+  assert_int_equal(sequence_of(&messages[0]), 4);
+  assert_int_equal(sequence_of(&messages[1]), 5);
+  mqtt_client_message_free(messages, 2);
+  assert_false(fd_readable(mqtt_message_ring_fd(ring)));
+
+  mqtt_message_ring_stats stats = mqtt_message_ring_get_stats(ring);
+  assert_int_equal(stats.pushed, 6);
+  assert_int_equal(stats.popped, 6);
+  assert_int_equal(stats.full_waits, 0);
+
+  // Messages left in the ring are freed with it
+  push(ring, 6, true);
+  mqtt_message_ring_destroy(ring);
+}
+
+// An empty ring returns 0 right away or after the timeout
+static void test_mqtt_message_ring_timeout_success(void** state)
+{
+  mqtt_client_message messages[4];
+  struct timespec start, end;
+  mqtt_message_ring* ring = mqtt_message_ring_create(4);
+  assert_non_null(ring);
+
+  assert_int_equal(mqtt_message_ring_pop(ring, messages, 4, 0), 0);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  assert_int_equal(mqtt_message_ring_pop(ring, messages, 4, 50), 0);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  long elapsed_ms = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000;
+  assert_true(elapsed_ms >= 45);
+
+  mqtt_message_ring_destroy(ring);
+}
+
+// A producer much faster than the consumer waits for room instead of losing messages
+static void test_mqtt_message_ring_backpressure_success(void** state)
+{
+  mqtt_client_message messages[16];
+  pthread_t producer;
+  int received = 0;
+  bool in_order = true;
+  mqtt_message_ring* ring = mqtt_message_ring_create(8);
+  assert_non_null(ring);
+
+  assert_int_equal(pthread_create(&producer, NULL, producer_thread, ring), 0);
+  while (received < PRODUCER_MESSAGES)
+  {
+    int count = mqtt_message_ring_pop(ring, messages, 16, -1);
+    assert_true(count > 0);
+    for (int i = 0; i < count; i++)
+    {
+      in_order &= sequence_of(&messages[i]) == received++;
+    }
+    mqtt_client_message_free(messages, count);
+  }
+  pthread_join(producer, NULL);
+
+  assert_true(in_order);
+  mqtt_message_ring_stats stats = mqtt_message_ring_get_stats(ring);
+  assert_int_equal(stats.pushed, PRODUCER_MESSAGES);
+  assert_int_equal(stats.dropped, 0);
+  mqtt_message_ring_destroy(ring);
+}
+
+// A full ring drops the message instead of blocking once the client is stopping
+static void test_mqtt_message_ring_full_when_stopping_fail(void** state)
+{
+  mqtt_message_ring* ring = mqtt_message_ring_create(2);
+  assert_non_null(ring);
+
+  push(ring, 0, true);
+  push(ring, 1, true);
+  keep_running = 0;
+  push(ring, 2, false);
+  keep_running = 1;
+
+  mqtt_message_ring_stats stats = mqtt_message_ring_get_stats(ring);
+  assert_int_equal(stats.pushed, 2);
+  assert_int_equal(stats.full_waits, 1);
+  assert_int_equal(stats.dropped, 1);
+  mqtt_message_ring_destroy(ring);
+}
+
+// on_message pushes messages and their properties for mqtt_client_poll
+static void test_mqtt_client_poll_success(void** state)
+{
+  mqtt_client_obj obj = { 0 };
+  mqtt_client_message messages[4];
+  struct mosquitto_message message = { 0 };
+  mosquitto_property* props = NULL;
+  char* content_type = NULL;
+
+  assert_int_equal(mqtt_client_poll(&obj, messages, 4, 0), -1);
+
+  obj.message_ring = mqtt_message_ring_create(4);
+  assert_non_null(obj.message_ring);
+  message.topic = "vehicles/car-1/position";
+  message.payload = "{}";
+  message.payloadlen = 2;
+  message.qos = 1;
+  mosquitto_property_add_string(&props, MQTT_PROP_CONTENT_TYPE, "application/json");
+  on_message(NULL, &obj, &message, props);
+  mosquitto_property_free_all(&props);
+
+  assert_int_equal(mqtt_client_poll(&obj, messages, 4, 0), 1);
+  assert_string_equal(messages[0].message.topic, "vehicles/car-1/position");
+  assert_int_equal(messages[0].message.payloadlen, 2);
+  assert_int_equal(messages[0].message.qos, 1);
+  assert_non_null(mosquitto_property_read_string(
+      messages[0].props, MQTT_PROP_CONTENT_TYPE, &content_type, false));
+  assert_string_equal(content_type, "application/json");
+  free(content_type);
+  mqtt_client_message_free(messages, 1);
+
+  mqtt_message_ring_destroy(obj.message_ring);
+}
+
+int test_mqtt_message_ring()
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_mqtt_message_ring_batch_success),
+    cmocka_unit_test(test_mqtt_message_ring_timeout_success),
+    cmocka_unit_test(test_mqtt_message_ring_backpressure_success),
+    cmocka_unit_test(test_mqtt_message_ring_full_when_stopping_fail),
+    cmocka_unit_test(test_mqtt_client_poll_success)
+  };
+  return cmocka_run_group_tests_name("mqtt_message_ring", tests, NULL, NULL);
+}
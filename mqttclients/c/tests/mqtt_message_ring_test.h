@@ -0,0 +1,11 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef MQTT_MESSAGE_RING_TEST_H
+#define MQTT_MESSAGE_RING_TEST_H
+
+#include "mqtt_message_ring.h"
+
+int test_mqtt_message_ring();
+
+#endif // MQTT_MESSAGE_RING_TEST_H
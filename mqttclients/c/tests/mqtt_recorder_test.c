@@ -0,0 +1,395 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+// clang-format off
+// cmocka has to come after stddef.h
+#include <cmocka.h>
+// clang-format on
+
+#include "mosquitto.h"
+#include "mqtt_protocol.h"
+#include "mqtt_recorder_test.h"
+
+#define START_NS 1700000000000000000ull
+#define MS 1000000ull
+
+static char* make_directory()
+{
+  char* directory = strdup("/tmp/mqtt_recorder_testXXXXXX");
+  assert_non_null(mkdtemp(directory));
+  return directory;
+}
+
+static void remove_directory(char* directory)
+{
+  DIR* dir = opendir(directory);
+  struct dirent* entry;
+  char path[512];
+  while ((entry = readdir(dir)) != NULL)
+  {
+    if (entry->d_name[0] != '.')
+    {
+      snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name);
+      unlink(path);
+    }
+  }
+  closedir(dir);
+  rmdir(directory);
+  free(directory);
+}
+
+static int count_files(const char* directory, const char* suffix)
+{
+  DIR* dir = opendir(directory);
+  struct dirent* entry;
+  int count = 0;
+  while ((entry = readdir(dir)) != NULL)
+  {
+    size_t length = strlen(entry->d_name);
+    size_t suffix_length = strlen(suffix);
+    count += length > suffix_length && strcmp(entry->d_name + length - suffix_length, suffix) == 0;
+  }
+  closedir(dir);
+  return count;
+}
+
+static int append(mqtt_recorder* recorder, const char* topic, const char* payload, uint64_t ns)
+{
+  struct mosquitto_message message = { .topic = (char*)topic,
+                                       .payload = (void*)payload,
+                                       .payloadlen = (int)strlen(payload),
+                                       .qos = 1 };
+  return mqtt_recorder_append(recorder, &message, NULL, ns);
+}
+
+static mqtt_recorder_options small_options()
+{
+  mqtt_recorder_options options = mqtt_recorder_options_default();
+  options.segment_bytes = 4096;
+  options.index_interval_bytes = 256;
+  options.sync = MQTT_RECORDER_SYNC_SEGMENT;
+  return options;
+}
+
+// Records 1000 messages over 20 topics in segments of 4096 bytes
+static void record_messages(const char* directory, mqtt_recorder_options options)
+{
+  char topic[64];
+  char payload[64];
+  mqtt_recorder* recorder = mqtt_recorder_create(directory, &options);
+  assert_non_null(recorder);
+  for (int i = 0; i < 1000; i++)
+  {
+    snprintf(topic, sizeof(topic), "vehicles/vehicle%d/position", i % 20);
+    snprintf(payload, sizeof(payload), "{\"sequence\":%d}", i);
+    assert_int_equal(append(recorder, topic, payload, START_NS + i * MS), MOSQ_ERR_SUCCESS);
+  }
+  mqtt_recorder_stats stats = mqtt_recorder_get_stats(recorder);
+  assert_int_equal(stats.records, 1000);
+  assert_int_equal(stats.dropped, 0);
+  assert_true(stats.segments > 10);
+  mqtt_recorder_destroy(recorder);
+}
+
+// Checks the reader returns the messages from first on, with their topics
+static void assert_messages(mqtt_recorder_reader* reader, int first)
+{
+  mqtt_recorder_record record;
+  char topic[64];
+  char payload[64];
+  int i = first;
+  while (mqtt_recorder_reader_next(reader, &record) == 1)
+  {
+    snprintf(topic, sizeof(topic), "vehicles/vehicle%d/position", i % 20);
+    snprintf(payload, sizeof(payload), "{\"sequence\":%d}", i);
+    assert_string_equal(record.topic, topic);
+    assert_int_equal(record.payload_length, strlen(payload));
+    assert_memory_equal(record.payload, payload, strlen(payload));
+    assert_int_equal(record.received_ns, START_NS + i * MS);
+    i++;
+  }
+  assert_int_equal(i, 1000);
+}
+
+static void test_mqtt_recorder_round_trip_success(void** state)
+{
+  char* directory = make_directory();
+  mqtt_recorder* recorder = mqtt_recorder_create(directory, NULL);
+  mosquitto_property* props = NULL;
+  struct mosquitto_message message = { .topic = "vehicles/vehicle1/position",
+                                       .payload = "{\"x\":1}",
+                                       .payloadlen = 7,
+                                       .qos = 2,
+                                       .retain = true };
+  assert_non_null(recorder);
+  assert_int_equal(
+      mosquitto_property_add_string(&props, MQTT_PROP_CONTENT_TYPE, "application/json"),
+      MOSQ_ERR_SUCCESS);
+  assert_int_equal(
+      mosquitto_property_add_string_pair(&props, MQTT_PROP_USER_PROPERTY, "vehicle", "1"),
+      MOSQ_ERR_SUCCESS);
+  assert_int_equal(
+      mosquitto_property_add_binary(&props, MQTT_PROP_CORRELATION_DATA, "\x01\x02", 2),
+      MOSQ_ERR_SUCCESS);
+  assert_int_equal(
+      mosquitto_property_add_int32(&props, MQTT_PROP_MESSAGE_EXPIRY_INTERVAL, 60),
+      MOSQ_ERR_SUCCESS);
+  assert_int_equal(
+      mosquitto_property_add_byte(&props, MQTT_PROP_PAYLOAD_FORMAT_INDICATOR, 1),
+      MOSQ_ERR_SUCCESS);
+  assert_int_equal(mqtt_recorder_append(recorder, &message, props, START_NS), MOSQ_ERR_SUCCESS);
+  // received now
+  message.retain = false;
+  assert_int_equal(mqtt_recorder_append(recorder, &message, NULL, 0), MOSQ_ERR_SUCCESS);
+  mosquitto_property_free_all(&props);
+  mqtt_recorder_destroy(recorder);
+  assert_int_equal(count_files(directory, ".rec"), 1);
+  assert_int_equal(count_files(directory, ".idx"), 1);
+
+  mqtt_recorder_reader* reader = mqtt_recorder_reader_open(directory);
+  mqtt_recorder_record record;
+  char* value = NULL;
+  char* name = NULL;
+  void* binary = NULL;
+  uint16_t binary_length;
+  uint32_t expiry;
+  uint8_t format;
+  assert_non_null(reader);
+  assert_int_equal(mqtt_recorder_reader_next(reader, &record), 1);
+  assert_int_equal(record.received_ns, START_NS);
+  assert_string_equal(record.topic, "vehicles/vehicle1/position");
+  assert_int_equal(record.payload_length, 7);
+  assert_memory_equal(record.payload, "{\"x\":1}", 7);
+  assert_int_equal(record.qos, 2);
+  assert_true(record.retain);
+  assert_int_equal(mqtt_recorder_record_properties(&record, &props), MOSQ_ERR_SUCCESS);
+  assert_non_null(mosquitto_property_read_string(props, MQTT_PROP_CONTENT_TYPE, &value, false));
+  assert_string_equal(value, "application/json");
+  free(value);
+  assert_non_null(
+      mosquitto_property_read_string_pair(props, MQTT_PROP_USER_PROPERTY, &name, &value, false));
+  assert_string_equal(name, "vehicle");
+  assert_string_equal(value, "1");
+  free(name);
+  free(value);
+  assert_non_null(mosquitto_property_read_binary(
+      props, MQTT_PROP_CORRELATION_DATA, &binary, &binary_length, false));
+  assert_int_equal(binary_length, 2);
+  assert_memory_equal(binary, "\x01\x02", 2);
+  free(binary);
+  assert_non_null(
+      mosquitto_property_read_int32(props, MQTT_PROP_MESSAGE_EXPIRY_INTERVAL, &expiry, false));
+  assert_int_equal(expiry, 60);
+  assert_non_null(
+      mosquitto_property_read_byte(props, MQTT_PROP_PAYLOAD_FORMAT_INDICATOR, &format, false));
+  assert_int_equal(format, 1);
+  mosquitto_property_free_all(&props);
+
+  assert_int_equal(mqtt_recorder_reader_next(reader, &record), 1);
+  assert_true(record.received_ns > START_NS);
+  assert_false(record.retain);
+  assert_int_equal(record.properties_length, 0);
+  assert_int_equal(mqtt_recorder_record_properties(&record, &props), MOSQ_ERR_SUCCESS);
+  assert_null(props);
+  assert_int_equal(mqtt_recorder_reader_next(reader, &record), 0);
+  mqtt_recorder_reader_close(reader);
+  remove_directory(directory);
+}
+
+// Full segments are closed with an index, and a new recorder numbers its segments after them
+static void test_mqtt_recorder_segments_success(void** state)
+{
+  char* directory = make_directory();
+  record_messages(directory, small_options());
+  int segments = count_files(directory, ".rec");
+  assert_true(segments > 10);
+  assert_int_equal(count_files(directory, ".idx"), segments);
+
+  mqtt_recorder* recorder = mqtt_recorder_create(directory, NULL);
+  assert_non_null(recorder);
+  assert_int_equal(
+      append(recorder, "vehicles/vehicle0/position", "{}", START_NS + 2000 * MS), MOSQ_ERR_SUCCESS);
+  mqtt_recorder_destroy(recorder);
+  assert_int_equal(count_files(directory, ".rec"), segments + 1);
+
+  mqtt_recorder_reader* reader = mqtt_recorder_reader_open(directory);
+  mqtt_recorder_record record;
+  assert_non_null(reader);
+  assert_true(mqtt_recorder_reader_seek(reader, START_NS + 1000 * MS));
+  assert_int_equal(mqtt_recorder_reader_next(reader, &record), 1);
+  assert_int_equal(record.received_ns, START_NS + 2000 * MS);
+  assert_int_equal(mqtt_recorder_reader_next(reader, &record), 0);
+  mqtt_recorder_reader_close(reader);
+  remove_directory(directory);
+}
+
+static void test_mqtt_recorder_seek_success(void** state)
+{
+  char* directory = make_directory();
+  record_messages(directory, small_options());
+  mqtt_recorder_reader* reader = mqtt_recorder_reader_open(directory);
+  assert_non_null(reader);
+
+  int times[] = { 0, 1, 17, 250, 499, 500, 998, 999 };
+  for (size_t i = 0; i < sizeof(times) / sizeof(times[0]); i++)
+  {
+    assert_true(mqtt_recorder_reader_seek(reader, START_NS + times[i] * MS));
+    assert_messages(reader, times[i]);
+  }
+  // between two records, before the first and after the last
+  assert_true(mqtt_recorder_reader_seek(reader, START_NS + 300 * MS - 1));
+  assert_messages(reader, 300);
+  assert_true(mqtt_recorder_reader_seek(reader, 0));
+  assert_messages(reader, 0);
+  assert_true(mqtt_recorder_reader_seek(reader, START_NS + 1000 * MS));
+  assert_messages(reader, 1000);
+  mqtt_recorder_reader_close(reader);
+  remove_directory(directory);
+}
+
+// Segments are read from their start without their index, and up to a corrupted record
+static void test_mqtt_recorder_recovery_success(void** state)
+{
+  char* directory = make_directory();
+  char path[256];
+  struct stat status;
+  mqtt_recorder_record record;
+  record_messages(directory, small_options());
+
+  for (int sequence = 1; sequence <= 3; sequence++)
+  {
+    snprintf(path, sizeof(path), "%s/%010d.idx", directory, sequence);
+    assert_int_equal(unlink(path), 0);
+  }
+  mqtt_recorder_reader* reader = mqtt_recorder_reader_open(directory);
+  assert_non_null(reader);
+  assert_messages(reader, 0);
+  assert_true(mqtt_recorder_reader_seek(reader, START_NS + 20 * MS));
+  assert_messages(reader, 20);
+  mqtt_recorder_reader_close(reader);
+
+  // the last byte of the last record of the last segment
+  snprintf(path, sizeof(path), "%s/%010d.rec", directory, count_files(directory, ".rec"));
+  int fd = open(path, O_RDWR);
+  assert_true(fd >= 0);
+  assert_int_equal(fstat(fd, &status), 0);
+  assert_int_equal(pwrite(fd, "x", 1, status.st_size - 1), 1);
+  close(fd);
+  reader = mqtt_recorder_reader_open(directory);
+  int count = 0;
+  while (mqtt_recorder_reader_next(reader, &record) == 1)
+  {
+    count++;
+  }
+  assert_int_equal(count, 999);
+  mqtt_recorder_reader_close(reader);
+  remove_directory(directory);
+}
+
+// With more topics than max_topics, the ids start again in a new segment
+static void test_mqtt_recorder_max_topics_success(void** state)
+{
+  char* directory = make_directory();
+  mqtt_recorder_options options = small_options();
+  options.segment_bytes = 1024 * 1024;
+  options.max_topics = 4;
+  mqtt_recorder* recorder = mqtt_recorder_create(directory, &options);
+  char topic[64];
+  assert_non_null(recorder);
+  for (int i = 0; i < 10; i++)
+  {
+    snprintf(topic, sizeof(topic), "vehicles/vehicle%d/position", i);
+    assert_int_equal(append(recorder, topic, "{}", START_NS + i * MS), MOSQ_ERR_SUCCESS);
+  }
+  assert_int_equal(mqtt_recorder_get_stats(recorder).segments, 3);
+  mqtt_recorder_destroy(recorder);
+
+  mqtt_recorder_reader* reader = mqtt_recorder_reader_open(directory);
+  mqtt_recorder_record record;
+  for (int i = 0; i < 10; i++)
+  {
+    snprintf(topic, sizeof(topic), "vehicles/vehicle%d/position", i);
+    assert_int_equal(mqtt_recorder_reader_next(reader, &record), 1);
+    assert_string_equal(record.topic, topic);
+  }
+  assert_int_equal(mqtt_recorder_reader_next(reader, &record), 0);
+  mqtt_recorder_reader_close(reader);
+  remove_directory(directory);
+}
+
+static void test_mqtt_recorder_sync_interval_success(void** state)
+{
+  char* directory = make_directory();
+  mqtt_recorder_options options = small_options();
+  options.segment_bytes = 1024 * 1024;
+  options.sync = MQTT_RECORDER_SYNC_INTERVAL;
+  options.sync_interval_ms = 1;
+  mqtt_recorder* recorder = mqtt_recorder_create(directory, &options);
+  assert_non_null(recorder);
+  assert_int_equal(append(recorder, "vehicles/vehicle1/position", "{}", 0), MOSQ_ERR_SUCCESS);
+  for (int i = 0; i < 1000 && mqtt_recorder_get_stats(recorder).syncs == 0; i++)
+  {
+    usleep(1000);
+  }
+  assert_int_equal(mqtt_recorder_get_stats(recorder).syncs, 1);
+  mqtt_recorder_destroy(recorder);
+  remove_directory(directory);
+}
+
+static void test_mqtt_recorder_invalid_failure(void** state)
+{
+  char* directory = make_directory();
+  mqtt_recorder_options options = small_options();
+  mqtt_recorder_sync sync;
+  char payload[4096] = { 0 };
+  struct mosquitto_message message
+      = { .topic = "vehicles/vehicle1/position", .payload = payload, .payloadlen = 4000 };
+
+  options.segment_bytes = 1024;
+  assert_null(mqtt_recorder_create(directory, &options));
+  options = small_options();
+  options.max_pending_segments = 0;
+  assert_null(mqtt_recorder_create(directory, &options));
+  assert_null(mqtt_recorder_create("/proc/mqtt_recorder", NULL));
+  assert_true(mqtt_recorder_sync_from_name("segment", &sync));
+  assert_int_equal(sync, MQTT_RECORDER_SYNC_SEGMENT);
+  assert_false(mqtt_recorder_sync_from_name("always", &sync));
+
+  // a record has to fit in a segment
+  options = small_options();
+  mqtt_recorder* recorder = mqtt_recorder_create(directory, &options);
+  assert_int_equal(
+      mqtt_recorder_append(recorder, &message, NULL, START_NS), MOSQ_ERR_PAYLOAD_SIZE);
+  assert_int_equal(mqtt_recorder_get_stats(recorder).dropped, 1);
+  mqtt_recorder_destroy(recorder);
+  assert_int_equal(count_files(directory, ".rec"), 0);
+
+  mqtt_recorder_record record = { .properties = "\x03\x10", .properties_length = 2 };
+  mosquitto_property* props = NULL;
+  assert_int_equal(mqtt_recorder_record_properties(&record, &props), MOSQ_ERR_MALFORMED_PACKET);
+  assert_null(props);
+  remove_directory(directory);
+}
+
+int test_mqtt_recorder()
+{
+  const struct CMUnitTest tests[] = { cmocka_unit_test(test_mqtt_recorder_round_trip_success),
+                                      cmocka_unit_test(test_mqtt_recorder_segments_success),
+                                      cmocka_unit_test(test_mqtt_recorder_seek_success),
+                                      cmocka_unit_test(test_mqtt_recorder_recovery_success),
+                                      cmocka_unit_test(test_mqtt_recorder_max_topics_success),
+                                      cmocka_unit_test(test_mqtt_recorder_sync_interval_success),
+                                      cmocka_unit_test(test_mqtt_recorder_invalid_failure) };
+  return cmocka_run_group_tests_name("mqtt_recorder", tests, NULL, NULL);
+}
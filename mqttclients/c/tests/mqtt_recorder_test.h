@@ -0,0 +1,11 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef MQTT_RECORDER_TEST_H
+#define MQTT_RECORDER_TEST_H
+
+#include "mqtt_recorder.h"
+
+int test_mqtt_recorder();
+
+#endif // MQTT_RECORDER_TEST_H
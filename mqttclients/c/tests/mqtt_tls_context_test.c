@@ -0,0 +1,207 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+// clang-format off
+// cmocka has to come after stddef.h
+#include <cmocka.h>
+// clang-format on
+
+#include <openssl/ec.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+
+#include "mqtt_tls_context_test.h"
+
+#define TEST_HOST "localhost"
+#define MAX_HANDSHAKE_STEPS 100
+
+typedef struct tls_test_state
+{
+  char ca_file[32];
+  SSL_CTX* server_ctx;
+  SSL_CTX* client_ctx;
+} tls_test_state;
+
+// Creates a self-signed certificate for TEST_HOST, writes it to a temporary CA file and configures
+// an in-memory server with it.
+static int setup(void** state)
+{
+  tls_test_state* test_state = calloc(1, sizeof(tls_test_state));
+  EVP_PKEY* key = NULL;
+  EVP_PKEY_CTX* key_ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, NULL);
+  X509* cert = X509_new();
+  int fd;
+  FILE* ca;
+
+  if (test_state == NULL || key_ctx == NULL || cert == NULL || EVP_PKEY_keygen_init(key_ctx) != 1
+      || EVP_PKEY_CTX_set_ec_paramgen_curve_nid(key_ctx, NID_X9_62_prime256v1) != 1
+      || EVP_PKEY_keygen(key_ctx, &key) != 1)
+  {
+    return -1;
+  }
+
+  X509_set_version(cert, 2);
+  ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+  X509_gmtime_adj(X509_getm_notBefore(cert), -60);
+  X509_gmtime_adj(X509_getm_notAfter(cert), 60 * 60);
+  X509_set_pubkey(cert, key);
+  X509_NAME_add_entry_by_txt(
+      X509_get_subject_name(cert), "CN", MBSTRING_ASC, (const unsigned char*)TEST_HOST, -1, -1, 0);
+  X509_set_issuer_name(cert, X509_get_subject_name(cert));
+  if (X509_sign(cert, key, EVP_sha256()) == 0)
+  {
+    return -1;
+  }
+
+  strcpy(test_state->ca_file, "/tmp/mqtt_tls_testXXXXXX");
+  if ((fd = mkstemp(test_state->ca_file)) < 0 || (ca = fdopen(fd, "w")) == NULL)
+  {
+    return -1;
+  }
+  PEM_write_X509(ca, cert);
+  fclose(ca);
+
+  test_state->server_ctx = SSL_CTX_new(TLS_server_method());
+  if (test_state->server_ctx == NULL || SSL_CTX_use_certificate(test_state->server_ctx, cert) != 1
+      || SSL_CTX_use_PrivateKey(test_state->server_ctx, key) != 1)
+  {
+    return -1;
+  }
+
+  mqtt_client_connection_settings connection_settings = { 0 };
+  connection_settings.ca_file = test_state->ca_file;
+  if ((test_state->client_ctx = mqtt_tls_context_get(&connection_settings)) == NULL)
+  {
+    return -1;
+  }
+
+  X509_free(cert);
+  EVP_PKEY_free(key);
+  EVP_PKEY_CTX_free(key_ctx);
+  *state = test_state;
+  return 0;
+}
+
+static int teardown(void** state)
+{
+  tls_test_state* test_state = (tls_test_state*)*state;
+  mqtt_tls_context_cleanup();
+  SSL_CTX_free(test_state->server_ctx);
+  unlink(test_state->ca_file);
+  free(test_state);
+  return 0;
+}
+
+static bool _handshake_step_ok(SSL* ssl, int rc)
+{
+  int error = SSL_get_error(ssl, rc);
+  return rc == 1 || error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE;
+}
+
+// Connects a client from the shared context to the in-memory server, the way mosquitto does (SNI
+// set before the handshake). Returns whether the session was resumed, or -1 if the handshake
+// failed.
+static int _connect(tls_test_state* test_state, const char* host)
+{
+  SSL* client = SSL_new(test_state->client_ctx);
+  SSL* server = SSL_new(test_state->server_ctx);
+  BIO* client_bio;
+  BIO* server_bio;
+  int client_rc = 0;
+  int server_rc = 0;
+  int result = -1;
+  char byte;
+
+  BIO_new_bio_pair(&client_bio, 0, &server_bio, 0);
+  SSL_set_bio(client, client_bio, client_bio);
+  SSL_set_bio(server, server_bio, server_bio);
+  SSL_set_tlsext_host_name(client, host);
+
+  for (int i = 0; i < MAX_HANDSHAKE_STEPS && (client_rc != 1 || server_rc != 1); i++)
+  {
+    client_rc = SSL_connect(client);
+    server_rc = SSL_accept(server);
+    if (!_handshake_step_ok(client, client_rc) || !_handshake_step_ok(server, server_rc))
+    {
+      break;
+    }
+  }
+
+  if (client_rc == 1 && server_rc == 1)
+  {
+    // TLS 1.3 session tickets arrive after the handshake
+    SSL_read(client, &byte, 1);
+    result = SSL_session_reused(client);
+    SSL_shutdown(client);
+    SSL_shutdown(server);
+  }
+
+  SSL_free(client);
+  SSL_free(server);
+  return result;
+}
+
+// The same settings share one context, missing files fail
+static void test_mqtt_tls_context_get_shared_success(void** state)
+{
+  tls_test_state* test_state = (tls_test_state*)*state;
+  mqtt_client_connection_settings connection_settings = { 0 };
+  connection_settings.ca_file = test_state->ca_file;
+
+  assert_ptr_equal(mqtt_tls_context_get(&connection_settings), test_state->client_ctx);
+
+  connection_settings.ca_file = "/nonexistent/ca.pem";
+  assert_null(mqtt_tls_context_get(&connection_settings));
+}
+
+// The second connection to a host resumes the session of the first
+static void test_mqtt_tls_context_resume_success(void** state)
+{
+  tls_test_state* test_state = (tls_test_state*)*state;
+  mqtt_tls_context_stats before = mqtt_tls_context_get_stats();
+
+  assert_int_equal(_connect(test_state, TEST_HOST), 0);
+  assert_int_equal(_connect(test_state, TEST_HOST), 1);
+
+  mqtt_tls_context_stats after = mqtt_tls_context_get_stats();
+  assert_int_equal(after.full_handshakes - before.full_handshakes, 1);
+  assert_int_equal(after.resumed_handshakes - before.resumed_handshakes, 1);
+}
+
+// Clearing the sessions forces a full handshake
+static void test_mqtt_tls_context_clear_sessions_success(void** state)
+{
+  tls_test_state* test_state = (tls_test_state*)*state;
+
+  assert_int_equal(_connect(test_state, TEST_HOST), 0);
+  mqtt_tls_context_clear_sessions();
+  assert_int_equal(_connect(test_state, TEST_HOST), 0);
+}
+
+// The broker's certificate must match the host we connect to
+static void test_mqtt_tls_context_wrong_host_fail(void** state)
+{
+  tls_test_state* test_state = (tls_test_state*)*state;
+
+  assert_int_equal(_connect(test_state, "example.com"), -1);
+}
+
+int test_mqtt_tls_context()
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test_setup_teardown(test_mqtt_tls_context_get_shared_success, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_mqtt_tls_context_resume_success, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_mqtt_tls_context_clear_sessions_success, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_mqtt_tls_context_wrong_host_fail, setup, teardown)
+  };
+  return cmocka_run_group_tests_name("mqtt_tls_context", tests, NULL, NULL);
+}
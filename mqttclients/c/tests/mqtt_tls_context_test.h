@@ -0,0 +1,11 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef MQTT_TLS_CONTEXT_TEST_H
+#define MQTT_TLS_CONTEXT_TEST_H
+
+#include "mqtt_tls_context.h"
+
+int test_mqtt_tls_context();
+
+#endif // MQTT_TLS_CONTEXT_TEST_H
@@ -0,0 +1,84 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+// clang-format off
+// cmocka has to come after stddef.h
+#include <cmocka.h>
+// clang-format on
+
+#include "mqtt_token_bucket_test.h"
+
+#define MS 1000000ull
+#define START_NS (1000 * MS)
+
+// At a high rate a 1 ms tick does many units of work, and the fractions carry over between ticks
+static void test_mqtt_token_bucket_high_rate_success(void** state)
+{
+  mqtt_token_bucket bucket = mqtt_token_bucket_init(200500, 1000, START_NS);
+  int taken = mqtt_token_bucket_take(&bucket, START_NS, 1000);
+  assert_int_equal(taken, 1);
+
+  for (int tick = 1; tick <= 1000; tick++)
+  {
+    taken += mqtt_token_bucket_take(&bucket, START_NS + tick * MS, 1000);
+  }
+  // one second at 200500/s, and the first token
+  assert_int_equal(taken, 200501);
+}
+
+// At a low rate most ticks do nothing
+static void test_mqtt_token_bucket_low_rate_success(void** state)
+{
+  mqtt_token_bucket bucket = mqtt_token_bucket_init(0.2, 1, START_NS);
+  int taken = mqtt_token_bucket_take(&bucket, START_NS, 10);
+  assert_int_equal(taken, 1);
+
+  for (int tick = 1; tick <= 20; tick++)
+  {
+    int tick_taken = mqtt_token_bucket_take(&bucket, START_NS + tick * 1000 * MS, 10);
+    // one every 5 seconds
+    assert_int_equal(tick_taken, tick % 5 == 0 ? 1 : 0);
+    taken += tick_taken;
+  }
+  assert_int_equal(taken, 5);
+}
+
+static void test_mqtt_token_bucket_burst_success(void** state)
+{
+  mqtt_token_bucket bucket = mqtt_token_bucket_init(1000, 10, START_NS);
+  assert_int_equal(mqtt_token_bucket_take(&bucket, START_NS, 100), 1);
+
+  // a timer that ran a second late only catches up with the burst
+  assert_int_equal(mqtt_token_bucket_take(&bucket, START_NS + 1000 * MS, 100), 10);
+  // max limits what is taken, the rest stays for the next tick
+  assert_int_equal(mqtt_token_bucket_take(&bucket, START_NS + 1005 * MS, 2), 2);
+  assert_int_equal(mqtt_token_bucket_take(&bucket, START_NS + 1005 * MS, 100), 3);
+  // a clock that went backwards adds nothing
+  assert_int_equal(mqtt_token_bucket_take(&bucket, START_NS, 100), 0);
+  // bursts below 1 would never allow any work
+  bucket = mqtt_token_bucket_init(0.5, 0, START_NS);
+  assert_int_equal(mqtt_token_bucket_take(&bucket, START_NS + 4000 * MS, 100), 1);
+}
+
+static void test_mqtt_token_bucket_now_success(void** state)
+{
+  uint64_t first = mqtt_token_bucket_now_ns();
+  uint64_t second = mqtt_token_bucket_now_ns();
+  assert_true(first > 0);
+  assert_true(second >= first);
+}
+
+int test_mqtt_token_bucket()
+{
+  const struct CMUnitTest tests[] = { cmocka_unit_test(test_mqtt_token_bucket_high_rate_success),
+                                      cmocka_unit_test(test_mqtt_token_bucket_low_rate_success),
+                                      cmocka_unit_test(test_mqtt_token_bucket_burst_success),
+                                      cmocka_unit_test(test_mqtt_token_bucket_now_success) };
+  return cmocka_run_group_tests_name("mqtt_token_bucket", tests, NULL, NULL);
+}
@@ -0,0 +1,11 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef MQTT_TOKEN_BUCKET_TEST_H
+#define MQTT_TOKEN_BUCKET_TEST_H
+
+#include "mqtt_token_bucket.h"
+
+int test_mqtt_token_bucket();
+
+#endif // MQTT_TOKEN_BUCKET_TEST_H
@@ -0,0 +1,205 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+// clang-format off
+// cmocka has to come after stddef.h
+#include <cmocka.h>
+// clang-format on
+
+#include "mqtt_callbacks.h"
+#include "mqtt_protocol.h"
+#include "mqtt_setup.h"
+#include "mqtt_topic_router_test.h"
+
+static int fallback_calls = 0;
+
+static void count_message(
+    struct mosquitto* mosq,
+    const struct mosquitto_message* message,
+    const mosquitto_property* props,
+    void* context)
+{
+  (*(int*)context)++;
+}
+
+static void count_fallback(
+    struct mosquitto* mosq,
+    const struct mosquitto_message* message,
+    const mosquitto_property* props)
+{
+  fallback_calls++;
+}
+
+static int dispatch(mqtt_topic_router* router, char* topic)
+{
+  struct mosquitto_message message = { 0 };
+  message.topic = topic;
+  return mqtt_topic_router_dispatch(router, NULL, &message, NULL);
+}
+
+static int setup(void** state)
+{
+  *state = mqtt_topic_router_create();
+  return *state == NULL ? -1 : 0;
+}
+
+static int teardown(void** state)
+{
+  mqtt_topic_router_destroy((mqtt_topic_router*)*state);
+  return 0;
+}
+
+// Exact filters only match their own topic
+static void test_mqtt_topic_router_exact_success(void** state)
+{
+  mqtt_topic_router* router = (mqtt_topic_router*)*state;
+  int calls = 0;
+
+  assert_int_equal(
+      mqtt_topic_router_add(router, "vehicles/car-1/position", count_message, &calls), 1);
+  assert_int_equal(
+      mqtt_topic_router_add(router, "vehicles/car-2/position", count_message, &calls), 2);
+
+  assert_int_equal(dispatch(router, "vehicles/car-1/position"), 1);
+  assert_int_equal(dispatch(router, "vehicles/car-1"), 0);
+  assert_int_equal(dispatch(router, "vehicles/car-1/position/x"), 0);
+  assert_int_equal(dispatch(router, "vehicles/car-3/position"), 0);
+  assert_int_equal(calls, 1);
+}
+
+// + matches exactly one level, # matches the parent and any number of levels
+static void test_mqtt_topic_router_wildcards_success(void** state)
+{
+  mqtt_topic_router* router = (mqtt_topic_router*)*state;
+  int plus_calls = 0;
+  int hash_calls = 0;
+  int all_calls = 0;
+
+  assert_true(mqtt_topic_router_add(router, "vehicles/+/position", count_message, &plus_calls) > 0);
+  assert_true(mqtt_topic_router_add(router, "vehicles/#", count_message, &hash_calls) > 0);
+  assert_true(mqtt_topic_router_add(router, "#", count_message, &all_calls) > 0);
+
+  assert_int_equal(dispatch(router, "vehicles/car-1/position"), 3);
+  assert_int_equal(dispatch(router, "vehicles"), 2);
+  assert_int_equal(dispatch(router, "vehicles//position"), 3);
+  assert_int_equal(dispatch(router, "vehicles/car-1/position/x"), 2);
+  assert_int_equal(dispatch(router, "fleet"), 1);
+  assert_int_equal(plus_calls, 2);
+  assert_int_equal(hash_calls, 4);
+  assert_int_equal(all_calls, 5);
+}
+
+// Topics starting with $ aren't matched by a wildcard in the first level
+static void test_mqtt_topic_router_dollar_topics_success(void** state)
+{
+  mqtt_topic_router* router = (mqtt_topic_router*)*state;
+  int calls = 0;
+
+  assert_true(mqtt_topic_router_add(router, "#", count_message, &calls) > 0);
+  assert_true(mqtt_topic_router_add(router, "+/broker/uptime", count_message, &calls) > 0);
+  assert_true(mqtt_topic_router_add(router, "$SYS/#", count_message, &calls) > 0);
+
+  assert_int_equal(dispatch(router, "$SYS/broker/uptime"), 1);
+}
+
+// Wildcards must fill a whole level and # must be last
+static void test_mqtt_topic_router_invalid_filter_fail(void** state)
+{
+  mqtt_topic_router* router = (mqtt_topic_router*)*state;
+  int calls = 0;
+
+  assert_int_equal(mqtt_topic_router_add(router, "", count_message, &calls), -1);
+  assert_int_equal(mqtt_topic_router_add(router, "vehicles/#/position", count_message, &calls), -1);
+  assert_int_equal(mqtt_topic_router_add(router, "vehicles/car+", count_message, &calls), -1);
+  assert_int_equal(mqtt_topic_router_add(router, "vehicles/car#", count_message, &calls), -1);
+}
+
+// Adding a filter again replaces its handler and keeps its identifier, removing stops dispatch
+static void test_mqtt_topic_router_replace_remove_success(void** state)
+{
+  mqtt_topic_router* router = (mqtt_topic_router*)*state;
+  int first_calls = 0;
+  int second_calls = 0;
+
+  int id = mqtt_topic_router_add(router, "vehicles/+/position", count_message, &first_calls);
+  assert_int_equal(
+      mqtt_topic_router_add(router, "vehicles/+/position", count_message, &second_calls), id);
+  assert_int_equal(dispatch(router, "vehicles/car-1/position"), 1);
+  assert_int_equal(first_calls, 0);
+  assert_int_equal(second_calls, 1);
+
+  assert_true(mqtt_topic_router_remove(router, "vehicles/+/position"));
+  assert_false(mqtt_topic_router_remove(router, "vehicles/+/position"));
+  assert_false(mqtt_topic_router_remove(router, "fleet/+"));
+  assert_int_equal(dispatch(router, "vehicles/car-1/position"), 0);
+  assert_int_equal(
+      mqtt_topic_router_add(router, "vehicles/+/position", count_message, &first_calls), id);
+}
+
+// Subscription identifiers select the handlers without matching the topic
+static void test_mqtt_topic_router_subscription_identifier_success(void** state)
+{
+  mqtt_topic_router* router = (mqtt_topic_router*)*state;
+  struct mosquitto_message message = { 0 };
+  mosquitto_property* props = NULL;
+  int plus_calls = 0;
+  int hash_calls = 0;
+
+  int plus_id = mqtt_topic_router_add(router, "vehicles/+/position", count_message, &plus_calls);
+  assert_true(mqtt_topic_router_add(router, "vehicles/#", count_message, &hash_calls) > 0);
+
+  message.topic = "vehicles/car-1/position";
+  mosquitto_property_add_varint(&props, MQTT_PROP_SUBSCRIPTION_IDENTIFIER, plus_id);
+  assert_int_equal(mqtt_topic_router_dispatch(router, NULL, &message, props), 1);
+  assert_int_equal(plus_calls, 1);
+  assert_int_equal(hash_calls, 0);
+  mosquitto_property_free_all(&props);
+
+  // Identifiers the router didn't assign fall back to matching the topic
+  mosquitto_property_add_varint(&props, MQTT_PROP_SUBSCRIPTION_IDENTIFIER, 1000);
+  assert_int_equal(mqtt_topic_router_dispatch(router, NULL, &message, props), 2);
+  mosquitto_property_free_all(&props);
+}
+
+// on_message dispatches through the router and falls back to handle_message
+static void test_on_message_router_success(void** state)
+{
+  mqtt_topic_router* router = (mqtt_topic_router*)*state;
+  mqtt_client_obj obj = { 0 };
+  struct mosquitto_message message = { 0 };
+  int calls = 0;
+
+  obj.router = router;
+  obj.handle_message = count_fallback;
+  fallback_calls = 0;
+  assert_true(mqtt_topic_router_add(router, "vehicles/+/position", count_message, &calls) > 0);
+
+  message.topic = "vehicles/car-1/position";
+  on_message(NULL, &obj, &message, NULL);
+  message.topic = "fleet/status";
+  on_message(NULL, &obj, &message, NULL);
+
+  assert_int_equal(calls, 1);
+  assert_int_equal(fallback_calls, 1);
+}
+
+int test_mqtt_topic_router()
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test_setup_teardown(test_mqtt_topic_router_exact_success, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_mqtt_topic_router_wildcards_success, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_mqtt_topic_router_dollar_topics_success, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_mqtt_topic_router_invalid_filter_fail, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_mqtt_topic_router_replace_remove_success, setup, teardown),
+    cmocka_unit_test_setup_teardown(
+        test_mqtt_topic_router_subscription_identifier_success, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_on_message_router_success, setup, teardown)
+  };
+  return cmocka_run_group_tests_name("mqtt_topic_router", tests, NULL, NULL);
+}
@@ -0,0 +1,248 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+// clang-format off
+// cmocka has to come after stddef.h
+#include <cmocka.h>
+// clang-format on
+
+#include "mqtt_setup.h"
+#include "position_batcher_test.h"
+
+#define MAX_CAPTURED_BATCHES 8
+#define MAX_CAPTURED_LENGTH 512
+
+// Keeps a copy of every published batch
+typedef struct batch_capture
+{
+  char payloads[MAX_CAPTURED_BATCHES][MAX_CAPTURED_LENGTH];
+  int lengths[MAX_CAPTURED_BATCHES];
+  int counts[MAX_CAPTURED_BATCHES];
+  int published;
+  int result;
+  // When set, the first batch stops the loop
+  mqtt_event_loop* loop;
+} batch_capture;
+
+static int capture_batch(const mosquitto_payload* payload, int count, void* context)
+{
+  batch_capture* capture = (batch_capture*)context;
+  assert_true(capture->published < MAX_CAPTURED_BATCHES);
+  assert_true(payload->payload_length < MAX_CAPTURED_LENGTH);
+  memcpy(capture->payloads[capture->published], payload->payload, payload->payload_length);
+  capture->lengths[capture->published] = (int)payload->payload_length;
+  capture->counts[capture->published++] = count;
+  if (capture->loop != NULL)
+  {
+    keep_running = 0;
+    mqtt_event_loop_wakeup(capture->loop);
+  }
+  return capture->result;
+}
+
+static int decode_capture(
+    const batch_capture* capture,
+    int batch,
+    position_encoding encoding,
+    geojson_geometry* positions)
+{
+  struct mosquitto_message message
+      = { .payload = (void*)capture->payloads[batch], .payloadlen = capture->lengths[batch] };
+  return mosquitto_payload_to_positions(encoding, &message, positions);
+}
+
+static geojson_coordinates position(int i)
+{
+  return (geojson_coordinates){ .x = -83.551071 + i * 0.001, .y = -36.169784 - i * 0.001 };
+}
+
+static void test_position_batcher_max_count_success(void** state)
+{
+  batch_capture capture = { 0 };
+  geojson_geometry positions = geojson_geometry_init();
+  mosquitto_payload point = mosquitto_payload_init(64);
+  position_batcher* batcher = position_batcher_create(
+      POSITION_ENCODING_JSON,
+      (position_batch_policy){ .max_count = 3 },
+      NULL,
+      capture_batch,
+      &capture);
+  assert_non_null(batcher);
+
+  for (int i = 0; i < 7; i++)
+  {
+    assert_int_equal(position_batcher_add(batcher, position(i)), 0);
+  }
+  assert_int_equal(capture.published, 2);
+  assert_int_equal(position_batcher_count(batcher), 1);
+  assert_int_equal(position_batcher_flush(batcher), 0);
+  assert_int_equal(position_batcher_count(batcher), 0);
+  assert_int_equal(capture.published, 3);
+
+  assert_int_equal(capture.counts[1], 3);
+  assert_int_equal(decode_capture(&capture, 1, POSITION_ENCODING_JSON, &positions), 3);
+  assert_int_equal(positions.type, GEOJSON_MULTI_POINT);
+  for (int i = 0; i < 3; i++)
+  {
+    assert_float_equal(positions.x[i], position(3 + i).x, 0.000001);
+    assert_float_equal(positions.y[i], position(3 + i).y, 0.000001);
+  }
+
+  // the last position went out alone, exactly like an unbatched position
+  assert_int_equal(capture.counts[2], 1);
+  assert_int_equal(position_to_mosquitto_payload(POSITION_ENCODING_JSON, position(6), &point), 0);
+  assert_int_equal(capture.lengths[2], point.payload_length);
+  assert_memory_equal(capture.payloads[2], point.payload, point.payload_length);
+
+  // flushing an empty batch publishes nothing
+  assert_int_equal(position_batcher_flush(batcher), 0);
+  assert_int_equal(capture.published, 3);
+
+  position_batcher_destroy(batcher);
+  geojson_geometry_destroy(&positions);
+  mosquitto_payload_destroy(&point);
+}
+
+static void test_position_batcher_max_bytes_success(void** state)
+{
+  // {"type":"MultiPoint","coordinates":[[-83.551071,-36.169784],[-83.550071,-36.170784]]}
+  const size_t two_positions = 85;
+  batch_capture capture = { 0 };
+  geojson_geometry positions = geojson_geometry_init();
+  position_batcher* batcher = position_batcher_create(
+      POSITION_ENCODING_JSON,
+      (position_batch_policy){ .max_count = 100, .max_bytes = two_positions },
+      NULL,
+      capture_batch,
+      &capture);
+  assert_non_null(batcher);
+
+  for (int i = 0; i < 5; i++)
+  {
+    assert_int_equal(position_batcher_add(batcher, position(i)), 0);
+  }
+  assert_int_equal(capture.published, 2);
+  assert_int_equal(capture.counts[0], 2);
+  assert_int_equal(capture.lengths[0], two_positions);
+  assert_int_equal(capture.lengths[1], two_positions);
+  assert_int_equal(decode_capture(&capture, 1, POSITION_ENCODING_JSON, &positions), 2);
+  assert_float_equal(positions.x[0], position(2).x, 0.000001);
+  position_batcher_destroy(batcher);
+
+  // binary batches are 16 bytes per position
+  memset(&capture, 0, sizeof(capture));
+  batcher = position_batcher_create(
+      POSITION_ENCODING_BINARY,
+      (position_batch_policy){ .max_count = 100, .max_bytes = 3 * POSITION_BINARY_PAYLOAD_LENGTH },
+      NULL,
+      capture_batch,
+      &capture);
+  assert_non_null(batcher);
+  for (int i = 0; i < 7; i++)
+  {
+    assert_int_equal(position_batcher_add(batcher, position(i)), 0);
+  }
+  assert_int_equal(capture.published, 2);
+  assert_int_equal(capture.lengths[1], 3 * POSITION_BINARY_PAYLOAD_LENGTH);
+  assert_int_equal(decode_capture(&capture, 1, POSITION_ENCODING_BINARY, &positions), 3);
+  assert_true(positions.x[2] == position(5).x);
+  assert_true(positions.y[2] == position(5).y);
+
+  position_batcher_destroy(batcher);
+  geojson_geometry_destroy(&positions);
+}
+
+// A batch that doesn't fill up is published by the latency timer
+static void test_position_batcher_max_latency_success(void** state)
+{
+  mqtt_event_loop loop;
+  batch_capture capture = { .loop = &loop };
+  assert_true(mqtt_event_loop_init(&loop));
+  keep_running = 1;
+  position_batcher* batcher = position_batcher_create(
+      POSITION_ENCODING_BINARY,
+      (position_batch_policy){ .max_count = 100, .max_latency_ms = 1 },
+      &loop,
+      capture_batch,
+      &capture);
+  assert_non_null(batcher);
+
+  assert_int_equal(position_batcher_add(batcher, position(0)), 0);
+  assert_int_equal(position_batcher_add(batcher, position(1)), 0);
+  assert_int_equal(capture.published, 0);
+
+  assert_int_equal(mqtt_event_loop_run(&loop), 0);
+  assert_int_equal(capture.published, 1);
+  assert_int_equal(capture.counts[0], 2);
+  assert_int_equal(position_batcher_count(batcher), 0);
+
+  // the timer of a batch that was destroyed before its deadline is removed with it
+  assert_int_equal(position_batcher_add(batcher, position(2)), 0);
+  position_batcher_destroy(batcher);
+  assert_int_equal(capture.published, 1);
+  // removed timers are freed by the loop, work queued before a stop still runs
+  keep_running = 0;
+  assert_int_equal(mqtt_event_loop_run(&loop), 0);
+  mqtt_event_loop_destroy(&loop);
+  keep_running = 1;
+}
+
+static void test_position_batcher_publish_fail(void** state)
+{
+  batch_capture capture = { .result = MOSQ_ERR_NO_CONN };
+  position_batcher* batcher = position_batcher_create(
+      POSITION_ENCODING_JSON,
+      (position_batch_policy){ .max_count = 2 },
+      NULL,
+      capture_batch,
+      &capture);
+  assert_non_null(batcher);
+
+  assert_int_equal(position_batcher_add(batcher, position(0)), 0);
+  assert_int_equal(position_batcher_add(batcher, position(1)), -1);
+  // the failed batch is dropped
+  assert_int_equal(position_batcher_count(batcher), 0);
+  assert_int_equal(capture.published, 1);
+
+  position_batcher_destroy(batcher);
+}
+
+static void test_position_batcher_create_invalid_fail(void** state)
+{
+  batch_capture capture = { 0 };
+  position_batch_policy policy = { .max_count = 10 };
+
+  assert_null(
+      position_batcher_create(POSITION_ENCODING_STREAM, policy, NULL, capture_batch, &capture));
+  assert_null(position_batcher_create(POSITION_ENCODING_JSON, policy, NULL, NULL, &capture));
+  assert_null(position_batcher_create(
+      POSITION_ENCODING_JSON,
+      (position_batch_policy){ .max_count = 0 },
+      NULL,
+      capture_batch,
+      &capture));
+  // a latency needs a loop to run its timers
+  policy.max_latency_ms = 100;
+  assert_null(
+      position_batcher_create(POSITION_ENCODING_JSON, policy, NULL, capture_batch, &capture));
+  position_batcher_destroy(NULL);
+}
+
+int test_position_batcher()
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_position_batcher_max_count_success),
+    cmocka_unit_test(test_position_batcher_max_bytes_success),
+    cmocka_unit_test(test_position_batcher_max_latency_success),
+    cmocka_unit_test(test_position_batcher_publish_fail),
+    cmocka_unit_test(test_position_batcher_create_invalid_fail)
+  };
+  return cmocka_run_group_tests_name("position_batcher", tests, NULL, NULL);
+}
@@ -0,0 +1,11 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef POSITION_BATCHER_TEST_H
+#define POSITION_BATCHER_TEST_H
+
+#include "position_batcher.h"
+
+int test_position_batcher();
+
+#endif // POSITION_BATCHER_TEST_H
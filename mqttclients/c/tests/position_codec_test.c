@@ -0,0 +1,232 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <math.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+// clang-format off
+// cmocka has to come after stddef.h
+#include <cmocka.h>
+// clang-format on
+
+#include "mqtt_protocol.h"
+#include "position_codec_test.h"
+
+static void test_position_binary_round_trip_success(void** state)
+{
+  // 1.0 and -2.5 as little-endian doubles
+  const unsigned char expected[POSITION_BINARY_PAYLOAD_LENGTH]
+      = { 0, 0, 0, 0, 0, 0, 0xf0, 0x3f, 0, 0, 0, 0, 0, 0, 0x04, 0xc0 };
+  mosquitto_payload payload = mosquitto_payload_init(POSITION_BINARY_PAYLOAD_LENGTH);
+  struct mosquitto_message message = { 0 };
+  geojson_coordinates coordinates = { 0 };
+
+  assert_int_equal(
+      position_to_mosquitto_payload(
+          POSITION_ENCODING_BINARY, (geojson_coordinates){ .x = 1.0, .y = -2.5 }, &payload),
+      0);
+  assert_int_equal(payload.payload_length, POSITION_BINARY_PAYLOAD_LENGTH);
+  assert_memory_equal(payload.payload, expected, POSITION_BINARY_PAYLOAD_LENGTH);
+
+  // every double survives unchanged, including the ones JSON can't represent exactly
+  assert_int_equal(
+      position_to_mosquitto_payload(
+          POSITION_ENCODING_BINARY,
+          (geojson_coordinates){ .x = -83.55107123456789, .y = NAN },
+          &payload),
+      0);
+  message.payload = payload.payload;
+  message.payloadlen = payload.payload_length;
+  assert_int_equal(
+      mosquitto_payload_to_position(POSITION_ENCODING_BINARY, &message, &coordinates), 0);
+  assert_true(coordinates.x == -83.55107123456789);
+  assert_true(isnan(coordinates.y));
+
+  mosquitto_payload_destroy(&payload);
+}
+
+static void test_position_json_round_trip_success(void** state)
+{
+  mosquitto_payload payload = mosquitto_payload_init(60);
+  struct mosquitto_message message = { 0 };
+  geojson_coordinates coordinates = { 0 };
+
+  assert_int_equal(
+      position_to_mosquitto_payload(
+          POSITION_ENCODING_JSON,
+          (geojson_coordinates){ .x = -83.551071, .y = -36.169784 },
+          &payload),
+      0);
+  assert_string_equal(
+      payload.payload, "{\"type\":\"Point\",\"coordinates\":[-83.551071,-36.169784]}");
+
+  message.payload = payload.payload;
+  message.payloadlen = payload.payload_length;
+  assert_int_equal(
+      mosquitto_payload_to_position(POSITION_ENCODING_JSON, &message, &coordinates), 0);
+  assert_float_equal(coordinates.x, -83.551071, 0.000001);
+  assert_float_equal(coordinates.y, -36.169784, 0.000001);
+
+  mosquitto_payload_destroy(&payload);
+}
+
+static void test_position_encoding_from_properties_success(void** state)
+{
+  mosquitto_property* props = NULL;
+  position_encoding encoding = POSITION_ENCODING_BINARY;
+
+  // MQTT 3.1.1 producers send no content type
+  assert_true(position_encoding_from_properties(NULL, &encoding));
+  assert_int_equal(encoding, POSITION_ENCODING_JSON);
+
+  mosquitto_property_add_string(
+      &props,
+      MQTT_PROP_CONTENT_TYPE,
+      position_encoding_content_type(POSITION_ENCODING_BINARY));
+  assert_true(position_encoding_from_properties(props, &encoding));
+  assert_int_equal(encoding, POSITION_ENCODING_BINARY);
+  mosquitto_property_free_all(&props);
+
+  mosquitto_property_add_string(&props, MQTT_PROP_CONTENT_TYPE, POSITION_JSON_CONTENT_TYPE);
+  assert_true(position_encoding_from_properties(props, &encoding));
+  assert_int_equal(encoding, POSITION_ENCODING_JSON);
+  mosquitto_property_free_all(&props);
+
+  mosquitto_property_add_string(&props, MQTT_PROP_CONTENT_TYPE, "application/protobuf");
+  assert_false(position_encoding_from_properties(props, &encoding));
+  mosquitto_property_free_all(&props);
+}
+
+static void test_position_encoding_from_name_success(void** state)
+{
+  position_encoding encoding = POSITION_ENCODING_JSON;
+
+  assert_true(position_encoding_from_name("binary", &encoding));
+  assert_int_equal(encoding, POSITION_ENCODING_BINARY);
+  assert_true(position_encoding_from_name("json", &encoding));
+  assert_int_equal(encoding, POSITION_ENCODING_JSON);
+  assert_false(position_encoding_from_name("xml", &encoding));
+  assert_false(position_encoding_from_name(NULL, &encoding));
+  assert_true(position_encoding_from_name("stream", &encoding));
+  assert_int_equal(encoding, POSITION_ENCODING_STREAM);
+  assert_null(position_encoding_content_type((position_encoding)3));
+}
+
+static void test_position_binary_wrong_length_fail(void** state)
+{
+  char buffer[POSITION_BINARY_PAYLOAD_LENGTH + 1] = { 0 };
+  struct mosquitto_message message = { .payload = buffer, .payloadlen = sizeof(buffer) };
+  mosquitto_payload payload = mosquitto_payload_init(POSITION_BINARY_PAYLOAD_LENGTH - 1);
+  geojson_coordinates coordinates = { 0 };
+
+  assert_int_equal(
+      mosquitto_payload_to_position(POSITION_ENCODING_BINARY, &message, &coordinates), -1);
+  message.payloadlen = POSITION_BINARY_PAYLOAD_LENGTH - 1;
+  assert_int_equal(
+      mosquitto_payload_to_position(POSITION_ENCODING_BINARY, &message, &coordinates), -1);
+  assert_int_equal(
+      position_to_mosquitto_payload(POSITION_ENCODING_BINARY, coordinates, &payload), -1);
+
+  mosquitto_payload_destroy(&payload);
+}
+
+static void test_positions_batch_round_trip_success(void** state)
+{
+  geojson_geometry positions = geojson_geometry_init();
+  geojson_geometry output = geojson_geometry_init();
+  mosquitto_payload payload = mosquitto_payload_init(128);
+  struct mosquitto_message message = { 0 };
+
+  assert_true(geojson_geometry_reset(&positions, GEOJSON_LINE_STRING, 3, 0));
+  geojson_geometry_add_position(&positions, 1.5, -2);
+  geojson_geometry_add_position(&positions, -83.551071, -36.169784);
+  geojson_geometry_add_position(&positions, 0, 90);
+
+  // JSON batches are MultiPoints whatever the geometry type
+  assert_int_equal(positions_to_mosquitto_payload(POSITION_ENCODING_JSON, &positions, &payload), 0);
+  assert_string_equal(
+      payload.payload,
+      "{\"type\":\"MultiPoint\",\"coordinates\":"
+      "[[1.500000,-2.000000],[-83.551071,-36.169784],[0.000000,90.000000]]}");
+  message.payload = payload.payload;
+  message.payloadlen = payload.payload_length;
+  assert_true(position_payload_is_batch(POSITION_ENCODING_JSON, &message));
+  assert_int_equal(mosquitto_payload_to_positions(POSITION_ENCODING_JSON, &message, &output), 3);
+  assert_float_equal(output.x[1], -83.551071, 0.000001);
+  assert_float_equal(output.y[2], 90, 0.000001);
+
+  assert_int_equal(
+      positions_to_mosquitto_payload(POSITION_ENCODING_BINARY, &positions, &payload), 0);
+  assert_int_equal(payload.payload_length, 3 * POSITION_BINARY_PAYLOAD_LENGTH);
+  message.payloadlen = payload.payload_length;
+  assert_true(position_payload_is_batch(POSITION_ENCODING_BINARY, &message));
+  assert_int_equal(mosquitto_payload_to_positions(POSITION_ENCODING_BINARY, &message, &output), 3);
+  assert_true(output.x[1] == -83.551071);
+  assert_true(output.y[0] == -2);
+
+  // a batch of one is written exactly like a single position
+  positions.count = 1;
+  assert_int_equal(positions_to_mosquitto_payload(POSITION_ENCODING_JSON, &positions, &payload), 0);
+  assert_string_equal(
+      payload.payload, "{\"type\":\"Point\",\"coordinates\":[1.500000,-2.000000]}");
+  message.payloadlen = payload.payload_length;
+  assert_false(position_payload_is_batch(POSITION_ENCODING_JSON, &message));
+  assert_int_equal(mosquitto_payload_to_positions(POSITION_ENCODING_JSON, &message, &output), 1);
+  assert_int_equal(output.type, GEOJSON_POINT);
+
+  geojson_geometry_destroy(&positions);
+  geojson_geometry_destroy(&output);
+  mosquitto_payload_destroy(&payload);
+}
+
+static void test_positions_invalid_fail(void** state)
+{
+  char buffer[2 * POSITION_BINARY_PAYLOAD_LENGTH + 1] = { 0 };
+  const char* line = "{\"type\":\"LineString\",\"coordinates\":[[1,2],[3,4]]}";
+  struct mosquitto_message message = { .payload = buffer, .payloadlen = sizeof(buffer) };
+  geojson_geometry positions = geojson_geometry_init();
+  mosquitto_payload payload = mosquitto_payload_init(POSITION_BINARY_PAYLOAD_LENGTH);
+
+  assert_int_equal(
+      mosquitto_payload_to_positions(POSITION_ENCODING_BINARY, &message, &positions), -1);
+  message.payloadlen = 0;
+  assert_int_equal(
+      mosquitto_payload_to_positions(POSITION_ENCODING_BINARY, &message, &positions), -1);
+  message.payload = (void*)line;
+  message.payloadlen = (int)strlen(line);
+  assert_int_equal(
+      mosquitto_payload_to_positions(POSITION_ENCODING_JSON, &message, &positions), -1);
+  assert_int_equal(
+      mosquitto_payload_to_positions(POSITION_ENCODING_STREAM, &message, &positions), -1);
+
+  // empty batches and batches larger than the payload aren't written
+  assert_int_equal(
+      positions_to_mosquitto_payload(POSITION_ENCODING_BINARY, &positions, &payload), -1);
+  assert_true(geojson_geometry_reset(&positions, GEOJSON_MULTI_POINT, 2, 0));
+  geojson_geometry_add_position(&positions, 1, 2);
+  geojson_geometry_add_position(&positions, 3, 4);
+  assert_int_equal(
+      positions_to_mosquitto_payload(POSITION_ENCODING_BINARY, &positions, &payload), -1);
+
+  geojson_geometry_destroy(&positions);
+  mosquitto_payload_destroy(&payload);
+}
+
+int test_position_codec()
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_position_binary_round_trip_success),
+    cmocka_unit_test(test_position_json_round_trip_success),
+    cmocka_unit_test(test_position_encoding_from_properties_success),
+    cmocka_unit_test(test_position_encoding_from_name_success),
+    cmocka_unit_test(test_position_binary_wrong_length_fail),
+    cmocka_unit_test(test_positions_batch_round_trip_success),
+    cmocka_unit_test(test_positions_invalid_fail)
+  };
+  return cmocka_run_group_tests_name("position_codec", tests, NULL, NULL);
+}
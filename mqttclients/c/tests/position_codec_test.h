@@ -0,0 +1,11 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef POSITION_CODEC_TEST_H
+#define POSITION_CODEC_TEST_H
+
+#include "position_codec.h"
+
+int test_position_codec();
+
+#endif // POSITION_CODEC_TEST_H
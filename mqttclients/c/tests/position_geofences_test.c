@@ -0,0 +1,358 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <math.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+// clang-format off
+// cmocka has to come after stddef.h
+#include <cmocka.h>
+// clang-format on
+
+#include "position_geofences_test.h"
+#include "position_trajectory.h"
+
+#define TEST_SEED 11
+#define TEST_FENCES 500
+#define TEST_POINTS 5000
+#define TEST_MAX_EVENTS 16
+#define TEST_ID_SIZE 32
+
+static const geojson_coordinates test_center = { .x = -122.335, .y = 47.608 };
+
+typedef struct test_event
+{
+  int vehicle;
+  int fence;
+  bool entered;
+} test_event;
+
+typedef struct test_events
+{
+  test_event events[TEST_MAX_EVENTS];
+  int count;
+} test_events;
+
+static void record_event(int vehicle, int fence, bool entered, void* context)
+{
+  test_events* events = (test_events*)context;
+  assert_true(events->count < TEST_MAX_EVENTS);
+  events->events[events->count++] = (test_event){ vehicle, fence, entered };
+}
+
+// Adds a ring of vertices around a center, at a random distance from it between radius / 2 and
+// radius, so rings aren't convex.
+static void add_ring(
+    geojson_geometry* polygon,
+    trajectory_rng* rng,
+    geojson_coordinates center,
+    double radius,
+    int vertices)
+{
+  int first = polygon->count;
+  for (int i = 0; i < vertices; i++)
+  {
+    double angle = 2 * M_PI * i / vertices;
+    double distance = trajectory_rng_between(rng, radius / 2, radius);
+    assert_true(geojson_geometry_add_position(
+        polygon, center.x + distance * cos(angle), center.y + distance * sin(angle)));
+  }
+  assert_true(geojson_geometry_add_position(polygon, polygon->x[first], polygon->y[first]));
+  assert_true(geojson_geometry_end_ring(polygon));
+}
+
+// A star shaped fence of 3 to 40 vertices, with a hole one time out of four.
+static void make_fence(geojson_geometry* polygon, trajectory_rng* rng)
+{
+  geojson_coordinates center
+      = { .x = test_center.x + trajectory_rng_between(rng, -0.1, 0.1),
+          .y = test_center.y + trajectory_rng_between(rng, -0.1, 0.1) };
+  double radius = trajectory_rng_between(rng, 0.002, 0.03);
+  int vertices = 3 + (int)(trajectory_rng_uniform(rng) * 38);
+  bool hole = trajectory_rng_uniform(rng) < 0.25;
+
+  *polygon = geojson_geometry_init();
+  assert_true(geojson_geometry_reset(polygon, GEOJSON_POLYGON, 2 * vertices + 2, 2));
+  add_ring(polygon, rng, center, radius, vertices);
+  if (hole)
+  {
+    add_ring(polygon, rng, center, radius / 5, vertices);
+  }
+}
+
+static void make_rectangle(
+    geojson_geometry* polygon,
+    double min_x,
+    double min_y,
+    double max_x,
+    double max_y)
+{
+  *polygon = geojson_geometry_init();
+  assert_true(geojson_geometry_reset(polygon, GEOJSON_POLYGON, 5, 1));
+  assert_true(geojson_geometry_add_position(polygon, min_x, min_y));
+  assert_true(geojson_geometry_add_position(polygon, max_x, min_y));
+  assert_true(geojson_geometry_add_position(polygon, max_x, max_y));
+  assert_true(geojson_geometry_add_position(polygon, min_x, max_y));
+  assert_true(geojson_geometry_add_position(polygon, min_x, min_y));
+  assert_true(geojson_geometry_end_ring(polygon));
+}
+
+// The usual crossing number test, one edge at a time.
+static bool brute_force_contains(const geojson_geometry* polygon, geojson_coordinates point)
+{
+  bool inside = false;
+  for (int r = 0, start = 0; r < polygon->ring_count; start = polygon->ring_ends[r++])
+  {
+    for (int i = start; i < polygon->ring_ends[r] - 1; i++)
+    {
+      double x0 = polygon->x[i], y0 = polygon->y[i];
+      double x1 = polygon->x[i + 1], y1 = polygon->y[i + 1];
+      if ((y0 > point.y) != (y1 > point.y)
+          && point.x < x0 + (point.y - y0) * (x1 - x0) / (y1 - y0))
+      {
+        inside = !inside;
+      }
+    }
+  }
+  return inside;
+}
+
+static void write_file(char* path, const char* text)
+{
+  int fd;
+  FILE* file;
+  strcpy(path, "/tmp/geofences_testXXXXXX");
+  assert_true((fd = mkstemp(path)) >= 0);
+  assert_non_null(file = fdopen(fd, "w"));
+  assert_int_equal(fputs(text, file) >= 0, true);
+  assert_int_equal(fclose(file), 0);
+}
+
+static void test_position_geofences_create_failure(void** state)
+{
+  const char* ids[] = { "depot", "airport" };
+  const char* invalid_ids[] = { "depot", "air/port" };
+  const char* empty_ids[] = { "depot", "" };
+  geojson_geometry polygons[2];
+  geojson_geometry line = geojson_geometry_init();
+  char path[32];
+
+  make_rectangle(&polygons[0], 0, 0, 1, 1);
+  make_rectangle(&polygons[1], 2, 2, 3, 3);
+  assert_null(position_geofences_create(invalid_ids, polygons, 2, 10));
+  assert_null(position_geofences_create(empty_ids, polygons, 2, 10));
+  assert_null(position_geofences_create(ids, polygons, -1, 10));
+  assert_null(position_geofences_create(ids, polygons, 2, 0));
+  assert_null(position_geofences_create(ids, &line, 1, 10));
+  polygons[1].x[2] = NAN;
+  assert_null(position_geofences_create(ids, polygons, 2, 10));
+
+  assert_null(position_geofences_load("/nonexistent/geofences", 10));
+  write_file(path, "depot {\"type\":\"Polygon\",\"coordinates\":[[[0,0],[1,0],[1,1],[0,0]]]}\n"
+                   "airport {\"type\":\"Polygon\",\"coordinates\":[[[0,0],[1,0],[1,1]]]}\n");
+  assert_null(position_geofences_load(path, 10));
+  unlink(path);
+
+  for (int i = 0; i < 2; i++)
+  {
+    geojson_geometry_destroy(&polygons[i]);
+  }
+}
+
+static void test_position_geofences_find_success(void** state)
+{
+  char id_text[TEST_FENCES][TEST_ID_SIZE];
+  const char* ids[TEST_FENCES];
+  geojson_geometry polygons[TEST_FENCES];
+  int found[TEST_FENCES];
+  int expected[TEST_FENCES];
+  trajectory_rng rng;
+  long total = 0;
+
+  trajectory_rng_seed(&rng, TEST_SEED);
+  for (int i = 0; i < TEST_FENCES; i++)
+  {
+    snprintf(id_text[i], TEST_ID_SIZE, "fence-%d", i);
+    ids[i] = id_text[i];
+    make_fence(&polygons[i], &rng);
+  }
+  position_geofences* fences = position_geofences_create(ids, polygons, TEST_FENCES, 1);
+  assert_non_null(fences);
+  assert_int_equal(position_geofences_count(fences), TEST_FENCES);
+  assert_string_equal(position_geofences_id(fences, 42), "fence-42");
+
+  for (int i = 0; i < TEST_POINTS; i++)
+  {
+    geojson_coordinates point = { .x = test_center.x + trajectory_rng_between(&rng, -0.12, 0.12),
+                                  .y = test_center.y + trajectory_rng_between(&rng, -0.12, 0.12) };
+    int expected_count = 0;
+    for (int j = 0; j < TEST_FENCES; j++)
+    {
+      if (brute_force_contains(&polygons[j], point))
+      {
+        expected[expected_count++] = j;
+      }
+    }
+    int count = position_geofences_find(fences, point, found, TEST_FENCES);
+    assert_int_equal(count, expected_count);
+    assert_memory_equal(found, expected, count * sizeof(int));
+    assert_int_equal(position_geofences_find(fences, point, found, 0), expected_count);
+    total += count;
+  }
+  // The points must hit fences for the test to mean something.
+  assert_true(total > TEST_POINTS / 2);
+  assert_int_equal(
+      position_geofences_find(fences, (geojson_coordinates){ .x = NAN, .y = 0 }, found, 1), -1);
+
+  position_geofences_destroy(fences);
+  for (int i = 0; i < TEST_FENCES; i++)
+  {
+    geojson_geometry_destroy(&polygons[i]);
+  }
+}
+
+static void test_position_geofences_find_hole_success(void** state)
+{
+  struct mosquitto_message message = { 0 };
+  const char* ids[] = { "park", "triangle" };
+  geojson_geometry polygons[] = { geojson_geometry_init(), geojson_geometry_init() };
+  int found[2];
+
+  message.payload = "{\"type\":\"Polygon\",\"coordinates\":[[[0,0],[4,0],[4,4],[0,4],[0,0]],"
+                    "[[1,1],[1,2],[2,2],[2,1],[1,1]]]}";
+  message.payloadlen = strlen(message.payload);
+  assert_int_equal(mosquitto_payload_to_geojson_geometry(&message, &polygons[0]), 0);
+  message.payload = "{\"type\":\"Polygon\",\"coordinates\":[[[3,3],[6,3],[3,6],[3,3]]]}";
+  message.payloadlen = strlen(message.payload);
+  assert_int_equal(mosquitto_payload_to_geojson_geometry(&message, &polygons[1]), 0);
+  position_geofences* fences = position_geofences_create(ids, polygons, 2, 1);
+  assert_non_null(fences);
+
+  assert_int_equal(position_geofences_find(fences, (geojson_coordinates){ 0.5, 0.5 }, found, 2), 1);
+  assert_int_equal(found[0], 0);
+  assert_int_equal(position_geofences_find(fences, (geojson_coordinates){ 1.5, 1.5 }, found, 2), 0);
+  assert_int_equal(position_geofences_find(fences, (geojson_coordinates){ 3.5, 3.5 }, found, 2), 2);
+  assert_int_equal(found[0], 0);
+  assert_int_equal(found[1], 1);
+  assert_int_equal(position_geofences_find(fences, (geojson_coordinates){ 5, 5 }, found, 2), 0);
+  assert_int_equal(position_geofences_find(fences, (geojson_coordinates){ 4.5, 3.2 }, found, 2), 1);
+  assert_int_equal(found[0], 1);
+
+  position_geofences_destroy(fences);
+  geojson_geometry_destroy(&polygons[0]);
+  geojson_geometry_destroy(&polygons[1]);
+}
+
+static void test_position_geofences_update_success(void** state)
+{
+  const char* ids[] = { "city", "depot", "airport" };
+  geojson_geometry polygons[3];
+  test_events events = { 0 };
+  geojson_coordinates outside = { .x = -1, .y = -1 };
+  geojson_coordinates city = { .x = 1, .y = 1 };
+  geojson_coordinates depot = { .x = 5.5, .y = 5.5 };
+  geojson_coordinates airport = { .x = 20, .y = 20 };
+
+  make_rectangle(&polygons[0], 0, 0, 10, 10);
+  make_rectangle(&polygons[1], 5, 5, 6, 6);
+  make_rectangle(&polygons[2], 15, 15, 25, 25);
+  position_geofences* fences = position_geofences_create(ids, polygons, 3, 2);
+  assert_non_null(fences);
+
+  assert_int_equal(position_geofences_update(fences, 0, outside, record_event, &events), 0);
+  assert_int_equal(position_geofences_update(fences, 0, city, record_event, &events), 1);
+  assert_int_equal(position_geofences_update(fences, 0, city, record_event, &events), 0);
+  assert_int_equal(position_geofences_update(fences, 0, depot, record_event, &events), 1);
+  assert_int_equal(position_geofences_update(fences, 1, depot, record_event, &events), 2);
+  assert_int_equal(position_geofences_update(fences, 0, airport, record_event, &events), 3);
+  assert_int_equal(position_geofences_update(fences, 0, outside, NULL, NULL), 1);
+  assert_int_equal(events.count, 7);
+  test_event expected[] = { { 0, 0, true },  { 0, 1, true },  { 1, 0, true },  { 1, 1, true },
+                            { 0, 0, false }, { 0, 1, false }, { 0, 2, true } };
+  for (int i = 0; i < events.count; i++)
+  {
+    assert_int_equal(events.events[i].vehicle, expected[i].vehicle);
+    assert_int_equal(events.events[i].fence, expected[i].fence);
+    assert_int_equal(events.events[i].entered, expected[i].entered);
+  }
+
+  assert_int_equal(position_geofences_update(fences, 2, city, record_event, &events), -1);
+  assert_int_equal(position_geofences_update(fences, -1, city, record_event, &events), -1);
+  assert_int_equal(
+      position_geofences_update(
+          fences, 0, (geojson_coordinates){ .x = 1, .y = NAN }, record_event, &events),
+      -1);
+
+  position_geofences_destroy(fences);
+  for (int i = 0; i < 3; i++)
+  {
+    geojson_geometry_destroy(&polygons[i]);
+  }
+}
+
+static void test_position_geofences_load_success(void** state)
+{
+  char path[32];
+  int found[2];
+
+  write_file(
+      path,
+      "# Fences of the test\n"
+      "\n"
+      "depot {\"type\":\"Polygon\",\"coordinates\":[[[0,0],[1,0],[1,1],[0,1],[0,0]]]}\r\n"
+      "  airport\t{\"type\": \"Polygon\", \"coordinates\": [[[2,2],[3,2],[3,3],[2,2]]]}");
+  position_geofences* fences = position_geofences_load(path, 10);
+  unlink(path);
+  assert_non_null(fences);
+
+  assert_int_equal(position_geofences_count(fences), 2);
+  assert_string_equal(position_geofences_id(fences, 0), "depot");
+  assert_string_equal(position_geofences_id(fences, 1), "airport");
+  assert_int_equal(
+      position_geofences_find(fences, (geojson_coordinates){ 2.9, 2.1 }, found, 2), 1);
+  assert_int_equal(found[0], 1);
+  position_geofences_destroy(fences);
+}
+
+// a set without fences, ex. a file of only comments, finds nothing
+static void test_position_geofences_empty_success(void** state)
+{
+  char path[32];
+  int found[1];
+  position_geofences* created = position_geofences_create(NULL, NULL, 0, 10);
+
+  write_file(path, "# No fences yet\n\n");
+  position_geofences* loaded = position_geofences_load(path, 10);
+  unlink(path);
+  assert_non_null(created);
+  assert_non_null(loaded);
+
+  position_geofences* sets[] = { created, loaded };
+  for (int i = 0; i < 2; i++)
+  {
+    assert_int_equal(position_geofences_count(sets[i]), 0);
+    assert_int_equal(
+        position_geofences_find(sets[i], (geojson_coordinates){ 0.5, 0.5 }, found, 1), 0);
+    assert_int_equal(
+        position_geofences_update(sets[i], 3, (geojson_coordinates){ 0.5, 0.5 }, NULL, NULL), 0);
+    position_geofences_destroy(sets[i]);
+  }
+}
+
+int test_position_geofences()
+{
+  const struct CMUnitTest tests[]
+      = { cmocka_unit_test(test_position_geofences_create_failure),
+          cmocka_unit_test(test_position_geofences_find_success),
+          cmocka_unit_test(test_position_geofences_find_hole_success),
+          cmocka_unit_test(test_position_geofences_update_success),
+          cmocka_unit_test(test_position_geofences_load_success),
+          cmocka_unit_test(test_position_geofences_empty_success) };
+  return cmocka_run_group_tests_name("position_geofences", tests, NULL, NULL);
+}
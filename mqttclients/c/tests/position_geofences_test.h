@@ -0,0 +1,11 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef POSITION_GEOFENCES_TEST_H
+#define POSITION_GEOFENCES_TEST_H
+
+#include "position_geofences.h"
+
+int test_position_geofences();
+
+#endif // POSITION_GEOFENCES_TEST_H
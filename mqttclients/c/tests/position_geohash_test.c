@@ -0,0 +1,244 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <math.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+// clang-format off
+// cmocka has to come after stddef.h
+#include <cmocka.h>
+// clang-format on
+
+#include "position_geohash_test.h"
+#include "position_trajectory.h"
+
+#define TEST_SEED 5
+#define TEST_POINTS 10000
+#define TEST_BOXES 200
+#define TEST_MAX_CELLS 64
+#define TEST_TOPIC_SIZE 128
+
+static const char test_base32[] = "0123456789bcdefghjkmnpqrstuvwxyz";
+
+// The usual encoder, halving the range of one axis per bit.
+static void bisect_geohash(geojson_coordinates position, int precision, char* geohash)
+{
+  double min_x = -180, max_x = 180, min_y = -90, max_y = 90;
+  for (int i = 0; i < precision; i++)
+  {
+    int character = 0;
+    for (int bit = 0; bit < 5; bit++)
+    {
+      double* min = (5 * i + bit) % 2 == 0 ? &min_x : &min_y;
+      double* max = (5 * i + bit) % 2 == 0 ? &max_x : &max_y;
+      double value = (5 * i + bit) % 2 == 0 ? position.x : position.y;
+      double middle = (*min + *max) / 2;
+      character <<= 1;
+      if (value >= middle)
+      {
+        character |= 1;
+        *min = middle;
+      }
+      else
+      {
+        *max = middle;
+      }
+    }
+    geohash[i] = test_base32[character];
+  }
+  geohash[precision] = '\0';
+}
+
+// The box of the cell of a geohash.
+static void geohash_box(const char* geohash, geojson_coordinates* min, geojson_coordinates* max)
+{
+  *min = (geojson_coordinates){ .x = -180, .y = -90 };
+  *max = (geojson_coordinates){ .x = 180, .y = 90 };
+  for (int i = 0; geohash[i] != '\0'; i++)
+  {
+    int character = (int)(strchr(test_base32, geohash[i]) - test_base32);
+    for (int bit = 0; bit < 5; bit++)
+    {
+      bool x = (5 * i + bit) % 2 == 0;
+      double* low = x ? &min->x : &min->y;
+      double* high = x ? &max->x : &max->y;
+      double middle = (*low + *high) / 2;
+      if ((character >> (4 - bit)) & 1)
+      {
+        *low = middle;
+      }
+      else
+      {
+        *high = middle;
+      }
+    }
+  }
+}
+
+static void test_position_geohash_encode_success(void** state)
+{
+  char geohash[POSITION_GEOHASH_SIZE];
+  char expected[POSITION_GEOHASH_SIZE];
+  trajectory_rng rng;
+
+  assert_true(position_geohash_encode((geojson_coordinates){ .x = -5.6, .y = 42.6 }, 5, geohash));
+  assert_string_equal(geohash, "ezs42");
+  assert_true(
+      position_geohash_encode((geojson_coordinates){ .x = 10.40744, .y = 57.64911 }, 11, geohash));
+  assert_string_equal(geohash, "u4pruydqqvj");
+  assert_true(position_geohash_encode((geojson_coordinates){ .x = 180, .y = 90 }, 12, geohash));
+  assert_string_equal(geohash, "zzzzzzzzzzzz");
+  assert_true(position_geohash_encode((geojson_coordinates){ .x = -180, .y = -90 }, 1, geohash));
+  assert_string_equal(geohash, "0");
+
+  trajectory_rng_seed(&rng, TEST_SEED);
+  for (int i = 0; i < TEST_POINTS; i++)
+  {
+    geojson_coordinates position = { .x = trajectory_rng_between(&rng, -180, 180),
+                                     .y = trajectory_rng_between(&rng, -90, 90) };
+    int precision = 1 + i % POSITION_GEOHASH_MAX_PRECISION;
+    assert_true(position_geohash_encode(position, precision, geohash));
+    bisect_geohash(position, precision, expected);
+    assert_string_equal(geohash, expected);
+  }
+}
+
+static void test_position_geohash_encode_failure(void** state)
+{
+  char geohash[POSITION_GEOHASH_SIZE];
+  assert_false(position_geohash_encode((geojson_coordinates){ .x = 180.5, .y = 0 }, 5, geohash));
+  assert_false(position_geohash_encode((geojson_coordinates){ .x = 0, .y = -91 }, 5, geohash));
+  assert_false(position_geohash_encode((geojson_coordinates){ .x = NAN, .y = 0 }, 5, geohash));
+  assert_false(position_geohash_encode((geojson_coordinates){ .x = 0, .y = 0 }, 0, geohash));
+  assert_false(position_geohash_encode((geojson_coordinates){ .x = 0, .y = 0 }, 13, geohash));
+}
+
+static void test_position_geohash_topic_success(void** state)
+{
+  char topic[TEST_TOPIC_SIZE];
+  geojson_coordinates position = { .x = 10.40744, .y = 57.64911 };
+  size_t length;
+  const char* id;
+
+  assert_int_equal(
+      position_geohash_topic(position, 5, "car-1", topic, sizeof(topic)),
+      strlen("vehicles/geo/u/4/p/r/u/car-1/position"));
+  assert_string_equal(topic, "vehicles/geo/u/4/p/r/u/car-1/position");
+  assert_non_null(id = position_geohash_topic_vehicle_id(topic, &length));
+  assert_int_equal(length, 5);
+  assert_memory_equal(id, "car-1", 5);
+
+  // Ids that are a geohash character, and topics that aren't geohash position topics.
+  assert_int_equal(position_geohash_topic(position, 1, "b", topic, sizeof(topic)), 25);
+  assert_non_null(id = position_geohash_topic_vehicle_id(topic, &length));
+  assert_true(length == 1 && id[0] == 'b');
+  assert_null(position_geohash_topic_vehicle_id("vehicles/car-1/position", &length));
+  assert_null(position_geohash_topic_vehicle_id("vehicles/geo/car-1/position", &length));
+  assert_null(position_geohash_topic_vehicle_id("vehicles/geo/u/4/car-1/speed", &length));
+  assert_null(position_geohash_topic_vehicle_id("vehicles/geo/u/4//position", &length));
+
+  assert_int_equal(position_geohash_topic(position, 5, "", topic, sizeof(topic)), -1);
+  assert_int_equal(position_geohash_topic(position, 5, "car/1", topic, sizeof(topic)), -1);
+  assert_int_equal(position_geohash_topic(position, 5, "car+", topic, sizeof(topic)), -1);
+  assert_int_equal(position_geohash_topic(position, 13, "car-1", topic, sizeof(topic)), -1);
+  // The topic and its terminator need 38 bytes.
+  assert_int_equal(position_geohash_topic(position, 5, "car-1", topic, 37), -1);
+  assert_int_equal(position_geohash_topic(position, 5, "car-1", topic, 38), 37);
+}
+
+static void test_position_geohash_filter_success(void** state)
+{
+  char filter[POSITION_GEOHASH_FILTER_SIZE];
+  assert_int_equal(position_geohash_filter("u4p", filter), strlen("vehicles/geo/u/4/p/#"));
+  assert_string_equal(filter, "vehicles/geo/u/4/p/#");
+  assert_true(position_geohash_filter("", filter) > 0);
+  assert_string_equal(filter, "vehicles/geo/#");
+  assert_true(position_geohash_filter("zzzzzzzzzzzz", filter) < (int)POSITION_GEOHASH_FILTER_SIZE);
+  assert_int_equal(position_geohash_filter("u4a", filter), -1);
+  assert_int_equal(position_geohash_filter("zzzzzzzzzzzzz", filter), -1);
+}
+
+static void test_position_geohash_cover_success(void** state)
+{
+  char cells[TEST_MAX_CELLS][POSITION_GEOHASH_SIZE];
+  char geohash[POSITION_GEOHASH_SIZE];
+  geojson_coordinates min, max;
+  trajectory_rng rng;
+
+  // The whole world, and the eastern half at precision 1 or 0.
+  assert_int_equal(
+      position_geohash_cover(
+          (geojson_coordinates){ -180, -90 }, (geojson_coordinates){ 180, 90 }, 5, 1, cells),
+      1);
+  assert_string_equal(cells[0], "");
+  assert_int_equal(
+      position_geohash_cover(
+          (geojson_coordinates){ 0, -90 }, (geojson_coordinates){ 180, 90 }, 1, 16, cells),
+      16);
+  assert_string_equal(cells[0], "h");
+  assert_string_equal(cells[15], "z");
+  assert_int_equal(
+      position_geohash_cover(
+          (geojson_coordinates){ 0, -90 }, (geojson_coordinates){ 180, 90 }, 1, 15, cells),
+      1);
+  assert_string_equal(cells[0], "");
+
+  // Just inside a cell of precision 2, its 32 cells of precision 3 are merged back.
+  geohash_box("ez", &min, &max);
+  min.x += 1e-9, min.y += 1e-9, max.x -= 1e-9, max.y -= 1e-9;
+  assert_int_equal(position_geohash_cover(min, max, 6, TEST_MAX_CELLS, cells), 1);
+  assert_string_equal(cells[0], "ez");
+
+  // Every point of random boxes is inside one of the cells, which are sorted and don't overlap.
+  trajectory_rng_seed(&rng, TEST_SEED);
+  for (int i = 0; i < TEST_BOXES; i++)
+  {
+    double width = trajectory_rng_between(&rng, 0.001, 1), height = width / 2;
+    min = (geojson_coordinates){ .x = trajectory_rng_between(&rng, -179, 178),
+                                 .y = trajectory_rng_between(&rng, -89, 88) };
+    max = (geojson_coordinates){ .x = min.x + width, .y = min.y + height };
+    int max_cells = 1 + i % TEST_MAX_CELLS;
+    int count = position_geohash_cover(min, max, 6, max_cells, cells);
+    assert_true(count >= 1 && count <= max_cells);
+    for (int c = 1; c < count; c++)
+    {
+      assert_true(strcmp(cells[c - 1], cells[c]) < 0);
+      assert_false(strncmp(cells[c - 1], cells[c], strlen(cells[c - 1])) == 0);
+    }
+    for (int p = 0; p < 50; p++)
+    {
+      geojson_coordinates point = { .x = trajectory_rng_between(&rng, min.x, max.x),
+                                    .y = trajectory_rng_between(&rng, min.y, max.y) };
+      bool covered = false;
+      assert_true(position_geohash_encode(point, 6, geohash));
+      for (int c = 0; c < count; c++)
+      {
+        covered |= strncmp(cells[c], geohash, strlen(cells[c])) == 0;
+      }
+      assert_true(covered);
+    }
+  }
+
+  assert_int_equal(
+      position_geohash_cover(
+          (geojson_coordinates){ 10, 0 }, (geojson_coordinates){ 9, 1 }, 5, 16, cells),
+      -1);
+  assert_int_equal(
+      position_geohash_cover(
+          (geojson_coordinates){ 0, 0 }, (geojson_coordinates){ 1, 1 }, 5, 0, cells),
+      -1);
+}
+
+int test_position_geohash()
+{
+  const struct CMUnitTest tests[]
+      = { cmocka_unit_test(test_position_geohash_encode_success),
+          cmocka_unit_test(test_position_geohash_encode_failure),
+          cmocka_unit_test(test_position_geohash_topic_success),
+          cmocka_unit_test(test_position_geohash_filter_success),
+          cmocka_unit_test(test_position_geohash_cover_success) };
+  return cmocka_run_group_tests_name("position_geohash", tests, NULL, NULL);
+}
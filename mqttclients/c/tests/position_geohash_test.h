@@ -0,0 +1,11 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef POSITION_GEOHASH_TEST_H
+#define POSITION_GEOHASH_TEST_H
+
+#include "position_geohash.h"
+
+int test_position_geohash();
+
+#endif // POSITION_GEOHASH_TEST_H
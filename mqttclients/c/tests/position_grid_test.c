@@ -0,0 +1,282 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <math.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+// clang-format off
+// cmocka has to come after stddef.h
+#include <cmocka.h>
+// clang-format on
+
+#include "position_grid_test.h"
+#include "position_trajectory.h"
+
+#define TEST_SEED 7
+#define TEST_VEHICLES 2000
+#define TEST_STEPS 20
+#define TEST_QUERIES 50
+#define TEST_STEP_SECONDS 5.0
+#define TEST_ID_SIZE 32
+#define EARTH_RADIUS_METERS 6371008.8
+
+static const geojson_coordinates test_center = { .x = -122.335, .y = 47.608 };
+
+typedef struct test_fleet
+{
+  position_store* store;
+  position_grid* grid;
+  trajectory_fleet* trajectories;
+} test_fleet;
+
+static void update(test_fleet* fleet, int vehicle, geojson_coordinates coordinates)
+{
+  char id[TEST_ID_SIZE];
+  int length = snprintf(id, sizeof(id), "vehicle-%d", vehicle);
+  int number = position_store_update(fleet->store, id, length, coordinates);
+  assert_true(number >= 0);
+  assert_true(position_grid_update(fleet->grid, number));
+}
+
+static void update_all(test_fleet* fleet)
+{
+  for (size_t i = 0; i < fleet->trajectories->count; i++)
+  {
+    update(fleet, (int)i, trajectory_fleet_position(fleet->trajectories, i));
+  }
+}
+
+static test_fleet create_fleet(int vehicles)
+{
+  test_fleet fleet;
+  fleet.store = position_store_create(vehicles);
+  fleet.grid = position_grid_create(fleet.store, vehicles, POSITION_GRID_DEFAULT_CELL_DEGREES);
+  fleet.trajectories
+      = trajectory_fleet_create(vehicles, trajectory_settings_default(test_center), TEST_SEED);
+  assert_non_null(fleet.store);
+  assert_non_null(fleet.grid);
+  assert_non_null(fleet.trajectories);
+  update_all(&fleet);
+  return fleet;
+}
+
+static void destroy_fleet(test_fleet* fleet)
+{
+  position_grid_destroy(fleet->grid);
+  position_store_destroy(fleet->store);
+  trajectory_fleet_destroy(fleet->trajectories);
+}
+
+static double distance_meters(geojson_coordinates a, geojson_coordinates b)
+{
+  const double radians = M_PI / 180;
+  double sin_y = sin((b.y - a.y) * radians / 2);
+  double sin_x = sin((b.x - a.x) * radians / 2);
+  double h = sin_y * sin_y + cos(a.y * radians) * cos(b.y * radians) * sin_x * sin_x;
+  return 2 * EARTH_RADIUS_METERS * asin(sqrt(h));
+}
+
+// Checks a query found exactly the vehicles that match, once each and in order
+static void assert_found(const position_store* store, int* found, int count, bool* expected)
+{
+  int expected_count = 0;
+  for (size_t i = 0; i < position_store_count(store); i++)
+  {
+    expected_count += expected[i];
+  }
+  assert_int_equal(count, expected_count);
+  for (int i = 0; i < count; i++)
+  {
+    assert_true(expected[found[i]]);
+    assert_true(i == 0 || found[i] > found[i - 1]);
+  }
+}
+
+static void test_position_grid_create_failure(void** state)
+{
+  position_store* store = position_store_create(16);
+  assert_non_null(store);
+  assert_null(position_grid_create(NULL, 16, POSITION_GRID_DEFAULT_CELL_DEGREES));
+  assert_null(position_grid_create(store, 0, POSITION_GRID_DEFAULT_CELL_DEGREES));
+  assert_null(position_grid_create(store, 16, 0));
+  assert_null(position_grid_create(store, 16, NAN));
+
+  position_grid* grid = position_grid_create(store, 16, POSITION_GRID_DEFAULT_CELL_DEGREES);
+  assert_non_null(grid);
+  // vehicles must be in the store first
+  assert_false(position_grid_update(grid, 0));
+  assert_false(position_grid_update(grid, -1));
+  int found[1];
+  geojson_coordinates min = { .x = 1, .y = 1 };
+  geojson_coordinates max = { .x = 0, .y = 2 };
+  assert_int_equal(position_grid_query_box(grid, min, max, found, 1), -1);
+  assert_int_equal(position_grid_query_radius(grid, min, -1, found, 1), -1);
+  assert_int_equal(
+      position_grid_query_radius(grid, (geojson_coordinates){ 0, 91 }, 1, found, 1), -1);
+
+  position_grid_destroy(grid);
+  position_store_destroy(store);
+}
+
+// Boxes find the vehicles in them while vehicles move between cells
+static void test_position_grid_query_box_success(void** state)
+{
+  test_fleet fleet = create_fleet(TEST_VEHICLES);
+  trajectory_rng rng;
+  int found[TEST_VEHICLES];
+  bool expected[TEST_VEHICLES];
+  trajectory_rng_seed(&rng, TEST_SEED);
+
+  for (int step = 0; step < TEST_STEPS; step++)
+  {
+    trajectory_fleet_step(fleet.trajectories, TEST_STEP_SECONDS * 10);
+    update_all(&fleet);
+    for (int query = 0; query < TEST_QUERIES / 10; query++)
+    {
+      geojson_coordinates min = { .x = trajectory_rng_between(&rng, -122.44, -122.24),
+                                  .y = trajectory_rng_between(&rng, 47.51, 47.71) };
+      geojson_coordinates max = { .x = min.x + trajectory_rng_between(&rng, 0, 0.05),
+                                  .y = min.y + trajectory_rng_between(&rng, 0, 0.05) };
+      for (int i = 0; i < TEST_VEHICLES; i++)
+      {
+        geojson_coordinates position = position_store_get(fleet.store, i);
+        expected[i] = position.x >= min.x && position.x <= max.x && position.y >= min.y
+            && position.y <= max.y;
+      }
+      int count = position_grid_query_box(fleet.grid, min, max, found, TEST_VEHICLES);
+      assert_found(fleet.store, found, count, expected);
+    }
+  }
+  destroy_fleet(&fleet);
+}
+
+static void test_position_grid_query_radius_success(void** state)
+{
+  test_fleet fleet = create_fleet(TEST_VEHICLES);
+  trajectory_rng rng;
+  int found[TEST_VEHICLES];
+  bool expected[TEST_VEHICLES];
+  trajectory_rng_seed(&rng, TEST_SEED);
+
+  for (int query = 0; query < TEST_QUERIES; query++)
+  {
+    geojson_coordinates center = { .x = trajectory_rng_between(&rng, -122.44, -122.24),
+                                   .y = trajectory_rng_between(&rng, 47.51, 47.71) };
+    double radius = trajectory_rng_between(&rng, 100, 3000);
+    for (int i = 0; i < TEST_VEHICLES; i++)
+    {
+      expected[i] = distance_meters(center, position_store_get(fleet.store, i)) <= radius;
+    }
+    int count = position_grid_query_radius(fleet.grid, center, radius, found, TEST_VEHICLES);
+    assert_found(fleet.store, found, count, expected);
+  }
+  destroy_fleet(&fleet);
+}
+
+// Queries over more cells than buckets go through the store, and only write max_count vehicles
+static void test_position_grid_query_large_success(void** state)
+{
+  test_fleet fleet = create_fleet(TEST_VEHICLES);
+  int found[TEST_VEHICLES];
+  bool expected[TEST_VEHICLES];
+  geojson_coordinates min = { .x = -180, .y = -90 };
+  geojson_coordinates max = { .x = 180, .y = 90 };
+
+  for (int i = 0; i < TEST_VEHICLES; i++)
+  {
+    expected[i] = true;
+  }
+  int count = position_grid_query_box(fleet.grid, min, max, found, TEST_VEHICLES);
+  assert_found(fleet.store, found, count, expected);
+
+  found[1] = -1;
+  assert_int_equal(position_grid_query_radius(fleet.grid, test_center, 1e6, found, 1), count);
+  assert_int_equal(found[1], -1);
+  destroy_fleet(&fleet);
+}
+
+// Circles across the antimeridian find the vehicles on both sides
+static void test_position_grid_query_antimeridian_success(void** state)
+{
+  test_fleet fleet = { .store = position_store_create(16) };
+  fleet.grid = position_grid_create(fleet.store, 16, POSITION_GRID_DEFAULT_CELL_DEGREES);
+  assert_non_null(fleet.grid);
+  int found[4];
+
+  update(&fleet, 0, (geojson_coordinates){ .x = 179.99, .y = 0 });
+  update(&fleet, 1, (geojson_coordinates){ .x = -179.99, .y = 0 });
+  update(&fleet, 2, (geojson_coordinates){ .x = -179.9, .y = 0 });
+  int count
+      = position_grid_query_radius(fleet.grid, (geojson_coordinates){ 179.995, 0 }, 2000, found, 4);
+  assert_int_equal(count, 2);
+  assert_int_equal(found[0], 0);
+  assert_int_equal(found[1], 1);
+
+  destroy_fleet(&fleet);
+}
+
+typedef struct grid_reader
+{
+  const position_grid* grid;
+  bool done;
+  int queries;
+  int duplicates;
+} grid_reader;
+
+static void* query_positions(void* context)
+{
+  grid_reader* reader = (grid_reader*)context;
+  int* found = malloc(TEST_VEHICLES * sizeof(int));
+  assert_non_null(found);
+  while (!__atomic_load_n(&reader->done, __ATOMIC_ACQUIRE))
+  {
+    int count = position_grid_query_radius(reader->grid, test_center, 3000, found, TEST_VEHICLES);
+    for (int i = 1; i < count; i++)
+    {
+      reader->duplicates += found[i] <= found[i - 1];
+    }
+    __atomic_store_n(&reader->queries, reader->queries + 1, __ATOMIC_RELAXED);
+  }
+  free(found);
+  return NULL;
+}
+
+// Queries run while vehicles move and never find a vehicle twice
+static void test_position_grid_concurrent_query_success(void** state)
+{
+  test_fleet fleet = create_fleet(TEST_VEHICLES);
+  grid_reader reader = { .grid = fleet.grid };
+  pthread_t thread;
+  assert_int_equal(pthread_create(&thread, NULL, query_positions, &reader), 0);
+
+  for (int step = 0;
+       step < TEST_STEPS * 10 || __atomic_load_n(&reader.queries, __ATOMIC_RELAXED) < 100;
+       step++)
+  {
+    trajectory_fleet_step(fleet.trajectories, TEST_STEP_SECONDS);
+    update_all(&fleet);
+  }
+  __atomic_store_n(&reader.done, true, __ATOMIC_RELEASE);
+  pthread_join(thread, NULL);
+
+  assert_int_equal(reader.duplicates, 0);
+  destroy_fleet(&fleet);
+}
+
+int test_position_grid()
+{
+  const struct CMUnitTest tests[]
+      = { cmocka_unit_test(test_position_grid_create_failure),
+          cmocka_unit_test(test_position_grid_query_box_success),
+          cmocka_unit_test(test_position_grid_query_radius_success),
+          cmocka_unit_test(test_position_grid_query_large_success),
+          cmocka_unit_test(test_position_grid_query_antimeridian_success),
+          cmocka_unit_test(test_position_grid_concurrent_query_success) };
+  return cmocka_run_group_tests_name("position_grid", tests, NULL, NULL);
+}
@@ -0,0 +1,11 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef POSITION_GRID_TEST_H
+#define POSITION_GRID_TEST_H
+
+#include "position_grid.h"
+
+int test_position_grid();
+
+#endif // POSITION_GRID_TEST_H
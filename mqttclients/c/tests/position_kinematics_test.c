@@ -0,0 +1,333 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <math.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+// clang-format off
+// cmocka has to come after stddef.h
+#include <cmocka.h>
+// clang-format on
+
+#include "position_kinematics_test.h"
+#include "position_trajectory.h"
+
+#define TEST_SEED 17
+// Odd, so the last segment is computed without SSE2.
+#define TEST_SEGMENTS 10001
+#define TEST_MAX_SUMMARIES 8
+#define TEST_PATH_LENGTH 200
+#define TEST_SECOND 1000000000ull
+// The length of a thousandth of a degree along a great circle.
+#define TEST_MILLIDEGREE_METERS (POSITION_KINEMATICS_EARTH_RADIUS_METERS * M_PI / 180000)
+
+typedef struct test_summaries
+{
+  int vehicles[TEST_MAX_SUMMARIES];
+  position_kinematics_summary summaries[TEST_MAX_SUMMARIES];
+  int count;
+} test_summaries;
+
+static void record_summary(int vehicle, const position_kinematics_summary* summary, void* context)
+{
+  test_summaries* summaries = (test_summaries*)context;
+  assert_true(summaries->count < TEST_MAX_SUMMARIES);
+  summaries->vehicles[summaries->count] = vehicle;
+  summaries->summaries[summaries->count++] = *summary;
+}
+
+// The usual haversine formula and initial bearing, one segment at a time in long double, as the
+// initial bearing loses digits along short segments in double.
+static void reference_segment(
+    double from_x,
+    double from_y,
+    double to_x,
+    double to_y,
+    double* meters,
+    double* heading)
+{
+  long double radians = 3.14159265358979323846264338327950288L / 180;
+  long double latitude_1 = from_y * radians, latitude_2 = to_y * radians;
+  long double longitudes = (to_x - from_x) * radians;
+  long double a = powl(sinl((latitude_2 - latitude_1) / 2), 2)
+      + cosl(latitude_1) * cosl(latitude_2) * powl(sinl(longitudes / 2), 2);
+  *meters = 2 * POSITION_KINEMATICS_EARTH_RADIUS_METERS * asinl(sqrtl(fminl(a, 1)));
+  *heading = fmodl(
+      atan2l(
+          sinl(longitudes) * cosl(latitude_2),
+          cosl(latitude_1) * sinl(latitude_2)
+              - sinl(latitude_1) * cosl(latitude_2) * cosl(longitudes))
+              / radians
+          + 360,
+      360);
+}
+
+static double angle_difference(double first, double second)
+{
+  double difference = fabs(first - second);
+  return fmin(difference, 360 - difference);
+}
+
+static void test_position_kinematics_segments_success(void** state)
+{
+  (void)state;
+  static double from_x[TEST_SEGMENTS], from_y[TEST_SEGMENTS];
+  static double to_x[TEST_SEGMENTS], to_y[TEST_SEGMENTS];
+  static double meters[TEST_SEGMENTS], headings[TEST_SEGMENTS];
+  trajectory_rng rng;
+
+  // Random segments anywhere, half of them short like the segments of a vehicle.
+  trajectory_rng_seed(&rng, TEST_SEED);
+  for (int i = 0; i < TEST_SEGMENTS; i++)
+  {
+    double span = i % 2 == 0 ? 0.01 : 180;
+    from_x[i] = trajectory_rng_between(&rng, -180, 180);
+    from_y[i] = trajectory_rng_between(&rng, -89, 89);
+    to_x[i] = fmax(-180, fmin(180, from_x[i] + trajectory_rng_between(&rng, -span, span)));
+    to_y[i] = fmax(-90, fmin(90, from_y[i] + trajectory_rng_between(&rng, -span / 2, span / 2)));
+  }
+  position_kinematics_segments(from_x, from_y, to_x, to_y, TEST_SEGMENTS, meters, headings);
+  for (int i = 0; i < TEST_SEGMENTS; i++)
+  {
+    double expected_meters, expected_heading;
+    reference_segment(from_x[i], from_y[i], to_x[i], to_y[i], &expected_meters, &expected_heading);
+    assert_true(fabs(meters[i] - expected_meters) < 1e-6);
+    assert_true(headings[i] >= 0 && headings[i] < 360);
+    assert_true(angle_difference(headings[i], expected_heading) < 1e-9);
+  }
+
+  // North, east, south and west at the equator, across the antimeridian, a segment of length 0,
+  // then over the north pole and from it.
+  double edge_from_x[] = { 0, 0, 0, 0, 179.9995, 12.5, 0, 10 };
+  double edge_from_y[] = { 0, 0, 0, 0, 0, 45, 89.9995, 90 };
+  double edge_to_x[] = { 0, 0.001, 0, -0.001, -179.9995, 12.5, 180, 10 };
+  double edge_to_y[] = { 0.001, 0, -0.001, 0, 0, 45, 89.9995, 89 };
+  double expected_meters[] = { TEST_MILLIDEGREE_METERS, TEST_MILLIDEGREE_METERS,
+                               TEST_MILLIDEGREE_METERS, TEST_MILLIDEGREE_METERS,
+                               TEST_MILLIDEGREE_METERS, 0,
+                               TEST_MILLIDEGREE_METERS, 1000 * TEST_MILLIDEGREE_METERS };
+  double expected_headings[] = { 0, 90, 180, 270, 90, 0, 0 };
+  int count = sizeof(edge_from_x) / sizeof(double);
+  for (int length = 1; length <= count; length++)
+  {
+    position_kinematics_segments(
+        edge_from_x, edge_from_y, edge_to_x, edge_to_y, length, meters, headings);
+    for (int i = 0; i < length; i++)
+    {
+      assert_true(fabs(meters[i] - expected_meters[i]) < 1e-6);
+      // The heading from a pole depends on the longitude it is given.
+      if (i < count - 1)
+      {
+        assert_true(angle_difference(headings[i], expected_headings[i]) < 1e-9);
+      }
+    }
+  }
+}
+
+static void test_position_kinematics_create_failure(void** state)
+{
+  (void)state;
+  assert_null(position_kinematics_create(0, 10 * TEST_SECOND, 1));
+  assert_null(position_kinematics_create(16, 0, 1));
+  assert_null(position_kinematics_create(16, 10 * TEST_SECOND, 0));
+  assert_null(position_kinematics_create(16, 10 * TEST_SECOND + 1, 4));
+  position_kinematics_destroy(NULL);
+}
+
+static void test_position_kinematics_update_success(void** state)
+{
+  (void)state;
+  position_kinematics* kinematics = position_kinematics_create(4, 10 * TEST_SECOND, 1);
+  position_kinematics_state vehicle;
+  assert_non_null(kinematics);
+  assert_false(position_kinematics_get(kinematics, 0, &vehicle));
+
+  int first[] = { 0, 1, 1 };
+  double first_x[] = { 0, 0, 0 };
+  double first_y[] = { 0, 0, 0.001 };
+  assert_int_equal(
+      position_kinematics_update(kinematics, first, first_x, first_y, 3, TEST_SECOND, NULL, NULL),
+      3);
+  assert_true(position_kinematics_get(kinematics, 0, &vehicle));
+  assert_int_equal(vehicle.fixes, 1);
+  assert_true(vehicle.total_meters == 0 && vehicle.speed_mps == 0);
+
+  // Vehicle 1 was repeated: its second position took no time, so it has no speed yet.
+  assert_true(position_kinematics_get(kinematics, 1, &vehicle));
+  assert_int_equal(vehicle.fixes, 2);
+  assert_true(fabs(vehicle.total_meters - TEST_MILLIDEGREE_METERS) < 1e-6);
+  assert_true(vehicle.speed_mps == 0 && vehicle.heading_degrees == 0);
+
+  int second[] = { 0, 1 };
+  double second_x[] = { 0, 0.001 };
+  double second_y[] = { 0.002, 0.001 };
+  assert_int_equal(
+      position_kinematics_update(
+          kinematics, second, second_x, second_y, 2, 3 * TEST_SECOND, NULL, NULL),
+      2);
+  assert_true(position_kinematics_get(kinematics, 0, &vehicle));
+  assert_int_equal(vehicle.fixes, 2);
+  assert_true(fabs(vehicle.total_meters - 2 * TEST_MILLIDEGREE_METERS) < 1e-6);
+  assert_true(fabs(vehicle.speed_mps - TEST_MILLIDEGREE_METERS) < 1e-6);
+  assert_true(vehicle.heading_degrees == 0);
+  assert_true(position_kinematics_get(kinematics, 1, &vehicle));
+  assert_true(fabs(vehicle.speed_mps - TEST_MILLIDEGREE_METERS / 2) < 1e-6);
+  assert_true(fabs(vehicle.heading_degrees - 90) < 1e-3);
+
+  // A batch longer than a chunk, following one vehicle, matches the segments one at a time.
+  int path[TEST_PATH_LENGTH];
+  double path_x[TEST_PATH_LENGTH], path_y[TEST_PATH_LENGTH];
+  double expected = 0, meters, heading;
+  trajectory_rng rng;
+  trajectory_rng_seed(&rng, TEST_SEED);
+  for (int i = 0; i < TEST_PATH_LENGTH; i++)
+  {
+    path[i] = 2;
+    path_x[i] = trajectory_rng_between(&rng, -122.4, -122.3);
+    path_y[i] = trajectory_rng_between(&rng, 47.5, 47.7);
+    if (i > 0)
+    {
+      reference_segment(path_x[i - 1], path_y[i - 1], path_x[i], path_y[i], &meters, &heading);
+      expected += meters;
+    }
+  }
+  assert_int_equal(
+      position_kinematics_update(
+          kinematics, path, path_x, path_y, TEST_PATH_LENGTH, 4 * TEST_SECOND, NULL, NULL),
+      TEST_PATH_LENGTH);
+  assert_true(position_kinematics_get(kinematics, 2, &vehicle));
+  assert_int_equal(vehicle.fixes, TEST_PATH_LENGTH);
+  assert_true(fabs(vehicle.total_meters - expected) < 1e-3);
+  assert_true(angle_difference(vehicle.heading_degrees, heading) < 1e-9);
+
+  position_kinematics_destroy(kinematics);
+}
+
+static void test_position_kinematics_tumbling_success(void** state)
+{
+  (void)state;
+  position_kinematics* kinematics = position_kinematics_create(1, 10 * TEST_SECOND, 1);
+  test_summaries summaries = { .count = 0 };
+  uint64_t seconds[] = { 1, 2, 5, 12, 35 };
+  int vehicle = 0;
+  assert_non_null(kinematics);
+
+  for (int i = 0; i < 5; i++)
+  {
+    double x = 0, y = 0.001 * i;
+    assert_int_equal(
+        position_kinematics_update(
+            kinematics, &vehicle, &x, &y, 1, seconds[i] * TEST_SECOND, record_summary, &summaries),
+        1);
+    assert_int_equal(summaries.count, i < 3 ? 0 : i - 2);
+  }
+
+  // The window of 0 s to 10 s, with 2 segments taking 4 s, then the window of 10 s to 20 s with
+  // the segment of 7 s ending at 12 s. Windows without positions have no summary.
+  position_kinematics_summary* summary = &summaries.summaries[0];
+  assert_int_equal(summaries.vehicles[0], 0);
+  assert_true(summary->start_ns == 0 && summary->end_ns == 10 * TEST_SECOND);
+  assert_int_equal(summary->fixes, 3);
+  assert_true(fabs(summary->meters - 2 * TEST_MILLIDEGREE_METERS) < 1e-6);
+  assert_true(fabs(summary->mean_speed_mps - TEST_MILLIDEGREE_METERS / 2) < 1e-6);
+  assert_true(fabs(summary->max_speed_mps - TEST_MILLIDEGREE_METERS) < 1e-6);
+  assert_true(summary->heading_degrees == 0);
+  summary = &summaries.summaries[1];
+  assert_true(summary->start_ns == 10 * TEST_SECOND && summary->end_ns == 20 * TEST_SECOND);
+  assert_int_equal(summary->fixes, 1);
+  assert_true(fabs(summary->meters - TEST_MILLIDEGREE_METERS) < 1e-6);
+  assert_true(fabs(summary->mean_speed_mps - TEST_MILLIDEGREE_METERS / 7) < 1e-6);
+
+  position_kinematics_destroy(kinematics);
+}
+
+static void test_position_kinematics_sliding_success(void** state)
+{
+  (void)state;
+  // Windows of 10 s sliding by 2 s.
+  position_kinematics* kinematics = position_kinematics_create(1, 10 * TEST_SECOND, 5);
+  test_summaries summaries = { .count = 0 };
+  uint64_t seconds[] = { 1, 3, 5, 13, 15 };
+  int vehicle = 0;
+  assert_non_null(kinematics);
+
+  for (int i = 0; i < 5; i++)
+  {
+    double x = 0, y = 0.001 * i;
+    assert_int_equal(
+        position_kinematics_update(
+            kinematics, &vehicle, &x, &y, 1, seconds[i] * TEST_SECOND, record_summary, &summaries),
+        1);
+  }
+  assert_int_equal(summaries.count, 4);
+
+  // Windows starting before time 0 start at 0.
+  uint64_t starts[] = { 0, 0, 0, 4 };
+  uint64_t ends[] = { 2, 4, 6, 14 };
+  uint32_t fixes[] = { 1, 2, 3, 2 };
+  double meters[] = { 0, 1, 2, 2 };
+  double mean_speeds[] = { 0, 0.5, 0.5, 0.2 };
+  for (int i = 0; i < 4; i++)
+  {
+    position_kinematics_summary* summary = &summaries.summaries[i];
+    assert_true(summary->start_ns == starts[i] * TEST_SECOND);
+    assert_true(summary->end_ns == ends[i] * TEST_SECOND);
+    assert_int_equal(summary->fixes, fixes[i]);
+    assert_true(fabs(summary->meters - meters[i] * TEST_MILLIDEGREE_METERS) < 1e-6);
+    assert_true(fabs(summary->mean_speed_mps - mean_speeds[i] * TEST_MILLIDEGREE_METERS) < 1e-6);
+  }
+
+  position_kinematics_destroy(kinematics);
+}
+
+static void test_position_kinematics_update_failure(void** state)
+{
+  (void)state;
+  position_kinematics* kinematics = position_kinematics_create(4, 10 * TEST_SECOND, 1);
+  position_kinematics_state vehicle;
+  int vehicles[] = { 0, 4, 1 };
+  double x[] = { 1, 1, 1 };
+  double y[] = { 1, 1, 1 };
+  assert_non_null(kinematics);
+
+  // Positions before the invalid one are added.
+  assert_int_equal(
+      position_kinematics_update(kinematics, vehicles, x, y, 3, TEST_SECOND, NULL, NULL), -1);
+  assert_true(position_kinematics_get(kinematics, 0, &vehicle));
+  assert_false(position_kinematics_get(kinematics, 1, &vehicle));
+  assert_false(position_kinematics_get(kinematics, 4, &vehicle));
+
+  double invalid_x[] = { 1, NAN };
+  double invalid_y[] = { 1, 91 };
+  assert_int_equal(
+      position_kinematics_update(kinematics, vehicles, invalid_x, y, 2, TEST_SECOND, NULL, NULL),
+      -1);
+  assert_int_equal(
+      position_kinematics_update(kinematics, vehicles, x, invalid_y, 2, TEST_SECOND, NULL, NULL),
+      -1);
+  assert_int_equal(position_kinematics_update(kinematics, vehicles, x, y, 1, 0, NULL, NULL), -1);
+
+  // A time going back is taken as the previous one.
+  double moved_y = 1.001;
+  assert_int_equal(
+      position_kinematics_update(kinematics, vehicles, x, &moved_y, 1, 1, NULL, NULL), 1);
+  assert_true(position_kinematics_get(kinematics, 0, &vehicle));
+  assert_true(vehicle.total_meters > 0 && vehicle.speed_mps == 0);
+
+  position_kinematics_destroy(kinematics);
+}
+
+int test_position_kinematics()
+{
+  const struct CMUnitTest tests[]
+      = { cmocka_unit_test(test_position_kinematics_segments_success),
+          cmocka_unit_test(test_position_kinematics_create_failure),
+          cmocka_unit_test(test_position_kinematics_update_success),
+          cmocka_unit_test(test_position_kinematics_tumbling_success),
+          cmocka_unit_test(test_position_kinematics_sliding_success),
+          cmocka_unit_test(test_position_kinematics_update_failure) };
+  return cmocka_run_group_tests_name("position_kinematics", tests, NULL, NULL);
+}
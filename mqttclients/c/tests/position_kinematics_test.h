@@ -0,0 +1,11 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef POSITION_KINEMATICS_TEST_H
+#define POSITION_KINEMATICS_TEST_H
+
+#include "position_kinematics.h"
+
+int test_position_kinematics();
+
+#endif // POSITION_KINEMATICS_TEST_H
@@ -0,0 +1,191 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+// clang-format off
+// cmocka has to come after stddef.h
+#include <cmocka.h>
+// clang-format on
+
+#include "position_store_test.h"
+
+#define TEST_VEHICLES 100000
+#define TEST_ID_SIZE 32
+#define TEST_UPDATES 200000
+
+static int make_id(char* id, int vehicle)
+{
+  return snprintf(id, TEST_ID_SIZE, "vehicle-%d", vehicle);
+}
+
+static void test_position_store_topic_vehicle_id_success(void** state)
+{
+  size_t length;
+  const char* topic = "vehicles/vehicle01/position";
+  const char* id = position_store_topic_vehicle_id(topic, &length);
+  assert_ptr_equal(id, topic + strlen("vehicles/"));
+  assert_int_equal(length, strlen("vehicle01"));
+
+  assert_non_null(position_store_topic_vehicle_id("vehicles/v/position", &length));
+  assert_int_equal(length, 1);
+}
+
+static void test_position_store_topic_vehicle_id_failure(void** state)
+{
+  size_t length;
+  assert_null(position_store_topic_vehicle_id(NULL, &length));
+  assert_null(position_store_topic_vehicle_id("vehicles//position", &length));
+  assert_null(position_store_topic_vehicle_id("vehicles/vehicle01", &length));
+  assert_null(position_store_topic_vehicle_id("vehicles/vehicle01/alarm", &length));
+  assert_null(position_store_topic_vehicle_id("vehicles/vehicle01/position/x", &length));
+  assert_null(position_store_topic_vehicle_id("fleet/vehicle01/position", &length));
+}
+
+static void test_position_store_update_success(void** state)
+{
+  position_store* store = position_store_create(4);
+  geojson_coordinates coordinates;
+  assert_non_null(store);
+
+  // ids are read up to their length, like the ids inside topics
+  assert_int_equal(
+      position_store_update(store, "vehicle01/position", 9, (geojson_coordinates){ 1, 2 }), 0);
+  assert_int_equal(position_store_update(store, "vehicle02", 9, (geojson_coordinates){ 3, 4 }), 1);
+  assert_int_equal(position_store_update(store, "vehicle01", 9, (geojson_coordinates){ 5, 6 }), 0);
+  assert_int_equal(position_store_count(store), 2);
+
+  assert_true(position_store_lookup(store, "vehicle01", 9, &coordinates));
+  assert_true(coordinates.x == 5 && coordinates.y == 6);
+  assert_true(position_store_lookup(store, "vehicle02", 9, &coordinates));
+  assert_true(coordinates.x == 3 && coordinates.y == 4);
+  assert_int_equal(position_store_find(store, "vehicle02", 9), 1);
+  assert_string_equal(position_store_id(store, 0), "vehicle01");
+  assert_true(position_store_get(store, 1).x == 3);
+
+  // a prefix or an extension of a known id is another vehicle
+  assert_false(position_store_lookup(store, "vehicle0", 8, &coordinates));
+  assert_false(position_store_lookup(store, "vehicle011", 10, &coordinates));
+
+  position_store_destroy(store);
+}
+
+static void test_position_store_update_failure(void** state)
+{
+  char long_id[POSITION_STORE_MAX_ID_LENGTH + 2];
+  position_store* store = position_store_create(2);
+  assert_non_null(store);
+  assert_null(position_store_create(0));
+
+  memset(long_id, 'v', sizeof(long_id));
+  assert_int_equal(
+      position_store_update(store, long_id, sizeof(long_id), (geojson_coordinates){ 0 }), -1);
+  assert_int_equal(position_store_find(store, long_id, sizeof(long_id)), -1);
+
+  // the store is full, but known vehicles still update
+  assert_int_equal(position_store_update(store, "a", 1, (geojson_coordinates){ 0 }), 0);
+  assert_int_equal(position_store_update(store, "b", 1, (geojson_coordinates){ 0 }), 1);
+  assert_int_equal(position_store_update(store, "c", 1, (geojson_coordinates){ 0 }), -1);
+  assert_int_equal(position_store_update(store, "a", 1, (geojson_coordinates){ 1, 1 }), 0);
+  assert_int_equal(position_store_count(store), 2);
+
+  position_store_destroy(store);
+}
+
+// Enough vehicles for probe chains and several id blocks
+static void test_position_store_many_vehicles_success(void** state)
+{
+  position_store* store = position_store_create(TEST_VEHICLES);
+  char id[TEST_ID_SIZE];
+  geojson_coordinates coordinates;
+  assert_non_null(store);
+
+  for (int i = 0; i < TEST_VEHICLES; i++)
+  {
+    int length = make_id(id, i);
+    assert_int_equal(position_store_update(store, id, length, (geojson_coordinates){ i, -i }), i);
+  }
+  assert_int_equal(position_store_count(store), TEST_VEHICLES);
+  for (int i = TEST_VEHICLES - 1; i >= 0; i--)
+  {
+    int length = make_id(id, i);
+    assert_true(position_store_lookup(store, id, length, &coordinates));
+    assert_true(coordinates.x == i && coordinates.y == -i);
+    assert_string_equal(position_store_id(store, i), id);
+  }
+  int length = make_id(id, TEST_VEHICLES);
+  assert_false(position_store_lookup(store, id, length, &coordinates));
+
+  position_store_destroy(store);
+}
+
+typedef struct store_reader
+{
+  position_store* store;
+  bool done;
+  int torn;
+  int lookups;
+} store_reader;
+
+static void* read_positions(void* context)
+{
+  store_reader* reader = (store_reader*)context;
+  char id[TEST_ID_SIZE];
+  geojson_coordinates coordinates;
+  while (!__atomic_load_n(&reader->done, __ATOMIC_ACQUIRE))
+  {
+    for (int i = 0; i < 16; i++)
+    {
+      int length = make_id(id, i);
+      if (position_store_lookup(reader->store, id, length, &coordinates))
+      {
+        reader->torn += coordinates.x != coordinates.y;
+        __atomic_store_n(&reader->lookups, reader->lookups + 1, __ATOMIC_RELAXED);
+      }
+    }
+  }
+  return NULL;
+}
+
+// A reader never sees the x of one update with the y of another
+static void test_position_store_concurrent_read_success(void** state)
+{
+  store_reader reader = { .store = position_store_create(16) };
+  char id[TEST_ID_SIZE];
+  pthread_t thread;
+  assert_non_null(reader.store);
+  assert_int_equal(pthread_create(&thread, NULL, read_positions, &reader), 0);
+
+  // keep updating until the reader has raced with enough updates
+  for (int update = 0;
+       update < TEST_UPDATES || __atomic_load_n(&reader.lookups, __ATOMIC_RELAXED) < TEST_UPDATES;
+       update++)
+  {
+    int length = make_id(id, update % 16);
+    double value = update;
+    position_store_update(reader.store, id, length, (geojson_coordinates){ value, value });
+  }
+  __atomic_store_n(&reader.done, true, __ATOMIC_RELEASE);
+  pthread_join(thread, NULL);
+
+  assert_int_equal(reader.torn, 0);
+  position_store_destroy(reader.store);
+}
+
+int test_position_store()
+{
+  const struct CMUnitTest tests[]
+      = { cmocka_unit_test(test_position_store_topic_vehicle_id_success),
+          cmocka_unit_test(test_position_store_topic_vehicle_id_failure),
+          cmocka_unit_test(test_position_store_update_success),
+          cmocka_unit_test(test_position_store_update_failure),
+          cmocka_unit_test(test_position_store_many_vehicles_success),
+          cmocka_unit_test(test_position_store_concurrent_read_success) };
+  return cmocka_run_group_tests_name("position_store", tests, NULL, NULL);
+}
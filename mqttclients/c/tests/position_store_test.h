@@ -0,0 +1,11 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef POSITION_STORE_TEST_H
+#define POSITION_STORE_TEST_H
+
+#include "position_store.h"
+
+int test_position_store();
+
+#endif // POSITION_STORE_TEST_H
@@ -0,0 +1,227 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <math.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+// clang-format off
+// cmocka has to come after stddef.h
+#include <cmocka.h>
+// clang-format on
+
+#include "position_stream_codec_test.h"
+
+#define TOPIC "vehicles/vehicle01/position"
+#define FRAMES 100
+
+// a vehicle moving a few meters between positions
+static geojson_coordinates walk(int i)
+{
+  return (geojson_coordinates){ .x = -122.123456 + i * 0.000173, .y = 47.654321 - i * 0.000091 };
+}
+
+static struct mosquitto_message frame_message(const mosquitto_payload* payload, const char* topic)
+{
+  struct mosquitto_message message = { 0 };
+  message.topic = (char*)topic;
+  message.payload = payload->payload;
+  message.payloadlen = payload->payload_length;
+  return message;
+}
+
+static void test_position_stream_round_trip_success(void** state)
+{
+  position_stream_encoder encoder = position_stream_encoder_init(10);
+  position_stream_decoder* decoder = position_stream_decoder_create();
+  mosquitto_payload payload = mosquitto_payload_init(POSITION_STREAM_MAX_FRAME_LENGTH);
+  geojson_coordinates coordinates;
+  size_t bytes = 0;
+  assert_non_null(decoder);
+
+  for (int i = 0; i < FRAMES; i++)
+  {
+    assert_int_equal(position_stream_encode(&encoder, walk(i), &payload), 0);
+    // keyframes are every 10th frame, the others are small differences
+    assert_int_equal(((unsigned char*)payload.payload)[0] & 1, i % 10 == 0);
+    assert_true(payload.payload_length <= (i % 10 == 0 ? 11 : 5));
+    bytes += payload.payload_length;
+
+    struct mosquitto_message message = frame_message(&payload, TOPIC);
+    assert_int_equal(position_stream_decode(decoder, &message, &coordinates), 0);
+    // quantized to micro-degrees, like the JSON payloads
+    assert_true(coordinates.x == round(walk(i).x * 1e6) / 1e6);
+    assert_true(coordinates.y == round(walk(i).y * 1e6) / 1e6);
+  }
+  // an order of magnitude less than the ~54 bytes of a JSON position
+  assert_true(bytes < FRAMES * 6);
+
+  position_stream_decoder_destroy(decoder);
+  mosquitto_payload_destroy(&payload);
+}
+
+static void test_position_stream_lost_frame_resync_success(void** state)
+{
+  position_stream_encoder encoder = position_stream_encoder_init(5);
+  position_stream_decoder* decoder = position_stream_decoder_create();
+  mosquitto_payload payload = mosquitto_payload_init(POSITION_STREAM_MAX_FRAME_LENGTH);
+  geojson_coordinates coordinates;
+  int decoded = 0;
+
+  for (int i = 0; i < 12; i++)
+  {
+    assert_int_equal(position_stream_encode(&encoder, walk(i), &payload), 0);
+    struct mosquitto_message message = frame_message(&payload, TOPIC);
+    // frame 2 is lost, frames 3 and 4 can't be applied until the keyframe at 5
+    if (i != 2)
+    {
+      int rc = position_stream_decode(decoder, &message, &coordinates);
+      assert_int_equal(rc, i == 3 || i == 4 ? -1 : 0);
+      decoded += rc == 0;
+    }
+    if (i == 5)
+    {
+      assert_true(coordinates.x == round(walk(5).x * 1e6) / 1e6);
+    }
+  }
+  assert_int_equal(decoded, 9);
+
+  position_stream_decoder_destroy(decoder);
+  mosquitto_payload_destroy(&payload);
+}
+
+static void test_position_stream_repeated_frame_fail(void** state)
+{
+  position_stream_encoder encoder
+      = position_stream_encoder_init(POSITION_STREAM_DEFAULT_KEYFRAME_INTERVAL);
+  position_stream_decoder* decoder = position_stream_decoder_create();
+  mosquitto_payload payload = mosquitto_payload_init(POSITION_STREAM_MAX_FRAME_LENGTH);
+  geojson_coordinates coordinates;
+
+  for (int i = 0; i < 3; i++)
+  {
+    assert_int_equal(position_stream_encode(&encoder, walk(i), &payload), 0);
+    struct mosquitto_message message = frame_message(&payload, TOPIC);
+    assert_int_equal(position_stream_decode(decoder, &message, &coordinates), 0);
+    if (i == 1)
+    {
+      // a redelivered difference isn't applied twice, and doesn't lose the stream
+      assert_int_equal(position_stream_decode(decoder, &message, &coordinates), -1);
+    }
+  }
+  assert_true(coordinates.x == round(walk(2).x * 1e6) / 1e6);
+
+  position_stream_decoder_destroy(decoder);
+  mosquitto_payload_destroy(&payload);
+}
+
+static void test_position_stream_many_topics_success(void** state)
+{
+  const int topic_count = 100;
+  position_stream_encoder* encoders = calloc(topic_count, sizeof(position_stream_encoder));
+  position_stream_decoder* decoder = position_stream_decoder_create();
+  mosquitto_payload payload = mosquitto_payload_init(POSITION_STREAM_MAX_FRAME_LENGTH);
+  geojson_coordinates coordinates;
+  char topic[64];
+
+  for (int t = 0; t < topic_count; t++)
+  {
+    encoders[t] = position_stream_encoder_init(POSITION_STREAM_DEFAULT_KEYFRAME_INTERVAL);
+  }
+  for (int i = 0; i < 3; i++)
+  {
+    for (int t = 0; t < topic_count; t++)
+    {
+      geojson_coordinates position = walk(i * t);
+      snprintf(topic, sizeof(topic), "vehicles/vehicle%03d/position", t);
+      assert_int_equal(position_stream_encode(&encoders[t], position, &payload), 0);
+      struct mosquitto_message message = frame_message(&payload, topic);
+      assert_int_equal(position_stream_decode(decoder, &message, &coordinates), 0);
+      assert_true(coordinates.x == round(position.x * 1e6) / 1e6);
+    }
+  }
+
+  free(encoders);
+  position_stream_decoder_destroy(decoder);
+  mosquitto_payload_destroy(&payload);
+}
+
+static void test_position_stream_extreme_differences_success(void** state)
+{
+  const double xs[] = { -9e12, 9e12, 0, -0.000001, 9e12 };
+  position_stream_encoder encoder = position_stream_encoder_init(100);
+  position_stream_decoder* decoder = position_stream_decoder_create();
+  mosquitto_payload payload = mosquitto_payload_init(POSITION_STREAM_MAX_FRAME_LENGTH);
+  geojson_coordinates coordinates;
+
+  for (size_t i = 0; i < sizeof(xs) / sizeof(xs[0]); i++)
+  {
+    assert_int_equal(
+        position_stream_encode(
+            &encoder, (geojson_coordinates){ .x = xs[i], .y = -xs[i] }, &payload),
+        0);
+    struct mosquitto_message message = frame_message(&payload, TOPIC);
+    assert_int_equal(position_stream_decode(decoder, &message, &coordinates), 0);
+    assert_true(coordinates.x == xs[i]);
+    assert_true(coordinates.y == -xs[i]);
+  }
+
+  position_stream_decoder_destroy(decoder);
+  mosquitto_payload_destroy(&payload);
+}
+
+static void test_position_stream_invalid_fail(void** state)
+{
+  const unsigned char frames[][4] = {
+    // a difference without a keyframe
+    { 0x02, 0x01, 0x01 },
+    // truncated varint
+    { 0x01, 0x81 },
+    // trailing byte
+    { 0x01, 0x01, 0x01, 0x01 },
+  };
+  const size_t lengths[] = { 3, 2, 4 };
+  position_stream_encoder encoder = position_stream_encoder_init(1);
+  position_stream_decoder* decoder = position_stream_decoder_create();
+  mosquitto_payload payload = mosquitto_payload_init(POSITION_STREAM_MAX_FRAME_LENGTH);
+  mosquitto_payload small_payload = mosquitto_payload_init(POSITION_STREAM_MAX_FRAME_LENGTH - 1);
+  struct mosquitto_message message = { 0 };
+  geojson_coordinates coordinates;
+
+  message.topic = TOPIC;
+  for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++)
+  {
+    message.payload = (void*)frames[i];
+    message.payloadlen = lengths[i];
+    assert_int_equal(position_stream_decode(decoder, &message, &coordinates), -1);
+  }
+  message.payloadlen = 0;
+  assert_int_equal(position_stream_decode(decoder, &message, &coordinates), -1);
+
+  assert_int_equal(
+      position_stream_encode(&encoder, (geojson_coordinates){ .x = NAN, .y = 0 }, &payload), -1);
+  assert_int_equal(
+      position_stream_encode(&encoder, (geojson_coordinates){ .x = 0, .y = 1e13 }, &payload), -1);
+  assert_int_equal(position_stream_encode(&encoder, walk(0), &small_payload), -1);
+
+  position_stream_decoder_destroy(decoder);
+  mosquitto_payload_destroy(&payload);
+  mosquitto_payload_destroy(&small_payload);
+}
+
+int test_position_stream_codec()
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_position_stream_round_trip_success),
+    cmocka_unit_test(test_position_stream_lost_frame_resync_success),
+    cmocka_unit_test(test_position_stream_repeated_frame_fail),
+    cmocka_unit_test(test_position_stream_many_topics_success),
+    cmocka_unit_test(test_position_stream_extreme_differences_success),
+    cmocka_unit_test(test_position_stream_invalid_fail)
+  };
+  return cmocka_run_group_tests_name("position_stream_codec", tests, NULL, NULL);
+}
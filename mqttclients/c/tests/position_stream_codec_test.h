@@ -0,0 +1,11 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef POSITION_STREAM_CODEC_TEST_H
+#define POSITION_STREAM_CODEC_TEST_H
+
+#include "position_stream_codec.h"
+
+int test_position_stream_codec();
+
+#endif // POSITION_STREAM_CODEC_TEST_H
@@ -0,0 +1,176 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <math.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+// clang-format off
+// cmocka has to come after stddef.h
+#include <cmocka.h>
+// clang-format on
+
+#include "position_trajectory_test.h"
+
+#define TEST_SEED 42
+#define TEST_VEHICLES 1001
+#define TEST_STEPS 200
+#define TEST_STEP_SECONDS 5.0
+#define METERS_PER_DEGREE 111320.0
+
+static const geojson_coordinates test_center = { .x = -122.335, .y = 47.608 };
+
+// The first outputs of xoshiro256+ seeded by splitmix64 with 0, from the reference implementations
+static void test_trajectory_rng_reference_success(void** state)
+{
+  trajectory_rng rng;
+  trajectory_rng_seed(&rng, 0);
+  assert_true(rng.state[0] == 0xe220a8397b1dcdafull);
+  assert_true(rng.state[3] == 0xf88bb8a8724c81ecull);
+
+  assert_true(trajectory_rng_next(&rng) == 0xdaac60e1ed6a4f9bull);
+  assert_true(trajectory_rng_next(&rng) == 0x3156a1da0dc08435ull);
+  assert_true(trajectory_rng_next(&rng) == 0xf9ba3e3285d046abull);
+}
+
+static void test_trajectory_rng_uniform_success(void** state)
+{
+  trajectory_rng rng;
+  double sum = 0;
+  trajectory_rng_seed(&rng, TEST_SEED);
+
+  for (int i = 0; i < 100000; i++)
+  {
+    double value = trajectory_rng_uniform(&rng);
+    assert_true(value >= 0 && value < 1);
+    sum += value;
+
+    value = trajectory_rng_between(&rng, -90, 90);
+    assert_true(value >= -90 && value < 90);
+  }
+  assert_true(fabs(sum / 100000 - 0.5) < 0.01);
+}
+
+static void test_trajectory_fleet_create_failure(void** state)
+{
+  trajectory_settings settings = trajectory_settings_default(test_center);
+  assert_null(trajectory_fleet_create(0, settings, TEST_SEED));
+
+  settings.min_speed_mps = settings.max_speed_mps + 1;
+  assert_null(trajectory_fleet_create(TEST_VEHICLES, settings, TEST_SEED));
+
+  settings = trajectory_settings_default(test_center);
+  settings.radius_degrees = 0;
+  assert_null(trajectory_fleet_create(TEST_VEHICLES, settings, TEST_SEED));
+}
+
+// The same seed drives the same vehicles, another seed other ones
+static void test_trajectory_fleet_reproducible_success(void** state)
+{
+  trajectory_settings settings = trajectory_settings_default(test_center);
+  trajectory_fleet* first = trajectory_fleet_create(TEST_VEHICLES, settings, TEST_SEED);
+  trajectory_fleet* second = trajectory_fleet_create(TEST_VEHICLES, settings, TEST_SEED);
+  trajectory_fleet* other = trajectory_fleet_create(TEST_VEHICLES, settings, TEST_SEED + 1);
+  assert_non_null(first);
+  assert_non_null(second);
+  assert_non_null(other);
+
+  for (int step = 0; step < TEST_STEPS; step++)
+  {
+    trajectory_fleet_step(first, TEST_STEP_SECONDS);
+    trajectory_fleet_step(second, TEST_STEP_SECONDS);
+    trajectory_fleet_step(other, TEST_STEP_SECONDS);
+  }
+  assert_memory_equal(first->x, second->x, TEST_VEHICLES * sizeof(double));
+  assert_memory_equal(first->y, second->y, TEST_VEHICLES * sizeof(double));
+  assert_true(memcmp(first->x, other->x, TEST_VEHICLES * sizeof(double)) != 0);
+
+  trajectory_fleet_destroy(first);
+  trajectory_fleet_destroy(second);
+  trajectory_fleet_destroy(other);
+}
+
+// Stepping the fleet in ranges, like threads sharing it would, gives the same run
+static void test_trajectory_fleet_step_range_success(void** state)
+{
+  trajectory_settings settings = trajectory_settings_default(test_center);
+  trajectory_fleet* whole = trajectory_fleet_create(TEST_VEHICLES, settings, TEST_SEED);
+  trajectory_fleet* split = trajectory_fleet_create(TEST_VEHICLES, settings, TEST_SEED);
+  assert_non_null(whole);
+  assert_non_null(split);
+
+  for (int step = 0; step < TEST_STEPS; step++)
+  {
+    trajectory_fleet_step(whole, TEST_STEP_SECONDS);
+    trajectory_fleet_step_range(split, 0, 333, TEST_STEP_SECONDS);
+    trajectory_fleet_step_range(split, 333, TEST_VEHICLES - 333, TEST_STEP_SECONDS);
+  }
+  assert_memory_equal(whole->x, split->x, TEST_VEHICLES * sizeof(double));
+  assert_memory_equal(whole->y, split->y, TEST_VEHICLES * sizeof(double));
+  assert_true(trajectory_fleet_position(whole, 500).x == split->x[500]);
+  assert_true(trajectory_fleet_position(whole, 500).y == split->y[500]);
+
+  trajectory_fleet_destroy(whole);
+  trajectory_fleet_destroy(split);
+}
+
+// Vehicles drive along streets at their speed and stay in the area, they never jump
+static void test_trajectory_fleet_motion_success(void** state)
+{
+  trajectory_settings settings = trajectory_settings_default(test_center);
+  trajectory_fleet* fleet = trajectory_fleet_create(TEST_VEHICLES, settings, TEST_SEED);
+  assert_non_null(fleet);
+  double max_meters = settings.max_speed_mps * TEST_STEP_SECONDS * 1.0001;
+  double meters_per_x_degree = METERS_PER_DEGREE * cos(test_center.y * M_PI / 180);
+  double total_meters = 0;
+  int turns = 0;
+
+  for (int step = 0; step < TEST_STEPS; step++)
+  {
+    for (size_t i = 0; i < fleet->count; i++)
+    {
+      geojson_coordinates before = trajectory_fleet_position(fleet, i);
+      double east = fleet->east[i];
+      trajectory_fleet_step_range(fleet, i, 1, TEST_STEP_SECONDS);
+      geojson_coordinates after = trajectory_fleet_position(fleet, i);
+
+      double east_meters = (after.x - before.x) * meters_per_x_degree;
+      double north_meters = (after.y - before.y) * METERS_PER_DEGREE;
+      // along one street at a time
+      assert_true(east_meters == 0 || north_meters == 0);
+      assert_true(fabs(east_meters) + fabs(north_meters) <= max_meters);
+      assert_true(after.x >= fleet->min_x && after.x <= fleet->max_x);
+      assert_true(after.y >= fleet->min_y && after.y <= fleet->max_y);
+      assert_true(
+          fleet->speed_mps[i] >= settings.min_speed_mps
+          && fleet->speed_mps[i] <= settings.max_speed_mps);
+      total_meters += fabs(east_meters) + fabs(north_meters);
+      turns += fabs(fleet->east[i]) != fabs(east);
+    }
+  }
+
+  // about the average speed, and a turn every minute or so
+  double average_speed = total_meters / (TEST_VEHICLES * TEST_STEPS * TEST_STEP_SECONDS);
+  assert_true(average_speed > settings.min_speed_mps && average_speed < settings.max_speed_mps);
+  double expected_turns
+      = TEST_VEHICLES * TEST_STEPS * TEST_STEP_SECONDS * TRAJECTORY_DEFAULT_TURN_RATE;
+  assert_true(turns > expected_turns * 0.8 && turns < expected_turns * 1.2);
+
+  trajectory_fleet_destroy(fleet);
+}
+
+int test_position_trajectory()
+{
+  const struct CMUnitTest tests[]
+      = { cmocka_unit_test(test_trajectory_rng_reference_success),
+          cmocka_unit_test(test_trajectory_rng_uniform_success),
+          cmocka_unit_test(test_trajectory_fleet_create_failure),
+          cmocka_unit_test(test_trajectory_fleet_reproducible_success),
+          cmocka_unit_test(test_trajectory_fleet_step_range_success),
+          cmocka_unit_test(test_trajectory_fleet_motion_success) };
+  return cmocka_run_group_tests_name("position_trajectory", tests, NULL, NULL);
+}
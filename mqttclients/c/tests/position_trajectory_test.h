@@ -0,0 +1,11 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef POSITION_TRAJECTORY_TEST_H
+#define POSITION_TRAJECTORY_TEST_H
+
+#include "position_trajectory.h"
+
+int test_position_trajectory();
+
+#endif // POSITION_TRAJECTORY_TEST_H
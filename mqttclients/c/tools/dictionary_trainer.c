@@ -0,0 +1,185 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zdict.h>
+
+#include "logging.h"
+
+/*
+ * Trains a zstd dictionary for mqtt_compression (built with PAYLOAD_COMPRESSION) from recorded
+ * payloads. Each sample file holds one payload, or with -l each line of the files is a payload, like
+ * the output of mosquitto_sub. A few thousand samples of the messages a topic carries are plenty.
+ *
+ *   mosquitto_sub -h localhost -t 'vehicles/+/position' -C 5000 > positions.txt
+ *   ./dictionary_trainer -l positions.txt positions.dict
+ *
+ * Then set TELEMETRY_COMPRESSION_DICTIONARY=positions.dict for the producer and the consumer.
+ *
+ * Options:
+ *   -l          split the sample files into one payload per line
+ *   -s <bytes>  the largest dictionary (default 4096), small payloads gain little from a larger one
+ */
+
+#define DEFAULT_DICTIONARY_SIZE 4096
+
+typedef struct samples
+{
+  char* data;
+  size_t length;
+  size_t capacity;
+  size_t* sizes;
+  unsigned count;
+  unsigned sizes_capacity;
+} samples;
+
+static bool add_sample(samples* samples, const char* sample, size_t length)
+{
+  if (samples->length + length > samples->capacity)
+  {
+    size_t capacity = samples->capacity * 2 > samples->length + length ? samples->capacity * 2
+                                                                       : samples->length + length;
+    char* data = realloc(samples->data, capacity);
+    if (data == NULL)
+    {
+      return false;
+    }
+    samples->data = data;
+    samples->capacity = capacity;
+  }
+  if (samples->count == samples->sizes_capacity)
+  {
+    unsigned capacity = samples->sizes_capacity > 0 ? samples->sizes_capacity * 2 : 1024;
+    size_t* sizes = realloc(samples->sizes, capacity * sizeof(size_t));
+    if (sizes == NULL)
+    {
+      return false;
+    }
+    samples->sizes = sizes;
+    samples->sizes_capacity = capacity;
+  }
+  memcpy(samples->data + samples->length, sample, length);
+  samples->length += length;
+  samples->sizes[samples->count++] = length;
+  return true;
+}
+
+static bool read_samples(const char* path, bool lines, samples* samples)
+{
+  FILE* file = fopen(path, "rb");
+  char* content = NULL;
+  long length = -1;
+  bool result = false;
+
+  if (file != NULL && fseek(file, 0, SEEK_END) == 0 && (length = ftell(file)) >= 0
+      && fseek(file, 0, SEEK_SET) == 0 && (content = malloc(length + 1)) != NULL
+      && fread(content, 1, length, file) == (size_t)length)
+  {
+    result = true;
+    if (!lines)
+    {
+      result = length == 0 || add_sample(samples, content, length);
+    }
+    for (char* line = content; lines && result && line < content + length;)
+    {
+      char* end = memchr(line, '\n', content + length - line);
+      end = end != NULL ? end : content + length;
+      result = end == line || add_sample(samples, line, end - line);
+      line = end + 1;
+    }
+  }
+  if (!result)
+  {
+    LOG_ERROR("Failed to read the samples in %s", path);
+  }
+
+  if (file != NULL)
+  {
+    fclose(file);
+  }
+  free(content);
+  return result;
+}
+
+static bool write_dictionary(const char* path, const char* dictionary, size_t length)
+{
+  FILE* output = fopen(path, "wb");
+  if (output == NULL)
+  {
+    return false;
+  }
+  bool written = fwrite(dictionary, 1, length, output) == length;
+  return fclose(output) == 0 && written;
+}
+
+int main(int argc, char* argv[])
+{
+  samples samples = { 0 };
+  size_t dictionary_size = DEFAULT_DICTIONARY_SIZE;
+  bool lines = false;
+  int result = EXIT_FAILURE;
+  int arg = 1;
+
+  for (; arg < argc && argv[arg][0] == '-'; arg++)
+  {
+    if (strcmp(argv[arg], "-l") == 0)
+    {
+      lines = true;
+    }
+    else if (strcmp(argv[arg], "-s") == 0 && arg + 1 < argc)
+    {
+      dictionary_size = strtoul(argv[++arg], NULL, 10);
+    }
+    else
+    {
+      break;
+    }
+  }
+  if (argc - arg < 2 || dictionary_size == 0)
+  {
+    fprintf(stderr, "Usage: %s [-l] [-s <bytes>] <sample file>... <dictionary file>\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  const char* dictionary_file = argv[argc - 1];
+  bool read = true;
+  for (; arg < argc - 1 && read; arg++)
+  {
+    read = read_samples(argv[arg], lines, &samples);
+  }
+
+  char* dictionary = malloc(dictionary_size);
+  if (read && dictionary != NULL)
+  {
+    size_t length = ZDICT_trainFromBuffer(
+        dictionary, dictionary_size, samples.data, samples.sizes, samples.count);
+    if (ZDICT_isError(length))
+    {
+      LOG_ERROR(
+          "Failed to train a dictionary from %u samples: %s",
+          samples.count,
+          ZDICT_getErrorName(length));
+    }
+    else if (!write_dictionary(dictionary_file, dictionary, length))
+    {
+      LOG_ERROR("Failed to write the dictionary to %s", dictionary_file);
+    }
+    else
+    {
+      printf(
+          "Trained a %zu byte dictionary from %u samples (%zu bytes) into %s\n",
+          length,
+          samples.count,
+          samples.length,
+          dictionary_file);
+      result = EXIT_SUCCESS;
+    }
+  }
+
+  free(dictionary);
+  free(samples.data);
+  free(samples.sizes);
+  return result;
+}
@@ -0,0 +1,88 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "logging.h"
+
+/*
+ * Prints binary log records (built with ASYNC_LOGGING and LOG_BINARY) as text, one line per record
+ * prefixed with its UTC time and thread. Reads the file given as the first argument, or stdin.
+ *
+ *   ./telemetry_producer telemetry.env > app.log
+ *   ./log_decoder app.log
+ */
+
+static const char* level_name(uint8_t level)
+{
+  switch (level)
+  {
+    case MQTT_LOG_LEVEL_ERROR:
+      return "ERROR";
+    case MQTT_LOG_LEVEL_WARNING:
+      return "WARNING";
+    default:
+      return "INFO";
+  }
+}
+
+static bool read_field(FILE* input, char* buffer, size_t length)
+{
+  buffer[length] = '\0';
+  return fread(buffer, 1, length, input) == length;
+}
+
+int main(int argc, char* argv[])
+{
+  FILE* input = argc > 1 ? fopen(argv[1], "rb") : stdin;
+  mqtt_log_binary_record header;
+  char tag[UINT8_MAX + 1];
+  char file[UINT8_MAX + 1];
+  char function[UINT8_MAX + 1];
+  char message[UINT16_MAX + 1];
+
+  if (input == NULL)
+  {
+    LOG_ERROR("Failed to open %s", argv[1]);
+    return EXIT_FAILURE;
+  }
+
+  while (fread(&header, sizeof(header), 1, input) == 1)
+  {
+    if (!read_field(input, tag, header.tag_length) || !read_field(input, file, header.file_length)
+        || !read_field(input, function, header.function_length)
+        || !read_field(input, message, header.message_length))
+    {
+      LOG_ERROR("Truncated log record");
+      break;
+    }
+
+    time_t seconds = (time_t)(header.timestamp_ns / 1000000000u);
+    char time_text[32];
+    strftime(time_text, sizeof(time_text), "%Y-%m-%dT%H:%M:%S", gmtime(&seconds));
+
+    printf(
+        "%s.%06uZ [%u] %s %s%s%s",
+        time_text,
+        (unsigned)(header.timestamp_ns % 1000000000u / 1000u),
+        header.thread_id,
+        level_name(header.level),
+        header.tag_length > 0 ? tag : "",
+        header.tag_length > 0 ? ": " : "",
+        message);
+    if (header.file_length > 0)
+    {
+      printf(" [%s:%s:%u]", file, function, header.line);
+    }
+    printf("\n");
+  }
+
+  if (input != stdin)
+  {
+    fclose(input);
+  }
+  return EXIT_SUCCESS;
+}
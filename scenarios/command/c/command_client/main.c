@@ -10,6 +10,7 @@
 #include "logging.h"
 #include "mosquitto.h"
 #include "mqtt_callbacks.h"
+#include "mqtt_event_loop.h"
 #include "mqtt_protocol.h"
 #include "mqtt_setup.h"
 #include "unlock_command.pb-c.h"
@@ -19,14 +20,15 @@
 #define COMMAND_CONTENT_TYPE "application/protobuf"
 #define COMMAND_TIMEOUT_SEC 10
 #define COMMAND_MIN_RATE_SEC 2
+#define COMMAND_CHECK_INTERVAL_MS 1000
 
 #define QOS_LEVEL 1
 #define MQTT_VERSION MQTT_PROTOCOL_V5
 
 #define UUID_LENGTH 37
 
-#define CONTINUE_IF_ERROR(rc)                                            \
-  if (true)                                                              \
+#define RETURN_IF_ERROR(rc)                                              \
+  do                                                                     \
   {                                                                      \
     if (rc != MOSQ_ERR_SUCCESS)                                          \
     {                                                                    \
@@ -35,9 +37,17 @@
       proplist = NULL;                                                   \
       free(payload_buf);                                                 \
       payload_buf = NULL;                                                \
-      continue;                                                          \
+      return;                                                            \
     }                                                                    \
-  }
+  } while (0)
+
+typedef struct unlock_command_client
+{
+  struct mosquitto* mosq;
+  char* pub_topic;
+  UnlockRequest proto_unlock_request;
+  Google__Protobuf__Timestamp proto_timestamp;
+} unlock_command_client;
 
 static uuid_t pending_correlation_id;
 static time_t last_command_sent_time;
@@ -72,11 +82,11 @@ void handle_message(
   }
   else if (unlock_response->succeed == true)
   {
-    printf("\tCommand succeed: True\n");
+    LOG_DETAIL("Command succeed: True");
   }
   else
   {
-    printf("\tCommand succeed: False\n\tError: %s\n", unlock_response->errordetail);
+    LOG_DETAIL("Command succeed: False\n\tError: %s", unlock_response->errordetail);
   }
 
   if (mosquitto_property_read_binary(
@@ -95,7 +105,7 @@ void handle_message(
     uuid_unparse(pending_correlation_id, readable_correlation_data);
     LOG_ERROR("Correlation data does not match, expected: %s", readable_correlation_data);
     uuid_unparse(correlation_data, readable_correlation_data);
-    printf("\treceived: %s\n", readable_correlation_data);
+    LOG_DETAIL("received: %s", readable_correlation_data);
   }
   else
   {
@@ -129,7 +139,7 @@ void on_connect_with_subscribe(
           != MOSQ_ERR_SUCCESS)
   {
     LOG_ERROR("Failed to subscribe: %s", mosquitto_strerror(result));
-    keep_running = 0;
+    mqtt_client_stop();
     /* We might as well disconnect if we were unable to subscribe */
     if ((result = mosquitto_disconnect_v5(mosq, reason_code, props)) != MOSQ_ERR_SUCCESS)
     {
@@ -138,6 +148,90 @@ void on_connect_with_subscribe(
   }
 }
 
+/* Called every COMMAND_CHECK_INTERVAL_MS by the event loop. Times out the pending command if
+ * there is one, and sends a new command when there is nothing pending. */
+void send_unlock_request(void* context)
+{
+  unlock_command_client* client = (unlock_command_client*)context;
+  mosquitto_property* proplist = NULL;
+  void* payload_buf;
+  size_t proto_payload_len;
+  time_t current_time = time(NULL);
+
+  // if there's a pending command
+  if (!uuid_is_null(pending_correlation_id))
+  {
+    // wait until the command times out
+    if (current_time < last_command_sent_time + COMMAND_TIMEOUT_SEC)
+    {
+      return;
+    }
+    else
+    {
+      LOG_ERROR("Command timed out without a response.");
+      uuid_clear(pending_correlation_id);
+    }
+  }
+  // If the command timed out (didn't `return` in the last if statement) or there is no
+  // pending command, send a new command if it's been more than 2 seconds since the last command
+  // (to avoid spamming commands)
+  if (current_time > last_command_sent_time + COMMAND_MIN_RATE_SEC)
+  {
+    last_command_sent_time = current_time;
+
+    client->proto_timestamp.seconds = current_time;
+    client->proto_unlock_request.when = &client->proto_timestamp;
+    proto_payload_len = unlock_request__get_packed_size(&client->proto_unlock_request);
+    payload_buf = malloc(proto_payload_len);
+
+    if (payload_buf == NULL)
+    {
+      LOG_ERROR("Failed to allocate memory for payload buffer.");
+      return;
+    }
+
+    if (unlock_request__pack(&client->proto_unlock_request, payload_buf) != proto_payload_len)
+    {
+      LOG_ERROR("Failure serializing payload.");
+      free(payload_buf);
+      payload_buf = NULL;
+      return;
+    }
+
+    RETURN_IF_ERROR(
+        mosquitto_property_add_string(&proplist, MQTT_PROP_RESPONSE_TOPIC, get_response_topic()));
+    RETURN_IF_ERROR(
+        mosquitto_property_add_string(&proplist, MQTT_PROP_CONTENT_TYPE, COMMAND_CONTENT_TYPE));
+
+    uuid_generate(pending_correlation_id);
+
+    RETURN_IF_ERROR(mosquitto_property_add_binary(
+        &proplist, MQTT_PROP_CORRELATION_DATA, pending_correlation_id, UUID_LENGTH));
+
+    LOG_INFO(
+        CLIENT_LOG_TAG,
+        "Sending unlock request from %s at %s",
+        client->proto_unlock_request.requestedfrom,
+        asctime(localtime(&client->proto_unlock_request.when->seconds)));
+
+    RETURN_IF_ERROR(mosquitto_publish_v5(
+        client->mosq,
+        NULL,
+        client->pub_topic,
+        proto_payload_len,
+        payload_buf,
+        QOS_LEVEL,
+        false,
+        proplist));
+
+    mosquitto_property_free_all(&proplist);
+    proplist = NULL;
+
+    free(payload_buf);
+    payload_buf = NULL;
+  }
+}
+
 /*
  * This sample sends an unlock command to the vehicle.
  */
@@ -146,7 +240,7 @@ int main(int argc, char* argv[])
   struct mosquitto* mosq;
   int result;
 
-  mqtt_client_obj obj;
+  mqtt_client_obj obj = { 0 };
   obj.mqtt_version = MQTT_VERSION;
   obj.handle_message = handle_message;
 
@@ -173,86 +267,30 @@ int main(int argc, char* argv[])
     sprintf(pub_topic, "vehicles/%s/command/unlock/request", COMMAND_TARGET_CLIENT_ID);
 
     // Set up protobuf unlock payload
-    UnlockRequest proto_unlock_request = UNLOCK_REQUEST__INIT;
-    void* payload_buf;
-    size_t proto_payload_len;
-    Google__Protobuf__Timestamp proto_timestamp = GOOGLE__PROTOBUF__TIMESTAMP__INIT;
-    proto_unlock_request.requestedfrom = obj.client_id;
-    proto_timestamp.nanos = 0;
-
-    mosquitto_property* proplist = NULL;
-    time_t current_time;
+    unlock_command_client client = { .mosq = mosq,
+                                     .pub_topic = pub_topic,
+                                     .proto_unlock_request = UNLOCK_REQUEST__INIT,
+                                     .proto_timestamp = GOOGLE__PROTOBUF__TIMESTAMP__INIT };
+    client.proto_unlock_request.requestedfrom = obj.client_id;
+    client.proto_timestamp.nanos = 0;
+
     last_command_sent_time = time(0);
     uuid_clear(pending_correlation_id);
 
-    while (keep_running)
+    if (mqtt_event_loop_add_timer(
+            mqtt_client_event_loop(),
+            COMMAND_CHECK_INTERVAL_MS,
+            COMMAND_CHECK_INTERVAL_MS,
+            send_unlock_request,
+            &client)
+        == NULL)
+    {
+      LOG_ERROR("Failure creating command timer");
+      result = MOSQ_ERR_UNKNOWN;
+    }
+    else
     {
-      current_time = time(NULL);
-      // if there's a pending command
-      if (!uuid_is_null(pending_correlation_id))
-      {
-        // wait until the command times out
-        if (current_time < last_command_sent_time + COMMAND_TIMEOUT_SEC)
-        {
-          continue;
-        }
-        else
-        {
-          LOG_ERROR("Command timed out without a response.");
-          uuid_clear(pending_correlation_id);
-        }
-      }
-      // If the command timed out (didn't `continue` in the last if statement) or there is no
-      // pending command, send a new command if it's been more than 2 seconds since the last command
-      // (to avoid spamming commands)
-      if (current_time > last_command_sent_time + COMMAND_MIN_RATE_SEC)
-      {
-        last_command_sent_time = current_time;
-
-        proto_timestamp.seconds = current_time;
-        proto_unlock_request.when = &proto_timestamp;
-        proto_payload_len = unlock_request__get_packed_size(&proto_unlock_request);
-        payload_buf = malloc(proto_payload_len);
-
-        if (payload_buf == NULL)
-        {
-          LOG_ERROR("Failed to allocate memory for payload buffer.");
-          continue;
-        }
-
-        if (unlock_request__pack(&proto_unlock_request, payload_buf) != proto_payload_len)
-        {
-          LOG_ERROR("Failure serializing payload.");
-          free(payload_buf);
-          payload_buf = NULL;
-          continue;
-        }
-
-        CONTINUE_IF_ERROR(mosquitto_property_add_string(
-            &proplist, MQTT_PROP_RESPONSE_TOPIC, get_response_topic()));
-        CONTINUE_IF_ERROR(
-            mosquitto_property_add_string(&proplist, MQTT_PROP_CONTENT_TYPE, COMMAND_CONTENT_TYPE));
-
-        uuid_generate(pending_correlation_id);
-
-        CONTINUE_IF_ERROR(mosquitto_property_add_binary(
-            &proplist, MQTT_PROP_CORRELATION_DATA, pending_correlation_id, UUID_LENGTH));
-
-        LOG_INFO(
-            CLIENT_LOG_TAG,
-            "Sending unlock request from %s at %s",
-            proto_unlock_request.requestedfrom,
-            asctime(localtime(&proto_unlock_request.when->seconds)));
-
-        CONTINUE_IF_ERROR(mosquitto_publish_v5(
-            mosq, NULL, pub_topic, proto_payload_len, payload_buf, QOS_LEVEL, false, proplist));
-
-        mosquitto_property_free_all(&proplist);
-        proplist = NULL;
-
-        free(payload_buf);
-        payload_buf = NULL;
-      }
+      result = mqtt_client_run();
     }
   }
 
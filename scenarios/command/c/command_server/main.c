@@ -9,6 +9,7 @@
 #include "logging.h"
 #include "mosquitto.h"
 #include "mqtt_callbacks.h"
+#include "mqtt_event_loop.h"
 #include "mqtt_protocol.h"
 #include "mqtt_setup.h"
 
@@ -48,8 +49,9 @@ bool handle_unlock(char* payload, int payload_length)
   }
   else
   {
-    printf(
-        "\tUnlock request sent from %s at %s",
+    /* asctime ends with a newline */
+    LOG_DETAIL(
+        "Unlock request sent from %s at %.24s",
         unlock_request->requestedfrom,
         asctime(localtime(&unlock_request->when->seconds)));
     LOG_INFO(SERVER_LOG_TAG, "Vehicle successfully unlocked");
@@ -122,7 +124,7 @@ void handle_message(
       proto_unlock_response.succeed ? "True" : "False");
   if (command_succeed == false)
   {
-    printf("\tError: %s\n", proto_unlock_response.errordetail);
+    LOG_DETAIL("Error: %s", proto_unlock_response.errordetail);
   }
 
   RETURN_IF_ERROR(mosquitto_publish_v5(
@@ -169,7 +171,7 @@ void on_connect_with_subscribe(
           != MOSQ_ERR_SUCCESS)
   {
     LOG_ERROR("Failed to subscribe: %s", mosquitto_strerror(result));
-    keep_running = 0;
+    mqtt_client_stop();
     /* We might as well disconnect if we were unable to subscribe */
     if ((result = mosquitto_disconnect_v5(mosq, reason_code, props)) != MOSQ_ERR_SUCCESS)
     {
@@ -186,7 +188,7 @@ int main(int argc, char* argv[])
   struct mosquitto* mosq;
   int result = MOSQ_ERR_SUCCESS;
 
-  mqtt_client_obj obj;
+  mqtt_client_obj obj = { 0 };
   obj.handle_message = handle_message;
   obj.mqtt_version = MQTT_VERSION;
 
@@ -209,9 +211,7 @@ int main(int argc, char* argv[])
   }
   else
   {
-    while (keep_running)
-    {
-    }
+    result = mqtt_client_run();
   }
 
   if (mosq != NULL)
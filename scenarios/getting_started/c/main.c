@@ -9,6 +9,7 @@
 #include "logging.h"
 #include "mosquitto.h"
 #include "mqtt_callbacks.h"
+#include "mqtt_event_loop.h"
 #include "mqtt_setup.h"
 
 #define PUB_TOPIC "sample/topic1"
@@ -16,6 +17,21 @@
 #define SUB_TOPIC "sample/+"
 #define QOS_LEVEL 1
 #define MQTT_VERSION MQTT_PROTOCOL_V311
+#define PUBLISH_INTERVAL_MS 5000
+
+/* Called by the event loop timer to publish the sample message. */
+void publish_message(void* context)
+{
+  struct mosquitto* mosq = (struct mosquitto*)context;
+
+  int result = mosquitto_publish_v5(
+      mosq, NULL, PUB_TOPIC, (int)strlen(PAYLOAD), PAYLOAD, QOS_LEVEL, false, NULL);
+
+  if (result != MOSQ_ERR_SUCCESS)
+  {
+    LOG_ERROR("Failure while publishing: %s", mosquitto_strerror(result));
+  }
+}
 
 /* Callback called when the client receives a CONNACK message from the broker and we want to
  * subscribe on connect. */
@@ -38,7 +54,7 @@ void on_connect_with_subscribe(
           != MOSQ_ERR_SUCCESS)
   {
     LOG_ERROR("Failed to subscribe: %s", mosquitto_strerror(result));
-    keep_running = 0;
+    mqtt_client_stop();
     /* We might as well disconnect if we were unable to subscribe */
     if ((result = mosquitto_disconnect_v5(mosq, reason_code, props)) != MOSQ_ERR_SUCCESS)
     {
@@ -76,20 +92,17 @@ int main(int argc, char* argv[])
     LOG_ERROR("Failure starting mosquitto loop: %s", mosquitto_strerror(result));
     result = MOSQ_ERR_UNKNOWN;
   }
+  else if (
+      mqtt_event_loop_add_timer(
+          mqtt_client_event_loop(), 0, PUBLISH_INTERVAL_MS, publish_message, mosq)
+      == NULL)
+  {
+    LOG_ERROR("Failure creating publish timer");
+    result = MOSQ_ERR_UNKNOWN;
+  }
   else
   {
-    while (keep_running)
-    {
-      result = mosquitto_publish_v5(
-          mosq, NULL, PUB_TOPIC, (int)strlen(PAYLOAD), PAYLOAD, QOS_LEVEL, false, NULL);
-
-      if (result != MOSQ_ERR_SUCCESS)
-      {
-        LOG_ERROR("Failure while publishing: %s", mosquitto_strerror(result));
-      }
-
-      sleep(5);
-    }
+    result = mqtt_client_run();
   }
 
   if (mosq != NULL)
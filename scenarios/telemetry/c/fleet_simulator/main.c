@@ -0,0 +1,492 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved. */
+/* SPDX-License-Identifier: MIT */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include "geo_json_handler.h"
+#include "logging.h"
+#include "mosquitto.h"
+#include "mqtt_event_loop.h"
+#include "mqtt_protocol.h"
+#include "mqtt_reactor.h"
+#include "mqtt_setup.h"
+#include "mqtt_token_bucket.h"
+#include "position_codec.h"
+#include "position_geohash.h"
+#include "position_trajectory.h"
+
+#define QOS_LEVEL 1
+#define MQTT_VERSION MQTT_PROTOCOL_V5
+#define DEFAULT_FLEET_VEHICLES 1000
+#define DEFAULT_FLEET_CONNECT_RATE 500
+#define DEFAULT_PUBLISH_INTERVAL_MS 5000
+#define DEFAULT_FLEET_SEED 1
+#define DEFAULT_CLIENT_ID_PREFIX "fleet"
+#define MAX_CLIENT_ID_LENGTH 64
+#define MAX_PAYLOAD_LENGTH 60
+#define PUBLISH_TICK_MS 1
+#define CONNECT_TICK_MS 10
+#define REPORT_INTERVAL_MS 1000
+
+/*
+ * Simulates a fleet of FLEET_VEHICLES vehicles in one process, each with its own connection and
+ * client id (MQTT_CLIENT_ID-<n>, default fleet-<n>) publishing its position to
+ * vehicles/<client id>/position every TELEMETRY_INTERVAL_MS, like the telemetry producer, so that
+ * consumers can be tested against 10k-100k producers.
+ *
+ * All vehicles share the settings of the env file, the TLS context and one event loop thread: the
+ * connections are driven by a mqtt_reactor instead of a network thread each. Vehicles connect at
+ * FLEET_CONNECT_RATE per second and their publishes are spread evenly over the interval with a
+ * token bucket. A vehicle only keeps its mosquitto client, its reactor handle, its client id and
+ * its motion, the topic and payload are written into buffers shared by the whole fleet. The
+ * vehicles drive on a street grid with position_trajectory, the same way for the same FLEET_SEED.
+ *
+ * Every second it prints the vehicles created and connected, the publish rate, the publishes that
+ * failed or wait for their PUBACK, and the memory per vehicle (the growth of the resident set since
+ * the first vehicle was created, divided by the vehicles). For more than about 1000 vehicles, raise
+ * the open file limit (ex. ulimit -n 200000), the simulator raises its soft limit to the hard one.
+ *
+ * Extra settings:
+ *   FLEET_VEHICLES               number of vehicles (default 1000)
+ *   FLEET_CONNECT_RATE           connections opened per second (default 500)
+ *   FLEET_SEED                   seed of the trajectories (default 1)
+ *   TELEMETRY_INTERVAL_MS        time between two positions of a vehicle (default 5000)
+ *   TELEMETRY_ENCODING           json (default) or binary
+ *   TELEMETRY_GEOHASH_PRECISION  precision of the geohash topics positions are also published on,
+ *                                vehicles/geo/<c1>/.../<cp>/<client id>/position (default 0, off)
+ */
+
+typedef struct fleet_vehicle
+{
+  struct mosquitto* mosq;
+  mqtt_reactor_client* client;
+  bool connected;
+  /* Also the <client id> of its topics. */
+  char client_id[MAX_CLIENT_ID_LENGTH];
+} fleet_vehicle;
+
+typedef struct fleet_simulation
+{
+  mqtt_client_connection_settings settings;
+  /* Shared by the clients of all vehicles, mosquitto callbacks get the vehicle instead. */
+  mqtt_client_obj obj;
+  mqtt_reactor reactor;
+  const char* client_id_prefix;
+  fleet_vehicle* vehicles;
+  /* The motion of the vehicles, vehicle i of the fleet drives trajectory i. */
+  trajectory_fleet* trajectories;
+  int vehicle_count;
+  int seed;
+  int created;
+  int connected;
+  int next_publisher;
+  int publish_interval_ms;
+  int geohash_precision;
+  position_encoding encoding;
+  mosquitto_property* props;
+  mosquitto_payload payload;
+  mqtt_token_bucket connect_bucket;
+  mqtt_token_bucket publish_bucket;
+  mqtt_event_timer* connect_timer;
+  /* Publish statistics, all counted on the loop thread. */
+  uint64_t published;
+  uint64_t failed;
+  uint64_t acknowledged;
+  uint64_t reported_published;
+  uint64_t reported_ns;
+  long base_rss_kb;
+} fleet_simulation;
+
+static fleet_simulation simulation = { 0 };
+
+/* The resident set size of the process from /proc/self/status, or -1. */
+static long resident_set_kb()
+{
+  long rss_kb = -1;
+  char line[256];
+  FILE* status = fopen("/proc/self/status", "r");
+  if (status != NULL)
+  {
+    while (fgets(line, sizeof(line), status) != NULL)
+    {
+      if (sscanf(line, "VmRSS: %ld", &rss_kb) == 1)
+      {
+        break;
+      }
+    }
+    fclose(status);
+  }
+  return rss_kb;
+}
+
+static void on_vehicle_connect(
+    struct mosquitto* mosq,
+    void* obj,
+    int reason_code,
+    int flags,
+    const mosquitto_property* props)
+{
+  fleet_vehicle* vehicle = (fleet_vehicle*)obj;
+  if (reason_code != 0)
+  {
+    LOG_ERROR("Vehicle failed to connect: %s", mosquitto_reason_string(reason_code));
+    return;
+  }
+  if (!vehicle->connected)
+  {
+    vehicle->connected = true;
+    simulation.connected++;
+  }
+}
+
+static void on_vehicle_disconnect(
+    struct mosquitto* mosq,
+    void* obj,
+    int reason_code,
+    const mosquitto_property* props)
+{
+  fleet_vehicle* vehicle = (fleet_vehicle*)obj;
+  if (vehicle->connected)
+  {
+    vehicle->connected = false;
+    simulation.connected--;
+  }
+}
+
+static void on_vehicle_publish(
+    struct mosquitto* mosq,
+    void* obj,
+    int mid,
+    int reason_code,
+    const mosquitto_property* props)
+{
+  simulation.acknowledged++;
+}
+
+/* Creates and connects the client of the next vehicle. */
+static bool add_vehicle(fleet_simulation* fleet)
+{
+  fleet_vehicle* vehicle = &fleet->vehicles[fleet->created];
+  int rc;
+
+  /* read_fleet_settings() checked that the id of the last vehicle fits. */
+  snprintf(
+      vehicle->client_id,
+      sizeof(vehicle->client_id),
+      "%s-%d",
+      fleet->client_id_prefix,
+      fleet->created);
+  /* Don't leave the shared settings pointing to the vehicle. */
+  fleet->settings.client_id = vehicle->client_id;
+  vehicle->mosq = mqtt_client_create(&fleet->settings, false, NULL, &fleet->obj);
+  fleet->settings.client_id = fleet->obj.client_id = NULL;
+  if (vehicle->mosq == NULL)
+  {
+    return false;
+  }
+  /* Replace the logging sample callbacks, they would be called for every vehicle. */
+  mosquitto_user_data_set(vehicle->mosq, vehicle);
+  mosquitto_connect_v5_callback_set(vehicle->mosq, on_vehicle_connect);
+  mosquitto_disconnect_v5_callback_set(vehicle->mosq, on_vehicle_disconnect);
+  mosquitto_publish_v5_callback_set(vehicle->mosq, on_vehicle_publish);
+
+  if ((rc = mosquitto_connect_bind_v5(
+           vehicle->mosq,
+           fleet->settings.hostname,
+           fleet->settings.tcp_port,
+           fleet->settings.keep_alive_in_seconds,
+           NULL,
+           NULL))
+      != MOSQ_ERR_SUCCESS)
+  {
+    LOG_ERROR("Failed to connect %s: %s", vehicle->client_id, mosquitto_strerror(rc));
+    return false;
+  }
+  if ((vehicle->client = mqtt_reactor_add_client(&fleet->reactor, vehicle->mosq)) == NULL)
+  {
+    return false;
+  }
+
+  fleet->created++;
+  /* Every vehicle publishes once per interval, a late tick catches up at most one more tick. */
+  fleet->publish_bucket.rate_per_second = fleet->created * 1000.0 / fleet->publish_interval_ms;
+  fleet->publish_bucket.burst = fleet->publish_bucket.rate_per_second * PUBLISH_TICK_MS * 2 / 1000;
+  fleet->publish_bucket.burst = fleet->publish_bucket.burst < 1 ? 1 : fleet->publish_bucket.burst;
+  return true;
+}
+
+/* Called every CONNECT_TICK_MS until the whole fleet is created. */
+static void connect_vehicles(void* context)
+{
+  fleet_simulation* fleet = (fleet_simulation*)context;
+  int count = mqtt_token_bucket_take(
+      &fleet->connect_bucket, mqtt_token_bucket_now_ns(), fleet->vehicle_count - fleet->created);
+
+  for (int i = 0; i < count; i++)
+  {
+    if (!add_vehicle(fleet))
+    {
+      mqtt_client_stop();
+      return;
+    }
+  }
+  if (fleet->created == fleet->vehicle_count)
+  {
+    LOG_INFO(APP_LOG_TAG, "All %d vehicles created", fleet->vehicle_count);
+    mqtt_event_loop_remove_timer(mqtt_client_event_loop(), fleet->connect_timer);
+    fleet->connect_timer = NULL;
+  }
+}
+
+/* Publishes the payload of a vehicle on a topic, counting the publish. */
+static void publish_on(fleet_simulation* fleet, fleet_vehicle* vehicle, const char* topic)
+{
+  if (mqtt_reactor_publish(
+          vehicle->client,
+          NULL,
+          topic,
+          (int)fleet->payload.payload_length,
+          fleet->payload.payload,
+          QOS_LEVEL,
+          false,
+          fleet->props)
+      == MOSQ_ERR_SUCCESS)
+  {
+    fleet->published++;
+  }
+  else
+  {
+    fleet->failed++;
+  }
+}
+
+/* Called every PUBLISH_TICK_MS, publishes the next vehicles in turn as the token bucket allows. */
+static void publish_positions(void* context)
+{
+  fleet_simulation* fleet = (fleet_simulation*)context;
+  char topic[MAX_CLIENT_ID_LENGTH + 32];
+  char geo_topic[POSITION_GEOHASH_FILTER_SIZE + MAX_CLIENT_ID_LENGTH + 32];
+  int count = mqtt_token_bucket_take(
+      &fleet->publish_bucket, mqtt_token_bucket_now_ns(), fleet->created);
+
+  /* Move the vehicles of this tick together, in two ranges when the turn wraps around. */
+  double seconds = fleet->publish_interval_ms / 1000.0;
+  int first = fleet->next_publisher;
+  int head = count < fleet->created - first ? count : fleet->created - first;
+  trajectory_fleet_step_range(fleet->trajectories, first, head, seconds);
+  trajectory_fleet_step_range(fleet->trajectories, 0, count - head, seconds);
+
+  for (int i = 0; i < count; i++)
+  {
+    int index = fleet->next_publisher;
+    fleet_vehicle* vehicle = &fleet->vehicles[index];
+    fleet->next_publisher = (index + 1) % fleet->created;
+
+    snprintf(topic, sizeof(topic), "vehicles/%s/position", vehicle->client_id);
+    geojson_coordinates position = trajectory_fleet_position(fleet->trajectories, index);
+    if (position_to_mosquitto_payload(fleet->encoding, position, &fleet->payload) != 0)
+    {
+      fleet->failed++;
+      continue;
+    }
+    publish_on(fleet, vehicle, topic);
+    if (fleet->geohash_precision > 0)
+    {
+      if (position_geohash_topic(
+              position,
+              fleet->geohash_precision,
+              vehicle->client_id,
+              geo_topic,
+              sizeof(geo_topic))
+          < 0)
+      {
+        fleet->failed++;
+      }
+      else
+      {
+        publish_on(fleet, vehicle, geo_topic);
+      }
+    }
+  }
+}
+
+/* Called every second. Printed rather than logged, so it is kept when LOG_LEVEL compiles out the
+ * INFO messages. */
+static void report(void* context)
+{
+  fleet_simulation* fleet = (fleet_simulation*)context;
+  uint64_t now_ns = mqtt_token_bucket_now_ns();
+  double seconds = (now_ns - fleet->reported_ns) / 1e9;
+  long rss_kb = resident_set_kb();
+
+  printf(
+      "vehicles: %d created, %d connected; publish: %.1f messages/s, %llu failed, %llu outstanding;"
+      " memory: %.1f MB, %.0f bytes/vehicle\n",
+      fleet->created,
+      fleet->connected,
+      (fleet->published - fleet->reported_published) / seconds,
+      (unsigned long long)fleet->failed,
+      (unsigned long long)(fleet->published - fleet->acknowledged),
+      rss_kb / 1024.0,
+      fleet->created > 0 && rss_kb >= 0 ? (rss_kb - fleet->base_rss_kb) * 1024.0 / fleet->created
+                                        : 0);
+
+  fleet->reported_published = fleet->published;
+  fleet->reported_ns = now_ns;
+}
+
+/* Each vehicle needs a file descriptor for its socket. */
+static void raise_open_file_limit(int vehicle_count)
+{
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+  {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < (rlim_t)vehicle_count + 64)
+  {
+    LOG_WARNING(
+        "The open file limit (%lu) is too low for %d vehicles, raise it with ulimit -n",
+        (unsigned long)limit.rlim_cur,
+        vehicle_count);
+  }
+}
+
+static bool read_fleet_settings(fleet_simulation* fleet, char* env_file)
+{
+  char* encoding_name;
+  int connect_rate;
+
+  if (!mqtt_client_setup(env_file, &fleet->settings)
+      || !set_int_connection_setting(
+          &fleet->vehicle_count, "FLEET_VEHICLES", DEFAULT_FLEET_VEHICLES)
+      || fleet->vehicle_count < 1
+      || !set_int_connection_setting(
+          &connect_rate, "FLEET_CONNECT_RATE", DEFAULT_FLEET_CONNECT_RATE)
+      || connect_rate < 1
+      || !set_int_connection_setting(
+          &fleet->publish_interval_ms, "TELEMETRY_INTERVAL_MS", DEFAULT_PUBLISH_INTERVAL_MS)
+      || fleet->publish_interval_ms < 1
+      || !set_int_connection_setting(&fleet->seed, "FLEET_SEED", DEFAULT_FLEET_SEED)
+      || !set_int_connection_setting(
+          &fleet->geohash_precision, "TELEMETRY_GEOHASH_PRECISION", 0)
+      || fleet->geohash_precision < 0 || fleet->geohash_precision > POSITION_GEOHASH_MAX_PRECISION
+      || !set_char_connection_setting(&encoding_name, "TELEMETRY_ENCODING", false)
+      || (encoding_name != NULL && !position_encoding_from_name(encoding_name, &fleet->encoding)))
+  {
+    return false;
+  }
+  if (fleet->encoding == POSITION_ENCODING_STREAM)
+  {
+    /* A stream needs the last position sent by each vehicle, which the consumer tracks per topic,
+     * but it isn't worth the memory here. */
+    LOG_ERROR("The fleet simulator sends json or binary positions, not streams");
+    return false;
+  }
+
+  fleet->client_id_prefix = fleet->settings.client_id != NULL ? fleet->settings.client_id
+                                                              : DEFAULT_CLIENT_ID_PREFIX;
+  if (snprintf(NULL, 0, "%s-%d", fleet->client_id_prefix, fleet->vehicle_count - 1)
+      >= MAX_CLIENT_ID_LENGTH)
+  {
+    LOG_ERROR(
+        "The client id %s is too long, the client ids of %d vehicles must fit in %d characters",
+        fleet->client_id_prefix,
+        fleet->vehicle_count,
+        MAX_CLIENT_ID_LENGTH - 1);
+    return false;
+  }
+  fleet->connect_bucket
+      = mqtt_token_bucket_init(connect_rate, connect_rate / 10.0, mqtt_token_bucket_now_ns());
+  fleet->publish_bucket = mqtt_token_bucket_init(0, 1, mqtt_token_bucket_now_ns());
+  /* The first token is for the first vehicle. */
+  fleet->publish_bucket.tokens = 0;
+  return true;
+}
+
+/* Creates the trajectories of the vehicles, in a city picked by the seed. */
+static trajectory_fleet* create_trajectories(int vehicle_count, int seed)
+{
+  trajectory_rng rng;
+  trajectory_rng_seed(&rng, seed);
+  geojson_coordinates center = { .x = trajectory_rng_between(&rng, -170, 170),
+                                 .y = trajectory_rng_between(&rng, -60, 60) };
+  return trajectory_fleet_create(vehicle_count, trajectory_settings_default(center), seed);
+}
+
+/*
+ * This sample simulates a fleet of vehicles sending telemetry messages to the Broker.
+ */
+int main(int argc, char* argv[])
+{
+  fleet_simulation* fleet = &simulation;
+  mqtt_event_loop* loop = mqtt_client_event_loop();
+  int result = MOSQ_ERR_SUCCESS;
+
+  fleet->obj.mqtt_version = MQTT_VERSION;
+  fleet->encoding = POSITION_ENCODING_JSON;
+  fleet->payload = mosquitto_payload_init(MAX_PAYLOAD_LENGTH);
+
+  if (loop == NULL || !read_fleet_settings(fleet, argv[1])
+      || mosquitto_property_add_string(
+             &fleet->props, MQTT_PROP_CONTENT_TYPE, position_encoding_content_type(fleet->encoding))
+          != MOSQ_ERR_SUCCESS
+      || (fleet->vehicles = calloc(fleet->vehicle_count, sizeof(fleet_vehicle))) == NULL
+      || (fleet->trajectories = create_trajectories(fleet->vehicle_count, fleet->seed)) == NULL
+      || !mqtt_reactor_init(&fleet->reactor, loop))
+  {
+    LOG_ERROR("Failure setting up the fleet");
+    mosquitto_payload_destroy(&fleet->payload);
+    mosquitto_property_free_all(&fleet->props);
+    trajectory_fleet_destroy(fleet->trajectories);
+    free(fleet->vehicles);
+    return MOSQ_ERR_UNKNOWN;
+  }
+
+  raise_open_file_limit(fleet->vehicle_count);
+  fleet->base_rss_kb = resident_set_kb();
+  fleet->reported_ns = mqtt_token_bucket_now_ns();
+  printf(
+      "%zu bytes of state per vehicle, and its mosquitto client\n",
+      sizeof(fleet_vehicle) + TRAJECTORY_BYTES_PER_VEHICLE);
+
+  if ((fleet->connect_timer
+       = mqtt_event_loop_add_timer(loop, 0, CONNECT_TICK_MS, connect_vehicles, fleet))
+          == NULL
+      || mqtt_event_loop_add_timer(loop, 0, PUBLISH_TICK_MS, publish_positions, fleet) == NULL
+      || mqtt_event_loop_add_timer(loop, REPORT_INTERVAL_MS, REPORT_INTERVAL_MS, report, fleet)
+          == NULL)
+  {
+    LOG_ERROR("Failure creating the fleet timers");
+    result = MOSQ_ERR_UNKNOWN;
+  }
+  else
+  {
+    result = mqtt_client_run();
+  }
+
+  /* The loop has stopped, so removing a client frees its handle right away instead of waiting for
+   * a batch of events that will never be dispatched. */
+  for (int i = 0; i < fleet->created; i++)
+  {
+    mqtt_reactor_remove_client(&fleet->reactor, fleet->vehicles[i].client);
+    mosquitto_disconnect_v5(fleet->vehicles[i].mosq, MOSQ_ERR_SUCCESS, NULL);
+    mosquitto_destroy(fleet->vehicles[i].mosq);
+  }
+  /* A vehicle that failed to connect has a client but wasn't counted as created. */
+  if (fleet->created < fleet->vehicle_count && fleet->vehicles[fleet->created].mosq != NULL)
+  {
+    mosquitto_destroy(fleet->vehicles[fleet->created].mosq);
+  }
+  mqtt_reactor_destroy(&fleet->reactor);
+  mosquitto_payload_destroy(&fleet->payload);
+  mosquitto_property_free_all(&fleet->props);
+  trajectory_fleet_destroy(fleet->trajectories);
+  free(fleet->vehicles);
+  mosquitto_lib_cleanup();
+  return result;
+}
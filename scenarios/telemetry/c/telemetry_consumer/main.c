@@ -1,39 +1,487 @@
 /* Copyright (c) Microsoft Corporation. All rights reserved. */
 /* SPDX-License-Identifier: MIT */
 
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <time.h>
 
 #include "geo_json_handler.h"
 #include "logging.h"
 #include "mosquitto.h"
 #include "mqtt_callbacks.h"
+#include "mqtt_compression.h"
+#include "mqtt_event_loop.h"
+#include "mqtt_recorder.h"
 #include "mqtt_setup.h"
+#include "position_codec.h"
+#include "position_geofences.h"
+#include "position_geohash.h"
+#include "position_grid.h"
+#include "position_kinematics.h"
+#include "position_store.h"
+#include "position_stream_codec.h"
 
 #define SUB_TOPIC "vehicles/+/position"
 #define QOS_LEVEL 1
-#define MQTT_VERSION MQTT_PROTOCOL_V311
+#define MQTT_VERSION MQTT_PROTOCOL_V5
+#define MESSAGE_RING_CAPACITY 1024
+#define POLL_BATCH_SIZE 64
+#define DEFAULT_MAX_VEHICLES 100000
+#define GEOFENCE_TOPIC_FORMAT "vehicles/%s/geofences/%s"
+#define GEOFENCE_TOPIC_SIZE \
+  (sizeof(GEOFENCE_TOPIC_FORMAT) + POSITION_STORE_MAX_ID_LENGTH + POSITION_GEOFENCES_MAX_ID_LENGTH)
+#define GEOFENCE_ENTER_PAYLOAD "{\"event\":\"enter\"}"
+#define GEOFENCE_EXIT_PAYLOAD "{\"event\":\"exit\"}"
+#define KINEMATICS_TOPIC_FORMAT "vehicles/%s/kinematics"
+#define KINEMATICS_TOPIC_SIZE (sizeof(KINEMATICS_TOPIC_FORMAT) + POSITION_STORE_MAX_ID_LENGTH)
+#define KINEMATICS_PAYLOAD_FORMAT                              \
+  "{\"start\":%" PRIu64 ",\"seconds\":%.3f,\"fixes\":%" PRIu32 \
+  ",\"meters\":%.1f,\"speed\":%.2f,\"max_speed\":%.2f,\"heading\":%.1f}"
+#define KINEMATICS_PAYLOAD_SIZE 256
+#define KINEMATICS_BATCH_SIZE 256
+#define NANOSECONDS_PER_SECOND 1000000000ull
+#define DEFAULT_REGION_PRECISION 5
+#define DEFAULT_REGION_MAX_FILTERS 16
+#define MAX_REGION_FILTERS 256
+#define BYTES_PER_MB (1024 * 1024)
 
-// Custom callback for when a message is received.
-void print_point_telemetry_message(
-    struct mosquitto* mosq,
-    const struct mosquitto_message* message,
-    const mosquitto_property* props)
+typedef struct telemetry_consumer
+{
+  /* First, so the event loop's source pointer can be cast back to the consumer. */
+  mqtt_event_source source;
+  mqtt_client_obj* obj;
+  struct mosquitto* mosq;
+  geojson_coordinates_batch coordinates;
+  /* The last position of each producer that sends a stream. */
+  position_stream_decoder* streams;
+  /* The positions of a batch, reused for every message. */
+  geojson_geometry positions;
+  /* The last known position of every vehicle, and a spatial index over them, for query threads to
+   * read. */
+  position_store* last_positions;
+  position_grid* grid;
+  /* Positions of vehicles that didn't fit in last_positions. */
+  uint64_t untracked;
+  /* The geofences whose entries and exits are published, or NULL. */
+  position_geofences* geofences;
+  uint64_t geofence_events;
+  /* The distance, speed and heading of every vehicle, or NULL, and the positions waiting to be
+   * added to them together at the end of a poll. */
+  position_kinematics* kinematics;
+  int kinematics_count;
+  int kinematics_vehicles[KINEMATICS_BATCH_SIZE];
+  double kinematics_x[KINEMATICS_BATCH_SIZE];
+  double kinematics_y[KINEMATICS_BATCH_SIZE];
+  uint64_t kinematics_summaries;
+} telemetry_consumer;
+
+/* The topic filters subscribed to on every connect, all positions by default, or the geohash
+ * topics of the cells covering TELEMETRY_REGION. */
+static char region_filters[MAX_REGION_FILTERS][POSITION_GEOHASH_FILTER_SIZE];
+static char* subscriptions[MAX_REGION_FILTERS] = { SUB_TOPIC };
+static int subscription_count = 1;
+
+void print_position(geojson_coordinates coordinates)
+{
+  LOG_DETAIL("type: Point");
+  LOG_DETAIL("coordinates: %f, %f", coordinates.x, coordinates.y);
+}
+
+/* Called for each geofence a vehicle enters or exits, publishes {"event":"enter"} or
+ * {"event":"exit"} on vehicles/<vehicle id>/geofences/<fence id>. */
+void publish_geofence_event(int vehicle, int fence, bool entered, void* context)
+{
+  telemetry_consumer* consumer = (telemetry_consumer*)context;
+  const char* payload = entered ? GEOFENCE_ENTER_PAYLOAD : GEOFENCE_EXIT_PAYLOAD;
+  char topic[GEOFENCE_TOPIC_SIZE];
+  int result;
+
+  snprintf(
+      topic,
+      sizeof(topic),
+      GEOFENCE_TOPIC_FORMAT,
+      position_store_id(consumer->last_positions, vehicle),
+      position_geofences_id(consumer->geofences, fence));
+  LOG_DETAIL("%s %s", topic, payload);
+  if ((result = mosquitto_publish_v5(
+           consumer->mosq, NULL, topic, strlen(payload), payload, QOS_LEVEL, false, NULL))
+      != MOSQ_ERR_SUCCESS)
+  {
+    LOG_ERROR("Failed to publish a geofence event: %s", mosquitto_strerror(result));
+  }
+  else
+  {
+    consumer->geofence_events++;
+  }
+}
+
+/* Called for each window summary of a vehicle, publishes it as JSON on
+ * vehicles/<vehicle id>/kinematics: the start of the window in nanoseconds since the epoch, its
+ * length, the positions received, the meters driven, the mean and max speed in m/s and the last
+ * heading in degrees. */
+void publish_kinematics(int vehicle, const position_kinematics_summary* summary, void* context)
 {
-  geojson_point json_message = geojson_point_init();
+  telemetry_consumer* consumer = (telemetry_consumer*)context;
+  char topic[KINEMATICS_TOPIC_SIZE];
+  char payload[KINEMATICS_PAYLOAD_SIZE];
+  int length;
+  int result;
 
-  int rc = mosquitto_payload_to_geojson_point(message, &json_message);
-  if (rc == 0)
+  snprintf(
+      topic,
+      sizeof(topic),
+      KINEMATICS_TOPIC_FORMAT,
+      position_store_id(consumer->last_positions, vehicle));
+  length = snprintf(
+      payload,
+      sizeof(payload),
+      KINEMATICS_PAYLOAD_FORMAT,
+      summary->start_ns,
+      (double)(summary->end_ns - summary->start_ns) / NANOSECONDS_PER_SECOND,
+      summary->fixes,
+      summary->meters,
+      summary->mean_speed_mps,
+      summary->max_speed_mps,
+      summary->heading_degrees);
+  LOG_DETAIL("%s %s", topic, payload);
+  if ((result = mosquitto_publish_v5(
+           consumer->mosq, NULL, topic, length, payload, QOS_LEVEL, false, NULL))
+      != MOSQ_ERR_SUCCESS)
   {
-    printf("\ttype: %s\n", json_message.type);
-    printf("\tcoordinates: %f, %f\n", json_message.coordinates.x, json_message.coordinates.y);
+    LOG_ERROR("Failed to publish kinematics: %s", mosquitto_strerror(result));
   }
   else
   {
-    LOG_ERROR("Failure parsing JSON: %s", (char*)message->payload);
+    consumer->kinematics_summaries++;
+  }
+}
+
+/* Adds the waiting positions to the kinematics, all received now. */
+void flush_kinematics(telemetry_consumer* consumer)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  position_kinematics_update(
+      consumer->kinematics,
+      consumer->kinematics_vehicles,
+      consumer->kinematics_x,
+      consumer->kinematics_y,
+      consumer->kinematics_count,
+      (uint64_t)now.tv_sec * NANOSECONDS_PER_SECOND + now.tv_nsec,
+      publish_kinematics,
+      consumer);
+  consumer->kinematics_count = 0;
+}
+
+/* Keeps a position as the last position of the vehicle publishing on topic, moves the vehicle in
+ * the grid and through the geofences, queues it for the kinematics and prints the position. */
+void record_position(
+    telemetry_consumer* consumer,
+    const char* topic,
+    geojson_coordinates coordinates)
+{
+  size_t length;
+  const char* id = position_store_topic_vehicle_id(topic, &length);
+  int vehicle;
+  if (id == NULL)
+  {
+    id = position_geohash_topic_vehicle_id(topic, &length);
+  }
+  if (id != NULL)
+  {
+    if ((vehicle = position_store_update(consumer->last_positions, id, length, coordinates)) < 0)
+    {
+      consumer->untracked++;
+    }
+    else
+    {
+      position_grid_update(consumer->grid, vehicle);
+      if (consumer->geofences != NULL)
+      {
+        position_geofences_update(
+            consumer->geofences, vehicle, coordinates, publish_geofence_event, consumer);
+      }
+      if (consumer->kinematics != NULL)
+      {
+        consumer->kinematics_vehicles[consumer->kinematics_count] = vehicle;
+        consumer->kinematics_x[consumer->kinematics_count] = coordinates.x;
+        consumer->kinematics_y[consumer->kinematics_count] = coordinates.y;
+        if (++consumer->kinematics_count == KINEMATICS_BATCH_SIZE)
+        {
+          flush_kinematics(consumer);
+        }
+      }
+    }
+  }
+  print_position(coordinates);
+}
+
+/* Records every position of a message from a batching producer, a GeoJSON MultiPoint or several
+ * binary positions. */
+void record_positions(
+    telemetry_consumer* consumer,
+    position_encoding encoding,
+    const struct mosquitto_message* message)
+{
+  int count = mosquitto_payload_to_positions(encoding, message, &consumer->positions);
+  for (int i = 0; i < count; i++)
+  {
+    record_position(
+        consumer,
+        message->topic,
+        (geojson_coordinates){ .x = consumer->positions.x[i], .y = consumer->positions.y[i] });
+  }
+}
+
+/* Called on the event loop thread when received messages are waiting in the message ring. Messages
+ * are taken in batches so the wakeup and polling costs are shared by the whole batch. The decoder
+ * is picked from each message's content type: binary positions are read directly, stream frames are
+ * applied to the last position of their topic, and JSON ones are parsed together with
+ * geojson_points_decode_batch(). Messages holding a batch of positions are unbatched first. The
+ * kinematics of the vehicles are then updated for the whole batch. */
+void on_messages_ready(mqtt_event_loop* loop, mqtt_event_source* source, uint32_t events)
+{
+  telemetry_consumer* consumer = (telemetry_consumer*)source;
+  mqtt_client_message messages[POLL_BATCH_SIZE];
+  const struct mosquitto_message* json_payloads[POLL_BATCH_SIZE];
+  int json_count = 0;
+
+  int count = mqtt_client_poll(consumer->obj, messages, POLL_BATCH_SIZE, 0);
+  for (int i = 0; i < count; i++)
+  {
+    position_encoding encoding;
+    geojson_coordinates coordinates;
+    if (!position_encoding_from_properties(messages[i].props, &encoding))
+    {
+      continue;
+    }
+    if (position_payload_is_batch(encoding, &messages[i].message))
+    {
+      record_positions(consumer, encoding, &messages[i].message);
+    }
+    else if (encoding == POSITION_ENCODING_JSON)
+    {
+      json_payloads[json_count++] = &messages[i].message;
+    }
+    else if (
+        (encoding == POSITION_ENCODING_STREAM
+             ? position_stream_decode(consumer->streams, &messages[i].message, &coordinates)
+             : mosquitto_payload_to_position(encoding, &messages[i].message, &coordinates))
+        == 0)
+    {
+      record_position(consumer, messages[i].message.topic, coordinates);
+    }
+  }
+
+  if (json_count > 0
+      && geojson_points_decode_batch(json_payloads, json_count, &consumer->coordinates) >= 0)
+  {
+    for (int i = 0; i < json_count; i++)
+    {
+      if (consumer->coordinates.decoded[i])
+      {
+        record_position(
+            consumer,
+            json_payloads[i]->topic,
+            (geojson_coordinates){ .x = consumer->coordinates.x[i],
+                                   .y = consumer->coordinates.y[i] });
+      }
+      else
+      {
+        LOG_ERROR("Failure parsing JSON: %s", (char*)json_payloads[i]->payload);
+      }
+    }
+  }
+  if (consumer->kinematics_count > 0)
+  {
+    flush_kinematics(consumer);
+  }
+  mqtt_client_message_free(messages, count);
+}
+
+bool watch_message_ring(telemetry_consumer* consumer)
+{
+  mqtt_event_loop* loop = mqtt_client_event_loop();
+  consumer->source.fd = mqtt_message_ring_fd(consumer->obj->message_ring);
+  consumer->source.on_event = on_messages_ready;
+  return loop != NULL && mqtt_event_loop_add_source(loop, &consumer->source, EPOLLIN);
+}
+
+/* Reads TELEMETRY_COMPRESSION_DICTIONARY, the dictionary the producers compress with. on_message
+ * then decompresses their messages before they are pushed into the message ring. */
+bool set_compression(mqtt_client_obj* obj)
+{
+  char* dictionary_file;
+  if (!set_char_connection_setting(&dictionary_file, "TELEMETRY_COMPRESSION_DICTIONARY", false))
+  {
+    return false;
+  }
+  if (dictionary_file == NULL)
+  {
+    return true;
+  }
+  obj->compression = mqtt_compression_load(dictionary_file, MQTT_COMPRESSION_DEFAULT_LEVEL);
+  return obj->compression != NULL;
+}
+
+/* Reads TELEMETRY_RECORD_DIRECTORY, the directory every received message is recorded to, in
+ * segments of TELEMETRY_RECORD_SEGMENT_MB (default 64) synced by the TELEMETRY_RECORD_SYNC policy,
+ * none, interval (the default, every TELEMETRY_RECORD_SYNC_MS, default 1000) or segment. */
+bool set_recorder(mqtt_client_obj* obj)
+{
+  mqtt_recorder_options options = mqtt_recorder_options_default();
+  char* directory;
+  char* sync;
+  int segment_mb;
+
+  if (!set_char_connection_setting(&directory, "TELEMETRY_RECORD_DIRECTORY", false)
+      || !set_int_connection_setting(
+          &segment_mb,
+          "TELEMETRY_RECORD_SEGMENT_MB",
+          MQTT_RECORDER_DEFAULT_SEGMENT_BYTES / BYTES_PER_MB)
+      || segment_mb <= 0 || segment_mb >= 4096
+      || !set_char_connection_setting(&sync, "TELEMETRY_RECORD_SYNC", false)
+      || !set_int_connection_setting(
+          &options.sync_interval_ms,
+          "TELEMETRY_RECORD_SYNC_MS",
+          MQTT_RECORDER_DEFAULT_SYNC_INTERVAL_MS))
+  {
+    return false;
+  }
+  if (sync != NULL && !mqtt_recorder_sync_from_name(sync, &options.sync))
+  {
+    LOG_ERROR("Invalid TELEMETRY_RECORD_SYNC: %s", sync);
+    return false;
+  }
+  if (directory == NULL)
+  {
+    return true;
+  }
+  options.segment_bytes = (size_t)segment_mb * BYTES_PER_MB;
+  if ((obj->recorder = mqtt_recorder_create(directory, &options)) != NULL)
+  {
+    LOG_INFO(APP_LOG_TAG, "Recording every message to %s", directory);
+  }
+  return obj->recorder != NULL;
+}
+
+/* Reads TELEMETRY_GEOFENCES, the file of the geofences whose entries and exits are published, one
+ * per line: its id, then its GeoJSON Polygon. */
+bool set_geofences(telemetry_consumer* consumer, int max_vehicles)
+{
+  char* geofences_file;
+  if (!set_char_connection_setting(&geofences_file, "TELEMETRY_GEOFENCES", false))
+  {
+    return false;
+  }
+  if (geofences_file == NULL)
+  {
+    return true;
+  }
+  if ((consumer->geofences = position_geofences_load(geofences_file, max_vehicles)) != NULL)
+  {
+    LOG_INFO(
+        APP_LOG_TAG,
+        "Publishing the entries and exits of %d geofences",
+        position_geofences_count(consumer->geofences));
+  }
+  return consumer->geofences != NULL;
+}
+
+/* Reads TELEMETRY_KINEMATICS_WINDOW_SECONDS, the length of the windows the kinematics of each
+ * vehicle are summarized over, 0 to not compute them, and TELEMETRY_KINEMATICS_PANES, the number of
+ * steps a window slides by, 1 for windows that don't overlap. */
+bool set_kinematics(telemetry_consumer* consumer, int max_vehicles)
+{
+  int window_seconds;
+  int panes;
+  if (!set_int_connection_setting(&window_seconds, "TELEMETRY_KINEMATICS_WINDOW_SECONDS", 0)
+      || window_seconds < 0
+      || !set_int_connection_setting(&panes, "TELEMETRY_KINEMATICS_PANES", 1))
+  {
+    return false;
+  }
+  if (window_seconds == 0)
+  {
+    return true;
+  }
+  if ((consumer->kinematics = position_kinematics_create(
+           max_vehicles, window_seconds * NANOSECONDS_PER_SECOND, panes))
+      != NULL)
+  {
+    LOG_INFO(
+        APP_LOG_TAG,
+        "Publishing the kinematics of the vehicles over windows of %d s sliding by %d s",
+        window_seconds,
+        window_seconds / panes);
   }
+  return consumer->kinematics != NULL;
+}
 
-  geojson_point_destroy(&json_message);
+/* Reads TELEMETRY_REGION, the box "min longitude,min latitude,max longitude,max latitude" whose
+ * positions are received, all of them when it isn't set. The consumer then subscribes to the
+ * geohash topics of at most TELEMETRY_REGION_MAX_FILTERS cells covering the box (default 16), no
+ * finer than TELEMETRY_GEOHASH_PRECISION (default 5), which must not be finer than the precision
+ * the producers publish with. The broker only sends the positions inside those cells, a little
+ * more than the box. */
+bool set_region()
+{
+  char* region;
+  int max_precision;
+  int max_filters;
+  int count;
+  geojson_coordinates min, max;
+  char cells[MAX_REGION_FILTERS][POSITION_GEOHASH_SIZE];
+  if (!set_char_connection_setting(&region, "TELEMETRY_REGION", false)
+      || !set_int_connection_setting(
+          &max_precision, "TELEMETRY_GEOHASH_PRECISION", DEFAULT_REGION_PRECISION)
+      || !set_int_connection_setting(
+          &max_filters, "TELEMETRY_REGION_MAX_FILTERS", DEFAULT_REGION_MAX_FILTERS)
+      || max_filters < 1 || max_filters > MAX_REGION_FILTERS)
+  {
+    return false;
+  }
+  if (region == NULL)
+  {
+    return true;
+  }
+  if (sscanf(region, "%lf,%lf,%lf,%lf", &min.x, &min.y, &max.x, &max.y) != 4
+      || (count = position_geohash_cover(min, max, max_precision, max_filters, cells)) < 0)
+  {
+    LOG_ERROR("Invalid TELEMETRY_REGION: %s", region);
+    return false;
+  }
+  for (int i = 0; i < count; i++)
+  {
+    position_geohash_filter(cells[i], region_filters[i]);
+    subscriptions[i] = region_filters[i];
+    LOG_INFO(APP_LOG_TAG, "Subscribing to %s", subscriptions[i]);
+  }
+  subscription_count = count;
+  return true;
+}
+
+/* Reads TELEMETRY_MAX_VEHICLES, the most vehicles whose last position is kept,
+ * TELEMETRY_GRID_CELL_DEGREES, the size of the cells of the grid indexing them, the geofences
+ * they are checked against and their kinematics. */
+bool set_last_positions(telemetry_consumer* consumer)
+{
+  int max_vehicles;
+  double cell_degrees;
+  if (!set_int_connection_setting(&max_vehicles, "TELEMETRY_MAX_VEHICLES", DEFAULT_MAX_VEHICLES)
+      || max_vehicles <= 0
+      || !set_double_connection_setting(
+          &cell_degrees, "TELEMETRY_GRID_CELL_DEGREES", POSITION_GRID_DEFAULT_CELL_DEGREES))
+  {
+    return false;
+  }
+  consumer->last_positions = position_store_create(max_vehicles);
+  consumer->grid = position_grid_create(consumer->last_positions, max_vehicles, cell_degrees);
+  return consumer->last_positions != NULL && consumer->grid != NULL
+      && set_geofences(consumer, max_vehicles) && set_kinematics(consumer, max_vehicles);
 }
 
 /* Callback called when the client receives a CONNACK message from the broker and we want to
@@ -53,11 +501,12 @@ void on_connect_with_subscribe(
    * connection drops and is automatically resumed by the client, then the
    * subscriptions will be recreated when the client reconnects. */
   if (keep_running
-      && (result = mosquitto_subscribe_v5(mosq, NULL, SUB_TOPIC, QOS_LEVEL, 0, NULL))
+      && (result = mosquitto_subscribe_multiple(
+              mosq, NULL, subscription_count, subscriptions, QOS_LEVEL, 0, NULL))
           != MOSQ_ERR_SUCCESS)
   {
     LOG_ERROR("Failed to subscribe: %s", mosquitto_strerror(result));
-    keep_running = 0;
+    mqtt_client_stop();
     /* We might as well disconnect if we were unable to subscribe */
     if ((result = mosquitto_disconnect_v5(mosq, reason_code, props)) != MOSQ_ERR_SUCCESS)
     {
@@ -71,17 +520,38 @@ void on_connect_with_subscribe(
  */
 int main(int argc, char* argv[])
 {
-  struct mosquitto* mosq;
+  struct mosquitto* mosq = NULL;
   int result = MOSQ_ERR_SUCCESS;
 
-  mqtt_client_obj obj;
-  obj.handle_message = print_point_telemetry_message;
+  mqtt_client_obj obj = { 0 };
   obj.mqtt_version = MQTT_VERSION;
+  /* The network thread only queues messages, they are parsed and printed on the main thread. */
+  obj.message_ring = mqtt_message_ring_create(MESSAGE_RING_CAPACITY);
+
+  telemetry_consumer consumer = { 0 };
+  consumer.obj = &obj;
+  consumer.coordinates = geojson_coordinates_batch_init(POLL_BATCH_SIZE);
+  consumer.streams = position_stream_decoder_create();
+  consumer.positions = geojson_geometry_init();
 
-  if ((mosq = mqtt_client_init(false, argv[1], on_connect_with_subscribe, &obj)) == NULL)
+  if (obj.message_ring == NULL || consumer.coordinates.x == NULL || consumer.streams == NULL
+      || (consumer.mosq = mosq = mqtt_client_init(false, argv[1], on_connect_with_subscribe, &obj))
+          == NULL)
   {
     result = MOSQ_ERR_UNKNOWN;
   }
+  else if (
+      !set_compression(&obj) || !set_recorder(&obj) || !set_last_positions(&consumer)
+      || !set_region())
+  {
+    LOG_ERROR("Failure reading the telemetry settings");
+    result = MOSQ_ERR_UNKNOWN;
+  }
+  else if (!watch_message_ring(&consumer))
+  {
+    LOG_ERROR("Failed to watch the message ring.");
+    result = MOSQ_ERR_UNKNOWN;
+  }
   else if (
       (result = mosquitto_connect_bind_v5(
            mosq, obj.hostname, obj.tcp_port, obj.keep_alive_in_seconds, NULL, NULL))
@@ -97,9 +567,7 @@ int main(int argc, char* argv[])
   }
   else
   {
-    while (keep_running)
-    {
-    }
+    result = mqtt_client_run();
   }
 
   if (mosq != NULL)
@@ -108,6 +576,45 @@ int main(int argc, char* argv[])
     mosquitto_loop_stop(mosq, false);
     mosquitto_destroy(mosq);
   }
+  if (consumer.last_positions != NULL)
+  {
+    LOG_INFO(
+        APP_LOG_TAG,
+        "Last positions of %zu vehicles kept, %" PRIu64 " positions of other vehicles not kept",
+        position_store_count(consumer.last_positions),
+        consumer.untracked);
+  }
+  if (consumer.geofences != NULL)
+  {
+    LOG_INFO(APP_LOG_TAG, "%" PRIu64 " geofence events published", consumer.geofence_events);
+  }
+  if (consumer.kinematics != NULL)
+  {
+    LOG_INFO(
+        APP_LOG_TAG, "%" PRIu64 " kinematics summaries published", consumer.kinematics_summaries);
+  }
+  if (obj.recorder != NULL)
+  {
+    mqtt_recorder_stats stats = mqtt_recorder_get_stats(obj.recorder);
+    LOG_INFO(
+        APP_LOG_TAG,
+        "%" PRIu64 " messages recorded in %" PRIu64 " segments (%" PRIu64 " bytes), %" PRIu64
+        " not recorded",
+        stats.records,
+        stats.segments,
+        stats.bytes,
+        stats.dropped);
+  }
+  mqtt_recorder_destroy(obj.recorder);
+  mqtt_message_ring_destroy(obj.message_ring);
+  mqtt_compression_destroy(obj.compression);
+  geojson_coordinates_batch_destroy(&consumer.coordinates);
+  position_stream_decoder_destroy(consumer.streams);
+  geojson_geometry_destroy(&consumer.positions);
+  position_kinematics_destroy(consumer.kinematics);
+  position_geofences_destroy(consumer.geofences);
+  position_grid_destroy(consumer.grid);
+  position_store_destroy(consumer.last_positions);
   mosquitto_lib_cleanup();
   return result;
 }
@@ -9,21 +9,363 @@
 #include "geo_json_handler.h"
 #include "logging.h"
 #include "mosquitto.h"
+#include "mqtt_compression.h"
+#include "mqtt_event_loop.h"
+#include "mqtt_protocol.h"
 #include "mqtt_setup.h"
+#include "mqtt_token_bucket.h"
+#include "position_batcher.h"
+#include "position_codec.h"
+#include "position_geohash.h"
+#include "position_stream_codec.h"
+#include "position_trajectory.h"
 
 #define QOS_LEVEL 1
-#define MQTT_VERSION MQTT_PROTOCOL_V311
+#define MQTT_VERSION MQTT_PROTOCOL_V5
+#define DEFAULT_PUBLISH_INTERVAL_MS 5000
+/* In rate mode, the bucket is checked every millisecond at high rates, and at most every second. */
+#define MIN_PACING_INTERVAL_MS 1
+#define MAX_PACING_INTERVAL_MS 1000
+#define REPORT_INTERVAL_MS 1000
 
 /* We format the doubles to 6 decimal points, and the format is fixed, so the max length is when
- * both coordinates are negative, ex {"type":"Point","coordinates":[-83.551071,-36.169784]} which is
- * 54
+ * both coordinates are negative, ex {"type":"Point","coordinates":[-122.335071,-36.169784]} which
+ * is 55. Binary positions are always POSITION_BINARY_PAYLOAD_LENGTH (16), and stream frames at most
+ * POSITION_STREAM_MAX_FRAME_LENGTH (21). Batches are written by the position_batcher to its own
+ * payload.
  */
 #define MAX_PAYLOAD_LENGTH 60
 
-double generate_random_coordinate()
+/* What rate mode reports every second, counted on the event loop thread that publishes. */
+typedef struct publish_stats
 {
-  double scale = rand() / (double)RAND_MAX;
-  return (scale * (180)) - 90;
+  uint64_t positions;
+  uint64_t published;
+  uint64_t failed;
+  uint64_t publish_ns_total;
+  uint64_t publish_ns_max;
+} publish_stats;
+
+static publish_stats stats = { 0 };
+/* Counted on the network thread. */
+static uint64_t acknowledged = 0;
+
+typedef struct position_publisher
+{
+  struct mosquitto* mosq;
+  char* topic;
+  const char* client_id;
+  /* Geohash mode: positions are also published on the geohash topic of this precision, 0 when
+   * off, written to geo_topic of geo_topic_size. */
+  int geohash_precision;
+  char* geo_topic;
+  size_t geo_topic_size;
+  /* The last position, a batch is published on the geohash topic of its last position. */
+  geojson_coordinates position;
+  mosquitto_payload payload;
+  position_encoding encoding;
+  /* The content type of the encoding, so consumers can pick the decoder. */
+  mosquitto_property* props;
+  /* The state of the stream encoding: the last position sent. */
+  position_stream_encoder stream;
+  /* Collects the JSON and binary positions into batches, NULL for streams. */
+  position_batcher* batcher;
+  /* Compresses every payload when TELEMETRY_COMPRESSION_DICTIONARY is set, NULL otherwise. */
+  mqtt_compression* compression;
+  /* Drives the vehicle, a fleet of one, for step_seconds between two positions. */
+  trajectory_fleet* vehicle;
+  double step_seconds;
+  /* Rate mode: the target positions per second, 0 to publish every TELEMETRY_INTERVAL_MS. */
+  double rate;
+  mqtt_token_bucket bucket;
+  publish_stats reported;
+  uint64_t reported_ns;
+} position_publisher;
+
+/* Reads TELEMETRY_ENCODING, "json" (the default), "binary" or "stream", and for streams
+ * TELEMETRY_KEYFRAME_INTERVAL. */
+bool set_position_encoding(position_encoding* encoding, position_stream_encoder* stream)
+{
+  char* name;
+  int keyframe_interval;
+  *encoding = POSITION_ENCODING_JSON;
+  if (!set_char_connection_setting(&name, "TELEMETRY_ENCODING", false)
+      || (name != NULL && !position_encoding_from_name(name, encoding)))
+  {
+    return false;
+  }
+  if (*encoding == POSITION_ENCODING_STREAM)
+  {
+    if (!set_int_connection_setting(
+            &keyframe_interval,
+            "TELEMETRY_KEYFRAME_INTERVAL",
+            POSITION_STREAM_DEFAULT_KEYFRAME_INTERVAL)
+        || keyframe_interval < 1)
+    {
+      return false;
+    }
+    *stream = position_stream_encoder_init(keyframe_interval);
+  }
+  return true;
+}
+
+/* Reads TELEMETRY_BATCH_SIZE, the most positions in a message (default 1, no batching),
+ * TELEMETRY_BATCH_MAX_BYTES, the largest batch payload (default 0, no limit) and
+ * TELEMETRY_BATCH_LATENCY_MS, how long a position may wait for its batch to fill (default 0, no
+ * limit). */
+bool set_batch_policy(position_batch_policy* policy)
+{
+  int max_bytes;
+  int max_latency_ms;
+  if (!set_int_connection_setting(&policy->max_count, "TELEMETRY_BATCH_SIZE", 1)
+      || !set_int_connection_setting(&max_bytes, "TELEMETRY_BATCH_MAX_BYTES", 0)
+      || !set_int_connection_setting(&max_latency_ms, "TELEMETRY_BATCH_LATENCY_MS", 0)
+      || policy->max_count < 1 || max_bytes < 0 || max_latency_ms < 0)
+  {
+    return false;
+  }
+  policy->max_bytes = (size_t)max_bytes;
+  policy->max_latency_ms = (uint32_t)max_latency_ms;
+  return true;
+}
+
+/* Reads TELEMETRY_COMPRESSION_DICTIONARY, a dictionary from tools/dictionary_trainer.c. When it is
+ * set, payloads are compressed with it and tagged with content-encoding=zstd, and consumers need
+ * the same dictionary. Needs the PAYLOAD_COMPRESSION cmake option. */
+bool set_compression(mqtt_compression** compression, mosquitto_property** props)
+{
+  char* dictionary_file;
+  *compression = NULL;
+  if (!set_char_connection_setting(&dictionary_file, "TELEMETRY_COMPRESSION_DICTIONARY", false))
+  {
+    return false;
+  }
+  if (dictionary_file == NULL)
+  {
+    return true;
+  }
+  *compression = mqtt_compression_load(dictionary_file, MQTT_COMPRESSION_DEFAULT_LEVEL);
+  return *compression != NULL && mqtt_compression_add_property(props) == MOSQ_ERR_SUCCESS;
+}
+
+/* Reads TELEMETRY_GEOHASH_PRECISION, the precision of the geohash topics positions are also
+ * published on, vehicles/geo/<c1>/.../<cp>/<client id>/position (default 0, off). */
+bool set_geohash_precision(int* precision)
+{
+  return set_int_connection_setting(precision, "TELEMETRY_GEOHASH_PRECISION", 0) && *precision >= 0
+      && *precision <= POSITION_GEOHASH_MAX_PRECISION;
+}
+
+/* Publishes a payload on a topic, timing the publish call. */
+int publish_on(position_publisher* publisher, const char* topic, const void* data, int length)
+{
+  uint64_t start_ns = mqtt_token_bucket_now_ns();
+  int result = mosquitto_publish_v5(
+      publisher->mosq, NULL, topic, length, data, QOS_LEVEL, false, publisher->props);
+  uint64_t publish_ns = mqtt_token_bucket_now_ns() - start_ns;
+  stats.publish_ns_total += publish_ns;
+  stats.publish_ns_max = publish_ns > stats.publish_ns_max ? publish_ns : stats.publish_ns_max;
+  /* Counted per message, each one is acknowledged on its own. */
+  if (result == MOSQ_ERR_SUCCESS)
+  {
+    stats.published++;
+  }
+  return result;
+}
+
+/* Called by the position_batcher with each batch of positions. */
+int publish_payload(const mosquitto_payload* payload, int count, void* context)
+{
+  position_publisher* publisher = (position_publisher*)context;
+  const void* data = payload->payload;
+  int length = payload->payload_length;
+  int result = MOSQ_ERR_SUCCESS;
+
+  if (publisher->compression != NULL)
+  {
+    result = mqtt_compression_compress(
+        publisher->compression, payload->payload, payload->payload_length, &data, &length);
+  }
+  if (result == MOSQ_ERR_SUCCESS)
+  {
+    result = publish_on(publisher, publisher->topic, data, length);
+  }
+  if (result == MOSQ_ERR_SUCCESS && publisher->geohash_precision > 0)
+  {
+    if (position_geohash_topic(
+            publisher->position,
+            publisher->geohash_precision,
+            publisher->client_id,
+            publisher->geo_topic,
+            publisher->geo_topic_size)
+        < 0)
+    {
+      result = MOSQ_ERR_INVAL;
+    }
+    else
+    {
+      result = publish_on(publisher, publisher->geo_topic, data, length);
+    }
+  }
+
+  if (result != MOSQ_ERR_SUCCESS && publisher->rate > 0)
+  {
+    /* Counted and reported every second instead, there may be thousands per second. */
+    stats.failed++;
+  }
+  else if (result != MOSQ_ERR_SUCCESS)
+  {
+    LOG_ERROR("Failure while publishing %d positions: %s", count, mosquitto_strerror(result));
+  }
+  return result;
+}
+
+/* Called by the event loop timer with the vehicle's new position. Stream frames are published right
+ * away, other positions are added to the current batch. */
+void publish_position(void* context)
+{
+  position_publisher* publisher = (position_publisher*)context;
+
+  trajectory_fleet_step(publisher->vehicle, publisher->step_seconds);
+  geojson_coordinates position = trajectory_fleet_position(publisher->vehicle, 0);
+  publisher->position = position;
+  stats.positions++;
+  if (publisher->batcher != NULL)
+  {
+    position_batcher_add(publisher->batcher, position);
+  }
+  else if (position_stream_encode(&publisher->stream, position, &publisher->payload) == 0)
+  {
+    publish_payload(&publisher->payload, 1, publisher);
+  }
+}
+
+/* Rate mode: called by the event loop timer every pacing interval, publishes as many positions as
+ * the token bucket allows. */
+void publish_paced_positions(void* context)
+{
+  position_publisher* publisher = (position_publisher*)context;
+  int count = mqtt_token_bucket_take(&publisher->bucket, mqtt_token_bucket_now_ns(), INT32_MAX);
+  for (int i = 0; i < count && keep_running; i++)
+  {
+    publish_position(publisher);
+  }
+}
+
+/* Rate mode: replaces the logging on_publish, which would be called for every message. */
+void on_publish_counted(
+    struct mosquitto* mosq,
+    void* obj,
+    int mid,
+    int reason_code,
+    const mosquitto_property* props)
+{
+  __atomic_fetch_add(&acknowledged, 1, __ATOMIC_RELAXED);
+}
+
+/* Rate mode: called by the event loop timer every second. */
+void report_rate(void* context)
+{
+  position_publisher* publisher = (position_publisher*)context;
+  uint64_t now_ns = mqtt_token_bucket_now_ns();
+  double seconds = (now_ns - publisher->reported_ns) / 1e9;
+  uint64_t outstanding = stats.published - __atomic_load_n(&acknowledged, __ATOMIC_RELAXED);
+  uint64_t calls
+      = stats.published + stats.failed - publisher->reported.published - publisher->reported.failed;
+
+  /* Printed rather than logged, so it is kept when LOG_LEVEL compiles out the INFO messages. */
+  printf(
+      "rate: %.1f positions/s (target %g), %.1f messages/s, %llu failed; publish call: %.2f us "
+      "average, %.2f us max; outstanding QoS 1: %llu\n",
+      (stats.positions - publisher->reported.positions) / seconds,
+      publisher->rate,
+      (stats.published - publisher->reported.published) / seconds,
+      (unsigned long long)(stats.failed - publisher->reported.failed),
+      calls > 0 ? (stats.publish_ns_total - publisher->reported.publish_ns_total) / 1e3 / calls : 0,
+      stats.publish_ns_max / 1e3,
+      (unsigned long long)outstanding);
+
+  publisher->reported = stats;
+  publisher->reported_ns = now_ns;
+  stats.publish_ns_max = 0;
+}
+
+/* Reads TELEMETRY_SEED, the seed of the vehicle's trajectory, by default a hash of the client id
+ * so that each vehicle drives its own way, and the same way every run. The seed also picks the city
+ * the vehicle drives in. */
+bool set_trajectory(position_publisher* publisher, const char* client_id)
+{
+  uint64_t hash = 14695981039346656037ull;
+  trajectory_rng rng;
+  int seed;
+
+  /* FNV-1a */
+  for (const char* c = client_id; *c != '\0'; c++)
+  {
+    hash = (hash ^ (unsigned char)*c) * 1099511628211ull;
+  }
+  if (!set_int_connection_setting(&seed, "TELEMETRY_SEED", (int)(hash & INT32_MAX)))
+  {
+    return false;
+  }
+
+  trajectory_rng_seed(&rng, seed);
+  geojson_coordinates center = { .x = trajectory_rng_between(&rng, -170, 170),
+                                 .y = trajectory_rng_between(&rng, -60, 60) };
+  publisher->vehicle = trajectory_fleet_create(1, trajectory_settings_default(center), seed);
+  return publisher->vehicle != NULL;
+}
+
+/* Reads TELEMETRY_RATE, the positions to publish per second. When it is set (ex. 0.2 for one every
+ * 5 seconds, or 100000), positions are paced with a token bucket instead of every
+ * TELEMETRY_INTERVAL_MS and the achieved rate is reported every second. Acknowledgements are then
+ * counted by on_publish_counted, which is set here since callbacks must not change once the network
+ * thread runs. */
+bool set_publish_rate(struct mosquitto* mosq, double* rate, int* publish_interval_ms)
+{
+  if (!set_double_connection_setting(rate, "TELEMETRY_RATE", 0) || *rate < 0
+      || !set_int_connection_setting(
+          publish_interval_ms, "TELEMETRY_INTERVAL_MS", DEFAULT_PUBLISH_INTERVAL_MS)
+      || *publish_interval_ms < 1)
+  {
+    LOG_ERROR("Failure reading the telemetry rate settings");
+    return false;
+  }
+  if (*rate > 0)
+  {
+    mosquitto_publish_v5_callback_set(mosq, on_publish_counted);
+  }
+  return true;
+}
+
+/* Publishes every publish_interval_ms, or paced to publisher->rate when it is set. */
+bool start_publishing(position_publisher* publisher, int publish_interval_ms)
+{
+  mqtt_event_loop* loop = mqtt_client_event_loop();
+
+  if (publisher->rate == 0)
+  {
+    publisher->step_seconds = publish_interval_ms / 1000.0;
+    return mqtt_event_loop_add_timer(loop, 0, publish_interval_ms, publish_position, publisher)
+        != NULL;
+  }
+
+  /* Check the bucket about once per position, but no more often than every millisecond, and let a
+   * late timer catch up with two intervals of positions. */
+  double interval_ms = 1000 / publisher->rate;
+  interval_ms = interval_ms < MIN_PACING_INTERVAL_MS ? MIN_PACING_INTERVAL_MS : interval_ms;
+  interval_ms = interval_ms > MAX_PACING_INTERVAL_MS ? MAX_PACING_INTERVAL_MS : interval_ms;
+  publisher->step_seconds = 1 / publisher->rate;
+  publisher->bucket = mqtt_token_bucket_init(
+      publisher->rate, publisher->rate * interval_ms / 1000 * 2, mqtt_token_bucket_now_ns());
+  publisher->reported_ns = mqtt_token_bucket_now_ns();
+
+  return mqtt_event_loop_add_timer(
+             loop, 0, (uint32_t)interval_ms, publish_paced_positions, publisher)
+      != NULL
+      && mqtt_event_loop_add_timer(
+             loop, REPORT_INTERVAL_MS, REPORT_INTERVAL_MS, report_rate, publisher)
+      != NULL;
 }
 
 /*
@@ -33,6 +375,8 @@ int main(int argc, char* argv[])
 {
   struct mosquitto* mosq;
   int result = MOSQ_ERR_SUCCESS;
+  double rate;
+  int publish_interval_ms;
 
   mqtt_client_obj obj = { 0 };
   obj.mqtt_version = MQTT_VERSION;
@@ -41,6 +385,10 @@ int main(int argc, char* argv[])
   {
     result = MOSQ_ERR_UNKNOWN;
   }
+  else if (!set_publish_rate(mosq, &rate, &publish_interval_ms))
+  {
+    result = MOSQ_ERR_INVAL;
+  }
   else if (
       (result = mosquitto_connect_bind_v5(
            mosq, obj.hostname, obj.tcp_port, obj.keep_alive_in_seconds, NULL, NULL))
@@ -58,33 +406,74 @@ int main(int argc, char* argv[])
   {
     char topic[strlen(obj.client_id) + 17];
     sprintf(topic, "vehicles/%s/position", obj.client_id);
-    mosquitto_payload payload = mosquitto_payload_init(MAX_PAYLOAD_LENGTH);
-    geojson_point json_point = geojson_point_init();
-    strcpy(json_point.type, "Point");
+    char geo_topic
+        [sizeof(POSITION_GEOHASH_TOPIC_PREFIX) + 2 * POSITION_GEOHASH_MAX_PRECISION
+         + strlen(obj.client_id) + sizeof(POSITION_GEOHASH_TOPIC_SUFFIX)];
+    position_publisher publisher = { .mosq = mosq,
+                                     .topic = topic,
+                                     .client_id = obj.client_id,
+                                     .geo_topic = geo_topic,
+                                     .geo_topic_size = sizeof(geo_topic),
+                                     .payload = mosquitto_payload_init(MAX_PAYLOAD_LENGTH),
+                                     .props = NULL,
+                                     .batcher = NULL,
+                                     .compression = NULL,
+                                     .vehicle = NULL,
+                                     .rate = rate };
+    position_batch_policy policy;
 
-    while (keep_running)
+    if (!set_position_encoding(&publisher.encoding, &publisher.stream)
+        || !set_batch_policy(&policy) || !set_geohash_precision(&publisher.geohash_precision)
+        || mosquitto_property_add_string(
+               &publisher.props,
+               MQTT_PROP_CONTENT_TYPE,
+               position_encoding_content_type(publisher.encoding))
+            != MOSQ_ERR_SUCCESS
+        || !set_compression(&publisher.compression, &publisher.props)
+        || !set_trajectory(&publisher, obj.client_id))
+    {
+      LOG_ERROR("Failure reading the telemetry settings");
+      result = MOSQ_ERR_UNKNOWN;
+    }
+    else if (publisher.encoding == POSITION_ENCODING_STREAM && policy.max_count > 1)
+    {
+      LOG_ERROR("Stream positions can't be batched, unset TELEMETRY_BATCH_SIZE");
+      result = MOSQ_ERR_INVAL;
+    }
+    else if (publisher.encoding == POSITION_ENCODING_STREAM && publisher.geohash_precision > 0)
+    {
+      /* A stream frame is a difference from the last frame on its topic, and vehicles change
+       * geohash topics as they drive. */
+      LOG_ERROR("Stream positions can't be published on geohash topics, unset the precision");
+      result = MOSQ_ERR_INVAL;
+    }
+    else if (
+        publisher.encoding != POSITION_ENCODING_STREAM
+        && (publisher.batcher = position_batcher_create(
+                publisher.encoding, policy, mqtt_client_event_loop(), publish_payload, &publisher))
+            == NULL)
+    {
+      result = MOSQ_ERR_UNKNOWN;
+    }
+    else if (!start_publishing(&publisher, publish_interval_ms))
+    {
+      LOG_ERROR("Failure creating publish timer");
+      result = MOSQ_ERR_UNKNOWN;
+    }
+    else
+    {
+      result = mqtt_client_run();
+    }
+    /* Send the positions still waiting in the current batch before disconnecting. */
+    if (publisher.batcher != NULL)
     {
-      geojson_point_set_coordinates(
-          &json_point, generate_random_coordinate(), generate_random_coordinate());
-      if (geojson_point_to_mosquitto_payload(json_point, &payload) != 0)
-      {
-        result = MOSQ_ERR_UNKNOWN;
-      }
-      else
-      {
-        result = mosquitto_publish_v5(
-            mosq, NULL, topic, payload.payload_length, payload.payload, QOS_LEVEL, false, NULL);
-      }
-
-      if (result != MOSQ_ERR_SUCCESS)
-      {
-        LOG_ERROR("Failure while publishing: %s", mosquitto_strerror(result));
-      }
-
-      sleep(5);
+      position_batcher_flush(publisher.batcher);
     }
-    mosquitto_payload_destroy(&payload);
-    geojson_point_destroy(&json_point);
+    position_batcher_destroy(publisher.batcher);
+    mqtt_compression_destroy(publisher.compression);
+    trajectory_fleet_destroy(publisher.vehicle);
+    mosquitto_payload_destroy(&publisher.payload);
+    mosquitto_property_free_all(&publisher.props);
   }
 
   if (mosq != NULL)